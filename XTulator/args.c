@@ -18,10 +18,12 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include "config.h"
 #include "timing.h"
+#include "hostthread.h"
 #include "machine.h"
 #include "cpu/cpu.h"
 #include "chipset/i8259.h"
@@ -34,15 +36,23 @@
 #endif
 #ifdef USE_NE2000
 #include "modules/io/pcap-win32.h"
+#include "modules/io/nat.h"
 #endif
 #include "modules/input/mouse.h"
 #include "modules/disk/biosdisk.h"
 #include "modules/audio/pcspeaker.h"
 #include "modules/audio/opl2.h"
 #include "modules/audio/blaster.h"
+#include "modules/audio/oplthread.h"
 #include "modules/video/cga.h"
 #include "modules/video/vga.h"
+#include "modules/video/frameskip.h"
+#include "modules/video/sdlconsole.h"
 #include "debuglog.h"
+#include "bench.h"
+#include "instances.h"
+#include "capture.h"
+#include "control.h"
 
 double speedarg = 0;
 
@@ -80,19 +90,70 @@ void args_showHelp() {
 	printf("  -speed <mhz>           Run the emulated CPU at approximately <mhz> MHz. (Default is as fast as possible)\r\n");
 	printf("                         There is currently no clock ticks counted per instruction, so the emulator is just going\r\n");
 	printf("                         to estimate how many instructions would come out to approximately the desired speed.\r\n");
-	printf("                         There will be more accurate speed-throttling at some point in the future.\r\n\r\n");
+	printf("                         There will be more accurate speed-throttling at some point in the future.\r\n");
+	printf("                         F10 toggles fast-forward, which runs flat out until it's pressed again.\r\n");
+	printf("  -cpucore <type>        Use <type> CPU core. (Default is interp)\r\n");
+	printf("                         interp: Plain interpreter.\r\n");
+	printf("                         cached: Interpreter that caches decoded prefixes and ModRM bytes of\r\n");
+	printf("                                 executed code.\r\n");
+	printf("                         block:  Decode cache plus translation of hot real mode code into\r\n");
+	printf("                                 pre-decoded blocks that run without the interpreter's dispatch.\r\n");
+	printf("  -clock <type>          Use <type> as the time base for emulated devices. (Default is host)\r\n");
+	printf("                         host:  Devices run on the host's real time clock.\r\n");
+	printf("                         guest: Devices run on emulated time counted from executed instructions,\r\n");
+	printf("                                which is paced to real time. -speed sets the instruction rate.\r\n");
+	printf("                         max:   Same as guest, but not paced. Runs as fast as possible.\r\n");
+	printf("  -idle                  Spot guests polling for input (INT 16h status checks, INT 28h, or tight loops\r\n");
+	printf("                         that change nothing) and let the host rest until the next timer, like HLT.\r\n");
+	printf("  -loadstate <file>      Resume from the snapshot in <file> instead of booting. It must have been saved\r\n");
+	printf("                         with the same machine, video card, memory size and hardware options.\r\n");
+	printf("  -savestate <file>      Save a snapshot of the whole machine to <file> when the emulator exits.\r\n");
+	printf("  -checkpoint <file> <s> Write a checkpoint to <file>.0, <file>.1, ... every <s> seconds of emulated\r\n");
+	printf("                         time. Most hold only the memory changed since the one before, and -loadstate\r\n");
+	printf("                         on any of them rebuilds memory from that chain. Needs the earlier files.\r\n\r\n");
 
 	printf("Disk options:\r\n");
 	printf("  -fd0 <file>            Insert <file> disk image as floppy 0.\r\n");
 	printf("  -fd1 <file>            Insert <file> disk image as floppy 1.\r\n");
 	printf("  -hd0 <file>            Insert <file> disk image as hard disk 0.\r\n");
 	printf("  -hd1 <file>            Insert <file> disk image as hard disk 1.\r\n");
-	printf("  -boot <disk>           Use <disk> (fd0, fd1, hd0 or hd1) as boot disk.\r\n\r\n");
+	printf("                         Any <file> above can be given as <base>,overlay=<cow> to leave <base>\r\n");
+	printf("                         untouched and keep guest writes in the overlay file <cow>, which is\r\n");
+	printf("                         created if it doesn't exist.\r\n");
+	printf("  -packimage <raw> <out> Compress the disk image <raw> into the packed image <out> and exit. Packed\r\n");
+	printf("                         images insert like raw ones but are read-only, unless used as an overlay's\r\n");
+	printf("                         <base>. Mostly empty images shrink to a fraction of their size.\r\n");
+	printf("  -boot <disk>           Use <disk> (fd0, fd1, hd0 or hd1) as boot disk.\r\n");
+#ifndef USE_DISK_HLE
+	printf("  -fdcfast               Have the floppy controller move whole reads from a track cache in one DMA\r\n");
+	printf("                         burst instead of one byte at a time.\r\n");
+#endif
+	printf("\r\n");
 
 	printf("Video options:\r\n");
 	printf("  -video <type>          Use <type> (CGA or VGA) video card emulation. (Default is machine-dependent)\r\n");
 	printf("  -fpslock <FPS>         Attempt to lock video refresh to <FPS> frames per second.\r\n");
-	printf("                         (Default is to base FPS on video adapter timings and is dynamic)\r\n\r\n");
+	printf("                         (Default is to base FPS on video adapter timings and is dynamic)\r\n");
+	printf("  -minfps <FPS>          When the host can't keep up, skip frames to keep the emulation at speed,\r\n");
+	printf("                         drawing no fewer than <FPS> a second. 0 never skips. (Default is %u)\r\n", FRAMESKIP_MINFPS);
+#ifdef USE_GL_PRESENTER
+	printf("  -gpu <mode>            Present through an OpenGL 2.0 shader in a resizable window. VGA graphics modes\r\n");
+	printf("                         are sent as palette indices and looked up on the GPU. <mode> is integer for\r\n");
+	printf("                         whole multiples of the mode's size, or sharp to fill the window at 4:3.\r\n");
+#endif
+	printf("  -headless              Run without a window, audio output or render thread. Video memory is still\r\n");
+	printf("                         emulated, but nothing is drawn unless -framedump, -vnc or -capture is given.\r\n");
+	printf("  -framedump <file> <s>  In headless mode, draw the screen every <s> seconds of emulated time and\r\n");
+	printf("                         write it to <file> as a PPM image.\r\n");
+#ifdef ENABLE_VNC
+	printf("  -vnc [<addr>:]<port>   Serve the screen, keyboard and mouse to a VNC viewer on <port>, headless or\r\n");
+	printf("                         not. Listens on 127.0.0.1 unless <addr> is given. There is no password, so\r\n");
+	printf("                         reach it through an SSH tunnel rather than opening it to a network.\r\n");
+#endif
+	printf("  -capture <file>        Record the screen and sound to the AVI <file>, as uncompressed video at %u\r\n", CAPTURE_FPS);
+	printf("                         frames per second and 16 bit PCM audio. Frames are dropped rather than slow\r\n");
+	printf("                         the emulator down, and a new file is started when the screen size changes.\r\n");
+	printf("\r\n");
 
 	printf("Serial options:\r\n");
 #ifdef ENABLE_TCP_MODEM
@@ -125,7 +186,11 @@ void args_showHelp() {
 	printf("Networking options:\r\n");
 	printf("  -net <id>              Initialize emulated NE2000 adapter using physical interface number specified\r\n");
 	printf("                         by <id>. Use \"-net list\" to display available interfaces. NE2000 will be\r\n");
-	printf("                         available to guest system at base port 0x300, IRQ 2.\r\n\r\n");
+	printf("                         available to guest system at base port 0x300, IRQ 2.\r\n");
+	printf("  -net nat               Initialize the NE2000 with built in user mode NAT instead, which needs no\r\n");
+	printf("                         pcap or root. DHCP gives the guest 10.0.2.15, the gateway is 10.0.2.2 and\r\n");
+	printf("                         reaches the host's own 127.0.0.1, DNS is 10.0.2.3. TCP and UDP only.\r\n");
+	printf("  -netdns <ip>           Name server -net nat relays DNS to. (Default is the host's)\r\n\r\n");
 #endif
 
 	printf("Miscellaneous options:\r\n");
@@ -133,7 +198,62 @@ void args_showHelp() {
 	printf("                         The maximum size is 736 KB, but this can only work with CGA video and a\r\n");
 	printf("                         system BIOS that will test beyond 640 KB.\r\n");
 	printf("  -debug <level>         <level> can be: NONE, ERROR, INFO, DETAIL. (Default is INFO)\r\n");
+	printf("  -debugsub <list>       Also log the messages of the devices in the comma separated <list>, which can\r\n");
+	printf("                         have DMA, VGA, CGA, PIT, PIC, PPI, UART, TCPMODEM, PCSPEAKER, MEMORY, PORTS,\r\n");
+	printf("                         TIMING, OPL2, BLASTER, FDC, NE2000, PCAP or ALL. Most need -debug detail.\r\n");
+	printf("  -logfile <file>        Write the log to <file> instead of stderr.\r\n");
 	printf("  -mips                  Display live MIPS being emulated.\r\n");
+	printf("  -profile               Count instructions per opcode, I/O per port and MMIO accesses, and time timer\r\n");
+	printf("                         callbacks, rendering and blitting. A summary is logged when the emulator exits.\r\n");
+	printf("  -profilecsv <file> <s> Same as -profile, and also append the running counters to the CSV <file>\r\n");
+	printf("                         every <s> seconds.\r\n");
+	printf("  -sample <n>            Record the guest CS:IP every <n> instructions. The most frequent addresses\r\n");
+	printf("                         are logged when the emulator exits, or when F12 is pressed.\r\n");
+	printf("  -samplemap <map> <seg> Show sampled addresses as symbols from the linker MAP file <map>, for a program\r\n");
+	printf("                         loaded at hex segment <seg>.\r\n");
+	printf("  -trace <file>          Record every instruction executed, with the registers going into it, to the\r\n");
+	printf("                         binary trace <file>.\r\n");
+	printf("  -tracedump <file>      Print the instructions in the trace <file> and exit.\r\n");
+	printf("  -record <file>         Record keyboard, mouse, modem and network input to <file>, with the\r\n");
+	printf("                         instruction each went in at, so the run can be repeated exactly with -replay.\r\n");
+	printf("                         Uses the guest clock unless -clock max is given.\r\n");
+	printf("  -replay <file>         Repeat a run recorded with -record, feeding in its input instead of the\r\n");
+	printf("                         host's. Start with the same machine, options and disk images.\r\n");
+#ifdef ENABLE_CONTROL
+	printf("  -control <path>        Take commands on the Unix domain socket <path>, one per line: type <text>,\r\n");
+	printf("                         keys <hex>..., screen, wait <s> <text>, pause, resume, save <file>, load\r\n");
+	printf("                         <file>, insert <drive> <file>, eject <drive>, speed <MHz>, turbo on|off,\r\n");
+	printf("                         metrics and quit. Each gets an OK or ERR reply, in order. Local scripts only,\r\n");
+	printf("                         anyone who can open <path> can control the machine.\r\n");
+#endif
+#ifdef ENABLE_METRICS
+	printf("  -metrics [<ip>:]<port> Serve live counters in the Prometheus text format at /metrics on <port>:\r\n");
+	printf("                         instructions per second, guest time, timer callbacks, audio underruns,\r\n");
+	printf("                         frames, disk and network traffic, and each thread role's CPU time. Listens\r\n");
+	printf("                         on 127.0.0.1 unless <ip> is given.\r\n");
+#endif
+#ifdef USE_BENCH
+	printf("  -bench <n>             Benchmark: run headless and unpaced for <n> instructions (0 for no limit),\r\n");
+	printf("                         then report the speed, peak memory use and -profile counts.\r\n");
+	printf("  -benchstop <p>[:<v>]   End the benchmark early when the guest writes hex port <p>, optionally only\r\n");
+	printf("                         when it writes the hex value <v>. For example 80:FF stops on POST code FFh.\r\n");
+#endif
+	printf("  -instances <n>         Run <n> independent copies of the machine, each in its own process. Any %%d\r\n");
+	printf("                         in a disk, snapshot, checkpoint, profile or frame dump path becomes the\r\n");
+	printf("                         copy's number (0 to <n>-1), and tcpmodem and VNC listen ports are offset\r\n");
+	printf("                         by it.\r\n");
+	printf("  -oplthread             Run OPL synthesis on its own thread. Frees up the main thread on multi-core\r\n");
+	printf("                         hosts, at the cost of about 10 ms of extra OPL latency.\r\n");
+	printf("  -hugepages             Back guest RAM, VGA memory and the memory map and block tables with 2 MB\r\n");
+	printf("                         pages to cut TLB misses, where the host has them. On Windows this needs the\r\n");
+	printf("                         \"Lock pages in memory\" right.\r\n");
+	printf("  -videohle              Handle the BIOS text output calls (INT 10h teletype, scroll, write character\r\n");
+	printf("                         and write string) in the emulator instead of running the video BIOS.\r\n");
+	printf("  -affinity <role>:<cpu> Pin the threads of <role> to the host CPUs in <cpu>, a list like 2 or 0,4-5.\r\n");
+	printf("                         <role> is cpu (the emulation loop), render, audio, net or io (disk cache,\r\n");
+	printf("                         logging, trace, capture and checkpoint writers). Once cpu is pinned, roles\r\n");
+	printf("                         without CPUs of their own keep off its CPUs. Can be given once per role.\r\n");
+	printf("  -priority <role>:<lvl> Run the threads of <role> at priority <lvl>: low, normal, high or realtime.\r\n");
 	printf("  -h                     Show this help screen.\r\n");
 }
 
@@ -171,33 +291,110 @@ int args_parse(MACHINE_t* machine, int argc, char* argv[]) {
 			}
 			speedarg = atof(argv[++i]);
 		}
+		else if (args_isMatch(argv[i], "-cpucore")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -cpucore. Use -h for help.\r\n");
+				return -1;
+			}
+			if (args_isMatch(argv[i + 1], "interp")) machine->CPU.core = CPU_CORE_INTERP;
+			else if (args_isMatch(argv[i + 1], "cached")) machine->CPU.core = CPU_CORE_CACHED;
+			else if (args_isMatch(argv[i + 1], "block")) machine->CPU.core = CPU_CORE_BLOCK;
+			else {
+				printf("%s is an invalid CPU core option\r\n", argv[i + 1]);
+				return -1;
+			}
+			i++;
+		}
+		else if (args_isMatch(argv[i], "-idle")) {
+			machine->CPU.idledetect = 1;
+		}
+		else if (args_isMatch(argv[i], "-clock")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -clock. Use -h for help.\r\n");
+				return -1;
+			}
+			if (args_isMatch(argv[i + 1], "host")) timing_setMode(TIMING_MODE_HOST);
+			else if (args_isMatch(argv[i + 1], "guest")) timing_setMode(TIMING_MODE_GUEST);
+			else if (args_isMatch(argv[i + 1], "max")) timing_setMode(TIMING_MODE_MAX);
+			else {
+				printf("%s is an invalid clock option\r\n", argv[i + 1]);
+				return -1;
+			}
+			i++;
+		}
+		else if (args_isMatch(argv[i], "-instances")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -instances. Use -h for help.\r\n");
+				return -1;
+			}
+			i++; //instances_scan already acted on it
+		}
+		else if (args_isMatch(argv[i], "-instanceid")) { //internal, how a copy on Windows learns its number
+			if ((i + 1) == argc) {
+				printf("Parameter required for -instanceid. Use -h for help.\r\n");
+				return -1;
+			}
+			instance_id = (uint32_t)atol(argv[++i]);
+			instance_child = 1;
+		}
+		else if (args_isMatch(argv[i], "-loadstate")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -loadstate. Use -h for help.\r\n");
+				return -1;
+			}
+			loadstate = instances_path(argv[++i]);
+		}
+		else if (args_isMatch(argv[i], "-savestate")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -savestate. Use -h for help.\r\n");
+				return -1;
+			}
+			savestate = instances_path(argv[++i]);
+		}
+		else if (args_isMatch(argv[i], "-checkpoint")) {
+			if ((i + 2) >= argc) {
+				printf("Parameter required for -checkpoint. Use -h for help.\r\n");
+				return -1;
+			}
+			checkpointfile = instances_path(argv[++i]);
+			checkpointinterval = atof(argv[++i]);
+			if (checkpointinterval <= 0) {
+				printf("%f is an invalid checkpoint interval\r\n", checkpointinterval);
+				return -1;
+			}
+		}
+#ifndef USE_DISK_HLE
+		else if (args_isMatch(argv[i], "-fdcfast")) {
+			fdcfast = 1;
+		}
+#endif
 		else if (args_isMatch(argv[i], "-fd0")) {
 			if ((i + 1) == argc) {
 				printf("Parameter required for -fd0. Use -h for help.\r\n");
 				return -1;
 			}
-			biosdisk_insert(&machine->CPU, 0, argv[++i]);
+			biosdisk_insert(&machine->CPU, 0, instances_path(argv[++i]));
 		}
 		else if (args_isMatch(argv[i], "-fd1")) {
 			if ((i + 1) == argc) {
 				printf("Parameter required for -fd1. Use -h for help.\r\n");
 				return -1;
 			}
-			biosdisk_insert(&machine->CPU, 1, argv[++i]);
+			biosdisk_insert(&machine->CPU, 1, instances_path(argv[++i]));
 		}
 		else if (args_isMatch(argv[i], "-hd0")) {
 			if ((i + 1) == argc) {
 				printf("Parameter required for -hd0. Use -h for help.\r\n");
 				return -1;
 			}
-			biosdisk_insert(&machine->CPU, 2, argv[++i]);
+			biosdisk_insert(&machine->CPU, 2, instances_path(argv[++i]));
 		}
 		else if (args_isMatch(argv[i], "-hd1")) {
 			if ((i + 1) == argc) {
 				printf("Parameter required for -hd1. Use -h for help.\r\n");
 				return -1;
 			}
-			biosdisk_insert(&machine->CPU, 3, argv[++i]);
+			biosdisk_insert(&machine->CPU, 3, instances_path(argv[++i]));
 		}
 		else if (args_isMatch(argv[i], "-boot")) {
 			if ((i + 1) == argc) {
@@ -238,6 +435,32 @@ int args_parse(MACHINE_t* machine, int argc, char* argv[]) {
 				return -1;
 			}
 		}
+		else if (args_isMatch(argv[i], "-minfps")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -minfps. Use -h for help.\r\n");
+				return -1;
+			}
+			frameskip_minFPS = atof(argv[++i]);
+			if ((frameskip_minFPS < 0) || (frameskip_minFPS > 144)) {
+				printf("%f is an invalid minimum FPS, valid range is 0 to 144\r\n", frameskip_minFPS);
+				return -1;
+			}
+		}
+#ifdef USE_GL_PRESENTER
+		else if (args_isMatch(argv[i], "-gpu")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -gpu. Use -h for help.\r\n");
+				return -1;
+			}
+			if (args_isMatch(argv[i + 1], "integer")) sdlconsole_gpu = SDLCONSOLE_GPU_INTEGER;
+			else if (args_isMatch(argv[i + 1], "sharp")) sdlconsole_gpu = SDLCONSOLE_GPU_SHARP;
+			else {
+				printf("%s is an invalid GPU scaling mode\r\n", argv[i + 1]);
+				return -1;
+			}
+			i++;
+		}
+#endif
 		else if (args_isMatch(argv[i], "-mem")) {
 			if ((i + 1) == argc) {
 				printf("Parameter required for -mem. Use -h for help.\r\n");
@@ -264,9 +487,225 @@ int args_parse(MACHINE_t* machine, int argc, char* argv[]) {
 			}
 			i++;
 		}
+		else if (args_isMatch(argv[i], "-debugsub")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -debugsub. Use -h for help.\r\n");
+				return -1;
+			}
+			if (debug_parseMask(argv[i + 1])) {
+				return -1;
+			}
+			i++;
+		}
+		else if (args_isMatch(argv[i], "-logfile")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -logfile. Use -h for help.\r\n");
+				return -1;
+			}
+			if (debug_setFile(argv[i + 1])) {
+				return -1;
+			}
+			i++;
+		}
 		else if (args_isMatch(argv[i], "-mips")) {
 			showMIPS = 1;
 		}
+		else if (args_isMatch(argv[i], "-profile")) {
+			profiling = 1;
+		}
+		else if (args_isMatch(argv[i], "-profilecsv")) {
+			if ((i + 2) >= argc) {
+				printf("Parameter required for -profilecsv. Use -h for help.\r\n");
+				return -1;
+			}
+			profiling = 1;
+			profilecsv = instances_path(argv[++i]);
+			profilecsvinterval = atof(argv[++i]);
+			if (profilecsvinterval <= 0) {
+				printf("%f is an invalid profile CSV interval\r\n", profilecsvinterval);
+				return -1;
+			}
+		}
+		else if (args_isMatch(argv[i], "-sample")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -sample. Use -h for help.\r\n");
+				return -1;
+			}
+			sampleinterval = atol(argv[++i]);
+			if (sampleinterval == 0) {
+				printf("Sample interval must be at least 1 instruction.\r\n");
+				return -1;
+			}
+		}
+		else if (args_isMatch(argv[i], "-samplemap")) {
+			if ((i + 2) >= argc) {
+				printf("Parameter required for -samplemap. Use -h for help.\r\n");
+				return -1;
+			}
+			samplemap = argv[++i];
+			samplemapseg = (uint16_t)strtol(argv[++i], NULL, 16);
+		}
+		else if (args_isMatch(argv[i], "-trace")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -trace. Use -h for help.\r\n");
+				return -1;
+			}
+			tracefile = argv[++i];
+		}
+		else if (args_isMatch(argv[i], "-packimage")) {
+			if ((i + 2) >= argc) {
+				printf("Parameter required for -packimage. Use -h for help.\r\n");
+				return -1;
+			}
+			packsrc = argv[++i];
+			packdst = argv[++i];
+		}
+		else if (args_isMatch(argv[i], "-tracedump")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -tracedump. Use -h for help.\r\n");
+				return -1;
+			}
+			tracedumpfile = argv[++i];
+		}
+		else if (args_isMatch(argv[i], "-record") || args_isMatch(argv[i], "-replay")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for %s. Use -h for help.\r\n", argv[i]);
+				return -1;
+			}
+			if (args_isMatch(argv[i], "-record")) recordfile = argv[++i];
+			else replayfile = argv[++i];
+			if (timing_mode == TIMING_MODE_HOST) timing_setMode(TIMING_MODE_GUEST); //inputs have to go in at an instruction count, not a host time
+		}
+#ifdef USE_BENCH
+		else if (args_isMatch(argv[i], "-bench")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -bench. Use -h for help.\r\n");
+				return -1;
+			}
+			benchinstructions = strtoull(argv[++i], NULL, 10);
+			benchmode = 1;
+			headless = 1;
+			profiling = 1;
+			timing_setMode(TIMING_MODE_MAX); //guest time follows the instruction count, so runs are repeatable
+		}
+		else if (args_isMatch(argv[i], "-benchstop")) {
+			char* value;
+			if ((i + 1) == argc) {
+				printf("Parameter required for -benchstop. Use -h for help.\r\n");
+				return -1;
+			}
+			bench_stopPort = (uint32_t)strtol(argv[++i], &value, 16) & 0x0FFF;
+			bench_stopValue = (*value == ':') ? (uint16_t)(strtol(value + 1, NULL, 16) & 0xFF) : BENCH_ANYVALUE;
+		}
+#endif
+		else if (args_isMatch(argv[i], "-hugepages")) {
+			hugepages = 1;
+		}
+		else if (args_isMatch(argv[i], "-videohle")) {
+			videohle = 1;
+		}
+		else if (args_isMatch(argv[i], "-affinity")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -affinity. Use -h for help.\r\n");
+				return -1;
+			}
+			if (hostthread_setAffinity(argv[++i])) {
+				printf("%s is an invalid affinity option\r\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (args_isMatch(argv[i], "-priority")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -priority. Use -h for help.\r\n");
+				return -1;
+			}
+			if (hostthread_setPriority(argv[++i])) {
+				printf("%s is an invalid priority option\r\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (args_isMatch(argv[i], "-oplthread")) {
+			oplthread_enabled = 1;
+		}
+		else if (args_isMatch(argv[i], "-headless")) {
+			headless = 1;
+		}
+#ifdef ENABLE_VNC
+		else if (args_isMatch(argv[i], "-vnc")) {
+			char* colon;
+			if ((i + 1) == argc) {
+				printf("Parameter required for -vnc. Use -h for help.\r\n");
+				return -1;
+			}
+			i++;
+			colon = strrchr(argv[i], ':');
+			if (colon != NULL) {
+				*colon = 0;
+				vncaddr = argv[i];
+				vncport = (uint16_t)atol(colon + 1);
+			}
+			else {
+				vncport = (uint16_t)atol(argv[i]);
+			}
+			if (vncport == 0) {
+				printf("%s is an invalid VNC port\r\n", (colon != NULL) ? colon + 1 : argv[i]);
+				return -1;
+			}
+			vncport += (uint16_t)instance_id;
+		}
+#endif
+		else if (args_isMatch(argv[i], "-framedump")) {
+			if ((i + 2) >= argc) {
+				printf("Parameter required for -framedump. Use -h for help.\r\n");
+				return -1;
+			}
+			framedump = instances_path(argv[++i]);
+			framedumpinterval = atof(argv[++i]);
+			if (framedumpinterval <= 0) {
+				printf("%f is an invalid frame dump interval\r\n", framedumpinterval);
+				return -1;
+			}
+		}
+#ifdef ENABLE_CONTROL
+		else if (args_isMatch(argv[i], "-control")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -control. Use -h for help.\r\n");
+				return -1;
+			}
+			controlpath = instances_path(argv[++i]);
+		}
+#endif
+#ifdef ENABLE_METRICS
+		else if (args_isMatch(argv[i], "-metrics")) {
+			char* colon;
+			if ((i + 1) == argc) {
+				printf("Parameter required for -metrics. Use -h for help.\r\n");
+				return -1;
+			}
+			i++;
+			colon = strrchr(argv[i], ':');
+			if (colon != NULL) {
+				*colon = 0;
+				metricsaddr = argv[i];
+				metricsport = (uint16_t)atol(colon + 1);
+			}
+			else {
+				metricsport = (uint16_t)atol(argv[i]);
+			}
+			if (metricsport == 0) {
+				printf("%s is an invalid metrics port\r\n", (colon != NULL) ? colon + 1 : argv[i]);
+				return -1;
+			}
+			metricsport += (uint16_t)instance_id;
+		}
+#endif
+		else if (args_isMatch(argv[i], "-capture")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -capture. Use -h for help.\r\n");
+				return -1;
+			}
+			capturefile = instances_path(argv[++i]);
+		}
 		else if (args_isMatch(argv[i], "-baud")) {
 			if ((i + 1) == argc) {
 				printf("Parameter required for -baud. Use -h for help.\r\n");
@@ -306,16 +745,15 @@ int args_parse(MACHINE_t* machine, int argc, char* argv[]) {
 				else {
 					port = (uint16_t)atol(argv[++i]);
 				}
-				uart_init(&machine->UART[uartnum], &machine->i8259, base, irq, (void*)tcpmodem_tx, &machine->tcpmodem[uartnum], NULL, NULL);
+				port += (uint16_t)instance_id;
+				uart_init(&machine->UART[uartnum], &machine->i8259, base, irq, (void*)tcpmodem_tx, &machine->tcpmodem[uartnum], (void*)tcpmodem_mcr, &machine->tcpmodem[uartnum]);
 				tcpmodem_init(&machine->tcpmodem[uartnum], &machine->UART[uartnum], port);
-				timing_addTimer(tcpmodem_rxpoll, &machine->tcpmodem[uartnum], baudrate / 9, TIMING_ENABLED);
 			} else
 #endif
 				if (args_isMatch(argv[i + 1], "mouse")) {
 				i++;
 				uart_init(&machine->UART[uartnum], &machine->i8259, base, irq, NULL, NULL, (void*)mouse_togglereset, NULL);
 				mouse_init(&machine->UART[uartnum]);
-				timing_addTimer(mouse_rxpoll, NULL, baudrate / 9, TIMING_ENABLED);
 			}
 			else if (args_isMatch(argv[i + 1], "none")) {
 				i++;
@@ -358,7 +796,7 @@ int args_parse(MACHINE_t* machine, int argc, char* argv[]) {
 #ifdef USE_NE2000
 		else if (args_isMatch(argv[i], "-net")) {
 			if ((i + 1) == argc) {
-				printf("Parameter required for -list. Use -h for help.\r\n");
+				printf("Parameter required for -net. Use -h for help.\r\n");
 				return -1;
 			}
 			i++;
@@ -366,9 +804,21 @@ int args_parse(MACHINE_t* machine, int argc, char* argv[]) {
 				pcap_listdevs();
 				return -1;
 			}
-			machine->pcap_if = atoi(argv[i]);
+			if (args_isMatch(argv[i], "nat")) {
+				machine->netnat = 1;
+			}
+			else {
+				machine->pcap_if = atoi(argv[i]);
+			}
 			machine->hwflags |= MACHINE_HW_NE2000;
 		}
+		else if (args_isMatch(argv[i], "-netdns")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -netdns. Use -h for help.\r\n");
+				return -1;
+			}
+			nat_dns = argv[++i];
+		}
 #endif
 		else {
 			printf("%s is not a valid parameter. Use -h for help.\r\n", argv[i]);
@@ -0,0 +1,133 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Benchmark harness, only in builds with USE_BENCH ("build.sh bench", or the
+	Bench configuration of the solution).
+
+	-bench <n> boots the selected machine headless with the guest clock counted
+	in instructions and unpaced, so a run does the same work every time no
+	matter how fast the host is. It stops after <n> instructions, or earlier
+	when the guest writes the -benchstop port, e.g. a POST code on port 80h or
+	an I/O port the workload pokes when it's done. Then it reports wall time,
+	instructions per second and peak memory use. -bench turns on -profile as
+	well, its summary comes first and has the per-device counts.
+
+	The last line is machine readable, for scripts comparing commits:
+
+		BENCH,<machine>,<instructions>,<seconds>,<ips>,<peak RSS KB>,<stop reason>
+*/
+
+#include "config.h"
+
+#ifdef USE_BENCH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <SDL.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "debuglog.h"
+#include "memory.h"
+#include "bench.h"
+
+uint8_t bench_enabled = 0;
+uint32_t bench_stopPort = 0xFFFFFFFF; //none
+uint16_t bench_stopValue = BENCH_ANYVALUE;
+uint64_t bench_limit = 0, bench_done = 0, bench_start = 0;
+char* bench_reason = "instruction limit";
+
+//from port_write, on every guest OUT
+void bench_portWrite(uint16_t portnum, uint8_t value) {
+	if (!bench_enabled || (portnum != bench_stopPort)) return;
+	if ((bench_stopValue != BENCH_ANYVALUE) && (value != bench_stopValue)) return;
+	bench_reason = "stop port";
+	running = 0;
+}
+
+//Shortens a CPU slice so the run ends on exactly the requested instruction count
+uint32_t bench_slice(uint32_t want) {
+	if (!bench_enabled || (bench_limit == 0)) return want;
+	if ((bench_limit - bench_done) < want) return (uint32_t)(bench_limit - bench_done);
+	return want;
+}
+
+void bench_ran(uint32_t instructions) {
+	if (!bench_enabled) return;
+	bench_done += instructions;
+	if ((bench_limit > 0) && (bench_done >= bench_limit)) {
+		running = 0;
+	}
+}
+
+//Peak resident set size in KB, 0 if it can't be had
+static uint64_t bench_peakRSS() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+	return (uint64_t)pmc.PeakWorkingSetSize >> 10;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage)) return 0;
+#ifdef __APPLE__
+	return (uint64_t)usage.ru_maxrss >> 10; //bytes there, KB on Linux and the BSDs
+#else
+	return (uint64_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+void bench_report() {
+	double seconds, ips;
+	uint64_t rss;
+
+	if (!bench_enabled) return;
+	seconds = (double)(SDL_GetPerformanceCounter() - bench_start) / (double)SDL_GetPerformanceFrequency();
+	ips = (seconds > 0) ? (double)bench_done / seconds : 0;
+	rss = bench_peakRSS();
+
+	debug_log(DEBUG_INFO, "[BENCH] Machine:      %s\r\n", usemachine);
+	debug_log(DEBUG_INFO, "[BENCH] Stopped by:   %s\r\n", bench_reason);
+	debug_log(DEBUG_INFO, "[BENCH] Instructions: %llu\r\n", (unsigned long long)bench_done);
+	debug_log(DEBUG_INFO, "[BENCH] Wall time:    %.03f seconds\r\n", seconds);
+	debug_log(DEBUG_INFO, "[BENCH] Speed:        %.0f instructions per second (%.02f MIPS)\r\n", ips, ips / 1000000.0);
+	debug_log(DEBUG_INFO, "[BENCH] Peak RSS:     %llu KB\r\n", (unsigned long long)rss);
+	debug_log(DEBUG_INFO, "[BENCH] Guest RAM:    %lu KB touched\r\n", (unsigned long)memory_touchedPages() * (MEMORY_PAGE_SIZE >> 10));
+	printf("BENCH,%s,%llu,%.03f,%.0f,%llu,%s\r\n", usemachine, (unsigned long long)bench_done, seconds, ips, (unsigned long long)rss, bench_reason);
+}
+
+//instructions may be 0 to run until the stop port is written
+int bench_init(uint64_t instructions) {
+	if ((instructions == 0) && (bench_stopPort == 0xFFFFFFFF)) {
+		debug_log(DEBUG_ERROR, "[BENCH] Needs an instruction count or a stop port, or it would never end\r\n");
+		return -1;
+	}
+	bench_limit = instructions;
+	bench_done = 0;
+	bench_start = SDL_GetPerformanceCounter();
+	bench_enabled = 1;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+#include "config.h"
+
+#ifdef USE_BENCH
+
+#define BENCH_ANYVALUE	0xFFFF //bench_stopValue when any write to the stop port ends the run
+
+extern uint8_t bench_enabled;
+extern uint32_t bench_stopPort;
+extern uint16_t bench_stopValue;
+
+void bench_portWrite(uint16_t portnum, uint8_t value);
+uint32_t bench_slice(uint32_t want);
+void bench_ran(uint32_t instructions);
+int bench_init(uint64_t instructions);
+void bench_report();
+
+#endif
+
+#endif
@@ -0,0 +1,587 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Audio and video capture, enabled with -capture <file>.
+
+	The render thread hands finished frames to capture_frame and the mixer
+	hands its sample blocks to capture_audio. Both only copy into a
+	single-producer/single-consumer queue, CAPTURE_SLOTS frames and
+	CAPTURE_AUDIORING samples, and an encoder thread writes them out. When a
+	queue is full the frame or block is dropped and counted, so a slow disk
+	never holds up rendering or emulation.
+
+	The file is an AVI with uncompressed 24 bit video at CAPTURE_FPS and
+	16 bit mono PCM audio at SAMPLE_RATE, which anything can play or convert.
+	Frames are taken from the render thread at most once per CAPTURE_FPS tick
+	of host time, and ticks with nothing new, or whose frame was dropped, get
+	an empty video chunk that players show as the previous frame again. That
+	keeps the video in step with the clock and costs nothing while the screen
+	is still. Audio only flows once the sound device is open and not while
+	fast-forwarding, so silence is written in its place when it falls more than
+	CAPTURE_AUDIOSLACK behind the video.
+
+	A frame size change, or a file reaching CAPTURE_SEGMENT bytes, closes the
+	file and carries on in a new one, named with -2, -3 and so on before the
+	extension.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+#endif
+#include "config.h"
+#include "debuglog.h"
+#include "utility.h"
+#include "capture.h"
+#include "hostthread.h"
+
+volatile uint8_t capture_enabled = 0;
+
+CAPTURE_FRAME_t* capture_slots = NULL;
+SDL_atomic_t capture_frameHead, capture_frameTail;
+int16_t capture_ring[CAPTURE_AUDIORING];
+SDL_atomic_t capture_audioHead, capture_audioTail;
+volatile uint8_t capture_quit = 0, capture_done = 0;
+uint64_t capture_start, capture_freq;
+
+//render thread side
+uint64_t capture_last = 0; //tick the last frame was queued or dropped in
+uint8_t capture_queued = 0, capture_stale = 1; //stale: there's a change the encoder hasn't been given
+
+//encoder thread side
+char* capture_name = NULL;
+FILE* capture_file = NULL;
+uint32_t capture_segment = 0, capture_w = 0, capture_h = 0;
+uint32_t capture_movi; //bytes in the movi list after its type, which is also where the next chunk goes in the index
+uint32_t capture_segFrames, capture_segSamples;
+uint64_t capture_next = 0; //tick the next video chunk is for
+CAPTURE_INDEX_t* capture_index = NULL;
+uint32_t capture_indexCount = 0, capture_indexSize = 0;
+uint8_t* capture_image = NULL; //last frame as written, bottom-up BGR rows padded to 4 bytes
+uint32_t capture_imageLen = 0;
+uint8_t capture_error = 0;
+
+uint64_t capture_frames = 0, capture_repeats = 0, capture_dropped = 0;
+uint64_t capture_samples = 0, capture_silence = 0, capture_audioDropped = 0, capture_bytes = 0;
+
+static uint8_t* capture_id(uint8_t* dst, const char* id) {
+	memcpy(dst, id, 4);
+	return dst + 4;
+}
+
+static uint8_t* capture_put16(uint8_t* dst, uint16_t value) {
+	dst[0] = (uint8_t)value;
+	dst[1] = (uint8_t)(value >> 8);
+	return dst + 2;
+}
+
+static uint8_t* capture_put32(uint8_t* dst, uint32_t value) {
+	capture_put16(dst, (uint16_t)value);
+	capture_put16(dst + 2, (uint16_t)(value >> 16));
+	return dst + 4;
+}
+
+static uint64_t capture_tick() {
+	return (SDL_GetPerformanceCounter() - capture_start) * CAPTURE_FPS / capture_freq;
+}
+
+static void capture_write(const void* data, uint32_t len) {
+	if (capture_error) return;
+	if (fwrite(data, 1, len, capture_file) != len) {
+		debug_log(DEBUG_ERROR, "[CAPTURE] Unable to write to the capture file, stopping\r\n");
+		capture_error = 1;
+		return;
+	}
+	capture_bytes += len;
+}
+
+/*
+	Everything ahead of the first chunk, with the sizes and counts as they
+	stand, so it's written with zeroes when a file is opened and again over
+	the top when it's closed.
+*/
+static uint32_t capture_header(uint8_t* dst, uint32_t riffsize) {
+	uint8_t* p = dst;
+	uint32_t i;
+
+	p = capture_id(p, "RIFF");
+	p = capture_put32(p, riffsize);
+	p = capture_id(p, "AVI ");
+	p = capture_id(p, "LIST");
+	p = capture_put32(p, 4 + 64 + (12 + 64 + 48) + (12 + 64 + 26));
+	p = capture_id(p, "hdrl");
+
+	p = capture_id(p, "avih");
+	p = capture_put32(p, 56);
+	p = capture_put32(p, 1000000 / CAPTURE_FPS);
+	p = capture_put32(p, capture_imageLen * CAPTURE_FPS + SAMPLE_RATE * 2);
+	p = capture_put32(p, 0);
+	p = capture_put32(p, 0x110); //AVIF_HASINDEX | AVIF_ISINTERLEAVED
+	p = capture_put32(p, capture_segFrames);
+	p = capture_put32(p, 0);
+	p = capture_put32(p, 2); //streams
+	p = capture_put32(p, capture_imageLen);
+	p = capture_put32(p, capture_w);
+	p = capture_put32(p, capture_h);
+	for (i = 0; i < 4; i++) {
+		p = capture_put32(p, 0);
+	}
+
+	p = capture_id(p, "LIST");
+	p = capture_put32(p, 4 + 64 + 48);
+	p = capture_id(p, "strl");
+	p = capture_id(p, "strh");
+	p = capture_put32(p, 56);
+	p = capture_id(p, "vids");
+	p = capture_id(p, "DIB ");
+	p = capture_put32(p, 0); //flags
+	p = capture_put32(p, 0); //priority and language
+	p = capture_put32(p, 0); //initial frames
+	p = capture_put32(p, 1); //scale
+	p = capture_put32(p, CAPTURE_FPS); //rate
+	p = capture_put32(p, 0); //start
+	p = capture_put32(p, capture_segFrames);
+	p = capture_put32(p, capture_imageLen);
+	p = capture_put32(p, 0xFFFFFFFF); //quality
+	p = capture_put32(p, 0); //sample size
+	p = capture_put16(p, 0);
+	p = capture_put16(p, 0);
+	p = capture_put16(p, (uint16_t)capture_w);
+	p = capture_put16(p, (uint16_t)capture_h);
+	p = capture_id(p, "strf");
+	p = capture_put32(p, 40);
+	p = capture_put32(p, 40); //BITMAPINFOHEADER
+	p = capture_put32(p, capture_w);
+	p = capture_put32(p, capture_h); //positive, rows go bottom up
+	p = capture_put16(p, 1); //planes
+	p = capture_put16(p, 24); //bits per pixel
+	p = capture_put32(p, 0); //BI_RGB
+	p = capture_put32(p, capture_imageLen);
+	for (i = 0; i < 4; i++) {
+		p = capture_put32(p, 0);
+	}
+
+	p = capture_id(p, "LIST");
+	p = capture_put32(p, 4 + 64 + 26);
+	p = capture_id(p, "strl");
+	p = capture_id(p, "strh");
+	p = capture_put32(p, 56);
+	p = capture_id(p, "auds");
+	p = capture_put32(p, 0); //handler
+	p = capture_put32(p, 0);
+	p = capture_put32(p, 0);
+	p = capture_put32(p, 0);
+	p = capture_put32(p, 1); //scale
+	p = capture_put32(p, SAMPLE_RATE); //rate
+	p = capture_put32(p, 0);
+	p = capture_put32(p, capture_segSamples);
+	p = capture_put32(p, SAMPLE_RATE / CAPTURE_FPS * 2);
+	p = capture_put32(p, 0xFFFFFFFF);
+	p = capture_put32(p, 2); //sample size
+	for (i = 0; i < 4; i++) {
+		p = capture_put16(p, 0);
+	}
+	p = capture_id(p, "strf");
+	p = capture_put32(p, 18);
+	p = capture_put16(p, 1); //WAVE_FORMAT_PCM
+	p = capture_put16(p, 1); //channels
+	p = capture_put32(p, SAMPLE_RATE);
+	p = capture_put32(p, SAMPLE_RATE * 2); //bytes per second
+	p = capture_put16(p, 2); //block align
+	p = capture_put16(p, 16); //bits per sample
+	p = capture_put16(p, 0);
+
+	p = capture_id(p, "LIST");
+	p = capture_put32(p, capture_movi);
+	p = capture_id(p, "movi");
+
+	return (uint32_t)(p - dst);
+}
+
+//Writes a chunk header and indexes it, the caller writes the data. Lengths are always even, so there's no padding.
+static void capture_chunk(const char* id, uint32_t len, uint32_t flags) {
+	uint8_t hdr[8];
+	CAPTURE_INDEX_t* entry;
+
+	if (capture_indexCount == capture_indexSize) {
+		uint32_t size = capture_indexSize ? (capture_indexSize * 2) : 4096;
+		entry = (CAPTURE_INDEX_t*)realloc(capture_index, sizeof(CAPTURE_INDEX_t) * size);
+		if (entry == NULL) {
+			debug_log(DEBUG_ERROR, "[CAPTURE] Unable to allocate index, stopping\r\n");
+			capture_error = 1;
+			return;
+		}
+		capture_index = entry;
+		capture_indexSize = size;
+	}
+	entry = &capture_index[capture_indexCount++];
+	memcpy(entry->id, id, 4);
+	entry->flags = flags;
+	entry->offset = capture_movi;
+	entry->size = len;
+
+	capture_id(hdr, id);
+	capture_put32(hdr + 4, len);
+	capture_write(hdr, 8);
+	capture_movi += 8 + len;
+}
+
+/*
+	Writes what the mixer has queued, and after it silence if the audio would
+	still be more than slack behind the video.
+*/
+static void capture_writeAudio(uint32_t slack) {
+	static uint8_t buf[4096];
+	uint32_t head, tail, avail, target, pad, n, i;
+
+	tail = (uint32_t)SDL_AtomicGet(&capture_audioTail);
+	head = (uint32_t)SDL_AtomicGet(&capture_audioHead);
+	SDL_MemoryBarrierAcquire();
+	avail = head - tail;
+	target = capture_segFrames * (SAMPLE_RATE / CAPTURE_FPS);
+	pad = 0;
+	if ((capture_segSamples + avail + slack) < target) {
+		pad = target - slack - capture_segSamples - avail;
+	}
+	if ((avail + pad) == 0) return;
+
+	capture_chunk("01wb", (avail + pad) * 2, 0x10);
+	while (avail > 0) {
+		n = (avail > (sizeof(buf) / 2)) ? (sizeof(buf) / 2) : avail;
+		for (i = 0; i < n; i++) {
+			capture_put16(buf + i * 2, (uint16_t)capture_ring[(tail + i) & (CAPTURE_AUDIORING - 1)]);
+		}
+		capture_write(buf, n * 2);
+		tail += n;
+		avail -= n;
+		capture_segSamples += n;
+		capture_samples += n;
+	}
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&capture_audioTail, (int)tail);
+
+	memset(buf, 0, sizeof(buf));
+	capture_segSamples += pad;
+	capture_silence += pad;
+	while (pad > 0) {
+		n = (pad > (sizeof(buf) / 2)) ? (sizeof(buf) / 2) : pad;
+		capture_write(buf, n * 2);
+		pad -= n;
+	}
+}
+
+//Lets go of anything the mixer has queued while there's no file to put it in
+static void capture_skipAudio() {
+	SDL_AtomicSet(&capture_audioTail, SDL_AtomicGet(&capture_audioHead));
+}
+
+static void capture_close() {
+	uint8_t hdr[512], entry[16];
+	uint32_t i, len;
+
+	if (capture_file == NULL) return;
+	capture_writeAudio(0); //the audio runs to the end of the last frame
+	capture_id(hdr, "idx1");
+	capture_put32(hdr + 4, capture_indexCount * 16);
+	capture_write(hdr, 8);
+	for (i = 0; i < capture_indexCount; i++) {
+		capture_id(entry, (char*)capture_index[i].id);
+		capture_put32(entry + 4, capture_index[i].flags);
+		capture_put32(entry + 8, capture_index[i].offset);
+		capture_put32(entry + 12, capture_index[i].size);
+		capture_write(entry, 16);
+	}
+
+	len = capture_header(hdr, 0);
+	capture_header(hdr, len - 8 + capture_movi - 4 + 8 + capture_indexCount * 16);
+	if (fseek(capture_file, 0, SEEK_SET) == 0) {
+		fwrite(hdr, 1, len, capture_file);
+	}
+	fclose(capture_file);
+	capture_file = NULL;
+}
+
+static int capture_open(uint32_t w, uint32_t h) {
+	uint8_t hdr[512];
+	char* name, * dot;
+	uint32_t len;
+
+	capture_close();
+
+	name = capture_name;
+	if (capture_segment > 0) {
+		name = (char*)malloc(strlen(capture_name) + 16);
+		if (name == NULL) return -1;
+		strcpy(name, capture_name);
+		dot = strrchr(name, '.');
+		if ((dot == NULL) || (strpbrk(dot, "/\\") != NULL)) {
+			dot = name + strlen(name);
+		}
+		sprintf(dot, "-%lu%s", (unsigned long)capture_segment + 1, capture_name + (dot - name));
+	}
+	capture_file = fopen(name, "wb");
+	if (capture_file == NULL) {
+		debug_log(DEBUG_ERROR, "[CAPTURE] Unable to create %s\r\n", name);
+	}
+	else if (capture_segment > 0) {
+		debug_log(DEBUG_INFO, "[CAPTURE] Carrying on in %s\r\n", name);
+	}
+	if (name != capture_name) {
+		free(name);
+	}
+	if (capture_file == NULL) {
+		capture_error = 1;
+		return -1;
+	}
+	capture_segment++;
+
+	capture_w = w;
+	capture_h = h;
+	capture_imageLen = ((w * 3 + 3) & ~3) * h;
+	capture_movi = 4;
+	capture_segFrames = 0;
+	capture_segSamples = 0;
+	capture_indexCount = 0;
+	len = capture_header(hdr, 0);
+	capture_write(hdr, len);
+	return capture_error ? -1 : 0;
+}
+
+/*
+	Writes the video chunk for tick capture_next, the frame given or an empty
+	one repeating the last, and then the audio that goes with it.
+*/
+static void capture_writeVideo(CAPTURE_FRAME_t* frame) {
+	uint32_t x, y, pitch;
+	uint32_t* src;
+	uint8_t* dst;
+
+	if ((frame != NULL) && ((frame->w != capture_w) || (frame->h != capture_h))) {
+		if (capture_open(frame->w, frame->h)) return;
+	}
+	else if ((capture_movi + capture_imageLen + CAPTURE_AUDIORING * 2) > (CAPTURE_SEGMENT - capture_indexCount * 16 - 4096)) {
+		if (capture_open(capture_w, capture_h)) return;
+		if (frame == NULL) { //a file can't start with a repeat
+			capture_chunk("00dc", capture_imageLen, 0x10);
+			capture_write(capture_image, capture_imageLen);
+			capture_frames++;
+			goto done;
+		}
+	}
+
+	if (frame == NULL) {
+		capture_chunk("00dc", 0, 0);
+		capture_repeats++;
+		goto done;
+	}
+
+	if (capture_image == NULL) {
+		capture_image = (uint8_t*)malloc(((CAPTURE_MAXW * 3 + 3) & ~3) * CAPTURE_MAXH);
+		if (capture_image == NULL) {
+			debug_log(DEBUG_ERROR, "[CAPTURE] Unable to allocate frame buffer, stopping\r\n");
+			capture_error = 1;
+			return;
+		}
+	}
+	pitch = (frame->w * 3 + 3) & ~3;
+	for (y = 0; y < frame->h; y++) {
+		src = &frame->pixels[y * frame->w];
+		dst = &capture_image[(frame->h - 1 - y) * pitch];
+		for (x = 0; x < frame->w; x++) {
+			dst[x * 3] = (uint8_t)src[x];
+			dst[x * 3 + 1] = (uint8_t)(src[x] >> 8);
+			dst[x * 3 + 2] = (uint8_t)(src[x] >> 16);
+		}
+		for (x = frame->w * 3; x < pitch; x++) {
+			dst[x] = 0;
+		}
+	}
+	capture_chunk("00dc", capture_imageLen, 0x10);
+	capture_write(capture_image, capture_imageLen);
+	capture_frames++;
+
+done:
+	capture_segFrames++;
+	capture_next++;
+	capture_writeAudio(CAPTURE_AUDIOSLACK);
+}
+
+#ifdef _WIN32
+void capture_encoder(void* dummy) {
+#else
+void* capture_encoder(void* dummy) {
+#endif
+	CAPTURE_FRAME_t* frame;
+	uint32_t tail;
+	uint64_t now;
+
+	hostthread_apply(HOSTTHREAD_IO);
+
+	while (!capture_error) {
+		tail = (uint32_t)SDL_AtomicGet(&capture_frameTail);
+		if (tail != (uint32_t)SDL_AtomicGet(&capture_frameHead)) {
+			SDL_MemoryBarrierAcquire();
+			frame = &capture_slots[tail % CAPTURE_SLOTS];
+			if (capture_file == NULL) { //the first frame starts the timeline
+				capture_next = frame->frame;
+			}
+			while ((capture_next < frame->frame) && !capture_error) { //ticks with nothing new, or whose frame was dropped
+				capture_writeVideo(NULL);
+			}
+			capture_writeVideo(frame); //a frame queued as its tick ended can come in late, it goes in the next one
+			SDL_MemoryBarrierRelease();
+			SDL_AtomicSet(&capture_frameTail, (int)(tail + 1));
+			continue;
+		}
+		if (capture_quit) break;
+
+		if (capture_file == NULL) {
+			capture_skipAudio();
+		}
+		else {
+			//the render thread may still queue a frame for the tick before this one, but none earlier
+			now = capture_tick();
+			while (((capture_next + 1) < now) && !capture_error) {
+				capture_writeVideo(NULL);
+			}
+		}
+		utility_sleep(CAPTURE_WRITEMS);
+	}
+
+	capture_close();
+	capture_enabled = 0;
+	capture_done = 1;
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+/*
+	From the render thread after each frame it draws. changed is 0 when the
+	frame is the same as the last one, which leaves the encoder to repeat it.
+*/
+void capture_frame(uint32_t* pixels, int w, int h, int stride, uint8_t changed) {
+	CAPTURE_FRAME_t* frame;
+	uint32_t head;
+	uint64_t now;
+	int y;
+
+	if (!capture_enabled) return;
+	if (changed) capture_stale = 1;
+	if (!capture_stale) return;
+	now = capture_tick();
+	if (capture_queued && (now <= capture_last)) return; //this tick already has its frame
+	capture_last = now;
+	capture_queued = 1;
+
+	head = (uint32_t)SDL_AtomicGet(&capture_frameHead);
+	if ((head - (uint32_t)SDL_AtomicGet(&capture_frameTail)) >= CAPTURE_SLOTS) { //the encoder is behind, try again next tick
+		capture_dropped++;
+		return;
+	}
+	frame = &capture_slots[head % CAPTURE_SLOTS];
+	if (w > CAPTURE_MAXW) w = CAPTURE_MAXW;
+	if (h > CAPTURE_MAXH) h = CAPTURE_MAXH;
+	frame->w = (uint32_t)w;
+	frame->h = (uint32_t)h;
+	frame->frame = now;
+	for (y = 0; y < h; y++) {
+		memcpy(&frame->pixels[y * w], (uint8_t*)pixels + (size_t)y * stride, (size_t)w * sizeof(uint32_t));
+	}
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&capture_frameHead, (int)(head + 1));
+	capture_stale = 0;
+}
+
+//From the mixer on the emulation thread, with each block of samples it renders
+void capture_audio(const int16_t* samples, uint32_t count) {
+	uint32_t head, i;
+
+	if (!capture_enabled) return;
+	head = (uint32_t)SDL_AtomicGet(&capture_audioHead);
+	if ((CAPTURE_AUDIORING - (head - (uint32_t)SDL_AtomicGet(&capture_audioTail))) < count) {
+		capture_audioDropped += count;
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		capture_ring[(head + i) & (CAPTURE_AUDIORING - 1)] = samples[i];
+	}
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&capture_audioHead, (int)(head + count));
+}
+
+int capture_init(char* filename) {
+#ifndef _WIN32
+	pthread_t thread;
+#endif
+
+	capture_slots = (CAPTURE_FRAME_t*)malloc(sizeof(CAPTURE_FRAME_t) * CAPTURE_SLOTS);
+	if (capture_slots == NULL) {
+		debug_log(DEBUG_ERROR, "[CAPTURE] Unable to allocate capture buffers\r\n");
+		return -1;
+	}
+	capture_name = filename;
+	capture_start = SDL_GetPerformanceCounter();
+	capture_freq = SDL_GetPerformanceFrequency();
+	SDL_AtomicSet(&capture_frameHead, 0);
+	SDL_AtomicSet(&capture_frameTail, 0);
+	SDL_AtomicSet(&capture_audioHead, 0);
+	SDL_AtomicSet(&capture_audioTail, 0);
+	capture_quit = 0;
+	capture_done = 0;
+	capture_enabled = 1;
+#ifdef _WIN32
+	if (_beginthread(capture_encoder, 0, NULL) == (uintptr_t)-1) {
+#else
+	if (pthread_create(&thread, NULL, capture_encoder, NULL)) {
+#endif
+		debug_log(DEBUG_ERROR, "[CAPTURE] Unable to start the encoder thread\r\n");
+		capture_enabled = 0;
+		return -1;
+	}
+#ifndef _WIN32
+	pthread_detach(thread);
+#endif
+
+	debug_log(DEBUG_INFO, "[CAPTURE] Recording video and audio to %s\r\n", filename);
+	return 0;
+}
+
+//Writes out what's queued and finishes the file, once the CPU has stopped
+void capture_stop() {
+	if (capture_slots == NULL) {
+		return;
+	}
+	capture_enabled = 0;
+	capture_quit = 1;
+	while (!capture_done) {
+		utility_sleep(1);
+	}
+	debug_log(DEBUG_INFO, "[CAPTURE] %llu frames written, %llu repeated and %llu dropped. %llu audio samples written, %llu of silence added and %llu dropped. %llu bytes in %lu file(s)\r\n",
+		(unsigned long long)capture_frames, (unsigned long long)capture_repeats, (unsigned long long)capture_dropped,
+		(unsigned long long)capture_samples, (unsigned long long)capture_silence, (unsigned long long)capture_audioDropped,
+		(unsigned long long)capture_bytes, (unsigned long)capture_segment);
+}
@@ -0,0 +1,36 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+#include "config.h"
+
+#define CAPTURE_FPS			30 //video frame rate in the file, the render thread's frames are sampled down to this
+#define CAPTURE_SLOTS		8 //frames the render thread can have queued before it starts dropping them
+#define CAPTURE_MAXW		1024 //largest frame the renderers produce
+#define CAPTURE_MAXH		1024
+#define CAPTURE_AUDIORING	32768 //samples the mixer can have queued before it starts dropping them, a power of two
+#define CAPTURE_AUDIOSLACK	(SAMPLE_RATE / 10) //audio may fall this far behind the video before silence is written in its place
+#define CAPTURE_SEGMENT		0x40000000 //bytes in a file before carrying on in the next one, AVI 1.0 readers don't go much past this
+#define CAPTURE_WRITEMS		5 //encoder thread sleep when there's nothing to write
+
+typedef struct {
+	uint32_t w, h;
+	uint64_t frame; //number on the CAPTURE_FPS timeline, counted from capture_init
+	uint32_t pixels[CAPTURE_MAXW * CAPTURE_MAXH];
+} CAPTURE_FRAME_t;
+
+typedef struct {
+	uint8_t id[4];
+	uint32_t flags;
+	uint32_t offset; //from the movi list type
+	uint32_t size;
+} CAPTURE_INDEX_t;
+
+extern volatile uint8_t capture_enabled;
+
+int capture_init(char* filename);
+void capture_frame(uint32_t* pixels, int w, int h, int stride, uint8_t changed);
+void capture_audio(const int16_t* samples, uint32_t count);
+void capture_stop();
+
+#endif
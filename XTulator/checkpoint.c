@@ -0,0 +1,195 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Periodic checkpoints.
+
+	Every interval of guest time a snapshot is written to <basename>.<n>. Most
+	of them are incremental: their RAM section only holds the pages written
+	since the previous checkpoint, going by memory_dirty, and a PARN section
+	names that previous file. Every CHECKPOINT_FULLEVERY-th one is a full
+	snapshot again. Any of them can be handed to -loadstate.
+
+	The CPU thread only gathers device state and copies the dirty pages, which
+	is a few memcpys. Packing and writing the file happens on a worker thread.
+	If the worker is still busy with the last checkpoint when the next one is
+	due, that one is skipped and its pages stay dirty for the next.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+pthread_t checkpoint_threadID;
+#endif
+#include <SDL.h>
+#include "config.h"
+#include "debuglog.h"
+#include "timing.h"
+#include "memory.h"
+#include "machine.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "hostthread.h"
+
+typedef struct {
+	SNAPSHOT_BUF_t state;
+	uint32_t* pages;
+	uint8_t* data; //copy of the pages, taken on the CPU thread
+	uint32_t count;
+	char name[512];
+} CHECKPOINT_JOB_t;
+
+MACHINE_t* checkpoint_machine = NULL;
+char* checkpoint_basename = NULL;
+uint32_t checkpoint_num = 0;
+char checkpoint_prev[512];
+
+CHECKPOINT_JOB_t checkpoint_job;
+uint8_t checkpoint_pending = 0, checkpoint_running = 0, checkpoint_stopped = 0;
+SDL_mutex* checkpoint_lock = NULL;
+SDL_cond* checkpoint_work = NULL; //worker waits on this for a job
+SDL_cond* checkpoint_done = NULL; //checkpoint_shutdown waits on this for the worker to finish
+
+#ifdef _WIN32
+void checkpoint_thread(void* dummy) {
+#else
+void* checkpoint_thread(void* dummy) {
+#endif
+	hostthread_apply(HOSTTHREAD_IO);
+	SDL_LockMutex(checkpoint_lock);
+	while (checkpoint_running || checkpoint_pending) {
+		if (!checkpoint_pending) {
+			SDL_CondWait(checkpoint_work, checkpoint_lock);
+			continue;
+		}
+		SDL_UnlockMutex(checkpoint_lock);
+
+		//the job is ours until checkpoint_pending is cleared
+		snapshot_writeRAM(&checkpoint_job.state, checkpoint_job.pages, checkpoint_job.count, checkpoint_job.data);
+		if (snapshot_writeFile(&checkpoint_job.state, checkpoint_job.name) == 0) {
+			debug_log(DEBUG_DETAIL, "[CHECKPOINT] Wrote %s (%lu RAM pages, %lu KB)\r\n", checkpoint_job.name, checkpoint_job.count, (checkpoint_job.state.len + 1023) >> 10);
+		}
+		snapshot_bufFree(&checkpoint_job.state);
+		free(checkpoint_job.pages);
+		free(checkpoint_job.data);
+
+		SDL_LockMutex(checkpoint_lock);
+		checkpoint_pending = 0;
+	}
+	checkpoint_stopped = 1;
+	SDL_CondBroadcast(checkpoint_done);
+	SDL_UnlockMutex(checkpoint_lock);
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+//Guest timer callback, runs on the CPU thread between instructions
+void checkpoint_take(void* dummy) {
+	CHECKPOINT_JOB_t job;
+	uint32_t page, i;
+	uint8_t full, busy;
+
+	SDL_LockMutex(checkpoint_lock);
+	busy = checkpoint_pending;
+	SDL_UnlockMutex(checkpoint_lock);
+	if (busy) {
+		debug_log(DEBUG_INFO, "[CHECKPOINT] Still writing the previous checkpoint, skipping this one\r\n");
+		return;
+	}
+
+	full = (checkpoint_num % CHECKPOINT_FULLEVERY) == 0;
+	if (full) {
+		snapshot_pageAll(); //a restored snapshot may still have pages waiting in its file
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.pages = (uint32_t*)malloc(MEMORY_PAGES * sizeof(uint32_t));
+	if (job.pages == NULL) return;
+	for (page = 0; page < MEMORY_PAGES; page++) {
+		if (memory_dirty[page] & (full ? MEMORY_TOUCHED : MEMORY_DIRTY)) job.pages[job.count++] = page;
+	}
+	job.data = (uint8_t*)malloc(((size_t)job.count << MEMORY_PAGE_SHIFT) + 1);
+	if (job.data == NULL) {
+		free(job.pages);
+		return;
+	}
+	for (i = 0; i < job.count; i++) {
+		memcpy(job.data + ((size_t)i << MEMORY_PAGE_SHIFT), main_ram + (job.pages[i] << MEMORY_PAGE_SHIFT), MEMORY_PAGE_SIZE);
+	}
+	memory_clearDirty();
+
+	snapshot_writeState(checkpoint_machine, &job.state, full ? NULL : checkpoint_prev);
+	snprintf(job.name, sizeof(job.name), "%s.%lu", checkpoint_basename, (unsigned long)checkpoint_num);
+	strcpy(checkpoint_prev, job.name);
+	checkpoint_num++;
+
+	SDL_LockMutex(checkpoint_lock);
+	checkpoint_job = job;
+	checkpoint_pending = 1;
+	SDL_CondSignal(checkpoint_work);
+	SDL_UnlockMutex(checkpoint_lock);
+}
+
+int checkpoint_init(MACHINE_t* machine, char* basename, double interval) {
+	checkpoint_machine = machine;
+	checkpoint_basename = basename;
+
+	checkpoint_lock = SDL_CreateMutex();
+	checkpoint_work = SDL_CreateCond();
+	checkpoint_done = SDL_CreateCond();
+	if ((checkpoint_lock == NULL) || (checkpoint_work == NULL) || (checkpoint_done == NULL)) {
+		debug_log(DEBUG_ERROR, "[CHECKPOINT] Unable to create worker synchronization objects\r\n");
+		return -1;
+	}
+
+	checkpoint_running = 1;
+#ifdef _WIN32
+	if (_beginthread(checkpoint_thread, 0, NULL) == (uintptr_t)-1) {
+		checkpoint_running = 0;
+		return -1;
+	}
+#else
+	if (pthread_create(&checkpoint_threadID, NULL, checkpoint_thread, NULL)) {
+		checkpoint_running = 0;
+		return -1;
+	}
+#endif
+
+	timing_addGuestTimer(checkpoint_take, NULL, 1.0 / interval, TIMING_ENABLED);
+	debug_log(DEBUG_INFO, "[CHECKPOINT] Writing a checkpoint to %s.<n> every %.01f seconds\r\n", basename, interval);
+	return 0;
+}
+
+//Lets the worker finish the checkpoint it's on, for emulator exit
+void checkpoint_shutdown() {
+	if (!checkpoint_running) return;
+	SDL_LockMutex(checkpoint_lock);
+	checkpoint_running = 0;
+	SDL_CondSignal(checkpoint_work);
+	while (!checkpoint_stopped) {
+		SDL_CondWait(checkpoint_done, checkpoint_lock);
+	}
+	SDL_UnlockMutex(checkpoint_lock);
+}
@@ -0,0 +1,12 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdint.h>
+#include "machine.h"
+
+#define CHECKPOINT_FULLEVERY	16 //every this many checkpoints is a full snapshot, so restoring never has to walk a long chain
+
+int checkpoint_init(MACHINE_t* machine, char* basename, double interval);
+void checkpoint_shutdown();
+
+#endif
@@ -3,6 +3,7 @@
 #include "../config.h"
 #include "../debuglog.h"
 #include "../ports.h"
+#include "../memory.h"
 #include "i8042.h"
 
 volatile uint8_t a20_enabled = 0;
@@ -44,7 +45,7 @@ void i8042_write(void* udata, uint32_t port, uint8_t value) {
         if (kbc->command) {
             switch (kbc->command) {
             case 0x60: kbc->command_byte = value; break;
-            case 0xD1: kbc->output_port = value; a20_enabled = (value >> 1) & 1; break;
+            case 0xD1: kbc->output_port = value; memory_setA20((value >> 1) & 1); break;
             case 0xD3: break;
             case 0xD4:
                 i8042_send_scancode(kbc, 0xFA);
@@ -90,7 +91,7 @@ static uint8_t port92_data = 0;
 
 void port92_write(void* udata, uint32_t port, uint8_t value) {
     port92_data = value;
-    a20_enabled = (port92_data >> 1) & 1;
+    memory_setA20((port92_data >> 1) & 1);
 }
 
 uint8_t port92_read(void* udata, uint32_t port) {
@@ -102,7 +103,7 @@ void i8042_init(I8042_t* kbc, CPU_t* cpu, I8259_t* i8259, KEYSTATE_t* keystate)
     kbc->keystate = keystate;
     kbc->cpu = cpu;
     kbc->i8259 = i8259;
-    a20_enabled = 0;
+    memory_setA20(0);
     kbc->status = 0x14;
     kbc->command_byte = 0x45;
     kbc->output_port = 0xDD;
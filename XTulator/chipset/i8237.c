@@ -27,6 +27,7 @@
 #include <memory.h>
 #include "i8237.h"
 #include "../cpu/cpu.h"
+#include "../memory.h"
 #include "../ports.h"
 #include "../timing.h"
 #include "../debuglog.h"
@@ -41,9 +42,9 @@ void i8237_reset(I8237_t* i8237) {
 
 void i8237_writeport(I8237_t* i8237, uint16_t addr, uint8_t value) {
 	uint8_t ch;
-#ifdef DEBUG_DMA
-	debug_log(DEBUG_DETAIL, "[DMA] Write port 0x%X: %X\n", addr, value);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_DMA)) {
+		debug_log(DEBUG_DETAIL, "[DMA] Write port 0x%X: %X\n", addr, value);
+	}
 	addr &= 0x0F;
 	switch (addr) {
 	case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
@@ -72,9 +73,9 @@ void i8237_writeport(I8237_t* i8237, uint16_t addr, uint8_t value) {
 				i8237->chan[ch].addr <<= 1;
 			}
 			i8237->chan[ch].reloadaddr = i8237->chan[ch].addr;
-#ifdef DEBUG_DMA
-			debug_log(DEBUG_DETAIL, "[DMA] Channel %u addr set to %08X\r\n", ch, i8237->chan[ch].addr);
-#endif
+			if (DEBUG_ON(DEBUG_SUB_DMA)) {
+				debug_log(DEBUG_DETAIL, "[DMA] Channel %u addr set to %08X\r\n", ch, i8237->chan[ch].addr);
+			}
 		}
 		i8237->flipflop ^= 1;
 		break;
@@ -110,9 +111,9 @@ void i8237_writeport(I8237_t* i8237, uint16_t addr, uint8_t value) {
 
 void i8237_writepage(I8237_t* i8237, uint16_t addr, uint8_t value) {
 	uint8_t ch;
-#ifdef DEBUG_DMA
-	debug_log(DEBUG_DETAIL, "[DMA] Write port 0x%X: %X\n", addr, value);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_DMA)) {
+		debug_log(DEBUG_DETAIL, "[DMA] Write port 0x%X: %X\n", addr, value);
+	}
 	addr &= 0x0F;
 	switch (addr) {
 	case 0x07:
@@ -131,16 +132,16 @@ void i8237_writepage(I8237_t* i8237, uint16_t addr, uint8_t value) {
 		return;
 	}
 	i8237->chan[ch].page = (uint32_t)value << 16;
-#ifdef DEBUG_DMA
-	debug_log(DEBUG_DETAIL, "[DMA] Channel %u page set to %08X\r\n", ch, i8237->chan[ch].page);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_DMA)) {
+		debug_log(DEBUG_DETAIL, "[DMA] Channel %u page set to %08X\r\n", ch, i8237->chan[ch].page);
+	}
 }
 
 uint8_t i8237_readport(I8237_t* i8237, uint16_t addr) {
 	uint8_t ch, ret = 0xFF;
-#ifdef DEBUG_DMA
-	debug_log(DEBUG_DETAIL, "[DMA] Read port 0x%X\n", addr);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_DMA)) {
+		debug_log(DEBUG_DETAIL, "[DMA] Read port 0x%X\n", addr);
+	}
 
 	addr &= 0x0F;
 	switch (addr) {
@@ -189,9 +190,9 @@ uint8_t i8237_readport(I8237_t* i8237, uint16_t addr) {
 
 uint8_t i8237_readpage(I8237_t* i8237, uint16_t addr) {
 	uint8_t ch;
-#ifdef DEBUG_DMA
-	debug_log(DEBUG_DETAIL, "[DMA] Read port 0x%X\n", addr);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_DMA)) {
+		debug_log(DEBUG_DETAIL, "[DMA] Read port 0x%X\n", addr);
+	}
 	addr &= 0x0F;
 	switch (addr) {
 	case 0x07:
@@ -250,6 +251,62 @@ void i8237_write(I8237_t* i8237, uint8_t ch, uint8_t value) {
 	}
 }
 
+//Block transfer between a buffer and memory on channel ch, tomem selects the direction. Stops early on terminal
+//count or a masked channel, autoinit channels wrap around and keep going. Incrementing channels are copied a page
+//at a time by the memory module, decrementing ones fall back to a byte at a time. Returns the bytes transferred.
+static uint32_t i8237_block(I8237_t* i8237, uint8_t ch, uint8_t* buf, uint32_t len, uint8_t tomem) {
+	uint32_t done = 0, n, i;
+
+	while (done < len) {
+		if (i8237->chan[ch].masked || i8237->chan[ch].terminal) break;
+		n = (uint32_t)i8237->chan[ch].count + 1; //bytes left until the count rolls over
+		if (n > (len - done)) n = len - done;
+		if (i8237->chan[ch].addrinc == 1) {
+			if (tomem) {
+				memory_writeBlock(i8237->chan[ch].page + i8237->chan[ch].addr, buf + done, n);
+			}
+			else {
+				memory_readBlock(i8237->chan[ch].page + i8237->chan[ch].addr, buf + done, n);
+			}
+			i8237->chan[ch].addr += n;
+		}
+		else {
+			for (i = 0; i < n; i++) {
+				if (tomem) {
+					cpu_write(i8237->cpu, i8237->chan[ch].page + i8237->chan[ch].addr, buf[done + i]);
+				}
+				else {
+					buf[done + i] = cpu_read(i8237->cpu, i8237->chan[ch].page + i8237->chan[ch].addr);
+				}
+				i8237->chan[ch].addr += i8237->chan[ch].addrinc;
+			}
+		}
+		i8237->chan[ch].count -= (uint16_t)n;
+		done += n;
+		if (i8237->chan[ch].count == 0xFFFF) {
+			if (i8237->chan[ch].autoinit) {
+				i8237->chan[ch].count = i8237->chan[ch].reloadcount;
+				i8237->chan[ch].addr = i8237->chan[ch].reloadaddr;
+			}
+			else {
+				i8237->chan[ch].terminal = 1;
+			}
+		}
+	}
+
+	return done;
+}
+
+//Moves up to len bytes from memory to a device in one call, see i8237_block
+uint32_t i8237_readBlock(I8237_t* i8237, uint8_t ch, uint8_t* dst, uint32_t len) {
+	return i8237_block(i8237, ch, dst, len, 0);
+}
+
+//Moves up to len bytes from a device into memory in one call, see i8237_block
+uint32_t i8237_writeBlock(I8237_t* i8237, uint8_t ch, const uint8_t* src, uint32_t len) {
+	return i8237_block(i8237, ch, (uint8_t*)src, len, 1);
+}
+
 void i8237_init(I8237_t* i8237, CPU_t* cpu, uint16_t base_port, uint16_t page_port, uint8_t is_slave) {
 	i8237_reset(i8237);
 	i8237->cpu = cpu;
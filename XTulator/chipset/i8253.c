@@ -32,7 +32,120 @@
 #include "../ports.h"
 #include "../debuglog.h"
 
-uint32_t i8253_timers[3];
+/*
+	The counters aren't stepped by a periodic callback. Each channel remembers
+	the PIT clock its count was loaded at, and the counter value and OUT level
+	are worked out from that when a port is read. Channel 0's next terminal
+	count is scheduled as a single guest clock timer event that raises IRQ 0.
+*/
+
+//PIT clocks elapsed since init at the given guest clock time
+static uint64_t i8253_toPit(I8253_t* i8253, uint64_t when) {
+	uint64_t delta, freq;
+
+	delta = (when > i8253->origin) ? (when - i8253->origin) : 0;
+	freq = timing_getFreq();
+	return (delta / freq) * PIT_FREQ + ((delta % freq) * PIT_FREQ) / freq;
+}
+
+static uint64_t i8253_now(I8253_t* i8253) {
+	return i8253_toPit(i8253, timing_getGuestCur());
+}
+
+//Guest clock time at which the given PIT clock is reached, rounded up
+static uint64_t i8253_toGuest(I8253_t* i8253, uint64_t pit) {
+	uint64_t freq;
+
+	freq = timing_getFreq();
+	return i8253->origin + (pit / PIT_FREQ) * freq + ((pit % PIT_FREQ) * freq + PIT_FREQ - 1) / PIT_FREQ;
+}
+
+static void i8253_update(I8253_t* i8253, uint8_t chan, uint64_t now) {
+	uint64_t elapsed, phase, half;
+	int32_t count;
+
+	if (!i8253->active[chan]) return;
+	count = i8253->reload[chan];
+	elapsed = now - i8253->loadtime[chan];
+
+	switch (i8253->mode[chan]) {
+	case 0: //interrupt on terminal count
+		if (elapsed < (uint64_t)count) {
+			i8253->counter[chan] = count - (int32_t)elapsed;
+			i8253->out[chan] = 0;
+		}
+		else {
+			i8253->counter[chan] = (int32_t)(((uint64_t)count - elapsed) & 0xFFFF); //keeps counting down after it wraps
+			i8253->out[chan] = 1;
+		}
+		break;
+	case 2: //rate generator
+		phase = elapsed % (uint64_t)count;
+		i8253->counter[chan] = count - (int32_t)phase;
+		i8253->out[chan] = (phase == (uint64_t)(count - 1)) ? 0 : 1;
+		break;
+	case 3: //square wave generator
+		phase = elapsed % (uint64_t)count;
+		half = ((uint64_t)count + 1) >> 1;
+		if (phase < half) {
+			i8253->counter[chan] = count - (int32_t)(phase << 1);
+			i8253->out[chan] = 1;
+		}
+		else {
+			i8253->counter[chan] = count - (int32_t)((phase - half) << 1);
+			i8253->out[chan] = 0;
+		}
+		break;
+	default:
+		if (DEBUG_ON(DEBUG_SUB_PIT)) {
+			debug_log(DEBUG_DETAIL, "I8253: Unknown mode %u on counter %u\r\n", i8253->mode[chan], chan);
+		}
+		break;
+	}
+}
+
+//Number of channel 0 terminal counts since it was loaded
+static uint64_t i8253_edges(I8253_t* i8253, uint64_t now) {
+	uint64_t elapsed;
+
+	if (!i8253->active[0]) return 0;
+	elapsed = now - i8253->loadtime[0];
+	switch (i8253->mode[0]) {
+	case 0:
+		return (elapsed >= (uint64_t)i8253->reload[0]) ? 1 : 0;
+	case 2:
+	case 3:
+		return elapsed / (uint64_t)i8253->reload[0];
+	default:
+		return 0;
+	}
+}
+
+static void i8253_schedule(I8253_t* i8253) {
+	uint64_t next;
+
+	if (!i8253->active[0]) {
+		timing_timerDisable(i8253->timer);
+		return;
+	}
+	switch (i8253->mode[0]) {
+	case 0:
+		if (i8253->irqedges > 0) {
+			timing_timerDisable(i8253->timer);
+			return;
+		}
+		next = i8253->loadtime[0] + (uint64_t)i8253->reload[0];
+		break;
+	case 2:
+	case 3:
+		next = i8253->loadtime[0] + (i8253->irqedges + 1) * (uint64_t)i8253->reload[0];
+		break;
+	default:
+		timing_timerDisable(i8253->timer);
+		return;
+	}
+	timing_timerAt(i8253->timer, i8253_toGuest(i8253, next));
+}
 
 void i8253_write(I8253_t* i8253, uint16_t portnum, uint8_t value) {
 	uint8_t sel, rl, loaded;
@@ -46,12 +159,10 @@ void i8253_write(I8253_t* i8253, uint16_t portnum, uint8_t value) {
 		switch (i8253->rlmode[portnum]) {
 		case 1: //MSB only
 			i8253->reload[portnum] = (int32_t)value << 8;
-			i8253->active[portnum] = 1;
 			loaded = 1;
 			break;
 		case 2: //LSB only
 			i8253->reload[portnum] = value;
-			i8253->active[portnum] = 1;
 			loaded = 1;
 			break;
 		case 3: //LSB, then MSB
@@ -59,28 +170,35 @@ void i8253_write(I8253_t* i8253, uint16_t portnum, uint8_t value) {
 				i8253->reload[portnum] = (i8253->reload[portnum] & 0xFF00) | value;
 			} else { //MSB
 				i8253->reload[portnum] = (i8253->reload[portnum] & 0x00FF) | ((int32_t)value << 8);
-				i8253->counter[portnum] = i8253->reload[portnum];
-				if (i8253->reload[portnum] == 0) {
-					i8253->reload[portnum] = 65536;
-				}
-				i8253->active[portnum] = 1;
 				loaded = 1;
-#ifdef DEBUG_PIT
-				debug_log(DEBUG_DETAIL, "I8253: Counter %u reload = %d\r\n", portnum, i8253->reload[portnum]);
-#endif
 			}
 			i8253->dataflipflop[portnum] ^= 1;
 			break;
 		}
-		if (loaded) switch (i8253->mode[portnum]) {
-		case 0:
-		case 1:
-			i8253->out[portnum] = 0;
-			break;
-		case 2:
-		case 3:
-			i8253->out[portnum] = 1;
-			break;
+		if (loaded) {
+			if (i8253->reload[portnum] == 0) {
+				i8253->reload[portnum] = 65536;
+			}
+			i8253->counter[portnum] = i8253->reload[portnum];
+			i8253->loadtime[portnum] = i8253_now(i8253);
+			i8253->active[portnum] = 1;
+			if (DEBUG_ON(DEBUG_SUB_PIT)) {
+				debug_log(DEBUG_DETAIL, "I8253: Counter %u reload = %d\r\n", portnum, i8253->reload[portnum]);
+			}
+			switch (i8253->mode[portnum]) {
+			case 0:
+			case 1:
+				i8253->out[portnum] = 0;
+				break;
+			case 2:
+			case 3:
+				i8253->out[portnum] = 1;
+				break;
+			}
+			if (portnum == 0) {
+				i8253->irqedges = 0;
+				i8253_schedule(i8253);
+			}
 		}
 		break;
 	case 3: //control word
@@ -90,7 +208,9 @@ void i8253_write(I8253_t* i8253, uint16_t portnum, uint8_t value) {
 		}
 		rl = (value >> 4) & 3; //read/load mode
 		if (rl == 0) { //counter latching operation
+			i8253_update(i8253, sel, i8253_now(i8253));
 			i8253->latch[sel] = i8253->counter[sel];
+			i8253->latched[sel] = 1;
 		} else { //set mode
 			i8253->rlmode[sel] = rl;
 			i8253->mode[sel] = (value >> 1) & 7;
@@ -98,9 +218,10 @@ void i8253_write(I8253_t* i8253, uint16_t portnum, uint8_t value) {
 				i8253->mode[sel] &= 3; //MSB is "don't care" if bit 1 is set
 			}
 			i8253->bcd[sel] = value & 1;
-#ifdef DEBUG_PIT
-			debug_log(DEBUG_DETAIL, "I8253: Counter %u mode = %u\r\n", sel, i8253->mode[sel]);
-#endif
+			i8253->latched[sel] = 0;
+			if (DEBUG_ON(DEBUG_SUB_PIT)) {
+				debug_log(DEBUG_DETAIL, "I8253: Counter %u mode = %u\r\n", sel, i8253->mode[sel]);
+			}
 		}
 		i8253->dataflipflop[sel] = 0;
 		break;
@@ -115,78 +236,55 @@ uint8_t i8253_read(I8253_t* i8253, uint16_t portnum) {
 		return 0xFF; //no read of control word possible
 	}
 
+	if (!i8253->latched[portnum] && (i8253->dataflipflop[portnum] == 0)) { //no latch command, so read the live count
+		i8253_update(i8253, (uint8_t)portnum, i8253_now(i8253));
+		i8253->latch[portnum] = i8253->counter[portnum];
+	}
+
 	switch (i8253->rlmode[portnum]) {
 	case 1: //MSB only
+		i8253->latched[portnum] = 0;
 		return i8253->latch[portnum] >> 8;
 	case 2: //LSB only
+		i8253->latched[portnum] = 0;
 		return (uint8_t)i8253->latch[portnum];
 	default: //LSB, then MSB (case 3, but say default so MSVC stops warning me about control paths not all returning a value)
 		if (i8253->dataflipflop[portnum] == 0) { //LSB
 			ret = (uint8_t)i8253->latch[portnum];
 		} else { //MSB
 			ret = i8253->latch[portnum] >> 8;
+			i8253->latched[portnum] = 0;
 		}
 		i8253->dataflipflop[portnum] ^= 1;
 		return ret;
 	}
 }
 
-void i8253_timerCallback0(I8259_t* i8259) {
-	i8259_doirq(i8259, 0);
-}
-
-void i8253_timerCallback1(I8259_t* i8259) {
-}
+//Channel 2 output as seen by the PC speaker
+//Channel 2 output at the given guest clock time, which may be a little in the past when the audio mixer renders a block
+uint8_t i8253_getOut2(I8253_t* i8253, uint64_t when) {
+	uint64_t pit;
 
-void i8253_timerCallback2(I8259_t* i8259) {
+	if (!i8253->active[2] || (i8253->mode[2] != 3) || (i8253->reload[2] < 50)) {
+		return 0;
+	}
+	pit = i8253_toPit(i8253, when);
+	if (pit < i8253->loadtime[2]) pit = i8253->loadtime[2];
+	i8253_update(i8253, 2, pit);
+	return i8253->out[2];
 }
 
-void i8253_tickCallback(I8253CB_t* i8253cb) {
+void i8253_timerCallback(I8253CB_t* i8253cb) {
 	I8253_t* i8253;
-	I8259_t* i8259;
-	uint8_t i;
+	uint64_t edges;
 
 	i8253 = i8253cb->i8253;
-	i8259 = i8253cb->i8259;
-	for (i = 0; i < 3; i++) {
-		if ((i == 2) && (i8253->mode[2] != 3)) pcspeaker_setGateState(i8253->cbdata.pcspeaker, PC_SPEAKER_GATE_TIMER2, 0);
-		if (i8253->active[i]) switch (i8253->mode[i]) {
-		case 0: //interrupt on terminal count
-			i8253->counter[i] -= 25;
-			if (i8253->counter[i] <= 0) {
-				i8253->counter[i] = 0;
-				i8253->out[i] = 1;
-				if (i == 0) i8253_timerCallback0(i8259);
-			}
-			break;
-		case 2: //rate generator
-			i8253->counter[i] -= 25;
-			if (i8253->counter[i] <= 0) {
-				i8253->out[i] ^= 1;
-				//if (i8253->out[i] == 0) {
-					if (i == 0) i8253_timerCallback0(i8259);
-				//}
-				i8253->counter[i] += i8253->reload[i];
-			}
-			break;
-		case 3: //square wave generator
-			i8253->counter[i] -= 50;
-			if (i8253->counter[i] <= 0) {
-				i8253->out[i] ^= 1;
-				if (i8253->out[i] == 0) {
-					if (i == 0) i8253_timerCallback0(i8259);
-				}
-				if (i == 2) pcspeaker_setGateState(i8253->cbdata.pcspeaker, PC_SPEAKER_GATE_TIMER2, (i8253->reload[i] < 50) ? 0 : i8253->out[i]);
-				i8253->counter[i] += i8253->reload[i];
-			}
-			break;
-		default:
-#ifdef DEBUG_PIT
-			debug_log(DEBUG_DETAIL, "I8253: Unknown mode %u on counter %u\r\n", i8253->mode[i], i);
-#endif
-			break;
-		}
+	edges = i8253_edges(i8253, i8253_now(i8253));
+	if (edges > i8253->irqedges) {
+		i8253->irqedges = edges;
+		i8259_doirq(i8253cb->i8259, 0);
 	}
+	i8253_schedule(i8253);
 }
 
 void i8253_init(I8253_t* i8253, I8259_t* i8259, PCSPEAKER_t* pcspeaker) {
@@ -195,8 +293,9 @@ void i8253_init(I8253_t* i8253, I8259_t* i8259, PCSPEAKER_t* pcspeaker) {
 	i8253->cbdata.i8253 = i8253;
 	i8253->cbdata.i8259 = i8259;
 	i8253->cbdata.pcspeaker = pcspeaker;
+	i8253->origin = timing_getGuestCur();
 
-	timing_addTimer(i8253_tickCallback, (void*)(&i8253->cbdata), 48000, TIMING_ENABLED); //79545.47
+	i8253->timer = timing_addGuestTimer(i8253_timerCallback, (void*)(&i8253->cbdata), 18.2, TIMING_DISABLED);
 
 	ports_cbRegister(0x40, 4, (void*)i8253_read, NULL, (void*)i8253_write, NULL, i8253);
 }
@@ -29,6 +29,8 @@
 #define PIT_MODE_HIBYTE	2
 #define PIT_MODE_TOGGLE	3
 
+#define PIT_FREQ	1193182
+
 typedef struct {
 	void* i8253;
 	I8259_t* i8259;
@@ -51,11 +53,17 @@ typedef struct {
 	uint8_t rlmode[3];
 	uint16_t latch[3];
 	uint8_t out[3];
+	uint8_t latched[3];
+	uint64_t loadtime[3]; //PIT clock when the current count was loaded
+	uint64_t irqedges; //channel 0 terminal counts already signalled since loadtime[0]
+	uint64_t origin; //guest clock time of PIT clock 0
+	uint32_t timer;
 	I8253CB_t cbdata;
 } I8253_t;
 
 void i8253_write(I8253_t* i8253, uint16_t portnum, uint8_t value);
 uint8_t i8253_read(I8253_t* i8253, uint16_t portnum);
+uint8_t i8253_getOut2(I8253_t* i8253, uint64_t when);
 void i8253_init(I8253_t* i8253, I8259_t* i8259, PCSPEAKER_t* pcspeaker);
 
 #endif
@@ -33,16 +33,22 @@
 #include "../ports.h"
 #include "../debuglog.h"
 
+//Which half of a refresh period the guest clock is in
+static uint8_t i8255_refreshPhase() {
+	return (uint8_t)((uint64_t)((double)timing_getGuestCur() * (double)I8255_REFRESHRATE / (double)timing_getFreq()) & 1);
+}
+
 uint8_t i8255_readport(I8255_t* i8255, uint16_t portnum) {
-#ifdef DEBUG_PPI
-	debug_log(DEBUG_DETAIL, "[I8255] Read port %02X\r\n", portnum);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_PPI)) {
+		debug_log(DEBUG_DETAIL, "[I8255] Read port %02X\r\n", portnum);
+	}
 	portnum &= 7;
 	switch (portnum) {
 	case 0:
 		return i8255->keystate->scancode;
 	case 1:
-		return i8255->portB;
+		//simulate DRAM refresh toggle, many BIOSes require this...
+		return (i8255->portB & 0xEF) | (i8255_refreshPhase() ? 0x10 : 0x00);
 	case 2:
 		//debug_log(DEBUG_DETAIL, "read 0x62\r\n");
 		if (i8255->portB & 8) {
@@ -55,9 +61,9 @@ uint8_t i8255_readport(I8255_t* i8255, uint16_t portnum) {
 }
 
 void i8255_writeport(I8255_t* i8255, uint16_t portnum, uint8_t value) {
-#ifdef DEBUG_PPI
-	debug_log(DEBUG_DETAIL, "[I8255] Write port %02X <- %02X\r\n", portnum, value);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_PPI)) {
+		debug_log(DEBUG_DETAIL, "[I8255] Write port %02X <- %02X\r\n", portnum, value);
+	}
 	portnum &= 7;
 	switch (portnum) {
 	case 0:
@@ -66,34 +72,30 @@ void i8255_writeport(I8255_t* i8255, uint16_t portnum, uint8_t value) {
 	case 1:
 		if (value & 0x01) {
 			pcspeaker_selectGate(i8255->pcspeaker, PC_SPEAKER_USE_TIMER2);
-#ifdef DEBUG_PPI
-			debug_log(DEBUG_DETAIL, "[I8255] Speaker take input from timer 2\r\n");
-#endif
+			if (DEBUG_ON(DEBUG_SUB_PPI)) {
+				debug_log(DEBUG_DETAIL, "[I8255] Speaker take input from timer 2\r\n");
+			}
 		} else {
 			pcspeaker_selectGate(i8255->pcspeaker, PC_SPEAKER_USE_DIRECT);
-#ifdef DEBUG_PPI
-			debug_log(DEBUG_DETAIL, "[I8255] Speaker take input from direct\r\n");
-#endif
+			if (DEBUG_ON(DEBUG_SUB_PPI)) {
+				debug_log(DEBUG_DETAIL, "[I8255] Speaker take input from direct\r\n");
+			}
 		}
 		pcspeaker_setGateState(i8255->pcspeaker, PC_SPEAKER_GATE_DIRECT, (value >> 1) & 1);
-#ifdef DEBUG_PPI
-		debug_log(DEBUG_DETAIL, "[I8255] Speaker direct value = %u\r\n", (value >> 1) & 1);
-#endif
+		if (DEBUG_ON(DEBUG_SUB_PPI)) {
+			debug_log(DEBUG_DETAIL, "[I8255] Speaker direct value = %u\r\n", (value >> 1) & 1);
+		}
 		if ((value & 0x40) && !(i8255->portB & 0x40)) {
 			i8255->keystate->scancode = 0xAA;
-#ifdef DEBUG_PPI
-			debug_log(DEBUG_DETAIL, "[I8255] Keyboard reset\r\n");
-#endif
+			if (DEBUG_ON(DEBUG_SUB_PPI)) {
+				debug_log(DEBUG_DETAIL, "[I8255] Keyboard reset\r\n");
+			}
 		}
-		i8255->portB = (value & 0xEF) | (i8255->portB & 0x10);
+		i8255->portB = value & 0xEF;
 		break;
 	}
 }
 
-void i8255_refreshToggle(I8255_t* i8255) {
-	i8255->portB ^= 0x10; //simulate DRAM refresh toggle, many BIOSes require this...
-}
-
 void i8255_init(I8255_t* i8255, KEYSTATE_t* keystate, PCSPEAKER_t* pcspeaker) {
 	memset(i8255, 0, sizeof(I8255_t));
 	i8255->keystate = keystate;
@@ -107,5 +109,4 @@ void i8255_init(I8255_t* i8255, KEYSTATE_t* keystate, PCSPEAKER_t* pcspeaker) {
 	}
 
 	ports_cbRegister(0x60, 6, (void*)i8255_readport, NULL, (void*)i8255_writeport, NULL, i8255);
-	timing_addTimer(i8255_refreshToggle, i8255, 66667, TIMING_ENABLED);
 }
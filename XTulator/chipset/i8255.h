@@ -5,6 +5,8 @@
 #include "../modules/audio/pcspeaker.h"
 #include "../modules/input/input.h"
 
+#define I8255_REFRESHRATE	66667 //port 61h bit 4 DRAM refresh toggles per second, worked out from the guest clock on read
+
 typedef struct {
 	uint8_t sw2;
 	uint8_t portA;
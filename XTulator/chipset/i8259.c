@@ -28,6 +28,11 @@
 #include "i8259.h"
 #include "../ports.h"
 
+//Called after anything that changes irr or imr
+static void i8259_update(I8259_t* i8259) {
+	i8259->pending = (i8259->irr & (~i8259->imr)) ? 1 : 0;
+}
+
 uint8_t i8259_read(I8259_t* i8259, uint16_t portnum) {
 	switch (portnum & 1) {
 	case 0:
@@ -107,6 +112,7 @@ void i8259_write(I8259_t* i8259, uint16_t portnum, uint8_t value) {
 		}
 		break;
 	}
+	i8259_update(i8259);
 }
 
 uint8_t i8259_nextintr(I8259_t* i8259) {
@@ -119,6 +125,7 @@ uint8_t i8259_nextintr(I8259_t* i8259) {
 			}
 			i8259->irr &= ~(1 << i);
 			i8259->isr |= (1 << i);
+			i8259_update(i8259);
 			return (i8259->icw[2] & 0xF8) + i;
 		}
 	}
@@ -127,6 +134,7 @@ uint8_t i8259_nextintr(I8259_t* i8259) {
 
 void i8259_doirq(I8259_t* i8259, uint8_t irqnum) {
 	i8259->irr |= (1 << irqnum) & (~i8259->imr);
+	i8259_update(i8259);
 	if (i8259->is_slave) {
 		i8259_doirq(i8259->partner, 2);
 	}
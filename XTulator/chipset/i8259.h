@@ -37,6 +37,7 @@ typedef struct I8259_s {
 	uint8_t lastintr;
 	uint8_t enabled;
 	uint8_t is_slave;
+	uint8_t pending; //irr & ~imr is nonzero, kept up to date so the CPU doesn't have to work it out before every slice
 	struct I8259_s* partner;
 } I8259_t;
 
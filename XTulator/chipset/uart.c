@@ -18,7 +18,13 @@
 */
 
 /*
-	Emulates the 8250 UART.
+	Emulates the 8250 UART, and the 16550A's FIFOs once the guest turns them on.
+
+	The receive FIFO holds 16 bytes and interrupts at the trigger level set in
+	FCR, or with a character timeout when fewer bytes have been waiting for
+	four character times. Transmitted bytes still go straight to the device,
+	so the transmit FIFO is always empty. Devices can hand over several bytes
+	at once with uart_rxbytes, as many as uart_rxroom says there is room for.
 */
 
 #include <stdio.h>
@@ -28,14 +34,59 @@
 #include "../debuglog.h"
 #include "i8259.h"
 #include "../ports.h"
+#include "../timing.h"
 #include "uart.h"
 
 const uint8_t uart_wordmask[4] = { 0x1F, 0x3F, 0x7F, 0xFF }; //5, 6, 7, or 8 bit words based on bits 1-0 in LCR
+const uint8_t uart_trigger[4] = { 1, 4, 8, 14 }; //receive FIFO interrupt levels based on bits 7-6 in FCR
+
+static void uart_fifoClear(UART_t* uart) {
+	uart->rxfifohead = 0;
+	uart->rxfifocount = 0;
+	uart->rxnew = 0;
+	uart->pendirq &= ~(UART_PENDING_RX | UART_PENDING_TIMEOUT);
+	timing_timerDisable(uart->timeouttimer);
+}
+
+//Raises or drops the receive interrupts after the FIFO count changed
+static void uart_fifoCheck(UART_t* uart) {
+	double chars;
+
+	if (uart->rxfifocount >= uart_trigger[uart->fcr >> 6]) {
+		timing_timerDisable(uart->timeouttimer);
+		uart->pendirq &= ~UART_PENDING_TIMEOUT;
+		if (uart->ien & UART_IRQ_RX_ENABLE) {
+			uart->pendirq |= UART_PENDING_RX;
+			i8259_doirq(uart->i8259, uart->irq);
+		}
+		return;
+	}
+
+	uart->pendirq &= ~UART_PENDING_RX;
+	if (uart->rxfifocount == 0) {
+		uart->pendirq &= ~UART_PENDING_TIMEOUT;
+		timing_timerDisable(uart->timeouttimer);
+		return;
+	}
+	//restart the character timeout, 10 bits a character
+	chars = 115200.0 / (double)(uart->divisor ? uart->divisor : 1) / 10.0;
+	timing_updateIntervalFreq(uart->timeouttimer, chars / 4.0);
+	timing_timerEnable(uart->timeouttimer);
+}
+
+void uart_timeout(UART_t* uart) {
+	timing_timerDisable(uart->timeouttimer);
+	if (!(uart->fcr & 0x01) || (uart->rxfifocount == 0)) return;
+	if (uart->ien & UART_IRQ_RX_ENABLE) {
+		uart->pendirq |= UART_PENDING_TIMEOUT;
+		i8259_doirq(uart->i8259, uart->irq);
+	}
+}
 
 void uart_writeport(UART_t* uart, uint16_t addr, uint8_t value) {
-#ifdef DEBUG_UART
-	debug_log(DEBUG_DETAIL, "[UART] Write %03X: %u\r\n", addr, value);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_UART)) {
+		debug_log(DEBUG_DETAIL, "[UART] Write %03X: %u\r\n", addr, value);
+	}
 
 	addr &= 0x07;
 
@@ -69,6 +120,20 @@ void uart_writeport(UART_t* uart, uint16_t addr, uint8_t value) {
 			uart->divisor = (uart->divisor & 0x00FF) | ((uint16_t)value << 8);
 		}
 		break;
+	case 0x02: //FCR
+		if ((value ^ uart->fcr) & 0x01) { //turning the FIFOs on or off empties them
+			uart_fifoClear(uart);
+		}
+		if (value & 0x01) {
+			if (value & 0x02) {
+				uart_fifoClear(uart);
+			}
+			uart->fcr = value & 0xC9;
+		}
+		else {
+			uart->fcr = 0;
+		}
+		break;
 	case 0x03: //LCR
 		uart->lcr = value;
 		uart->dlab = value >> 7;
@@ -88,17 +153,30 @@ void uart_writeport(UART_t* uart, uint16_t addr, uint8_t value) {
 uint8_t uart_readport(UART_t* uart, uint16_t addr) {
 	uint8_t ret = 0; // xFF;
 
-#ifdef DEBUG_UART
-	debug_log(DEBUG_DETAIL, "[UART] Read %03X\r\n", addr);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_UART)) {
+		debug_log(DEBUG_DETAIL, "[UART] Read %03X\r\n", addr);
+	}
 	addr &= 0x07;
 	
 	switch (addr) {
 	case 0x00:
 		if (uart->dlab == 0) {
-			ret = uart->rx;
-			uart->rxnew = 0;
-			uart->pendirq &= ~UART_PENDING_RX;
+			if (uart->fcr & 0x01) {
+				if (uart->rxfifocount > 0) {
+					uart->rx = uart->rxfifo[uart->rxfifohead];
+					uart->rxfifohead = (uart->rxfifohead + 1) & (UART_FIFOSIZE - 1);
+					uart->rxfifocount--;
+				}
+				ret = uart->rx;
+				uart->rxnew = (uart->rxfifocount > 0) ? 1 : 0;
+				uart->pendirq &= ~UART_PENDING_TIMEOUT;
+				uart_fifoCheck(uart);
+			}
+			else {
+				ret = uart->rx;
+				uart->rxnew = 0;
+				uart->pendirq &= ~UART_PENDING_RX;
+			}
 			if (uart->ien & UART_IRQ_LSR_ENABLE) {
 				uart->pendirq |= UART_PENDING_LSR;
 				i8259_doirq(uart->i8259, uart->irq);
@@ -122,6 +200,9 @@ uint8_t uart_readport(UART_t* uart, uint16_t addr) {
 		else if (uart->pendirq & UART_PENDING_RX) {
 			ret |= 0x04;
 		}
+		else if (uart->pendirq & UART_PENDING_TIMEOUT) {
+			ret |= 0x0C;
+		}
 		else if (uart->pendirq & UART_PENDING_TX) {
 			ret |= 0x02;
 			uart->pendirq &= ~UART_PENDING_TX;
@@ -129,6 +210,9 @@ uint8_t uart_readport(UART_t* uart, uint16_t addr) {
 		else if (uart->pendirq & UART_PENDING_MSR) {
 			//nothing to do
 		}
+		if (uart->fcr & 0x01) {
+			ret |= 0xC0;
+		}
 		if (uart->pendirq) {
 			i8259_doirq(uart->i8259, uart->irq);
 		}
@@ -142,6 +226,8 @@ uint8_t uart_readport(UART_t* uart, uint16_t addr) {
 	case 0x05: //LSR
 		ret = 0x60; //transmit register always report empty in emulator
 		ret |= uart->rxnew ? 0x01 : 0x00;
+		ret |= uart->overrun ? 0x02 : 0x00;
+		uart->overrun = 0;
 		uart->pendirq &= ~UART_PENDING_LSR;
 		break;
 	case 0x06: //MSR
@@ -162,6 +248,10 @@ uint8_t uart_readport(UART_t* uart, uint16_t addr) {
 }
 
 void uart_rxdata(UART_t* uart, uint8_t value) {
+	if (uart->fcr & 0x01) {
+		uart_rxbytes(uart, &value, 1);
+		return;
+	}
 	uart->rx = value;
 	uart->rxnew = 1;
 	if (uart->ien & UART_IRQ_RX_ENABLE) {
@@ -170,8 +260,49 @@ void uart_rxdata(UART_t* uart, uint8_t value) {
 	}
 }
 
+//Bytes the receiver can take right now without an overrun
+int uart_rxroom(UART_t* uart) {
+	if (uart->fcr & 0x01) {
+		return UART_FIFOSIZE - uart->rxfifocount;
+	}
+	return uart->rxnew ? 0 : 1;
+}
+
+//How many bytes a device should hand over at once, so that each batch is one receive interrupt
+int uart_rxbatch(UART_t* uart) {
+	if (uart->fcr & 0x01) {
+		return uart_trigger[uart->fcr >> 6];
+	}
+	return 1;
+}
+
+//Queues up to len bytes, returns how many fit. The interrupt decision is made once for the whole batch.
+int uart_rxbytes(UART_t* uart, const uint8_t* data, int len) {
+	int i;
+
+	if (!(uart->fcr & 0x01)) {
+		if ((len == 0) || uart->rxnew) return 0;
+		uart_rxdata(uart, data[0]);
+		return 1;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (uart->rxfifocount == UART_FIFOSIZE) {
+			uart->overrun = 1;
+			break;
+		}
+		uart->rxfifo[(uart->rxfifohead + uart->rxfifocount) & (UART_FIFOSIZE - 1)] = data[i];
+		uart->rxfifocount++;
+	}
+	if (i > 0) {
+		uart->rxnew = 1;
+		uart_fifoCheck(uart);
+	}
+	return i;
+}
+
 void uart_init(UART_t* uart, I8259_t* i8259, uint16_t base, uint8_t irq, void (*tx)(void*, uint8_t), void* udata, void (*mcr)(void*, uint8_t), void* udata2) {
-	debug_log(DEBUG_INFO, "[UART] Initializing 8250 UART at base port 0x%03X, IRQ %u\r\n", base, irq);
+	debug_log(DEBUG_INFO, "[UART] Initializing 16550A UART at base port 0x%03X, IRQ %u\r\n", base, irq);
 	memset(uart, 0, sizeof(UART_t));
 	uart->i8259 = i8259;
 	uart->irq = irq;
@@ -180,5 +311,6 @@ void uart_init(UART_t* uart, I8259_t* i8259, uint16_t base, uint8_t irq, void (*
 	uart->udata2 = udata2;
 	uart->mcrCb = mcr;
 	uart->msr = 0x30;
+	uart->timeouttimer = timing_addGuestTimer(uart_timeout, uart, 1000, TIMING_DISABLED);
 	ports_cbRegister(base, 8, (void*)uart_readport, NULL, (void*)uart_writeport, NULL, uart);
 }
@@ -13,6 +13,9 @@
 #define UART_PENDING_TX				0x02
 #define UART_PENDING_MSR			0x04
 #define UART_PENDING_LSR			0x08
+#define UART_PENDING_TIMEOUT		0x10 //16550A character timeout, data has sat below the trigger level for four character times
+
+#define UART_FIFOSIZE				16
 
 typedef struct {
 	uint8_t rx;
@@ -30,6 +33,12 @@ typedef struct {
 	uint16_t divisor;
 	uint8_t irq;
 	uint8_t pendirq;
+	uint8_t fcr; //FIFO control register, bit 0 turns on 16550A mode
+	uint8_t rxfifo[UART_FIFOSIZE];
+	uint8_t rxfifohead;
+	uint8_t rxfifocount;
+	uint8_t overrun;
+	uint32_t timeouttimer;
 	void* udata;
 	void* udata2;
 	void (*txCb)(void*, uint8_t);
@@ -40,6 +49,9 @@ typedef struct {
 void uart_writeport(UART_t* uart, uint16_t addr, uint8_t value);
 uint8_t uart_readport(UART_t* uart, uint16_t addr);
 void uart_rxdata(UART_t* uart, uint8_t value);
+int uart_rxroom(UART_t* uart);
+int uart_rxbatch(UART_t* uart);
+int uart_rxbytes(UART_t* uart, const uint8_t* data, int len);
 void uart_init(UART_t* uart, I8259_t* i8259, uint16_t base, uint8_t irq, void (*tx)(void*, uint8_t), void* udata, void (*mcr)(void*, uint8_t), void* udata2);
 
 #endif
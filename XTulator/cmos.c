@@ -6,6 +6,7 @@
 #include "ports.h"
 #include "debuglog.h"
 #include "cmos.h"
+#include "replay.h"
 
 static uint8_t to_bcd(int val) {
 	return ((val / 10) << 4) | (val % 10);
@@ -37,7 +38,7 @@ void cmos_write(void* udata, uint32_t port, uint8_t value) {
 
 uint8_t cmos_read(void* udata, uint32_t port) {
 	CMOS_t* cmos = (CMOS_t*)udata;
-	time_t t = time(NULL);
+	time_t t = replay_time();
 	struct tm tm = *localtime(&t);
 	uint8_t ret_val = 0xFF;
 
@@ -6,31 +6,18 @@
 #define STR_TITLE "XTulator"
 #define STR_VERSION "0.24.5.24"
 
-//#define DEBUG_DMA
-//#define DEBUG_VGA
-//#define DEBUG_CGA
-//#define DEBUG_PIT
-//#define DEBUG_PIC
-//#define DEBUG_PPI
-//#define DEBUG_UART
-//#define DEBUG_TCPMODEM
-//#define DEBUG_PCSPEAKER
-//#define DEBUG_MEMORY
-//#define DEBUG_PORTS
-//#define DEBUG_TIMING
-//#define DEBUG_OPL2
-//#define DEBUG_BLASTER
-//#define DEBUG_FDC
-//#define DEBUG_NE2000
-//#define DEBUG_PCAP
-
 #define USE_DISK_HLE
 #define USE_NUKED_OPL
-//#define USE_NE2000
+#define USE_OPL_SIMD //generate OPL3 operator output three slots at a time, with SSE2 or NEON when available
+#define USE_VGA_SIMD //use SSE2 or NEON for pixel doubling in the VGA renderer
+#define USE_GL_PRESENTER //OpenGL 2.0 shader presenter through SDL, -gpu
+//#define USE_NE2000 //NE2000 adapter, on a host interface through pcap (-net <id>) or the built in NAT (-net nat)
+//#define USE_BENCH //benchmark harness (-bench), normally defined by the bench build targets instead of here
 
-#ifdef _WIN32
 #define ENABLE_TCP_MODEM
-#endif
+#define ENABLE_VNC //remote framebuffer server, -vnc
+#define ENABLE_CONTROL //automation control socket, -control
+#define ENABLE_METRICS //Prometheus metrics over HTTP, -metrics
 
 #define VIDEO_CARD_MDA		0
 #define VIDEO_CARD_CGA		1
@@ -40,6 +27,24 @@
 #define SAMPLE_RATE		48000
 #define SAMPLE_BUFFER	4800
 
+//bounds for how many instructions the main loop runs between timer checks when not throttled
+#define CPU_SLICE_MIN	100
+#define CPU_SLICE_MAX	10000
+#define CPU_IDLE_MAX	1000000	//instructions' worth of guest time a halted CPU may skip at once
+#define CPU_IDLE_SLEEP	10	//longest host sleep in milliseconds while the CPU is halted
+#define CPU_THROTTLE_MINSLEEP	100	//microseconds, the throttle spins through waits shorter than this rather than sleep
+#define CPU_THROTTLE_MAXDEBT	0.02	//seconds of instructions the throttle may fall behind before it stops trying to catch up
+#define TURBO_FRAMEDIV	8	//while fast-forwarding, only every this many frames is drawn
+
+//-idle polling detection
+#define CPU_IDLE_SPAN	32	//bytes a backward branch may go back and still count as a tight loop
+#define CPU_IDLE_SPINS	256	//identical trips around a tight loop before it counts as polling
+#define CPU_IDLE_POLLS	32	//INT 16h status checks or INT 28h calls in a row that count as polling
+#define CPU_IDLE_GAP	50000	//instructions between two of those that still count as in a row
+
+//instructions per emulated second for the guest clock when -speed isn't given (roughly a 12 MHz 286)
+#define TIMING_GUEST_IPS	3000000
+
 #ifdef _WIN32
 #define FUNC_INLINE __forceinline
 #else
@@ -51,13 +56,42 @@
 #endif
 
 extern volatile uint8_t running;
-extern uint8_t videocard, showMIPS;
+extern uint8_t videocard, showMIPS, headless, fdcfast, profiling, hugepages, videohle;
+extern char* profilecsv;
+extern double profilecsvinterval;
+extern uint32_t sampleinterval;
+extern char* samplemap;
+extern uint16_t samplemapseg;
+extern char* tracefile;
+extern char* tracedumpfile;
+extern char* capturefile;
+extern char* recordfile;
+extern char* replayfile;
+#ifdef USE_BENCH
+extern uint8_t benchmode;
+extern uint64_t benchinstructions;
+#endif
+extern char* packsrc, * packdst;
+extern char* framedump;
+extern uint16_t vncport;
+extern char* vncaddr;
+extern char* controlpath;
+extern uint16_t metricsport;
+extern char* metricsaddr;
+extern double framedumpinterval;
+extern char* loadstate;
+extern char* savestate;
+extern char* checkpointfile;
+extern double checkpointinterval;
 extern double speedarg;
 extern volatile double speed;
+extern volatile uint8_t turbo, paused;
 extern uint32_t baudrate, ramsize;
 extern char* usemachine;
 extern uint8_t bootdrive;
 
 void setspeed(double mhz);
+void setturbo(uint8_t on);
+void setpaused(uint8_t on);
 
 #endif
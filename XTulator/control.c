@@ -0,0 +1,768 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Control socket for driving a machine from scripts, enabled with
+	-control <path>. It's a Unix domain socket, which Windows 10 has too.
+
+	A client sends commands a line at a time, as many in one go as it likes,
+	and gets a reply for each in order: OK or ERR and a message, with any
+	data in lines starting with | before it. Blank lines and lines starting
+	with # get no reply, so a script file can be sent as is.
+
+	The server thread only moves bytes. It queues complete lines in
+	control_lines and raises control_events, and the main loop calls
+	control_service between slices, which runs them on the CPU thread
+	where the machine can be touched safely. A command that takes a while
+	(typing, waiting for text) is carried on by a host timer, and the
+	commands after it wait their turn, so the CPU never waits on a client.
+	A line is only taken off the queue once its command has finished, which
+	is how the server thread knows everything is done when a client that has
+	closed its end can be let go.
+
+	type <text>        type text, with \n Enter, \t Tab, \b Backspace, \e Esc and \\
+	keys <hex> ...     send raw scancodes, makes and breaks both
+	screen             the text on screen, a | line per row
+	wait <s> <text>    wait up to s seconds for text to appear on screen
+	pause, resume      stop and start the CPU and the timers
+	save <file>        write a snapshot
+	load <file>        restore a snapshot taken with the same configuration
+	insert <d> <file>  insert a disk image in fd0, fd1, hd0 or hd1
+	eject <d>          take it out again
+	speed <MHz>        change the -speed setting, 0 for unlimited
+	turbo on|off       fast-forward
+	metrics            the counters -metrics serves, a | line each
+	quit               stop the emulator
+*/
+
+#include "config.h"
+#ifdef ENABLE_CONTROL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <SDL.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/stat.h>
+pthread_t control_threadID;
+#endif
+#include "debuglog.h"
+#include "utility.h"
+#include "timing.h"
+#include "memory.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "hostthread.h"
+#include "chipset/i8042.h"
+#include "modules/disk/biosdisk.h"
+#include "modules/video/biosvideo.h"
+#include "metrics.h"
+#include "control.h"
+
+#ifdef _WIN32
+#define CONTROL_POLLFD			WSAPOLLFD
+#define control_poll(f, n, ms)	WSAPoll(f, n, ms)
+#define control_wouldBlock()	(WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#define CONTROL_POLLFD			struct pollfd
+#define control_poll(f, n, ms)	poll(f, n, ms)
+#define control_wouldBlock()	((errno == EAGAIN) || (errno == EWOULDBLOCK))
+#define closesocket				close
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define CONTROL_SENDFLAGS		MSG_NOSIGNAL
+#else
+#define CONTROL_SENDFLAGS		0
+#endif
+
+#define CONTROL_WAITHZ			20 //screen checks per second while waiting for text
+#define CONTROL_KEYSTALL		(CONTROL_KEYHZ * 2) //ticks the guest may leave a scancode unread before typing gives up
+#define CONTROL_MAXROWS			60
+
+SDL_atomic_t control_events;
+SDL_atomic_t control_hangup; //the server thread lost its client and waits for the CPU thread to clear up after it
+SDL_atomic_t control_overflow; //a reply didn't fit, the client isn't reading them
+
+CONTROL_LINE_t control_lines[CONTROL_LINES];
+SDL_atomic_t control_lineHead, control_lineTail;
+char control_replies[CONTROL_REPLYRING];
+SDL_atomic_t control_replyHead, control_replyTail;
+
+//server thread side
+CONTROL_SOCKET control_server = CONTROL_NOSOCKET, control_client = CONTROL_NOSOCKET;
+char control_rx[CONTROL_LINE];
+uint32_t control_rxLen = 0;
+uint8_t control_rxSkip = 0; //throwing away the rest of an overlong line
+uint8_t control_eof = 0; //the client has sent all it's going to
+
+//CPU thread side
+MACHINE_t* control_machine = NULL;
+uint32_t control_timer;
+uint8_t control_op = CONTROL_OP_NONE;
+uint8_t control_keys[CONTROL_KEYQUEUE];
+uint32_t control_keyPos, control_keyCount, control_keyStall;
+char* control_waitText = NULL;
+uint64_t control_waitUntil;
+char control_text[CONTROL_MAXROWS][CONTROL_MAXCOLS + 1];
+char control_metrics[METRICS_TEXT];
+
+//a key's plain and shifted character share its scancode
+static const struct {
+	const char* plain;
+	const char* shifted;
+	uint8_t first;
+} control_keyrows[] = {
+	{ "1234567890-=", "!@#$%^&*()_+", 0x02 },
+	{ "qwertyuiop[]", "QWERTYUIOP{}", 0x10 },
+	{ "asdfghjkl;'`", "ASDFGHJKL:\"~", 0x1E },
+	{ "\\zxcvbnm,./", "|ZXCVBNM<>?", 0x2B }
+};
+
+static void control_reply(const char* fmt, ...) {
+	char buf[CONTROL_LINE + CONTROL_MAXCOLS];
+	uint32_t head, len, i;
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vsnprintf(buf, sizeof(buf) - 1, fmt, args);
+	va_end(args);
+	if (ret < 0) return;
+	len = ((uint32_t)ret > (sizeof(buf) - 2)) ? (sizeof(buf) - 2) : (uint32_t)ret;
+	buf[len++] = '\n';
+
+	head = (uint32_t)SDL_AtomicGet(&control_replyHead);
+	if ((CONTROL_REPLYRING - (head - (uint32_t)SDL_AtomicGet(&control_replyTail))) < len) {
+		SDL_AtomicSet(&control_overflow, 1);
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		control_replies[(head + i) & (CONTROL_REPLYRING - 1)] = buf[i];
+	}
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&control_replyHead, (int)(head + len));
+}
+
+/*
+	Copies the text page on screen into control_text, a row per line with
+	anything unprintable as a space or ?, for the BIOS text modes only.
+*/
+static int control_readScreen(uint16_t* cols, uint16_t* rows, uint16_t* cursor) {
+	CPU_t* cpu = &control_machine->CPU;
+	uint8_t cells[CONTROL_MAXCOLS * 2], mode, page, c;
+	uint32_t vram;
+	uint16_t x, y;
+
+	mode = cpu_read(cpu, BIOSVIDEO_BDA_MODE) & 0x7F;
+	if ((mode > 3) && (mode != 7)) return -1;
+	*cols = cpu_readw(cpu, BIOSVIDEO_BDA_COLS);
+	*rows = cpu_read(cpu, BIOSVIDEO_BDA_ROWS);
+	*rows = (*rows == 0) ? 25 : (*rows + 1);
+	if ((*cols == 0) || (*cols > CONTROL_MAXCOLS) || (*rows > CONTROL_MAXROWS)) return -1;
+	page = cpu_read(cpu, BIOSVIDEO_BDA_PAGE) & 7;
+	*cursor = cpu_readw(cpu, BIOSVIDEO_BDA_CURSOR + (uint32_t)page * 2);
+	vram = ((mode == 7) ? 0xB0000 : 0xB8000) + cpu_readw(cpu, BIOSVIDEO_BDA_PAGESTART);
+
+	for (y = 0; y < *rows; y++) {
+		memory_readBlock(vram + (uint32_t)y * *cols * 2, cells, (uint32_t)*cols * 2);
+		for (x = 0; x < *cols; x++) {
+			c = cells[x * 2];
+			control_text[y][x] = (c < ' ') ? ' ' : ((c >= 0x7F) ? '?' : (char)c);
+		}
+		control_text[y][x] = 0;
+	}
+	return 0;
+}
+
+static int control_onScreen(const char* text) {
+	uint16_t cols, rows, cursor, y;
+
+	if (control_readScreen(&cols, &rows, &cursor)) return 0;
+	for (y = 0; y < rows; y++) {
+		if (strstr(control_text[y], text) != NULL) return 1;
+	}
+	return 0;
+}
+
+static int control_pushKey(uint8_t scancode) {
+	if (control_keyCount == CONTROL_KEYQUEUE) return -1;
+	control_keys[control_keyCount++] = scancode;
+	return 0;
+}
+
+//Turns text into the makes and breaks that type it, with Shift around the characters that need it
+static int control_queueText(const char* text) {
+	uint8_t scancode, shift;
+	const char* pos;
+	char c;
+	uint32_t i;
+
+	for (; *text; text++) {
+		c = *text;
+		if ((c == '\\') && (text[1] != 0)) {
+			switch (*++text) {
+			case 'n': case 'r': c = '\r'; break;
+			case 't': c = '\t'; break;
+			case 'b': c = '\b'; break;
+			case 'e': c = 0x1B; break;
+			default: c = *text; break;
+			}
+		}
+		scancode = 0;
+		shift = 0;
+		switch (c) {
+		case ' ': scancode = 0x39; break;
+		case '\r': scancode = 0x1C; break;
+		case '\t': scancode = 0x0F; break;
+		case '\b': scancode = 0x0E; break;
+		case 0x1B: scancode = 0x01; break;
+		default:
+			for (i = 0; (i < sizeof(control_keyrows) / sizeof(control_keyrows[0])) && (scancode == 0); i++) {
+				if ((pos = strchr(control_keyrows[i].plain, c)) != NULL) {
+					scancode = control_keyrows[i].first + (uint8_t)(pos - control_keyrows[i].plain);
+				}
+				else if ((pos = strchr(control_keyrows[i].shifted, c)) != NULL) {
+					scancode = control_keyrows[i].first + (uint8_t)(pos - control_keyrows[i].shifted);
+					shift = 1;
+				}
+			}
+			break;
+		}
+		if (scancode == 0) return -1;
+		if ((shift && control_pushKey(0x2A)) || control_pushKey(scancode) || control_pushKey(scancode | 0x80) || (shift && control_pushKey(0xAA))) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//Starts a command that takes a while, the timer carries it on
+static void control_begin(uint8_t op, double hz) {
+	control_op = op;
+	timing_updateIntervalFreq(control_timer, hz);
+	timing_timerEnable(control_timer);
+}
+
+static void control_run();
+
+//A command is done, the line it came on can go and the next one can run
+static void control_next() {
+	uint32_t tail;
+
+	tail = (uint32_t)SDL_AtomicGet(&control_lineTail);
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&control_lineTail, (int)(tail + 1));
+}
+
+static void control_finish(const char* reply) {
+	control_reply("%s", reply);
+	control_op = CONTROL_OP_NONE;
+	timing_timerDisable(control_timer);
+	control_next();
+	control_run();
+}
+
+static void control_tick(void* dummy) {
+	uint8_t scancode;
+
+	if (control_op == CONTROL_OP_KEYS) {
+		if (control_machine->i8042.status & 1) { //the guest hasn't read the last one yet
+			if (++control_keyStall >= CONTROL_KEYSTALL) {
+				control_finish("ERR the guest stopped reading the keyboard");
+			}
+			return;
+		}
+		control_keyStall = 0;
+		scancode = control_keys[control_keyPos++];
+		if (replay_input(REPLAY_KEY, &control_machine->i8042, &scancode, 1)) {
+			i8042_send_scancode(&control_machine->i8042, scancode);
+		}
+		if (control_keyPos == control_keyCount) {
+			control_finish("OK");
+		}
+	}
+	else if (control_op == CONTROL_OP_WAIT) {
+		if (control_onScreen(control_waitText)) {
+			control_finish("OK");
+		}
+		else if (SDL_GetPerformanceCounter() >= control_waitUntil) {
+			control_finish("ERR timed out");
+		}
+	}
+}
+
+static int control_drive(const char* name) {
+	static const char* names[4] = { "fd0", "fd1", "hd0", "hd1" };
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (!_stricmp(name, names[i])) return i;
+	}
+	return -1;
+}
+
+//Runs one line. Commands that finish straight away reply here, the others through control_finish.
+static void control_command(CONTROL_LINE_t* line) {
+	char* cmd, * arg, * end;
+	uint16_t cols, rows, cursor, y;
+	unsigned long value;
+	double num;
+	int drive, len;
+
+	if (line->overlong) {
+		control_reply("ERR line is too long");
+		return;
+	}
+	cmd = line->text + strspn(line->text, " \t");
+	if ((*cmd == 0) || (*cmd == '#')) return;
+	arg = cmd + strcspn(cmd, " \t");
+	if (*arg != 0) {
+		*arg++ = 0;
+	}
+
+	if (!_stricmp(cmd, "type")) { //the text starts right after the one space, it can start with spaces of its own
+		control_keyPos = control_keyCount = control_keyStall = 0;
+		if (control_queueText(arg)) {
+			control_reply("ERR can't type that");
+		}
+		else if (control_keyCount == 0) {
+			control_reply("OK");
+		}
+		else {
+			control_begin(CONTROL_OP_KEYS, CONTROL_KEYHZ);
+		}
+		return;
+	}
+
+	arg += strspn(arg, " \t");
+	for (len = (int)strlen(arg); (len > 0) && ((arg[len - 1] == ' ') || (arg[len - 1] == '\t')); len--) {
+		arg[len - 1] = 0;
+	}
+
+	if (!_stricmp(cmd, "keys")) {
+		control_keyPos = control_keyCount = control_keyStall = 0;
+		while (*arg != 0) {
+			value = strtoul(arg, &end, 16);
+			if ((end == arg) || (value > 0xFF) || ((*end != 0) && (*end != ' ') && (*end != '\t')) || control_pushKey((uint8_t)value)) {
+				control_reply("ERR bad scancode list");
+				return;
+			}
+			arg = end + strspn(end, " \t");
+		}
+		if (control_keyCount == 0) {
+			control_reply("OK");
+		}
+		else {
+			control_begin(CONTROL_OP_KEYS, CONTROL_KEYHZ);
+		}
+	}
+	else if (!_stricmp(cmd, "screen")) {
+		if (control_readScreen(&cols, &rows, &cursor)) {
+			control_reply("ERR not in a text mode");
+			return;
+		}
+		for (y = 0; y < rows; y++) {
+			for (len = (int)cols; (len > 0) && (control_text[y][len - 1] == ' '); len--) {
+				control_text[y][len - 1] = 0;
+			}
+			control_reply("|%s", control_text[y]);
+		}
+		control_reply("OK %ux%u cursor %u,%u", cols, rows, cursor >> 8, cursor & 0xFF);
+	}
+	else if (!_stricmp(cmd, "wait")) {
+		num = strtod(arg, &end);
+		if ((end == arg) || (num < 0) || ((*end != ' ') && (*end != '\t'))) {
+			control_reply("ERR usage: wait <seconds> <text>");
+			return;
+		}
+		control_waitText = end + 1;
+		if (control_onScreen(control_waitText)) {
+			control_reply("OK");
+			return;
+		}
+		control_waitUntil = SDL_GetPerformanceCounter() + (uint64_t)(num * (double)SDL_GetPerformanceFrequency());
+		control_begin(CONTROL_OP_WAIT, CONTROL_WAITHZ);
+	}
+	else if (!_stricmp(cmd, "pause") || !_stricmp(cmd, "resume")) {
+		setpaused(!_stricmp(cmd, "pause"));
+		control_reply("OK");
+	}
+	else if (!_stricmp(cmd, "save") || !_stricmp(cmd, "load")) {
+		if (*arg == 0) {
+			control_reply("ERR usage: %s <file>", cmd);
+		}
+		else if (!_stricmp(cmd, "save") ? snapshot_save(control_machine, arg) : snapshot_load(control_machine, arg)) {
+			control_reply("ERR unable to %s %s", !_stricmp(cmd, "save") ? "save to" : "restore", arg);
+		}
+		else {
+			control_reply("OK");
+		}
+	}
+	else if (!_stricmp(cmd, "insert")) {
+		end = arg + strcspn(arg, " \t");
+		if (*end != 0) {
+			*end++ = 0;
+			end += strspn(end, " \t");
+		}
+		drive = control_drive(arg);
+		if ((drive < 0) || (*end == 0)) {
+			control_reply("ERR usage: insert fd0|fd1|hd0|hd1 <file>");
+		}
+		else if (biosdisk_insert(&control_machine->CPU, (uint8_t)drive, end)) {
+			control_reply("ERR unable to insert %s", end);
+		}
+		else {
+			control_reply("OK");
+		}
+	}
+	else if (!_stricmp(cmd, "eject")) {
+		drive = control_drive(arg);
+		if (drive < 0) {
+			control_reply("ERR usage: eject fd0|fd1|hd0|hd1");
+			return;
+		}
+		biosdisk_eject(&control_machine->CPU, (uint8_t)drive);
+		control_reply("OK");
+	}
+	else if (!_stricmp(cmd, "speed")) {
+		num = strtod(arg, &end);
+		if ((end == arg) || (*end != 0) || (num < 0)) {
+			control_reply("ERR usage: speed <MHz>");
+			return;
+		}
+		setspeed(num);
+		control_reply("OK");
+	}
+	else if (!_stricmp(cmd, "turbo")) {
+		if (!_stricmp(arg, "on") || !_stricmp(arg, "off")) {
+			setturbo(!_stricmp(arg, "on"));
+			control_reply("OK");
+		}
+		else {
+			control_reply("ERR usage: turbo on|off");
+		}
+	}
+	else if (!_stricmp(cmd, "metrics")) {
+		char* text;
+		char* eol;
+		if (metrics_format(control_metrics, sizeof(control_metrics)) < 0) {
+			control_reply("ERR metrics didn't fit");
+			return;
+		}
+		for (text = control_metrics; *text; text = eol + 1) {
+			eol = strchr(text, '\n');
+			if (eol == NULL) break;
+			*eol = 0;
+			control_reply("|%s", text);
+		}
+		control_reply("OK");
+	}
+	else if (!_stricmp(cmd, "quit")) {
+		control_reply("OK");
+		running = 0;
+	}
+	else {
+		control_reply("ERR unknown command %s", cmd);
+	}
+}
+
+//Runs queued lines until one of them has to wait for something
+static void control_run() {
+	uint32_t tail;
+
+	while (control_op == CONTROL_OP_NONE) {
+		tail = (uint32_t)SDL_AtomicGet(&control_lineTail);
+		if (tail == (uint32_t)SDL_AtomicGet(&control_lineHead)) return;
+		SDL_MemoryBarrierAcquire();
+		control_command(&control_lines[tail % CONTROL_LINES]);
+		if (control_op == CONTROL_OP_NONE) {
+			control_next();
+		}
+	}
+}
+
+//From the main loop when the server thread has raised control_events
+void control_service() {
+	SDL_AtomicSet(&control_events, 0);
+	if (SDL_AtomicGet(&control_hangup)) {
+		//the server thread is waiting on this, so both queues can be emptied from here
+		control_op = CONTROL_OP_NONE;
+		timing_timerDisable(control_timer);
+		SDL_AtomicSet(&control_lineTail, SDL_AtomicGet(&control_lineHead));
+		SDL_AtomicSet(&control_replyTail, SDL_AtomicGet(&control_replyHead));
+		SDL_AtomicSet(&control_overflow, 0);
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&control_hangup, 0);
+		return;
+	}
+	control_run();
+}
+
+static void control_setNonblocking(CONTROL_SOCKET sock) {
+#ifdef _WIN32
+	unsigned long iMode = 1;
+	ioctlsocket(sock, FIONBIO, &iMode);
+#else
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+static void control_accept() {
+	CONTROL_SOCKET sock;
+
+	sock = accept(control_server, NULL, NULL);
+	if (sock == CONTROL_NOSOCKET) return;
+	control_setNonblocking(sock);
+	control_client = sock;
+	control_rxLen = 0;
+	control_rxSkip = 0;
+	control_eof = 0;
+	debug_log(DEBUG_INFO, "[CONTROL] Client connected\r\n");
+}
+
+static void control_disconnect() {
+	closesocket(control_client);
+	control_client = CONTROL_NOSOCKET;
+	SDL_AtomicSet(&control_hangup, 1);
+	SDL_AtomicSet(&control_events, 1);
+	debug_log(DEBUG_INFO, "[CONTROL] Client disconnected\r\n");
+}
+
+//Queues the complete lines in control_rx, whatever doesn't fit yet stays there
+static void control_split() {
+	CONTROL_LINE_t* line;
+	uint32_t start = 0, len, head;
+	char* nl;
+
+	while (1) {
+		nl = (char*)memchr(control_rx + start, '\n', control_rxLen - start);
+		if (nl == NULL) {
+			if ((start > 0) || (control_rxLen < sizeof(control_rx))) break;
+			nl = control_rx + control_rxLen; //full with no end in sight, it's overlong
+		}
+		len = (uint32_t)(nl - (control_rx + start));
+		if (control_rxSkip) { //the end of a line already answered as overlong
+			control_rxSkip = (nl == (control_rx + control_rxLen));
+			start += len + ((nl < (control_rx + control_rxLen)) ? 1 : 0);
+			continue;
+		}
+		head = (uint32_t)SDL_AtomicGet(&control_lineHead);
+		if ((head - (uint32_t)SDL_AtomicGet(&control_lineTail)) >= CONTROL_LINES) break;
+		line = &control_lines[head % CONTROL_LINES];
+		line->overlong = (nl == (control_rx + control_rxLen));
+		if ((len > 0) && (control_rx[start + len - 1] == '\r')) {
+			len--;
+		}
+		if (!line->overlong) {
+			memcpy(line->text, control_rx + start, len);
+			line->text[len] = 0;
+			line->len = (uint16_t)len;
+		}
+		control_rxSkip = line->overlong;
+		start += (uint32_t)(nl - (control_rx + start)) + (line->overlong ? 0 : 1);
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&control_lineHead, (int)(head + 1));
+		SDL_AtomicSet(&control_events, 1);
+	}
+	if (start > 0) {
+		memmove(control_rx, control_rx + start, control_rxLen - start);
+		control_rxLen -= start;
+	}
+}
+
+//Sends what replies it can without blocking, returns -1 when the connection has gone
+static int control_send() {
+	uint32_t head, tail, len;
+	int ret;
+
+	tail = (uint32_t)SDL_AtomicGet(&control_replyTail);
+	head = (uint32_t)SDL_AtomicGet(&control_replyHead);
+	SDL_MemoryBarrierAcquire();
+	while (head != tail) {
+		len = head - tail;
+		if (len > (CONTROL_REPLYRING - (tail & (CONTROL_REPLYRING - 1)))) {
+			len = CONTROL_REPLYRING - (tail & (CONTROL_REPLYRING - 1)); //up to the end of the ring, the rest next time round
+		}
+		ret = send(control_client, control_replies + (tail & (CONTROL_REPLYRING - 1)), (int)len, CONTROL_SENDFLAGS);
+		if (ret <= 0) {
+			if ((ret < 0) && control_wouldBlock()) break;
+			return -1;
+		}
+		tail += (uint32_t)ret;
+	}
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&control_replyTail, (int)tail);
+	return 0;
+}
+
+#ifdef _WIN32
+void control_thread(void* dummy) {
+#else
+void* control_thread(void* dummy) {
+#endif
+	CONTROL_POLLFD fd;
+	int ret;
+
+	hostthread_apply(HOSTTHREAD_NET);
+
+	while (running) {
+		if (control_client == CONTROL_NOSOCKET) {
+			if (SDL_AtomicGet(&control_hangup)) { //the CPU thread hasn't cleared up after the last client yet
+				utility_sleep(CONTROL_POLLMS);
+				continue;
+			}
+			fd.fd = control_server;
+			fd.events = POLLIN;
+			fd.revents = 0;
+			if (control_poll(&fd, 1, CONTROL_POLLMS) > 0) {
+				control_accept();
+			}
+			continue;
+		}
+		if (SDL_AtomicGet(&control_overflow)) {
+			debug_log(DEBUG_INFO, "[CONTROL] Client isn't reading its replies\r\n");
+			control_disconnect();
+			continue;
+		}
+
+		fd.fd = control_client;
+		fd.events = 0;
+		if (!control_eof && (control_rxLen < sizeof(control_rx))) fd.events |= POLLIN;
+		if (SDL_AtomicGet(&control_replyHead) != SDL_AtomicGet(&control_replyTail)) fd.events |= POLLOUT;
+		fd.revents = 0;
+		if (fd.events == 0) { //poll would only report the hangup of a client that's done sending, over and over
+			utility_sleep(CONTROL_POLLMS);
+			ret = 0;
+		}
+		else {
+			ret = control_poll(&fd, 1, CONTROL_POLLMS);
+		}
+		if (ret < 0) {
+			control_disconnect();
+			continue;
+		}
+		if (fd.revents & POLLIN) {
+			ret = recv(control_client, control_rx + control_rxLen, (int)(sizeof(control_rx) - control_rxLen), 0);
+			if (ret > 0) {
+				control_rxLen += (uint32_t)ret;
+			}
+			else if ((ret == 0) || !control_wouldBlock()) {
+				control_eof = 1;
+				if ((control_rxLen > 0) && (control_rxLen < sizeof(control_rx))) {
+					control_rx[control_rxLen++] = '\n'; //the last line needn't have an end
+				}
+			}
+		}
+		else if (fd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			control_eof = 1;
+		}
+		control_split();
+		if (((fd.revents & POLLOUT) || control_eof) && control_send()) {
+			control_disconnect();
+			continue;
+		}
+		//a client that's done sending is let go once everything it sent has run and been answered
+		if (control_eof && (control_rxLen == 0) &&
+			(SDL_AtomicGet(&control_lineHead) == SDL_AtomicGet(&control_lineTail)) &&
+			(SDL_AtomicGet(&control_replyHead) == SDL_AtomicGet(&control_replyTail))) {
+			control_disconnect();
+		}
+	}
+	if (control_client != CONTROL_NOSOCKET) { //the reply to quit, if that's what stopped it
+		control_send();
+	}
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+//A socket left behind by an earlier run makes bind fail. Anything else at the path is left alone.
+static void control_removeStale(char* path) {
+#ifdef _WIN32
+	DWORD attr = GetFileAttributesA(path);
+	if ((attr != INVALID_FILE_ATTRIBUTES) && (attr & FILE_ATTRIBUTE_REPARSE_POINT)) {
+		DeleteFileA(path);
+	}
+#else
+	struct stat st;
+	if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+#endif
+}
+
+int control_init(MACHINE_t* machine, char* path) {
+	struct sockaddr_un addr;
+#ifdef _WIN32
+	WSADATA wsa;
+#endif
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		debug_log(DEBUG_ERROR, "[CONTROL] Socket path %s is too long\r\n", path);
+		return -1;
+	}
+#ifdef _WIN32
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+	control_machine = machine;
+	SDL_AtomicSet(&control_events, 0);
+	SDL_AtomicSet(&control_hangup, 0);
+	SDL_AtomicSet(&control_overflow, 0);
+	SDL_AtomicSet(&control_lineHead, 0);
+	SDL_AtomicSet(&control_lineTail, 0);
+	SDL_AtomicSet(&control_replyHead, 0);
+	SDL_AtomicSet(&control_replyTail, 0);
+
+	control_server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (control_server == CONTROL_NOSOCKET) {
+		debug_log(DEBUG_ERROR, "[CONTROL] Could not create socket to listen on\r\n");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	control_removeStale(path);
+	if (bind(control_server, (struct sockaddr*)&addr, sizeof(addr)) || listen(control_server, 1)) {
+		debug_log(DEBUG_ERROR, "[CONTROL] Unable to listen on %s\r\n", path);
+		closesocket(control_server);
+		control_server = CONTROL_NOSOCKET;
+		return -1;
+	}
+	control_setNonblocking(control_server);
+
+	control_timer = timing_addTimer(control_tick, NULL, CONTROL_KEYHZ, TIMING_DISABLED);
+
+#ifdef _WIN32
+	_beginthread(control_thread, 0, NULL);
+#else
+	pthread_create(&control_threadID, NULL, control_thread, NULL);
+#endif
+	debug_log(DEBUG_INFO, "[CONTROL] Listening for commands on %s\r\n", path);
+	return 0;
+}
+#endif
@@ -0,0 +1,49 @@
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include "config.h"
+
+#ifdef ENABLE_CONTROL
+#include <stdint.h>
+#include <SDL.h>
+#include "machine.h"
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <afunix.h>
+typedef SOCKET CONTROL_SOCKET;
+#define CONTROL_NOSOCKET	INVALID_SOCKET
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+typedef int CONTROL_SOCKET;
+#define CONTROL_NOSOCKET	-1
+#endif
+
+#define CONTROL_LINE		1024 //longest command line, including the newline
+#define CONTROL_LINES		64 //command lines the server thread can queue ahead of the CPU thread, power of two
+#define CONTROL_REPLYRING	65536 //bytes of replies the CPU thread can queue ahead of the client, power of two
+#define CONTROL_POLLMS		5 //longest the server thread sits in poll() before it looks for replies to send
+#define CONTROL_KEYHZ		200 //scancodes typed per second at most, each waits for the guest to read the last
+#define CONTROL_KEYQUEUE	4096 //scancodes a type or keys command can expand to
+#define CONTROL_MAXCOLS		132
+
+//what the CPU thread is in the middle of, the next command waits for it
+#define CONTROL_OP_NONE		0
+#define CONTROL_OP_KEYS		1
+#define CONTROL_OP_WAIT		2
+
+typedef struct {
+	uint16_t len;
+	uint8_t overlong; //didn't fit in CONTROL_LINE, only an error goes back
+	char text[CONTROL_LINE];
+} CONTROL_LINE_t;
+
+extern SDL_atomic_t control_events;
+
+int control_init(MACHINE_t* machine, char* path);
+void control_service();
+#endif
+
+#endif
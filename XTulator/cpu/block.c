@@ -0,0 +1,466 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Block translator for the "block" CPU core.
+
+	Once an instruction has started executing BLOCK_HOT times in real mode,
+	the straight run of code from there up to and including the next short or
+	near branch is translated into an array of pre-decoded ops: prefixes,
+	ModRM, displacements and immediates are all resolved, so cpu_blockRun in
+	cpu.c only has to switch on the op kind. Anything not covered here ends
+	the block early, and is left to the interpreter.
+
+	Blocks never cross a page, and live on the decode cache's pages. Their
+	bytes are marked in blockcover[], and a guest write to one of those bytes
+	orphans every block on the page by bumping its blockgen. Pages that keep
+	getting their code rewritten are left to the decode cache after a while.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../config.h"
+#include "../debuglog.h"
+#include "../utility.h"
+#include "../memory.h"
+#include "cpu.h"
+#include "decode.h"
+#include "block.h"
+
+extern const uint8_t lazysafe[0x100];
+
+BLOCK_t* block_pool = NULL;
+uint32_t block_next = 0, block_epoch = 1;
+uint32_t block_generation = 0; //bumped by every invalidation, so a running block can tell it was written over
+
+void block_invalidate(DECODE_PAGE_t* dpage) {
+	memset(dpage->blockcover, 0, sizeof(dpage->blockcover));
+	dpage->blocks = 0;
+	dpage->blockgen++;
+	dpage->blockkills++;
+	block_generation++;
+}
+
+//Decodes a ModRM byte and its displacement, returns the bytes taken or 0 if they go past room
+static uint32_t block_modrm(const uint8_t* code, uint32_t room, BLOCK_OP_t* op) {
+	uint32_t len = 1;
+
+	if (room < 1) return 0;
+	op->mode = code[0] >> 6;
+	op->reg = (code[0] >> 3) & 7;
+	op->rm = code[0] & 7;
+	op->disp16 = 0;
+
+	switch (op->mode) {
+	case 0:
+		if (op->rm == 6) {
+			if (room < 3) return 0;
+			op->disp16 = (uint16_t)code[1] | ((uint16_t)code[2] << 8);
+			len = 3;
+		}
+		if (((op->rm == 2) || (op->rm == 3)) && !op->segoverride) {
+			op->seg = regss;
+		}
+		break;
+	case 1:
+		if (room < 2) return 0;
+		op->disp16 = (uint16_t)(int16_t)(int8_t)code[1];
+		len = 2;
+		if (((op->rm == 2) || (op->rm == 3) || (op->rm == 6)) && !op->segoverride) {
+			op->seg = regss;
+		}
+		break;
+	case 2:
+		if (room < 3) return 0;
+		op->disp16 = (uint16_t)code[1] | ((uint16_t)code[2] << 8);
+		len = 3;
+		if (((op->rm == 2) || (op->rm == 3) || (op->rm == 6)) && !op->segoverride) {
+			op->seg = regss;
+		}
+		break;
+	}
+
+	return len;
+}
+
+static BLOCK_t* block_translate(DECODE_PAGE_t* dpage, DECODE_ENTRY_t* entry, uint32_t linear, uint16_t ip) {
+	BLOCK_t* block;
+	BLOCK_OP_t* op;
+	const uint8_t* code;
+	uint32_t offset, room, pos, start, len, i;
+	uint8_t ends;
+
+	code = memory_pages[linear >> MEMORY_PAGE_SHIFT].read;
+	if (code == NULL) {
+		return NULL;
+	}
+	offset = linear & MEMORY_PAGE_MASK;
+	code += offset;
+	room = MEMORY_PAGE_SIZE - offset;
+	if (room > (0x10000 - (uint32_t)ip)) {
+		room = 0x10000 - (uint32_t)ip; //IP must not wrap inside a block
+	}
+
+	if (block_pool == NULL) {
+		block_pool = (BLOCK_t*)utility_allocPages(sizeof(BLOCK_t) * BLOCK_MAXBLOCKS, "Block pool");
+		if (block_pool == NULL) {
+			debug_log(DEBUG_ERROR, "[BLOCK] Unable to allocate the block pool\r\n");
+			return NULL;
+		}
+	}
+	if (block_next == BLOCK_MAXBLOCKS) {
+		block_next = 0;
+		block_epoch++; //every block out there is stale now
+	}
+	block = &block_pool[block_next];
+	block->count = 0;
+
+	pos = 0;
+	ends = 0;
+	while (!ends && (block->count < BLOCK_MAXOPS)) {
+		op = &block->op[block->count];
+		start = pos;
+		op->seg = regds;
+		op->segoverride = 0;
+		op->mode = 3;
+		op->disp16 = 0;
+		op->imm = 0;
+		op->alu = 0;
+		op->flags = 0;
+
+		//segment overrides are the only prefixes taken, anything with LOCK or REP goes to the interpreter
+		for (i = 0; (pos < room) && (i < DECODE_MAXLEN); i++, pos++) {
+			if (code[pos] == 0x26) op->seg = reges;
+			else if (code[pos] == 0x2E) op->seg = regcs;
+			else if (code[pos] == 0x36) op->seg = regss;
+			else if (code[pos] == 0x3E) op->seg = regds;
+			else break;
+			op->segoverride = 1;
+		}
+		if (pos >= room) break;
+		op->opcode = code[pos];
+		op->at = (uint16_t)pos;
+		pos++;
+
+#define BLOCK_NEED(n) if ((pos + (n)) > room) goto stop
+#define BLOCK_IMM8() code[pos]
+#define BLOCK_IMM16() ((uint16_t)code[pos] | ((uint16_t)code[pos + 1] << 8))
+#define BLOCK_MODRM() len = block_modrm(code + pos, room - pos, op); if (len == 0) goto stop; pos += len
+
+		if ((op->opcode < 0x40) && ((op->opcode & 7) < 6)) {
+			op->alu = op->opcode >> 3;
+			switch (op->opcode & 7) {
+			case 0:
+			case 1:
+				op->kind = (op->opcode & 1) ? BLOCK_OP_ALU16_EG : BLOCK_OP_ALU8_EG;
+				BLOCK_MODRM();
+				if ((op->mode < 3) && (op->alu != 7)) op->flags |= BLOCK_FLAG_WRITE;
+				break;
+			case 2:
+			case 3:
+				op->kind = (op->opcode & 1) ? BLOCK_OP_ALU16_GE : BLOCK_OP_ALU8_GE;
+				BLOCK_MODRM();
+				break;
+			case 4:
+				op->kind = BLOCK_OP_ALU8_AI;
+				BLOCK_NEED(1);
+				op->imm = BLOCK_IMM8();
+				pos += 1;
+				break;
+			case 5:
+				op->kind = BLOCK_OP_ALU16_AI;
+				BLOCK_NEED(2);
+				op->imm = BLOCK_IMM16();
+				pos += 2;
+				break;
+			}
+		}
+		else switch (op->opcode) {
+		case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
+			op->kind = BLOCK_OP_INC16;
+			op->reg = op->opcode & 7;
+			break;
+		case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F:
+			op->kind = BLOCK_OP_DEC16;
+			op->reg = op->opcode & 7;
+			break;
+		case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
+			op->kind = BLOCK_OP_PUSH16;
+			op->reg = op->opcode & 7;
+			op->flags |= BLOCK_FLAG_WRITE;
+			break;
+		case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
+			op->kind = BLOCK_OP_POP16;
+			op->reg = op->opcode & 7;
+			break;
+		case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+		case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F:
+			op->kind = BLOCK_OP_JCC;
+			BLOCK_NEED(1);
+			op->imm = (uint16_t)(int16_t)(int8_t)BLOCK_IMM8();
+			pos += 1;
+			ends = 1;
+			break;
+		case 0x80:
+		case 0x82:
+			op->kind = BLOCK_OP_GRP1_8;
+			BLOCK_MODRM();
+			BLOCK_NEED(1);
+			op->imm = BLOCK_IMM8();
+			pos += 1;
+			op->alu = op->reg;
+			if ((op->mode < 3) && (op->alu != 7)) op->flags |= BLOCK_FLAG_WRITE;
+			break;
+		case 0x81:
+		case 0x83:
+			op->kind = BLOCK_OP_GRP1_16;
+			BLOCK_MODRM();
+			if (op->opcode == 0x81) {
+				BLOCK_NEED(2);
+				op->imm = BLOCK_IMM16();
+				pos += 2;
+			}
+			else {
+				BLOCK_NEED(1);
+				op->imm = (uint16_t)(int16_t)(int8_t)BLOCK_IMM8();
+				pos += 1;
+			}
+			op->alu = op->reg;
+			if ((op->mode < 3) && (op->alu != 7)) op->flags |= BLOCK_FLAG_WRITE;
+			break;
+		case 0x84:
+		case 0x85:
+			op->kind = (op->opcode & 1) ? BLOCK_OP_TEST16_EG : BLOCK_OP_TEST8_EG;
+			BLOCK_MODRM();
+			break;
+		case 0x86:
+		case 0x87:
+			op->kind = (op->opcode & 1) ? BLOCK_OP_XCHG16 : BLOCK_OP_XCHG8;
+			BLOCK_MODRM();
+			if (op->mode < 3) op->flags |= BLOCK_FLAG_WRITE;
+			break;
+		case 0x88:
+		case 0x89:
+			op->kind = (op->opcode & 1) ? BLOCK_OP_MOV16_EG : BLOCK_OP_MOV8_EG;
+			BLOCK_MODRM();
+			if (op->mode < 3) op->flags |= BLOCK_FLAG_WRITE;
+			break;
+		case 0x8A:
+		case 0x8B:
+			op->kind = (op->opcode & 1) ? BLOCK_OP_MOV16_GE : BLOCK_OP_MOV8_GE;
+			BLOCK_MODRM();
+			break;
+		case 0x8D:
+			op->kind = BLOCK_OP_LEA;
+			BLOCK_MODRM();
+			if (op->mode == 3) goto stop; //raises #UD, the interpreter can have it
+			break;
+		case 0x90:
+			op->kind = BLOCK_OP_NOP;
+			break;
+		case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
+			op->kind = BLOCK_OP_XCHGAX;
+			op->reg = op->opcode & 7;
+			break;
+		case 0x98:
+			op->kind = BLOCK_OP_CBW;
+			break;
+		case 0x99:
+			op->kind = BLOCK_OP_CWD;
+			break;
+		case 0xA0:
+		case 0xA1:
+			op->kind = (op->opcode & 1) ? BLOCK_OP_MOV16_AM : BLOCK_OP_MOV8_AM;
+			BLOCK_NEED(2);
+			op->imm = BLOCK_IMM16();
+			pos += 2;
+			break;
+		case 0xA2:
+		case 0xA3:
+			op->kind = (op->opcode & 1) ? BLOCK_OP_MOV16_MA : BLOCK_OP_MOV8_MA;
+			BLOCK_NEED(2);
+			op->imm = BLOCK_IMM16();
+			pos += 2;
+			op->flags |= BLOCK_FLAG_WRITE;
+			break;
+		case 0xA8:
+			op->kind = BLOCK_OP_TEST8_AI;
+			BLOCK_NEED(1);
+			op->imm = BLOCK_IMM8();
+			pos += 1;
+			break;
+		case 0xA9:
+			op->kind = BLOCK_OP_TEST16_AI;
+			BLOCK_NEED(2);
+			op->imm = BLOCK_IMM16();
+			pos += 2;
+			break;
+		case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: case 0xB7:
+			op->kind = BLOCK_OP_MOV8_RI;
+			op->reg = op->opcode & 7;
+			BLOCK_NEED(1);
+			op->imm = BLOCK_IMM8();
+			pos += 1;
+			break;
+		case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+			op->kind = BLOCK_OP_MOV16_RI;
+			op->reg = op->opcode & 7;
+			BLOCK_NEED(2);
+			op->imm = BLOCK_IMM16();
+			pos += 2;
+			break;
+		case 0xC6:
+			op->kind = BLOCK_OP_MOV8_EI;
+			BLOCK_MODRM();
+			BLOCK_NEED(1);
+			op->imm = BLOCK_IMM8();
+			pos += 1;
+			if (op->mode < 3) op->flags |= BLOCK_FLAG_WRITE;
+			break;
+		case 0xC7:
+			op->kind = BLOCK_OP_MOV16_EI;
+			BLOCK_MODRM();
+			BLOCK_NEED(2);
+			op->imm = BLOCK_IMM16();
+			pos += 2;
+			if (op->mode < 3) op->flags |= BLOCK_FLAG_WRITE;
+			break;
+		case 0xE0:
+		case 0xE1:
+		case 0xE2:
+		case 0xE3:
+			op->kind = (op->opcode == 0xE0) ? BLOCK_OP_LOOPNZ : (op->opcode == 0xE1) ? BLOCK_OP_LOOPZ :
+				(op->opcode == 0xE2) ? BLOCK_OP_LOOP : BLOCK_OP_JCXZ;
+			BLOCK_NEED(1);
+			op->imm = (uint16_t)(int16_t)(int8_t)BLOCK_IMM8();
+			pos += 1;
+			ends = 1;
+			break;
+		case 0xE9:
+			op->kind = BLOCK_OP_JMP;
+			BLOCK_NEED(2);
+			op->imm = BLOCK_IMM16();
+			pos += 2;
+			ends = 1;
+			break;
+		case 0xEB:
+			op->kind = BLOCK_OP_JMP;
+			BLOCK_NEED(1);
+			op->imm = (uint16_t)(int16_t)(int8_t)BLOCK_IMM8();
+			pos += 1;
+			ends = 1;
+			break;
+		case 0xF5:
+			op->kind = BLOCK_OP_CMC;
+			break;
+		case 0xF8:
+			op->kind = BLOCK_OP_CLC;
+			break;
+		case 0xF9:
+			op->kind = BLOCK_OP_STC;
+			break;
+		case 0xFA:
+			op->kind = BLOCK_OP_CLI;
+			break;
+		case 0xFB:
+			op->kind = BLOCK_OP_STI;
+			break;
+		case 0xFC:
+			op->kind = BLOCK_OP_CLD;
+			break;
+		case 0xFD:
+			op->kind = BLOCK_OP_STD;
+			break;
+		default:
+			goto stop;
+		}
+
+#undef BLOCK_NEED
+#undef BLOCK_IMM8
+#undef BLOCK_IMM16
+#undef BLOCK_MODRM
+
+		if (!lazysafe[op->opcode]) op->flags |= BLOCK_FLAG_SYNC;
+		op->next = (uint16_t)pos;
+		block->count++;
+		continue;
+
+	stop:
+		pos = start;
+		break;
+	}
+
+	if (block->count == 0) {
+		return NULL;
+	}
+
+	block->linear = linear;
+	block->epoch = block_epoch;
+	block->dpage = dpage;
+	block->pagegen = dpage->blockgen;
+	block->len = block->op[block->count - 1].next;
+	memset(&dpage->blockcover[offset], 1, block->len);
+	dpage->blocks = 1;
+	entry->block = (uint16_t)(block_next + 1);
+	block_next++;
+	return block;
+}
+
+//The valid block starting at linear, if there is one
+BLOCK_t* block_find(DECODE_ENTRY_t* entry, uint32_t linear) {
+	BLOCK_t* block;
+
+	if (entry->block == 0) {
+		return NULL;
+	}
+
+	block = &block_pool[entry->block - 1];
+	if ((block->epoch == block_epoch) && (block->linear == linear) && (block->pagegen == block->dpage->blockgen)) {
+		return block;
+	}
+
+	//orphaned, let it warm up again
+	entry->block = 0;
+	entry->heat = 0;
+	return NULL;
+}
+
+//Like block_find, but counts the instruction towards BLOCK_HOT and translates once it gets there
+BLOCK_t* block_get(DECODE_ENTRY_t* entry, uint32_t linear, uint16_t ip) {
+	DECODE_PAGE_t* dpage;
+	BLOCK_t* block;
+
+	block = block_find(entry, linear);
+	if (block != NULL) {
+		return block;
+	}
+
+	if (entry->heat < 255) entry->heat++;
+	if (entry->heat != BLOCK_HOT) {
+		return NULL;
+	}
+
+	dpage = decode_map[linear >> MEMORY_PAGE_SHIFT];
+	if ((dpage == NULL) || (dpage->blockkills >= BLOCK_MAXKILLS)) {
+		return NULL;
+	}
+	return block_translate(dpage, entry, linear, ip);
+}
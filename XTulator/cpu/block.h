@@ -0,0 +1,95 @@
+#ifndef _BLOCK_H_
+#define _BLOCK_H_
+
+#include <stdint.h>
+#include "decode.h"
+
+#define BLOCK_MAXBLOCKS		8192	//translated blocks kept at once, the whole pool starts over when it runs out
+#define BLOCK_MAXOPS		32	//longest run of guest instructions in one block
+#define BLOCK_HOT		16	//times an instruction has to start executing before a block is translated from it
+#define BLOCK_MAXKILLS		8	//write invalidations after which a page is left to the decode cache for good
+
+#define BLOCK_OP_ALU8_EG	0	//00-38 ALU Eb Gb
+#define BLOCK_OP_ALU16_EG	1	//01-39 ALU Ev Gv
+#define BLOCK_OP_ALU8_GE	2	//02-3A ALU Gb Eb
+#define BLOCK_OP_ALU16_GE	3	//03-3B ALU Gv Ev
+#define BLOCK_OP_ALU8_AI	4	//04-3C ALU AL Ib
+#define BLOCK_OP_ALU16_AI	5	//05-3D ALU AX Iv
+#define BLOCK_OP_GRP1_8		6	//80/82 GRP1 Eb Ib
+#define BLOCK_OP_GRP1_16	7	//81/83 GRP1 Ev Iv, the 83 immediate is sign extended at translation
+#define BLOCK_OP_TEST8_EG	8
+#define BLOCK_OP_TEST16_EG	9
+#define BLOCK_OP_TEST8_AI	10
+#define BLOCK_OP_TEST16_AI	11
+#define BLOCK_OP_XCHG8		12
+#define BLOCK_OP_XCHG16		13
+#define BLOCK_OP_MOV8_EG	14
+#define BLOCK_OP_MOV16_EG	15
+#define BLOCK_OP_MOV8_GE	16
+#define BLOCK_OP_MOV16_GE	17
+#define BLOCK_OP_LEA		18
+#define BLOCK_OP_MOV8_AM	19	//A0 MOV AL Ob
+#define BLOCK_OP_MOV16_AM	20
+#define BLOCK_OP_MOV8_MA	21	//A2 MOV Ob AL
+#define BLOCK_OP_MOV16_MA	22
+#define BLOCK_OP_MOV8_RI	23
+#define BLOCK_OP_MOV16_RI	24
+#define BLOCK_OP_MOV8_EI	25
+#define BLOCK_OP_MOV16_EI	26
+#define BLOCK_OP_INC16		27
+#define BLOCK_OP_DEC16		28
+#define BLOCK_OP_PUSH16		29
+#define BLOCK_OP_POP16		30
+#define BLOCK_OP_XCHGAX		31
+#define BLOCK_OP_NOP		32
+#define BLOCK_OP_CBW		33
+#define BLOCK_OP_CWD		34
+#define BLOCK_OP_CLC		35
+#define BLOCK_OP_STC		36
+#define BLOCK_OP_CMC		37
+#define BLOCK_OP_CLD		38
+#define BLOCK_OP_STD		39
+#define BLOCK_OP_CLI		40
+#define BLOCK_OP_STI		41
+//the rest end a block
+#define BLOCK_OP_JCC		42
+#define BLOCK_OP_JMP		43
+#define BLOCK_OP_LOOP		44
+#define BLOCK_OP_LOOPZ		45
+#define BLOCK_OP_LOOPNZ		46
+#define BLOCK_OP_JCXZ		47
+
+#define BLOCK_FLAG_SYNC		0x01	//lazy flags have to be synced first, same as lazysafe[] in cpu_exec
+#define BLOCK_FLAG_WRITE	0x02	//writes guest memory, which may invalidate the running block
+
+typedef struct {
+	uint8_t kind; //BLOCK_OP_*
+	uint8_t opcode;
+	uint8_t flags; //BLOCK_FLAG_*
+	uint8_t alu; //ALU operation, the opcode's bits 3-5 or the GRP1 ModRM reg field
+	uint8_t mode, reg, rm;
+	uint8_t seg; //segment register for memory operands
+	uint8_t segoverride;
+	uint16_t disp16;
+	uint16_t imm; //immediate, or branch displacement
+	uint16_t at; //IP of the opcode byte, relative to the start of the block
+	uint16_t next; //IP of the following instruction, relative to the start of the block
+} BLOCK_OP_t;
+
+typedef struct {
+	uint32_t linear; //guest linear address of the first instruction
+	uint32_t epoch; //block_epoch when translated
+	DECODE_PAGE_t* dpage; //cached page holding the code
+	uint32_t pagegen; //dpage->blockgen when translated
+	uint16_t len; //guest bytes covered
+	uint8_t count;
+	BLOCK_OP_t op[BLOCK_MAXOPS];
+} BLOCK_t;
+
+extern uint32_t block_generation;
+
+BLOCK_t* block_find(DECODE_ENTRY_t* entry, uint32_t linear);
+BLOCK_t* block_get(DECODE_ENTRY_t* entry, uint32_t linear, uint16_t ip);
+void block_invalidate(DECODE_PAGE_t* dpage);
+
+#endif
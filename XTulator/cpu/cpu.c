@@ -20,10 +20,19 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include "cpu.h"
+#include "block.h"
 #include "../chipset/i8042.h" 
 #include "../config.h"
 #include "../debuglog.h"
+#include "../memory.h"
+#include "../profile.h"
+#include "../sampler.h"
+#include "../trace.h"
+
+uint32_t get_real_address(CPU_t* cpu, uint16_t seg, uint16_t off);
+int get_descriptor_info(CPU_t* cpu, uint16_t selector, uint32_t* base, uint16_t* limit, uint8_t* access);
 
 const uint8_t byteregtable[8] = { regal, regcl, regdl, regbl, regah, regch, regdh, regbh };
 
@@ -38,14 +47,85 @@ const uint8_t parity[0x100] = {
 	0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1
 };
 
+/* opcodes that never look at cf/pf/af/zf/sf/of directly, so pending lazy flags can stay pending across them */
+const uint8_t lazysafe[0x100] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, /* 00 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 10 */
+	1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 0, /* 20 */
+	1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 0, /* 30 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 40 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 50 */
+	1, 1, 1, 0, 0, 0, 0, 0, 1, 0, 1, 0, 1, 1, 1, 1, /* 60 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 70 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 80 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 0, 0, 0, /* 90 */
+	1, 1, 1, 1, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1, 0, 0, /* A0 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* B0 */
+	0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, /* C0 */
+	0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, /* D0 */
+	0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, /* E0 */
+	1, 0, 1, 1, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0  /* F0 */
+};
+
+/*
+	Segment loads in protected mode go through a small direct mapped cache of
+	decoded descriptors keyed on the table base and selector, so reloading the
+	same selectors over and over (DOS extenders, Windows standard mode) doesn't
+	read the table a byte at a time each time. Nothing is added to the write
+	path to catch the guest changing a descriptor: the pages an entry was read
+	from get MEMORY_WATCHED, which any write to them clears through
+	memory_markDirty, and an entry is only used while its pages still have it.
+	Map changes bump memory_mapGeneration, which entries are checked against.
+	IDT gates are cached the same way, by vector.
+*/
+static DESCRIPTOR_ENTRY_t* cpu_descRead(CPU_t* cpu, DESCRIPTOR_ENTRY_t* entry, uint32_t table, uint16_t selector) {
+	uint32_t addr = table + (selector & 0xFFF8);
+	uint32_t first = (addr & MEMORY_MASK) >> MEMORY_PAGE_SHIFT;
+	uint32_t last = ((addr + 5) & MEMORY_MASK) >> MEMORY_PAGE_SHIFT;
+	uint8_t raw[6];
+
+	selector &= 0xFFFC;
+	if (entry->valid && (entry->selector == selector) && (entry->table == table) && (entry->gen == memory_mapGeneration) &&
+		(memory_dirty[first] & MEMORY_WATCHED) && (memory_dirty[last] & MEMORY_WATCHED)) {
+		return entry;
+	}
+
+	memory_readBlock(addr, raw, sizeof(raw));
+	entry->limit = (uint16_t)raw[0] | ((uint16_t)raw[1] << 8);
+	entry->base = (uint32_t)raw[2] | ((uint32_t)raw[3] << 8) | ((uint32_t)raw[4] << 16);
+	entry->access = raw[5];
+	entry->table = table;
+	entry->selector = selector;
+	entry->gen = memory_mapGeneration;
+	entry->valid = 1;
+	memory_dirty[first] |= MEMORY_WATCHED;
+	memory_dirty[last] |= MEMORY_WATCHED;
+	return entry;
+}
+
+static DESCRIPTOR_ENTRY_t* cpu_descriptor(CPU_t* cpu, uint32_t table, uint16_t selector) {
+	return cpu_descRead(cpu, &cpu->desccache[(selector >> 2) & (CPU_DESCCACHE - 1)], table, selector);
+}
+
+static DESCRIPTOR_ENTRY_t* cpu_gate(CPU_t* cpu, uint8_t intnum) {
+	return cpu_descRead(cpu, &cpu->gatecache[intnum & (CPU_GATECACHE - 1)], cpu->idtr.base, (uint16_t)intnum << 3);
+}
+
+//LGDT, LLDT, LOADALL, reset and snapshot restore
+void cpu_descFlush(CPU_t* cpu) {
+	memset(cpu->desccache, 0, sizeof(cpu->desccache));
+	memset(cpu->gatecache, 0, sizeof(cpu->gatecache));
+}
+
 void load_tr(CPU_t* cpu, uint16_t selector) {
+	DESCRIPTOR_ENTRY_t* desc;
+
 	if ((selector & 0xFFF8) == 0) 
 		return;
 
-	uint32_t table_base = (selector & 4) ? cpu->ldtr_cache.base : cpu->gdtr.base;
-	uint32_t addr = table_base + (selector >> 3) * 8;
-	cpu->tr_cache.limit = cpu_readw(cpu, addr);
-	cpu->tr_cache.base = cpu_read(cpu, addr + 2) | (cpu_read(cpu, addr + 3) << 8) | (cpu_read(cpu, addr + 4) << 16);
+	desc = cpu_descriptor(cpu, (selector & 4) ? cpu->ldtr_cache.base : cpu->gdtr.base, selector);
+	cpu->tr_cache.limit = desc->limit;
+	cpu->tr_cache.base = desc->base;
 	cpu->tr_cache.valid = 1;
 	cpu->tr = selector;
 	cpu->tr_cache.sp0 = cpu_readw(cpu, cpu->tr_cache.base + 2);
@@ -58,9 +138,9 @@ void load_ldtr(CPU_t* cpu, uint16_t selector) {
 		return; 
 	}
 
-	uint32_t addr = cpu->gdtr.base + (selector >> 3) * 8;
-	cpu->ldtr_cache.limit = cpu_readw(cpu, addr);
-	cpu->ldtr_cache.base = cpu_read(cpu, addr + 2) | (cpu_read(cpu, addr + 3) << 8) | (cpu_read(cpu, addr + 4) << 16);
+	DESCRIPTOR_ENTRY_t* desc = cpu_descriptor(cpu, cpu->gdtr.base, selector & 0xFFF8);
+	cpu->ldtr_cache.limit = desc->limit;
+	cpu->ldtr_cache.base = desc->base;
 	cpu->ldtr_cache.valid = 1;
 	cpu->ldtr = selector;
 }
@@ -68,7 +148,10 @@ void load_ldtr(CPU_t* cpu, uint16_t selector) {
 void load_descriptor(CPU_t* cpu, uint8_t seg_reg, uint16_t selector) {
 	DESCRIPTOR_CACHE* cache = &cpu->segcache[seg_reg];
 	cpu->segregs[seg_reg] = selector;
-	if (seg_reg == regcs) cpu->cpl = selector & 3;
+	if (seg_reg == regcs) {
+		cpu->cpl = selector & 3;
+		cpu->code_host = NULL;
+	}
 
 	if ((selector & 0xFFF8) == 0) {
 		cache->valid = 0;
@@ -88,10 +171,10 @@ void load_descriptor(CPU_t* cpu, uint8_t seg_reg, uint16_t selector) {
 		table_limit = cpu->gdtr.limit;
 	}
 
-	uint32_t addr = table_base + (selector & 0xFFF8);
-	cache->limit = cpu_readw(cpu, addr);
-	cache->base = cpu_read(cpu, addr + 2) | (cpu_read(cpu, addr + 3) << 8) | (cpu_read(cpu, addr + 4) << 16);
-	cache->access = cpu_read(cpu, addr + 5);
+	DESCRIPTOR_ENTRY_t* desc = cpu_descriptor(cpu, table_base, selector);
+	cache->limit = desc->limit;
+	cache->base = desc->base;
+	cache->access = desc->access;
 
 	if (!(cache->access & 0x80)) {
 		cpu_intcall(cpu, 11);
@@ -101,39 +184,38 @@ void load_descriptor(CPU_t* cpu, uint8_t seg_reg, uint16_t selector) {
 	cache->valid = 1;
 }
 
+/*
+	The TSS state goes out and comes in as one block each, through
+	memory_writeBlock/readBlock, which copy straight to and from RAM pages. The
+	words are IP, flags, AX, CX, DX, BX, SP, BP, SI, DI, then ES, CS, SS, DS,
+	the same order as wordregs and segregs.
+*/
 void cpu_task_switch(CPU_t* cpu, uint16_t selector, uint8_t is_iret) {
 	uint32_t new_base; uint16_t new_limit; uint8_t new_access;
+	uint8_t tss[CPU_TSS_WORDS * 2];
+	uint16_t word;
+	int i;
 	if (!get_descriptor_info(cpu, selector, &new_base, &new_limit, &new_access)) return;
 	uint32_t old_base = cpu->tr_cache.base;
 	if (cpu->tr_cache.valid) {
-		cpu_writew(cpu, old_base + 0x0E, cpu->ip);
-		cpu_writew(cpu, old_base + 0x10, makeflagsword(cpu));
-		cpu_writew(cpu, old_base + 0x12, cpu->regs.wordregs[regax]);
-		cpu_writew(cpu, old_base + 0x14, cpu->regs.wordregs[regcx]);
-		cpu_writew(cpu, old_base + 0x16, cpu->regs.wordregs[regdx]);
-		cpu_writew(cpu, old_base + 0x18, cpu->regs.wordregs[regbx]);
-		cpu_writew(cpu, old_base + 0x1A, cpu->regs.wordregs[regsp]);
-		cpu_writew(cpu, old_base + 0x1C, cpu->regs.wordregs[regbp]);
-		cpu_writew(cpu, old_base + 0x1E, cpu->regs.wordregs[regsi]);
-		cpu_writew(cpu, old_base + 0x20, cpu->regs.wordregs[regdi]);
-		cpu_writew(cpu, old_base + 0x22, cpu->segregs[reges]);
-		cpu_writew(cpu, old_base + 0x24, cpu->segregs[regcs]);
-		cpu_writew(cpu, old_base + 0x26, cpu->segregs[regss]);
-		cpu_writew(cpu, old_base + 0x28, cpu->segregs[regds]);
-	}
-	cpu->ip = cpu_readw(cpu, new_base + 0x0E);
-	uint16_t nf = cpu_readw(cpu, new_base + 0x10);
+		for (i = 0; i < CPU_TSS_WORDS; i++) {
+			if (i == 0) word = cpu->ip;
+			else if (i == 1) word = makeflagsword(cpu);
+			else if (i < 10) word = cpu->regs.wordregs[i - 2];
+			else word = cpu->segregs[i - 10];
+			tss[i * 2] = (uint8_t)word;
+			tss[i * 2 + 1] = (uint8_t)(word >> 8);
+		}
+		memory_writeBlock(old_base + CPU_TSS_STATE, tss, sizeof(tss));
+	}
+	memory_readBlock(new_base + CPU_TSS_STATE, tss, sizeof(tss));
+	cpu->ip = (uint16_t)tss[0] | ((uint16_t)tss[1] << 8);
+	uint16_t nf = (uint16_t)tss[2] | ((uint16_t)tss[3] << 8);
 	if (!is_iret) { nf |= 0x4000; cpu_writew(cpu, new_base + 0x00, cpu->tr); }
-	cpu->regs.wordregs[regax] = cpu_readw(cpu, new_base + 0x12);
-	cpu->regs.wordregs[regcx] = cpu_readw(cpu, new_base + 0x14);
-	cpu->regs.wordregs[regdx] = cpu_readw(cpu, new_base + 0x16);
-	cpu->regs.wordregs[regbx] = cpu_readw(cpu, new_base + 0x18);
-	cpu->regs.wordregs[regsp] = cpu_readw(cpu, new_base + 0x1A);
-	cpu->regs.wordregs[regbp] = cpu_readw(cpu, new_base + 0x1C);
-	cpu->regs.wordregs[regsi] = cpu_readw(cpu, new_base + 0x1E);
-	cpu->regs.wordregs[regdi] = cpu_readw(cpu, new_base + 0x20);
-	uint16_t s[] = { cpu_readw(cpu,new_base + 0x22), cpu_readw(cpu,new_base + 0x24), cpu_readw(cpu,new_base + 0x26), cpu_readw(cpu,new_base + 0x28) };
-	for (int i = 0; i < 4; i++) if (s[i] > 0) load_descriptor(cpu, i, s[i]);
+	for (i = 0; i < 8; i++) cpu->regs.wordregs[i] = (uint16_t)tss[4 + i * 2] | ((uint16_t)tss[5 + i * 2] << 8);
+	uint16_t s[4];
+	for (i = 0; i < 4; i++) s[i] = (uint16_t)tss[20 + i * 2] | ((uint16_t)tss[21 + i * 2] << 8);
+	for (i = 0; i < 4; i++) if (s[i] > 0) load_descriptor(cpu, i, s[i]);
 	cpu->tr = selector;
 	cpu->tr_cache.base = new_base;
 	cpu->tr_cache.limit = new_limit;
@@ -142,14 +224,46 @@ void cpu_task_switch(CPU_t* cpu, uint16_t selector, uint8_t is_iret) {
 }
 
 FUNC_INLINE void cpu_writew(CPU_t* cpu, uint32_t addr32, uint16_t value) {
+	uint32_t addr2;
+	uint8_t *lo, *hi;
+
+	//fast path: both bytes land in plain RAM pages
+	addr32 &= MEMORY_MASK;
+	addr2 = (addr32 + 1) & MEMORY_MASK;
+	lo = memory_pages[addr32 >> MEMORY_PAGE_SHIFT].write;
+	hi = memory_pages[addr2 >> MEMORY_PAGE_SHIFT].write;
+	if ((lo != NULL) && (hi != NULL)) {
+		lo[addr32 & MEMORY_PAGE_MASK] = (uint8_t)value;
+		hi[addr2 & MEMORY_PAGE_MASK] = (uint8_t)(value >> 8);
+		memory_markDirty(addr32);
+		memory_markDirty(addr2);
+		memory_writes++;
+		return;
+	}
+
 	cpu_write(cpu, addr32, (uint8_t)value);
-	cpu_write(cpu, addr32 + 1, (uint8_t)(value >> 8));
+	cpu_write(cpu, addr2, (uint8_t)(value >> 8));
 }
 
 FUNC_INLINE uint16_t cpu_readw(CPU_t* cpu, uint32_t addr32) {
-	return ((uint16_t)cpu_read(cpu, addr32) | (uint16_t)(cpu_read(cpu, addr32 + 1) << 8));
+	uint32_t addr2;
+	uint8_t *lo, *hi;
+
+	addr32 &= MEMORY_MASK;
+	addr2 = (addr32 + 1) & MEMORY_MASK;
+	lo = memory_pages[addr32 >> MEMORY_PAGE_SHIFT].read;
+	hi = memory_pages[addr2 >> MEMORY_PAGE_SHIFT].read;
+	if ((lo != NULL) && (hi != NULL)) {
+		return (uint16_t)lo[addr32 & MEMORY_PAGE_MASK] | ((uint16_t)hi[addr2 & MEMORY_PAGE_MASK] << 8);
+	}
+
+	return ((uint16_t)cpu_read(cpu, addr32) | (uint16_t)(cpu_read(cpu, addr2) << 8));
 }
 
+#define CPU_PM(cpu) ((cpu)->protected_mode)
+#define CPU_FN(name) name
+#include "cpuexec.h"
+
 int get_descriptor_info(CPU_t* cpu, uint16_t selector, uint32_t* base, uint16_t* limit, uint8_t* access) {
 	uint32_t table_base;
 	uint16_t table_limit;
@@ -175,23 +289,27 @@ int get_descriptor_info(CPU_t* cpu, uint16_t selector, uint32_t* base, uint16_t*
 		return 0;
 	}
 
-	uint32_t addr = table_base + (index * 8);
-	*limit = cpu_readw(cpu, addr);
-	*base = cpu_read(cpu, addr + 2) | (cpu_read(cpu, addr + 3) << 8) | (cpu_read(cpu, addr + 4) << 16);
-	*access = cpu_read(cpu, addr + 5);
+	DESCRIPTOR_ENTRY_t* desc = cpu_descriptor(cpu, table_base, selector);
+	*limit = desc->limit;
+	*base = desc->base;
+	*access = desc->access;
 
-	debug_log(DEBUG_INFO, "[CPU] get_descriptor_info(sel=%04X): Found at %08X -> base=%06X, limit=%04X, access=%02X\n",
-		selector, addr, *base, *limit, *access);
+	debug_log(DEBUG_DETAIL, "[CPU] get_descriptor_info(sel=%04X): Found at %08X -> base=%06X, limit=%04X, access=%02X\n",
+		selector, table_base + (index * 8), *base, *limit, *access);
 
 	return 1;
 }
 
 void push_error_code(CPU_t* cpu, uint16_t error_code) {
 	cpu->regs.wordregs[regsp] -= 2;
-	putmem16(cpu, cpu->segregs[regss], cpu->regs.wordregs[regsp], error_code);
+	putmem16(cpu, regss, cpu->regs.wordregs[regsp], error_code);
 }
 
 FUNC_INLINE void flag_szp8(CPU_t* cpu, uint8_t value) {
+	if (cpu->lazy_op != CPU_LAZY_NONE) {
+		cpu_flagsSync(cpu); /* about to overwrite flags eagerly, so settle the pending ones first */
+	}
+
 	if (!value) {
 		cpu->zf = 1;
 	}
@@ -210,6 +328,10 @@ FUNC_INLINE void flag_szp8(CPU_t* cpu, uint8_t value) {
 }
 
 FUNC_INLINE void flag_szp16(CPU_t* cpu, uint16_t value) {
+	if (cpu->lazy_op != CPU_LAZY_NONE) {
+		cpu_flagsSync(cpu); /* about to overwrite flags eagerly, so settle the pending ones first */
+	}
+
 	if (!value) {
 		cpu->zf = 1;
 	}
@@ -470,146 +592,244 @@ FUNC_INLINE void flag_sub16(CPU_t* cpu, uint16_t v1, uint16_t v2) {
 	}
 }
 
+/*
+	Lazy flags: the common ALU ops only remember their operands and result,
+	and cf/pf/af/zf/sf/of are computed from those when something needs them.
+	Instructions that touch the flag fields directly call cpu_flagsSync first
+	(see lazysafe[] in cpu_exec), while Jcc asks the flag_lazy* getters.
+*/
+void cpu_flagsSync(CPU_t* cpu) {
+	uint8_t op;
+
+	op = cpu->lazy_op;
+	cpu->lazy_op = CPU_LAZY_NONE;
+
+	switch (op) {
+	case CPU_LAZY_ADD8:
+		flag_add8(cpu, (uint8_t)cpu->lazy_dst, (uint8_t)cpu->lazy_src);
+		break;
+	case CPU_LAZY_ADD16:
+		flag_add16(cpu, cpu->lazy_dst, cpu->lazy_src);
+		break;
+	case CPU_LAZY_SUB8:
+		flag_sub8(cpu, (uint8_t)cpu->lazy_dst, (uint8_t)cpu->lazy_src);
+		break;
+	case CPU_LAZY_SUB16:
+		flag_sub16(cpu, cpu->lazy_dst, cpu->lazy_src);
+		break;
+	case CPU_LAZY_LOG8:
+		flag_log8(cpu, (uint8_t)cpu->lazy_res);
+		break;
+	case CPU_LAZY_LOG16:
+		flag_log16(cpu, cpu->lazy_res);
+		break;
+	case CPU_LAZY_INC16:
+		cpu->tempcf = cpu->cf;
+		flag_add16(cpu, cpu->lazy_dst, 1);
+		cpu->cf = cpu->tempcf;
+		break;
+	case CPU_LAZY_DEC16:
+		cpu->tempcf = cpu->cf;
+		flag_sub16(cpu, cpu->lazy_dst, 1);
+		cpu->cf = cpu->tempcf;
+		break;
+	default:
+		break;
+	}
+}
+
+FUNC_INLINE uint16_t flag_lazySign(CPU_t* cpu) {
+	switch (cpu->lazy_op) {
+	case CPU_LAZY_ADD8:
+	case CPU_LAZY_SUB8:
+	case CPU_LAZY_LOG8:
+		return 0x80;
+	default:
+		return 0x8000;
+	}
+}
+
+FUNC_INLINE uint8_t flag_lazyCF(CPU_t* cpu) {
+	switch (cpu->lazy_op) {
+	case CPU_LAZY_ADD8:
+	case CPU_LAZY_ADD16:
+		return (cpu->lazy_res < cpu->lazy_dst) ? 1 : 0;
+	case CPU_LAZY_SUB8:
+	case CPU_LAZY_SUB16:
+		return (cpu->lazy_dst < cpu->lazy_src) ? 1 : 0;
+	case CPU_LAZY_LOG8:
+	case CPU_LAZY_LOG16:
+		return 0;
+	default: /* INC and DEC leave cf alone */
+		return cpu->cf;
+	}
+}
+
+FUNC_INLINE uint8_t flag_lazyZF(CPU_t* cpu) {
+	if (cpu->lazy_op == CPU_LAZY_NONE) return cpu->zf;
+	return (cpu->lazy_res == 0) ? 1 : 0;
+}
+
+FUNC_INLINE uint8_t flag_lazySF(CPU_t* cpu) {
+	if (cpu->lazy_op == CPU_LAZY_NONE) return cpu->sf;
+	return (cpu->lazy_res & flag_lazySign(cpu)) ? 1 : 0;
+}
+
+FUNC_INLINE uint8_t flag_lazyPF(CPU_t* cpu) {
+	if (cpu->lazy_op == CPU_LAZY_NONE) return cpu->pf;
+	return parity[cpu->lazy_res & 255];
+}
+
+FUNC_INLINE uint8_t flag_lazyAF(CPU_t* cpu) {
+	switch (cpu->lazy_op) {
+	case CPU_LAZY_NONE:
+	case CPU_LAZY_LOG8:
+	case CPU_LAZY_LOG16:
+		return cpu->af;
+	default:
+		return ((cpu->lazy_dst ^ cpu->lazy_src ^ cpu->lazy_res) & 0x10) ? 1 : 0;
+	}
+}
+
+FUNC_INLINE uint8_t flag_lazyOF(CPU_t* cpu) {
+	switch (cpu->lazy_op) {
+	case CPU_LAZY_NONE:
+		return cpu->of;
+	case CPU_LAZY_ADD8:
+	case CPU_LAZY_ADD16:
+	case CPU_LAZY_INC16:
+		return ((cpu->lazy_res ^ cpu->lazy_dst) & (cpu->lazy_res ^ cpu->lazy_src) & flag_lazySign(cpu)) ? 1 : 0;
+	case CPU_LAZY_SUB8:
+	case CPU_LAZY_SUB16:
+	case CPU_LAZY_DEC16:
+		return ((cpu->lazy_res ^ cpu->lazy_dst) & (cpu->lazy_dst ^ cpu->lazy_src) & flag_lazySign(cpu)) ? 1 : 0;
+	default:
+		return 0;
+	}
+}
+
+FUNC_INLINE void flag_lazyArith(CPU_t* cpu, uint8_t op, uint16_t v1, uint16_t v2, uint16_t res) {
+	/* ADD and SUB replace all six flags, so whatever was pending can simply be dropped */
+	cpu->lazy_op = op;
+	cpu->lazy_dst = v1;
+	cpu->lazy_src = v2;
+	cpu->lazy_res = res;
+}
+
+FUNC_INLINE void flag_lazyLog(CPU_t* cpu, uint8_t op, uint16_t res) {
+	/* logic ops leave af as it was */
+	cpu->af = flag_lazyAF(cpu);
+	cpu->lazy_op = op;
+	cpu->lazy_res = res;
+}
+
+FUNC_INLINE void flag_lazyIncDec(CPU_t* cpu, uint8_t op, uint16_t v1, uint16_t res) {
+	/* INC and DEC leave cf as it was */
+	cpu->cf = flag_lazyCF(cpu);
+	cpu->lazy_op = op;
+	cpu->lazy_dst = v1;
+	cpu->lazy_src = 1;
+	cpu->lazy_res = res;
+}
+
 FUNC_INLINE void op_adc8(CPU_t* cpu) {
+	if (cpu->lazy_op != CPU_LAZY_NONE) cpu_flagsSync(cpu);
 	cpu->res8 = cpu->oper1b + cpu->oper2b + cpu->cf;
 	flag_adc8(cpu, cpu->oper1b, cpu->oper2b, cpu->cf);
 }
 
 FUNC_INLINE void op_adc16(CPU_t* cpu) {
+	if (cpu->lazy_op != CPU_LAZY_NONE) cpu_flagsSync(cpu);
 	cpu->res16 = cpu->oper1 + cpu->oper2 + cpu->cf;
 	flag_adc16(cpu, cpu->oper1, cpu->oper2, cpu->cf);
 }
 
 FUNC_INLINE void op_add8(CPU_t* cpu) {
 	cpu->res8 = cpu->oper1b + cpu->oper2b;
-	flag_add8(cpu, cpu->oper1b, cpu->oper2b);
+	flag_lazyArith(cpu, CPU_LAZY_ADD8, cpu->oper1b, cpu->oper2b, cpu->res8);
 }
 
 FUNC_INLINE void op_add16(CPU_t* cpu) {
 	cpu->res16 = cpu->oper1 + cpu->oper2;
-	flag_add16(cpu, cpu->oper1, cpu->oper2);
+	flag_lazyArith(cpu, CPU_LAZY_ADD16, cpu->oper1, cpu->oper2, cpu->res16);
+}
+
+FUNC_INLINE void op_inc16(CPU_t* cpu) {
+	cpu->res16 = cpu->oper1 + 1;
+	flag_lazyIncDec(cpu, CPU_LAZY_INC16, cpu->oper1, cpu->res16);
+}
+
+FUNC_INLINE void op_dec16(CPU_t* cpu) {
+	cpu->res16 = cpu->oper1 - 1;
+	flag_lazyIncDec(cpu, CPU_LAZY_DEC16, cpu->oper1, cpu->res16);
 }
 
 FUNC_INLINE void op_and8(CPU_t* cpu) {
 	cpu->res8 = cpu->oper1b & cpu->oper2b;
-	flag_log8(cpu, cpu->res8);
+	flag_lazyLog(cpu, CPU_LAZY_LOG8, cpu->res8);
 }
 
 FUNC_INLINE void op_and16(CPU_t* cpu) {
 	cpu->res16 = cpu->oper1 & cpu->oper2;
-	flag_log16(cpu, cpu->res16);
+	flag_lazyLog(cpu, CPU_LAZY_LOG16, cpu->res16);
 }
 
 FUNC_INLINE void op_or8(CPU_t* cpu) {
 	cpu->res8 = cpu->oper1b | cpu->oper2b;
-	flag_log8(cpu, cpu->res8);
+	flag_lazyLog(cpu, CPU_LAZY_LOG8, cpu->res8);
 }
 
 FUNC_INLINE void op_or16(CPU_t* cpu) {
 	cpu->res16 = cpu->oper1 | cpu->oper2;
-	flag_log16(cpu, cpu->res16);
+	flag_lazyLog(cpu, CPU_LAZY_LOG16, cpu->res16);
 }
 
 FUNC_INLINE void op_xor8(CPU_t* cpu) {
 	cpu->res8 = cpu->oper1b ^ cpu->oper2b;
-	flag_log8(cpu, cpu->res8);
+	flag_lazyLog(cpu, CPU_LAZY_LOG8, cpu->res8);
 }
 
 FUNC_INLINE void op_xor16(CPU_t* cpu) {
 	cpu->res16 = cpu->oper1 ^ cpu->oper2;
-	flag_log16(cpu, cpu->res16);
+	flag_lazyLog(cpu, CPU_LAZY_LOG16, cpu->res16);
 }
 
 FUNC_INLINE void op_sub8(CPU_t* cpu) {
 	cpu->res8 = cpu->oper1b - cpu->oper2b;
-	flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
+	flag_lazyArith(cpu, CPU_LAZY_SUB8, cpu->oper1b, cpu->oper2b, cpu->res8);
 }
 
 FUNC_INLINE void op_sub16(CPU_t* cpu) {
 	cpu->res16 = cpu->oper1 - cpu->oper2;
-	flag_sub16(cpu, cpu->oper1, cpu->oper2);
+	flag_lazyArith(cpu, CPU_LAZY_SUB16, cpu->oper1, cpu->oper2, cpu->res16);
 }
 
-FUNC_INLINE void op_sbb8(CPU_t* cpu) {
-	cpu->res8 = cpu->oper1b - (cpu->oper2b + cpu->cf);
-	flag_sbb8(cpu, cpu->oper1b, cpu->oper2b, cpu->cf);
+FUNC_INLINE void op_cmp8(CPU_t* cpu) {
+	flag_lazyArith(cpu, CPU_LAZY_SUB8, cpu->oper1b, cpu->oper2b, (uint8_t)(cpu->oper1b - cpu->oper2b));
 }
 
-FUNC_INLINE void op_sbb16(CPU_t* cpu) {
-	cpu->res16 = cpu->oper1 - (cpu->oper2 + cpu->cf);
-	flag_sbb16(cpu, cpu->oper1, cpu->oper2, cpu->cf);
+FUNC_INLINE void op_cmp16(CPU_t* cpu) {
+	flag_lazyArith(cpu, CPU_LAZY_SUB16, cpu->oper1, cpu->oper2, cpu->oper1 - cpu->oper2);
 }
 
-FUNC_INLINE void getea(CPU_t* cpu, uint8_t rmval) {
-	uint32_t	tempea;
-
-	tempea = 0;
-	switch (cpu->mode) {
-	case 0:
-		switch (rmval) {
-		case 0: tempea = cpu->regs.wordregs[regbx] + cpu->regs.wordregs[regsi]; break;
-		case 1: tempea = cpu->regs.wordregs[regbx] + cpu->regs.wordregs[regdi]; break;
-		case 2: tempea = cpu->regs.wordregs[regbp] + cpu->regs.wordregs[regsi]; break;
-		case 3: tempea = cpu->regs.wordregs[regbp] + cpu->regs.wordregs[regdi]; break;
-		case 4: tempea = cpu->regs.wordregs[regsi]; break;
-		case 5: tempea = cpu->regs.wordregs[regdi]; break;
-		case 6: tempea = cpu->disp16; break;
-		case 7: tempea = cpu->regs.wordregs[regbx]; break;
-		}
-		break;
-	case 1:
-	case 2:
-		switch (rmval) {
-		case 0: tempea = cpu->regs.wordregs[regbx] + cpu->regs.wordregs[regsi] + cpu->disp16; break;
-		case 1: tempea = cpu->regs.wordregs[regbx] + cpu->regs.wordregs[regdi] + cpu->disp16; break;
-		case 2: tempea = cpu->regs.wordregs[regbp] + cpu->regs.wordregs[regsi] + cpu->disp16; break;
-		case 3: tempea = cpu->regs.wordregs[regbp] + cpu->regs.wordregs[regdi] + cpu->disp16; break;
-		case 4: tempea = cpu->regs.wordregs[regsi] + cpu->disp16; break;
-		case 5: tempea = cpu->regs.wordregs[regdi] + cpu->disp16; break;
-		case 6: tempea = cpu->regs.wordregs[regbp] + cpu->disp16; break;
-		case 7: tempea = cpu->regs.wordregs[regbx] + cpu->disp16; break;
-		}
-		break;
-	}
-
-	uint16_t offset = tempea & 0xFFFF;
-
-	if (cpu->protected_mode) {
-		int seg_reg_index = -1;
-
-		if (cpu->useseg == cpu->segregs[regss]) seg_reg_index = regss;
-		else if (cpu->useseg == cpu->segregs[regds]) seg_reg_index = regds;
-		else if (cpu->useseg == cpu->segregs[reges]) seg_reg_index = reges;
-		else if (cpu->useseg == cpu->segregs[regcs]) seg_reg_index = regcs;
-
-		if (seg_reg_index != -1 && cpu->segcache[seg_reg_index].valid) {
-			cpu->ea = cpu->segcache[seg_reg_index].base + offset;
-		}
-		else {
-			cpu->ea = (cpu->useseg << 4) + offset;
-		}
-	}
-	else {
-		uint32_t addr = (cpu->useseg << 4) + offset;
-		if (!a20_enabled) {
-			addr &= 0x000FFFFF;
-		}
-		cpu->ea = addr;
-	}
+FUNC_INLINE void op_test8(CPU_t* cpu) {
+	flag_lazyLog(cpu, CPU_LAZY_LOG8, cpu->oper1b & cpu->oper2b);
 }
 
-FUNC_INLINE void push(CPU_t* cpu, uint16_t pushval) {
-	cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regsp] - 2;
-	putmem16(cpu, cpu->segregs[regss], cpu->regs.wordregs[regsp], pushval);
+FUNC_INLINE void op_test16(CPU_t* cpu) {
+	flag_lazyLog(cpu, CPU_LAZY_LOG16, cpu->oper1 & cpu->oper2);
 }
 
-FUNC_INLINE uint16_t pop(CPU_t* cpu) {
-
-	uint16_t	tempval;
+FUNC_INLINE void op_sbb8(CPU_t* cpu) {
+	if (cpu->lazy_op != CPU_LAZY_NONE) cpu_flagsSync(cpu);
+	cpu->res8 = cpu->oper1b - (cpu->oper2b + cpu->cf);
+	flag_sbb8(cpu, cpu->oper1b, cpu->oper2b, cpu->cf);
+}
 
-	tempval = getmem16(cpu, cpu->segregs[regss], cpu->regs.wordregs[regsp]);
-	cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regsp] + 2;
-	return tempval;
+FUNC_INLINE void op_sbb16(CPU_t* cpu) {
+	if (cpu->lazy_op != CPU_LAZY_NONE) cpu_flagsSync(cpu);
+	cpu->res16 = cpu->oper1 - (cpu->oper2 + cpu->cf);
+	flag_sbb16(cpu, cpu->oper1, cpu->oper2, cpu->cf);
 }
 
 uint32_t translate_address_safe(CPU_t* cpu, uint16_t seg, uint16_t off, int* fault) {
@@ -648,8 +868,7 @@ uint32_t get_real_address(CPU_t* cpu, uint16_t seg, uint16_t off) {
 		return addr;
 	}
 	else {
-		uint32_t addr = (uint32_t)((seg << 4) + off);
-		return a20_enabled ? addr : (addr & 0x000FFFFF);
+		return (uint32_t)((seg << 4) + off);
 	}
 }
 
@@ -662,6 +881,8 @@ void cpu_reset(CPU_t* cpu) {
 	memset(cpu->segcache, 0, sizeof(cpu->segcache));
 	memset(&cpu->ldtr_cache, 0, sizeof(cpu->ldtr_cache));
 	memset(&cpu->tr_cache, 0, sizeof(cpu->tr_cache));
+	cpu->code_host = NULL;
+	cpu->lazy_op = CPU_LAZY_NONE;
 	cpu->msw = 0xFFF0;
 	cpu->gdtr.base = 0;
 	cpu->gdtr.limit = 0xFFFF;
@@ -670,55 +891,15 @@ void cpu_reset(CPU_t* cpu) {
 	cpu->handling_fault = 0;
 	cpu->ldtr = 0;
 	cpu->tr = 0;
+	cpu_descFlush(cpu);
 	cpu->protected_mode = 0;
-	a20_enabled = 0;
+	memory_setA20(0);
 	cpu->segregs[regcs] = 0xF000;
 	cpu->ip = 0xFFF0;
 	cpu->hltstate = 0;
 	cpu->trap_toggle = 0;
 }
 
-FUNC_INLINE uint16_t readrm16(CPU_t* cpu, uint8_t rmval) {
-	if (cpu->mode < 3) {
-		getea(cpu, rmval);
-		return cpu_read(cpu, cpu->ea) | ((uint16_t)cpu_read(cpu, cpu->ea + 1) << 8);
-	}
-	else {
-		return getreg16(cpu, rmval);
-	}
-}
-
-FUNC_INLINE uint8_t readrm8(CPU_t* cpu, uint8_t rmval) {
-	if (cpu->mode < 3) {
-		getea(cpu, rmval);
-		return cpu_read(cpu, cpu->ea);
-	}
-	else {
-		return getreg8(cpu, rmval);
-	}
-}
-
-FUNC_INLINE void writerm16(CPU_t* cpu, uint8_t rmval, uint16_t value) {
-	if (cpu->mode < 3) {
-		getea(cpu, rmval);
-		cpu_write(cpu, cpu->ea, value & 0xFF);
-		cpu_write(cpu, cpu->ea + 1, value >> 8);
-	}
-	else {
-		putreg16(cpu, rmval, value);
-	}
-}
-
-FUNC_INLINE void writerm8(CPU_t* cpu, uint8_t rmval, uint8_t value) {
-	if (cpu->mode < 3) {
-		getea(cpu, rmval);
-		cpu_write(cpu, cpu->ea, value);
-	}
-	else {
-		putreg8(cpu, rmval, value);
-	}
-}
-
 FUNC_INLINE uint8_t op_grp2_8(CPU_t* cpu, uint8_t cnt) {
 
 	uint16_t	s;
@@ -1026,7 +1207,7 @@ FUNC_INLINE void op_grp3_8(CPU_t* cpu) {
 	switch (cpu->reg) {
 	case 0:
 	case 1: /* TEST */
-		flag_log8(cpu, cpu->oper1b & getmem8(cpu, cpu->segregs[regcs], cpu->ip));
+		flag_log8(cpu, cpu->oper1b & getcode8(cpu, cpu->ip));
 		StepIP(cpu, 1);
 		break;
 
@@ -1148,7 +1329,7 @@ FUNC_INLINE void op_grp3_16(CPU_t* cpu) {
 	switch (cpu->reg) {
 	case 0:
 	case 1: /* TEST */
-		flag_log16(cpu, cpu->oper1 & getmem16(cpu, cpu->segregs[regcs], cpu->ip));
+		flag_log16(cpu, cpu->oper1 & getcode16(cpu, cpu->ip));
 		StepIP(cpu, 2);
 		break;
 
@@ -1220,18 +1401,12 @@ FUNC_INLINE void op_grp3_16(CPU_t* cpu) {
 FUNC_INLINE void op_grp5(CPU_t* cpu) {
 	switch (cpu->reg) {
 	case 0: /* INC Ev */
-		cpu->oper2 = 1;
-		cpu->tempcf = cpu->cf;
-		op_add16(cpu);
-		cpu->cf = cpu->tempcf;
+		op_inc16(cpu);
 		writerm16(cpu, cpu->rm, cpu->res16);
 		break;
 
 	case 1: /* DEC Ev */
-		cpu->oper2 = 1;
-		cpu->tempcf = cpu->cf;
-		op_sub16(cpu);
-		cpu->cf = cpu->tempcf;
+		op_dec16(cpu);
 		writerm16(cpu, cpu->rm, cpu->res16);
 		break;
 
@@ -1277,7 +1452,64 @@ FUNC_INLINE void op_grp5(CPU_t* cpu) {
 	}
 }
 
+/*
+	Idle detection for -idle. A guest that waits for input by polling rather
+	than with HLT looks busy, so two patterns are treated like HLT instead:
+	INT 16h status checks finding the BIOS keyboard buffer empty (or INT 28h
+	DOS idle calls) coming in quick succession, and a tight backward branch
+	going round and round with no register or memory changing in between.
+	Either sets cpu->idle, cpu_exec stops, and the main loop skips ahead to
+	the next timer just like for a halted CPU. The guest still executes its
+	loop afterwards, so a false positive only costs speed.
+*/
+static void cpu_idlePoll(CPU_t* cpu, uint8_t intnum) {
+	if (intnum == 0x16) {
+		if ((cpu->regs.byteregs[regah] != 0x01) && (cpu->regs.byteregs[regah] != 0x11)) return;
+		if (cpu_readw(cpu, 0x41A) != cpu_readw(cpu, 0x41C)) { //head != tail, a key is waiting
+			cpu->idle_polls = 0;
+			return;
+		}
+	}
+	else if (intnum != 0x28) {
+		return;
+	}
+
+	if ((cpu->totalexec - cpu->idle_lastpoll) > CPU_IDLE_GAP) {
+		cpu->idle_polls = 0; //doing real work in between
+	}
+	cpu->idle_lastpoll = cpu->totalexec;
+	if (++cpu->idle_polls >= CPU_IDLE_POLLS) {
+		cpu->idle_polls = 0;
+		cpu->idle = 1;
+	}
+}
+
+//Called when a branch at most CPU_IDLE_SPAN bytes back was taken
+static void cpu_idleBranch(CPU_t* cpu) {
+	if ((cpu->ip != cpu->idle_ip) || (cpu->segregs[regcs] != cpu->idle_cs) || (memory_writes != cpu->idle_writes) ||
+		memcmp(cpu->regs.wordregs, cpu->idle_regs, sizeof(cpu->idle_regs))) {
+		cpu->idle_ip = cpu->ip;
+		cpu->idle_cs = cpu->segregs[regcs];
+		cpu->idle_writes = memory_writes;
+		memcpy(cpu->idle_regs, cpu->regs.wordregs, sizeof(cpu->idle_regs));
+		cpu->idle_spins = 0;
+		return;
+	}
+	if (++cpu->idle_spins >= CPU_IDLE_SPINS) {
+		cpu->idle_spins = 0;
+		cpu->idle = 1;
+	}
+}
+
 void cpu_intcall(CPU_t* cpu, uint8_t intnum) {
+	if (cpu->lazy_op != CPU_LAZY_NONE) {
+		cpu_flagsSync(cpu);
+	}
+
+	if (cpu->idledetect) {
+		cpu_idlePoll(cpu, intnum);
+	}
+
 	if (intnum == 0x15) {
 		uint8_t ah = cpu->regs.byteregs[regah];
 		if (ah == 0x88) {
@@ -1300,16 +1532,21 @@ void cpu_intcall(CPU_t* cpu, uint8_t intnum) {
 		return;
 	}
 
+	cpu_intDispatch(cpu, intnum);
+}
+
+//Goes through the IVT or IDT, skipping any callback. A callback that only takes some of its calls passes the rest on with this.
+void cpu_intDispatch(CPU_t* cpu, uint8_t intnum) {
 	if (cpu->protected_mode) {
 		uint32_t gate_offset = intnum * 8;
 		if (gate_offset + 7 > cpu->idtr.limit) goto int_rm_fallback;
 
-		uint32_t gate_addr = cpu->idtr.base + gate_offset;
-		uint8_t access = cpu_read(cpu, gate_addr + 5);
+		DESCRIPTOR_ENTRY_t* gate = cpu_gate(cpu, intnum);
+		uint8_t access = gate->access;
 		if (!(access & 0x80)) goto int_rm_fallback;
 
-		uint16_t n_ip = cpu_readw(cpu, gate_addr);
-		uint16_t n_cs = cpu_readw(cpu, gate_addr + 2);
+		uint16_t n_ip = gate->limit;
+		uint16_t n_cs = (uint16_t)gate->base;
 		uint8_t type = access & 0x1F;
 
 		if (type == 0x05) {
@@ -1344,2669 +1581,812 @@ int_rm_fallback:
 	push(cpu, cpu->segregs[regcs]);
 	push(cpu, cpu->ip);
 	cpu->ifl = 0; cpu->tf = 0;
-	cpu->segregs[regcs] = getmem16(cpu, 0, (uint16_t)intnum * 4 + 2);
-	cpu->ip = getmem16(cpu, 0, (uint16_t)intnum * 4);
+	cpu->segregs[regcs] = cpu_readw(cpu, (uint32_t)intnum * 4 + 2);
+	cpu->ip = cpu_readw(cpu, (uint32_t)intnum * 4);
 }
 
 void cpu_interruptCheck(CPU_t* cpu, I8259_t* i8259) {
 	/* get next interrupt from the i8259, if a3ny */
-	if (!cpu->trap_toggle && (cpu->ifl && (i8259->irr & (~i8259->imr)))) {
+	if (!cpu->trap_toggle && (cpu->ifl && i8259->pending)) {
 		cpu->hltstate = 0;
 		cpu_intcall(cpu, i8259_nextintr(i8259));
 	}
 }
 
-static uint32_t read_24bit_base(CPU_t* cpu, uint32_t addr) {
-	return cpu_read(cpu, addr) | (cpu_read(cpu, addr + 1) << 8) | (cpu_read(cpu, addr + 2) << 16);
+/*
+	Block execution of REP string instructions. Each helper handles as many
+	elements as it can in one go while the source and/or destination stay
+	inside a single directly mapped memory page and inside the segment, and
+	returns how many it did. Zero means the interpreter should fall back to
+	stepping the instruction one element at a time.
+*/
+static uint32_t cpu_stringSpan(CPU_t* cpu, uint8_t sreg, uint16_t off, uint8_t size, uint8_t write, uint32_t max, uint8_t** host) {
+	uint32_t linear, offset, n, limit;
+	uint8_t* ptr;
+	MEMORY_PAGE_t* page;
+
+	limit = 0xFFFF;
+	if (cpu->protected_mode) {
+		if (!cpu->segcache[sreg].valid) {
+			return 0;
+		}
+		limit = cpu->segcache[sreg].limit;
+	}
+	if ((uint32_t)off + size - 1 > limit) {
+		return 0;
+	}
+
+	linear = get_seg_address(cpu, sreg, off) & MEMORY_MASK;
+	page = &memory_pages[linear >> MEMORY_PAGE_SHIFT];
+	ptr = (write) ? page->write : page->read;
+	offset = linear & MEMORY_PAGE_MASK;
+	if ((ptr == NULL) || (offset + size > MEMORY_PAGE_SIZE)) {
+		return 0;
+	}
+	if (write) {
+		memory_markDirty(linear);
+	}
+
+	if (cpu->df) {
+		n = offset / size + 1;
+		if (n > ((uint32_t)off / size + 1)) n = (uint32_t)off / size + 1;
+	}
+	else {
+		n = (MEMORY_PAGE_SIZE - offset) / size;
+		if (n > ((limit - off + 1) / size)) n = (limit - off + 1) / size;
+	}
+	if (n > max) n = max;
+
+	*host = ptr + offset;
+	return n;
 }
 
-void cpu_exec(CPU_t* cpu, uint32_t execloops) {
+FUNC_INLINE uint32_t cpu_repCount(CPU_t* cpu, uint32_t budget) {
+	uint32_t n = cpu->regs.wordregs[regcx];
+	if (budget == 0) budget = 1;
+	return (n > budget) ? budget : n;
+}
 
-	uint32_t loopcount;
-	uint8_t docontinue;
-	static uint16_t firstip;
+FUNC_INLINE void cpu_repAdvance(CPU_t* cpu, uint8_t reg, uint32_t n, uint8_t size) {
+	if (cpu->df) {
+		cpu->regs.wordregs[reg] -= (uint16_t)(n * size);
+	}
+	else {
+		cpu->regs.wordregs[reg] += (uint16_t)(n * size);
+	}
+}
 
-	for (loopcount = 0; loopcount < execloops; loopcount++) {
+/*
+	The same for an ascending run into or out of a device range with a bulk
+	handler, e.g. REP MOVSW or STOSW into video memory. The handler is looked
+	up once for the page instead of once per byte. Returns the region and sets
+	*n to how many elements fit, or returns NULL.
+*/
+static MEMORY_REGION_t* cpu_stringRegion(CPU_t* cpu, uint8_t sreg, uint16_t off, uint8_t size, uint8_t write, uint32_t* n, uint32_t* linear) {
+	MEMORY_REGION_t* region;
+	uint32_t limit, offset, fit;
 
-		if (cpu->trap_toggle) {
-			cpu_intcall(cpu, 1);
+	if (cpu->df) {
+		return NULL;
+	}
+	limit = 0xFFFF;
+	if (cpu->protected_mode) {
+		if (!cpu->segcache[sreg].valid) {
+			return NULL;
 		}
+		limit = cpu->segcache[sreg].limit;
+	}
+	if ((uint32_t)off + size - 1 > limit) {
+		return NULL;
+	}
 
-		if (cpu->tf) {
-			cpu->trap_toggle = 1;
-		}
-		else {
-			cpu->trap_toggle = 0;
-		}
-
-		if (cpu->hltstate) goto skipexecution;
-
-		cpu->reptype = 0;
-		cpu->segoverride = 0;
-		cpu->useseg = cpu->segregs[regds];
-		docontinue = 0;
-		firstip = cpu->ip;
-
-		while (!docontinue) {
-			cpu->segregs[regcs] = cpu->segregs[regcs] & 0xFFFF;
-			cpu->ip = cpu->ip & 0xFFFF;
-			cpu->savecs = cpu->segregs[regcs];
-			cpu->saveip = cpu->ip;
-			cpu->opcode = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-
-			switch (cpu->opcode) {
-				/* segment prefix check */
-			case 0x2E:	/* segment cpu->segregs[regcs] */
-				cpu->useseg = cpu->segregs[regcs];
-				cpu->segoverride = 1;
-				break;
+	*linear = get_seg_address(cpu, sreg, off) & MEMORY_MASK;
+	region = memory_blockRegion(&memory_pages[*linear >> MEMORY_PAGE_SHIFT], write);
+	if (region == NULL) {
+		return NULL;
+	}
+	offset = *linear & MEMORY_PAGE_MASK;
+	fit = (MEMORY_PAGE_SIZE - offset) / size;
+	if (fit > ((limit - off + 1) / size)) fit = (limit - off + 1) / size;
+	if (*n > fit) *n = fit;
+	return (*n > 0) ? region : NULL;
+}
 
-			case 0x3E:	/* segment cpu->segregs[regds] */
-				cpu->useseg = cpu->segregs[regds];
-				cpu->segoverride = 1;
-				break;
+static uint32_t cpu_repMovsRegion(CPU_t* cpu, uint8_t size, uint32_t budget) {
+	MEMORY_REGION_t* region;
+	uint8_t* host;
+	uint32_t n, linear;
+
+	n = cpu_repCount(cpu, budget);
+	region = cpu_stringRegion(cpu, reges, cpu->regs.wordregs[regdi], size, 1, &n, &linear);
+	if (region != NULL) {
+		n = cpu_stringSpan(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi], size, 0, n, &host);
+		if (n == 0) return 0;
+		n = (*region->writeblock)(region->udata, linear, host, n * size) / size;
+		memory_markDirty(linear);
+		memory_writes++;
+		if (profile_enabled) profile_mmioWrite[linear >> MEMORY_PAGE_SHIFT] += n * size;
+	}
+	else {
+		region = cpu_stringRegion(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi], size, 0, &n, &linear);
+		if (region == NULL) return 0;
+		n = cpu_stringSpan(cpu, reges, cpu->regs.wordregs[regdi], size, 1, n, &host);
+		if (n == 0) return 0;
+		n = (*region->readblock)(region->udata, linear, host, n * size) / size;
+		if (profile_enabled) profile_mmioRead[linear >> MEMORY_PAGE_SHIFT] += n * size;
+	}
+
+	cpu_repAdvance(cpu, regsi, n, size);
+	cpu_repAdvance(cpu, regdi, n, size);
+	cpu->regs.wordregs[regcx] -= (uint16_t)n;
+	return n;
+}
 
-			case 0x26:	/* segment cpu->segregs[reges] */
-				cpu->useseg = cpu->segregs[reges];
-				cpu->segoverride = 1;
-				break;
+static uint32_t cpu_repStosRegion(CPU_t* cpu, uint8_t size, uint32_t budget) {
+	MEMORY_REGION_t* region;
+	uint8_t fill[256];
+	uint32_t n, i, linear;
 
-			case 0x36:	/* segment cpu->segregs[regss] */
-				cpu->useseg = cpu->segregs[regss];
-				cpu->segoverride = 1;
-				break;
+	n = cpu_repCount(cpu, budget);
+	if (n > (sizeof(fill) / size)) n = sizeof(fill) / size;
+	region = cpu_stringRegion(cpu, reges, cpu->regs.wordregs[regdi], size, 1, &n, &linear);
+	if (region == NULL) return 0;
 
-			case 0xF0: /* LOCK prefix */
-				break;
+	if (size == 1) {
+		memset(fill, cpu->regs.byteregs[regal], n);
+	}
+	else {
+		for (i = 0; i < n; i++) {
+			fill[i << 1] = (uint8_t)cpu->regs.wordregs[regax];
+			fill[(i << 1) + 1] = (uint8_t)(cpu->regs.wordregs[regax] >> 8);
+		}
+	}
+	n = (*region->writeblock)(region->udata, linear, fill, n * size) / size;
+	memory_markDirty(linear);
+	memory_writes++;
+	if (profile_enabled) profile_mmioWrite[linear >> MEMORY_PAGE_SHIFT] += n * size;
 
-				/* repetition prefix check */
-			case 0xF3:	/* REP/REPE/REPZ */
-				cpu->reptype = 1;
-				break;
+	cpu_repAdvance(cpu, regdi, n, size);
+	cpu->regs.wordregs[regcx] -= (uint16_t)n;
+	return n;
+}
 
-			case 0xF2:	/* REPNE/REPNZ */
-				cpu->reptype = 2;
-				break;
+static uint32_t cpu_repMovs(CPU_t* cpu, uint8_t size, uint32_t budget) {
+	uint8_t *src, *dst, *slow, *dlow;
+	uint32_t n, i, bytes;
+	int32_t step;
 
-			default:
-				docontinue = 1;
-				break;
+	n = cpu_stringSpan(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi], size, 0, cpu_repCount(cpu, budget), &src);
+	if (n == 0) return cpu_repMovsRegion(cpu, size, budget);
+	n = cpu_stringSpan(cpu, reges, cpu->regs.wordregs[regdi], size, 1, n, &dst);
+	if (n == 0) return cpu_repMovsRegion(cpu, size, budget);
+
+	bytes = n * size;
+	step = (cpu->df) ? -(int32_t)size : (int32_t)size;
+	slow = (cpu->df) ? src - (bytes - size) : src;
+	dlow = (cpu->df) ? dst - (bytes - size) : dst;
+	if ((dlow + bytes <= slow) || (slow + bytes <= dlow)) {
+		memcpy(dlow, slow, bytes);
+	}
+	else { //overlapping, keep the element-by-element result
+		for (i = 0; i < n; i++, src += step, dst += step) {
+			if (size == 1) {
+				*dst = *src;
+			}
+			else {
+				uint8_t lo = src[0], hi = src[1];
+				dst[0] = lo;
+				dst[1] = hi;
 			}
 		}
+	}
 
-#if 0
-		printf("%04X:%04X  %02X %02X %02X %02X\n",
-			cpu->savecs,
-			firstip,
-			cpu->opcode,
-			getmem8(cpu, cpu->segregs[regcs], cpu->ip + 0),
-			getmem8(cpu, cpu->segregs[regcs], cpu->ip + 1),
-			getmem8(cpu, cpu->segregs[regcs], cpu->ip + 2)
-		);
-#endif
-
-#if 0
-		if (cpu->protected_mode) {
-			printf("%04X:%04X  %02X %02X %02X %02X\n",
-				cpu->savecs,
-				firstip,
-				cpu->opcode,
-				getmem8(cpu, cpu->segregs[regcs], cpu->ip + 0),
-				getmem8(cpu, cpu->segregs[regcs], cpu->ip + 1),
-				getmem8(cpu, cpu->segregs[regcs], cpu->ip + 2)
-			);
-		}
-#endif
-
-		cpu->totalexec++;
-
-		switch (cpu->opcode) {
-		case 0x00:	/* 00 ADD Eb Gb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getreg8(cpu, cpu->reg);
-			op_add8(cpu);
-			writerm8(cpu, cpu->rm, cpu->res8);
-			break;
+	cpu_repAdvance(cpu, regsi, n, size);
+	cpu_repAdvance(cpu, regdi, n, size);
+	cpu->regs.wordregs[regcx] -= (uint16_t)n;
+	return n;
+}
 
-		case 0x01:	/* 01 ADD Ev Gv */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			cpu->oper2 = getreg16(cpu, cpu->reg);
-			op_add16(cpu);
-			writerm16(cpu, cpu->rm, cpu->res16);
-			break;
+static uint32_t cpu_repStos(CPU_t* cpu, uint8_t size, uint32_t budget) {
+	uint8_t *dst;
+	uint32_t n, i;
 
-		case 0x02:	/* 02 ADD Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			cpu->oper2b = readrm8(cpu, cpu->rm);
-			op_add8(cpu);
-			putreg8(cpu, cpu->reg, cpu->res8);
-			break;
+	n = cpu_stringSpan(cpu, reges, cpu->regs.wordregs[regdi], size, 1, cpu_repCount(cpu, budget), &dst);
+	if (n == 0) return cpu_repStosRegion(cpu, size, budget);
 
-		case 0x03:	/* 03 ADD Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			cpu->oper2 = readrm16(cpu, cpu->rm);
-			op_add16(cpu);
-			putreg16(cpu, cpu->reg, cpu->res16);
-			break;
+	if (size == 1) {
+		memset((cpu->df) ? dst - (n - 1) : dst, cpu->regs.byteregs[regal], n);
+	}
+	else {
+		if (cpu->df) dst -= (n - 1) * 2;
+		for (i = 0; i < n; i++, dst += 2) {
+			dst[0] = (uint8_t)cpu->regs.wordregs[regax];
+			dst[1] = (uint8_t)(cpu->regs.wordregs[regax] >> 8);
+		}
+	}
 
-		case 0x04:	/* 04 ADD cpu->regs.byteregs[regal] Ib */
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			op_add8(cpu);
-			cpu->regs.byteregs[regal] = cpu->res8;
-			break;
+	cpu_repAdvance(cpu, regdi, n, size);
+	cpu->regs.wordregs[regcx] -= (uint16_t)n;
+	return n;
+}
 
-		case 0x05:	/* 05 ADD eAX Iv */
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			op_add16(cpu);
-			cpu->regs.wordregs[regax] = cpu->res16;
-			break;
+static uint32_t cpu_repLods(CPU_t* cpu, uint8_t size, uint32_t budget) {
+	uint8_t *src;
+	uint32_t n;
 
-		case 0x06:	/* 06 PUSH cpu->segregs[reges] */
-			push(cpu, cpu->segregs[reges]);
-			break;
+	n = cpu_stringSpan(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi], size, 0, cpu_repCount(cpu, budget), &src);
+	if (n == 0) return 0;
 
-		case 0x07:	/* 07 POP cpu->segregs[reges] */
-			cpu->oper1 = pop(cpu);
-			if (cpu->protected_mode) {
-				load_descriptor(cpu, reges, cpu->oper1);
-			}
-			cpu->segregs[reges] = cpu->oper1;
-			break;
+	//only the last element loaded is observable
+	src = (cpu->df) ? src - (n - 1) * size : src + (n - 1) * size;
+	if (size == 1) {
+		cpu->regs.byteregs[regal] = src[0];
+	}
+	else {
+		cpu->oper1 = (uint16_t)src[0] | ((uint16_t)src[1] << 8);
+		cpu->regs.wordregs[regax] = cpu->oper1;
+	}
 
-		case 0x08:	/* 08 OR Eb Gb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getreg8(cpu, cpu->reg);
-			op_or8(cpu);
-			writerm8(cpu, cpu->rm, cpu->res8);
-			break;
+	cpu_repAdvance(cpu, regsi, n, size);
+	cpu->regs.wordregs[regcx] -= (uint16_t)n;
+	return n;
+}
 
-		case 0x09:	/* 09 OR Ev Gv */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			cpu->oper2 = getreg16(cpu, cpu->reg);
-			op_or16(cpu);
-			writerm16(cpu, cpu->rm, cpu->res16);
-			break;
+static uint32_t cpu_repIns(CPU_t* cpu, uint8_t size, uint32_t budget) {
+	uint8_t *dst;
+	uint32_t n, i;
+	int32_t step;
 
-		case 0x0A:	/* 0A OR Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			cpu->oper2b = readrm8(cpu, cpu->rm);
-			op_or8(cpu);
-			putreg8(cpu, cpu->reg, cpu->res8);
-			break;
+	n = cpu_stringSpan(cpu, reges, cpu->regs.wordregs[regdi], size, 1, cpu_repCount(cpu, budget), &dst);
+	if (n == 0) return 0;
 
-		case 0x0B:	/* 0B OR Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			cpu->oper2 = readrm16(cpu, cpu->rm);
-			op_or16(cpu);
-			putreg16(cpu, cpu->reg, cpu->res16);
-			break;
+	i = 0;
+	step = (cpu->df) ? -(int32_t)size : (int32_t)size;
+	if (!cpu->df) { //the span is ascending, a device with a bulk handler can fill it in one go
+		i = port_readBlock(cpu, cpu->regs.wordregs[regdx], dst, n, size);
+		dst += i * size;
+	}
+	for (; i < n; i++, dst += step) {
+		if (size == 1) {
+			*dst = port_read(cpu, cpu->regs.wordregs[regdx]);
+		}
+		else {
+			uint16_t value = port_readw(cpu, cpu->regs.wordregs[regdx]);
+			dst[0] = (uint8_t)value;
+			dst[1] = (uint8_t)(value >> 8);
+		}
+	}
 
-		case 0x0C:	/* 0C OR cpu->regs.byteregs[regal] Ib */
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			op_or8(cpu);
-			cpu->regs.byteregs[regal] = cpu->res8;
-			break;
+	cpu_repAdvance(cpu, regdi, n, size);
+	cpu->regs.wordregs[regcx] -= (uint16_t)n;
+	return n;
+}
 
-		case 0x0D:	/* 0D OR eAX Iv */
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			op_or16(cpu);
-			cpu->regs.wordregs[regax] = cpu->res16;
-			break;
+static uint32_t cpu_repOuts(CPU_t* cpu, uint8_t size, uint32_t budget) {
+	uint8_t *src;
+	uint32_t n, i;
+	int32_t step;
 
-		case 0x0E:	/* 0E PUSH cpu->segregs[regcs] */
-			push(cpu, cpu->segregs[regcs]);
-			break;
+	n = cpu_stringSpan(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi], size, 0, cpu_repCount(cpu, budget), &src);
+	if (n == 0) return 0;
 
-		case 0x0F: /* extended opcodes */
-			cpu->opcode = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-#if 1
-			debug_log(DEBUG_INFO, "[CPU] Extended Opcode 0Fh, %02Xh\n", cpu->opcode);
-#endif
-
-			switch (cpu->opcode) {
-			case 0x00: /* Group 6 Instructions */
-				modregrm(cpu);
-				if (cpu->protected_mode) {
-					switch (cpu->reg) {
-					case 0: // SLDT
-						writerm16(cpu, cpu->rm, cpu->ldtr);
-						break;
-					case 1: // STR
-						writerm16(cpu, cpu->rm, cpu->tr);
-						break;
-					case 2: // LLDT
-						if (cpu->cpl != 0) {
-							cpu_intcall(cpu, 13);
-							break;
-						}
-						cpu->ldtr = readrm16(cpu, cpu->rm);
-						load_ldtr(cpu, cpu->ldtr);
-						break;
-					case 3: // LTR
-						if (cpu->cpl != 0) {
-							cpu_intcall(cpu, 13);
-							break;
-						}
-						cpu->tr = readrm16(cpu, cpu->rm);
-						load_tr(cpu, cpu->tr);
-						break;
-					case 4: // VERR
-					case 5: // VERW
-					{
-						uint16_t sel = readrm16(cpu, cpu->rm);
-						uint32_t base; uint16_t limit; uint8_t access;
-						cpu->zf = 0;
-						if ((sel & 0xFFFC) != 0 && get_descriptor_info(cpu, sel, &base, &limit, &access)) {
-							uint8_t dpl = (access >> 5) & 3;
-							uint8_t cpl = cpu->cpl;
-							uint8_t rpl = sel & 3;
-							uint8_t max_pl = (cpl > rpl) ? cpl : rpl;
-							bool is_code = (access & 0x08) != 0;
-							bool is_conforming = is_code && (access & 0x04);
-
-							if ((access & 0x10) && (is_conforming || (max_pl <= dpl))) {
-								if (cpu->reg == 4) { // VERR
-									if (!is_code || (access & 0x02)) cpu->zf = 1;
-								}
-								else { // VERW
-									if (!is_code && (access & 0x02)) cpu->zf = 1;
-								}
-							}
-						}
-						break;
-					}
-					default:
-						debug_log(DEBUG_ERROR, "[CPU] Unhandled Group 6 /0Fh opcode reg=%d (rm=%d)\n", cpu->reg, cpu->rm);
-						cpu_intcall(cpu, 6);
-						break;
-					}
-				}
-				else {
-					cpu_intcall(cpu, 6);
-				}
-				break;
-			case 0x01: /* Group 7 Instructions */
-				modregrm(cpu);
-				switch (cpu->reg) {
-				case 0: // SGDT
-					if (cpu->mode == 3) {
-						cpu_intcall(cpu, 6);
-						break;
-					}
-					getea(cpu, cpu->rm);
-					cpu_writew(cpu, cpu->ea, cpu->gdtr.limit);
-					cpu_write(cpu, cpu->ea + 2, (cpu->gdtr.base) & 0xFF);
-					cpu_write(cpu, cpu->ea + 3, (cpu->gdtr.base >> 8) & 0xFF);
-					cpu_write(cpu, cpu->ea + 4, (cpu->gdtr.base >> 16) & 0xFF);
-					break;
-				case 1: // SIDT
-					if (cpu->mode == 3) {
-						cpu_intcall(cpu, 6);
-						break;
-					}
-					getea(cpu, cpu->rm);
-					cpu_writew(cpu, cpu->ea, cpu->idtr.limit);
-					cpu_write(cpu, cpu->ea + 2, (cpu->idtr.base) & 0xFF);
-					cpu_write(cpu, cpu->ea + 3, (cpu->idtr.base >> 8) & 0xFF);
-					cpu_write(cpu, cpu->ea + 4, (cpu->idtr.base >> 16) & 0xFF);
-					break;
-				case 2: // LGDT
-					if (cpu->protected_mode && cpu->cpl != 0) {
-						cpu_intcall(cpu, 13);
-						break;
-					}
-					if (cpu->mode == 3) {
-						cpu_intcall(cpu, 6);
-						break;
-					}
-					getea(cpu, cpu->rm);
-					uint16_t gdt_limit = cpu_readw(cpu, cpu->ea);
-					uint32_t gdt_base = cpu_read(cpu, cpu->ea + 2)
-						| (cpu_read(cpu, cpu->ea + 3) << 8)
-						| (cpu_read(cpu, cpu->ea + 4) << 16);
-					cpu->gdtr.limit = gdt_limit;
-					cpu->gdtr.base = gdt_base;
-					break;
-				case 3: // LIDT
-					if (cpu->protected_mode && cpu->cpl != 0) {
-						cpu_intcall(cpu, 13);
-						break;
-					}
-					if (cpu->mode == 3) {
-						cpu_intcall(cpu, 6);
-						break;
-					}
-					getea(cpu, cpu->rm);
-					uint16_t idt_limit = cpu_readw(cpu, cpu->ea);
-					uint32_t idt_base = cpu_read(cpu, cpu->ea + 2)
-						| (cpu_read(cpu, cpu->ea + 3) << 8)
-						| (cpu_read(cpu, cpu->ea + 4) << 16);
-					cpu->idtr.limit = idt_limit;
-					cpu->idtr.base = idt_base;
-					break;
-				case 4: // SMSW Ew
-					writerm16(cpu, cpu->rm, cpu->msw);
-					break;
-				case 6: // LMSW Ew
-					if (cpu->protected_mode && cpu->cpl != 0) {
-						cpu_intcall(cpu, 13);
-						break;
-					}
-					cpu->oper1 = readrm16(cpu, cpu->rm);
-
-					if (cpu->protected_mode) {
-						cpu->oper1 |= 1;
-					}
-
-					cpu->msw = (cpu->msw & 0xFFF0) | (cpu->oper1 & 0x000F);
-
-					if (!cpu->protected_mode && (cpu->msw & 1)) {
-						debug_log(DEBUG_INFO, "[CPU] Entering Protected Mode\n");
-						cpu->protected_mode = 1;
-
-						cpu->segcache[regcs].base = (uint32_t)cpu->segregs[regcs] << 4;
-						cpu->segcache[regcs].limit = 0xFFFF;
-						cpu->segcache[regcs].access = 0x93;
-						cpu->segcache[regcs].valid = 1;
-
-						cpu->segcache[regds].base = (uint32_t)cpu->segregs[regds] << 4;
-						cpu->segcache[regds].limit = 0xFFFF;
-						cpu->segcache[regds].access = 0x93;
-						cpu->segcache[regds].valid = 1;
-
-						cpu->segcache[reges].base = (uint32_t)cpu->segregs[reges] << 4;
-						cpu->segcache[reges].limit = 0xFFFF;
-						cpu->segcache[reges].access = 0x93;
-						cpu->segcache[reges].valid = 1;
-
-						cpu->segcache[regss].base = (uint32_t)cpu->segregs[regss] << 4;
-						cpu->segcache[regss].limit = 0xFFFF;
-						cpu->segcache[regss].access = 0x93;
-						cpu->segcache[regss].valid = 1;
-					}
-					break;
-				default:
-					debug_log(DEBUG_ERROR, "[CPU] Unhandled Group 7 /0Fh opcode reg=%d (rm=%d)\n", cpu->reg, cpu->rm);
-					cpu_intcall(cpu, 6);
-					break;
-				}
-				break;
-			case 0x02: // LAR
-			case 0x03: // LSL
-			{
-				modregrm(cpu);
-				uint32_t base;
-				uint16_t limit;
-				uint8_t access;
-				uint16_t sel = readrm16(cpu, cpu->rm);
-				uint8_t cpl = cpu->cpl;
-				uint8_t rpl = sel & 3;
-
-				cpu->zf = 0;
-
-				if (get_descriptor_info(cpu, sel, &base, &limit, &access)) {
-					uint8_t type = (access >> 0) & 0x1F;
-					uint8_t dpl = (access >> 5) & 3;
-
-					if (dpl >= cpl && dpl >= rpl) {
-						bool valid_type = false;
-						if (cpu->opcode == 0x02) { // LAR
-							if (type != 0x00 && type != 0x08 && type != 0x0A && type != 0x0D) {
-								valid_type = true;
-							}
-						}
-						else { // LSL
-							if (type != 0x00 && type != 0x04 && type != 0x05 && type != 0x06 &&
-								type != 0x07 && type != 0x0C && type != 0x0E && type != 0x0F) {
-								valid_type = true;
-							}
-						}
-
-						if (valid_type) {
-							cpu->zf = 1;
-							if (cpu->opcode == 0x02) { // LAR
-								putreg16(cpu, cpu->reg, access << 8);
-							}
-							else { // LSL
-								putreg16(cpu, cpu->reg, limit);
-							}
-						}
-					}
-				}
-				break;
-			}
-			case 0x05: /* LOADALL - 286 version */
-				if (cpu->protected_mode) {
-					cpu_intcall(cpu, 6);
-					break;
-				}
-
-				uint32_t addr = 0x800;
-
-				cpu->segcache[reges].limit = cpu_readw(cpu, addr + 0x1E);
-				cpu->segcache[reges].base = read_24bit_base(cpu, addr + 0x1B);
-				cpu->segcache[reges].access = cpu_read(cpu, addr + 0x1A);
-				cpu->segcache[reges].valid = 1;
-
-				cpu->segcache[regcs].limit = cpu_readw(cpu, addr + 0x24);
-				cpu->segcache[regcs].base = read_24bit_base(cpu, addr + 0x21);
-				cpu->segcache[regcs].access = cpu_read(cpu, addr + 0x20);
-				cpu->segcache[regcs].valid = 1;
-
-				cpu->segcache[regss].limit = cpu_readw(cpu, addr + 0x2A);
-				cpu->segcache[regss].base = read_24bit_base(cpu, addr + 0x27);
-				cpu->segcache[regss].access = cpu_read(cpu, addr + 0x26);
-				cpu->segcache[regss].valid = 1;
-
-				cpu->segcache[regds].limit = cpu_readw(cpu, addr + 0x30);
-				cpu->segcache[regds].base = read_24bit_base(cpu, addr + 0x2D);
-				cpu->segcache[regds].access = cpu_read(cpu, addr + 0x2C);
-				cpu->segcache[regds].valid = 1;
-
-				cpu->regs.wordregs[regdi] = cpu_readw(cpu, addr + 0x32);
-				cpu->regs.wordregs[regsi] = cpu_readw(cpu, addr + 0x34);
-				cpu->regs.wordregs[regbp] = cpu_readw(cpu, addr + 0x36);
-				cpu->regs.wordregs[regsp] = cpu_readw(cpu, addr + 0x38);
-				cpu->regs.wordregs[regbx] = cpu_readw(cpu, addr + 0x3A);
-				cpu->regs.wordregs[regdx] = cpu_readw(cpu, addr + 0x3C);
-				cpu->regs.wordregs[regcx] = cpu_readw(cpu, addr + 0x3E);
-				cpu->regs.wordregs[regax] = cpu_readw(cpu, addr + 0x40);
-
-				decodeflagsword(cpu, cpu_readw(cpu, addr + 0x42));
-				cpu->ip = cpu_readw(cpu, addr + 0x44);
-				cpu->ldtr = cpu_readw(cpu, addr + 0x46);
-				cpu->tr = cpu_readw(cpu, addr + 0x54);
-				cpu->segregs[regds] = cpu_readw(cpu, addr + 0x48);
-				cpu->segregs[regss] = cpu_readw(cpu, addr + 0x4A);
-				cpu->segregs[regcs] = cpu_readw(cpu, addr + 0x4C);
-				cpu->segregs[reges] = cpu_readw(cpu, addr + 0x4E);
-
-				cpu->gdtr.limit = cpu_readw(cpu, addr + 0x56);
-				cpu->gdtr.base = read_24bit_base(cpu, addr + 0x58);
-				cpu->idtr.limit = cpu_readw(cpu, addr + 0x5C);
-				cpu->idtr.base = read_24bit_base(cpu, addr + 0x5E);
-
-				cpu->msw = cpu_readw(cpu, addr + 0x66);
-				if (!cpu->protected_mode && (cpu->msw & 1)) {
-					debug_log(DEBUG_INFO, "[CPU] Entering Protected Mode\n");
-				}
-				cpu->protected_mode = (cpu->msw & 1);
-				break;
-			case 0x06: /* CLTS */
-				if (cpu->protected_mode && cpu->cpl != 0) {
-					cpu_intcall(cpu, 13);
-					break;
-				}
-				cpu->msw &= ~0x0008;
-				break;
-			default:
-				debug_log(DEBUG_ERROR, "[CPU] Unhandled 0Fh opcode: %02Xh\n", cpu->opcode);
-				cpu_intcall(cpu, 6);
-				break;
-			}
-			break;
-
-		case 0x10:	/* 10 ADC Eb Gb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getreg8(cpu, cpu->reg);
-			op_adc8(cpu);
-			writerm8(cpu, cpu->rm, cpu->res8);
-			break;
-
-		case 0x11:	/* 11 ADC Ev Gv */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			cpu->oper2 = getreg16(cpu, cpu->reg);
-			op_adc16(cpu);
-			writerm16(cpu, cpu->rm, cpu->res16);
-			break;
-
-		case 0x12:	/* 12 ADC Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			cpu->oper2b = readrm8(cpu, cpu->rm);
-			op_adc8(cpu);
-			putreg8(cpu, cpu->reg, cpu->res8);
-			break;
-
-		case 0x13:	/* 13 ADC Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			cpu->oper2 = readrm16(cpu, cpu->rm);
-			op_adc16(cpu);
-			putreg16(cpu, cpu->reg, cpu->res16);
-			break;
-
-		case 0x14:	/* 14 ADC cpu->regs.byteregs[regal] Ib */
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			op_adc8(cpu);
-			cpu->regs.byteregs[regal] = cpu->res8;
-			break;
-
-		case 0x15:	/* 15 ADC eAX Iv */
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			op_adc16(cpu);
-			cpu->regs.wordregs[regax] = cpu->res16;
-			break;
-
-		case 0x16:	/* 16 PUSH cpu->segregs[regss] */
-			push(cpu, cpu->segregs[regss]);
-			break;
-
-		case 0x17:	/* 17 POP cpu->segregs[regss] */
-			cpu->oper1 = pop(cpu);
-			if (cpu->protected_mode) {
-				load_descriptor(cpu, regss, cpu->oper1);
-			}
-			cpu->segregs[regss] = cpu->oper1;
-			break;
-
-		case 0x18:	/* 18 SBB Eb Gb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getreg8(cpu, cpu->reg);
-			op_sbb8(cpu);
-			writerm8(cpu, cpu->rm, cpu->res8);
-			break;
-
-		case 0x19:	/* 19 SBB Ev Gv */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			cpu->oper2 = getreg16(cpu, cpu->reg);
-			op_sbb16(cpu);
-			writerm16(cpu, cpu->rm, cpu->res16);
-			break;
-
-		case 0x1A:	/* 1A SBB Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			cpu->oper2b = readrm8(cpu, cpu->rm);
-			op_sbb8(cpu);
-			putreg8(cpu, cpu->reg, cpu->res8);
-			break;
-
-		case 0x1B:	/* 1B SBB Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			cpu->oper2 = readrm16(cpu, cpu->rm);
-			op_sbb16(cpu);
-			putreg16(cpu, cpu->reg, cpu->res16);
-			break;
-
-		case 0x1C:	/* 1C SBB cpu->regs.byteregs[regal] Ib */
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			op_sbb8(cpu);
-			cpu->regs.byteregs[regal] = cpu->res8;
-			break;
-
-		case 0x1D:	/* 1D SBB eAX Iv */
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			op_sbb16(cpu);
-			cpu->regs.wordregs[regax] = cpu->res16;
-			break;
-
-		case 0x1E:	/* 1E PUSH cpu->segregs[regds] */
-			push(cpu, cpu->segregs[regds]);
-			break;
-
-		case 0x1F:	/* 1F POP cpu->segregs[regds] */
-			cpu->oper1 = pop(cpu);
-			if (cpu->protected_mode) {
-				load_descriptor(cpu, regds, cpu->oper1);
-			}
-			cpu->segregs[regds] = cpu->oper1;
-			break;
-
-		case 0x20:	/* 20 AND Eb Gb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getreg8(cpu, cpu->reg);
-			op_and8(cpu);
-			writerm8(cpu, cpu->rm, cpu->res8);
-			break;
-
-		case 0x21:	/* 21 AND Ev Gv */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			cpu->oper2 = getreg16(cpu, cpu->reg);
-			op_and16(cpu);
-			writerm16(cpu, cpu->rm, cpu->res16);
-			break;
-
-		case 0x22:	/* 22 AND Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			cpu->oper2b = readrm8(cpu, cpu->rm);
-			op_and8(cpu);
-			putreg8(cpu, cpu->reg, cpu->res8);
-			break;
-
-		case 0x23:	/* 23 AND Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			cpu->oper2 = readrm16(cpu, cpu->rm);
-			op_and16(cpu);
-			putreg16(cpu, cpu->reg, cpu->res16);
-			break;
-
-		case 0x24:	/* 24 AND cpu->regs.byteregs[regal] Ib */
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			op_and8(cpu);
-			cpu->regs.byteregs[regal] = cpu->res8;
-			break;
-
-		case 0x25:	/* 25 AND eAX Iv */
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			op_and16(cpu);
-			cpu->regs.wordregs[regax] = cpu->res16;
-			break;
-
-		case 0x27:	/* 27 DAA */
-		{
-			uint8_t old_al;
-			old_al = cpu->regs.byteregs[regal];
-			if (((cpu->regs.byteregs[regal] & 0x0F) > 9) || cpu->af) {
-				cpu->oper1 = (uint16_t)cpu->regs.byteregs[regal] + 0x06;
-				cpu->regs.byteregs[regal] = cpu->oper1 & 0xFF;
-				if (cpu->oper1 & 0xFF00) cpu->cf = 1;
-				if ((cpu->oper1 & 0x000F) < (old_al & 0x0F)) cpu->af = 1;
-			}
-			if (((cpu->regs.byteregs[regal] & 0xF0) > 0x90) || cpu->cf) {
-				cpu->oper1 = (uint16_t)cpu->regs.byteregs[regal] + 0x60;
-				cpu->regs.byteregs[regal] = cpu->oper1 & 0xFF;
-				if (cpu->oper1 & 0xFF00) cpu->cf = 1; else cpu->cf = 0;
-			}
-			flag_szp8(cpu, cpu->regs.byteregs[regal]);
-			break;
-		}
-
-		case 0x28:	/* 28 SUB Eb Gb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getreg8(cpu, cpu->reg);
-			op_sub8(cpu);
-			writerm8(cpu, cpu->rm, cpu->res8);
-			break;
-
-		case 0x29:	/* 29 SUB Ev Gv */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			cpu->oper2 = getreg16(cpu, cpu->reg);
-			op_sub16(cpu);
-			writerm16(cpu, cpu->rm, cpu->res16);
-			break;
-
-		case 0x2A:	/* 2A SUB Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			cpu->oper2b = readrm8(cpu, cpu->rm);
-			op_sub8(cpu);
-			putreg8(cpu, cpu->reg, cpu->res8);
-			break;
-
-		case 0x2B:	/* 2B SUB Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			cpu->oper2 = readrm16(cpu, cpu->rm);
-			op_sub16(cpu);
-			putreg16(cpu, cpu->reg, cpu->res16);
-			break;
-
-		case 0x2C:	/* 2C SUB cpu->regs.byteregs[regal] Ib */
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			op_sub8(cpu);
-			cpu->regs.byteregs[regal] = cpu->res8;
-			break;
-
-		case 0x2D:	/* 2D SUB eAX Iv */
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			op_sub16(cpu);
-			cpu->regs.wordregs[regax] = cpu->res16;
-			break;
-
-		case 0x2F:	/* 2F DAS */
-		{
-			uint8_t old_al;
-			old_al = cpu->regs.byteregs[regal];
-			if (((cpu->regs.byteregs[regal] & 0x0F) > 9) || cpu->af) {
-				cpu->oper1 = (uint16_t)cpu->regs.byteregs[regal] - 0x06;
-				cpu->regs.byteregs[regal] = cpu->oper1 & 0xFF;
-				if (cpu->oper1 & 0xFF00) cpu->cf = 1;
-				if ((cpu->oper1 & 0x000F) >= (old_al & 0x0F)) cpu->af = 1;
-			}
-			if (((cpu->regs.byteregs[regal] & 0xF0) > 0x90) || cpu->cf) {
-				cpu->oper1 = (uint16_t)cpu->regs.byteregs[regal] - 0x60;
-				cpu->regs.byteregs[regal] = cpu->oper1 & 0xFF;
-				if (cpu->oper1 & 0xFF00) cpu->cf = 1; else cpu->cf = 0;
-			}
-			flag_szp8(cpu, cpu->regs.byteregs[regal]);
-			break;
-		}
-
-		case 0x30:	/* 30 XOR Eb Gb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getreg8(cpu, cpu->reg);
-			op_xor8(cpu);
-			writerm8(cpu, cpu->rm, cpu->res8);
-			break;
-
-		case 0x31:	/* 31 XOR Ev Gv */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			cpu->oper2 = getreg16(cpu, cpu->reg);
-			op_xor16(cpu);
-			writerm16(cpu, cpu->rm, cpu->res16);
-			break;
-
-		case 0x32:	/* 32 XOR Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			cpu->oper2b = readrm8(cpu, cpu->rm);
-			op_xor8(cpu);
-			putreg8(cpu, cpu->reg, cpu->res8);
-			break;
-
-		case 0x33:	/* 33 XOR Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			cpu->oper2 = readrm16(cpu, cpu->rm);
-			op_xor16(cpu);
-			putreg16(cpu, cpu->reg, cpu->res16);
-			break;
-
-		case 0x34:	/* 34 XOR cpu->regs.byteregs[regal] Ib */
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			op_xor8(cpu);
-			cpu->regs.byteregs[regal] = cpu->res8;
-			break;
-
-		case 0x35:	/* 35 XOR eAX Iv */
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			op_xor16(cpu);
-			cpu->regs.wordregs[regax] = cpu->res16;
-			break;
-
-		case 0x37:	/* 37 AAA ASCII */
-			if (((cpu->regs.byteregs[regal] & 0xF) > 9) || (cpu->af == 1)) {
-				cpu->regs.wordregs[regax] = cpu->regs.wordregs[regax] + 0x106;
-				cpu->af = 1;
-				cpu->cf = 1;
-			}
-			else {
-				cpu->af = 0;
-				cpu->cf = 0;
-			}
-
-			cpu->regs.byteregs[regal] = cpu->regs.byteregs[regal] & 0xF;
-			break;
-
-		case 0x38:	/* 38 CMP Eb Gb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getreg8(cpu, cpu->reg);
-			flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
-			break;
-
-		case 0x39:	/* 39 CMP Ev Gv */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			cpu->oper2 = getreg16(cpu, cpu->reg);
-			flag_sub16(cpu, cpu->oper1, cpu->oper2);
-			break;
-
-		case 0x3A:	/* 3A CMP Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			cpu->oper2b = readrm8(cpu, cpu->rm);
-			flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
-			break;
-
-		case 0x3B:	/* 3B CMP Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			cpu->oper2 = readrm16(cpu, cpu->rm);
-			flag_sub16(cpu, cpu->oper1, cpu->oper2);
-			break;
-
-		case 0x3C:	/* 3C CMP cpu->regs.byteregs[regal] Ib */
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
-			break;
-
-		case 0x3D:	/* 3D CMP eAX Iv */
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			flag_sub16(cpu, cpu->oper1, cpu->oper2);
-			break;
-
-		case 0x3F:	/* 3F AAS ASCII */
-			if (((cpu->regs.byteregs[regal] & 0xF) > 9) || (cpu->af == 1)) {
-				cpu->regs.wordregs[regax] = cpu->regs.wordregs[regax] - 6;
-				cpu->regs.byteregs[regah] = cpu->regs.byteregs[regah] - 1;
-				cpu->af = 1;
-				cpu->cf = 1;
-			}
-			else {
-				cpu->af = 0;
-				cpu->cf = 0;
-			}
-
-			cpu->regs.byteregs[regal] = cpu->regs.byteregs[regal] & 0xF;
-			break;
-
-		case 0x40:	/* 40 INC eAX */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = 1;
-			op_add16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regax] = cpu->res16;
-			break;
-
-		case 0x41:	/* 41 INC eCX */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regcx];
-			cpu->oper2 = 1;
-			op_add16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regcx] = cpu->res16;
-			break;
-
-		case 0x42:	/* 42 INC eDX */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regdx];
-			cpu->oper2 = 1;
-			op_add16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regdx] = cpu->res16;
-			break;
-
-		case 0x43:	/* 43 INC eBX */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regbx];
-			cpu->oper2 = 1;
-			op_add16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regbx] = cpu->res16;
-			break;
-
-		case 0x44:	/* 44 INC eSP */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regsp];
-			cpu->oper2 = 1;
-			op_add16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regsp] = cpu->res16;
-			break;
-
-		case 0x45:	/* 45 INC eBP */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regbp];
-			cpu->oper2 = 1;
-			op_add16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regbp] = cpu->res16;
-			break;
-
-		case 0x46:	/* 46 INC eSI */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regsi];
-			cpu->oper2 = 1;
-			op_add16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regsi] = cpu->res16;
-			break;
-
-		case 0x47:	/* 47 INC eDI */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regdi];
-			cpu->oper2 = 1;
-			op_add16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regdi] = cpu->res16;
-			break;
-
-		case 0x48:	/* 48 DEC eAX */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = 1;
-			op_sub16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regax] = cpu->res16;
-			break;
-
-		case 0x49:	/* 49 DEC eCX */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regcx];
-			cpu->oper2 = 1;
-			op_sub16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regcx] = cpu->res16;
-			break;
-
-		case 0x4A:	/* 4A DEC eDX */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regdx];
-			cpu->oper2 = 1;
-			op_sub16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regdx] = cpu->res16;
-			break;
-
-		case 0x4B:	/* 4B DEC eBX */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regbx];
-			cpu->oper2 = 1;
-			op_sub16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regbx] = cpu->res16;
-			break;
-
-		case 0x4C:	/* 4C DEC eSP */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regsp];
-			cpu->oper2 = 1;
-			op_sub16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regsp] = cpu->res16;
-			break;
-
-		case 0x4D:	/* 4D DEC eBP */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regbp];
-			cpu->oper2 = 1;
-			op_sub16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regbp] = cpu->res16;
-			break;
-
-		case 0x4E:	/* 4E DEC eSI */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regsi];
-			cpu->oper2 = 1;
-			op_sub16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regsi] = cpu->res16;
-			break;
-
-		case 0x4F:	/* 4F DEC eDI */
-			cpu->oldcf = cpu->cf;
-			cpu->oper1 = cpu->regs.wordregs[regdi];
-			cpu->oper2 = 1;
-			op_sub16(cpu);
-			cpu->cf = cpu->oldcf;
-			cpu->regs.wordregs[regdi] = cpu->res16;
-			break;
-
-		case 0x50:	/* 50 PUSH eAX */
-			push(cpu, cpu->regs.wordregs[regax]);
-			break;
-
-		case 0x51:	/* 51 PUSH eCX */
-			push(cpu, cpu->regs.wordregs[regcx]);
-			break;
-
-		case 0x52:	/* 52 PUSH eDX */
-			push(cpu, cpu->regs.wordregs[regdx]);
-			break;
-
-		case 0x53:	/* 53 PUSH eBX */
-			push(cpu, cpu->regs.wordregs[regbx]);
-			break;
-
-		case 0x54:	/* 54 PUSH eSP */
-			push(cpu, cpu->regs.wordregs[regsp]);
-			break;
-
-		case 0x55:	/* 55 PUSH eBP */
-			push(cpu, cpu->regs.wordregs[regbp]);
-			break;
-
-		case 0x56:	/* 56 PUSH eSI */
-			push(cpu, cpu->regs.wordregs[regsi]);
-			break;
-
-		case 0x57:	/* 57 PUSH eDI */
-			push(cpu, cpu->regs.wordregs[regdi]);
-			break;
-
-		case 0x58:	/* 58 POP eAX */
-			cpu->regs.wordregs[regax] = pop(cpu);
-			break;
-
-		case 0x59:	/* 59 POP eCX */
-			cpu->regs.wordregs[regcx] = pop(cpu);
-			break;
-
-		case 0x5A:	/* 5A POP eDX */
-			cpu->regs.wordregs[regdx] = pop(cpu);
-			break;
-
-		case 0x5B:	/* 5B POP eBX */
-			cpu->regs.wordregs[regbx] = pop(cpu);
-			break;
-
-		case 0x5C:	/* 5C POP eSP */
-			cpu->regs.wordregs[regsp] = pop(cpu);
-			break;
-
-		case 0x5D:	/* 5D POP eBP */
-			cpu->regs.wordregs[regbp] = pop(cpu);
-			break;
-
-		case 0x5E:	/* 5E POP eSI */
-			cpu->regs.wordregs[regsi] = pop(cpu);
-			break;
-
-		case 0x5F:	/* 5F POP eDI */
-			cpu->regs.wordregs[regdi] = pop(cpu);
-			break;
-
-		case 0x60:	/* 60 PUSHA */
-			cpu->oldsp = cpu->regs.wordregs[regsp];
-			push(cpu, cpu->regs.wordregs[regax]);
-			push(cpu, cpu->regs.wordregs[regcx]);
-			push(cpu, cpu->regs.wordregs[regdx]);
-			push(cpu, cpu->regs.wordregs[regbx]);
-			push(cpu, cpu->oldsp);
-			push(cpu, cpu->regs.wordregs[regbp]);
-			push(cpu, cpu->regs.wordregs[regsi]);
-			push(cpu, cpu->regs.wordregs[regdi]);
-			break;
-
-		case 0x61:	/* 61 POPA */
-			cpu->regs.wordregs[regdi] = pop(cpu);
-			cpu->regs.wordregs[regsi] = pop(cpu);
-			cpu->regs.wordregs[regbp] = pop(cpu);
-			cpu->regs.wordregs[regsp] += 2;
-			cpu->regs.wordregs[regbx] = pop(cpu);
-			cpu->regs.wordregs[regdx] = pop(cpu);
-			cpu->regs.wordregs[regcx] = pop(cpu);
-			cpu->regs.wordregs[regax] = pop(cpu);
-			break;
-
-		case 0x62: /* 62 BOUND Gv, Ev */
-			modregrm(cpu);
-			if (cpu->mode == 3) {
-				cpu_intcall(cpu, 6);
-				break;
-			}
-			if ((cpu->disp16 & 0xFFFF) >= 0xFFFD) {
-				cpu_intcall(cpu, 13);
-				break;
-			}
-			getea(cpu, cpu->rm);
-			if (signext32(getreg16(cpu, cpu->reg)) < signext32(getmem16(cpu, cpu->ea >> 4, cpu->ea & 15))) {
-				cpu_intcall(cpu, 5); //bounds check exception
-			}
-			else {
-				cpu->ea += 2;
-				if (signext32(getreg16(cpu, cpu->reg)) > signext32(getmem16(cpu, cpu->ea >> 4, cpu->ea & 15))) {
-					cpu_intcall(cpu, 5); //bounds check exception
-				}
-			}
-			break;
-
-		case 0x63: /* ARPL Ew, Gw */
-			debug_log(DEBUG_INFO, "[CPU] 286 Opcode: ARPL (63h)\n");
-
-			if (!cpu->protected_mode) {
-				cpu_intcall(cpu, 6);
-			}
-			else {
-				modregrm(cpu);
-
-				uint16_t dest = readrm16(cpu, cpu->rm);
-				uint16_t src = getreg16(cpu, cpu->reg);
-
-				uint8_t dest_rpl = dest & 0x3;
-				uint8_t src_rpl = src & 0x3;
-
-				if (dest_rpl < src_rpl) {
-					cpu->zf = 1;
-					dest = (dest & 0xFFFC) | src_rpl;
-					writerm16(cpu, cpu->rm, dest);
-				}
-				else {
-					cpu->zf = 0;
-				}
-			}
-			break;
-
-		case 0x68:	/* 68 PUSH Iv */
-			push(cpu, getmem16(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 2);
-			break;
-
-		case 0x69:	/* 69 IMUL Gv Ev Iv */
-			modregrm(cpu);
-			cpu->temp1 = readrm16(cpu, cpu->rm);
-			cpu->temp2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			if ((cpu->temp1 & 0x8000L) == 0x8000L) {
-				cpu->temp1 = cpu->temp1 | 0xFFFF0000L;
-			}
-
-			if ((cpu->temp2 & 0x8000L) == 0x8000L) {
-				cpu->temp2 = cpu->temp2 | 0xFFFF0000L;
-			}
-
-			cpu->temp3 = (uint32_t)((int32_t)cpu->temp1 * (int32_t)cpu->temp2);
-			putreg16(cpu, cpu->reg, cpu->temp3 & 0xFFFFL);
-			if (cpu->temp3 & 0xFFFF0000L) {
-				cpu->cf = 1;
-				cpu->of = 1;
-			}
-			else {
-				cpu->cf = 0;
-				cpu->of = 0;
-			}
-			break;
-
-		case 0x6A:	/* 6A PUSH Ib */
-			push(cpu, (uint16_t)signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip)));
-			StepIP(cpu, 1);
-			break;
-
-		case 0x6B:	/* 6B IMUL Gv Eb Ib */
-			modregrm(cpu);
-			cpu->temp1 = readrm16(cpu, cpu->rm);
-			cpu->temp2 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if ((cpu->temp1 & 0x8000L) == 0x8000L) {
-				cpu->temp1 = cpu->temp1 | 0xFFFF0000L;
-			}
-
-			if ((cpu->temp2 & 0x8000L) == 0x8000L) {
-				cpu->temp2 = cpu->temp2 | 0xFFFF0000L;
-			}
-
-			cpu->temp3 = (uint32_t)((int32_t)cpu->temp1 * (int32_t)cpu->temp2);
-			putreg16(cpu, cpu->reg, cpu->temp3 & 0xFFFFL);
-			if (cpu->temp3 & 0xFFFF0000L) {
-				cpu->cf = 1;
-				cpu->of = 1;
-			}
-			else {
-				cpu->cf = 0;
-				cpu->of = 0;
-			}
-			break;
-
-		case 0x6C:	/* 6E INSB */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			putmem8(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi], port_read(cpu, cpu->regs.wordregs[regdx]));
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 1;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 1;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0x6D:	/* 6F INSW */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			putmem16(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi], port_readw(cpu, cpu->regs.wordregs[regdx]));
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 2;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 2;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0x6E:	/* 6E OUTSB */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			port_write(cpu, cpu->regs.wordregs[regdx], getmem8(cpu, cpu->useseg, cpu->regs.wordregs[regsi]));
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 1;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 1;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0x6F:	/* 6F OUTSW */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			port_writew(cpu, cpu->regs.wordregs[regdx], getmem16(cpu, cpu->useseg, cpu->regs.wordregs[regsi]));
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 2;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 2;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0x70:	/* 70 JO Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (cpu->of) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x71:	/* 71 JNO Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (!cpu->of) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x72:	/* 72 JB Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (cpu->cf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x73:	/* 73 JNB Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (!cpu->cf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x74:	/* 74 JZ Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (cpu->zf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x75:	/* 75 JNZ Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (!cpu->zf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x76:	/* 76 JBE Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (cpu->cf || cpu->zf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x77:	/* 77 JA Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (!cpu->cf && !cpu->zf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x78:	/* 78 JS Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (cpu->sf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x79:	/* 79 JNS Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (!cpu->sf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x7A:	/* 7A JPE Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (cpu->pf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x7B:	/* 7B JPO Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (!cpu->pf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x7C:	/* 7C JL Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (cpu->sf != cpu->of) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x7D:	/* 7D JGE Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (cpu->sf == cpu->of) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x7E:	/* 7E JLE Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if ((cpu->sf != cpu->of) || cpu->zf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x7F:	/* 7F JG Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (!cpu->zf && (cpu->sf == cpu->of)) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0x80:
-		case 0x82:	/* 80/82 GRP1 Eb Ib */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			switch (cpu->reg) {
-			case 0:
-				op_add8(cpu);
-				break;
-			case 1:
-				op_or8(cpu);
-				break;
-			case 2:
-				op_adc8(cpu);
-				break;
-			case 3:
-				op_sbb8(cpu);
-				break;
-			case 4:
-				op_and8(cpu);
-				break;
-			case 5:
-				op_sub8(cpu);
-				break;
-			case 6:
-				op_xor8(cpu);
-				break;
-			case 7:
-				flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
-				break;
-			default:
-				break;	/* to avoid compiler warnings */
-			}
-
-			if (cpu->reg < 7) {
-				writerm8(cpu, cpu->rm, cpu->res8);
-			}
-			break;
-
-		case 0x81:	/* 81 GRP1 Ev Iv */
-		case 0x83:	/* 83 GRP1 Ev Ib */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			if (cpu->opcode == 0x81) {
-				cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-				StepIP(cpu, 2);
-			}
-			else {
-				cpu->oper2 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-				StepIP(cpu, 1);
-			}
-
-			switch (cpu->reg) {
-			case 0:
-				op_add16(cpu);
-				break;
-			case 1:
-				op_or16(cpu);
-				break;
-			case 2:
-				op_adc16(cpu);
-				break;
-			case 3:
-				op_sbb16(cpu);
-				break;
-			case 4:
-				op_and16(cpu);
-				break;
-			case 5:
-				op_sub16(cpu);
-				break;
-			case 6:
-				op_xor16(cpu);
-				break;
-			case 7:
-				flag_sub16(cpu, cpu->oper1, cpu->oper2);
-				break;
-			default:
-				break;	/* to avoid compiler warnings */
-			}
-
-			if (cpu->reg < 7) {
-				writerm16(cpu, cpu->rm, cpu->res16);
-			}
-			break;
-
-		case 0x84:	/* 84 TEST Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			cpu->oper2b = readrm8(cpu, cpu->rm);
-			flag_log8(cpu, cpu->oper1b & cpu->oper2b);
-			break;
-
-		case 0x85:	/* 85 TEST Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			cpu->oper2 = readrm16(cpu, cpu->rm);
-			flag_log16(cpu, cpu->oper1 & cpu->oper2);
-			break;
-
-		case 0x86:	/* 86 XCHG Gb Eb */
-			modregrm(cpu);
-			cpu->oper1b = getreg8(cpu, cpu->reg);
-			putreg8(cpu, cpu->reg, readrm8(cpu, cpu->rm));
-			writerm8(cpu, cpu->rm, cpu->oper1b);
-			break;
-
-		case 0x87:	/* 87 XCHG Gv Ev */
-			modregrm(cpu);
-			cpu->oper1 = getreg16(cpu, cpu->reg);
-			putreg16(cpu, cpu->reg, readrm16(cpu, cpu->rm));
-			writerm16(cpu, cpu->rm, cpu->oper1);
-			break;
-
-		case 0x88:	/* 88 MOV Eb Gb */
-			modregrm(cpu);
-			writerm8(cpu, cpu->rm, getreg8(cpu, cpu->reg));
-			break;
-
-		case 0x89:	/* 89 MOV Ev Gv */
-			modregrm(cpu);
-			writerm16(cpu, cpu->rm, getreg16(cpu, cpu->reg));
-			break;
-
-		case 0x8A:	/* 8A MOV Gb Eb */
-			modregrm(cpu);
-			putreg8(cpu, cpu->reg, readrm8(cpu, cpu->rm));
-			break;
-
-		case 0x8B:	/* 8B MOV Gv Ev */
-			modregrm(cpu);
-			putreg16(cpu, cpu->reg, readrm16(cpu, cpu->rm));
-			break;
-
-		case 0x8C:	/* 8C MOV Ew Sw */
-			modregrm(cpu);
-			writerm16(cpu, cpu->rm, getsegreg(cpu, cpu->reg));
-			break;
-
-		case 0x8D:	/* 8D LEA Gv M */
-			modregrm(cpu);
-			if (cpu->mode == 3) {
-				cpu_intcall(cpu, 6);
-				break;
-			}
-			getea(cpu, cpu->rm);
-			if (cpu->protected_mode) {
-				int seg_idx = -1;
-				if (cpu->useseg == cpu->segregs[regcs]) seg_idx = regcs;
-				else if (cpu->useseg == cpu->segregs[regds]) seg_idx = regds;
-				else if (cpu->useseg == cpu->segregs[reges]) seg_idx = reges;
-				else if (cpu->useseg == cpu->segregs[regss]) seg_idx = regss;
-
-				if (seg_idx != -1 && cpu->segcache[seg_idx].valid) {
-					putreg16(cpu, cpu->reg, (uint16_t)(cpu->ea - cpu->segcache[seg_idx].base));
-				}
-				else {
-					putreg16(cpu, cpu->reg, (uint16_t)(cpu->ea - (cpu->useseg << 4)));
-				}
-			}
-			else {
-				putreg16(cpu, cpu->reg, (uint16_t)(cpu->ea - segbase(cpu->useseg)));
-			}
-			break;
-
-		case 0x8E:	/* 8E MOV Sw Ew */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			if (cpu->protected_mode) {
-				load_descriptor(cpu, cpu->reg, cpu->oper1);
-			}
-			putsegreg(cpu, cpu->reg, cpu->oper1);
-			break;
-
-		case 0x8F:	/* 8F POP Ev */
-			modregrm(cpu);
-			writerm16(cpu, cpu->rm, pop(cpu));
-			break;
-
-		case 0x90:	/* 90 NOP */
-			break;
-
-		case 0x91:	/* 91 XCHG eCX eAX */
-			cpu->oper1 = cpu->regs.wordregs[regcx];
-			cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regax];
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			break;
-
-		case 0x92:	/* 92 XCHG eDX eAX */
-			cpu->oper1 = cpu->regs.wordregs[regdx];
-			cpu->regs.wordregs[regdx] = cpu->regs.wordregs[regax];
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			break;
-
-		case 0x93:	/* 93 XCHG eBX eAX */
-			cpu->oper1 = cpu->regs.wordregs[regbx];
-			cpu->regs.wordregs[regbx] = cpu->regs.wordregs[regax];
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			break;
-
-		case 0x94:	/* 94 XCHG eSP eAX */
-			cpu->oper1 = cpu->regs.wordregs[regsp];
-			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regax];
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			break;
-
-		case 0x95:	/* 95 XCHG eBP eAX */
-			cpu->oper1 = cpu->regs.wordregs[regbp];
-			cpu->regs.wordregs[regbp] = cpu->regs.wordregs[regax];
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			break;
-
-		case 0x96:	/* 96 XCHG eSI eAX */
-			cpu->oper1 = cpu->regs.wordregs[regsi];
-			cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regax];
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			break;
-
-		case 0x97:	/* 97 XCHG eDI eAX */
-			cpu->oper1 = cpu->regs.wordregs[regdi];
-			cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regax];
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			break;
-
-		case 0x98:	/* 98 CBW */
-			if ((cpu->regs.byteregs[regal] & 0x80) == 0x80) {
-				cpu->regs.byteregs[regah] = 0xFF;
-			}
-			else {
-				cpu->regs.byteregs[regah] = 0;
-			}
-			break;
-
-		case 0x99:	/* 99 CWD */
-			if ((cpu->regs.byteregs[regah] & 0x80) == 0x80) {
-				cpu->regs.wordregs[regdx] = 0xFFFF;
-			}
-			else {
-				cpu->regs.wordregs[regdx] = 0;
-			}
-			break;
-
-		case 0x9A:	/* 9A CALL Ap */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			push(cpu, cpu->segregs[regcs]);
-			push(cpu, cpu->ip);
-			cpu->ip = cpu->oper1;
-			cpu->segregs[regcs] = cpu->oper2;
-			if (cpu->protected_mode) {
-				load_descriptor(cpu, regcs, cpu->segregs[regcs]);
-			}
-			break;
-
-		case 0x9B:	/* 9B WAIT */
-			break;
-
-		case 0x9C:	/* 9C PUSHF */
-			if (cpu->protected_mode) {
-				push(cpu, makeflagsword(cpu));
-			}
-			else {
-				push(cpu, makeflagsword(cpu) & 0x0FFF);
-			}
-			break;
-
-		case 0x9D:    /* 9D POPF */
-		{
-			uint16_t new_flags = pop(cpu);
-			uint16_t old_flags = makeflagsword(cpu);
-			uint8_t cpl = cpu->cpl;
-			uint8_t iopl = (old_flags >> 12) & 3;
-
-			if (cpu->protected_mode) {
-				if (cpl > iopl) {
-					if (new_flags & 0x0200) {
-						old_flags |= 0x0200;
-					}
-					else {
-						old_flags &= ~0x0200;
-					}
-					new_flags = (new_flags & ~0x0200) | (old_flags & 0x0200);
-				}
-
-				if (cpl != 0) {
-					new_flags = (new_flags & ~0x3000) | (old_flags & 0x3000);
-				}
-
-				new_flags &= 0x72FF;
-				new_flags |= 0x0002;
-			}
-			else {
-				new_flags &= 0x72FF;
-				new_flags |= 0xF002;
-			}
-
-			decodeflagsword(cpu, new_flags);
-			break;
-		}
-		case 0x9E:	/* 9E SAHF */
-			decodeflagsword(cpu, (makeflagsword(cpu) & 0xFF00) | cpu->regs.byteregs[regah]);
-			break;
-
-		case 0x9F:	/* 9F LAHF */
-			cpu->regs.byteregs[regah] = makeflagsword(cpu) & 0xFF;
-			break;
-
-		case 0xA0:	/* A0 MOV cpu->regs.byteregs[regal] Ob */
-			cpu->regs.byteregs[regal] = getmem8(cpu, cpu->useseg, getmem16(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 2);
-			break;
-
-		case 0xA1:	/* A1 MOV eAX Ov */
-			cpu->oper1 = getmem16(cpu, cpu->useseg, getmem16(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 2);
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			break;
-
-		case 0xA2:	/* A2 MOV Ob cpu->regs.byteregs[regal] */
-			putmem8(cpu, cpu->useseg, getmem16(cpu, cpu->segregs[regcs], cpu->ip), cpu->regs.byteregs[regal]);
-			StepIP(cpu, 2);
-			break;
-
-		case 0xA3:	/* A3 MOV Ov eAX */
-			putmem16(cpu, cpu->useseg, getmem16(cpu, cpu->segregs[regcs], cpu->ip), cpu->regs.wordregs[regax]);
-			StepIP(cpu, 2);
-			break;
-
-		case 0xA4:	/* A4 MOVSB */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			putmem8(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi], getmem8(cpu, cpu->useseg, cpu->regs.wordregs[regsi]));
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 1;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 1;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xA5:	/* A5 MOVSW */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			putmem16(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi], getmem16(cpu, cpu->useseg, cpu->regs.wordregs[regsi]));
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 2;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 2;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xA6:	/* A6 CMPSB */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			cpu->oper1b = getmem8(cpu, cpu->useseg, cpu->regs.wordregs[regsi]);
-			cpu->oper2b = getmem8(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi]);
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 1;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 1;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
-			}
-
-			flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			if ((cpu->reptype == 1) && !cpu->zf) {
-				break;
-			}
-			else if ((cpu->reptype == 2) && (cpu->zf == 1)) {
-				break;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xA7:	/* A7 CMPSW */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			cpu->oper1 = getmem16(cpu, cpu->useseg, cpu->regs.wordregs[regsi]);
-			cpu->oper2 = getmem16(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi]);
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 2;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 2;
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
-			}
-
-			flag_sub16(cpu, cpu->oper1, cpu->oper2);
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			if ((cpu->reptype == 1) && !cpu->zf) {
-				break;
-			}
-
-			if ((cpu->reptype == 2) && (cpu->zf == 1)) {
-				break;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xA8:	/* A8 TEST cpu->regs.byteregs[regal] Ib */
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			flag_log8(cpu, cpu->oper1b & cpu->oper2b);
-			break;
-
-		case 0xA9:	/* A9 TEST eAX Iv */
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			flag_log16(cpu, cpu->oper1 & cpu->oper2);
-			break;
-
-		case 0xAA:	/* AA STOSB */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			putmem8(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi], cpu->regs.byteregs[regal]);
-			if (cpu->df) {
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
-			}
-			else {
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xAB:	/* AB STOSW */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			putmem16(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi], cpu->regs.wordregs[regax]);
-			if (cpu->df) {
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
-			}
-			else {
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xAC:	/* AC LODSB */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			cpu->regs.byteregs[regal] = getmem8(cpu, cpu->useseg, cpu->regs.wordregs[regsi]);
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 1;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 1;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xAD:	/* AD LODSW */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			cpu->oper1 = getmem16(cpu, cpu->useseg, cpu->regs.wordregs[regsi]);
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			if (cpu->df) {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 2;
-			}
-			else {
-				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 2;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xAE:	/* AE SCASB */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			cpu->oper1b = cpu->regs.byteregs[regal];
-			cpu->oper2b = getmem8(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi]);
-			flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
-			if (cpu->df) {
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
-			}
-			else {
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			if ((cpu->reptype == 1) && !cpu->zf) {
-				break;
-			}
-			else if ((cpu->reptype == 2) && (cpu->zf == 1)) {
-				break;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xAF:	/* AF SCASW */
-			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
-				break;
-			}
-
-			cpu->oper1 = cpu->regs.wordregs[regax];
-			cpu->oper2 = getmem16(cpu, cpu->segregs[reges], cpu->regs.wordregs[regdi]);
-			flag_sub16(cpu, cpu->oper1, cpu->oper2);
-			if (cpu->df) {
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
-			}
-			else {
-				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
-			}
-
-			if (cpu->reptype) {
-				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			}
-
-			if ((cpu->reptype == 1) && !cpu->zf) {
-				break;
-			}
-			else if ((cpu->reptype == 2) && (cpu->zf == 1)) { //did i fix a typo bug? this used to be & instead of &&
-				break;
-			}
-
-			loopcount++;
-			if (!cpu->reptype) {
-				break;
-			}
-
-			cpu->ip = firstip;
-			break;
-
-		case 0xB0:	/* B0 MOV cpu->regs.byteregs[regal] Ib */
-			cpu->regs.byteregs[regal] = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			break;
+	i = 0;
+	step = (cpu->df) ? -(int32_t)size : (int32_t)size;
+	if (!cpu->df) {
+		i = port_writeBlock(cpu, cpu->regs.wordregs[regdx], src, n, size);
+		src += i * size;
+	}
+	for (; i < n; i++, src += step) {
+		if (size == 1) {
+			port_write(cpu, cpu->regs.wordregs[regdx], *src);
+		}
+		else {
+			port_writew(cpu, cpu->regs.wordregs[regdx], (uint16_t)src[0] | ((uint16_t)src[1] << 8));
+		}
+	}
 
-		case 0xB1:	/* B1 MOV cpu->regs.byteregs[regcl] Ib */
-			cpu->regs.byteregs[regcl] = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			break;
+	cpu_repAdvance(cpu, regsi, n, size);
+	cpu->regs.wordregs[regcx] -= (uint16_t)n;
+	return n;
+}
 
-		case 0xB2:	/* B2 MOV cpu->regs.byteregs[regdl] Ib */
-			cpu->regs.byteregs[regdl] = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			break;
+//run a REP string op in bulk when possible, accounting two loop iterations per element like the stepped path does
+#define REP_BLOCK(func, size) \
+	if (cpu->reptype && !cpu->tf && ((cpu->temp32 = func(cpu, size, (execloops - loopcount + 1) >> 1)) > 0)) { \
+		loopcount += (cpu->temp32 << 1) - 1; \
+		if (cpu->regs.wordregs[regcx]) { \
+			cpu->ip = firstip; \
+		} \
+		break; \
+	}
 
-		case 0xB3:	/* B3 MOV cpu->regs.byteregs[regbl] Ib */
-			cpu->regs.byteregs[regbl] = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			break;
+static uint32_t read_24bit_base(CPU_t* cpu, uint32_t addr) {
+	return cpu_read(cpu, addr) | (cpu_read(cpu, addr + 1) << 8) | (cpu_read(cpu, addr + 2) << 16);
+}
 
-		case 0xB4:	/* B4 MOV cpu->regs.byteregs[regah] Ib */
-			cpu->regs.byteregs[regah] = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			break;
+/*
+	Decode cache hooks for the cached and block cores. cpu_decodeStart either
+	replays a cached prefix/opcode decode for the instruction at CS:IP, or arms
+	recording so that the prefix loop and modregrm fill in the entry as they go.
+*/
+static uint8_t cpu_decodeStart(CPU_t* cpu, DECODE_ENTRY_t* entry, uint32_t linear) {
+	if (entry == NULL) {
+		return 0;
+	}
 
-		case 0xB5:	/* B5 MOV cpu->regs.byteregs[regch] Ib */
-			cpu->regs.byteregs[regch] = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			break;
+	if (entry->len == 0) {
+		cpu->decode_rec = entry;
+		cpu->decode_room = MEMORY_PAGE_SIZE - (linear & MEMORY_PAGE_MASK);
+		return 0;
+	}
+	if (((uint32_t)cpu->ip + entry->len) > 0x10000) {
+		return 0; //recorded through another CS:IP, here the instruction wraps around IP
+	}
 
-		case 0xB6:	/* B6 MOV cpu->regs.byteregs[regdh] Ib */
-			cpu->regs.byteregs[regdh] = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			break;
+	cpu->segoverride = entry->segoverride;
+	cpu->usesegreg = entry->usesegreg;
+	cpu->useseg = cpu->segregs[entry->usesegreg];
+	cpu->reptype = entry->reptype;
+	cpu->savecs = cpu->segregs[regcs];
+	cpu->saveip = cpu->ip + entry->prefixlen;
+	cpu->opcode = entry->opcode;
+	cpu->ip = cpu->saveip + 1;
+	cpu->decode_ip = cpu->ip;
+	if (entry->hasmodrm) {
+		cpu->decode_pre = entry;
+	}
+	return 1;
+}
 
-		case 0xB7:	/* B7 MOV cpu->regs.byteregs[regbh] Ib */
-			cpu->regs.byteregs[regbh] = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			break;
+static void cpu_decodeRecord(CPU_t* cpu, uint16_t firstip) {
+	DECODE_ENTRY_t* entry = cpu->decode_rec;
+	uint16_t prefixlen = cpu->saveip - firstip;
 
-		case 0xB8:	/* B8 MOV eAX Iv */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			cpu->regs.wordregs[regax] = cpu->oper1;
-			break;
+	//don't cache anything that wraps around IP or runs off the end of the page
+	if ((cpu->saveip < firstip) || (cpu->ip <= cpu->saveip) ||
+		((prefixlen + 1) > DECODE_MAXLEN) || ((prefixlen + 1) > cpu->decode_room)) {
+		cpu->decode_rec = NULL;
+		return;
+	}
 
-		case 0xB9:	/* B9 MOV eCX Iv */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			cpu->regs.wordregs[regcx] = cpu->oper1;
-			break;
+	entry->prefixlen = (uint8_t)prefixlen;
+	entry->opcode = cpu->opcode;
+	entry->segoverride = cpu->segoverride;
+	entry->usesegreg = cpu->usesegreg;
+	entry->reptype = cpu->reptype;
+	entry->hasmodrm = 0;
+	entry->len = (uint8_t)prefixlen + 1;
+	cpu->decode_ip = cpu->ip;
+}
 
-		case 0xBA:	/* BA MOV eDX Iv */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			cpu->regs.wordregs[regdx] = cpu->oper1;
-			break;
+FUNC_INLINE void cpu_decodeRecordModrm(CPU_t* cpu, uint16_t modstart) {
+	DECODE_ENTRY_t* entry = cpu->decode_rec;
+	uint16_t len;
 
-		case 0xBB:	/* BB MOV eBX Iv */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			cpu->regs.wordregs[regbx] = cpu->oper1;
-			break;
+	cpu->decode_rec = NULL;
+	if ((modstart != cpu->decode_ip) || (entry->len == 0)) {
+		return; //not the ModRM byte straight after the opcode, or invalidated meanwhile
+	}
 
-		case 0xBC:	/* BC MOV eSP Iv */
-			cpu->regs.wordregs[regsp] = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			break;
+	len = entry->len + (uint16_t)(cpu->ip - modstart);
+	if ((cpu->ip <= modstart) || (len > DECODE_MAXLEN) || (len > cpu->decode_room)) {
+		entry->len = 0;
+		return;
+	}
 
-		case 0xBD:	/* BD MOV eBP Iv */
-			cpu->regs.wordregs[regbp] = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			break;
+	entry->hasmodrm = 1;
+	entry->addrbyte = cpu->addrbyte;
+	entry->disp16 = cpu->disp16;
+	entry->modrmlen = (uint8_t)(cpu->ip - modstart);
+	entry->len = (uint8_t)len;
+}
 
-		case 0xBE:	/* BE MOV eSI Iv */
-			cpu->regs.wordregs[regsi] = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			break;
+FUNC_INLINE void cpu_decodeReplayModrm(CPU_t* cpu) {
+	DECODE_ENTRY_t* entry = cpu->decode_pre;
 
-		case 0xBF:	/* BF MOV eDI Iv */
-			cpu->regs.wordregs[regdi] = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			break;
+	cpu->decode_pre = NULL;
+	cpu->addrbyte = entry->addrbyte;
+	cpu->disp16 = entry->disp16;
+	cpu->ip += entry->modrmlen;
+	cpu->mode = cpu->addrbyte >> 6;
+	cpu->reg = (cpu->addrbyte >> 3) & 7;
+	cpu->rm = cpu->addrbyte & 7;
+	switch (cpu->mode) {
+	case 0:
+		if (((cpu->rm == 2) || (cpu->rm == 3)) && !cpu->segoverride) {
+			cpu->useseg = cpu->segregs[regss];
+			cpu->usesegreg = regss;
+		}
+		break;
+	case 1:
+	case 2:
+		if (((cpu->rm == 2) || (cpu->rm == 3) || (cpu->rm == 6)) && !cpu->segoverride) {
+			cpu->useseg = cpu->segregs[regss];
+			cpu->usesegreg = regss;
+		}
+		break;
+	default:
+		cpu->disp8 = 0;
+		cpu->disp16 = 0;
+	}
+}
 
-		case 0xC0:	/* C0 GRP2 byte imm8 */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			writerm8(cpu, cpu->rm, op_grp2_8(cpu, cpu->oper2b));
-			break;
+/*
+	Executor for the block core's translated blocks (see block.c). Every op
+	does exactly what the interpreter's handler for that opcode does, using
+	the same helpers, so the two cores can't drift apart. Blocks chain into
+	each other without going back through cpu_exec, for as long as the
+	instruction budget lasts and nothing writes over translated code.
+*/
+FUNC_INLINE void cpu_blockAlu8(CPU_t* cpu, uint8_t alu) {
+	switch (alu) {
+	case 0: op_add8(cpu); break;
+	case 1: op_or8(cpu); break;
+	case 2: op_adc8(cpu); break;
+	case 3: op_sbb8(cpu); break;
+	case 4: op_and8(cpu); break;
+	case 5: op_sub8(cpu); break;
+	case 6: op_xor8(cpu); break;
+	default: op_cmp8(cpu); break;
+	}
+}
 
-		case 0xC1:	/* C1 GRP2 word imm8 */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			cpu->oper2 = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			writerm16(cpu, cpu->rm, op_grp2_16(cpu, (uint8_t)cpu->oper2));
-			break;
+FUNC_INLINE void cpu_blockAlu16(CPU_t* cpu, uint8_t alu) {
+	switch (alu) {
+	case 0: op_add16(cpu); break;
+	case 1: op_or16(cpu); break;
+	case 2: op_adc16(cpu); break;
+	case 3: op_sbb16(cpu); break;
+	case 4: op_and16(cpu); break;
+	case 5: op_sub16(cpu); break;
+	case 6: op_xor16(cpu); break;
+	default: op_cmp16(cpu); break;
+	}
+}
 
-		case 0xC2:	/* C2 RET Iw */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			cpu->ip = pop(cpu);
-			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regsp] + cpu->oper1;
-			break;
+//Condition of Jcc opcode 70+cc, in the same terms as the interpreter's cases
+FUNC_INLINE uint8_t cpu_blockCond(CPU_t* cpu, uint8_t cc) {
+	switch (cc) {
+	case 0x0: return flag_lazyOF(cpu);
+	case 0x1: return !flag_lazyOF(cpu);
+	case 0x2: return flag_lazyCF(cpu);
+	case 0x3: return !flag_lazyCF(cpu);
+	case 0x4: return flag_lazyZF(cpu);
+	case 0x5: return !flag_lazyZF(cpu);
+	case 0x6: return flag_lazyCF(cpu) || flag_lazyZF(cpu);
+	case 0x7: return !flag_lazyCF(cpu) && !flag_lazyZF(cpu);
+	case 0x8: return flag_lazySF(cpu);
+	case 0x9: return !flag_lazySF(cpu);
+	case 0xA: return flag_lazyPF(cpu);
+	case 0xB: return !flag_lazyPF(cpu);
+	case 0xC: return flag_lazySF(cpu) != flag_lazyOF(cpu);
+	case 0xD: return flag_lazySF(cpu) == flag_lazyOF(cpu);
+	case 0xE: return (flag_lazySF(cpu) != flag_lazyOF(cpu)) || flag_lazyZF(cpu);
+	default: return !flag_lazyZF(cpu) && (flag_lazySF(cpu) == flag_lazyOF(cpu));
+	}
+}
 
-		case 0xC3:	/* C3 RET */
-			cpu->ip = pop(cpu);
-			break;
+//What modregrm would have left behind for the op's operand
+FUNC_INLINE void cpu_blockModrm(CPU_t* cpu, BLOCK_OP_t* op) {
+	cpu->mode = op->mode;
+	cpu->reg = op->reg;
+	cpu->rm = op->rm;
+	cpu->disp16 = op->disp16;
+	cpu->segoverride = op->segoverride;
+	cpu->usesegreg = op->seg;
+	cpu->useseg = cpu->segregs[op->seg];
+}
 
-		case 0xC4:	/* C4 LES Gv Mp */
-			modregrm(cpu);
-			if (cpu->mode == 3) {
-				cpu_intcall(cpu, 6);
+//Runs translated code from CS:IP, returns the number of instructions executed, at most budget
+static uint32_t cpu_blockRun(CPU_t* cpu, BLOCK_t* block, uint32_t budget) {
+	BLOCK_OP_t* op;
+	DECODE_ENTRY_t* entry;
+	uint32_t done, count, i, gen, mapgen, linear;
+	uint16_t startip;
+
+	done = 0;
+	gen = block_generation;
+	mapgen = memory_mapGeneration;
+	cpu->savecs = cpu->segregs[regcs];
+	cpu->reptype = 0;
+
+	while (1) {
+		startip = cpu->ip;
+		if (((uint32_t)startip + block->len) > 0x10000) {
+			break; //reached through a CS:IP whose IP would wrap partway
+		}
+		count = block->count;
+		if (count > (budget - done)) {
+			count = budget - done;
+		}
+
+		for (i = 0; i < count; ) {
+			op = &block->op[i++];
+			cpu->ip = startip + op->next;
+			if ((op->flags & BLOCK_FLAG_SYNC) && (cpu->lazy_op != CPU_LAZY_NONE)) {
+				cpu_flagsSync(cpu);
+			}
+			profile_countOp(op->opcode);
+			sampler_tick(cpu->savecs, startip + op->at, 0);
+			trace_tick(cpu, startip + op->at, op->next - op->at);
+
+			switch (op->kind) {
+			case BLOCK_OP_ALU8_EG:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1b = readrm8(cpu, op->rm);
+				cpu->oper2b = getreg8(cpu, op->reg);
+				cpu_blockAlu8(cpu, op->alu);
+				if (op->alu != 7) writerm8(cpu, op->rm, cpu->res8);
+				break;
+			case BLOCK_OP_ALU16_EG:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1 = readrm16(cpu, op->rm);
+				cpu->oper2 = getreg16(cpu, op->reg);
+				cpu_blockAlu16(cpu, op->alu);
+				if (op->alu != 7) writerm16(cpu, op->rm, cpu->res16);
+				break;
+			case BLOCK_OP_ALU8_GE:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1b = getreg8(cpu, op->reg);
+				cpu->oper2b = readrm8(cpu, op->rm);
+				cpu_blockAlu8(cpu, op->alu);
+				if (op->alu != 7) putreg8(cpu, op->reg, cpu->res8);
+				break;
+			case BLOCK_OP_ALU16_GE:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1 = getreg16(cpu, op->reg);
+				cpu->oper2 = readrm16(cpu, op->rm);
+				cpu_blockAlu16(cpu, op->alu);
+				if (op->alu != 7) putreg16(cpu, op->reg, cpu->res16);
+				break;
+			case BLOCK_OP_ALU8_AI:
+				cpu->oper1b = cpu->regs.byteregs[regal];
+				cpu->oper2b = (uint8_t)op->imm;
+				cpu_blockAlu8(cpu, op->alu);
+				if (op->alu != 7) cpu->regs.byteregs[regal] = cpu->res8;
+				break;
+			case BLOCK_OP_ALU16_AI:
+				cpu->oper1 = cpu->regs.wordregs[regax];
+				cpu->oper2 = op->imm;
+				cpu_blockAlu16(cpu, op->alu);
+				if (op->alu != 7) cpu->regs.wordregs[regax] = cpu->res16;
+				break;
+			case BLOCK_OP_GRP1_8:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1b = readrm8(cpu, op->rm);
+				cpu->oper2b = (uint8_t)op->imm;
+				cpu_blockAlu8(cpu, op->alu);
+				if (op->alu != 7) writerm8(cpu, op->rm, cpu->res8);
+				break;
+			case BLOCK_OP_GRP1_16:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1 = readrm16(cpu, op->rm);
+				cpu->oper2 = op->imm;
+				cpu_blockAlu16(cpu, op->alu);
+				if (op->alu != 7) writerm16(cpu, op->rm, cpu->res16);
+				break;
+			case BLOCK_OP_TEST8_EG:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1b = getreg8(cpu, op->reg);
+				cpu->oper2b = readrm8(cpu, op->rm);
+				op_test8(cpu);
+				break;
+			case BLOCK_OP_TEST16_EG:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1 = getreg16(cpu, op->reg);
+				cpu->oper2 = readrm16(cpu, op->rm);
+				op_test16(cpu);
+				break;
+			case BLOCK_OP_TEST8_AI:
+				cpu->oper1b = cpu->regs.byteregs[regal];
+				cpu->oper2b = (uint8_t)op->imm;
+				op_test8(cpu);
+				break;
+			case BLOCK_OP_TEST16_AI:
+				cpu->oper1 = cpu->regs.wordregs[regax];
+				cpu->oper2 = op->imm;
+				op_test16(cpu);
+				break;
+			case BLOCK_OP_XCHG8:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1b = getreg8(cpu, op->reg);
+				putreg8(cpu, op->reg, readrm8(cpu, op->rm));
+				writerm8(cpu, op->rm, cpu->oper1b);
+				break;
+			case BLOCK_OP_XCHG16:
+				cpu_blockModrm(cpu, op);
+				cpu->oper1 = getreg16(cpu, op->reg);
+				putreg16(cpu, op->reg, readrm16(cpu, op->rm));
+				writerm16(cpu, op->rm, cpu->oper1);
+				break;
+			case BLOCK_OP_MOV8_EG:
+				cpu_blockModrm(cpu, op);
+				writerm8(cpu, op->rm, getreg8(cpu, op->reg));
+				break;
+			case BLOCK_OP_MOV16_EG:
+				cpu_blockModrm(cpu, op);
+				writerm16(cpu, op->rm, getreg16(cpu, op->reg));
+				break;
+			case BLOCK_OP_MOV8_GE:
+				cpu_blockModrm(cpu, op);
+				putreg8(cpu, op->reg, readrm8(cpu, op->rm));
+				break;
+			case BLOCK_OP_MOV16_GE:
+				cpu_blockModrm(cpu, op);
+				putreg16(cpu, op->reg, readrm16(cpu, op->rm));
+				break;
+			case BLOCK_OP_LEA:
+				cpu_blockModrm(cpu, op);
+				getea(cpu, op->rm);
+				putreg16(cpu, op->reg, (uint16_t)(cpu->ea - get_seg_address(cpu, cpu->usesegreg, 0)));
+				break;
+			case BLOCK_OP_MOV8_AM:
+				cpu->regs.byteregs[regal] = getmem8(cpu, op->seg, op->imm);
+				break;
+			case BLOCK_OP_MOV16_AM:
+				cpu->regs.wordregs[regax] = getmem16(cpu, op->seg, op->imm);
+				break;
+			case BLOCK_OP_MOV8_MA:
+				putmem8(cpu, op->seg, op->imm, cpu->regs.byteregs[regal]);
+				break;
+			case BLOCK_OP_MOV16_MA:
+				putmem16(cpu, op->seg, op->imm, cpu->regs.wordregs[regax]);
+				break;
+			case BLOCK_OP_MOV8_RI:
+				putreg8(cpu, op->reg, (uint8_t)op->imm);
+				break;
+			case BLOCK_OP_MOV16_RI:
+				putreg16(cpu, op->reg, op->imm);
+				break;
+			case BLOCK_OP_MOV8_EI:
+				cpu_blockModrm(cpu, op);
+				writerm8(cpu, op->rm, (uint8_t)op->imm);
+				break;
+			case BLOCK_OP_MOV16_EI:
+				cpu_blockModrm(cpu, op);
+				writerm16(cpu, op->rm, op->imm);
+				break;
+			case BLOCK_OP_INC16:
+				cpu->oper1 = cpu->regs.wordregs[op->reg];
+				op_inc16(cpu);
+				cpu->regs.wordregs[op->reg] = cpu->res16;
+				break;
+			case BLOCK_OP_DEC16:
+				cpu->oper1 = cpu->regs.wordregs[op->reg];
+				op_dec16(cpu);
+				cpu->regs.wordregs[op->reg] = cpu->res16;
+				break;
+			case BLOCK_OP_PUSH16:
+				push(cpu, cpu->regs.wordregs[op->reg]);
+				break;
+			case BLOCK_OP_POP16:
+				cpu->regs.wordregs[op->reg] = pop(cpu);
 				break;
-			}
-			if ((cpu->disp16 & 0xFFFF) >= 0xFFFD) {
-				cpu_intcall(cpu, 13);
+			case BLOCK_OP_XCHGAX:
+				cpu->oper1 = cpu->regs.wordregs[op->reg];
+				cpu->regs.wordregs[op->reg] = cpu->regs.wordregs[regax];
+				cpu->regs.wordregs[regax] = cpu->oper1;
 				break;
-			}
-			getea(cpu, cpu->rm);
-			putreg16(cpu, cpu->reg, cpu_readw(cpu, cpu->ea));
-			cpu->segregs[reges] = cpu_readw(cpu, cpu->ea + 2);
-			if (cpu->protected_mode) 
-				load_descriptor(cpu, reges, cpu->segregs[reges]);
-			break;
-
-		case 0xC5:	/* C5 LDS Gv Mp */
-			modregrm(cpu);
-			if (cpu->mode == 3) {
-				cpu_intcall(cpu, 6);
+			case BLOCK_OP_NOP:
 				break;
-			}
-			if ((cpu->disp16 & 0xFFFF) >= 0xFFFD) {
-				cpu_intcall(cpu, 13);
+			case BLOCK_OP_CBW:
+				cpu->regs.byteregs[regah] = (cpu->regs.byteregs[regal] & 0x80) ? 0xFF : 0;
 				break;
-			}
-			getea(cpu, cpu->rm);
-			putreg16(cpu, cpu->reg, cpu_readw(cpu, cpu->ea));
-			cpu->segregs[regds] = cpu_readw(cpu, cpu->ea + 2);
-			if (cpu->protected_mode) 
-				load_descriptor(cpu, regds, cpu->segregs[regds]);
-			break;
-
-		case 0xC6:	/* C6 MOV Eb Ib */
-			modregrm(cpu);
-			writerm8(cpu, cpu->rm, getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			break;
-
-		case 0xC7:	/* C7 MOV Ev Iv */
-			modregrm(cpu);
-			writerm16(cpu, cpu->rm, getmem16(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 2);
-			break;
-
-		case 0xC8:	/* C8 ENTER */
-			cpu->stacksize = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			cpu->nestlev = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			push(cpu, cpu->regs.wordregs[regbp]);
-			cpu->frametemp = cpu->regs.wordregs[regsp];
-			if (cpu->nestlev) {
-				for (cpu->temp16 = 1; cpu->temp16 < cpu->nestlev; ++cpu->temp16) {
-					cpu->regs.wordregs[regbp] = cpu->regs.wordregs[regbp] - 2;
-					push(cpu, cpu->regs.wordregs[regbp]);
+			case BLOCK_OP_CWD:
+				cpu->regs.wordregs[regdx] = (cpu->regs.byteregs[regah] & 0x80) ? 0xFFFF : 0;
+				break;
+			case BLOCK_OP_CLC:
+				cpu->cf = 0;
+				break;
+			case BLOCK_OP_STC:
+				cpu->cf = 1;
+				break;
+			case BLOCK_OP_CMC:
+				cpu->cf = cpu->cf ? 0 : 1;
+				break;
+			case BLOCK_OP_CLD:
+				cpu->df = 0;
+				break;
+			case BLOCK_OP_STD:
+				cpu->df = 1;
+				break;
+			case BLOCK_OP_CLI:
+				cpu->ifl = 0;
+				break;
+			case BLOCK_OP_STI:
+				cpu->ifl = 1;
+				break;
+			case BLOCK_OP_JCC:
+				if (cpu_blockCond(cpu, op->opcode & 0x0F)) {
+					cpu->ip = cpu->ip + op->imm;
 				}
-
-				push(cpu, cpu->frametemp); //cpu->regs.wordregs[regsp]);
-			}
-
-			cpu->regs.wordregs[regbp] = cpu->frametemp;
-			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regbp] - cpu->stacksize;
-
-			break;
-
-		case 0xC9:	/* C9 LEAVE */
-			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regbp];
-			cpu->regs.wordregs[regbp] = pop(cpu);
-			break;
-
-		case 0xCA:	/* CA RETF Iw */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			cpu->ip = pop(cpu);
-			cpu->segregs[regcs] = pop(cpu);
-			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regsp] + cpu->oper1;
-			break;
-
-		case 0xCB:	/* CB RETF */
-			cpu->ip = pop(cpu);
-			cpu->segregs[regcs] = pop(cpu);
-			break;
-
-		case 0xCC:	/* CC INT 3 */
-			cpu_intcall(cpu, 3);
-			break;
-
-		case 0xCD:	/* CD INT Ib */
-			cpu->oper1b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			cpu_intcall(cpu, cpu->oper1b);
-			break;
-
-		case 0xCE:	/* CE INTO */
-			if (cpu->of) {
-				cpu_intcall(cpu, 4);
-			}
-			break;
-
-		case 0xCF:	/* CF IRET */
-		{
-			if (cpu->protected_mode) {
-				if (makeflagsword(cpu) & 0x4000) {
-					cpu_task_switch(cpu, cpu_readw(cpu, cpu->tr_cache.base), 1);
-					break;
+				break;
+			case BLOCK_OP_JMP:
+				cpu->ip = cpu->ip + op->imm;
+				break;
+			case BLOCK_OP_LOOP:
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+				if (cpu->regs.wordregs[regcx]) {
+					cpu->ip = cpu->ip + op->imm;
 				}
-				uint16_t t_ip = pop(cpu), t_cs = pop(cpu), t_fl = pop(cpu);
-				if ((t_cs & 3) > (cpu->segregs[regcs] & 3)) {
-					uint16_t t_sp = pop(cpu), t_ss = pop(cpu);
-					load_descriptor(cpu, regss, t_ss);
-					cpu->regs.wordregs[regsp] = t_sp;
+				break;
+			case BLOCK_OP_LOOPZ:
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+				if (cpu->regs.wordregs[regcx] && (cpu->zf == 1)) {
+					cpu->ip = cpu->ip + op->imm;
+				}
+				break;
+			case BLOCK_OP_LOOPNZ:
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+				if (cpu->regs.wordregs[regcx] && !cpu->zf) {
+					cpu->ip = cpu->ip + op->imm;
+				}
+				break;
+			case BLOCK_OP_JCXZ:
+				if (!cpu->regs.wordregs[regcx]) {
+					cpu->ip = cpu->ip + op->imm;
 				}
-				load_descriptor(cpu, regcs, t_cs);
-				cpu->ip = t_ip;
-				decodeflagsword(cpu, t_fl);
-			}
-			else {
-				cpu->ip = pop(cpu);
-				cpu->segregs[regcs] = pop(cpu);
-				decodeflagsword(cpu, pop(cpu));
-			}
-			break;
-		}
-
-		case 0xD0:	/* D0 GRP2 Eb 1 */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			writerm8(cpu, cpu->rm, op_grp2_8(cpu, 1));
-			break;
-
-		case 0xD1:	/* D1 GRP2 Ev 1 */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			writerm16(cpu, cpu->rm, op_grp2_16(cpu, 1));
-			break;
-
-		case 0xD2:	/* D2 GRP2 Eb cpu->regs.byteregs[regcl] */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			writerm8(cpu, cpu->rm, op_grp2_8(cpu, cpu->regs.byteregs[regcl]));
-			break;
-
-		case 0xD3:	/* D3 GRP2 Ev cpu->regs.byteregs[regcl] */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			writerm16(cpu, cpu->rm, op_grp2_16(cpu, cpu->regs.byteregs[regcl]));
-			break;
-
-		case 0xD4:	/* D4 AAM I0 */
-			cpu->oper1 = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			if (!cpu->oper1) {
-				cpu_intcall(cpu, 0);
 				break;
-			}	/* division by zero */
-
-			cpu->regs.byteregs[regah] = (cpu->regs.byteregs[regal] / cpu->oper1) & 255;
-			cpu->regs.byteregs[regal] = (cpu->regs.byteregs[regal] % cpu->oper1) & 255;
-			flag_szp16(cpu, cpu->regs.wordregs[regax]);
-			break;
-
-		case 0xD5:	/* D5 AAD I0 */
-			cpu->oper1 = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			cpu->regs.byteregs[regal] = (cpu->regs.byteregs[regah] * cpu->oper1 + cpu->regs.byteregs[regal]) & 255;
-			cpu->regs.byteregs[regah] = 0;
-			flag_szp16(cpu, cpu->regs.byteregs[regah] * cpu->oper1 + cpu->regs.byteregs[regal]);
-			cpu->sf = 0;
-			break;
-
-		case 0xD6:	/* D6 SALC */
-			cpu->regs.byteregs[regal] = cpu->cf ? 0xFF : 0x00;
-			break;
-
-		case 0xD7:	/* D7 XLAT */
-			cpu->regs.byteregs[regal] = cpu_read(cpu, cpu->useseg * 16 + (cpu->regs.wordregs[regbx]) + cpu->regs.byteregs[regal]);
-			break;
-
-		case 0xD8:
-		case 0xD9:
-		case 0xDA:
-		case 0xDB:
-		case 0xDC:
-		case 0xDE:
-		case 0xDD:
-		case 0xDF:	/* escape to x87 FPU (unsupported) */
-			modregrm(cpu);
-			break;
-
-		case 0xE0:	/* E0 LOOPNZ Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			if ((cpu->regs.wordregs[regcx]) && !cpu->zf) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0xE1:	/* E1 LOOPZ Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			if (cpu->regs.wordregs[regcx] && (cpu->zf == 1)) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0xE2:	/* E2 LOOP Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
-			if (cpu->regs.wordregs[regcx]) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0xE3:	/* E3 JCXZ Jb */
-			cpu->temp16 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			if (!cpu->regs.wordregs[regcx]) {
-				cpu->ip = cpu->ip + cpu->temp16;
-			}
-			break;
-
-		case 0xE4:	/* E4 IN cpu->regs.byteregs[regal] Ib */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			cpu->oper1b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			cpu->regs.byteregs[regal] = (uint8_t)port_read(cpu, cpu->oper1b);
-			break;
-
-		case 0xE5:	/* E5 IN eAX Ib */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			cpu->oper1b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			cpu->regs.wordregs[regax] = port_readw(cpu, cpu->oper1b);
-			break;
-
-		case 0xE6:	/* E6 OUT Ib cpu->regs.byteregs[regal] */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			cpu->oper1b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			port_write(cpu, cpu->oper1b, cpu->regs.byteregs[regal]);
-			break;
-
-		case 0xE7:	/* E7 OUT Ib eAX */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			cpu->oper1b = getmem8(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 1);
-			port_writew(cpu, cpu->oper1b, cpu->regs.wordregs[regax]);
-			break;
-
-		case 0xE8:	/* E8 CALL Jv */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			push(cpu, cpu->ip);
-			cpu->ip = cpu->ip + cpu->oper1;
-			break;
-
-		case 0xE9:	/* E9 JMP Jv */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			cpu->ip = cpu->ip + cpu->oper1;
-			break;
-
-		case 0xEA:	/* EA JMP Ap */
-			cpu->oper1 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			StepIP(cpu, 2);
-			cpu->oper2 = getmem16(cpu, cpu->segregs[regcs], cpu->ip);
-			cpu->ip = cpu->oper1;
-			cpu->segregs[regcs] = cpu->oper2;
-			if (cpu->protected_mode) {
-				load_descriptor(cpu, regcs, cpu->segregs[regcs]);
-			}
-			break;
-
-		case 0xEB:	/* EB JMP Jb */
-			cpu->oper1 = signext(getmem8(cpu, cpu->segregs[regcs], cpu->ip));
-			StepIP(cpu, 1);
-			cpu->ip = cpu->ip + cpu->oper1;
-			break;
-
-		case 0xEC:	/* EC IN cpu->regs.byteregs[regal] regdx */
-			cpu->oper1 = cpu->regs.wordregs[regdx];
-			cpu->regs.byteregs[regal] = (uint8_t)port_read(cpu, cpu->oper1);
-			break;
-
-		case 0xED:	/* ED IN eAX regdx */
-			cpu->oper1 = cpu->regs.wordregs[regdx];
-			cpu->regs.wordregs[regax] = port_readw(cpu, cpu->oper1);
-			break;
-
-		case 0xEE:	/* EE OUT regdx cpu->regs.byteregs[regal] */
-			cpu->oper1 = cpu->regs.wordregs[regdx];
-			port_write(cpu, cpu->oper1, cpu->regs.byteregs[regal]);
-			break;
-
-		case 0xEF:	/* EF OUT regdx eAX */
-			cpu->oper1 = cpu->regs.wordregs[regdx];
-			port_writew(cpu, cpu->oper1, cpu->regs.wordregs[regax]);
-			break;
-
-		case 0xF4:	/* F4 HLT */
-			if (cpu->protected_mode && cpu->cpl != 0) {
-				cpu_intcall(cpu, 13); break;
-			}
-			cpu->hltstate = 1;
-			break;
-
-		case 0xF5:	/* F5 CMC */
-			if (!cpu->cf) {
-				cpu->cf = 1;
-			}
-			else {
-				cpu->cf = 0;
-			}
-			break;
-
-		case 0xF6:	/* F6 GRP3a Eb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			op_grp3_8(cpu);
-			if ((cpu->reg > 1) && (cpu->reg < 4)) {
-				writerm8(cpu, cpu->rm, cpu->res8);
 			}
-			break;
 
-		case 0xF7:	/* F7 GRP3b Ev */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			op_grp3_16(cpu);
-			if ((cpu->reg > 1) && (cpu->reg < 4)) {
-				writerm16(cpu, cpu->rm, cpu->res16);
+			if ((op->flags & BLOCK_FLAG_WRITE) && ((block_generation != gen) || (memory_mapGeneration != mapgen))) {
+				break; //the rest of the block may have just been written over
 			}
-			break;
-
-		case 0xF8:	/* F8 CLC */
-			cpu->cf = 0;
-			break;
-
-		case 0xF9:	/* F9 STC */
-			cpu->cf = 1;
-			break;
+		}
 
-		case 0xFA:	/* FA CLI */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			cpu->ifl = 0;
+		done += i;
+		cpu->totalexec += i;
+		if (i > 0) {
+			cpu->saveip = startip + block->op[i - 1].at;
+			cpu->opcode = block->op[i - 1].opcode;
+		}
+		if ((i < block->count) || (done >= budget) || (block_generation != gen) || (memory_mapGeneration != mapgen)) {
 			break;
+		}
+		if (cpu->idledetect && (cpu->ip <= cpu->saveip) && ((cpu->saveip - cpu->ip) <= CPU_IDLE_SPAN)) {
+			cpu_idleBranch(cpu);
+			if (cpu->idle) break;
+		}
 
-		case 0xFB:	/* FB STI */
-			if (cpu->protected_mode && cpu->cpl > cpu->iopl) {
-				cpu_intcall(cpu, 13); break;
-			}
-			cpu->ifl = 1;
+		linear = get_seg_address(cpu, regcs, cpu->ip) & MEMORY_MASK;
+		entry = decode_lookup(linear);
+		if (entry == NULL) {
 			break;
-
-		case 0xFC:	/* FC CLD */
-			cpu->df = 0;
+		}
+		block = block_find(entry, linear);
+		if (block == NULL) {
 			break;
+		}
+	}
 
-		case 0xFD:	/* FD STD */
-			cpu->df = 1;
-			break;
+	return done;
+}
 
-		case 0xFE:	/* FE GRP4 Eb */
-			modregrm(cpu);
-			cpu->oper1b = readrm8(cpu, cpu->rm);
-			cpu->oper2b = 1;
-			if (!cpu->reg) {
-				cpu->tempcf = cpu->cf;
-				cpu->res8 = cpu->oper1b + cpu->oper2b;
-				flag_add8(cpu, cpu->oper1b, cpu->oper2b);
-				cpu->cf = cpu->tempcf;
-				writerm8(cpu, cpu->rm, cpu->res8);
-			}
-			else {
-				cpu->tempcf = cpu->cf;
-				cpu->res8 = cpu->oper1b - cpu->oper2b;
-				flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
-				cpu->cf = cpu->tempcf;
-				writerm8(cpu, cpu->rm, cpu->res8);
-			}
-			break;
+#define CPU_PM(cpu) 0
+#define CPU_FN(name) name##_real
+#define CPU_EXEC_LOOP
+#include "cpuexec.h"
 
-		case 0xFF:	/* FF GRP5 Ev */
-			modregrm(cpu);
-			cpu->oper1 = readrm16(cpu, cpu->rm);
-			op_grp5(cpu);
-			break;
+#define CPU_PM(cpu) 1
+#define CPU_FN(name) name##_prot
+#define CPU_EXEC_LOOP
+#include "cpuexec.h"
 
-#if 1
-		default:
-			debug_log(DEBUG_ERROR, "\n--- INVALID OPCODE EXCEPTION ---\n");
-			debug_log(DEBUG_ERROR, "Location: %04X:%04X\n", cpu->savecs, firstip);
-			debug_log(DEBUG_ERROR, "Opcode:   %02X (Next bytes: %02X %02X %02X)\n",
-				cpu->opcode,
-				getmem8(cpu, cpu->segregs[regcs], cpu->ip),
-				getmem8(cpu, cpu->segregs[regcs], cpu->ip + 1),
-				getmem8(cpu, cpu->segregs[regcs], cpu->ip + 2));
-			debug_log(DEBUG_ERROR, "Registers: AX:%04X BX:%04X CX:%04X DX:%04X\n",
-				cpu->regs.wordregs[regax], cpu->regs.wordregs[regbx],
-				cpu->regs.wordregs[regcx], cpu->regs.wordregs[regdx]);
-			debug_log(DEBUG_ERROR, "Pointers:  SP:%04X BP:%04X SI:%04X DI:%04X\n",
-				cpu->regs.wordregs[regsp], cpu->regs.wordregs[regbp],
-				cpu->regs.wordregs[regsi], cpu->regs.wordregs[regdi]);
-			debug_log(DEBUG_ERROR, "Flags:     %04X (Mode: %s)\n",
-				makeflagsword(cpu), cpu->protected_mode ? "PROTECTED" : "REAL");
-			debug_log(DEBUG_ERROR, "--------------------------------\n");
+void cpu_exec(CPU_t* cpu, uint32_t execloops) {
+	uint32_t done;
+	uint8_t pm;
 
-			cpu_intcall(cpu, 6);
-			break;
-#else
-		default:
-			cpu_intcall(cpu, 6);
-			debug_log(DEBUG_INFO, "[CPU] Invalid opcode exception at %04X:%04X\r\n", cpu->segregs[regcs], firstip);
-			break;
-#endif
+	while (execloops > 0) {
+		pm = cpu->protected_mode;
+		done = (pm) ? cpu_execLoop_prot(cpu, execloops) : cpu_execLoop_real(cpu, execloops);
+		if ((cpu->protected_mode == pm) || (done >= execloops)) {
+			break; //slice used up, or HLT/idle ended it early
 		}
+		execloops -= done;
+	}
 
-	skipexecution:
-		;
+	if (cpu->lazy_op != CPU_LAZY_NONE) {
+		cpu_flagsSync(cpu); /* leave the flag fields valid for HLE hooks and the rest of the emulator */
 	}
 }
 
@@ -23,6 +23,26 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "../chipset/i8259.h"
+#include "decode.h"
+
+#define CPU_CORE_INTERP		0
+#define CPU_CORE_CACHED		1
+#define CPU_CORE_BLOCK		2
+
+#define CPU_DESCCACHE		64 //decoded GDT/LDT descriptors kept for segment loads, power of two
+#define CPU_GATECACHE		32 //IDT gates kept for protected mode interrupts, by vector, power of two
+#define CPU_TSS_STATE		0x0E //the part of a TSS a task switch saves and loads, IP through DS
+#define CPU_TSS_WORDS		14
+
+#define CPU_LAZY_NONE		0
+#define CPU_LAZY_ADD8		1
+#define CPU_LAZY_ADD16		2
+#define CPU_LAZY_SUB8		3
+#define CPU_LAZY_SUB16		4
+#define CPU_LAZY_LOG8		5
+#define CPU_LAZY_LOG16		6
+#define CPU_LAZY_INC16		7
+#define CPU_LAZY_DEC16		8
 
 union _bytewordregs_ {
 	uint16_t wordregs[8];
@@ -38,10 +58,22 @@ typedef struct {
 	uint16_t sp0;
 } DESCRIPTOR_CACHE;
 
+//a descriptor as read from a table, see cpu_descriptor
+typedef struct {
+	uint32_t table; //GDT or LDT base it was read from
+	uint32_t base;
+	uint32_t gen; //memory_mapGeneration at the time
+	uint16_t selector; //without the RPL bits, or the vector times 8 for a gate
+	uint16_t limit; //offset for a gate
+	uint8_t access;
+	uint8_t valid;
+} DESCRIPTOR_ENTRY_t;
+
 typedef struct {
 	union _bytewordregs_ regs;
 	uint8_t	opcode, segoverride, reptype, hltstate;
 	uint16_t segregs[4], savecs, saveip, ip, useseg, oldsp;
+	uint8_t usesegreg; //index of the segment register useseg was taken from
 	uint16_t msw;
 	struct {
 		uint16_t limit;
@@ -52,8 +84,25 @@ typedef struct {
 	DESCRIPTOR_CACHE segcache[4];
 	DESCRIPTOR_CACHE ldtr_cache;
 	DESCRIPTOR_CACHE tr_cache;
+	DESCRIPTOR_ENTRY_t desccache[CPU_DESCCACHE];
+	DESCRIPTOR_ENTRY_t gatecache[CPU_GATECACHE]; //base holds the selector for a gate
 	uint8_t cpl, iopl;
+	uint8_t* code_host; //host pointer for CS:code_iplow when the current code page is plain memory, otherwise NULL
+	uint32_t code_base, code_gen;
+	uint16_t code_iplow, code_iphigh;
+	uint8_t code_pm;
+	uint8_t core; //CPU_CORE_*
+	uint8_t idledetect; //watch for the guest polling for input, see cpu_idleBranch and cpu_idlePoll
+	uint8_t idle; //polling was spotted, the main loop idles as if halted and clears this
+	uint16_t idle_cs, idle_ip, idle_regs[8];
+	uint32_t idle_writes, idle_spins, idle_polls;
+	uint64_t idle_lastpoll;
+	DECODE_ENTRY_t* decode_pre; //cached decode for the current instruction's ModRM, if any
+	DECODE_ENTRY_t* decode_rec; //entry being recorded for the current instruction, if any
+	uint16_t decode_ip, decode_room;
 	uint8_t	tempcf, oldcf, cf, pf, af, zf, sf, tf, ifl, df, of, mode, reg, rm;
+	uint8_t lazy_op; //CPU_LAZY_*, the ALU op whose flags haven't been written to cf/pf/af/zf/sf/of yet
+	uint16_t lazy_dst, lazy_src, lazy_res;
 	uint16_t oper1, oper2, res16, disp16, temp16, dummy, stacksize, frametemp;
 	uint8_t	oper1b, oper2b, res8, disp8, temp8, nestlev, addrbyte;
 	uint32_t temp1, temp2, temp3, temp4, temp5, temp32, tempaddr32, ea;
@@ -98,10 +147,12 @@ typedef struct {
 #endif
 
 #define StepIP(mycpu, x)	mycpu->ip += x
-#define getmem8(mycpu, x, y)	cpu_read(mycpu, get_real_address(mycpu, x, y))
-#define getmem16(mycpu, x, y)	cpu_readw(mycpu, get_real_address(mycpu, x, y))
-#define putmem8(mycpu, x, y, z)	cpu_write(mycpu, get_real_address(mycpu, x, y), z)
-#define putmem16(mycpu, x, y, z)	cpu_writew(mycpu, get_real_address(mycpu, x, y), z)
+#define getmem8(mycpu, x, y)	cpu_read(mycpu, get_seg_address(mycpu, x, y))
+#define getmem16(mycpu, x, y)	cpu_readw(mycpu, get_seg_address(mycpu, x, y))
+#define getcode8(mycpu, y)	cpu_fetch8(mycpu, y)
+#define getcode16(mycpu, y)	cpu_fetch16(mycpu, y)
+#define putmem8(mycpu, x, y, z)	cpu_write(mycpu, get_seg_address(mycpu, x, y), z)
+#define putmem16(mycpu, x, y, z)	cpu_writew(mycpu, get_seg_address(mycpu, x, y), z)
 #define signext(value)	(int16_t)(int8_t)(value)
 #define signext32(value)	(int32_t)(int16_t)(value)
 #define getreg16(mycpu, regid)	mycpu->regs.wordregs[regid]
@@ -114,6 +165,7 @@ typedef struct {
 
 #define makeflagsword(x) \
 	( \
+	(x->lazy_op ? cpu_flagsSync(x) : (void)0), \
 	2 | (uint16_t) x->cf | ((uint16_t) x->pf << 2) | ((uint16_t) x->af << 4) | ((uint16_t) x->zf << 6) | ((uint16_t) x->sf << 7) | \
 	((uint16_t) x->tf << 8) | ((uint16_t) x->ifl << 9) | ((uint16_t) x->df << 10) | ((uint16_t) x->of << 11) \
 	)
@@ -121,6 +173,7 @@ typedef struct {
 #define decodeflagsword(x,y) { \
 	uint16_t tmp; \
 	tmp = y; \
+	x->lazy_op = CPU_LAZY_NONE; \
 	x->cf = tmp & 1; \
 	x->pf = (tmp >> 2) & 1; \
 	x->af = (tmp >> 4) & 1; \
@@ -134,7 +187,12 @@ typedef struct {
 }
 
 #define modregrm(x) { \
-	x->addrbyte = getmem8(x, x->segregs[regcs], x->ip); \
+	if ((x->decode_pre != NULL) && (x->ip == x->decode_ip)) { \
+	cpu_decodeReplayModrm(x); \
+	} \
+	else { \
+	uint16_t modstart = x->ip; \
+	x->addrbyte = getcode8(x, x->ip); \
 	StepIP(x, 1); \
 	x->mode = x->addrbyte >> 6; \
 	x->reg = (x->addrbyte >> 3) & 7; \
@@ -143,27 +201,30 @@ typedef struct {
 	{ \
 	case 0: \
 	if(x->rm == 6) { \
-	x->disp16 = getmem16(x, x->segregs[regcs], x->ip); \
+	x->disp16 = getcode16(x, x->ip); \
 	StepIP(x, 2); \
 	} \
 	if(((x->rm == 2) || (x->rm == 3)) && !x->segoverride) { \
 	x->useseg = x->segregs[regss]; \
+	x->usesegreg = regss; \
 	} \
 	break; \
  \
 	case 1: \
-	x->disp16 = signext(getmem8(x, x->segregs[regcs], x->ip)); \
+	x->disp16 = signext(getcode8(x, x->ip)); \
 	StepIP(x, 1); \
 	if(((x->rm == 2) || (x->rm == 3) || (x->rm == 6)) && !x->segoverride) { \
 	x->useseg = x->segregs[regss]; \
+	x->usesegreg = regss; \
 	} \
 	break; \
  \
 	case 2: \
-	x->disp16 = getmem16(x, x->segregs[regcs], x->ip); \
+	x->disp16 = getcode16(x, x->ip); \
 	StepIP(x, 2); \
 	if(((x->rm == 2) || (x->rm == 3) || (x->rm == 6)) && !x->segoverride) { \
 	x->useseg = x->segregs[regss]; \
+	x->usesegreg = regss; \
 	} \
 	break; \
  \
@@ -171,6 +232,10 @@ typedef struct {
 	x->disp8 = 0; \
 	x->disp16 = 0; \
 	} \
+	if (x->decode_rec != NULL) { \
+	cpu_decodeRecordModrm(x, modstart); \
+	} \
+	} \
 }
 
 uint8_t cpu_read(CPU_t* cpu, uint32_t addr);
@@ -178,13 +243,18 @@ uint16_t cpu_readw(CPU_t* cpu, uint32_t addr);
 void cpu_write(CPU_t* cpu, uint32_t addr32, uint8_t value);
 void cpu_writew(CPU_t* cpu, uint32_t addr32, uint16_t value);
 void cpu_intcall(CPU_t* cpu, uint8_t intnum);
+void cpu_intDispatch(CPU_t* cpu, uint8_t intnum);
 void cpu_reset(CPU_t* cpu);
+void cpu_descFlush(CPU_t* cpu);
+void cpu_flagsSync(CPU_t* cpu);
 void cpu_interruptCheck(CPU_t* cpu, I8259_t* i8259);
 void cpu_exec(CPU_t* cpu, uint32_t execloops);
 void port_write(CPU_t* cpu, uint16_t portnum, uint8_t value);
 void port_writew(CPU_t* cpu, uint16_t portnum, uint16_t value);
 uint8_t port_read(CPU_t* cpu, uint16_t portnum);
 uint16_t port_readw(CPU_t* cpu, uint16_t portnum);
+uint32_t port_readBlock(CPU_t* cpu, uint16_t portnum, uint8_t* dst, uint32_t count, uint8_t size);
+uint32_t port_writeBlock(CPU_t* cpu, uint16_t portnum, const uint8_t* src, uint32_t count, uint8_t size);
 void cpu_registerIntCallback(CPU_t* cpu, uint8_t interrupt, void (*cb)(CPU_t*, uint8_t));
 void push(CPU_t* cpu, uint16_t pushval);
 
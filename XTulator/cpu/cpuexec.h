@@ -0,0 +1,2884 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	The parts of the interpreter that depend on the CPU mode, included by
+	cpu.c once per instantiation instead of being compiled once. Before each
+	include cpu.c defines CPU_PM(cpu), the mode test, and CPU_FN(name), the
+	name to give each function here.
+
+	The first include has CPU_PM read cpu->protected_mode and keeps the plain
+	names, for the code outside the main loop. The others pass CPU_EXEC_LOOP
+	and fix CPU_PM at 0 or 1. That produces cpu_execLoop_real and
+	cpu_execLoop_prot, and the compiler drops the other mode's segment
+	handling and privilege checks from each of them. cpu_exec runs whichever
+	matches the mode, and a loop returns as soon as the mode stops matching.
+
+	There's no include guard on purpose.
+*/
+
+#define get_seg_address CPU_FN(get_seg_address)
+#define cpu_codeRefill CPU_FN(cpu_codeRefill)
+#define cpu_codePointer CPU_FN(cpu_codePointer)
+#define cpu_fetch8 CPU_FN(cpu_fetch8)
+#define cpu_fetch16 CPU_FN(cpu_fetch16)
+#define getea CPU_FN(getea)
+#define push CPU_FN(push)
+#define pop CPU_FN(pop)
+#define readrm16 CPU_FN(readrm16)
+#define readrm8 CPU_FN(readrm8)
+#define writerm16 CPU_FN(writerm16)
+#define writerm8 CPU_FN(writerm8)
+#define cpu_execLoop CPU_FN(cpu_execLoop)
+
+/*
+	Resolve a segment register and offset to a linear address. The segment
+	register is given by index, so protected mode goes straight to that
+	register's descriptor cache which is filled in by load_descriptor.
+*/
+FUNC_INLINE uint32_t get_seg_address(CPU_t* cpu, uint8_t sreg, uint16_t off) {
+	if (CPU_PM(cpu)) {
+		DESCRIPTOR_CACHE* cache = &cpu->segcache[sreg];
+		if (cache->valid && (off <= cache->limit)) {
+			return cache->base + off;
+		}
+		return ((uint32_t)cpu->segregs[sreg] << 4) + off;
+	}
+
+	return ((uint32_t)cpu->segregs[sreg] << 4) + off; //the wrap at 1 MB with A20 off is done by the memory map, see memory_setA20
+}
+
+/*
+	Instruction fetch goes through a cached pointer to the current code page.
+	The cache covers the range of IP values within CS that map into a single
+	memory page with a direct host pointer, and is keyed on the CS base, mode
+	and memory map generation (which A20 changes bump) so that it revalidates
+	itself.
+*/
+static uint8_t* cpu_codeRefill(CPU_t* cpu, uint16_t ip) {
+	uint32_t base, limit, linear, offset, high;
+	uint8_t* host;
+
+	cpu->code_host = NULL;
+	if (CPU_PM(cpu)) {
+		if (!cpu->segcache[regcs].valid || (ip > cpu->segcache[regcs].limit)) {
+			return NULL;
+		}
+		base = cpu->segcache[regcs].base;
+		limit = cpu->segcache[regcs].limit;
+	}
+	else {
+		base = (uint32_t)cpu->segregs[regcs] << 4;
+		limit = 0xFFFF;
+	}
+
+	linear = (base + ip) & MEMORY_MASK;
+	host = memory_pages[linear >> MEMORY_PAGE_SHIFT].read;
+	if (host == NULL) {
+		return NULL;
+	}
+
+	offset = linear & MEMORY_PAGE_MASK;
+	cpu->code_iplow = (ip >= offset) ? (ip - offset) : 0;
+	high = (uint32_t)ip + (MEMORY_PAGE_MASK - offset);
+	cpu->code_iphigh = (high > limit) ? (uint16_t)limit : (uint16_t)high;
+	cpu->code_host = host + offset - (ip - cpu->code_iplow);
+	cpu->code_base = base;
+	cpu->code_pm = CPU_PM(cpu);
+	cpu->code_gen = memory_mapGeneration;
+	return host + offset;
+}
+
+FUNC_INLINE uint8_t* cpu_codePointer(CPU_t* cpu, uint16_t ip, uint16_t len) {
+	uint32_t base;
+
+	base = (CPU_PM(cpu)) ? cpu->segcache[regcs].base : ((uint32_t)cpu->segregs[regcs] << 4);
+	if ((cpu->code_host != NULL) && (cpu->code_base == base) && (cpu->code_pm == CPU_PM(cpu)) &&
+		(cpu->code_gen == memory_mapGeneration) &&
+		(ip >= cpu->code_iplow) && ((uint32_t)ip + len - 1 <= cpu->code_iphigh)) {
+		return cpu->code_host + (ip - cpu->code_iplow);
+	}
+
+	if (cpu_codeRefill(cpu, ip) == NULL) {
+		return NULL;
+	}
+	if ((uint32_t)ip + len - 1 > cpu->code_iphigh) {
+		return NULL; //spans a page or segment limit, let the caller take the slow path
+	}
+	return cpu->code_host + (ip - cpu->code_iplow);
+}
+
+FUNC_INLINE uint8_t cpu_fetch8(CPU_t* cpu, uint16_t ip) {
+	uint8_t* host = cpu_codePointer(cpu, ip, 1);
+	if (host != NULL) {
+		return *host;
+	}
+	return getmem8(cpu, regcs, ip);
+}
+
+FUNC_INLINE uint16_t cpu_fetch16(CPU_t* cpu, uint16_t ip) {
+	uint8_t* host = cpu_codePointer(cpu, ip, 2);
+	if (host != NULL) {
+		return (uint16_t)host[0] | ((uint16_t)host[1] << 8);
+	}
+	return getmem16(cpu, regcs, ip);
+}
+
+FUNC_INLINE void getea(CPU_t* cpu, uint8_t rmval) {
+	uint32_t	tempea;
+
+	tempea = 0;
+	switch (cpu->mode) {
+	case 0:
+		switch (rmval) {
+		case 0: tempea = cpu->regs.wordregs[regbx] + cpu->regs.wordregs[regsi]; break;
+		case 1: tempea = cpu->regs.wordregs[regbx] + cpu->regs.wordregs[regdi]; break;
+		case 2: tempea = cpu->regs.wordregs[regbp] + cpu->regs.wordregs[regsi]; break;
+		case 3: tempea = cpu->regs.wordregs[regbp] + cpu->regs.wordregs[regdi]; break;
+		case 4: tempea = cpu->regs.wordregs[regsi]; break;
+		case 5: tempea = cpu->regs.wordregs[regdi]; break;
+		case 6: tempea = cpu->disp16; break;
+		case 7: tempea = cpu->regs.wordregs[regbx]; break;
+		}
+		break;
+	case 1:
+	case 2:
+		switch (rmval) {
+		case 0: tempea = cpu->regs.wordregs[regbx] + cpu->regs.wordregs[regsi] + cpu->disp16; break;
+		case 1: tempea = cpu->regs.wordregs[regbx] + cpu->regs.wordregs[regdi] + cpu->disp16; break;
+		case 2: tempea = cpu->regs.wordregs[regbp] + cpu->regs.wordregs[regsi] + cpu->disp16; break;
+		case 3: tempea = cpu->regs.wordregs[regbp] + cpu->regs.wordregs[regdi] + cpu->disp16; break;
+		case 4: tempea = cpu->regs.wordregs[regsi] + cpu->disp16; break;
+		case 5: tempea = cpu->regs.wordregs[regdi] + cpu->disp16; break;
+		case 6: tempea = cpu->regs.wordregs[regbp] + cpu->disp16; break;
+		case 7: tempea = cpu->regs.wordregs[regbx] + cpu->disp16; break;
+		}
+		break;
+	}
+
+	uint16_t offset = tempea & 0xFFFF;
+
+	cpu->ea = get_seg_address(cpu, cpu->usesegreg, offset);
+}
+
+FUNC_INLINE void push(CPU_t* cpu, uint16_t pushval) {
+	cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regsp] - 2;
+	putmem16(cpu, regss, cpu->regs.wordregs[regsp], pushval);
+}
+
+FUNC_INLINE uint16_t pop(CPU_t* cpu) {
+
+	uint16_t	tempval;
+
+	tempval = getmem16(cpu, regss, cpu->regs.wordregs[regsp]);
+	cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regsp] + 2;
+	return tempval;
+}
+
+FUNC_INLINE uint16_t readrm16(CPU_t* cpu, uint8_t rmval) {
+	if (cpu->mode < 3) {
+		getea(cpu, rmval);
+		return cpu_read(cpu, cpu->ea) | ((uint16_t)cpu_read(cpu, cpu->ea + 1) << 8);
+	}
+	else {
+		return getreg16(cpu, rmval);
+	}
+}
+
+FUNC_INLINE uint8_t readrm8(CPU_t* cpu, uint8_t rmval) {
+	if (cpu->mode < 3) {
+		getea(cpu, rmval);
+		return cpu_read(cpu, cpu->ea);
+	}
+	else {
+		return getreg8(cpu, rmval);
+	}
+}
+
+FUNC_INLINE void writerm16(CPU_t* cpu, uint8_t rmval, uint16_t value) {
+	if (cpu->mode < 3) {
+		getea(cpu, rmval);
+		cpu_write(cpu, cpu->ea, value & 0xFF);
+		cpu_write(cpu, cpu->ea + 1, value >> 8);
+	}
+	else {
+		putreg16(cpu, rmval, value);
+	}
+}
+
+FUNC_INLINE void writerm8(CPU_t* cpu, uint8_t rmval, uint8_t value) {
+	if (cpu->mode < 3) {
+		getea(cpu, rmval);
+		cpu_write(cpu, cpu->ea, value);
+	}
+	else {
+		putreg8(cpu, rmval, value);
+	}
+}
+
+#ifdef CPU_EXEC_LOOP
+
+static uint32_t cpu_execLoop(CPU_t* cpu, uint32_t execloops) {
+
+	uint32_t loopcount, linear, done;
+	uint8_t docontinue;
+	static uint16_t firstip;
+	DECODE_ENTRY_t* entry;
+	BLOCK_t* block;
+
+	for (loopcount = 0; loopcount < execloops; loopcount++) {
+
+		if (cpu->protected_mode != CPU_PM(cpu)) break; //LMSW, LOADALL or a reset changed modes, cpu_exec goes on in the other loop
+
+		if (cpu->trap_toggle) {
+			cpu_intcall(cpu, 1);
+		}
+
+		if (cpu->tf) {
+			cpu->trap_toggle = 1;
+		}
+		else {
+			cpu->trap_toggle = 0;
+		}
+
+		if (cpu->hltstate) break; //nothing happens until an interrupt, the rest of the slice just passes
+		if (cpu->idle) break; //polling, see cpu_idleBranch
+
+		cpu->reptype = 0;
+		cpu->segoverride = 0;
+		cpu->useseg = cpu->segregs[regds];
+		cpu->usesegreg = regds;
+		docontinue = 0;
+		firstip = cpu->ip;
+		cpu->decode_pre = NULL;
+		cpu->decode_rec = NULL;
+		if (cpu->core != CPU_CORE_INTERP) {
+			linear = get_seg_address(cpu, regcs, cpu->ip) & MEMORY_MASK;
+			entry = decode_lookup(linear);
+			if ((cpu->core == CPU_CORE_BLOCK) && (entry != NULL) && !CPU_PM(cpu) && !cpu->tf) {
+				block = block_get(entry, linear, cpu->ip);
+				if ((block != NULL) && ((done = cpu_blockRun(cpu, block, execloops - loopcount)) > 0)) {
+					loopcount += done - 1;
+					continue;
+				}
+			}
+			docontinue = cpu_decodeStart(cpu, entry, linear);
+		}
+
+		while (!docontinue) {
+			cpu->segregs[regcs] = cpu->segregs[regcs] & 0xFFFF;
+			cpu->ip = cpu->ip & 0xFFFF;
+			cpu->savecs = cpu->segregs[regcs];
+			cpu->saveip = cpu->ip;
+			cpu->opcode = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+
+			switch (cpu->opcode) {
+				/* segment prefix check */
+			case 0x2E:	/* segment cpu->segregs[regcs] */
+				cpu->useseg = cpu->segregs[regcs];
+				cpu->usesegreg = regcs;
+				cpu->segoverride = 1;
+				break;
+
+			case 0x3E:	/* segment cpu->segregs[regds] */
+				cpu->useseg = cpu->segregs[regds];
+				cpu->usesegreg = regds;
+				cpu->segoverride = 1;
+				break;
+
+			case 0x26:	/* segment cpu->segregs[reges] */
+				cpu->useseg = cpu->segregs[reges];
+				cpu->usesegreg = reges;
+				cpu->segoverride = 1;
+				break;
+
+			case 0x36:	/* segment cpu->segregs[regss] */
+				cpu->useseg = cpu->segregs[regss];
+				cpu->usesegreg = regss;
+				cpu->segoverride = 1;
+				break;
+
+			case 0xF0: /* LOCK prefix */
+				break;
+
+				/* repetition prefix check */
+			case 0xF3:	/* REP/REPE/REPZ */
+				cpu->reptype = 1;
+				break;
+
+			case 0xF2:	/* REPNE/REPNZ */
+				cpu->reptype = 2;
+				break;
+
+			default:
+				docontinue = 1;
+				break;
+			}
+		}
+
+		if (cpu->decode_rec != NULL) {
+			cpu_decodeRecord(cpu, firstip);
+		}
+		profile_countOp(cpu->opcode);
+		sampler_tick(cpu->savecs, cpu->saveip, CPU_PM(cpu));
+		trace_tick(cpu, firstip, 0);
+
+#if 0
+		printf("%04X:%04X  %02X %02X %02X %02X\n",
+			cpu->savecs,
+			firstip,
+			cpu->opcode,
+			getmem8(cpu, regcs, cpu->ip + 0),
+			getmem8(cpu, regcs, cpu->ip + 1),
+			getmem8(cpu, regcs, cpu->ip + 2)
+		);
+#endif
+
+#if 0
+		if (CPU_PM(cpu)) {
+			printf("%04X:%04X  %02X %02X %02X %02X\n",
+				cpu->savecs,
+				firstip,
+				cpu->opcode,
+				getmem8(cpu, regcs, cpu->ip + 0),
+				getmem8(cpu, regcs, cpu->ip + 1),
+				getmem8(cpu, regcs, cpu->ip + 2)
+			);
+		}
+#endif
+
+		cpu->totalexec++;
+
+		if ((cpu->lazy_op != CPU_LAZY_NONE) && !lazysafe[cpu->opcode]) {
+			cpu_flagsSync(cpu);
+		}
+
+		switch (cpu->opcode) {
+		case 0x00:	/* 00 ADD Eb Gb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getreg8(cpu, cpu->reg);
+			op_add8(cpu);
+			writerm8(cpu, cpu->rm, cpu->res8);
+			break;
+
+		case 0x01:	/* 01 ADD Ev Gv */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			cpu->oper2 = getreg16(cpu, cpu->reg);
+			op_add16(cpu);
+			writerm16(cpu, cpu->rm, cpu->res16);
+			break;
+
+		case 0x02:	/* 02 ADD Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			cpu->oper2b = readrm8(cpu, cpu->rm);
+			op_add8(cpu);
+			putreg8(cpu, cpu->reg, cpu->res8);
+			break;
+
+		case 0x03:	/* 03 ADD Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			cpu->oper2 = readrm16(cpu, cpu->rm);
+			op_add16(cpu);
+			putreg16(cpu, cpu->reg, cpu->res16);
+			break;
+
+		case 0x04:	/* 04 ADD cpu->regs.byteregs[regal] Ib */
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			op_add8(cpu);
+			cpu->regs.byteregs[regal] = cpu->res8;
+			break;
+
+		case 0x05:	/* 05 ADD eAX Iv */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			op_add16(cpu);
+			cpu->regs.wordregs[regax] = cpu->res16;
+			break;
+
+		case 0x06:	/* 06 PUSH cpu->segregs[reges] */
+			push(cpu, cpu->segregs[reges]);
+			break;
+
+		case 0x07:	/* 07 POP cpu->segregs[reges] */
+			cpu->oper1 = pop(cpu);
+			if (CPU_PM(cpu)) {
+				load_descriptor(cpu, reges, cpu->oper1);
+			}
+			cpu->segregs[reges] = cpu->oper1;
+			break;
+
+		case 0x08:	/* 08 OR Eb Gb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getreg8(cpu, cpu->reg);
+			op_or8(cpu);
+			writerm8(cpu, cpu->rm, cpu->res8);
+			break;
+
+		case 0x09:	/* 09 OR Ev Gv */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			cpu->oper2 = getreg16(cpu, cpu->reg);
+			op_or16(cpu);
+			writerm16(cpu, cpu->rm, cpu->res16);
+			break;
+
+		case 0x0A:	/* 0A OR Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			cpu->oper2b = readrm8(cpu, cpu->rm);
+			op_or8(cpu);
+			putreg8(cpu, cpu->reg, cpu->res8);
+			break;
+
+		case 0x0B:	/* 0B OR Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			cpu->oper2 = readrm16(cpu, cpu->rm);
+			op_or16(cpu);
+			putreg16(cpu, cpu->reg, cpu->res16);
+			break;
+
+		case 0x0C:	/* 0C OR cpu->regs.byteregs[regal] Ib */
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			op_or8(cpu);
+			cpu->regs.byteregs[regal] = cpu->res8;
+			break;
+
+		case 0x0D:	/* 0D OR eAX Iv */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			op_or16(cpu);
+			cpu->regs.wordregs[regax] = cpu->res16;
+			break;
+
+		case 0x0E:	/* 0E PUSH cpu->segregs[regcs] */
+			push(cpu, cpu->segregs[regcs]);
+			break;
+
+		case 0x0F: /* extended opcodes */
+			cpu->opcode = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			profile_countOp0F(cpu->opcode);
+#if 1
+			debug_log(DEBUG_INFO, "[CPU] Extended Opcode 0Fh, %02Xh\n", cpu->opcode);
+#endif
+
+			switch (cpu->opcode) {
+			case 0x00: /* Group 6 Instructions */
+				modregrm(cpu);
+				if (CPU_PM(cpu)) {
+					switch (cpu->reg) {
+					case 0: // SLDT
+						writerm16(cpu, cpu->rm, cpu->ldtr);
+						break;
+					case 1: // STR
+						writerm16(cpu, cpu->rm, cpu->tr);
+						break;
+					case 2: // LLDT
+						if (cpu->cpl != 0) {
+							cpu_intcall(cpu, 13);
+							break;
+						}
+						cpu->ldtr = readrm16(cpu, cpu->rm);
+						cpu_descFlush(cpu);
+						load_ldtr(cpu, cpu->ldtr);
+						break;
+					case 3: // LTR
+						if (cpu->cpl != 0) {
+							cpu_intcall(cpu, 13);
+							break;
+						}
+						cpu->tr = readrm16(cpu, cpu->rm);
+						load_tr(cpu, cpu->tr);
+						break;
+					case 4: // VERR
+					case 5: // VERW
+					{
+						uint16_t sel = readrm16(cpu, cpu->rm);
+						uint32_t base; uint16_t limit; uint8_t access;
+						cpu->zf = 0;
+						if ((sel & 0xFFFC) != 0 && get_descriptor_info(cpu, sel, &base, &limit, &access)) {
+							uint8_t dpl = (access >> 5) & 3;
+							uint8_t cpl = cpu->cpl;
+							uint8_t rpl = sel & 3;
+							uint8_t max_pl = (cpl > rpl) ? cpl : rpl;
+							bool is_code = (access & 0x08) != 0;
+							bool is_conforming = is_code && (access & 0x04);
+
+							if ((access & 0x10) && (is_conforming || (max_pl <= dpl))) {
+								if (cpu->reg == 4) { // VERR
+									if (!is_code || (access & 0x02)) cpu->zf = 1;
+								}
+								else { // VERW
+									if (!is_code && (access & 0x02)) cpu->zf = 1;
+								}
+							}
+						}
+						break;
+					}
+					default:
+						debug_log(DEBUG_ERROR, "[CPU] Unhandled Group 6 /0Fh opcode reg=%d (rm=%d)\n", cpu->reg, cpu->rm);
+						cpu_intcall(cpu, 6);
+						break;
+					}
+				}
+				else {
+					cpu_intcall(cpu, 6);
+				}
+				break;
+			case 0x01: /* Group 7 Instructions */
+				modregrm(cpu);
+				switch (cpu->reg) {
+				case 0: // SGDT
+					if (cpu->mode == 3) {
+						cpu_intcall(cpu, 6);
+						break;
+					}
+					getea(cpu, cpu->rm);
+					cpu_writew(cpu, cpu->ea, cpu->gdtr.limit);
+					cpu_write(cpu, cpu->ea + 2, (cpu->gdtr.base) & 0xFF);
+					cpu_write(cpu, cpu->ea + 3, (cpu->gdtr.base >> 8) & 0xFF);
+					cpu_write(cpu, cpu->ea + 4, (cpu->gdtr.base >> 16) & 0xFF);
+					break;
+				case 1: // SIDT
+					if (cpu->mode == 3) {
+						cpu_intcall(cpu, 6);
+						break;
+					}
+					getea(cpu, cpu->rm);
+					cpu_writew(cpu, cpu->ea, cpu->idtr.limit);
+					cpu_write(cpu, cpu->ea + 2, (cpu->idtr.base) & 0xFF);
+					cpu_write(cpu, cpu->ea + 3, (cpu->idtr.base >> 8) & 0xFF);
+					cpu_write(cpu, cpu->ea + 4, (cpu->idtr.base >> 16) & 0xFF);
+					break;
+				case 2: // LGDT
+					if (CPU_PM(cpu) && cpu->cpl != 0) {
+						cpu_intcall(cpu, 13);
+						break;
+					}
+					if (cpu->mode == 3) {
+						cpu_intcall(cpu, 6);
+						break;
+					}
+					getea(cpu, cpu->rm);
+					uint16_t gdt_limit = cpu_readw(cpu, cpu->ea);
+					uint32_t gdt_base = cpu_read(cpu, cpu->ea + 2)
+						| (cpu_read(cpu, cpu->ea + 3) << 8)
+						| (cpu_read(cpu, cpu->ea + 4) << 16);
+					cpu->gdtr.limit = gdt_limit;
+					cpu->gdtr.base = gdt_base;
+					cpu_descFlush(cpu);
+					break;
+				case 3: // LIDT
+					if (CPU_PM(cpu) && cpu->cpl != 0) {
+						cpu_intcall(cpu, 13);
+						break;
+					}
+					if (cpu->mode == 3) {
+						cpu_intcall(cpu, 6);
+						break;
+					}
+					getea(cpu, cpu->rm);
+					uint16_t idt_limit = cpu_readw(cpu, cpu->ea);
+					uint32_t idt_base = cpu_read(cpu, cpu->ea + 2)
+						| (cpu_read(cpu, cpu->ea + 3) << 8)
+						| (cpu_read(cpu, cpu->ea + 4) << 16);
+					cpu->idtr.limit = idt_limit;
+					cpu->idtr.base = idt_base;
+					break;
+				case 4: // SMSW Ew
+					writerm16(cpu, cpu->rm, cpu->msw);
+					break;
+				case 6: // LMSW Ew
+					if (CPU_PM(cpu) && cpu->cpl != 0) {
+						cpu_intcall(cpu, 13);
+						break;
+					}
+					cpu->oper1 = readrm16(cpu, cpu->rm);
+
+					if (CPU_PM(cpu)) {
+						cpu->oper1 |= 1;
+					}
+
+					cpu->msw = (cpu->msw & 0xFFF0) | (cpu->oper1 & 0x000F);
+
+					if (!CPU_PM(cpu) && (cpu->msw & 1)) {
+						debug_log(DEBUG_INFO, "[CPU] Entering Protected Mode\n");
+						cpu->protected_mode = 1;
+
+						cpu->segcache[regcs].base = (uint32_t)cpu->segregs[regcs] << 4;
+						cpu->segcache[regcs].limit = 0xFFFF;
+						cpu->segcache[regcs].access = 0x93;
+						cpu->segcache[regcs].valid = 1;
+
+						cpu->segcache[regds].base = (uint32_t)cpu->segregs[regds] << 4;
+						cpu->segcache[regds].limit = 0xFFFF;
+						cpu->segcache[regds].access = 0x93;
+						cpu->segcache[regds].valid = 1;
+
+						cpu->segcache[reges].base = (uint32_t)cpu->segregs[reges] << 4;
+						cpu->segcache[reges].limit = 0xFFFF;
+						cpu->segcache[reges].access = 0x93;
+						cpu->segcache[reges].valid = 1;
+
+						cpu->segcache[regss].base = (uint32_t)cpu->segregs[regss] << 4;
+						cpu->segcache[regss].limit = 0xFFFF;
+						cpu->segcache[regss].access = 0x93;
+						cpu->segcache[regss].valid = 1;
+					}
+					break;
+				default:
+					debug_log(DEBUG_ERROR, "[CPU] Unhandled Group 7 /0Fh opcode reg=%d (rm=%d)\n", cpu->reg, cpu->rm);
+					cpu_intcall(cpu, 6);
+					break;
+				}
+				break;
+			case 0x02: // LAR
+			case 0x03: // LSL
+			{
+				modregrm(cpu);
+				uint32_t base;
+				uint16_t limit;
+				uint8_t access;
+				uint16_t sel = readrm16(cpu, cpu->rm);
+				uint8_t cpl = cpu->cpl;
+				uint8_t rpl = sel & 3;
+
+				cpu->zf = 0;
+
+				if (get_descriptor_info(cpu, sel, &base, &limit, &access)) {
+					uint8_t type = (access >> 0) & 0x1F;
+					uint8_t dpl = (access >> 5) & 3;
+
+					if (dpl >= cpl && dpl >= rpl) {
+						bool valid_type = false;
+						if (cpu->opcode == 0x02) { // LAR
+							if (type != 0x00 && type != 0x08 && type != 0x0A && type != 0x0D) {
+								valid_type = true;
+							}
+						}
+						else { // LSL
+							if (type != 0x00 && type != 0x04 && type != 0x05 && type != 0x06 &&
+								type != 0x07 && type != 0x0C && type != 0x0E && type != 0x0F) {
+								valid_type = true;
+							}
+						}
+
+						if (valid_type) {
+							cpu->zf = 1;
+							if (cpu->opcode == 0x02) { // LAR
+								putreg16(cpu, cpu->reg, access << 8);
+							}
+							else { // LSL
+								putreg16(cpu, cpu->reg, limit);
+							}
+						}
+					}
+				}
+				break;
+			}
+			case 0x05: /* LOADALL - 286 version */
+				if (CPU_PM(cpu)) {
+					cpu_intcall(cpu, 6);
+					break;
+				}
+
+				uint32_t addr = 0x800;
+
+				cpu->segcache[reges].limit = cpu_readw(cpu, addr + 0x1E);
+				cpu->segcache[reges].base = read_24bit_base(cpu, addr + 0x1B);
+				cpu->segcache[reges].access = cpu_read(cpu, addr + 0x1A);
+				cpu->segcache[reges].valid = 1;
+
+				cpu->segcache[regcs].limit = cpu_readw(cpu, addr + 0x24);
+				cpu->segcache[regcs].base = read_24bit_base(cpu, addr + 0x21);
+				cpu->segcache[regcs].access = cpu_read(cpu, addr + 0x20);
+				cpu->segcache[regcs].valid = 1;
+
+				cpu->segcache[regss].limit = cpu_readw(cpu, addr + 0x2A);
+				cpu->segcache[regss].base = read_24bit_base(cpu, addr + 0x27);
+				cpu->segcache[regss].access = cpu_read(cpu, addr + 0x26);
+				cpu->segcache[regss].valid = 1;
+
+				cpu->segcache[regds].limit = cpu_readw(cpu, addr + 0x30);
+				cpu->segcache[regds].base = read_24bit_base(cpu, addr + 0x2D);
+				cpu->segcache[regds].access = cpu_read(cpu, addr + 0x2C);
+				cpu->segcache[regds].valid = 1;
+
+				cpu->regs.wordregs[regdi] = cpu_readw(cpu, addr + 0x32);
+				cpu->regs.wordregs[regsi] = cpu_readw(cpu, addr + 0x34);
+				cpu->regs.wordregs[regbp] = cpu_readw(cpu, addr + 0x36);
+				cpu->regs.wordregs[regsp] = cpu_readw(cpu, addr + 0x38);
+				cpu->regs.wordregs[regbx] = cpu_readw(cpu, addr + 0x3A);
+				cpu->regs.wordregs[regdx] = cpu_readw(cpu, addr + 0x3C);
+				cpu->regs.wordregs[regcx] = cpu_readw(cpu, addr + 0x3E);
+				cpu->regs.wordregs[regax] = cpu_readw(cpu, addr + 0x40);
+
+				decodeflagsword(cpu, cpu_readw(cpu, addr + 0x42));
+				cpu->ip = cpu_readw(cpu, addr + 0x44);
+				cpu->ldtr = cpu_readw(cpu, addr + 0x46);
+				cpu->tr = cpu_readw(cpu, addr + 0x54);
+				cpu->segregs[regds] = cpu_readw(cpu, addr + 0x48);
+				cpu->segregs[regss] = cpu_readw(cpu, addr + 0x4A);
+				cpu->segregs[regcs] = cpu_readw(cpu, addr + 0x4C);
+				cpu->segregs[reges] = cpu_readw(cpu, addr + 0x4E);
+
+				cpu->gdtr.limit = cpu_readw(cpu, addr + 0x56);
+				cpu->gdtr.base = read_24bit_base(cpu, addr + 0x58);
+				cpu->idtr.limit = cpu_readw(cpu, addr + 0x5C);
+				cpu->idtr.base = read_24bit_base(cpu, addr + 0x5E);
+				cpu_descFlush(cpu);
+
+				cpu->msw = cpu_readw(cpu, addr + 0x66);
+				if (!CPU_PM(cpu) && (cpu->msw & 1)) {
+					debug_log(DEBUG_INFO, "[CPU] Entering Protected Mode\n");
+				}
+				cpu->protected_mode = (cpu->msw & 1);
+				break;
+			case 0x06: /* CLTS */
+				if (CPU_PM(cpu) && cpu->cpl != 0) {
+					cpu_intcall(cpu, 13);
+					break;
+				}
+				cpu->msw &= ~0x0008;
+				break;
+			default:
+				debug_log(DEBUG_ERROR, "[CPU] Unhandled 0Fh opcode: %02Xh\n", cpu->opcode);
+				cpu_intcall(cpu, 6);
+				break;
+			}
+			break;
+
+		case 0x10:	/* 10 ADC Eb Gb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getreg8(cpu, cpu->reg);
+			op_adc8(cpu);
+			writerm8(cpu, cpu->rm, cpu->res8);
+			break;
+
+		case 0x11:	/* 11 ADC Ev Gv */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			cpu->oper2 = getreg16(cpu, cpu->reg);
+			op_adc16(cpu);
+			writerm16(cpu, cpu->rm, cpu->res16);
+			break;
+
+		case 0x12:	/* 12 ADC Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			cpu->oper2b = readrm8(cpu, cpu->rm);
+			op_adc8(cpu);
+			putreg8(cpu, cpu->reg, cpu->res8);
+			break;
+
+		case 0x13:	/* 13 ADC Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			cpu->oper2 = readrm16(cpu, cpu->rm);
+			op_adc16(cpu);
+			putreg16(cpu, cpu->reg, cpu->res16);
+			break;
+
+		case 0x14:	/* 14 ADC cpu->regs.byteregs[regal] Ib */
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			op_adc8(cpu);
+			cpu->regs.byteregs[regal] = cpu->res8;
+			break;
+
+		case 0x15:	/* 15 ADC eAX Iv */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			op_adc16(cpu);
+			cpu->regs.wordregs[regax] = cpu->res16;
+			break;
+
+		case 0x16:	/* 16 PUSH cpu->segregs[regss] */
+			push(cpu, cpu->segregs[regss]);
+			break;
+
+		case 0x17:	/* 17 POP cpu->segregs[regss] */
+			cpu->oper1 = pop(cpu);
+			if (CPU_PM(cpu)) {
+				load_descriptor(cpu, regss, cpu->oper1);
+			}
+			cpu->segregs[regss] = cpu->oper1;
+			break;
+
+		case 0x18:	/* 18 SBB Eb Gb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getreg8(cpu, cpu->reg);
+			op_sbb8(cpu);
+			writerm8(cpu, cpu->rm, cpu->res8);
+			break;
+
+		case 0x19:	/* 19 SBB Ev Gv */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			cpu->oper2 = getreg16(cpu, cpu->reg);
+			op_sbb16(cpu);
+			writerm16(cpu, cpu->rm, cpu->res16);
+			break;
+
+		case 0x1A:	/* 1A SBB Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			cpu->oper2b = readrm8(cpu, cpu->rm);
+			op_sbb8(cpu);
+			putreg8(cpu, cpu->reg, cpu->res8);
+			break;
+
+		case 0x1B:	/* 1B SBB Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			cpu->oper2 = readrm16(cpu, cpu->rm);
+			op_sbb16(cpu);
+			putreg16(cpu, cpu->reg, cpu->res16);
+			break;
+
+		case 0x1C:	/* 1C SBB cpu->regs.byteregs[regal] Ib */
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			op_sbb8(cpu);
+			cpu->regs.byteregs[regal] = cpu->res8;
+			break;
+
+		case 0x1D:	/* 1D SBB eAX Iv */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			op_sbb16(cpu);
+			cpu->regs.wordregs[regax] = cpu->res16;
+			break;
+
+		case 0x1E:	/* 1E PUSH cpu->segregs[regds] */
+			push(cpu, cpu->segregs[regds]);
+			break;
+
+		case 0x1F:	/* 1F POP cpu->segregs[regds] */
+			cpu->oper1 = pop(cpu);
+			if (CPU_PM(cpu)) {
+				load_descriptor(cpu, regds, cpu->oper1);
+			}
+			cpu->segregs[regds] = cpu->oper1;
+			break;
+
+		case 0x20:	/* 20 AND Eb Gb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getreg8(cpu, cpu->reg);
+			op_and8(cpu);
+			writerm8(cpu, cpu->rm, cpu->res8);
+			break;
+
+		case 0x21:	/* 21 AND Ev Gv */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			cpu->oper2 = getreg16(cpu, cpu->reg);
+			op_and16(cpu);
+			writerm16(cpu, cpu->rm, cpu->res16);
+			break;
+
+		case 0x22:	/* 22 AND Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			cpu->oper2b = readrm8(cpu, cpu->rm);
+			op_and8(cpu);
+			putreg8(cpu, cpu->reg, cpu->res8);
+			break;
+
+		case 0x23:	/* 23 AND Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			cpu->oper2 = readrm16(cpu, cpu->rm);
+			op_and16(cpu);
+			putreg16(cpu, cpu->reg, cpu->res16);
+			break;
+
+		case 0x24:	/* 24 AND cpu->regs.byteregs[regal] Ib */
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			op_and8(cpu);
+			cpu->regs.byteregs[regal] = cpu->res8;
+			break;
+
+		case 0x25:	/* 25 AND eAX Iv */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			op_and16(cpu);
+			cpu->regs.wordregs[regax] = cpu->res16;
+			break;
+
+		case 0x27:	/* 27 DAA */
+		{
+			uint8_t old_al;
+			old_al = cpu->regs.byteregs[regal];
+			if (((cpu->regs.byteregs[regal] & 0x0F) > 9) || cpu->af) {
+				cpu->oper1 = (uint16_t)cpu->regs.byteregs[regal] + 0x06;
+				cpu->regs.byteregs[regal] = cpu->oper1 & 0xFF;
+				if (cpu->oper1 & 0xFF00) cpu->cf = 1;
+				if ((cpu->oper1 & 0x000F) < (old_al & 0x0F)) cpu->af = 1;
+			}
+			if (((cpu->regs.byteregs[regal] & 0xF0) > 0x90) || cpu->cf) {
+				cpu->oper1 = (uint16_t)cpu->regs.byteregs[regal] + 0x60;
+				cpu->regs.byteregs[regal] = cpu->oper1 & 0xFF;
+				if (cpu->oper1 & 0xFF00) cpu->cf = 1; else cpu->cf = 0;
+			}
+			flag_szp8(cpu, cpu->regs.byteregs[regal]);
+			break;
+		}
+
+		case 0x28:	/* 28 SUB Eb Gb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getreg8(cpu, cpu->reg);
+			op_sub8(cpu);
+			writerm8(cpu, cpu->rm, cpu->res8);
+			break;
+
+		case 0x29:	/* 29 SUB Ev Gv */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			cpu->oper2 = getreg16(cpu, cpu->reg);
+			op_sub16(cpu);
+			writerm16(cpu, cpu->rm, cpu->res16);
+			break;
+
+		case 0x2A:	/* 2A SUB Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			cpu->oper2b = readrm8(cpu, cpu->rm);
+			op_sub8(cpu);
+			putreg8(cpu, cpu->reg, cpu->res8);
+			break;
+
+		case 0x2B:	/* 2B SUB Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			cpu->oper2 = readrm16(cpu, cpu->rm);
+			op_sub16(cpu);
+			putreg16(cpu, cpu->reg, cpu->res16);
+			break;
+
+		case 0x2C:	/* 2C SUB cpu->regs.byteregs[regal] Ib */
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			op_sub8(cpu);
+			cpu->regs.byteregs[regal] = cpu->res8;
+			break;
+
+		case 0x2D:	/* 2D SUB eAX Iv */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			op_sub16(cpu);
+			cpu->regs.wordregs[regax] = cpu->res16;
+			break;
+
+		case 0x2F:	/* 2F DAS */
+		{
+			uint8_t old_al;
+			old_al = cpu->regs.byteregs[regal];
+			if (((cpu->regs.byteregs[regal] & 0x0F) > 9) || cpu->af) {
+				cpu->oper1 = (uint16_t)cpu->regs.byteregs[regal] - 0x06;
+				cpu->regs.byteregs[regal] = cpu->oper1 & 0xFF;
+				if (cpu->oper1 & 0xFF00) cpu->cf = 1;
+				if ((cpu->oper1 & 0x000F) >= (old_al & 0x0F)) cpu->af = 1;
+			}
+			if (((cpu->regs.byteregs[regal] & 0xF0) > 0x90) || cpu->cf) {
+				cpu->oper1 = (uint16_t)cpu->regs.byteregs[regal] - 0x60;
+				cpu->regs.byteregs[regal] = cpu->oper1 & 0xFF;
+				if (cpu->oper1 & 0xFF00) cpu->cf = 1; else cpu->cf = 0;
+			}
+			flag_szp8(cpu, cpu->regs.byteregs[regal]);
+			break;
+		}
+
+		case 0x30:	/* 30 XOR Eb Gb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getreg8(cpu, cpu->reg);
+			op_xor8(cpu);
+			writerm8(cpu, cpu->rm, cpu->res8);
+			break;
+
+		case 0x31:	/* 31 XOR Ev Gv */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			cpu->oper2 = getreg16(cpu, cpu->reg);
+			op_xor16(cpu);
+			writerm16(cpu, cpu->rm, cpu->res16);
+			break;
+
+		case 0x32:	/* 32 XOR Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			cpu->oper2b = readrm8(cpu, cpu->rm);
+			op_xor8(cpu);
+			putreg8(cpu, cpu->reg, cpu->res8);
+			break;
+
+		case 0x33:	/* 33 XOR Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			cpu->oper2 = readrm16(cpu, cpu->rm);
+			op_xor16(cpu);
+			putreg16(cpu, cpu->reg, cpu->res16);
+			break;
+
+		case 0x34:	/* 34 XOR cpu->regs.byteregs[regal] Ib */
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			op_xor8(cpu);
+			cpu->regs.byteregs[regal] = cpu->res8;
+			break;
+
+		case 0x35:	/* 35 XOR eAX Iv */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			op_xor16(cpu);
+			cpu->regs.wordregs[regax] = cpu->res16;
+			break;
+
+		case 0x37:	/* 37 AAA ASCII */
+			if (((cpu->regs.byteregs[regal] & 0xF) > 9) || (cpu->af == 1)) {
+				cpu->regs.wordregs[regax] = cpu->regs.wordregs[regax] + 0x106;
+				cpu->af = 1;
+				cpu->cf = 1;
+			}
+			else {
+				cpu->af = 0;
+				cpu->cf = 0;
+			}
+
+			cpu->regs.byteregs[regal] = cpu->regs.byteregs[regal] & 0xF;
+			break;
+
+		case 0x38:	/* 38 CMP Eb Gb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getreg8(cpu, cpu->reg);
+			op_cmp8(cpu);
+			break;
+
+		case 0x39:	/* 39 CMP Ev Gv */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			cpu->oper2 = getreg16(cpu, cpu->reg);
+			op_cmp16(cpu);
+			break;
+
+		case 0x3A:	/* 3A CMP Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			cpu->oper2b = readrm8(cpu, cpu->rm);
+			op_cmp8(cpu);
+			break;
+
+		case 0x3B:	/* 3B CMP Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			cpu->oper2 = readrm16(cpu, cpu->rm);
+			op_cmp16(cpu);
+			break;
+
+		case 0x3C:	/* 3C CMP cpu->regs.byteregs[regal] Ib */
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			op_cmp8(cpu);
+			break;
+
+		case 0x3D:	/* 3D CMP eAX Iv */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			op_cmp16(cpu);
+			break;
+
+		case 0x3F:	/* 3F AAS ASCII */
+			if (((cpu->regs.byteregs[regal] & 0xF) > 9) || (cpu->af == 1)) {
+				cpu->regs.wordregs[regax] = cpu->regs.wordregs[regax] - 6;
+				cpu->regs.byteregs[regah] = cpu->regs.byteregs[regah] - 1;
+				cpu->af = 1;
+				cpu->cf = 1;
+			}
+			else {
+				cpu->af = 0;
+				cpu->cf = 0;
+			}
+
+			cpu->regs.byteregs[regal] = cpu->regs.byteregs[regal] & 0xF;
+			break;
+
+		case 0x40:	/* 40 INC eAX */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			op_inc16(cpu);
+			cpu->regs.wordregs[regax] = cpu->res16;
+			break;
+
+		case 0x41:	/* 41 INC eCX */
+			cpu->oper1 = cpu->regs.wordregs[regcx];
+			op_inc16(cpu);
+			cpu->regs.wordregs[regcx] = cpu->res16;
+			break;
+
+		case 0x42:	/* 42 INC eDX */
+			cpu->oper1 = cpu->regs.wordregs[regdx];
+			op_inc16(cpu);
+			cpu->regs.wordregs[regdx] = cpu->res16;
+			break;
+
+		case 0x43:	/* 43 INC eBX */
+			cpu->oper1 = cpu->regs.wordregs[regbx];
+			op_inc16(cpu);
+			cpu->regs.wordregs[regbx] = cpu->res16;
+			break;
+
+		case 0x44:	/* 44 INC eSP */
+			cpu->oper1 = cpu->regs.wordregs[regsp];
+			op_inc16(cpu);
+			cpu->regs.wordregs[regsp] = cpu->res16;
+			break;
+
+		case 0x45:	/* 45 INC eBP */
+			cpu->oper1 = cpu->regs.wordregs[regbp];
+			op_inc16(cpu);
+			cpu->regs.wordregs[regbp] = cpu->res16;
+			break;
+
+		case 0x46:	/* 46 INC eSI */
+			cpu->oper1 = cpu->regs.wordregs[regsi];
+			op_inc16(cpu);
+			cpu->regs.wordregs[regsi] = cpu->res16;
+			break;
+
+		case 0x47:	/* 47 INC eDI */
+			cpu->oper1 = cpu->regs.wordregs[regdi];
+			op_inc16(cpu);
+			cpu->regs.wordregs[regdi] = cpu->res16;
+			break;
+
+		case 0x48:	/* 48 DEC eAX */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			op_dec16(cpu);
+			cpu->regs.wordregs[regax] = cpu->res16;
+			break;
+
+		case 0x49:	/* 49 DEC eCX */
+			cpu->oper1 = cpu->regs.wordregs[regcx];
+			op_dec16(cpu);
+			cpu->regs.wordregs[regcx] = cpu->res16;
+			break;
+
+		case 0x4A:	/* 4A DEC eDX */
+			cpu->oper1 = cpu->regs.wordregs[regdx];
+			op_dec16(cpu);
+			cpu->regs.wordregs[regdx] = cpu->res16;
+			break;
+
+		case 0x4B:	/* 4B DEC eBX */
+			cpu->oper1 = cpu->regs.wordregs[regbx];
+			op_dec16(cpu);
+			cpu->regs.wordregs[regbx] = cpu->res16;
+			break;
+
+		case 0x4C:	/* 4C DEC eSP */
+			cpu->oper1 = cpu->regs.wordregs[regsp];
+			op_dec16(cpu);
+			cpu->regs.wordregs[regsp] = cpu->res16;
+			break;
+
+		case 0x4D:	/* 4D DEC eBP */
+			cpu->oper1 = cpu->regs.wordregs[regbp];
+			op_dec16(cpu);
+			cpu->regs.wordregs[regbp] = cpu->res16;
+			break;
+
+		case 0x4E:	/* 4E DEC eSI */
+			cpu->oper1 = cpu->regs.wordregs[regsi];
+			op_dec16(cpu);
+			cpu->regs.wordregs[regsi] = cpu->res16;
+			break;
+
+		case 0x4F:	/* 4F DEC eDI */
+			cpu->oper1 = cpu->regs.wordregs[regdi];
+			op_dec16(cpu);
+			cpu->regs.wordregs[regdi] = cpu->res16;
+			break;
+
+		case 0x50:	/* 50 PUSH eAX */
+			push(cpu, cpu->regs.wordregs[regax]);
+			break;
+
+		case 0x51:	/* 51 PUSH eCX */
+			push(cpu, cpu->regs.wordregs[regcx]);
+			break;
+
+		case 0x52:	/* 52 PUSH eDX */
+			push(cpu, cpu->regs.wordregs[regdx]);
+			break;
+
+		case 0x53:	/* 53 PUSH eBX */
+			push(cpu, cpu->regs.wordregs[regbx]);
+			break;
+
+		case 0x54:	/* 54 PUSH eSP */
+			push(cpu, cpu->regs.wordregs[regsp]);
+			break;
+
+		case 0x55:	/* 55 PUSH eBP */
+			push(cpu, cpu->regs.wordregs[regbp]);
+			break;
+
+		case 0x56:	/* 56 PUSH eSI */
+			push(cpu, cpu->regs.wordregs[regsi]);
+			break;
+
+		case 0x57:	/* 57 PUSH eDI */
+			push(cpu, cpu->regs.wordregs[regdi]);
+			break;
+
+		case 0x58:	/* 58 POP eAX */
+			cpu->regs.wordregs[regax] = pop(cpu);
+			break;
+
+		case 0x59:	/* 59 POP eCX */
+			cpu->regs.wordregs[regcx] = pop(cpu);
+			break;
+
+		case 0x5A:	/* 5A POP eDX */
+			cpu->regs.wordregs[regdx] = pop(cpu);
+			break;
+
+		case 0x5B:	/* 5B POP eBX */
+			cpu->regs.wordregs[regbx] = pop(cpu);
+			break;
+
+		case 0x5C:	/* 5C POP eSP */
+			cpu->regs.wordregs[regsp] = pop(cpu);
+			break;
+
+		case 0x5D:	/* 5D POP eBP */
+			cpu->regs.wordregs[regbp] = pop(cpu);
+			break;
+
+		case 0x5E:	/* 5E POP eSI */
+			cpu->regs.wordregs[regsi] = pop(cpu);
+			break;
+
+		case 0x5F:	/* 5F POP eDI */
+			cpu->regs.wordregs[regdi] = pop(cpu);
+			break;
+
+		case 0x60:	/* 60 PUSHA */
+			cpu->oldsp = cpu->regs.wordregs[regsp];
+			push(cpu, cpu->regs.wordregs[regax]);
+			push(cpu, cpu->regs.wordregs[regcx]);
+			push(cpu, cpu->regs.wordregs[regdx]);
+			push(cpu, cpu->regs.wordregs[regbx]);
+			push(cpu, cpu->oldsp);
+			push(cpu, cpu->regs.wordregs[regbp]);
+			push(cpu, cpu->regs.wordregs[regsi]);
+			push(cpu, cpu->regs.wordregs[regdi]);
+			break;
+
+		case 0x61:	/* 61 POPA */
+			cpu->regs.wordregs[regdi] = pop(cpu);
+			cpu->regs.wordregs[regsi] = pop(cpu);
+			cpu->regs.wordregs[regbp] = pop(cpu);
+			cpu->regs.wordregs[regsp] += 2;
+			cpu->regs.wordregs[regbx] = pop(cpu);
+			cpu->regs.wordregs[regdx] = pop(cpu);
+			cpu->regs.wordregs[regcx] = pop(cpu);
+			cpu->regs.wordregs[regax] = pop(cpu);
+			break;
+
+		case 0x62: /* 62 BOUND Gv, Ev */
+			modregrm(cpu);
+			if (cpu->mode == 3) {
+				cpu_intcall(cpu, 6);
+				break;
+			}
+			if ((cpu->disp16 & 0xFFFF) >= 0xFFFD) {
+				cpu_intcall(cpu, 13);
+				break;
+			}
+			getea(cpu, cpu->rm);
+			if (signext32(getreg16(cpu, cpu->reg)) < signext32(cpu_readw(cpu, cpu->ea))) {
+				cpu_intcall(cpu, 5); //bounds check exception
+			}
+			else {
+				cpu->ea += 2;
+				if (signext32(getreg16(cpu, cpu->reg)) > signext32(cpu_readw(cpu, cpu->ea))) {
+					cpu_intcall(cpu, 5); //bounds check exception
+				}
+			}
+			break;
+
+		case 0x63: /* ARPL Ew, Gw */
+			debug_log(DEBUG_INFO, "[CPU] 286 Opcode: ARPL (63h)\n");
+
+			if (!CPU_PM(cpu)) {
+				cpu_intcall(cpu, 6);
+			}
+			else {
+				modregrm(cpu);
+
+				uint16_t dest = readrm16(cpu, cpu->rm);
+				uint16_t src = getreg16(cpu, cpu->reg);
+
+				uint8_t dest_rpl = dest & 0x3;
+				uint8_t src_rpl = src & 0x3;
+
+				if (dest_rpl < src_rpl) {
+					cpu->zf = 1;
+					dest = (dest & 0xFFFC) | src_rpl;
+					writerm16(cpu, cpu->rm, dest);
+				}
+				else {
+					cpu->zf = 0;
+				}
+			}
+			break;
+
+		case 0x68:	/* 68 PUSH Iv */
+			push(cpu, getcode16(cpu, cpu->ip));
+			StepIP(cpu, 2);
+			break;
+
+		case 0x69:	/* 69 IMUL Gv Ev Iv */
+			modregrm(cpu);
+			cpu->temp1 = readrm16(cpu, cpu->rm);
+			cpu->temp2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			if ((cpu->temp1 & 0x8000L) == 0x8000L) {
+				cpu->temp1 = cpu->temp1 | 0xFFFF0000L;
+			}
+
+			if ((cpu->temp2 & 0x8000L) == 0x8000L) {
+				cpu->temp2 = cpu->temp2 | 0xFFFF0000L;
+			}
+
+			cpu->temp3 = (uint32_t)((int32_t)cpu->temp1 * (int32_t)cpu->temp2);
+			putreg16(cpu, cpu->reg, cpu->temp3 & 0xFFFFL);
+			if (cpu->temp3 & 0xFFFF0000L) {
+				cpu->cf = 1;
+				cpu->of = 1;
+			}
+			else {
+				cpu->cf = 0;
+				cpu->of = 0;
+			}
+			break;
+
+		case 0x6A:	/* 6A PUSH Ib */
+			push(cpu, (uint16_t)signext(getcode8(cpu, cpu->ip)));
+			StepIP(cpu, 1);
+			break;
+
+		case 0x6B:	/* 6B IMUL Gv Eb Ib */
+			modregrm(cpu);
+			cpu->temp1 = readrm16(cpu, cpu->rm);
+			cpu->temp2 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if ((cpu->temp1 & 0x8000L) == 0x8000L) {
+				cpu->temp1 = cpu->temp1 | 0xFFFF0000L;
+			}
+
+			if ((cpu->temp2 & 0x8000L) == 0x8000L) {
+				cpu->temp2 = cpu->temp2 | 0xFFFF0000L;
+			}
+
+			cpu->temp3 = (uint32_t)((int32_t)cpu->temp1 * (int32_t)cpu->temp2);
+			putreg16(cpu, cpu->reg, cpu->temp3 & 0xFFFFL);
+			if (cpu->temp3 & 0xFFFF0000L) {
+				cpu->cf = 1;
+				cpu->of = 1;
+			}
+			else {
+				cpu->cf = 0;
+				cpu->of = 0;
+			}
+			break;
+
+		case 0x6C:	/* 6E INSB */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repIns, 1);
+
+			putmem8(cpu, reges, cpu->regs.wordregs[regdi], port_read(cpu, cpu->regs.wordregs[regdx]));
+			if (cpu->df) {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
+			}
+			else {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0x6D:	/* 6F INSW */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repIns, 2);
+
+			putmem16(cpu, reges, cpu->regs.wordregs[regdi], port_readw(cpu, cpu->regs.wordregs[regdx]));
+			if (cpu->df) {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
+			}
+			else {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0x6E:	/* 6E OUTSB */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repOuts, 1);
+
+			port_write(cpu, cpu->regs.wordregs[regdx], getmem8(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi]));
+			if (cpu->df) {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 1;
+			}
+			else {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 1;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0x6F:	/* 6F OUTSW */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repOuts, 2);
+
+			port_writew(cpu, cpu->regs.wordregs[regdx], getmem16(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi]));
+			if (cpu->df) {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 2;
+			}
+			else {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 2;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0x70:	/* 70 JO Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (flag_lazyOF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x71:	/* 71 JNO Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (!flag_lazyOF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x72:	/* 72 JB Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (flag_lazyCF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x73:	/* 73 JNB Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (!flag_lazyCF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x74:	/* 74 JZ Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (flag_lazyZF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x75:	/* 75 JNZ Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (!flag_lazyZF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x76:	/* 76 JBE Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (flag_lazyCF(cpu) || flag_lazyZF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x77:	/* 77 JA Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (!flag_lazyCF(cpu) && !flag_lazyZF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x78:	/* 78 JS Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (flag_lazySF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x79:	/* 79 JNS Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (!flag_lazySF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x7A:	/* 7A JPE Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (flag_lazyPF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x7B:	/* 7B JPO Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (!flag_lazyPF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x7C:	/* 7C JL Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (flag_lazySF(cpu) != flag_lazyOF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x7D:	/* 7D JGE Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (flag_lazySF(cpu) == flag_lazyOF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x7E:	/* 7E JLE Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if ((flag_lazySF(cpu) != flag_lazyOF(cpu)) || flag_lazyZF(cpu)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x7F:	/* 7F JG Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (!flag_lazyZF(cpu) && (flag_lazySF(cpu) == flag_lazyOF(cpu))) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0x80:
+		case 0x82:	/* 80/82 GRP1 Eb Ib */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			switch (cpu->reg) {
+			case 0:
+				op_add8(cpu);
+				break;
+			case 1:
+				op_or8(cpu);
+				break;
+			case 2:
+				op_adc8(cpu);
+				break;
+			case 3:
+				op_sbb8(cpu);
+				break;
+			case 4:
+				op_and8(cpu);
+				break;
+			case 5:
+				op_sub8(cpu);
+				break;
+			case 6:
+				op_xor8(cpu);
+				break;
+			case 7:
+				op_cmp8(cpu);
+				break;
+			default:
+				break;	/* to avoid compiler warnings */
+			}
+
+			if (cpu->reg < 7) {
+				writerm8(cpu, cpu->rm, cpu->res8);
+			}
+			break;
+
+		case 0x81:	/* 81 GRP1 Ev Iv */
+		case 0x83:	/* 83 GRP1 Ev Ib */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			if (cpu->opcode == 0x81) {
+				cpu->oper2 = getcode16(cpu, cpu->ip);
+				StepIP(cpu, 2);
+			}
+			else {
+				cpu->oper2 = signext(getcode8(cpu, cpu->ip));
+				StepIP(cpu, 1);
+			}
+
+			switch (cpu->reg) {
+			case 0:
+				op_add16(cpu);
+				break;
+			case 1:
+				op_or16(cpu);
+				break;
+			case 2:
+				op_adc16(cpu);
+				break;
+			case 3:
+				op_sbb16(cpu);
+				break;
+			case 4:
+				op_and16(cpu);
+				break;
+			case 5:
+				op_sub16(cpu);
+				break;
+			case 6:
+				op_xor16(cpu);
+				break;
+			case 7:
+				op_cmp16(cpu);
+				break;
+			default:
+				break;	/* to avoid compiler warnings */
+			}
+
+			if (cpu->reg < 7) {
+				writerm16(cpu, cpu->rm, cpu->res16);
+			}
+			break;
+
+		case 0x84:	/* 84 TEST Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			cpu->oper2b = readrm8(cpu, cpu->rm);
+			op_test8(cpu);
+			break;
+
+		case 0x85:	/* 85 TEST Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			cpu->oper2 = readrm16(cpu, cpu->rm);
+			op_test16(cpu);
+			break;
+
+		case 0x86:	/* 86 XCHG Gb Eb */
+			modregrm(cpu);
+			cpu->oper1b = getreg8(cpu, cpu->reg);
+			putreg8(cpu, cpu->reg, readrm8(cpu, cpu->rm));
+			writerm8(cpu, cpu->rm, cpu->oper1b);
+			break;
+
+		case 0x87:	/* 87 XCHG Gv Ev */
+			modregrm(cpu);
+			cpu->oper1 = getreg16(cpu, cpu->reg);
+			putreg16(cpu, cpu->reg, readrm16(cpu, cpu->rm));
+			writerm16(cpu, cpu->rm, cpu->oper1);
+			break;
+
+		case 0x88:	/* 88 MOV Eb Gb */
+			modregrm(cpu);
+			writerm8(cpu, cpu->rm, getreg8(cpu, cpu->reg));
+			break;
+
+		case 0x89:	/* 89 MOV Ev Gv */
+			modregrm(cpu);
+			writerm16(cpu, cpu->rm, getreg16(cpu, cpu->reg));
+			break;
+
+		case 0x8A:	/* 8A MOV Gb Eb */
+			modregrm(cpu);
+			putreg8(cpu, cpu->reg, readrm8(cpu, cpu->rm));
+			break;
+
+		case 0x8B:	/* 8B MOV Gv Ev */
+			modregrm(cpu);
+			putreg16(cpu, cpu->reg, readrm16(cpu, cpu->rm));
+			break;
+
+		case 0x8C:	/* 8C MOV Ew Sw */
+			modregrm(cpu);
+			writerm16(cpu, cpu->rm, getsegreg(cpu, cpu->reg));
+			break;
+
+		case 0x8D:	/* 8D LEA Gv M */
+			modregrm(cpu);
+			if (cpu->mode == 3) {
+				cpu_intcall(cpu, 6);
+				break;
+			}
+			getea(cpu, cpu->rm);
+			putreg16(cpu, cpu->reg, (uint16_t)(cpu->ea - get_seg_address(cpu, cpu->usesegreg, 0)));
+			break;
+
+		case 0x8E:	/* 8E MOV Sw Ew */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			if (CPU_PM(cpu)) {
+				load_descriptor(cpu, cpu->reg, cpu->oper1);
+			}
+			putsegreg(cpu, cpu->reg, cpu->oper1);
+			break;
+
+		case 0x8F:	/* 8F POP Ev */
+			modregrm(cpu);
+			writerm16(cpu, cpu->rm, pop(cpu));
+			break;
+
+		case 0x90:	/* 90 NOP */
+			break;
+
+		case 0x91:	/* 91 XCHG eCX eAX */
+			cpu->oper1 = cpu->regs.wordregs[regcx];
+			cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regax];
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			break;
+
+		case 0x92:	/* 92 XCHG eDX eAX */
+			cpu->oper1 = cpu->regs.wordregs[regdx];
+			cpu->regs.wordregs[regdx] = cpu->regs.wordregs[regax];
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			break;
+
+		case 0x93:	/* 93 XCHG eBX eAX */
+			cpu->oper1 = cpu->regs.wordregs[regbx];
+			cpu->regs.wordregs[regbx] = cpu->regs.wordregs[regax];
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			break;
+
+		case 0x94:	/* 94 XCHG eSP eAX */
+			cpu->oper1 = cpu->regs.wordregs[regsp];
+			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regax];
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			break;
+
+		case 0x95:	/* 95 XCHG eBP eAX */
+			cpu->oper1 = cpu->regs.wordregs[regbp];
+			cpu->regs.wordregs[regbp] = cpu->regs.wordregs[regax];
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			break;
+
+		case 0x96:	/* 96 XCHG eSI eAX */
+			cpu->oper1 = cpu->regs.wordregs[regsi];
+			cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regax];
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			break;
+
+		case 0x97:	/* 97 XCHG eDI eAX */
+			cpu->oper1 = cpu->regs.wordregs[regdi];
+			cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regax];
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			break;
+
+		case 0x98:	/* 98 CBW */
+			if ((cpu->regs.byteregs[regal] & 0x80) == 0x80) {
+				cpu->regs.byteregs[regah] = 0xFF;
+			}
+			else {
+				cpu->regs.byteregs[regah] = 0;
+			}
+			break;
+
+		case 0x99:	/* 99 CWD */
+			if ((cpu->regs.byteregs[regah] & 0x80) == 0x80) {
+				cpu->regs.wordregs[regdx] = 0xFFFF;
+			}
+			else {
+				cpu->regs.wordregs[regdx] = 0;
+			}
+			break;
+
+		case 0x9A:	/* 9A CALL Ap */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			push(cpu, cpu->segregs[regcs]);
+			push(cpu, cpu->ip);
+			cpu->ip = cpu->oper1;
+			cpu->segregs[regcs] = cpu->oper2;
+			if (CPU_PM(cpu)) {
+				load_descriptor(cpu, regcs, cpu->segregs[regcs]);
+			}
+			break;
+
+		case 0x9B:	/* 9B WAIT */
+			break;
+
+		case 0x9C:	/* 9C PUSHF */
+			if (CPU_PM(cpu)) {
+				push(cpu, makeflagsword(cpu));
+			}
+			else {
+				push(cpu, makeflagsword(cpu) & 0x0FFF);
+			}
+			break;
+
+		case 0x9D:    /* 9D POPF */
+		{
+			uint16_t new_flags = pop(cpu);
+			uint16_t old_flags = makeflagsword(cpu);
+			uint8_t cpl = cpu->cpl;
+			uint8_t iopl = (old_flags >> 12) & 3;
+
+			if (CPU_PM(cpu)) {
+				if (cpl > iopl) {
+					if (new_flags & 0x0200) {
+						old_flags |= 0x0200;
+					}
+					else {
+						old_flags &= ~0x0200;
+					}
+					new_flags = (new_flags & ~0x0200) | (old_flags & 0x0200);
+				}
+
+				if (cpl != 0) {
+					new_flags = (new_flags & ~0x3000) | (old_flags & 0x3000);
+				}
+
+				new_flags &= 0x72FF;
+				new_flags |= 0x0002;
+			}
+			else {
+				new_flags &= 0x72FF;
+				new_flags |= 0xF002;
+			}
+
+			decodeflagsword(cpu, new_flags);
+			break;
+		}
+		case 0x9E:	/* 9E SAHF */
+			decodeflagsword(cpu, (makeflagsword(cpu) & 0xFF00) | cpu->regs.byteregs[regah]);
+			break;
+
+		case 0x9F:	/* 9F LAHF */
+			cpu->regs.byteregs[regah] = makeflagsword(cpu) & 0xFF;
+			break;
+
+		case 0xA0:	/* A0 MOV cpu->regs.byteregs[regal] Ob */
+			cpu->regs.byteregs[regal] = getmem8(cpu, cpu->usesegreg, getcode16(cpu, cpu->ip));
+			StepIP(cpu, 2);
+			break;
+
+		case 0xA1:	/* A1 MOV eAX Ov */
+			cpu->oper1 = getmem16(cpu, cpu->usesegreg, getcode16(cpu, cpu->ip));
+			StepIP(cpu, 2);
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			break;
+
+		case 0xA2:	/* A2 MOV Ob cpu->regs.byteregs[regal] */
+			putmem8(cpu, cpu->usesegreg, getcode16(cpu, cpu->ip), cpu->regs.byteregs[regal]);
+			StepIP(cpu, 2);
+			break;
+
+		case 0xA3:	/* A3 MOV Ov eAX */
+			putmem16(cpu, cpu->usesegreg, getcode16(cpu, cpu->ip), cpu->regs.wordregs[regax]);
+			StepIP(cpu, 2);
+			break;
+
+		case 0xA4:	/* A4 MOVSB */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repMovs, 1);
+
+			putmem8(cpu, reges, cpu->regs.wordregs[regdi], getmem8(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi]));
+			if (cpu->df) {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 1;
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
+			}
+			else {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 1;
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xA5:	/* A5 MOVSW */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repMovs, 2);
+
+			putmem16(cpu, reges, cpu->regs.wordregs[regdi], getmem16(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi]));
+			if (cpu->df) {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 2;
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
+			}
+			else {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 2;
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xA6:	/* A6 CMPSB */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->oper1b = getmem8(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi]);
+			cpu->oper2b = getmem8(cpu, reges, cpu->regs.wordregs[regdi]);
+			if (cpu->df) {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 1;
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
+			}
+			else {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 1;
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
+			}
+
+			flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			if ((cpu->reptype == 1) && !cpu->zf) {
+				break;
+			}
+			else if ((cpu->reptype == 2) && (cpu->zf == 1)) {
+				break;
+			}
+
+			loopcount++;
+			if (!cpu->reptype) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xA7:	/* A7 CMPSW */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->oper1 = getmem16(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi]);
+			cpu->oper2 = getmem16(cpu, reges, cpu->regs.wordregs[regdi]);
+			if (cpu->df) {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 2;
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
+			}
+			else {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 2;
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
+			}
+
+			flag_sub16(cpu, cpu->oper1, cpu->oper2);
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			if ((cpu->reptype == 1) && !cpu->zf) {
+				break;
+			}
+
+			if ((cpu->reptype == 2) && (cpu->zf == 1)) {
+				break;
+			}
+
+			loopcount++;
+			if (!cpu->reptype) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xA8:	/* A8 TEST cpu->regs.byteregs[regal] Ib */
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			op_test8(cpu);
+			break;
+
+		case 0xA9:	/* A9 TEST eAX Iv */
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			op_test16(cpu);
+			break;
+
+		case 0xAA:	/* AA STOSB */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repStos, 1);
+
+			putmem8(cpu, reges, cpu->regs.wordregs[regdi], cpu->regs.byteregs[regal]);
+			if (cpu->df) {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
+			}
+			else {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xAB:	/* AB STOSW */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repStos, 2);
+
+			putmem16(cpu, reges, cpu->regs.wordregs[regdi], cpu->regs.wordregs[regax]);
+			if (cpu->df) {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
+			}
+			else {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xAC:	/* AC LODSB */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repLods, 1);
+
+			cpu->regs.byteregs[regal] = getmem8(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi]);
+			if (cpu->df) {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 1;
+			}
+			else {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 1;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xAD:	/* AD LODSW */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+			REP_BLOCK(cpu_repLods, 2);
+
+			cpu->oper1 = getmem16(cpu, cpu->usesegreg, cpu->regs.wordregs[regsi]);
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			if (cpu->df) {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] - 2;
+			}
+			else {
+				cpu->regs.wordregs[regsi] = cpu->regs.wordregs[regsi] + 2;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			loopcount++;
+			if (!cpu->reptype || (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xAE:	/* AE SCASB */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->oper1b = cpu->regs.byteregs[regal];
+			cpu->oper2b = getmem8(cpu, reges, cpu->regs.wordregs[regdi]);
+			flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
+			if (cpu->df) {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 1;
+			}
+			else {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 1;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			if ((cpu->reptype == 1) && !cpu->zf) {
+				break;
+			}
+			else if ((cpu->reptype == 2) && (cpu->zf == 1)) {
+				break;
+			}
+
+			loopcount++;
+			if (!cpu->reptype) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xAF:	/* AF SCASW */
+			if (cpu->reptype && (cpu->regs.wordregs[regcx] == 0)) {
+				break;
+			}
+
+			cpu->oper1 = cpu->regs.wordregs[regax];
+			cpu->oper2 = getmem16(cpu, reges, cpu->regs.wordregs[regdi]);
+			flag_sub16(cpu, cpu->oper1, cpu->oper2);
+			if (cpu->df) {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] - 2;
+			}
+			else {
+				cpu->regs.wordregs[regdi] = cpu->regs.wordregs[regdi] + 2;
+			}
+
+			if (cpu->reptype) {
+				cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			}
+
+			if ((cpu->reptype == 1) && !cpu->zf) {
+				break;
+			}
+			else if ((cpu->reptype == 2) && (cpu->zf == 1)) { //did i fix a typo bug? this used to be & instead of &&
+				break;
+			}
+
+			loopcount++;
+			if (!cpu->reptype) {
+				break;
+			}
+
+			cpu->ip = firstip;
+			break;
+
+		case 0xB0:	/* B0 MOV cpu->regs.byteregs[regal] Ib */
+			cpu->regs.byteregs[regal] = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			break;
+
+		case 0xB1:	/* B1 MOV cpu->regs.byteregs[regcl] Ib */
+			cpu->regs.byteregs[regcl] = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			break;
+
+		case 0xB2:	/* B2 MOV cpu->regs.byteregs[regdl] Ib */
+			cpu->regs.byteregs[regdl] = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			break;
+
+		case 0xB3:	/* B3 MOV cpu->regs.byteregs[regbl] Ib */
+			cpu->regs.byteregs[regbl] = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			break;
+
+		case 0xB4:	/* B4 MOV cpu->regs.byteregs[regah] Ib */
+			cpu->regs.byteregs[regah] = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			break;
+
+		case 0xB5:	/* B5 MOV cpu->regs.byteregs[regch] Ib */
+			cpu->regs.byteregs[regch] = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			break;
+
+		case 0xB6:	/* B6 MOV cpu->regs.byteregs[regdh] Ib */
+			cpu->regs.byteregs[regdh] = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			break;
+
+		case 0xB7:	/* B7 MOV cpu->regs.byteregs[regbh] Ib */
+			cpu->regs.byteregs[regbh] = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			break;
+
+		case 0xB8:	/* B8 MOV eAX Iv */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			cpu->regs.wordregs[regax] = cpu->oper1;
+			break;
+
+		case 0xB9:	/* B9 MOV eCX Iv */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			cpu->regs.wordregs[regcx] = cpu->oper1;
+			break;
+
+		case 0xBA:	/* BA MOV eDX Iv */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			cpu->regs.wordregs[regdx] = cpu->oper1;
+			break;
+
+		case 0xBB:	/* BB MOV eBX Iv */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			cpu->regs.wordregs[regbx] = cpu->oper1;
+			break;
+
+		case 0xBC:	/* BC MOV eSP Iv */
+			cpu->regs.wordregs[regsp] = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			break;
+
+		case 0xBD:	/* BD MOV eBP Iv */
+			cpu->regs.wordregs[regbp] = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			break;
+
+		case 0xBE:	/* BE MOV eSI Iv */
+			cpu->regs.wordregs[regsi] = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			break;
+
+		case 0xBF:	/* BF MOV eDI Iv */
+			cpu->regs.wordregs[regdi] = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			break;
+
+		case 0xC0:	/* C0 GRP2 byte imm8 */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			writerm8(cpu, cpu->rm, op_grp2_8(cpu, cpu->oper2b));
+			break;
+
+		case 0xC1:	/* C1 GRP2 word imm8 */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			cpu->oper2 = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			writerm16(cpu, cpu->rm, op_grp2_16(cpu, (uint8_t)cpu->oper2));
+			break;
+
+		case 0xC2:	/* C2 RET Iw */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			cpu->ip = pop(cpu);
+			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regsp] + cpu->oper1;
+			break;
+
+		case 0xC3:	/* C3 RET */
+			cpu->ip = pop(cpu);
+			break;
+
+		case 0xC4:	/* C4 LES Gv Mp */
+			modregrm(cpu);
+			if (cpu->mode == 3) {
+				cpu_intcall(cpu, 6);
+				break;
+			}
+			if ((cpu->disp16 & 0xFFFF) >= 0xFFFD) {
+				cpu_intcall(cpu, 13);
+				break;
+			}
+			getea(cpu, cpu->rm);
+			putreg16(cpu, cpu->reg, cpu_readw(cpu, cpu->ea));
+			cpu->segregs[reges] = cpu_readw(cpu, cpu->ea + 2);
+			if (CPU_PM(cpu)) 
+				load_descriptor(cpu, reges, cpu->segregs[reges]);
+			break;
+
+		case 0xC5:	/* C5 LDS Gv Mp */
+			modregrm(cpu);
+			if (cpu->mode == 3) {
+				cpu_intcall(cpu, 6);
+				break;
+			}
+			if ((cpu->disp16 & 0xFFFF) >= 0xFFFD) {
+				cpu_intcall(cpu, 13);
+				break;
+			}
+			getea(cpu, cpu->rm);
+			putreg16(cpu, cpu->reg, cpu_readw(cpu, cpu->ea));
+			cpu->segregs[regds] = cpu_readw(cpu, cpu->ea + 2);
+			if (CPU_PM(cpu)) 
+				load_descriptor(cpu, regds, cpu->segregs[regds]);
+			break;
+
+		case 0xC6:	/* C6 MOV Eb Ib */
+			modregrm(cpu);
+			writerm8(cpu, cpu->rm, getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			break;
+
+		case 0xC7:	/* C7 MOV Ev Iv */
+			modregrm(cpu);
+			writerm16(cpu, cpu->rm, getcode16(cpu, cpu->ip));
+			StepIP(cpu, 2);
+			break;
+
+		case 0xC8:	/* C8 ENTER */
+			cpu->stacksize = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			cpu->nestlev = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			push(cpu, cpu->regs.wordregs[regbp]);
+			cpu->frametemp = cpu->regs.wordregs[regsp];
+			if (cpu->nestlev) {
+				for (cpu->temp16 = 1; cpu->temp16 < cpu->nestlev; ++cpu->temp16) {
+					cpu->regs.wordregs[regbp] = cpu->regs.wordregs[regbp] - 2;
+					push(cpu, cpu->regs.wordregs[regbp]);
+				}
+
+				push(cpu, cpu->frametemp); //cpu->regs.wordregs[regsp]);
+			}
+
+			cpu->regs.wordregs[regbp] = cpu->frametemp;
+			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regbp] - cpu->stacksize;
+
+			break;
+
+		case 0xC9:	/* C9 LEAVE */
+			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regbp];
+			cpu->regs.wordregs[regbp] = pop(cpu);
+			break;
+
+		case 0xCA:	/* CA RETF Iw */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			cpu->ip = pop(cpu);
+			cpu->segregs[regcs] = pop(cpu);
+			cpu->regs.wordregs[regsp] = cpu->regs.wordregs[regsp] + cpu->oper1;
+			break;
+
+		case 0xCB:	/* CB RETF */
+			cpu->ip = pop(cpu);
+			cpu->segregs[regcs] = pop(cpu);
+			break;
+
+		case 0xCC:	/* CC INT 3 */
+			cpu_intcall(cpu, 3);
+			break;
+
+		case 0xCD:	/* CD INT Ib */
+			cpu->oper1b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			cpu_intcall(cpu, cpu->oper1b);
+			break;
+
+		case 0xCE:	/* CE INTO */
+			if (cpu->of) {
+				cpu_intcall(cpu, 4);
+			}
+			break;
+
+		case 0xCF:	/* CF IRET */
+		{
+			if (CPU_PM(cpu)) {
+				if (makeflagsword(cpu) & 0x4000) {
+					cpu_task_switch(cpu, cpu_readw(cpu, cpu->tr_cache.base), 1);
+					break;
+				}
+				uint16_t t_ip = pop(cpu), t_cs = pop(cpu), t_fl = pop(cpu);
+				if ((t_cs & 3) > (cpu->segregs[regcs] & 3)) {
+					uint16_t t_sp = pop(cpu), t_ss = pop(cpu);
+					load_descriptor(cpu, regss, t_ss);
+					cpu->regs.wordregs[regsp] = t_sp;
+				}
+				load_descriptor(cpu, regcs, t_cs);
+				cpu->ip = t_ip;
+				decodeflagsword(cpu, t_fl);
+			}
+			else {
+				cpu->ip = pop(cpu);
+				cpu->segregs[regcs] = pop(cpu);
+				decodeflagsword(cpu, pop(cpu));
+			}
+			break;
+		}
+
+		case 0xD0:	/* D0 GRP2 Eb 1 */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			writerm8(cpu, cpu->rm, op_grp2_8(cpu, 1));
+			break;
+
+		case 0xD1:	/* D1 GRP2 Ev 1 */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			writerm16(cpu, cpu->rm, op_grp2_16(cpu, 1));
+			break;
+
+		case 0xD2:	/* D2 GRP2 Eb cpu->regs.byteregs[regcl] */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			writerm8(cpu, cpu->rm, op_grp2_8(cpu, cpu->regs.byteregs[regcl]));
+			break;
+
+		case 0xD3:	/* D3 GRP2 Ev cpu->regs.byteregs[regcl] */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			writerm16(cpu, cpu->rm, op_grp2_16(cpu, cpu->regs.byteregs[regcl]));
+			break;
+
+		case 0xD4:	/* D4 AAM I0 */
+			cpu->oper1 = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			if (!cpu->oper1) {
+				cpu_intcall(cpu, 0);
+				break;
+			}	/* division by zero */
+
+			cpu->regs.byteregs[regah] = (cpu->regs.byteregs[regal] / cpu->oper1) & 255;
+			cpu->regs.byteregs[regal] = (cpu->regs.byteregs[regal] % cpu->oper1) & 255;
+			flag_szp16(cpu, cpu->regs.wordregs[regax]);
+			break;
+
+		case 0xD5:	/* D5 AAD I0 */
+			cpu->oper1 = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			cpu->regs.byteregs[regal] = (cpu->regs.byteregs[regah] * cpu->oper1 + cpu->regs.byteregs[regal]) & 255;
+			cpu->regs.byteregs[regah] = 0;
+			flag_szp16(cpu, cpu->regs.byteregs[regah] * cpu->oper1 + cpu->regs.byteregs[regal]);
+			cpu->sf = 0;
+			break;
+
+		case 0xD6:	/* D6 SALC */
+			cpu->regs.byteregs[regal] = cpu->cf ? 0xFF : 0x00;
+			break;
+
+		case 0xD7:	/* D7 XLAT */
+			cpu->regs.byteregs[regal] = getmem8(cpu, cpu->usesegreg, cpu->regs.wordregs[regbx] + cpu->regs.byteregs[regal]);
+			break;
+
+		case 0xD8:
+		case 0xD9:
+		case 0xDA:
+		case 0xDB:
+		case 0xDC:
+		case 0xDE:
+		case 0xDD:
+		case 0xDF:	/* escape to x87 FPU (unsupported) */
+			modregrm(cpu);
+			break;
+
+		case 0xE0:	/* E0 LOOPNZ Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			if ((cpu->regs.wordregs[regcx]) && !cpu->zf) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0xE1:	/* E1 LOOPZ Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			if (cpu->regs.wordregs[regcx] && (cpu->zf == 1)) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0xE2:	/* E2 LOOP Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			cpu->regs.wordregs[regcx] = cpu->regs.wordregs[regcx] - 1;
+			if (cpu->regs.wordregs[regcx]) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0xE3:	/* E3 JCXZ Jb */
+			cpu->temp16 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			if (!cpu->regs.wordregs[regcx]) {
+				cpu->ip = cpu->ip + cpu->temp16;
+			}
+			break;
+
+		case 0xE4:	/* E4 IN cpu->regs.byteregs[regal] Ib */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			cpu->oper1b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			cpu->regs.byteregs[regal] = (uint8_t)port_read(cpu, cpu->oper1b);
+			break;
+
+		case 0xE5:	/* E5 IN eAX Ib */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			cpu->oper1b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			cpu->regs.wordregs[regax] = port_readw(cpu, cpu->oper1b);
+			break;
+
+		case 0xE6:	/* E6 OUT Ib cpu->regs.byteregs[regal] */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			cpu->oper1b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			port_write(cpu, cpu->oper1b, cpu->regs.byteregs[regal]);
+			break;
+
+		case 0xE7:	/* E7 OUT Ib eAX */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			cpu->oper1b = getcode8(cpu, cpu->ip);
+			StepIP(cpu, 1);
+			port_writew(cpu, cpu->oper1b, cpu->regs.wordregs[regax]);
+			break;
+
+		case 0xE8:	/* E8 CALL Jv */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			push(cpu, cpu->ip);
+			cpu->ip = cpu->ip + cpu->oper1;
+			break;
+
+		case 0xE9:	/* E9 JMP Jv */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			cpu->ip = cpu->ip + cpu->oper1;
+			break;
+
+		case 0xEA:	/* EA JMP Ap */
+			cpu->oper1 = getcode16(cpu, cpu->ip);
+			StepIP(cpu, 2);
+			cpu->oper2 = getcode16(cpu, cpu->ip);
+			cpu->ip = cpu->oper1;
+			cpu->segregs[regcs] = cpu->oper2;
+			if (CPU_PM(cpu)) {
+				load_descriptor(cpu, regcs, cpu->segregs[regcs]);
+			}
+			break;
+
+		case 0xEB:	/* EB JMP Jb */
+			cpu->oper1 = signext(getcode8(cpu, cpu->ip));
+			StepIP(cpu, 1);
+			cpu->ip = cpu->ip + cpu->oper1;
+			break;
+
+		case 0xEC:	/* EC IN cpu->regs.byteregs[regal] regdx */
+			cpu->oper1 = cpu->regs.wordregs[regdx];
+			cpu->regs.byteregs[regal] = (uint8_t)port_read(cpu, cpu->oper1);
+			break;
+
+		case 0xED:	/* ED IN eAX regdx */
+			cpu->oper1 = cpu->regs.wordregs[regdx];
+			cpu->regs.wordregs[regax] = port_readw(cpu, cpu->oper1);
+			break;
+
+		case 0xEE:	/* EE OUT regdx cpu->regs.byteregs[regal] */
+			cpu->oper1 = cpu->regs.wordregs[regdx];
+			port_write(cpu, cpu->oper1, cpu->regs.byteregs[regal]);
+			break;
+
+		case 0xEF:	/* EF OUT regdx eAX */
+			cpu->oper1 = cpu->regs.wordregs[regdx];
+			port_writew(cpu, cpu->oper1, cpu->regs.wordregs[regax]);
+			break;
+
+		case 0xF4:	/* F4 HLT */
+			if (CPU_PM(cpu) && cpu->cpl != 0) {
+				cpu_intcall(cpu, 13); break;
+			}
+			cpu->hltstate = 1;
+			break;
+
+		case 0xF5:	/* F5 CMC */
+			if (!cpu->cf) {
+				cpu->cf = 1;
+			}
+			else {
+				cpu->cf = 0;
+			}
+			break;
+
+		case 0xF6:	/* F6 GRP3a Eb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			op_grp3_8(cpu);
+			if ((cpu->reg > 1) && (cpu->reg < 4)) {
+				writerm8(cpu, cpu->rm, cpu->res8);
+			}
+			break;
+
+		case 0xF7:	/* F7 GRP3b Ev */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			op_grp3_16(cpu);
+			if ((cpu->reg > 1) && (cpu->reg < 4)) {
+				writerm16(cpu, cpu->rm, cpu->res16);
+			}
+			break;
+
+		case 0xF8:	/* F8 CLC */
+			cpu->cf = 0;
+			break;
+
+		case 0xF9:	/* F9 STC */
+			cpu->cf = 1;
+			break;
+
+		case 0xFA:	/* FA CLI */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			cpu->ifl = 0;
+			break;
+
+		case 0xFB:	/* FB STI */
+			if (CPU_PM(cpu) && cpu->cpl > cpu->iopl) {
+				cpu_intcall(cpu, 13); break;
+			}
+			cpu->ifl = 1;
+			break;
+
+		case 0xFC:	/* FC CLD */
+			cpu->df = 0;
+			break;
+
+		case 0xFD:	/* FD STD */
+			cpu->df = 1;
+			break;
+
+		case 0xFE:	/* FE GRP4 Eb */
+			modregrm(cpu);
+			cpu->oper1b = readrm8(cpu, cpu->rm);
+			cpu->oper2b = 1;
+			if (!cpu->reg) {
+				cpu->tempcf = cpu->cf;
+				cpu->res8 = cpu->oper1b + cpu->oper2b;
+				flag_add8(cpu, cpu->oper1b, cpu->oper2b);
+				cpu->cf = cpu->tempcf;
+				writerm8(cpu, cpu->rm, cpu->res8);
+			}
+			else {
+				cpu->tempcf = cpu->cf;
+				cpu->res8 = cpu->oper1b - cpu->oper2b;
+				flag_sub8(cpu, cpu->oper1b, cpu->oper2b);
+				cpu->cf = cpu->tempcf;
+				writerm8(cpu, cpu->rm, cpu->res8);
+			}
+			break;
+
+		case 0xFF:	/* FF GRP5 Ev */
+			modregrm(cpu);
+			cpu->oper1 = readrm16(cpu, cpu->rm);
+			op_grp5(cpu);
+			break;
+
+#if 1
+		default:
+			debug_log(DEBUG_ERROR, "\n--- INVALID OPCODE EXCEPTION ---\n");
+			debug_log(DEBUG_ERROR, "Location: %04X:%04X\n", cpu->savecs, firstip);
+			debug_log(DEBUG_ERROR, "Opcode:   %02X (Next bytes: %02X %02X %02X)\n",
+				cpu->opcode,
+				getcode8(cpu, cpu->ip),
+				getmem8(cpu, regcs, cpu->ip + 1),
+				getmem8(cpu, regcs, cpu->ip + 2));
+			debug_log(DEBUG_ERROR, "Registers: AX:%04X BX:%04X CX:%04X DX:%04X\n",
+				cpu->regs.wordregs[regax], cpu->regs.wordregs[regbx],
+				cpu->regs.wordregs[regcx], cpu->regs.wordregs[regdx]);
+			debug_log(DEBUG_ERROR, "Pointers:  SP:%04X BP:%04X SI:%04X DI:%04X\n",
+				cpu->regs.wordregs[regsp], cpu->regs.wordregs[regbp],
+				cpu->regs.wordregs[regsi], cpu->regs.wordregs[regdi]);
+			debug_log(DEBUG_ERROR, "Flags:     %04X (Mode: %s)\n",
+				makeflagsword(cpu), CPU_PM(cpu) ? "PROTECTED" : "REAL");
+			debug_log(DEBUG_ERROR, "--------------------------------\n");
+
+			cpu_intcall(cpu, 6);
+			break;
+#else
+		default:
+			cpu_intcall(cpu, 6);
+			debug_log(DEBUG_INFO, "[CPU] Invalid opcode exception at %04X:%04X\r\n", cpu->segregs[regcs], firstip);
+			break;
+#endif
+		}
+
+		if (cpu->idledetect && (cpu->ip <= firstip) && ((firstip - cpu->ip) <= CPU_IDLE_SPAN) && (cpu->segregs[regcs] == cpu->savecs)) {
+			cpu_idleBranch(cpu);
+		}
+	}
+
+	return loopcount;
+}
+
+#endif
+
+#undef get_seg_address
+#undef cpu_codeRefill
+#undef cpu_codePointer
+#undef cpu_fetch8
+#undef cpu_fetch16
+#undef getea
+#undef push
+#undef pop
+#undef readrm16
+#undef readrm8
+#undef writerm16
+#undef writerm8
+#undef cpu_execLoop
+#undef CPU_PM
+#undef CPU_FN
+#undef CPU_EXEC_LOOP
@@ -0,0 +1,149 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Decode cache for the "cached" CPU core.
+
+	Prefixes, opcode and ModRM/displacement bytes of executed instructions are
+	remembered per guest linear address, so that the interpreter can skip
+	straight to the opcode handler the next time the instruction runs. Pages
+	with cached entries get their direct write pointer swapped for a write
+	callback, which invalidates any entries that a guest write overlaps.
+
+	The "block" core keeps its translated blocks (see block.c) on the same
+	pages, so the same hook throws those away when their code is written.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../config.h"
+#include "../debuglog.h"
+#include "../memory.h"
+#include "decode.h"
+#include "block.h"
+
+DECODE_PAGE_t* decode_map[MEMORY_PAGES];
+DECODE_PAGE_t* decode_pool[DECODE_MAXPAGES];
+uint32_t decode_next = 0;
+
+void decode_write(DECODE_PAGE_t* dpage, uint32_t addr32, uint8_t value) {
+	uint32_t offset, i;
+
+	offset = addr32 & MEMORY_PAGE_MASK;
+	dpage->write[offset] = value;
+
+	//any cached instruction starting in the DECODE_MAXLEN bytes up to here may have changed
+	for (i = 0; (i < DECODE_MAXLEN) && (i <= offset); i++) {
+		dpage->entry[offset - i].len = 0;
+	}
+
+	if (dpage->blocks && dpage->blockcover[offset]) {
+		block_invalidate(dpage);
+	}
+}
+
+static void decode_unhook(DECODE_PAGE_t* dpage) {
+	MEMORY_PAGE_t* page = memory_page(dpage->page); //the page's own entry, A20 may have been turned off since it was hooked
+
+	//only undo the hook if nothing has remapped the page since
+	if ((page->writecb == (void*)decode_write) && (page->udata == dpage)) {
+		if (page->write == NULL) {
+			page->write = dpage->write;
+		}
+		page->writecb = NULL;
+		page->udata = NULL;
+	}
+	decode_map[dpage->page] = NULL;
+}
+
+void decode_flush() {
+	uint32_t i;
+
+	for (i = 0; i < DECODE_MAXPAGES; i++) {
+		if ((decode_pool[i] != NULL) && (decode_map[decode_pool[i]->page] == decode_pool[i])) {
+			decode_unhook(decode_pool[i]);
+		}
+	}
+}
+
+static DECODE_PAGE_t* decode_hook(uint32_t pagenum) {
+	MEMORY_PAGE_t* page = &memory_pages[pagenum];
+	DECODE_PAGE_t* dpage;
+
+	//only plain RAM/ROM pages without callbacks can be cached
+	if ((page->read == NULL) || (page->sub != NULL) || (page->writecb != NULL) || (page->readcb != NULL)) {
+		return NULL;
+	}
+
+	dpage = decode_pool[decode_next];
+	if (dpage == NULL) {
+		dpage = (DECODE_PAGE_t*)calloc(1, sizeof(DECODE_PAGE_t));
+		if (dpage == NULL) {
+			debug_log(DEBUG_ERROR, "[DECODE] Unable to allocate decode cache page\r\n");
+			return NULL;
+		}
+		decode_pool[decode_next] = dpage;
+	}
+	else if (decode_map[dpage->page] == dpage) {
+		decode_unhook(dpage); //evict the oldest cached page
+	}
+	decode_next = (decode_next + 1) % DECODE_MAXPAGES;
+
+	memset(dpage->entry, 0, sizeof(dpage->entry));
+	memset(dpage->blockcover, 0, sizeof(dpage->blockcover));
+	dpage->blocks = 0;
+	dpage->blockgen++; //blocks from the page's previous use must not match
+	dpage->blockkills = 0;
+	dpage->page = pagenum;
+	dpage->write = page->write;
+	dpage->gen = memory_mapGeneration;
+
+	if (page->write != NULL) { //ROM pages can't be written, so they don't need the hook
+		page->write = NULL;
+		page->writecb = (void*)decode_write;
+		page->udata = dpage;
+	}
+
+	decode_map[pagenum] = dpage;
+	return dpage;
+}
+
+DECODE_ENTRY_t* decode_lookup(uint32_t addr32) {
+	uint32_t pagenum = addr32 >> MEMORY_PAGE_SHIFT;
+	DECODE_PAGE_t* dpage = decode_map[pagenum];
+
+	if (dpage == NULL) {
+		dpage = decode_hook(pagenum);
+		if (dpage == NULL) {
+			return NULL;
+		}
+	}
+	else if (dpage->gen != memory_mapGeneration) {
+		//the memory map was changed underneath the cache, start over
+		decode_flush();
+		dpage = decode_hook(pagenum);
+		if (dpage == NULL) {
+			return NULL;
+		}
+	}
+
+	return &dpage->entry[addr32 & MEMORY_PAGE_MASK];
+}
@@ -0,0 +1,41 @@
+#ifndef _DECODE_H_
+#define _DECODE_H_
+
+#include <stdint.h>
+#include "../memory.h"
+
+#define DECODE_MAXPAGES		256	//maximum number of guest code pages with cached decode at once
+#define DECODE_MAXLEN		8	//longest prefix/opcode/ModRM/displacement run that is cached
+
+typedef struct {
+	uint8_t len; //total cached length in bytes, 0 = entry invalid
+	uint8_t prefixlen;
+	uint8_t opcode;
+	uint8_t segoverride;
+	uint8_t usesegreg;
+	uint8_t reptype;
+	uint8_t hasmodrm;
+	uint8_t addrbyte;
+	uint8_t modrmlen;
+	uint16_t disp16;
+	uint8_t heat; //times the instruction started executing under the block core, saturates at 255
+	uint16_t block; //index + 1 of the translated block starting here, 0 = none
+} DECODE_ENTRY_t;
+
+typedef struct {
+	uint32_t page; //guest page number
+	uint8_t* write; //the page's direct write pointer, which is hooked while the page is cached
+	uint32_t gen; //memory map generation at the time the page was hooked
+	uint32_t blockgen; //bumped whenever a write lands on translated code, which orphans the page's blocks
+	uint32_t blockkills; //how many times that happened
+	uint8_t blocks; //nonzero if blockcover[] has anything set
+	DECODE_ENTRY_t entry[MEMORY_PAGE_SIZE];
+	uint8_t blockcover[MEMORY_PAGE_SIZE]; //bytes that are part of a translated block
+} DECODE_PAGE_t;
+
+extern DECODE_PAGE_t* decode_map[MEMORY_PAGES];
+
+DECODE_ENTRY_t* decode_lookup(uint32_t addr32);
+void decode_flush();
+
+#endif
@@ -17,24 +17,395 @@
   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+/*
+	debug_log doesn't write anything itself once debug_init has run. It puts the
+	format pointer and the arguments in a slot of a lock-free ring and the log
+	thread does the formatting and the writing, so a -debug detail run pays for
+	an atomic and a few stores per message instead of a formatted write and a
+	flush. Any thread may log. Formats have to be string literals, only the
+	pointer is kept. %s arguments are copied, and anything the ring can't hold
+	as arguments (too many of them, long strings, %.*s) is formatted by the
+	caller into the slot instead.
+
+	The ring is the bounded queue where every slot carries the ring position it
+	is ready for. A producer claims a position with a compare and swap on the
+	head, fills the slot and then publishes it by setting its sequence to the
+	position plus one. When the ring is full the caller writes it out itself,
+	so nothing is lost, it only costs the emulator time when it logs faster
+	than the log thread keeps up.
+*/
+
 #include "config.h"
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <SDL.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+#endif
+#include "utility.h"
 #include "debuglog.h"
+#include "hostthread.h"
+
+#define DEBUG_KIND_NONE		0 //%%
+#define DEBUG_KIND_SIGNED	1
+#define DEBUG_KIND_UNSIGNED	2
+#define DEBUG_KIND_CHAR		3
+#define DEBUG_KIND_DOUBLE	4
+#define DEBUG_KIND_STRING	5
+#define DEBUG_KIND_POINTER	6
+#define DEBUG_KIND_BAD		7 //nothing the ring can keep, the caller formats the message
+
+typedef union {
+	int64_t i;
+	uint64_t u;
+	double d;
+	void* p;
+} DEBUG_ARG_t;
+
+typedef struct {
+	SDL_atomic_t seq; //ring position this slot is ready for
+	const char* format; //NULL when text already holds the formatted line
+	uint8_t argc;
+	DEBUG_ARG_t arg[DEBUG_MAXARGS];
+	char text[DEBUG_TEXTSIZE];
+} DEBUG_ENTRY_t;
+
+typedef struct {
+	uint8_t kind; //DEBUG_KIND_*
+	uint8_t stars; //* widths and precisions, they take an int argument each
+	uint8_t precision;
+	char length; //0, h, H (hh), l, q (ll), z, j, t, L
+	const char* lenpos; //where the length modifier starts, the conversion follows it
+	char conv;
+} DEBUG_SPEC_t;
+
+typedef struct {
+	char* name;
+	uint32_t mask;
+} DEBUG_SUBNAME_t;
+
+const DEBUG_SUBNAME_t debug_subNames[] = {
+	{ "dma", DEBUG_SUB_DMA }, { "vga", DEBUG_SUB_VGA }, { "cga", DEBUG_SUB_CGA },
+	{ "pit", DEBUG_SUB_PIT }, { "pic", DEBUG_SUB_PIC }, { "ppi", DEBUG_SUB_PPI },
+	{ "uart", DEBUG_SUB_UART }, { "tcpmodem", DEBUG_SUB_TCPMODEM }, { "pcspeaker", DEBUG_SUB_PCSPEAKER },
+	{ "memory", DEBUG_SUB_MEMORY }, { "ports", DEBUG_SUB_PORTS }, { "timing", DEBUG_SUB_TIMING },
+	{ "opl2", DEBUG_SUB_OPL2 }, { "blaster", DEBUG_SUB_BLASTER }, { "fdc", DEBUG_SUB_FDC },
+	{ "ne2000", DEBUG_SUB_NE2000 }, { "pcap", DEBUG_SUB_PCAP }, { "all", DEBUG_SUB_ALL },
+	{ NULL, 0 }
+};
 
 uint8_t debug_level = DEBUG_INFO;
+uint32_t debug_mask = 0;
+
+DEBUG_ENTRY_t debug_ring[DEBUG_RINGSIZE];
+SDL_atomic_t debug_head;
+uint32_t debug_tail = 0; //only touched with debug_drainLock held
+SDL_mutex* debug_drainLock = NULL;
+FILE* debug_file = NULL; //NULL for stderr
+volatile uint8_t debug_async = 0;
+
+//f points just past the %, returns where the text after the conversion starts
+static const char* debug_parseSpec(const char* f, DEBUG_SPEC_t* spec) {
+	spec->stars = 0;
+	spec->precision = 0;
+	spec->length = 0;
+	if (*f == '%') {
+		spec->kind = DEBUG_KIND_NONE;
+		return f + 1;
+	}
+
+	while ((*f != 0) && (strchr("-+ #0", *f) != NULL)) f++;
+	if (*f == '*') {
+		spec->stars++;
+		f++;
+	}
+	else while ((*f >= '0') && (*f <= '9')) f++;
+	if (*f == '.') {
+		spec->precision = 1;
+		f++;
+		if (*f == '*') {
+			spec->stars++;
+			f++;
+		}
+		else while ((*f >= '0') && (*f <= '9')) f++;
+	}
+
+	spec->lenpos = f;
+	if ((f[0] == 'h') && (f[1] == 'h')) {
+		spec->length = 'H';
+		f += 2;
+	}
+	else if ((f[0] == 'l') && (f[1] == 'l')) {
+		spec->length = 'q';
+		f += 2;
+	}
+	else if ((f[0] == 'I') && (f[1] == '6') && (f[2] == '4')) {
+		spec->length = 'q';
+		f += 3;
+	}
+	else if ((*f != 0) && (strchr("hlzjtL", *f) != NULL)) {
+		spec->length = *f++;
+	}
+
+	spec->conv = *f;
+	switch (spec->conv) {
+	case 'd': case 'i':
+		spec->kind = DEBUG_KIND_SIGNED;
+		break;
+	case 'u': case 'o': case 'x': case 'X':
+		spec->kind = DEBUG_KIND_UNSIGNED;
+		break;
+	case 'c':
+		spec->kind = (spec->length == 0) ? DEBUG_KIND_CHAR : DEBUG_KIND_BAD;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		spec->kind = (spec->length == 'L') ? DEBUG_KIND_BAD : DEBUG_KIND_DOUBLE;
+		break;
+	case 's':
+		spec->kind = ((spec->length == 0) && !spec->precision) ? DEBUG_KIND_STRING : DEBUG_KIND_BAD;
+		break;
+	case 'p':
+		spec->kind = DEBUG_KIND_POINTER;
+		break;
+	default:
+		spec->kind = DEBUG_KIND_BAD;
+		return f;
+	}
+	return f + 1;
+}
+
+//Copies the arguments into the slot, -1 if the caller has to format the message instead
+static int debug_capture(DEBUG_ENTRY_t* entry, const char* format, va_list* ap) {
+	DEBUG_SPEC_t spec;
+	const char* f = format;
+	const char* s;
+	size_t textpos = 0, len;
+	DEBUG_ARG_t* arg;
+	int i;
+
+	entry->argc = 0;
+	while (*f) {
+		if (*f++ != '%') continue;
+		f = debug_parseSpec(f, &spec);
+		if (spec.kind == DEBUG_KIND_NONE) continue;
+		if ((spec.kind == DEBUG_KIND_BAD) || ((entry->argc + spec.stars) >= DEBUG_MAXARGS)) return -1;
+		for (i = 0; i < spec.stars; i++) {
+			entry->arg[entry->argc++].i = va_arg(*ap, int);
+		}
+		arg = &entry->arg[entry->argc++];
+		switch (spec.kind) {
+		case DEBUG_KIND_SIGNED:
+			switch (spec.length) {
+			case 'H': arg->i = (signed char)va_arg(*ap, int); break;
+			case 'h': arg->i = (short)va_arg(*ap, int); break;
+			case 'l': arg->i = va_arg(*ap, long); break;
+			case 'q': arg->i = va_arg(*ap, long long); break;
+			case 'z': arg->i = (int64_t)va_arg(*ap, size_t); break;
+			case 'j': arg->i = va_arg(*ap, intmax_t); break;
+			case 't': arg->i = va_arg(*ap, ptrdiff_t); break;
+			default: arg->i = va_arg(*ap, int); break;
+			}
+			break;
+		case DEBUG_KIND_UNSIGNED:
+			switch (spec.length) {
+			case 'H': arg->u = (unsigned char)va_arg(*ap, unsigned int); break;
+			case 'h': arg->u = (unsigned short)va_arg(*ap, unsigned int); break;
+			case 'l': arg->u = va_arg(*ap, unsigned long); break;
+			case 'q': arg->u = va_arg(*ap, unsigned long long); break;
+			case 'z': arg->u = va_arg(*ap, size_t); break;
+			case 'j': arg->u = va_arg(*ap, uintmax_t); break;
+			case 't': arg->u = (uint64_t)va_arg(*ap, ptrdiff_t); break;
+			default: arg->u = va_arg(*ap, unsigned int); break;
+			}
+			break;
+		case DEBUG_KIND_CHAR:
+			arg->i = va_arg(*ap, int);
+			break;
+		case DEBUG_KIND_DOUBLE:
+			arg->d = va_arg(*ap, double);
+			break;
+		case DEBUG_KIND_POINTER:
+			arg->p = va_arg(*ap, void*);
+			break;
+		case DEBUG_KIND_STRING:
+			s = va_arg(*ap, const char*);
+			if (s == NULL) s = "(null)";
+			len = strlen(s) + 1;
+			if ((textpos + len) > DEBUG_TEXTSIZE) return -1;
+			memcpy(entry->text + textpos, s, len);
+			arg->u = textpos;
+			textpos += len;
+			break;
+		}
+	}
+	return 0;
+}
+
+//Log thread side of debug_capture, puts the line back together from the format and the kept arguments
+static void debug_format(DEBUG_ENTRY_t* entry, char* line, size_t size) {
+	DEBUG_SPEC_t spec;
+	const char* f = entry->format;
+	const char* start;
+	char conv[64];
+	size_t pos = 0, cpos;
+	DEBUG_ARG_t* arg;
+	int n, a = 0;
+
+	while ((*f != 0) && (pos < (size - 1))) {
+		if (*f != '%') {
+			line[pos++] = *f++;
+			continue;
+		}
+		start = f++;
+		f = debug_parseSpec(f, &spec);
+		if (spec.kind == DEBUG_KIND_NONE) {
+			line[pos++] = '%';
+			continue;
+		}
+
+		//the same conversion with the * values written in and every integer widened to 64 bits
+		for (cpos = 0; (start < spec.lenpos) && (cpos < (sizeof(conv) - 16)); start++) {
+			if (*start == '*') {
+				cpos += sprintf(conv + cpos, "%d", (int)entry->arg[a++].i);
+			}
+			else {
+				conv[cpos++] = *start;
+			}
+		}
+		if ((spec.kind == DEBUG_KIND_SIGNED) || (spec.kind == DEBUG_KIND_UNSIGNED)) {
+			conv[cpos++] = 'l';
+			conv[cpos++] = 'l';
+		}
+		conv[cpos++] = spec.conv;
+		conv[cpos] = 0;
+
+		arg = &entry->arg[a++];
+		switch (spec.kind) {
+		case DEBUG_KIND_SIGNED: n = snprintf(line + pos, size - pos, conv, (long long)arg->i); break;
+		case DEBUG_KIND_UNSIGNED: n = snprintf(line + pos, size - pos, conv, (unsigned long long)arg->u); break;
+		case DEBUG_KIND_CHAR: n = snprintf(line + pos, size - pos, conv, (int)arg->i); break;
+		case DEBUG_KIND_DOUBLE: n = snprintf(line + pos, size - pos, conv, arg->d); break;
+		case DEBUG_KIND_STRING: n = snprintf(line + pos, size - pos, conv, entry->text + arg->u); break;
+		case DEBUG_KIND_POINTER: n = snprintf(line + pos, size - pos, conv, arg->p); break;
+		default: n = -1; break;
+		}
+		if (n < 0) break;
+		pos += (size_t)n;
+		if (pos >= size) pos = size - 1;
+	}
+	line[pos] = 0;
+}
+
+static DEBUG_ENTRY_t* debug_claim(int* pos) {
+	DEBUG_ENTRY_t* entry;
+	int head, seq;
+
+	head = SDL_AtomicGet(&debug_head);
+	while (1) {
+		entry = &debug_ring[(uint32_t)head & (DEBUG_RINGSIZE - 1)];
+		seq = SDL_AtomicGet(&entry->seq);
+		if (seq == head) {
+			if (SDL_AtomicCAS(&debug_head, head, (int)((uint32_t)head + 1))) {
+				*pos = head;
+				return entry;
+			}
+		}
+		else if ((int)((uint32_t)seq - (uint32_t)head) < 0) {
+			return NULL; //full, the message from the last time round isn't written out yet
+		}
+		head = SDL_AtomicGet(&debug_head);
+	}
+}
 
 void debug_log(uint8_t level, char* format, ...) {
-	va_list argptr;
-	va_start(argptr, format);
+	DEBUG_ENTRY_t* entry;
+	va_list argptr, copy;
+	int pos;
+
 	if (level > debug_level) {
+		return;
+	}
+	va_start(argptr, format);
+	if (!debug_async) {
+		vfprintf((debug_file != NULL) ? debug_file : stderr, format, argptr);
+		fflush((debug_file != NULL) ? debug_file : stderr);
 		va_end(argptr);
 		return;
 	}
-	vfprintf(stderr, format, argptr);
-	fflush(stderr);
+
+	while ((entry = debug_claim(&pos)) == NULL) { //full, write it out here rather than wait for the log thread
+		debug_flush();
+	}
+	va_copy(copy, argptr);
+	entry->format = format;
+	if (debug_capture(entry, format, &copy)) {
+		entry->format = NULL;
+		vsnprintf(entry->text, DEBUG_TEXTSIZE, format, argptr);
+	}
+	va_end(copy);
 	va_end(argptr);
+
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&entry->seq, (int)((uint32_t)pos + 1));
+}
+
+//Writes out everything queued so far, from the log thread or at exit
+void debug_flush() {
+	DEBUG_ENTRY_t* entry;
+	char line[DEBUG_LINESIZE];
+	FILE* out;
+	uint8_t wrote = 0;
+
+	if (debug_drainLock == NULL) {
+		return;
+	}
+	SDL_LockMutex(debug_drainLock);
+	out = (debug_file != NULL) ? debug_file : stderr;
+	while (1) {
+		entry = &debug_ring[debug_tail & (DEBUG_RINGSIZE - 1)];
+		if (SDL_AtomicGet(&entry->seq) != (int)(debug_tail + 1)) break;
+		SDL_MemoryBarrierAcquire();
+		if (entry->format == NULL) {
+			fputs(entry->text, out);
+		}
+		else {
+			debug_format(entry, line, sizeof(line));
+			fputs(line, out);
+		}
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&entry->seq, (int)(debug_tail + DEBUG_RINGSIZE));
+		debug_tail++;
+		wrote = 1;
+	}
+	if (wrote) {
+		fflush(out);
+	}
+	SDL_UnlockMutex(debug_drainLock);
+}
+
+#ifdef _WIN32
+void debug_thread(void* dummy) {
+#else
+void* debug_thread(void* dummy) {
+#endif
+	hostthread_apply(HOSTTHREAD_IO);
+	while (debug_async) {
+		debug_flush();
+		utility_sleep(DEBUG_DRAINMS);
+	}
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+static void debug_exit() {
+	debug_flush();
+	debug_async = 0; //anything logged by later atexit handlers is written straight out
 }
 
 void debug_setLevel(uint8_t level) {
@@ -44,6 +415,85 @@ void debug_setLevel(uint8_t level) {
 	debug_level = level;
 }
 
-void debug_init() {
-	//TODO: Maybe allow initializing this with file output rather than always using stderr. Or maybe remove this, I don't know...
+void debug_setMask(uint32_t mask) {
+	debug_mask = mask;
+}
+
+//Comma separated subsystem names, "all" or "none"
+int debug_parseMask(char* list) {
+	uint32_t mask = 0;
+	char name[16];
+	int i, len;
+
+	while (*list) {
+		for (len = 0; (list[len] != 0) && (list[len] != ','); len++);
+		if ((len == 0) || (len >= (int)sizeof(name))) return -1;
+		for (i = 0; i < len; i++) {
+			name[i] = ((list[i] >= 'A') && (list[i] <= 'Z')) ? (list[i] - 'A' + 'a') : list[i];
+		}
+		name[len] = 0;
+		list += len;
+		if (*list == ',') list++;
+
+		if (strcmp(name, "none") == 0) continue;
+		for (i = 0; debug_subNames[i].name != NULL; i++) {
+			if (strcmp(name, debug_subNames[i].name) == 0) break;
+		}
+		if (debug_subNames[i].name == NULL) {
+			debug_log(DEBUG_ERROR, "[DEBUG] Unknown subsystem: %s\r\n", name);
+			return -1;
+		}
+		mask |= debug_subNames[i].mask;
+	}
+	debug_setMask(mask);
+	return 0;
+}
+
+int debug_setFile(char* filename) {
+	FILE* file;
+
+	file = fopen(filename, "w");
+	if (file == NULL) {
+		debug_log(DEBUG_ERROR, "[DEBUG] Unable to open log file %s\r\n", filename);
+		return -1;
+	}
+	debug_flush(); //what came before goes where it was headed
+	if (debug_drainLock != NULL) SDL_LockMutex(debug_drainLock);
+	if (debug_file != NULL) fclose(debug_file);
+	debug_file = file;
+	if (debug_drainLock != NULL) SDL_UnlockMutex(debug_drainLock);
+	return 0;
+}
+
+int debug_init() {
+#ifndef _WIN32
+	pthread_t thread;
+#endif
+	uint32_t i;
+
+	debug_drainLock = SDL_CreateMutex();
+	if (debug_drainLock == NULL) {
+		return -1; //messages are just written out by whoever logs them
+	}
+	for (i = 0; i < DEBUG_RINGSIZE; i++) {
+		SDL_AtomicSet(&debug_ring[i].seq, (int)i);
+	}
+	SDL_AtomicSet(&debug_head, 0);
+	debug_tail = 0;
+
+	debug_async = 1;
+#ifdef _WIN32
+	if (_beginthread(debug_thread, 0, NULL) == (uintptr_t)-1) {
+		debug_async = 0;
+		return -1;
+	}
+#else
+	if (pthread_create(&thread, NULL, debug_thread, NULL)) {
+		debug_async = 0;
+		return -1;
+	}
+	pthread_detach(thread);
+#endif
+	atexit(debug_exit);
+	return 0;
 }
@@ -17,8 +17,43 @@
 #define DEBUG_INFO		2
 #define DEBUG_DETAIL	3
 
+//Per-device messages, turned on at run time with -debugsub instead of at compile time
+#define DEBUG_SUB_DMA		0x00000001
+#define DEBUG_SUB_VGA		0x00000002
+#define DEBUG_SUB_CGA		0x00000004
+#define DEBUG_SUB_PIT		0x00000008
+#define DEBUG_SUB_PIC		0x00000010
+#define DEBUG_SUB_PPI		0x00000020
+#define DEBUG_SUB_UART		0x00000040
+#define DEBUG_SUB_TCPMODEM	0x00000080
+#define DEBUG_SUB_PCSPEAKER	0x00000100
+#define DEBUG_SUB_MEMORY	0x00000200
+#define DEBUG_SUB_PORTS		0x00000400
+#define DEBUG_SUB_TIMING	0x00000800
+#define DEBUG_SUB_OPL2		0x00001000
+#define DEBUG_SUB_BLASTER	0x00002000
+#define DEBUG_SUB_FDC		0x00004000
+#define DEBUG_SUB_NE2000	0x00008000
+#define DEBUG_SUB_PCAP		0x00010000
+#define DEBUG_SUB_ALL		0xFFFFFFFF
+
+#define DEBUG_ON(sub)		(debug_mask & (sub))
+
+#define DEBUG_RINGSIZE		2048 //messages waiting for the log thread, power of two
+#define DEBUG_MAXARGS		12 //arguments kept per message, more than that and it's formatted by the caller
+#define DEBUG_TEXTSIZE		256 //per message space for copies of %s arguments, or the whole line when formatted by the caller
+#define DEBUG_LINESIZE		1024 //longest line the log thread writes
+#define DEBUG_DRAINMS		10 //log thread sleep when the ring is empty
+
+extern uint8_t debug_level;
+extern uint32_t debug_mask;
+
 void debug_log(uint8_t level, char* format, ...);
 void debug_setLevel(uint8_t level);
-void debug_init();
+void debug_setMask(uint32_t mask);
+int debug_parseMask(char* list);
+int debug_setFile(char* filename);
+void debug_flush();
+int debug_init();
 
 #endif
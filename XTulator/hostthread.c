@@ -0,0 +1,225 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Pins each role's threads to host CPUs and sets their priority, from
+	-affinity <role>:<cpus> and -priority <role>:<level>. Every thread calls
+	hostthread_apply with its role as the first thing it does, so the settings
+	apply to the calling thread and no thread handles need to be kept for
+	them. It does note down a way to read the thread's CPU time, so the
+	metrics can say how busy each role keeps the host.
+
+	Once the CPU thread is pinned, the threads of roles that weren't given
+	CPUs of their own are kept off the CPU thread's, so it has its cores to
+	itself.
+*/
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+#include <SDL.h>
+#include "config.h"
+#include "debuglog.h"
+#include "hostthread.h"
+
+const char* hostthread_names[HOSTTHREAD_ROLES] = { "cpu", "render", "audio", "net", "io" };
+
+uint64_t hostthread_mask[HOSTTHREAD_ROLES] = { 0 }; //0 means not pinned
+uint8_t hostthread_priority[HOSTTHREAD_ROLES] = { HOSTTHREAD_PRIORITY_DEFAULT, HOSTTHREAD_PRIORITY_DEFAULT, HOSTTHREAD_PRIORITY_DEFAULT, HOSTTHREAD_PRIORITY_DEFAULT, HOSTTHREAD_PRIORITY_DEFAULT };
+
+HOSTTHREAD_TRACK_t hostthread_tracked[HOSTTHREAD_TRACKED];
+SDL_atomic_t hostthread_trackClaimed, hostthread_trackReady[HOSTTHREAD_TRACKED];
+SDL_SpinLock hostthread_trackLock = 0; //readers take turns updating the last readings
+
+//Splits "<role>:<value>", returns the role or -1
+static int hostthread_role(char* arg, char** value) {
+	char name[16];
+	char* colon;
+	int i;
+
+	colon = strchr(arg, ':');
+	if ((colon == NULL) || ((colon - arg) >= (int)sizeof(name))) return -1;
+	memcpy(name, arg, colon - arg);
+	name[colon - arg] = 0;
+	for (i = 0; i < HOSTTHREAD_ROLES; i++) {
+		if (!_stricmp(name, hostthread_names[i])) {
+			*value = colon + 1;
+			return i;
+		}
+	}
+	return -1;
+}
+
+//-affinity <role>:<cpus>, where <cpus> is a list like 2 or 2-3 or 0,4-5
+int hostthread_setAffinity(char* arg) {
+	char* list;
+	char* end;
+	long first, last;
+	uint64_t mask = 0;
+	int role;
+
+	role = hostthread_role(arg, &list);
+	if (role < 0) return -1;
+	while (*list) {
+		first = strtol(list, &end, 10);
+		if (end == list) return -1;
+		last = first;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list) return -1;
+		}
+		if ((first < 0) || (last < first) || (last >= HOSTTHREAD_MAXCPUS)) return -1;
+		for (; first <= last; first++) {
+			mask |= (uint64_t)1 << first;
+		}
+		if (*end == ',') end++;
+		else if (*end != 0) return -1;
+		list = end;
+	}
+	if (mask == 0) return -1;
+	hostthread_mask[role] = mask;
+	return 0;
+}
+
+//-priority <role>:<level>, where <level> is low, normal, high or realtime
+int hostthread_setPriority(char* arg) {
+	char* level;
+	int role;
+
+	role = hostthread_role(arg, &level);
+	if (role < 0) return -1;
+	if (!_stricmp(level, "low")) hostthread_priority[role] = SDL_THREAD_PRIORITY_LOW;
+	else if (!_stricmp(level, "normal")) hostthread_priority[role] = SDL_THREAD_PRIORITY_NORMAL;
+	else if (!_stricmp(level, "high")) hostthread_priority[role] = SDL_THREAD_PRIORITY_HIGH;
+	else if (!_stricmp(level, "realtime")) hostthread_priority[role] = SDL_THREAD_PRIORITY_TIME_CRITICAL;
+	else return -1;
+	return 0;
+}
+
+//Notes down the calling thread's CPU clock, each thread claims its own slot so none of this needs a lock
+static void hostthread_track(uint8_t role) {
+	HOSTTHREAD_TRACK_t* track;
+	int slot;
+
+	slot = SDL_AtomicAdd(&hostthread_trackClaimed, 1);
+	if (slot >= HOSTTHREAD_TRACKED) return;
+	track = &hostthread_tracked[slot];
+	track->role = role;
+	track->last = 0;
+#ifdef _WIN32
+	if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &track->handle, THREAD_QUERY_LIMITED_INFORMATION, FALSE, 0)) return;
+#else
+	if (pthread_getcpuclockid(pthread_self(), &track->clock)) return;
+#endif
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&hostthread_trackReady[slot], 1);
+}
+
+/*
+	CPU seconds used by the threads of a role so far, and how many of them
+	there have been. Windows still answers for a thread that has exited
+	through its handle. Elsewhere its clock goes with it, so its last reading
+	stands and the total never goes backwards, but a short lived thread that
+	was never read in its lifetime isn't counted.
+*/
+double hostthread_cpuTime(uint8_t role, uint32_t* threads) {
+	HOSTTHREAD_TRACK_t* track;
+	double total = 0;
+	int i, count;
+#ifdef _WIN32
+	FILETIME created, exited, kernel, user;
+#else
+	struct timespec ts;
+#endif
+
+	count = SDL_AtomicGet(&hostthread_trackClaimed);
+	if (count > HOSTTHREAD_TRACKED) count = HOSTTHREAD_TRACKED;
+	*threads = 0;
+	SDL_AtomicLock(&hostthread_trackLock);
+	for (i = 0; i < count; i++) {
+		if (!SDL_AtomicGet(&hostthread_trackReady[i])) continue;
+		SDL_MemoryBarrierAcquire();
+		track = &hostthread_tracked[i];
+		if (track->role != role) continue;
+#ifdef _WIN32
+		if (GetThreadTimes((HANDLE)track->handle, &created, &exited, &kernel, &user)) {
+			track->last = ((double)(((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+				(double)(((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) / 10000000.0;
+		}
+#else
+		if (clock_gettime(track->clock, &ts) == 0) {
+			track->last = (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+		}
+#endif
+		total += track->last;
+		(*threads)++;
+	}
+	SDL_AtomicUnlock(&hostthread_trackLock);
+	return total;
+}
+
+void hostthread_apply(uint8_t role) {
+	uint64_t mask;
+	int cpus, ret = 0;
+
+	hostthread_track(role);
+	mask = hostthread_mask[role];
+	if ((mask == 0) && (role != HOSTTHREAD_CPU) && (hostthread_mask[HOSTTHREAD_CPU] != 0)) {
+		//keep off the CPU thread's cores
+		cpus = SDL_GetCPUCount();
+		if (cpus > HOSTTHREAD_MAXCPUS) cpus = HOSTTHREAD_MAXCPUS;
+		mask = (cpus == HOSTTHREAD_MAXCPUS) ? ~(uint64_t)0 : (((uint64_t)1 << cpus) - 1);
+		mask &= ~hostthread_mask[HOSTTHREAD_CPU];
+	}
+
+	if (mask != 0) {
+#ifdef _WIN32
+		ret = (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) == 0) ? -1 : 0;
+#else
+		cpu_set_t set;
+		int i;
+		CPU_ZERO(&set);
+		for (i = 0; i < HOSTTHREAD_MAXCPUS; i++) {
+			if (mask & ((uint64_t)1 << i)) CPU_SET(i, &set);
+		}
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) ? -1 : 0;
+#endif
+		if (ret) {
+			debug_log(DEBUG_ERROR, "[HOSTTHREAD] Unable to pin a %s thread to CPU mask %llX\r\n", hostthread_names[role], (unsigned long long)mask);
+		}
+	}
+
+	if (hostthread_priority[role] != HOSTTHREAD_PRIORITY_DEFAULT) {
+		if (SDL_SetThreadPriority((SDL_ThreadPriority)hostthread_priority[role])) {
+			debug_log(DEBUG_ERROR, "[HOSTTHREAD] Unable to set the priority of a %s thread: %s\r\n", hostthread_names[role], SDL_GetError());
+		}
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef _HOSTTHREAD_H_
+#define _HOSTTHREAD_H_
+
+#include <stdint.h>
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#define HOSTTHREAD_CPU		0 //the emulation loop
+#define HOSTTHREAD_RENDER	1 //VGA and CGA render threads
+#define HOSTTHREAD_AUDIO	2 //SDL's audio callback and the OPL synth thread
+#define HOSTTHREAD_NET		3 //pcap capture and send threads, the TCP modem reactor, the VNC, control and metrics servers
+#define HOSTTHREAD_IO		4 //disk cache, log, trace, capture, checkpoint and preload threads
+#define HOSTTHREAD_ROLES	5
+
+#define HOSTTHREAD_MAXCPUS	64 //affinity masks are 64 bits
+
+#define HOSTTHREAD_PRIORITY_DEFAULT	0xFF //leave it to the OS
+
+#define HOSTTHREAD_TRACKED	64 //threads whose CPU time is kept track of, any after that still get their settings
+
+typedef struct {
+	uint8_t role;
+	double last; //seconds at the last reading, what's reported once the thread has gone
+#ifdef _WIN32
+	void* handle;
+#else
+	clockid_t clock;
+#endif
+} HOSTTHREAD_TRACK_t;
+
+extern const char* hostthread_names[HOSTTHREAD_ROLES];
+
+int hostthread_setAffinity(char* arg);
+int hostthread_setPriority(char* arg);
+void hostthread_apply(uint8_t role);
+double hostthread_cpuTime(uint8_t role, uint32_t* threads);
+
+#endif
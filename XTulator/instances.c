@@ -0,0 +1,250 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	-instances <n> runs n copies of the machine from one command line, e.g. to
+	soak test a BIOS or run a batch of headless jobs side by side.
+
+	Every device in this tree keeps its state in globals, so the copies are
+	separate processes rather than threads sharing one: on POSIX hosts the
+	supervisor forks once per instance after the host side tables are set up,
+	so those pages and the executable stay shared copy on write. Windows has
+	no fork, the supervisor starts itself again there with -instanceid.
+
+	Paths given to the disk, snapshot, checkpoint, profile and frame dump
+	options can have %d in them, which becomes the instance number, and tcpmodem
+	listen ports are offset by it, so the copies don't fight over files and
+	sockets. The supervisor waits for all of them and exits nonzero if any did.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+#include "config.h"
+#include "args.h"
+#include "debuglog.h"
+#include "instances.h"
+
+uint32_t instance_count = 1, instance_id = 0;
+uint8_t instance_child = 0; //set in each copy -instances started
+
+//Finds -instances before args_parse runs, which already opens disks and sockets
+uint32_t instances_scan(int argc, char* argv[]) {
+	int i;
+	uint32_t count = 1;
+
+	for (i = 1; i < (argc - 1); i++) {
+		if (args_isMatch(argv[i], "-instanceid")) {
+			return 1; //this is one of the copies already
+		}
+		if (args_isMatch(argv[i], "-instances")) {
+			count = (uint32_t)atol(argv[i + 1]);
+		}
+	}
+	return count;
+}
+
+//Returns path with every %d replaced by the instance number, or path itself when there's none
+char* instances_path(char* path) {
+	char num[12], *ret, *src, *dst;
+	size_t len, count = 0;
+
+	for (src = path; (src = strstr(src, "%d")) != NULL; src += 2) count++;
+	if (count == 0) return path;
+
+	sprintf(num, "%lu", (unsigned long)instance_id);
+	len = strlen(path) + count * strlen(num) + 1;
+	ret = (char*)malloc(len);
+	if (ret == NULL) return path;
+
+	for (src = path, dst = ret; *src; ) {
+		if ((src[0] == '%') && (src[1] == 'd')) {
+			strcpy(dst, num);
+			dst += strlen(num);
+			src += 2;
+		}
+		else {
+			*dst++ = *src++;
+		}
+	}
+	*dst = 0;
+	return ret;
+}
+
+#ifdef _WIN32
+/*
+	_spawnv joins its arguments with spaces into one command line and the
+	child's C runtime splits it up again, so anything with a space, a tab or a
+	quote in it has to be quoted the way that split expects: wrapped in quotes,
+	a quote inside escaped with a backslash, and backslashes doubled where they
+	come right before a quote, the closing one included. Returns a new string,
+	or the argument itself when it needs nothing.
+*/
+static char* instances_quote(char* arg) {
+	char* ret, * dst;
+	size_t slashes, i;
+
+	if ((*arg != 0) && (strpbrk(arg, " \t\"") == NULL)) {
+		return arg;
+	}
+	ret = (char*)malloc(strlen(arg) * 2 + 3);
+	if (ret == NULL) return NULL;
+	dst = ret;
+	*dst++ = '"';
+	while (1) {
+		for (slashes = 0; *arg == '\\'; arg++) slashes++;
+		if ((*arg == '"') || (*arg == 0)) {
+			slashes *= 2; //each one escaped, so the quote after them stays what it is
+		}
+		for (i = 0; i < slashes; i++) *dst++ = '\\';
+		if (*arg == 0) break;
+		if (*arg == '"') *dst++ = '\\';
+		*dst++ = *arg++;
+	}
+	*dst++ = '"';
+	*dst = 0;
+	return ret;
+}
+
+//The first count entries of childargv, the ones instances_quote had to copy, and the array itself
+static void instances_freeArgs(char** childargv, char* argv[], int count) {
+	int j;
+
+	for (j = 0; j < count; j++) {
+		if (childargv[j] != argv[j]) free(childargv[j]);
+	}
+	free(childargv);
+}
+#endif
+
+/*
+	Starts count instances and waits for them. Returns 1 in a forked copy,
+	which goes on to run its machine with instance_id set, or 0 in the
+	supervisor once every copy has exited, with *status set to the exit code
+	the supervisor should use. -1 if not even one could be started.
+*/
+int instances_spawn(int argc, char* argv[], uint32_t count, int* status) {
+	uint32_t i, started = 0, failed = 0;
+#ifdef _WIN32
+	intptr_t* child;
+	char** childargv;
+	char idstr[12];
+	int j;
+#else
+	pid_t* child;
+#endif
+
+	if (count > INSTANCES_MAX) {
+		debug_log(DEBUG_ERROR, "[INSTANCES] At most %u instances can be run at once\r\n", INSTANCES_MAX);
+		return -1;
+	}
+
+	child = calloc(count, sizeof(child[0]));
+	if (child == NULL) return -1;
+#ifdef _WIN32
+	childargv = (char**)malloc(sizeof(char*) * (argc + 3));
+	if (childargv == NULL) {
+		free(child);
+		return -1;
+	}
+	for (j = 0; j < argc; j++) {
+		childargv[j] = instances_quote(argv[j]);
+		if (childargv[j] == NULL) {
+			instances_freeArgs(childargv, argv, j);
+			free(child);
+			return -1;
+		}
+	}
+	childargv[argc] = "-instanceid";
+	childargv[argc + 1] = idstr;
+	childargv[argc + 2] = NULL;
+#endif
+
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < count; i++) {
+#ifdef _WIN32
+		sprintf(idstr, "%lu", (unsigned long)i);
+		child[i] = _spawnv(_P_NOWAIT, argv[0], childargv);
+		if (child[i] == -1) {
+			debug_log(DEBUG_ERROR, "[INSTANCES] Unable to start instance %lu\r\n", (unsigned long)i);
+			failed++;
+			continue;
+		}
+#else
+		child[i] = fork();
+		if (child[i] == 0) {
+			free(child);
+			instance_count = count;
+			instance_id = i;
+			instance_child = 1;
+			return 1;
+		}
+		if (child[i] < 0) {
+			debug_log(DEBUG_ERROR, "[INSTANCES] Unable to start instance %lu\r\n", (unsigned long)i);
+			failed++;
+			continue;
+		}
+#endif
+		started++;
+	}
+
+	if (started == 0) {
+		free(child);
+#ifdef _WIN32
+		instances_freeArgs(childargv, argv, argc);
+#endif
+		return -1;
+	}
+	debug_log(DEBUG_INFO, "[INSTANCES] Started %lu instances\r\n", (unsigned long)started);
+
+	for (i = 0; i < count; i++) {
+		int code;
+#ifdef _WIN32
+		if (child[i] == -1) continue;
+		if (_cwait(&code, child[i], _WAIT_CHILD) == -1) code = -1;
+#else
+		int wstatus;
+		if (child[i] <= 0) continue;
+		if (waitpid(child[i], &wstatus, 0) < 0) code = -1;
+		else if (WIFEXITED(wstatus)) code = WEXITSTATUS(wstatus);
+		else code = -1; //killed by a signal
+#endif
+		if (code != 0) {
+			debug_log(DEBUG_INFO, "[INSTANCES] Instance %lu exited with status %d\r\n", (unsigned long)i, code);
+			failed++;
+		}
+	}
+	debug_log(DEBUG_INFO, "[INSTANCES] All instances done, %lu failed\r\n", (unsigned long)failed);
+
+	free(child);
+#ifdef _WIN32
+	instances_freeArgs(childargv, argv, argc);
+#endif
+	*status = failed ? 1 : 0;
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef _INSTANCES_H_
+#define _INSTANCES_H_
+
+#include <stdint.h>
+
+#define INSTANCES_MAX		256 //copies -instances will start from one command line
+
+extern uint32_t instance_count, instance_id;
+extern uint8_t instance_child;
+
+uint32_t instances_scan(int argc, char* argv[]);
+char* instances_path(char* path);
+int instances_spawn(int argc, char* argv[], uint32_t count, int* status);
+
+#endif
@@ -25,6 +25,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <SDL.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+pthread_t machine_preloadThreadID;
+#endif
 #include "config.h"
 #include "debuglog.h"
 #include "cpu/cpu.h"
@@ -36,6 +43,7 @@
 #include "modules/audio/pcspeaker.h"
 #include "modules/audio/opl2.h"
 #include "modules/audio/blaster.h"
+#include "modules/audio/oplthread.h"
 #include "modules/disk/biosdisk.h"
 #include "modules/disk/fdc.h"
 #include "modules/input/mouse.h"
@@ -43,10 +51,12 @@
 #ifdef USE_NE2000
 #include "modules/io/ne2000.h"
 #include "modules/io/pcap-win32.h"
+#include "modules/io/nat.h"
 #endif
 #include "modules/io/tcpmodem.h"
 #include "modules/video/cga.h"
 #include "modules/video/vga.h"
+#include "modules/video/biosvideo.h"
 #include "rtc.h"
 #include "cmos.h"
 #include "chipset/i8042.h"
@@ -54,6 +64,7 @@
 #include "utility.h"
 #include "timing.h"
 #include "machine.h"
+#include "hostthread.h"
 
 /*
 	ID string, full description, init function, default video, speed in MHz (-1 = unlimited), default hardware flags
@@ -250,6 +261,7 @@ int machine_init_generic_xt(MACHINE_t* machine) {
 	extern uint8_t port92_read(void* udata, uint32_t port);
 	ports_cbRegister(0x92, 1, port92_read, NULL, port92_write, NULL, NULL);
 	pcspeaker_init(&machine->pcspeaker);
+	pcspeaker_setTimer2Source(&machine->pcspeaker, (void*)i8253_getOut2, &machine->i8253);
 
 	//check machine HW flags and init devices accordingly
 	if ((machine->hwflags & MACHINE_HW_BLASTER) && !(machine->hwflags & MACHINE_HW_SKIP_BLASTER)) {
@@ -263,6 +275,11 @@ int machine_init_generic_xt(MACHINE_t* machine) {
 		OPL3_init(&machine->OPL3);
 		machine->mixOPL = 1;
 	}
+	if (machine->mixOPL && oplthread_enabled && !headless) { //nothing would consume the samples in headless mode
+		if (oplthread_init(&machine->OPL3)) {
+			debug_log(DEBUG_ERROR, "[MACHINE] Unable to start OPL synthesis thread, generating on the main thread instead\r\n");
+		}
+	}
 	if ((machine->hwflags & MACHINE_HW_RTC) && !(machine->hwflags & MACHINE_HW_SKIP_RTC)) {
 		rtc_init(&machine->CPU);
 	}
@@ -274,13 +291,11 @@ int machine_init_generic_xt(MACHINE_t* machine) {
 	else if ((machine->hwflags & MACHINE_HW_UART0_MOUSE) && !(machine->hwflags & MACHINE_HW_SKIP_UART0)) {
 		uart_init(&machine->UART[0], &machine->i8259, 0x3F8, 4, NULL, NULL, (void*)mouse_togglereset, NULL);
 		mouse_init(&machine->UART[0]);
-		timing_addTimer(mouse_rxpoll, NULL, baudrate / 9, TIMING_ENABLED);
 	}
 #ifdef ENABLE_TCP_MODEM
 	else if ((machine->hwflags & MACHINE_HW_UART0_TCPMODEM) && !(machine->hwflags & MACHINE_HW_SKIP_UART0)) {
-		uart_init(&machine->UART[0], &machine->i8259, 0x3F8, 4, (void*)tcpmodem_tx, &machine->tcpmodem[0], NULL, NULL);
+		uart_init(&machine->UART[0], &machine->i8259, 0x3F8, 4, (void*)tcpmodem_tx, &machine->tcpmodem[0], (void*)tcpmodem_mcr, &machine->tcpmodem[0]);
 		tcpmodem_init(&machine->tcpmodem[0], &machine->UART[0], 23);
-		timing_addTimer(tcpmodem_rxpoll, &machine->tcpmodem[0], baudrate / 9, TIMING_ENABLED);
 	}
 #endif
 
@@ -290,20 +305,23 @@ int machine_init_generic_xt(MACHINE_t* machine) {
 	else if ((machine->hwflags & MACHINE_HW_UART1_MOUSE) && !(machine->hwflags & MACHINE_HW_SKIP_UART1)) {
 		uart_init(&machine->UART[1], &machine->i8259, 0x2F8, 3, NULL, NULL, (void*)mouse_togglereset, NULL);
 		mouse_init(&machine->UART[1]);
-		timing_addTimer(mouse_rxpoll, NULL, baudrate / 9, TIMING_ENABLED);
 	}
 #ifdef ENABLE_TCP_MODEM
 	else if ((machine->hwflags & MACHINE_HW_UART1_TCPMODEM) && !(machine->hwflags & MACHINE_HW_SKIP_UART1)) {
-		uart_init(&machine->UART[1], &machine->i8259, 0x2F8, 3, (void*)tcpmodem_tx, &machine->tcpmodem[1], NULL, NULL);
+		uart_init(&machine->UART[1], &machine->i8259, 0x2F8, 3, (void*)tcpmodem_tx, &machine->tcpmodem[1], (void*)tcpmodem_mcr, &machine->tcpmodem[1]);
 		tcpmodem_init(&machine->tcpmodem[1], &machine->UART[1], 23);
-		timing_addTimer(tcpmodem_rxpoll, &machine->tcpmodem[1], baudrate / 9, TIMING_ENABLED);
 	}
 #endif
 
 #ifdef USE_NE2000
 	if (machine->hwflags & MACHINE_HW_NE2000) {
 		ne2000_init(&machine->ne2000, &machine->i8259, 0x300, 2, (uint8_t*)&mac);
-		if (machine->pcap_if > -1) {
+		if (machine->netnat) {
+			if (nat_init(&machine->ne2000)) {
+				return -1;
+			}
+		}
+		else if (machine->pcap_if > -1) {
 			if (pcap_init(&machine->ne2000, machine->pcap_if)) {
 				return -1;
 			}
@@ -313,8 +331,9 @@ int machine_init_generic_xt(MACHINE_t* machine) {
 
 	cpu_reset(&machine->CPU);
 #ifndef USE_DISK_HLE
-	fdc_init(&fdc, &machine->CPU, &i8259, &i8237);
-	fdc_insert(&fdc, 0, "dos622.img");
+	fdc_init(&machine->fdc, &machine->CPU, &machine->i8259, &machine->i8237);
+	machine->fdc.fastmode = fdcfast;
+	fdc_insert(&machine->fdc, 0, "dos622.img");
 #else
 	biosdisk_init(&machine->CPU);
 #endif
@@ -327,26 +346,113 @@ int machine_init_generic_xt(MACHINE_t* machine) {
 		if (vga_init()) return -1;
 		break;
 	}
+	if (videohle) biosvideo_init(&machine->CPU);
 
 	return 0;
 }
 
-int machine_init(MACHINE_t* machine, char* id) {
-	int num = 0, match = 0, i = 0;
-
-	do {
-		if (machine_defs[num].id == NULL) {
-			debug_log(DEBUG_ERROR, "[MACHINE] ERROR: Machine definition not found: %s\r\n", id);
-			return -1;
-		}
+static int machine_find(char* id) {
+	int num;
 
+	for (num = 0; machine_defs[num].id != NULL; num++) {
 		if (_stricmp(id, machine_defs[num].id) == 0) {
-			match = 1;
+			return num;
 		}
-		else {
-			num++;
+	}
+	return -1;
+}
+
+/*
+	Startup overlaps reading the machine's ROMs with SDL's video and audio
+	setup, which mostly waits on the host's window system and sound server.
+	machine_preload starts a thread that loads each ROM into the cache that
+	utility_loadROM keeps, touching every page so the reads really happen, and
+	machine_init waits for it before building the memory map from the cache.
+	Nothing else may call utility_loadROM in between.
+*/
+static SDL_mutex* machine_preloadLock = NULL;
+static SDL_cond* machine_preloadDone = NULL;
+static volatile uint8_t machine_preloading = 0;
+static int machine_preloadNum;
+
+#ifdef _WIN32
+static void machine_preloadThread(void* dummy) {
+#else
+static void* machine_preloadThread(void* dummy) {
+#endif
+	volatile uint8_t sum = 0;
+	uint8_t* data;
+	uint32_t j;
+	int i;
+
+	hostthread_apply(HOSTTHREAD_IO);
+
+	for (i = 0; machine_mem[machine_preloadNum][i].memtype != MACHINE_MEM_ENDLIST; i++) {
+		if (machine_mem[machine_preloadNum][i].memtype != MACHINE_MEM_ROM) continue;
+		data = utility_loadROM((size_t)machine_mem[machine_preloadNum][i].size, machine_mem[machine_preloadNum][i].filename);
+		if (data == NULL) continue; //machine_init reports it
+		for (j = 0; j < machine_mem[machine_preloadNum][i].size; j += MEMORY_PAGE_SIZE) {
+			sum += data[j];
 		}
-	} while (!match);
+	}
+	if ((videocard == VIDEO_CARD_VGA) || ((videocard == 0xFF) && (machine_defs[machine_preloadNum].video == VIDEO_CARD_VGA))) {
+		utility_loadROM(32768, "roms/video/et4000.bin");
+	}
+
+	SDL_LockMutex(machine_preloadLock);
+	machine_preloading = 0;
+	SDL_CondBroadcast(machine_preloadDone);
+	SDL_UnlockMutex(machine_preloadLock);
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+//Starts loading the ROMs of machine id in the background, does nothing if it's not a known machine
+void machine_preload(char* id) {
+	machine_preloadNum = machine_find(id);
+	if (machine_preloadNum < 0) return;
+
+	if (machine_preloadLock == NULL) {
+		machine_preloadLock = SDL_CreateMutex();
+		machine_preloadDone = SDL_CreateCond();
+		if ((machine_preloadLock == NULL) || (machine_preloadDone == NULL)) return;
+	}
+
+	machine_preloading = 1;
+#ifdef _WIN32
+	if (_beginthread(machine_preloadThread, 0, NULL) == (uintptr_t)-1) {
+		machine_preloading = 0;
+	}
+#else
+	if (pthread_create(&machine_preloadThreadID, NULL, machine_preloadThread, NULL)) {
+		machine_preloading = 0;
+	}
+	else {
+		pthread_detach(machine_preloadThreadID);
+	}
+#endif
+}
+
+static void machine_preloadWait() {
+	if (machine_preloadLock == NULL) return;
+	SDL_LockMutex(machine_preloadLock);
+	while (machine_preloading) {
+		SDL_CondWait(machine_preloadDone, machine_preloadLock);
+	}
+	SDL_UnlockMutex(machine_preloadLock);
+}
+
+int machine_init(MACHINE_t* machine, char* id) {
+	int num, i = 0;
+
+	machine_preloadWait();
+
+	num = machine_find(id);
+	if (num < 0) {
+		debug_log(DEBUG_ERROR, "[MACHINE] ERROR: Machine definition not found: %s\r\n", id);
+		return -1;
+	}
 
 	debug_log(DEBUG_INFO, "[MACHINE] Initializing machine: \"%s\" (%s)\r\n", machine_defs[num].description, machine_defs[num].id);
 
@@ -359,19 +465,14 @@ int machine_init(MACHINE_t* machine, char* id) {
 		if (machine_mem[num][i].memtype == MACHINE_MEM_RAM) {
 			memory_mapRegister(machine_mem[num][i].start, machine_mem[num][i].size, &main_ram[machine_mem[num][i].start], &main_ram[machine_mem[num][i].start]);
 		} else if (machine_mem[num][i].memtype == MACHINE_MEM_ROM) {
-			temp = (uint8_t*)malloc((size_t)machine_mem[num][i].size);
-			if (temp == NULL) {
-				debug_log(DEBUG_ERROR, "[MACHINE] ERROR: Unable to allocate %lu bytes for ROM\r\n", machine_mem[num][i].size);
-				return -1;
-			}
-			int ret;
-			ret = utility_loadFile(temp, machine_mem[num][i].size, machine_mem[num][i].filename);
-			if ((machine_mem[num][i].required == MACHINE_ROM_REQUIRED) && ret) {
+			temp = utility_loadROM((size_t)machine_mem[num][i].size, machine_mem[num][i].filename);
+			if ((temp == NULL) && (machine_mem[num][i].required == MACHINE_ROM_REQUIRED)) {
 				debug_log(DEBUG_ERROR, "[MACHINE] Could not open file, or size is less than expected: %s\r\n", machine_mem[num][i].filename);
-				free(temp);
 				return -1;
 			}
-			memory_mapRegister(machine_mem[num][i].start, machine_mem[num][i].size, temp, NULL);
+			if (temp != NULL) { //a missing optional ROM leaves the range unmapped
+				memory_mapRegister(machine_mem[num][i].start, machine_mem[num][i].size, temp, NULL);
+			}
 		}
 		i++;
 	}
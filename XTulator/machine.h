@@ -75,6 +75,7 @@ typedef struct {
 	FDC_t fdc;
 	uint64_t hwflags;
 	int pcap_if;
+	uint8_t netnat; //-net nat, the NE2000 goes through the user mode NAT instead of pcap
 } MACHINE_t;
 
 typedef struct {
@@ -95,6 +96,7 @@ typedef struct {
 } MACHINEDEF_t;
 
 int machine_init_generic_xt(MACHINE_t* machine);
+void machine_preload(char* id);
 int machine_init(MACHINE_t* machine, char* id);
 void machine_list();
 
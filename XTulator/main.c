@@ -29,11 +29,34 @@
 #include "menus.h"
 #include "utility.h"
 #include "debuglog.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "profile.h"
+#include "sampler.h"
+#include "trace.h"
+#include "capture.h"
+#include "control.h"
+#include "metrics.h"
+#include "modules/video/frameskip.h"
+#include "replay.h"
+#include "hostthread.h"
+#include "bench.h"
+#include "instances.h"
 #include "cpu/cpu.h"
 #include "chipset/i8259.h"
 #include "modules/disk/biosdisk.h"
+#include "modules/disk/diskcache.h"
+#include "modules/disk/packdisk.h"
 #include "modules/video/sdlconsole.h"
+#include "modules/video/vnc.h"
+#include "modules/video/vga.h"
 #include "modules/audio/sdlaudio.h"
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+pthread_t main_emuThreadID;
+#endif
 #ifdef USE_NE2000
 #include "modules/io/pcap-win32.h"
 #endif
@@ -43,16 +66,92 @@ char* usemachine = "generic_xt"; //default
 char title[64]; //assuming 64 isn't safe if somebody starts messing with STR_TITLE and STR_VERSION
 
 uint64_t ops = 0;
-uint32_t baudrate = 115200, ramsize = 640, instructionsperloop = 100, cpuLimitTimer;
-uint8_t videocard = 0xFF, showMIPS = 0;
-volatile uint8_t goCPU = 1, limitCPU = 0;
+uint32_t baudrate = 115200, ramsize = 640, instructionsperloop = 100;
+uint8_t videocard = 0xFF, showMIPS = 0, headless = 0, fdcfast = 0, profiling = 0, hugepages = 0, videohle = 0;
+char* profilecsv = NULL; //-profilecsv output, counters are appended every profilecsvinterval seconds
+double profilecsvinterval = 1.0;
+uint32_t sampleinterval = 0; //instructions between CS:IP samples, 0 when not sampling
+char* samplemap = NULL; //linker MAP file to resolve samples against
+uint16_t samplemapseg = 0; //segment the MAP file's program was loaded at
+char* tracefile = NULL; //-trace output
+char* capturefile = NULL; //-capture output
+char* tracedumpfile = NULL; //trace to print instead of running a machine
+char* recordfile = NULL; //-record output
+char* replayfile = NULL; //-replay input
+#ifdef USE_BENCH
+uint8_t benchmode = 0;
+uint64_t benchinstructions = 0; //0 runs until the -benchstop port is written
+#endif
+char* packsrc = NULL, * packdst = NULL; //-packimage, compress a disk image instead of running a machine
+char* framedump = NULL; //file the headless mode framebuffer is periodically written to
+double framedumpinterval = 1.0; //seconds of emulated time between dumps
+uint16_t vncport = 0; //-vnc, 0 when there's no VNC server
+char* vncaddr = NULL; //address it listens on, NULL for VNC_DEFAULTADDR
+char* controlpath = NULL; //-control socket
+uint16_t metricsport = 0; //-metrics, 0 when there's no metrics server
+char* metricsaddr = NULL; //address it listens on, NULL for METRICS_DEFAULTADDR
+char* loadstate = NULL; //snapshot to resume from at startup
+char* savestate = NULL; //snapshot written when the emulator exits
+char* checkpointfile = NULL; //base name of periodic checkpoints
+double checkpointinterval = 60.0; //seconds of emulated time between checkpoints
+volatile uint8_t goCPU = 1, limitCPU = 0, turbo = 0, paused = 0;
 volatile double speed = 0;
+double instpertick = 0; //measured instructions per host timer tick, for sizing CPU slices
+double throttleIPS = 0; //instructions per host second with -speed on the host clock
+uint64_t throttleStart = 0, throttleDone = 0; //host time accounting started, and instructions run since
+uint64_t main_slept = 0; //host ticks the CPU thread has slept waiting for time to catch up, for frameskip
 
-volatile uint8_t running = 1;
+volatile uint8_t running = 1, emuStopped = 0;
 
 MACHINE_t machine;
 
+//host time spent in each step of startup, logged just before the first instruction runs
+static char* main_startupPhase[8];
+static uint64_t main_startupTime[8];
+static int main_startupCount = 0;
+static uint64_t main_startupLast;
+
+static void main_startupMark(char* phase) {
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	if ((phase != NULL) && (main_startupCount < 8)) {
+		main_startupPhase[main_startupCount] = phase;
+		main_startupTime[main_startupCount++] = now - main_startupLast;
+	}
+	main_startupLast = now;
+}
+
+static void main_startupReport() {
+	uint8_t level = profiling ? DEBUG_INFO : DEBUG_DETAIL;
+	double freq = (double)SDL_GetPerformanceFrequency() / 1000.0, total = 0;
+	int i;
+
+	for (i = 0; i < main_startupCount; i++) {
+		debug_log(level, "[STARTUP] %-22s %8.02f ms\r\n", main_startupPhase[i], (double)main_startupTime[i] / freq);
+		total += (double)main_startupTime[i] / freq;
+	}
+	debug_log(level, "[STARTUP] %-22s %8.02f ms\r\n", "Total", total);
+}
+
+//Sleeps the CPU thread has chosen to take, counted so frameskip can tell how much time it has to spare
+static void main_sleep(uint32_t ms) {
+	uint64_t start = timing_getCur();
+
+	utility_sleep(ms);
+	main_slept += timing_getCur() - start;
+}
+
+static void main_sleepMicros(uint32_t us) {
+	uint64_t start = timing_getCur();
+
+	utility_sleepMicros(us);
+	main_slept += timing_getCur() - start;
+}
+
 void optimer(void* dummy) {
+	metrics_tick(ops);
+	frameskip_update(main_slept, limitCPU || ((timing_mode == TIMING_MODE_GUEST) && (timing_guestIPS > 0)));
+	instpertick = ((double)ops * 10.0) / (double)timing_getFreq();
 	ops /= 10000;
 	if (showMIPS) {
 		debug_log(DEBUG_INFO, "%llu.%llu MIPS          \r", ops / 10, ops % 10);
@@ -60,26 +159,308 @@ void optimer(void* dummy) {
 	ops = 0;
 }
 
-void cputimer(void* dummy) {
-	goCPU = 1;
+//Run the CPU up to the next timer deadline instead of a fixed count, so timing_loop isn't polled needlessly
+uint32_t slicesize() {
+	uint64_t ticks, guest;
+	double count;
+
+	if (replay_mode != REPLAY_OFF) {
+		count = CPU_SLICE_MAX; //host timing mustn't decide where slices end, or inputs go in at different instructions
+	}
+	else if (instpertick == 0) {
+		count = CPU_SLICE_MIN; //nothing measured yet
+	}
+	else {
+		ticks = timing_untilNext();
+		count = (ticks == TIMING_NEVER) ? CPU_SLICE_MAX : (double)ticks * instpertick;
+		if (count < CPU_SLICE_MIN) count = CPU_SLICE_MIN;
+		if (count > CPU_SLICE_MAX) count = CPU_SLICE_MAX;
+	}
+
+	//guest clock timers are due after an exact number of instructions, so stop right there
+	guest = timing_guestUntilNext();
+	if (guest < (uint64_t)count) {
+		count = (guest == 0) ? 1 : (double)guest;
+	}
+	return replay_slice((uint32_t)count);
+}
+
+/*
+	Throttling with -speed on the host clock. For every second of host time
+	since accounting started the CPU is owed throttleIPS instructions, and it
+	runs slices until it has caught up. Then the thread sleeps until another
+	CPU_SLICE_MIN is owed or the next host timer is due, whichever comes first,
+	instead of spinning. The CPU doesn't count clocks per instruction, so the
+	rate uses the same 14 clocks per instruction estimate as the guest clock.
+*/
+void main_throttleReset() {
+	throttleStart = timing_getCur();
+	throttleDone = 0;
+}
+
+//Returns how many instructions to run now, or 0 after waiting for the budget to refill
+uint32_t main_throttle() {
+	uint64_t now, next;
+	double due, wake;
+	uint32_t count;
+
+	now = timing_getCur();
+	due = ((double)(now - throttleStart) * throttleIPS) / (double)timing_getFreq();
+	if (due >= (double)(throttleDone + CPU_SLICE_MIN)) {
+		if ((due - (double)throttleDone) > (throttleIPS * CPU_THROTTLE_MAXDEBT)) { //the host was busy elsewhere, don't race to catch up
+			main_throttleReset();
+			return CPU_SLICE_MIN;
+		}
+		count = slicesize();
+		if ((due - (double)throttleDone) < (double)count) {
+			count = (uint32_t)(due - (double)throttleDone);
+		}
+		return count;
+	}
+
+	wake = (double)throttleStart + (((double)(throttleDone + CPU_SLICE_MIN) * (double)timing_getFreq()) / throttleIPS);
+	next = timing_untilNext();
+	if ((next != TIMING_NEVER) && ((double)(now + next) < wake)) {
+		wake = (double)(now + next);
+	}
+	if ((wake - (double)now) >= ((double)CPU_THROTTLE_MINSLEEP * (double)timing_getFreq() / 1000000.0)) {
+		main_sleepMicros((uint32_t)(((wake - (double)now) * 1000000.0) / (double)timing_getFreq()));
+	}
+	return 0;
 }
 
 void setspeed(double mhz) {
+	if (timing_mode != TIMING_MODE_HOST) {
+		//the guest clock does the pacing, just tell it how many instructions make up a second
+		speed = (mhz > 0) ? mhz : 0;
+		timing_setGuestIPS((mhz > 0) ? ((mhz * 1000000.0) / 14.0) : 0);
+		return;
+	}
 	if (mhz > 0) {
 		speed = mhz;
-		instructionsperloop = (uint32_t)((speed * 1000000.0) / 140000.0);
+		throttleIPS = (speed * 1000000.0) / 14.0;
 		limitCPU = 1;
-		debug_log(DEBUG_INFO, "[MACHINE] Throttling speed to approximately a %.02f MHz 8088 (%lu instructions/sec)\r\n", speed, instructionsperloop * 10000);
-		timing_timerEnable(cpuLimitTimer);
+		main_throttleReset();
+		debug_log(DEBUG_INFO, "[MACHINE] Throttling speed to approximately a %.02f MHz 8088 (%.0f instructions/sec)\r\n", speed, throttleIPS);
 	}
 	else {
 		speed = 0;
-		instructionsperloop = 100;
+		instructionsperloop = CPU_SLICE_MIN;
+		limitCPU = 0;
+	}
+	if (turbo) { //keep running flat out, the new speed takes over when fast-forward ends
 		limitCPU = 0;
-		timing_timerDisable(cpuLimitTimer);
 	}
 }
 
+/*
+	Fast-forward runs the CPU flat out whatever the -speed setting, for getting
+	through boots, installs and long computations. With the guest clock it just
+	stops pacing it to the host's, so devices on guest time stay in step.
+	Sound isn't generated meanwhile and only every TURBO_FRAMEDIV'th frame is
+	drawn, which leaves the host's time to the CPU.
+*/
+void setturbo(uint8_t on) {
+	if (on == turbo) return;
+	turbo = on;
+	if (on) {
+		limitCPU = 0;
+	}
+	else {
+		if (timing_mode == TIMING_MODE_GUEST) {
+			timing_setGuestCur(timing_getGuestCur()); //pace from here, instead of waiting for real time to catch up
+		}
+		setspeed(speed);
+	}
+	sdlaudio_suspend(on || paused);
+	debug_log(DEBUG_INFO, "[MACHINE] Fast-forward %s\r\n", on ? "on" : "off");
+}
+
+/*
+	Pausing stops the CPU and every timer with it, so the machine stays just
+	as it was. Input is still taken in and the control socket still answers.
+	On resuming, pacing starts from there instead of catching up.
+*/
+void setpaused(uint8_t on) {
+	if (on == paused) return;
+	paused = on;
+	if (!on) {
+		if (timing_mode == TIMING_MODE_GUEST) {
+			timing_setGuestCur(timing_getGuestCur());
+		}
+		if (limitCPU) {
+			main_throttleReset();
+		}
+	}
+	sdlaudio_suspend(on || turbo);
+	debug_log(DEBUG_INFO, "[MACHINE] %s\r\n", on ? "Paused" : "Resumed");
+}
+
+//Hands queued keyboard, mouse and menu input to the emulated hardware, called right before interrupts are checked
+void main_drainInput() {
+	int event;
+
+	if (headless && !vncport) return; //nothing queues input
+	while ((event = sdlconsole_loop()) != SDLCONSOLE_EVENT_NONE) {
+		switch (event) {
+		case SDLCONSOLE_EVENT_KEY:
+			machine.KeyState.scancode = sdlconsole_getScancode();
+			machine.KeyState.isNew = 1;
+			if (replay_input(REPLAY_KEY, &machine.i8042, &machine.KeyState.scancode, 1)) {
+				i8042_send_scancode(&machine.i8042, machine.KeyState.scancode);
+			}
+			break;
+		case SDLCONSOLE_EVENT_QUIT:
+			running = 0;
+			break;
+#ifdef _WIN32
+		case SDLCONSOLE_EVENT_MENU:
+			menus_command(sdlconsole_getMenuCommand());
+			break;
+#endif
+		case SDLCONSOLE_EVENT_TURBO:
+			setturbo(!turbo);
+			break;
+		case SDLCONSOLE_EVENT_DEBUG_1:
+			break;
+		case SDLCONSOLE_EVENT_DEBUG_2:
+			sampler_dump();
+			vga_dumpregs(); //-debugsub vga only
+			break;
+		}
+	}
+}
+
+/*
+	The CPU is halted until an interrupt comes in, or -idle caught the guest
+	polling for one, and only a timer (or input) can raise it. Instead of
+	spinning through empty slices, move the guest clock straight on to the
+	next guest timer, and let the host thread sleep until that's due in real
+	time, or until the next host timer.
+*/
+void main_idle() {
+	uint64_t until, ms;
+
+	if (timing_mode != TIMING_MODE_HOST) {
+		until = timing_guestUntilNext();
+		if (until == 0) until = 1;
+		if (until > CPU_IDLE_MAX) until = CPU_IDLE_MAX;
+		until = replay_slice((uint32_t)until);
+#ifdef USE_BENCH
+		until = bench_slice((uint32_t)until);
+#endif
+		timing_advance((uint32_t)until);
+		replay_ran((uint32_t)until);
+#ifdef USE_BENCH
+		bench_ran((uint32_t)until);
+#endif
+		if ((timing_mode == TIMING_MODE_MAX) || turbo) return; //unpaced, nothing to wait for
+		until = timing_guestAhead();
+	}
+	else {
+		until = timing_untilNext();
+	}
+
+	ms = (until == TIMING_NEVER) ? CPU_IDLE_SLEEP : ((until * 1000) / timing_getFreq());
+	if (ms > CPU_IDLE_SLEEP) ms = CPU_IDLE_SLEEP; //input still has to be drained now and then
+	if (ms > 0) {
+		main_sleep((uint32_t)ms);
+	}
+}
+
+//The emulation loop. Runs on its own thread unless headless, so the main thread is free to wait on SDL events
+#ifdef _WIN32
+void main_emuLoop(void* dummy) {
+#else
+void* main_emuLoop(void* dummy) {
+#endif
+	hostthread_apply(HOSTTHREAD_CPU);
+	while (running) {
+		uint64_t ahead, next;
+		replay_deliver();
+		main_drainInput();
+#ifdef USE_NE2000
+		if (pcap_ne2000 != NULL) {
+			pcap_rxPoll();
+		}
+#endif
+#ifdef ENABLE_TCP_MODEM
+		if (SDL_AtomicGet(&tcpmodem_events)) {
+			tcpmodem_service();
+		}
+#endif
+#ifdef ENABLE_CONTROL
+		if (SDL_AtomicGet(&control_events)) {
+			control_service();
+		}
+#endif
+		if (paused) {
+			utility_sleep(CPU_IDLE_SLEEP);
+			continue;
+		}
+		cpu_interruptCheck(&machine.CPU, &machine.i8259);
+
+		if (machine.CPU.hltstate || machine.CPU.idle) {
+			main_idle();
+			machine.CPU.idle = 0;
+			if (limitCPU) {
+				main_throttleReset(); //a halted CPU doesn't make up the time afterwards
+			}
+		}
+		else if (limitCPU == 0) {
+			goCPU = 1;
+			instructionsperloop = slicesize();
+			ahead = turbo ? 0 : timing_guestAhead();
+			if (ahead > 0) {
+				goCPU = 0; //guest clock is ahead of real time, sleep until the host catches up or a host timer is due
+				next = timing_untilNext();
+				if ((next != TIMING_NEVER) && (next < ahead)) {
+					ahead = next;
+				}
+				if (ahead >= ((CPU_THROTTLE_MINSLEEP * timing_getFreq()) / 1000000)) {
+					main_sleepMicros((uint32_t)((ahead * 1000000) / timing_getFreq()));
+				}
+			}
+		}
+		else {
+			instructionsperloop = main_throttle();
+			goCPU = (instructionsperloop > 0);
+		}
+		if (goCPU && !machine.CPU.hltstate) {
+#ifdef USE_BENCH
+			instructionsperloop = bench_slice(instructionsperloop);
+#endif
+			cpu_exec(&machine.CPU, instructionsperloop);
+			ops += instructionsperloop;
+			timing_advance(instructionsperloop);
+			replay_ran(instructionsperloop);
+#ifdef USE_BENCH
+			bench_ran(instructionsperloop);
+#endif
+			if (limitCPU) {
+				throttleDone += instructionsperloop;
+			}
+			goCPU = 0;
+		}
+		timing_loop();
+		sdlaudio_updateSampleTiming();
+	}
+
+	//the CPU has stopped between instructions, so this is a consistent point to take the snapshot
+	if (savestate != NULL) {
+		snapshot_save(&machine, savestate);
+	}
+	profile_report();
+	sampler_dump();
+#ifdef USE_BENCH
+	bench_report();
+#endif
+	emuStopped = 1;
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
 int main(int argc, char *argv[]) {
 
 	sprintf(title, "%s v%s pre alpha", STR_TITLE, STR_VERSION);
@@ -87,31 +468,70 @@ int main(int argc, char *argv[]) {
 	printf("%s (c)2025 Jdjd Gaming, forked from XTulator by Mike Chambers\r\n", title);
 	printf("[A portable, open source 80286 PC emulator]\r\n\r\n");
 
+	main_startupMark(NULL);
 	ports_init();
 	timing_init();
-	memory_init();
 #ifdef _WIN32
 	menus_setMachine(&machine);
 #endif
+	main_startupMark("Host tables");
+
+	instance_count = instances_scan(argc, argv);
+	if (instance_count > 1) {
+		int status;
+		int ret = instances_spawn(argc, argv, instance_count, &status);
+		if (ret < 0) {
+			return -1;
+		}
+		if (ret == 0) {
+			return status; //supervisor, every copy has exited
+		}
+	}
+	debug_init(); //not before the fork, a copy would get the queue but not the log thread
 
 	machine.pcap_if = -1;
 	if (args_parse(&machine, argc, argv)) {
 		return -1;
 	}
-
-	if (sdlconsole_init(title)) {
-		debug_log(DEBUG_ERROR, "[ERROR] SDL initialization failure\r\n");
+	if (memory_init()) { //after the arguments, -hugepages decides how guest RAM is backed
+		debug_log(DEBUG_ERROR, "[ERROR] Unable to allocate guest RAM\r\n");
 		return -1;
 	}
+	if (instance_child) {
+		sprintf(title + strlen(title), " #%lu", (unsigned long)instance_id);
+	}
+	main_startupMark("Arguments and disks");
+	if (tracedumpfile != NULL) {
+		return trace_dump(tracedumpfile) ? 1 : 0;
+	}
+	if (packsrc != NULL) {
+		return packdisk_create(packsrc, packdst) ? 1 : 0;
+	}
+
+	if (!headless) {
+		machine_preload(usemachine); //ROMs are read while SDL sets up the window
+		if (sdlconsole_init(title)) {
+			debug_log(DEBUG_ERROR, "[ERROR] SDL initialization failure\r\n");
+			return -1;
+		}
 
-	if (sdlaudio_init(&machine)) {
-		debug_log(DEBUG_INFO, "[WARNING] SDL audio initialization failure\r\n");
+		if (sdlaudio_init(&machine)) {
+			debug_log(DEBUG_INFO, "[WARNING] SDL audio initialization failure\r\n");
+		}
+		main_startupMark("SDL video");
+	}
+#ifdef ENABLE_VNC
+	if (vncport && vnc_init(title, vncaddr, vncport)) {
+		debug_log(DEBUG_ERROR, "[ERROR] Unable to start the VNC server\r\n");
+		return -1;
 	}
+#endif
 
 	if (machine_init(&machine, usemachine) < 0) {
 		debug_log(DEBUG_ERROR, "[ERROR] Machine initialization failure\r\n");
 		return -1;
 	}
+	main_startupMark("ROMs and devices");
 
 	if (bootdrive == 0xFF) {
 		if (biosdisk[2].inserted) {
@@ -122,45 +542,84 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	if ((loadstate != NULL) && snapshot_load(&machine, loadstate)) {
+		debug_log(DEBUG_ERROR, "[ERROR] Unable to restore snapshot %s\r\n", loadstate);
+		return -1;
+	}
+	if ((checkpointfile != NULL) && checkpoint_init(&machine, checkpointfile, checkpointinterval)) {
+		debug_log(DEBUG_ERROR, "[ERROR] Unable to start checkpointing\r\n");
+		return -1;
+	}
+	if (profiling && profile_init(profilecsv, profilecsvinterval)) {
+		return -1;
+	}
+	if (sampleinterval > 0) {
+		if (sampler_init(sampleinterval)) return -1;
+		if ((samplemap != NULL) && sampler_loadMap(samplemap, samplemapseg)) return -1;
+	}
+	if ((tracefile != NULL) && trace_init(tracefile)) {
+		return -1;
+	}
+	if ((capturefile != NULL) && capture_init(capturefile)) {
+		return -1;
+	}
+	if ((recordfile != NULL) && replay_init(&machine, recordfile, REPLAY_RECORD)) {
+		return -1;
+	}
+	if ((replayfile != NULL) && replay_init(&machine, replayfile, REPLAY_PLAY)) {
+		return -1;
+	}
+#ifdef ENABLE_CONTROL
+	if ((controlpath != NULL) && control_init(&machine, controlpath)) {
+		return -1;
+	}
+#endif
+#ifdef ENABLE_METRICS
+	if (metricsport && metrics_init(metricsaddr, metricsport)) {
+		debug_log(DEBUG_ERROR, "[ERROR] Unable to start the metrics server\r\n");
+		return -1;
+	}
+#endif
+#ifdef USE_BENCH
+	if (benchmode && bench_init(benchinstructions)) {
+		return -1;
+	}
+#endif
+
 	timing_addTimer(optimer, NULL, 10, TIMING_ENABLED);
-	cpuLimitTimer = timing_addTimer(cputimer, NULL, 10000, TIMING_DISABLED);
 	if (speed > 0) {
 		setspeed(speed);
 	}
-	while (running) {
-		static uint32_t curloop = 0;
-		cpu_interruptCheck(&machine.CPU, &machine.i8259);
-
-		if (limitCPU == 0) {
-			goCPU = 1;
-		}
-		if (goCPU) {
-			cpu_exec(&machine.CPU, instructionsperloop);
-			ops += instructionsperloop;
-			goCPU = 0;
-		}
-		timing_loop();
-		sdlaudio_updateSampleTiming();
-		if (++curloop == 100) {
-			switch (sdlconsole_loop()) {
-			case SDLCONSOLE_EVENT_KEY:
-				machine.KeyState.scancode = sdlconsole_getScancode();
-				machine.KeyState.isNew = 1;
-				i8042_send_scancode(&machine.i8042, machine.KeyState.scancode);
-				break;
-			case SDLCONSOLE_EVENT_QUIT:
-				running = 0;
-				break;
-			case SDLCONSOLE_EVENT_DEBUG_1:
-				break;
-			case SDLCONSOLE_EVENT_DEBUG_2:
-				break;
-			}
+	main_startupMark("Snapshot and tools");
+	main_startupReport();
 
+	if (headless) {
+		main_emuLoop(NULL);
+		trace_stop();
+		capture_stop();
+		replay_stop();
+		checkpoint_shutdown();
+		diskcache_shutdown();
+		return 0;
+	}
 
-			curloop = 0;
-		}
+	//TODO: error checking below
+#ifdef _WIN32
+	_beginthread(main_emuLoop, 0, NULL);
+#else
+	pthread_create(&main_emuThreadID, NULL, main_emuLoop, NULL);
+#endif
+	while (running) {
+		sdlconsole_pump(10);
+	}
+	while (!emuStopped) { //let it finish the slice it's in and write any snapshot
+		utility_sleep(1);
 	}
+	trace_stop();
+	capture_stop();
+	replay_stop();
+	checkpoint_shutdown();
+	diskcache_shutdown();
 
 	return 0;
 }
@@ -20,85 +20,425 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
 #include "config.h"
 #include "cpu/cpu.h"
 #include "modules/video/cga.h"
 #include "modules/video/vga.h"
 #include "utility.h"
+#include "debuglog.h"
 #include "memory.h"
+#include "profile.h"
 #include "chipset/i8042.h"
 
 uint8_t* main_ram = NULL;
 
-uint8_t* memory_mapRead[MEMORY_RANGE];
-uint8_t* memory_mapWrite[MEMORY_RANGE];
-uint8_t (*memory_mapReadCallback[MEMORY_RANGE])(void* udata, uint32_t addr);
-void (*memory_mapWriteCallback[MEMORY_RANGE])(void* udata, uint32_t addr, uint8_t value);
-void* memory_udata[MEMORY_RANGE];
+/*
+	The 16 MB address space is described by 4 KB pages. A page either holds a
+	host pointer (RAM/ROM), a read/write callback pair (MMIO), or, for the rare
+	case of a region that doesn't start or end on a page boundary, a per-byte
+	subpage table. Direct pointers take precedence over callbacks.
+*/
+MEMORY_PAGE_t* memory_pages = NULL; //from utility_allocPages, so -hugepages covers it along with guest RAM
+uint32_t memory_mapGeneration = 0; //bumped on every map change so cached page pointers can revalidate
+uint8_t memory_dirty[MEMORY_PAGES]; //MEMORY_DIRTY and MEMORY_TOUCHED per page
+uint32_t memory_writes = 0; //running count of guest memory writes, the idle detector only looks at whether it moved
+MEMORY_REGION_t memory_regions[MEMORY_MAXREGIONS];
+uint32_t memory_regionCount = 0;
+uint8_t memory_a20gated = 0; //memory_pages currently has the pages with A20 set swapped out for aliases
+MEMORY_PAGE_t memory_a20saved[MEMORY_A20PAGES]; //their real entries while it does
 
 void cpu_write(CPU_t* cpu, uint32_t addr32, uint8_t value) {
-	addr32 &= (a20_enabled) ? MEMORY_MASK : 0x0FFFFF;
+	MEMORY_PAGE_t* page;
+	addr32 &= MEMORY_MASK;
+	page = &memory_pages[addr32 >> MEMORY_PAGE_SHIFT];
+	memory_markDirty(addr32);
+	memory_writes++;
 
-	if (memory_mapWrite[addr32] != NULL) {
-		*(memory_mapWrite[addr32]) = value;
+	if (page->write != NULL) {
+		page->write[addr32 & MEMORY_PAGE_MASK] = value;
 	}
-	else if (memory_mapWriteCallback[addr32] != NULL) {
-		(*memory_mapWriteCallback[addr32])(memory_udata[addr32], addr32, value);
+	else if (page->writecb != NULL) {
+		profile_countMMIOWrite(addr32);
+		(*page->writecb)(page->udata, addr32, value);
+	}
+	else if (page->sub != NULL) {
+		uint32_t offset = addr32 & MEMORY_PAGE_MASK;
+		if (page->sub->write[offset] != NULL) {
+			*(page->sub->write[offset]) = value;
+		}
+		else if (page->sub->writecb[offset] != NULL) {
+			profile_countMMIOWrite(addr32);
+			(*page->sub->writecb[offset])(page->sub->udata[offset], addr32, value);
+		}
 	}
 }
 
 uint8_t cpu_read(CPU_t* cpu, uint32_t addr32) {
-	addr32 &= (a20_enabled) ? MEMORY_MASK : 0x0FFFFF;
+	MEMORY_PAGE_t* page;
+	addr32 &= MEMORY_MASK;
+	page = &memory_pages[addr32 >> MEMORY_PAGE_SHIFT];
 
-	if (memory_mapRead[addr32] != NULL) {
-		return *(memory_mapRead[addr32]);
+	if (page->read != NULL) {
+		return page->read[addr32 & MEMORY_PAGE_MASK];
 	}
 
-	if (memory_mapReadCallback[addr32] != NULL) {
-		return (*memory_mapReadCallback[addr32])(memory_udata[addr32], addr32);
+	if (page->readcb != NULL) {
+		profile_countMMIORead(addr32);
+		return (*page->readcb)(page->udata, addr32);
+	}
+
+	if (page->sub != NULL) {
+		uint32_t offset = addr32 & MEMORY_PAGE_MASK;
+		if (page->sub->read[offset] != NULL) {
+			return *(page->sub->read[offset]);
+		}
+		if (page->sub->readcb[offset] != NULL) {
+			profile_countMMIORead(addr32);
+			return (*page->sub->readcb[offset])(page->sub->udata[offset], addr32);
+		}
 	}
 
 	return 0xFF;
 }
 
-void memory_mapRegister(uint32_t start, uint32_t len, uint8_t* readb, uint8_t* writeb) {
+//The device range of an MMIO page if it has a bulk handler for that direction and nothing has hooked the page since, otherwise NULL
+MEMORY_REGION_t* memory_blockRegion(MEMORY_PAGE_t* page, uint8_t write) {
+	MEMORY_REGION_t* region = page->region;
+
+	if ((region == NULL) || (page->sub != NULL)) return NULL;
+	if (write) {
+		if ((page->write != NULL) || (region->writeblock == NULL) || (page->writecb != region->writeb) || (page->udata != region->udata)) return NULL;
+	}
+	else {
+		if ((page->read != NULL) || (region->readblock == NULL) || (page->readcb != region->readb) || (page->udata != region->udata)) return NULL;
+	}
+	return region;
+}
+
+/*
+	Block transfers for device emulation (disk DMA, INT 13h). Runs that land in
+	directly mapped pages are copied with memcpy, runs into a device range with
+	a bulk handler go to it a page at a time, and anything else (other MMIO,
+	subpages, pages hooked by the decode cache) goes through cpu_write/cpu_read
+	one byte at a time so callbacks still see every access.
+*/
+void memory_writeBlock(uint32_t addr32, const uint8_t* src, uint32_t len) {
+	MEMORY_PAGE_t* page;
+	uint32_t addr, chunk;
+
+	while (len > 0) {
+		addr = addr32 & MEMORY_MASK;
+		chunk = MEMORY_PAGE_SIZE - (addr & MEMORY_PAGE_MASK);
+		if (chunk > len) chunk = len;
+		page = &memory_pages[addr >> MEMORY_PAGE_SHIFT];
+		if (page->write != NULL) {
+			memcpy(&page->write[addr & MEMORY_PAGE_MASK], src, chunk);
+			memory_markDirty(addr);
+			memory_writes++;
+		}
+		else {
+			MEMORY_REGION_t* region = memory_blockRegion(page, 1);
+			uint32_t i = 0;
+			if (region != NULL) {
+				i = (*region->writeblock)(region->udata, addr, src, chunk);
+				memory_markDirty(addr);
+				memory_writes++;
+				if (profile_enabled) profile_mmioWrite[addr >> MEMORY_PAGE_SHIFT] += i;
+			}
+			for (; i < chunk; i++) {
+				cpu_write(NULL, addr32 + i, src[i]);
+			}
+		}
+		addr32 += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+}
+
+void memory_readBlock(uint32_t addr32, uint8_t* dst, uint32_t len) {
+	MEMORY_PAGE_t* page;
+	uint32_t addr, chunk;
+
+	while (len > 0) {
+		addr = addr32 & MEMORY_MASK;
+		chunk = MEMORY_PAGE_SIZE - (addr & MEMORY_PAGE_MASK);
+		if (chunk > len) chunk = len;
+		page = &memory_pages[addr >> MEMORY_PAGE_SHIFT];
+		if (page->read != NULL) {
+			memcpy(dst, &page->read[addr & MEMORY_PAGE_MASK], chunk);
+		}
+		else {
+			MEMORY_REGION_t* region = memory_blockRegion(page, 0);
+			uint32_t i = 0;
+			if (region != NULL) {
+				i = (*region->readblock)(region->udata, addr, dst, chunk);
+				if (profile_enabled) profile_mmioRead[addr >> MEMORY_PAGE_SHIFT] += i;
+			}
+			for (; i < chunk; i++) {
+				dst[i] = cpu_read(NULL, addr32 + i);
+			}
+		}
+		addr32 += chunk;
+		dst += chunk;
+		len -= chunk;
+	}
+}
+
+/*
+	A20 gating is done in the map rather than on every access. While A20 is
+	off, the entry of every page with address bit 20 set is saved away and
+	replaced by one that forwards to the same address with the bit cleared,
+	so the access path never looks at a20_enabled. Reaching those pages with
+	A20 off is rare (the wrap above FFFF:000F, or an A20 test) so the alias
+	doesn't need to be fast, and going through cpu_read/cpu_write means it
+	always sees the low page as it's mapped now, hooks included.
+*/
+static uint8_t memory_a20read(void* udata, uint32_t addr) {
+	return cpu_read(NULL, addr & ~(uint32_t)0x100000);
+}
+
+static void memory_a20write(void* udata, uint32_t addr, uint8_t value) {
+	cpu_write(NULL, addr & ~(uint32_t)0x100000, value);
+}
+
+//The page's own entry, which isn't the one in memory_pages while A20 is off. Anything that changes the map goes through this.
+MEMORY_PAGE_t* memory_page(uint32_t pagenum) {
+	if (memory_a20gated && (pagenum & MEMORY_A20PAGE)) {
+		return &memory_a20saved[((pagenum >> 9) << 8) | (pagenum & (MEMORY_A20PAGE - 1))];
+	}
+	return &memory_pages[pagenum];
+}
+
+//From the i8042 output port and port 92h
+void memory_setA20(uint8_t on) {
+	uint32_t pagenum;
+	MEMORY_PAGE_t* saved;
+
+	a20_enabled = on;
+	if (memory_a20gated == !on) {
+		return;
+	}
+
+	memory_mapGeneration++;
+	memory_a20gated = 1; //so memory_page finds the saved entries
+	for (pagenum = MEMORY_A20PAGE; pagenum < MEMORY_PAGES; pagenum++) {
+		if (!(pagenum & MEMORY_A20PAGE)) {
+			pagenum += MEMORY_A20PAGE - 1;
+			continue;
+		}
+		saved = memory_page(pagenum);
+		if (on) {
+			memory_pages[pagenum] = *saved;
+			continue;
+		}
+		*saved = memory_pages[pagenum];
+		memset(&memory_pages[pagenum], 0, sizeof(MEMORY_PAGE_t));
+		memory_pages[pagenum].readcb = memory_a20read;
+		memory_pages[pagenum].writecb = memory_a20write;
+	}
+	memory_a20gated = !on;
+}
+
+//convert a page to per-byte mapping, preserving whatever it currently maps
+int memory_splitPage(MEMORY_PAGE_t* page) {
 	uint32_t i;
-	for (i = 0; i < len; i++) {
-		if ((start + i) >= MEMORY_RANGE) {
-			break;
+	MEMORY_SUBPAGE_t* sub;
+
+	sub = (MEMORY_SUBPAGE_t*)malloc(sizeof(MEMORY_SUBPAGE_t));
+	if (sub == NULL) {
+		debug_log(DEBUG_ERROR, "[MEMORY] Unable to allocate memory for subpage table\r\n");
+		return -1;
+	}
+
+	for (i = 0; i < MEMORY_PAGE_SIZE; i++) {
+		sub->read[i] = (page->read == NULL) ? NULL : page->read + i;
+		sub->write[i] = (page->write == NULL) ? NULL : page->write + i;
+		sub->readcb[i] = page->readcb;
+		sub->writecb[i] = page->writecb;
+		sub->udata[i] = page->udata;
+	}
+
+	page->read = NULL;
+	page->write = NULL;
+	page->readcb = NULL;
+	page->writecb = NULL;
+	page->udata = NULL;
+	page->region = NULL;
+	page->sub = sub;
+	return 0;
+}
+
+void memory_mapRegister(uint32_t start, uint32_t len, uint8_t* readb, uint8_t* writeb) {
+	uint32_t addr, end, offset, count, i;
+	MEMORY_PAGE_t* page;
+
+	memory_mapGeneration++;
+	end = start + len;
+	if (end > MEMORY_RANGE) {
+		end = MEMORY_RANGE;
+	}
+
+	for (addr = start; addr < end; addr += count) {
+		page = memory_page(addr >> MEMORY_PAGE_SHIFT);
+		offset = addr & MEMORY_PAGE_MASK;
+		count = MEMORY_PAGE_SIZE - offset;
+		if (count > (end - addr)) {
+			count = end - addr;
+		}
+
+		if ((count == MEMORY_PAGE_SIZE) && (page->sub == NULL)) {
+			page->read = (readb == NULL) ? NULL : readb + (addr - start);
+			page->write = (writeb == NULL) ? NULL : writeb + (addr - start);
+			continue;
+		}
+
+		if ((page->sub == NULL) && memory_splitPage(page)) {
+			return;
+		}
+		for (i = 0; i < count; i++) {
+			page->sub->read[offset + i] = (readb == NULL) ? NULL : readb + (addr - start) + i;
+			page->sub->write[offset + i] = (writeb == NULL) ? NULL : writeb + (addr - start) + i;
 		}
-		memory_mapRead[start + i] = (readb == NULL) ? NULL : readb + i;
-		memory_mapWrite[start + i] = (writeb == NULL) ? NULL : writeb + i;
 	}
 }
 
+/*
+	Maps a device's callbacks over count bytes from start. The range gets a
+	MEMORY_REGION_t that every whole page in it points to, and the page keeps
+	its own copy of the byte callbacks so the access path is the same as for
+	the internal hooks. Ragged ends fall back to the per-byte subpage table.
+*/
 void memory_mapCallbackRegister(uint32_t start, uint32_t count, uint8_t(*readb)(void*, uint32_t), void (*writeb)(void*, uint32_t, uint8_t), void* udata) {
-	uint32_t i;
-	for (i = 0; i < count; i++) {
-		if ((start + i) >= MEMORY_RANGE) {
-			break;
+	uint32_t addr, end, offset, len, i;
+	MEMORY_PAGE_t* page;
+	MEMORY_REGION_t* region = NULL;
+
+	memory_mapGeneration++;
+	end = start + count;
+	if (end > MEMORY_RANGE) {
+		end = MEMORY_RANGE;
+	}
+	if (memory_regionCount < MEMORY_MAXREGIONS) {
+		region = &memory_regions[memory_regionCount++];
+		memset(region, 0, sizeof(MEMORY_REGION_t));
+		region->base = start;
+		region->size = end - start;
+		region->readb = readb;
+		region->writeb = writeb;
+		region->udata = udata;
+	}
+
+	for (addr = start; addr < end; addr += len) {
+		page = memory_page(addr >> MEMORY_PAGE_SHIFT);
+		offset = addr & MEMORY_PAGE_MASK;
+		len = MEMORY_PAGE_SIZE - offset;
+		if (len > (end - addr)) {
+			len = end - addr;
+		}
+
+		if ((len == MEMORY_PAGE_SIZE) && (page->sub == NULL)) {
+			page->readcb = readb;
+			page->writecb = writeb;
+			page->udata = udata;
+			page->region = region;
+			continue;
+		}
+
+		if ((page->sub == NULL) && memory_splitPage(page)) {
+			return;
+		}
+		for (i = 0; i < len; i++) {
+			page->sub->readcb[offset + i] = readb;
+			page->sub->writecb[offset + i] = writeb;
+			page->sub->udata[offset + i] = udata;
 		}
-		memory_mapReadCallback[start + i] = readb;
-		memory_mapWriteCallback[start + i] = writeb;
-		memory_udata[start + i] = udata;
 	}
 }
 
-int memory_init() {
+//After memory_mapCallbackRegister, for devices that can take or give a run of bytes in one go. start is the one registered there.
+void memory_mapBlockRegister(uint32_t start, uint32_t (*readblock)(void*, uint32_t, uint8_t*, uint32_t), uint32_t (*writeblock)(void*, uint32_t, const uint8_t*, uint32_t)) {
 	uint32_t i;
 
-	main_ram = (uint8_t*)malloc(MEMORY_RANGE);
-	if (main_ram == NULL) {
-		return -1;
+	for (i = memory_regionCount; i > 0; i--) { //the newest registration wins
+		if (memory_regions[i - 1].base == start) {
+			memory_regions[i - 1].readblock = readblock;
+			memory_regions[i - 1].writeblock = writeblock;
+			return;
+		}
 	}
+	debug_log(DEBUG_ERROR, "[MEMORY] No device range at %06X for block handlers\r\n", start);
+}
+
+//Checkpoints call this once they've saved the dirty pages, it keeps the record of which pages were ever touched
+void memory_clearDirty() {
+	uint32_t page;
+
+	for (page = 0; page < MEMORY_PAGES; page++) {
+		memory_dirty[page] &= MEMORY_TOUCHED;
+	}
+}
+
+uint32_t memory_touchedPages() {
+	uint32_t page, count = 0;
 
-	for (i = 0; i < MEMORY_RANGE; i++) {
-		memory_mapRead[i] = NULL;
-		memory_mapWrite[i] = NULL;
-		memory_mapReadCallback[i] = NULL;
-		memory_mapWriteCallback[i] = NULL;
-		memory_udata[i] = NULL;
+	for (page = 0; page < MEMORY_PAGES; page++) {
+		if (memory_dirty[page] & MEMORY_TOUCHED) count++;
 	}
+	return count;
+}
+
+//Zeroes len bytes of guest RAM from start, handing the host pages back where it can so the next touch gets a fresh zero page
+static void memory_release(uint32_t start, uint32_t len) {
+#if defined(_WIN32)
+	if (VirtualFree(main_ram + start, len, MEM_DECOMMIT) && (VirtualAlloc(main_ram + start, len, MEM_COMMIT, PAGE_READWRITE) != NULL)) {
+		return;
+	}
+#elif defined(__linux__)
+	if (madvise(main_ram + start, len, MADV_DONTNEED) == 0) {
+		return; //private anonymous memory reads back as zeros afterwards
+	}
+#endif
+	memset(main_ram + start, 0, len);
+}
+
+//Zeroes all of guest RAM, only visiting pages that were ever written
+void memory_discard() {
+	uint32_t page, first;
+
+	for (page = 0; page < MEMORY_PAGES; ) {
+		if (!(memory_dirty[page] & MEMORY_TOUCHED)) {
+			page++;
+			continue;
+		}
+		first = page;
+		while ((page < MEMORY_PAGES) && (memory_dirty[page] & MEMORY_TOUCHED)) {
+			memory_dirty[page++] = 0;
+		}
+		memory_release(first << MEMORY_PAGE_SHIFT, (page - first) << MEMORY_PAGE_SHIFT);
+	}
+}
+
+/*
+	Guest RAM covers the whole 16 MB address space, but most guests only ever
+	touch a small part of it, so it's reserved as demand-zero memory and the
+	host only backs the pages that get written. memory_dirty records those,
+	which lets snapshots and checkpoints skip the rest without reading them.
+*/
+int memory_init() {
+	main_ram = (uint8_t*)utility_allocPages(MEMORY_RANGE, "Guest RAM");
+	memory_pages = (MEMORY_PAGE_t*)utility_allocPages(sizeof(MEMORY_PAGE_t) * MEMORY_PAGES, "Memory map");
+	if ((main_ram == NULL) || (memory_pages == NULL)) {
+		return -1;
+	}
+
+	memset(memory_dirty, 0, sizeof(memory_dirty));
+	memory_setA20(0); //off at power on, the map registrations after this land in the saved entries
 
 	return 0;
 }
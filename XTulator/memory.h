@@ -6,10 +6,71 @@
 #define MEMORY_RANGE		0x1000000
 #define MEMORY_MASK			0x0FFFFFF
 
+#define MEMORY_PAGE_SHIFT	12
+#define MEMORY_PAGE_SIZE	(1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_MASK	(MEMORY_PAGE_SIZE - 1)
+#define MEMORY_PAGES		(MEMORY_RANGE >> MEMORY_PAGE_SHIFT)
+#define MEMORY_MAXREGIONS	64 //device ranges memory_mapCallbackRegister can hand out
+#define MEMORY_A20PAGE		(0x100000 >> MEMORY_PAGE_SHIFT) //address line 20 as a bit of the page number
+#define MEMORY_A20PAGES		(MEMORY_PAGES / 2) //pages with A20 set, these alias the page below them while A20 is off
+
+//a device's memory mapped range, the callbacks get the address itself, base is there for devices that want the offset
+typedef struct {
+	uint32_t base;
+	uint32_t size;
+	uint8_t (*readb)(void* udata, uint32_t addr);
+	void (*writeb)(void* udata, uint32_t addr, uint8_t value);
+	//optional bulk handlers for REP MOVS/STOS and memory_readBlock/writeBlock, they move up to len bytes within one page and return how many they did
+	uint32_t (*readblock)(void* udata, uint32_t addr, uint8_t* dst, uint32_t len);
+	uint32_t (*writeblock)(void* udata, uint32_t addr, const uint8_t* src, uint32_t len);
+	void* udata;
+} MEMORY_REGION_t;
+
+//per-byte fallback used only when a page is mapped at less than page granularity
+typedef struct {
+	uint8_t* read[MEMORY_PAGE_SIZE];
+	uint8_t* write[MEMORY_PAGE_SIZE];
+	uint8_t (*readcb[MEMORY_PAGE_SIZE])(void* udata, uint32_t addr);
+	void (*writecb[MEMORY_PAGE_SIZE])(void* udata, uint32_t addr, uint8_t value);
+	void* udata[MEMORY_PAGE_SIZE];
+} MEMORY_SUBPAGE_t;
+
+typedef struct {
+	uint8_t* read; //host pointer to the first byte of the page, or NULL
+	uint8_t* write;
+	uint8_t (*readcb)(void* udata, uint32_t addr);
+	void (*writecb)(void* udata, uint32_t addr, uint8_t value);
+	void* udata;
+	MEMORY_REGION_t* region; //device range the callbacks above belong to, NULL if they're an internal hook
+	MEMORY_SUBPAGE_t* sub; //when non-NULL, the fields above are unused
+} MEMORY_PAGE_t;
+
 extern uint8_t* main_ram;
+extern MEMORY_PAGE_t* memory_pages;
+extern uint32_t memory_mapGeneration;
+extern uint8_t memory_dirty[MEMORY_PAGES];
+extern uint32_t memory_writes;
+extern uint8_t memory_a20gated;
+
+#define MEMORY_DIRTY		0x01 //written since the last checkpoint
+#define MEMORY_TOUCHED		0x02 //written since power on or the last memory_discard, the others are still zero
+#define MEMORY_WATCHED		0x04 //set by a cache of something read from the page, the next write clears it
+
+//every guest write path marks the page it lands in, incremental checkpoints save just those and clear them
+//it assigns rather than ORs so that a write also clears MEMORY_WATCHED
+#define memory_markDirty(addr32) memory_dirty[(addr32) >> MEMORY_PAGE_SHIFT] = MEMORY_DIRTY | MEMORY_TOUCHED
 
+MEMORY_PAGE_t* memory_page(uint32_t pagenum);
+void memory_setA20(uint8_t on);
 void memory_mapRegister(uint32_t start, uint32_t len, uint8_t* readb, uint8_t* writeb);
 void memory_mapCallbackRegister(uint32_t start, uint32_t count, uint8_t(*readb)(void*, uint32_t), void (*writeb)(void*, uint32_t, uint8_t), void* udata);
+void memory_mapBlockRegister(uint32_t start, uint32_t (*readblock)(void*, uint32_t, uint8_t*, uint32_t), uint32_t (*writeblock)(void*, uint32_t, const uint8_t*, uint32_t));
+MEMORY_REGION_t* memory_blockRegion(MEMORY_PAGE_t* page, uint8_t write);
+void memory_writeBlock(uint32_t addr32, const uint8_t* src, uint32_t len);
+void memory_readBlock(uint32_t addr32, uint8_t* dst, uint32_t len);
+void memory_clearDirty();
+uint32_t memory_touchedPages();
+void memory_discard();
 int memory_init();
 
 #endif
@@ -29,7 +29,9 @@
 #include "modules/disk/biosdisk.h"
 #include "timing.h"
 #include "utility.h"
+#include "replay.h"
 #include "menus.h"
+#include "modules/video/sdlconsole.h"
 
 #define IDM_FILE_RESET       1001
 #define IDM_FILE_SEPARATOR1  1002
@@ -54,6 +56,7 @@
 #define IDM_EMULATION_SPEED25     3005
 #define IDM_EMULATION_SPEED50     3006
 #define IDM_EMULATION_SPEEDUNLIM  3007
+#define IDM_EMULATION_TURBO       3008
 
 
 WNDPROC menus_oldProc;
@@ -92,12 +95,15 @@ MENU_t menu_emulation[] = {
     { TEXT("Set CPU speed to 25 MHz"), MENUS_ENABLED, MENUS_FUNCTION, (void*)IDM_EMULATION_SPEED25 },
     { TEXT("Set CPU speed to 50 MHz"), MENUS_ENABLED, MENUS_FUNCTION, (void*)IDM_EMULATION_SPEED50 },
     { TEXT("Set CPU speed to unlimited"), MENUS_ENABLED, MENUS_FUNCTION, (void*)IDM_EMULATION_SPEEDUNLIM },
+    { TEXT("Fast-forward on/off (F10)"), MENUS_ENABLED, MENUS_FUNCTION, (void*)IDM_EMULATION_TURBO },
     { NULL }
 };
 
 void menus_resetCallback(void* dummy) {
     uint8_t scancode = menus_ctrlaltdel[menus_resetPos++];
-    i8042_send_scancode(&menus_useMachine->i8042, scancode);
+    if (replay_input(REPLAY_KEY, &menus_useMachine->i8042, &scancode, 1)) {
+        i8042_send_scancode(&menus_useMachine->i8042, scancode);
+    }
 
     if (menus_resetPos == 3) {
         timing_timerDisable(menus_resetTimer);
@@ -105,68 +111,74 @@ void menus_resetCallback(void* dummy) {
 }
 
 
+//Runs on the CPU thread, menu selections are queued by menus_wndProc like any other input event
+void menus_command(int menuId) {
+    switch (menuId) {
+    case IDM_FILE_RESET:
+        menus_reset();
+        break;
+    case IDM_FILE_EXIT:
+        menus_exit();
+        break;
+    case IDM_DISK_FLOPPY0:
+        menus_changeFloppy0();
+        break;
+    case IDM_DISK_FLOPPY1:
+        menus_changeFloppy1();
+        break;
+    case IDM_DISK_EJECT0:
+        menus_ejectFloppy0();
+        break;
+    case IDM_DISK_EJECT1:
+        menus_ejectFloppy1();
+        break;
+    case IDM_DISK_HARD0:
+        menus_insertHard0();
+        break;
+    case IDM_DISK_HARD1:
+        menus_insertHard1();
+        break;
+    case IDM_DISK_BOOTFD0:
+        menus_setBootFloppy0();
+        break;
+    case IDM_DISK_BOOTHD0:
+        menus_setBootHard0();
+        break;
+    case IDM_EMULATION_SPEED477:
+        menus_speed477();
+        break;
+    case IDM_EMULATION_SPEED8:
+        menus_speed8();
+        break;
+    case IDM_EMULATION_SPEED10:
+        menus_speed10();
+        break;
+    case IDM_EMULATION_SPEED16:
+        menus_speed16();
+        break;
+    case IDM_EMULATION_SPEED25:
+        menus_speed25();
+        break;
+    case IDM_EMULATION_SPEED50:
+        menus_speed50();
+        break;
+    case IDM_EMULATION_SPEEDUNLIM:
+        menus_speedunlimited();
+        break;
+    case IDM_EMULATION_TURBO:
+        menus_turbo();
+        break;
+    default:
+        break;
+    }
+}
+
 LRESULT CALLBACK menus_wndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     switch (msg) {
-    case WM_COMMAND: {
-        int menuId = LOWORD(wParam);
-        switch (menuId) {
-        case IDM_FILE_RESET:
-            menus_reset();
-            break;
-        case IDM_FILE_EXIT:
-            menus_exit();
-            break;
-        case IDM_DISK_FLOPPY0:
-            menus_changeFloppy0();
-            break;
-        case IDM_DISK_FLOPPY1:
-            menus_changeFloppy1();
-            break;
-        case IDM_DISK_EJECT0:
-            menus_ejectFloppy0();
-            break;
-        case IDM_DISK_EJECT1:
-            menus_ejectFloppy1();
-            break;
-        case IDM_DISK_HARD0:
-            menus_insertHard0();
-            break;
-        case IDM_DISK_HARD1:
-            menus_insertHard1();
-            break;
-        case IDM_DISK_BOOTFD0:
-            menus_setBootFloppy0();
-            break;
-        case IDM_DISK_BOOTHD0:
-            menus_setBootHard0();
-            break;
-        case IDM_EMULATION_SPEED477:
-            menus_speed477();
-            break;
-        case IDM_EMULATION_SPEED8:
-            menus_speed8();
-            break;
-        case IDM_EMULATION_SPEED10:
-            menus_speed10();
-            break;
-        case IDM_EMULATION_SPEED16:
-            menus_speed16();
-            break;
-        case IDM_EMULATION_SPEED25:
-            menus_speed25();
-            break;
-        case IDM_EMULATION_SPEED50:
-            menus_speed50();
-            break;
-        case IDM_EMULATION_SPEEDUNLIM:
-            menus_speedunlimited();
-            break;
-        default:
-            break;
-        }
+    case WM_COMMAND:
+        sdlconsole_queueInput(SDLCONSOLE_EVENT_MENU, LOWORD(wParam), 0, 0, 0);
         return 0;
     }
-    }
 
     return(CallWindowProc(menus_oldProc, hwnd, msg, wParam, lParam));
 }
@@ -368,4 +380,8 @@ void menus_speedunlimited() {
     setspeed(0);
 }
 
+void menus_turbo() {
+    setturbo(!turbo);
+}
+
 #endif
\ No newline at end of file
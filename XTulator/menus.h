@@ -27,6 +27,7 @@ typedef struct {
 } MENUBAR_t;
 
 int menus_init(HWND hwnd);
+void menus_command(int menuId);
 void menus_setMachine(MACHINE_t* machine);
 void menus_exit();
 void menus_openFloppyFile(uint8_t disk);
@@ -46,6 +47,7 @@ void menus_speed16();
 void menus_speed25();
 void menus_speed50();
 void menus_speedunlimited();
+void menus_turbo();
 
 #endif //_WIN32
 
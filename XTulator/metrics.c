@@ -0,0 +1,403 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Live counters for watching a fleet of emulators, in the Prometheus text
+	format. The control socket's metrics command returns them, and with
+	-metrics [<addr>:]<port> they're also served over HTTP at /metrics for a
+	scraper to collect.
+
+	The counters are kept by the threads that do the work, each thread in a
+	struct of its own in metrics so they never share a cache line, and
+	nothing waits on anything: a scrape just reads whatever they hold.
+	Counters are totals since startup, rates are left to whoever collects
+	them, apart from the instructions per second and guest time ratio
+	gauges which optimer works out over a short window.
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <SDL.h>
+#ifdef ENABLE_METRICS
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <process.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+pthread_t metrics_threadID;
+#endif
+#endif
+#include "debuglog.h"
+#include "timing.h"
+#include "hostthread.h"
+#include "modules/audio/sdlaudio.h"
+#include "modules/video/frameskip.h"
+#include "metrics.h"
+
+#ifdef ENABLE_METRICS
+#ifdef _WIN32
+typedef SOCKET METRICS_SOCKET;
+#define METRICS_NOSOCKET		INVALID_SOCKET
+#define METRICS_POLLFD			WSAPOLLFD
+#define metrics_poll(f, n, ms)	WSAPoll(f, n, ms)
+#define metrics_wouldBlock()	(WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+typedef int METRICS_SOCKET;
+#define METRICS_NOSOCKET		-1
+#define METRICS_POLLFD			struct pollfd
+#define metrics_poll(f, n, ms)	poll(f, n, ms)
+#define metrics_wouldBlock()	((errno == EAGAIN) || (errno == EWOULDBLOCK))
+#define closesocket				close
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define METRICS_SENDFLAGS		MSG_NOSIGNAL
+#else
+#define METRICS_SENDFLAGS		0
+#endif
+#endif
+
+typedef struct {
+	char* buf;
+	int len, size;
+	uint8_t truncated;
+} METRICS_OUT_t;
+
+METRICS_t metrics;
+
+//optimer's last few readings, for the gauges
+struct {
+	uint64_t instructions, guest, host;
+} metrics_window[METRICS_WINDOW];
+uint32_t metrics_windowPos = 0, metrics_windowFill = 0;
+uint64_t metrics_lastGuest = 0, metrics_lastHost = 0;
+
+#ifdef ENABLE_METRICS
+METRICS_SOCKET metrics_server = METRICS_NOSOCKET;
+char metrics_request[METRICS_REQUEST + 1];
+char metrics_body[METRICS_TEXT];
+#endif
+
+//optimer, on the CPU thread, with the instructions run since its last tick
+void metrics_tick(uint64_t ran) {
+	uint64_t guest, host;
+	uint32_t oldest;
+
+	guest = timing_getGuestCur();
+	host = timing_getCur();
+	metrics.cpu.instructions += ran;
+	if (metrics_lastHost != 0) {
+		metrics.cpu.guestTicks += guest - metrics_lastGuest;
+		metrics.cpu.hostTicks += host - metrics_lastHost;
+	}
+	metrics_lastGuest = guest;
+	metrics_lastHost = host;
+
+	metrics_window[metrics_windowPos].instructions = metrics.cpu.instructions;
+	metrics_window[metrics_windowPos].guest = metrics.cpu.guestTicks;
+	metrics_window[metrics_windowPos].host = metrics.cpu.hostTicks;
+	metrics_windowPos = (metrics_windowPos + 1) % METRICS_WINDOW;
+	if (metrics_windowFill < METRICS_WINDOW) metrics_windowFill++;
+	oldest = (metrics_windowFill < METRICS_WINDOW) ? 0 : metrics_windowPos;
+	if (metrics.cpu.hostTicks > metrics_window[oldest].host) {
+		host = metrics.cpu.hostTicks - metrics_window[oldest].host;
+		metrics.cpu.ips = (double)(metrics.cpu.instructions - metrics_window[oldest].instructions) * (double)timing_getFreq() / (double)host;
+		metrics.cpu.guestRatio = (double)(metrics.cpu.guestTicks - metrics_window[oldest].guest) / (double)host;
+	}
+}
+
+static void metrics_printf(METRICS_OUT_t* out, const char* fmt, ...) {
+	va_list va;
+	int ret;
+
+	if (out->truncated) return;
+	va_start(va, fmt);
+	ret = vsnprintf(out->buf + out->len, (size_t)(out->size - out->len), fmt, va);
+	va_end(va);
+	if ((ret < 0) || (ret >= (out->size - out->len))) {
+		out->buf[out->len] = 0; //leave off the line that didn't fit
+		out->truncated = 1;
+		return;
+	}
+	out->len += ret;
+}
+
+static void metrics_family(METRICS_OUT_t* out, const char* name, const char* type, const char* help) {
+	metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_counter(METRICS_OUT_t* out, const char* name, const char* help, uint64_t value) {
+	metrics_family(out, name, "counter", help);
+	metrics_printf(out, "%s %llu\n", name, (unsigned long long)value);
+}
+
+static void metrics_seconds(METRICS_OUT_t* out, const char* name, const char* help, double value) {
+	metrics_family(out, name, "counter", help);
+	metrics_printf(out, "%s %.6f\n", name, value);
+}
+
+static void metrics_gauge(METRICS_OUT_t* out, const char* name, const char* help, double value) {
+	metrics_family(out, name, "gauge", help);
+	metrics_printf(out, "%s %.9g\n", name, value);
+}
+
+//Writes the exposition to buf, returns its length or -1 if it didn't fit
+int metrics_format(char* buf, int size) {
+	METRICS_OUT_t out;
+	double freq = (double)timing_getFreq(), seconds[HOSTTHREAD_ROLES];
+	uint32_t threads[HOSTTHREAD_ROLES];
+	uint8_t role;
+
+	out.buf = buf;
+	out.len = 0;
+	out.size = size;
+	out.truncated = 0;
+	if (size > 0) buf[0] = 0;
+
+	metrics_counter(&out, "xtulator_instructions_total", "Guest instructions executed.", metrics.cpu.instructions);
+	metrics_gauge(&out, "xtulator_instructions_per_second", "Guest instructions per host second, over the last second.", metrics.cpu.ips);
+	metrics_counter(&out, "xtulator_timer_callbacks_total", "Emulated device timer callbacks run.", metrics.cpu.timerCallbacks);
+	metrics_seconds(&out, "xtulator_guest_seconds_total", "Guest clock time elapsed.", (double)metrics.cpu.guestTicks / freq);
+	metrics_seconds(&out, "xtulator_host_seconds_total", "Host time elapsed while the guest clock was kept.", (double)metrics.cpu.hostTicks / freq);
+	metrics_gauge(&out, "xtulator_guest_time_ratio", "Guest seconds per host second, over the last second.", metrics.cpu.guestRatio);
+	metrics_gauge(&out, "xtulator_paused", "1 while the machine is paused.", (double)paused);
+	metrics_gauge(&out, "xtulator_turbo", "1 while fast-forwarding.", (double)turbo);
+
+	metrics_gauge(&out, "xtulator_audio_buffer_samples", "Samples waiting in the audio ring for the host device.", (double)sdlaudio_bufferFill());
+	metrics_counter(&out, "xtulator_audio_callbacks_total", "Host audio device callbacks.", metrics.audio.callbacks);
+	metrics_counter(&out, "xtulator_audio_underruns_total", "Host audio device callbacks the ring ran dry in.", metrics.audio.underruns);
+	metrics_counter(&out, "xtulator_audio_underrun_samples_total", "Samples of silence played for want of audio.", metrics.audio.underrunSamples);
+
+	metrics_counter(&out, "xtulator_frames_rendered_total", "Frames the render thread drew changes in.", metrics.render.framesRendered);
+	metrics_counter(&out, "xtulator_frames_unchanged_total", "Frames the render thread found nothing new in.", metrics.render.framesUnchanged);
+	metrics_counter(&out, "xtulator_frames_skipped_total", "Frames not handed to the render thread, fast-forwarding, short of time or still busy.", metrics.cpu.framesSkipped);
+	metrics_gauge(&out, "xtulator_frame_divisor", "Frame skipping under CPU pressure, one frame in this many is drawn.", (double)frameskip_div);
+	metrics_counter(&out, "xtulator_frames_presented_total", "Frames presented to the window.", metrics.render.framesPresented);
+
+	metrics_counter(&out, "xtulator_disk_reads_total", "BIOS disk read requests.", metrics.cpu.diskReads);
+	metrics_counter(&out, "xtulator_disk_writes_total", "BIOS disk write requests.", metrics.cpu.diskWrites);
+	metrics_counter(&out, "xtulator_disk_read_bytes_total", "Bytes read from disk images.", metrics.cpu.diskReadBytes);
+	metrics_counter(&out, "xtulator_disk_written_bytes_total", "Bytes written to disk images.", metrics.cpu.diskWriteBytes);
+
+#ifdef USE_NE2000
+	metrics_counter(&out, "xtulator_net_rx_packets_total", "Frames received by the NE2000.", metrics.cpu.netRxPackets);
+	metrics_counter(&out, "xtulator_net_rx_bytes_total", "Bytes received by the NE2000.", metrics.cpu.netRxBytes);
+	metrics_counter(&out, "xtulator_net_rx_dropped_total", "Frames dropped because the NE2000's receive ring was full.", metrics.cpu.netRxDropped);
+	metrics_counter(&out, "xtulator_net_tx_packets_total", "Frames sent by the NE2000.", metrics.cpu.netTxPackets);
+	metrics_counter(&out, "xtulator_net_tx_bytes_total", "Bytes sent by the NE2000.", metrics.cpu.netTxBytes);
+#endif
+
+	for (role = 0; role < HOSTTHREAD_ROLES; role++) {
+		seconds[role] = hostthread_cpuTime(role, &threads[role]);
+	}
+	metrics_family(&out, "xtulator_thread_cpu_seconds_total", "counter", "Host CPU time used by each role's threads.");
+	for (role = 0; role < HOSTTHREAD_ROLES; role++) {
+		metrics_printf(&out, "xtulator_thread_cpu_seconds_total{role=\"%s\"} %.6f\n", hostthread_names[role], seconds[role]);
+	}
+	metrics_family(&out, "xtulator_threads", "gauge", "Threads each role has started.");
+	for (role = 0; role < HOSTTHREAD_ROLES; role++) {
+		metrics_printf(&out, "xtulator_threads{role=\"%s\"} %lu\n", hostthread_names[role], (unsigned long)threads[role]);
+	}
+
+	return out.truncated ? -1 : out.len;
+}
+
+#ifdef ENABLE_METRICS
+//Blocking sends on a non-blocking socket, a scraper that stops reading gets METRICS_TIMEOUTMS
+static int metrics_sendAll(METRICS_SOCKET sock, const char* data, int len) {
+	METRICS_POLLFD fd;
+	int ret;
+
+	while (len > 0) {
+		ret = send(sock, data, len, METRICS_SENDFLAGS);
+		if (ret > 0) {
+			data += ret;
+			len -= ret;
+			continue;
+		}
+		if ((ret < 0) && metrics_wouldBlock()) {
+			fd.fd = sock;
+			fd.events = POLLOUT;
+			fd.revents = 0;
+			if (metrics_poll(&fd, 1, METRICS_TIMEOUTMS) > 0) continue;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+//Reads the request up to the blank line after its headers and answers it
+static void metrics_serve(METRICS_SOCKET sock) {
+	METRICS_POLLFD fd;
+	char header[160];
+	char* path;
+	char* end;
+	int len = 0, ret, bodylen;
+	const char* status = "200 OK";
+
+	while (len < METRICS_REQUEST) {
+		fd.fd = sock;
+		fd.events = POLLIN;
+		fd.revents = 0;
+		if (metrics_poll(&fd, 1, METRICS_TIMEOUTMS) <= 0) return;
+		ret = recv(sock, metrics_request + len, METRICS_REQUEST - len, 0);
+		if (ret <= 0) {
+			if ((ret < 0) && metrics_wouldBlock()) continue;
+			return;
+		}
+		len += ret;
+		metrics_request[len] = 0;
+		if (strstr(metrics_request, "\r\n\r\n") || strstr(metrics_request, "\n\n")) break;
+	}
+	metrics_request[len] = 0;
+
+	bodylen = 0;
+	path = strchr(metrics_request, ' ');
+	if ((path == NULL) || (strncmp(metrics_request, "GET ", 4) && strncmp(metrics_request, "HEAD ", 5))) {
+		status = "405 Method Not Allowed";
+	}
+	else {
+		path++;
+		end = strpbrk(path, " ?\r\n");
+		if (end != NULL) *end = 0;
+		if (strcmp(path, "/metrics") && strcmp(path, "/")) {
+			status = "404 Not Found";
+		}
+		else {
+			bodylen = metrics_format(metrics_body, sizeof(metrics_body));
+			if (bodylen < 0) {
+				debug_log(DEBUG_ERROR, "[METRICS] Exposition didn't fit in %u bytes\r\n", (unsigned)METRICS_TEXT);
+				bodylen = (int)strlen(metrics_body);
+			}
+		}
+	}
+	if (strcmp(status, "200 OK")) {
+		bodylen = sprintf(metrics_body, "%s\n", status);
+	}
+
+	sprintf(header, "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", status, bodylen);
+	if (metrics_sendAll(sock, header, (int)strlen(header))) return;
+	if (strncmp(metrics_request, "HEAD ", 5)) {
+		metrics_sendAll(sock, metrics_body, bodylen);
+	}
+}
+
+#ifdef _WIN32
+void metrics_thread(void* dummy) {
+#else
+void* metrics_thread(void* dummy) {
+#endif
+	METRICS_POLLFD fd;
+	METRICS_SOCKET client;
+#ifdef _WIN32
+	unsigned long iMode = 1;
+#endif
+
+	hostthread_apply(HOSTTHREAD_NET);
+
+	while (running) {
+		fd.fd = metrics_server;
+		fd.events = POLLIN;
+		fd.revents = 0;
+		if (metrics_poll(&fd, 1, METRICS_POLLMS) <= 0) continue;
+		client = accept(metrics_server, NULL, NULL);
+		if (client == METRICS_NOSOCKET) continue;
+#ifdef _WIN32
+		ioctlsocket(client, FIONBIO, &iMode);
+#else
+		fcntl(client, F_SETFL, fcntl(client, F_GETFL, 0) | O_NONBLOCK);
+#endif
+		metrics_serve(client); //one scrape at a time, they're quick
+		closesocket(client);
+	}
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+int metrics_init(char* addr, uint16_t port) {
+	int ret;
+	struct addrinfo hints, *result = NULL;
+	char portstr[16];
+#ifdef _WIN32
+	WSADATA wsa;
+	unsigned long iMode = 1;
+#else
+	int reuse = 1;
+#endif
+
+	if (addr == NULL) addr = METRICS_DEFAULTADDR;
+	debug_log(DEBUG_INFO, "[METRICS] Serving metrics at http://%s:%u/metrics\r\n", addr, port);
+
+#ifdef _WIN32
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_PASSIVE;
+	sprintf(portstr, "%u", port);
+	ret = getaddrinfo(addr, portstr, &hints, &result);
+	if (ret != 0) {
+		debug_log(DEBUG_ERROR, "[METRICS] getaddrinfo error: %d\r\n", ret);
+		return -1;
+	}
+	metrics_server = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (metrics_server == METRICS_NOSOCKET) {
+		freeaddrinfo(result);
+		debug_log(DEBUG_ERROR, "[METRICS] Could not create socket to listen on\r\n");
+		return -1;
+	}
+#ifdef _WIN32
+	ioctlsocket(metrics_server, FIONBIO, &iMode);
+#else
+	fcntl(metrics_server, F_SETFL, fcntl(metrics_server, F_GETFL, 0) | O_NONBLOCK);
+	setsockopt(metrics_server, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+#endif
+	ret = bind(metrics_server, result->ai_addr, (int)result->ai_addrlen);
+	freeaddrinfo(result);
+	if ((ret != 0) || (listen(metrics_server, 4) != 0)) {
+		debug_log(DEBUG_ERROR, "[METRICS] Unable to listen on %s port %u\r\n", addr, port);
+		closesocket(metrics_server);
+		metrics_server = METRICS_NOSOCKET;
+		return -1;
+	}
+
+#ifdef _WIN32
+	_beginthread(metrics_thread, 0, NULL);
+#else
+	pthread_create(&metrics_threadID, NULL, metrics_thread, NULL);
+#endif
+	return 0;
+}
+#endif
@@ -0,0 +1,59 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+#include "config.h"
+
+#define METRICS_WINDOW		10 //optimer ticks the instructions per second and guest time ratio gauges are taken over
+#define METRICS_TEXT		16384 //room for the whole exposition
+#define METRICS_REQUEST		2048 //bytes of an HTTP request read before it's answered, the rest is ignored
+#define METRICS_TIMEOUTMS	2000 //longest a scraper may take to send its request
+#define METRICS_POLLMS		100 //longest the server thread sits in poll() before it checks for shutdown
+#define METRICS_DEFAULTADDR	"127.0.0.1"
+#define METRICS_PAD			64 //keeps each thread's counters on cache lines of their own
+
+/*
+	Every counter is only ever written by the thread named on its struct, so
+	they're plain increments. Readers in other threads may see a value that's
+	a moment old, which is all a scrape needs.
+*/
+typedef struct {
+	volatile uint64_t instructions;
+	volatile uint64_t timerCallbacks;
+	volatile uint64_t framesSkipped; //frames the draw timer didn't hand to the render thread, fast-forwarding, short of time or still busy
+	volatile uint64_t diskReads, diskWrites, diskReadBytes, diskWriteBytes;
+	volatile uint64_t netRxPackets, netRxBytes, netRxDropped, netTxPackets, netTxBytes;
+	volatile uint64_t guestTicks, hostTicks; //both clocks' progress, between optimer ticks
+	volatile double ips, guestRatio; //over the last METRICS_WINDOW optimer ticks
+} METRICS_CPU_t;
+
+typedef struct {
+	volatile uint64_t framesRendered; //frames with something drawn
+	volatile uint64_t framesUnchanged; //frames the render thread found nothing new in
+	volatile uint64_t framesPresented; //frames that made it to the window
+} METRICS_RENDER_t;
+
+typedef struct {
+	volatile uint64_t callbacks;
+	volatile uint64_t underruns; //callbacks the ring ran dry in
+	volatile uint64_t underrunSamples; //silence played in their place
+} METRICS_AUDIO_t;
+
+typedef struct {
+	METRICS_CPU_t cpu;
+	uint8_t pad0[METRICS_PAD];
+	METRICS_RENDER_t render;
+	uint8_t pad1[METRICS_PAD];
+	METRICS_AUDIO_t audio;
+	uint8_t pad2[METRICS_PAD];
+} METRICS_t;
+
+extern METRICS_t metrics;
+
+void metrics_tick(uint64_t ran);
+int metrics_format(char* buf, int size);
+#ifdef ENABLE_METRICS
+int metrics_init(char* addr, uint16_t port);
+#endif
+
+#endif
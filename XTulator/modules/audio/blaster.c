@@ -52,9 +52,25 @@ uint8_t blaster_getreadbuf(BLASTER_t* blaster) {
 	return ret;
 }
 
+//Queues the current DAC output so the mixer can play it back at the right point in its next block
+static void blaster_postSample(BLASTER_t* blaster, uint64_t time, uint8_t dma) {
+	if ((uint16_t)(blaster->evhead - blaster->evtail) == BLASTER_EVENTS) { //full, the oldest one is as good as played
+		blaster->out = blaster->events[blaster->evtail % BLASTER_EVENTS];
+		blaster->evtail++;
+	}
+	blaster->events[blaster->evhead % BLASTER_EVENTS].time = time;
+	blaster->events[blaster->evhead % BLASTER_EVENTS].sample = blaster->sample;
+	blaster->events[blaster->evhead % BLASTER_EVENTS].dma = dma;
+	blaster->evhead++;
+}
+
+static void blaster_startDMA(BLASTER_t* blaster);
+
 void blaster_reset(BLASTER_t* blaster) {
 	blaster->dspenable = 0;
+	blaster->blockdone = 0;
 	blaster->sample = 0;
+	blaster_postSample(blaster, timing_getGuestCur(), 0);
 	blaster->readlen = 0;
 	blaster_putreadbuf(blaster, 0xAA);
 }
@@ -65,6 +81,7 @@ void blaster_writecmd(BLASTER_t* blaster, uint8_t value) {
 		blaster->sample = value;
 		blaster->sample -= 128;
 		blaster->sample *= 256;
+		blaster_postSample(blaster, timing_getGuestCur(), 0);
 		blaster->lastcmd = 0;
 		return;
 	case 0x14: //DMA DAC, 8-bit
@@ -75,26 +92,28 @@ void blaster_writecmd(BLASTER_t* blaster, uint8_t value) {
 		} else {
 			blaster->dmalen |= (uint32_t)value << 8;
 			blaster->dmalen++;
+			blaster->dorecord = (blaster->lastcmd == 0x24) ? 1 : 0;
 			blaster->lastcmd = 0;
 			blaster->dmacount = 0;
+			blaster->blockdone = 0;
 			blaster->silencedsp = 0;
 			blaster->autoinit = 0;
-			blaster->dorecord = (blaster->lastcmd == 0x24) ? 1 : 0;
 			blaster->activedma = 1;
-			timing_timerEnable(blaster->timer);
-#ifdef DEBUG_BLASTER
-			debug_log(DEBUG_DETAIL, "[BLASTER] Begin DMA transfer mode with %lu byte blocks\r\n", blaster->dmalen);
-#endif
+			blaster_startDMA(blaster);
+			if (DEBUG_ON(DEBUG_SUB_BLASTER)) {
+				debug_log(DEBUG_DETAIL, "[BLASTER] Begin DMA transfer mode with %lu byte blocks\r\n", blaster->dmalen);
+			}
 		}
 		return;
 	case 0x40: //set time constant
 		blaster->timeconst = value;
 		blaster->samplerate = 1000000.0 / (256.0 - (double)value);
-		timing_updateIntervalFreq(blaster->timer, blaster->samplerate);
+		blaster->sampleticks = (double)timing_getFreq() / blaster->samplerate;
+		timing_updateIntervalFreq(blaster->timer, blaster->samplerate / (double)BLASTER_DMABUF);
 		blaster->lastcmd = 0;
-#ifdef DEBUG_BLASTER
-		debug_log(DEBUG_DETAIL, "[BLASTER] Set time constant: %u (Sample rate: %f Hz)\r\n", value, blaster->samplerate);
-#endif
+		if (DEBUG_ON(DEBUG_SUB_BLASTER)) {
+			debug_log(DEBUG_DETAIL, "[BLASTER] Set time constant: %u (Sample rate: %f Hz)\r\n", value, blaster->samplerate);
+		}
 		return;
 	case 0x48: //set DMA block size
 		if (blaster->writehilo == 0) {
@@ -115,9 +134,10 @@ void blaster_writecmd(BLASTER_t* blaster, uint8_t value) {
 			blaster->dmalen++;
 			blaster->lastcmd = 0;
 			blaster->dmacount = 0;
+			blaster->blockdone = 0;
 			blaster->silencedsp = 1;
 			blaster->autoinit = 0;
-			timing_timerEnable(blaster->timer);
+			blaster_startDMA(blaster);
 		}
 		return;
 	case 0xE0: //DSP identification (returns bitwise NOT of data byte)
@@ -153,14 +173,15 @@ void blaster_writecmd(BLASTER_t* blaster, uint8_t value) {
 	case 0x1C: //auto-initialize DMA DAC, 8-bit
 	case 0x2C:
 		blaster->dmacount = 0;
+		blaster->blockdone = 0;
 		blaster->silencedsp = 0;
 		blaster->autoinit = 1;
 		blaster->dorecord = (value == 0x2C) ? 1 : 0;
 		blaster->activedma = 1;
-		timing_timerEnable(blaster->timer);
-#ifdef DEBUG_BLASTER
-		debug_log(DEBUG_DETAIL, "[BLASTER] Begin auto-init DMA transfer mode with %lu byte blocks\r\n", blaster->dmalen);
-#endif
+		blaster_startDMA(blaster);
+		if (DEBUG_ON(DEBUG_SUB_BLASTER)) {
+			debug_log(DEBUG_DETAIL, "[BLASTER] Begin auto-init DMA transfer mode with %lu byte blocks\r\n", blaster->dmalen);
+		}
 		break;
 	case 0x20: //direct DAC, 8-bit record
 		blaster_putreadbuf(blaster, 128); //Silence, though I might add actual recording support later.
@@ -185,7 +206,7 @@ void blaster_writecmd(BLASTER_t* blaster, uint8_t value) {
 		break;
 	case 0xD4: //continue DMA operation, 8-bit
 		blaster->activedma = 1;
-		timing_timerEnable(blaster->timer);
+		blaster_startDMA(blaster);
 		break;
 	case 0xDA: //exit auto-initialize DMA operation, 8-bit
 		blaster->activedma = 0;
@@ -218,9 +239,9 @@ void blaster_writecmd(BLASTER_t* blaster, uint8_t value) {
 }
 
 void blaster_write(BLASTER_t* blaster, uint16_t addr, uint8_t value) {
-#ifdef DEBUG_BLASTER
-	debug_log(DEBUG_DETAIL, "[BLASTER] Write %03X: %02X\r\n", addr, value);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_BLASTER)) {
+		debug_log(DEBUG_DETAIL, "[BLASTER] Write %03X: %02X\r\n", addr, value);
+	}
 	addr &= 0x0F;
 
 	switch (addr) {
@@ -238,9 +259,9 @@ void blaster_write(BLASTER_t* blaster, uint16_t addr, uint8_t value) {
 uint8_t blaster_read(BLASTER_t* blaster, uint16_t addr) {
 	uint8_t ret = 0xFF;
 
-#ifdef DEBUG_BLASTER
-	debug_log(DEBUG_DETAIL, "[BLASTER] Read %03X\r\n", addr);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_BLASTER)) {
+		debug_log(DEBUG_DETAIL, "[BLASTER] Read %03X\r\n", addr);
+	}
 	addr &= 0x0F;
 
 	switch (addr) {
@@ -255,38 +276,98 @@ uint8_t blaster_read(BLASTER_t* blaster, uint16_t addr) {
 	return ret;
 }
 
-void blaster_generateSample(BLASTER_t* blaster) { //for DMA mode
-	if (blaster->silencedsp == 0) {
-		if (blaster->dorecord == 0) {
-			blaster->sample = i8237_read(blaster->i8237, blaster->dmachan);
-			blaster->sample -= 128;
-			blaster->sample *= 256;
-		} else {
-			i8237_write(blaster->i8237, blaster->dmachan, 128); //silence
-		}
-	} else {
-		blaster->sample = 0;
-	}
+/*
+	DMA playback runs a chunk of up to BLASTER_DMABUF samples at a time. Each
+	timer callback fires when the previous chunk has finished playing, raises
+	the block IRQ if that chunk ended the DSP block, then fetches the next
+	chunk with one block transfer and queues its samples stamped at the guest
+	times they play. Chunks never cross a DSP block boundary, so the IRQ lands
+	on the same sample it would if bytes were fetched one at a time.
+*/
+void blaster_dmaChunk(BLASTER_t* blaster) {
+	uint32_t n, i, got;
+	uint64_t start;
 
-	if (++blaster->dmacount == blaster->dmalen) {
+	if (blaster->blockdone) {
+		blaster->blockdone = 0;
 		blaster->dmacount = 0;
 		i8259_doirq(blaster->i8259, blaster->irq);
 		if (blaster->autoinit == 0) {
 			blaster->activedma = 0;
 			timing_timerDisable(blaster->timer);
+			return;
 		}
 	}
 
-	if (blaster->dspenable == 0) {
-		blaster->sample = 0;
-		return;
+	n = blaster->dmalen - blaster->dmacount;
+	if (n > BLASTER_DMABUF) n = BLASTER_DMABUF;
+
+	if (blaster->silencedsp == 0) {
+		if (blaster->dorecord == 0) {
+			got = i8237_readBlock(blaster->i8237, blaster->dmachan, blaster->dmabuf, n);
+			if (got < n) {
+				memset(blaster->dmabuf + got, 0xFF, n - got); //what a masked or finished channel reads as
+			}
+		}
+		else {
+			memset(blaster->dmabuf, 128, n); //silence
+			i8237_writeBlock(blaster->i8237, blaster->dmachan, blaster->dmabuf, n);
+		}
+	}
+
+	start = blaster->chunkend;
+	for (i = 0; i < n; i++) {
+		if ((blaster->silencedsp == 0) && (blaster->dorecord == 0) && blaster->dspenable) {
+			blaster->sample = ((int16_t)blaster->dmabuf[i] - 128) * 256;
+		}
+		else {
+			blaster->sample = 0;
+		}
+		blaster_postSample(blaster, start + (uint64_t)((double)i * blaster->sampleticks), 1);
+	}
+
+	blaster->dmacount += n;
+	if (blaster->dmacount >= blaster->dmalen) {
+		blaster->blockdone = 1;
 	}
+	blaster->chunkend = start + (uint64_t)((double)n * blaster->sampleticks);
+	timing_timerAt(blaster->timer, blaster->chunkend);
+}
+
+//Starts or resumes DMA playback from the current guest time
+static void blaster_startDMA(BLASTER_t* blaster) {
+	blaster->chunkend = timing_getGuestCur();
+	blaster_dmaChunk(blaster);
 }
 
 int16_t blaster_getSample(BLASTER_t* blaster) {
 	return blaster->sample;
 }
 
+//Renders count output samples, the first at guest time start and each following one step ticks later.
+//DMA samples are linearly interpolated toward the next one, direct DAC writes are held until the next change.
+void blaster_render(BLASTER_t* blaster, int16_t* buf, uint32_t count, uint64_t start, double step) {
+	BLASTER_EVENT_t* next;
+	uint32_t i;
+	uint64_t t, span;
+
+	for (i = 0; i < count; i++) {
+		t = start + (uint64_t)((double)i * step);
+		while ((blaster->evtail != blaster->evhead) && (blaster->events[blaster->evtail % BLASTER_EVENTS].time <= t)) {
+			blaster->out = blaster->events[blaster->evtail % BLASTER_EVENTS];
+			blaster->evtail++;
+		}
+		buf[i] = blaster->out.sample;
+		if (blaster->out.dma && (blaster->evtail != blaster->evhead)) {
+			next = &blaster->events[blaster->evtail % BLASTER_EVENTS];
+			span = next->time - blaster->out.time;
+			if (next->dma && (span > 0) && ((double)span <= (blaster->sampleticks * 2.0))) {
+				buf[i] += (int16_t)((double)(next->sample - blaster->out.sample) * (double)(t - blaster->out.time) / (double)span);
+			}
+		}
+	}
+}
+
 void blaster_init(BLASTER_t* blaster, I8237_t* i8237, I8259_t* i8259, uint16_t base, uint8_t dma, uint8_t irq) {
 	debug_log(DEBUG_INFO, "[BLASTER] Initializing Sound Blaster 2.0 at base port 0x%03X, IRQ %u, DMA %u\r\n", base, irq, dma);
 	memset(blaster, 0, sizeof(BLASTER_t));
@@ -297,5 +378,7 @@ void blaster_init(BLASTER_t* blaster, I8237_t* i8237, I8259_t* i8259, uint16_t b
 	ports_cbRegister(base, 16, (void*)blaster_read, NULL, (void*)blaster_write, NULL, blaster);
 
 	//TODO: error handling
-	blaster->timer = timing_addTimer(blaster_generateSample, blaster, 22050, TIMING_DISABLED);
+	blaster->samplerate = 22050;
+	blaster->sampleticks = (double)timing_getFreq() / blaster->samplerate;
+	blaster->timer = timing_addGuestTimer(blaster_dmaChunk, blaster, blaster->samplerate / (double)BLASTER_DMABUF, TIMING_DISABLED);
 }
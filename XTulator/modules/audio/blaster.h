@@ -5,6 +5,15 @@
 #include "../../chipset/i8237.h"
 #include "../../chipset/i8259.h"
 
+#define BLASTER_EVENTS	512
+#define BLASTER_DMABUF	32 //samples fetched per DMA block transfer, small so the guest's view of the DMA count stays close
+
+typedef struct {
+	uint64_t time;
+	int16_t sample;
+	uint8_t dma; //part of an evenly spaced DMA stream, so it can be interpolated toward the next one
+} BLASTER_EVENT_t;
+
 typedef struct {
 	I8237_t* i8237;
 	I8259_t* i8259;
@@ -28,11 +37,19 @@ typedef struct {
 	uint8_t silencedsp;
 	uint8_t dorecord;
 	uint8_t activedma;
+	uint8_t dmabuf[BLASTER_DMABUF];
+	double sampleticks; //guest timer ticks per DSP sample
+	uint64_t chunkend; //guest time the samples fetched so far run out
+	uint8_t blockdone; //the last chunk finished the DSP block, IRQ is due when it has played
+	BLASTER_EVENT_t events[BLASTER_EVENTS]; //DAC output changes, stamped with guest time, waiting for blaster_render
+	uint16_t evhead, evtail;
+	BLASTER_EVENT_t out; //event currently being played by blaster_render
 } BLASTER_t;
 
 void blaster_write(BLASTER_t* blaster, uint16_t addr, uint8_t value);
 uint8_t blaster_read(BLASTER_t* blaster, uint16_t addr);
 int16_t blaster_getSample(BLASTER_t* blaster);
+void blaster_render(BLASTER_t* blaster, int16_t* buf, uint32_t count, uint64_t start, double step);
 void blaster_init(BLASTER_t* blaster, I8237_t* i8237, I8259_t* i8259, uint16_t base, uint8_t dma, uint8_t irq);
 
 #endif
@@ -37,6 +37,16 @@
 #include "../../debuglog.h"
 #include "nukedopl.h"
 
+#ifdef USE_OPL_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define OPL_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OPL_SIMD_NEON
+#endif
+#endif
+
 #define RSM_FRAC    10
 
  // Channel types
@@ -187,6 +197,7 @@ static const Bit8u ch_slot[18] = {
 typedef Bit16s(*envelope_sinfunc)(Bit16u phase, Bit16u envelope);
 typedef void(*envelope_genfunc)(opl3_slot* slott);
 
+#ifndef USE_OPL_SIMD
 static Bit16s OPL3_EnvelopeCalcExp(Bit32u level)
 {
     if (level > 0x1fff)
@@ -343,6 +354,7 @@ static const envelope_sinfunc envelope_sin[8] = {
     OPL3_EnvelopeCalcSin6,
     OPL3_EnvelopeCalcSin7
 };
+#endif
 
 enum envelope_gen_num
 {
@@ -666,10 +678,12 @@ static void OPL3_SlotWriteE0(opl3_slot* slot, Bit8u data)
     }
 }
 
+#ifndef USE_OPL_SIMD
 static void OPL3_SlotGenerate(opl3_slot* slot)
 {
     slot->out = envelope_sin[slot->reg_wf](slot->pg_phase_out + *slot->mod, slot->eg_out);
 }
+#endif
 
 static void OPL3_SlotCalcFB(opl3_slot* slot)
 {
@@ -684,6 +698,201 @@ static void OPL3_SlotCalcFB(opl3_slot* slot)
     slot->prout = slot->out;
 }
 
+#ifdef USE_OPL_SIMD
+//
+// Grouped slot output
+//
+// wavetab holds the log-sin value of every waveform at every phase, with the
+// sign in bit 15, so all eight waveforms are one lookup instead of a call
+// through envelope_sin. Slots are generated three at a time: a slot's
+// modulator is always at least three slots before it, so the slots in a
+// group never depend on each other and can be computed side by side.
+//
+// The exp shift is done as a multiply-high: (x << 5) * 2^(12 - n) >> 16 is
+// (x << 1) >> n for every exprom value, and zero once n is past 12.
+//
+
+static Bit16u wavetab[8][1024];
+static Bit8u wavetab_ready = 0;
+
+#if defined(OPL_SIMD_SSE2) || defined(OPL_SIMD_NEON)
+static const Bit16u expmult[32] = {
+    0x1000, 0x0800, 0x0400, 0x0200, 0x0100, 0x0080, 0x0040, 0x0020,
+    0x0010, 0x0008, 0x0004, 0x0002, 0x0001, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+};
+#endif
+
+static void OPL3_WaveTableInit(void)
+{
+    Bit16u phase;
+    Bit16u out;
+    Bit16u neg;
+    Bit8u wf;
+
+    for (wf = 0; wf < 8; wf++)
+    {
+        for (phase = 0; phase < 0x400; phase++)
+        {
+            out = 0;
+            neg = 0;
+            switch (wf)
+            {
+            case 0:
+            case 2:
+                if (wf == 0 && (phase & 0x200))
+                {
+                    neg = 1;
+                }
+                if (phase & 0x100)
+                {
+                    out = logsinrom[(phase & 0xff) ^ 0xff];
+                }
+                else
+                {
+                    out = logsinrom[phase & 0xff];
+                }
+                break;
+            case 1:
+                if (phase & 0x200)
+                {
+                    out = 0x1000;
+                }
+                else if (phase & 0x100)
+                {
+                    out = logsinrom[(phase & 0xff) ^ 0xff];
+                }
+                else
+                {
+                    out = logsinrom[phase & 0xff];
+                }
+                break;
+            case 3:
+                if (phase & 0x100)
+                {
+                    out = 0x1000;
+                }
+                else
+                {
+                    out = logsinrom[phase & 0xff];
+                }
+                break;
+            case 4:
+            case 5:
+                if (wf == 4 && (phase & 0x300) == 0x100)
+                {
+                    neg = 1;
+                }
+                if (phase & 0x200)
+                {
+                    out = 0x1000;
+                }
+                else if (phase & 0x80)
+                {
+                    out = logsinrom[((phase ^ 0xff) << 1) & 0xff];
+                }
+                else
+                {
+                    out = logsinrom[(phase << 1) & 0xff];
+                }
+                break;
+            case 6:
+                if (phase & 0x200)
+                {
+                    neg = 1;
+                }
+                break;
+            case 7:
+                if (phase & 0x200)
+                {
+                    neg = 1;
+                    out = ((phase & 0x1ff) ^ 0x1ff) << 3;
+                }
+                else
+                {
+                    out = phase << 3;
+                }
+                break;
+            }
+            wavetab[wf][phase] = out | (neg << 15);
+        }
+    }
+    wavetab_ready = 1;
+}
+
+static void OPL3_SlotGenerateGroup(opl3_slot* slot)
+{
+    Bit16u wave[3];
+    Bit16u env[3];
+    Bit8u ii;
+
+    for (ii = 0; ii < 3; ii++)
+    {
+        wave[ii] = wavetab[slot[ii].reg_wf][(Bit16u)(slot[ii].pg_phase_out + *slot[ii].mod) & 0x3ff];
+        env[ii] = (Bit16u)slot[ii].eg_out;
+    }
+#if defined(OPL_SIMD_SSE2)
+    {
+        __m128i w, lv, neg, r;
+        int l0, l1, l2;
+        w = _mm_setr_epi16(wave[0], wave[1], wave[2], 0, 0, 0, 0, 0);
+        neg = _mm_srai_epi16(w, 15);
+        lv = _mm_add_epi16(_mm_and_si128(w, _mm_set1_epi16(0x1fff)),
+            _mm_slli_epi16(_mm_setr_epi16(env[0], env[1], env[2], 0, 0, 0, 0, 0), 3));
+        lv = _mm_min_epi16(lv, _mm_set1_epi16(0x1fff));
+        l0 = _mm_extract_epi16(lv, 0);
+        l1 = _mm_extract_epi16(lv, 1);
+        l2 = _mm_extract_epi16(lv, 2);
+        r = _mm_mulhi_epu16(
+            _mm_slli_epi16(_mm_setr_epi16(exprom[l0 & 0xff], exprom[l1 & 0xff], exprom[l2 & 0xff], 0, 0, 0, 0, 0), 5),
+            _mm_setr_epi16(expmult[l0 >> 8], expmult[l1 >> 8], expmult[l2 >> 8], 0, 0, 0, 0, 0));
+        r = _mm_xor_si128(r, neg);
+        slot[0].out = (Bit16s)_mm_extract_epi16(r, 0);
+        slot[1].out = (Bit16s)_mm_extract_epi16(r, 1);
+        slot[2].out = (Bit16s)_mm_extract_epi16(r, 2);
+    }
+#elif defined(OPL_SIMD_NEON)
+    {
+        Bit16u level[4];
+        Bit16u expval[4] = { 0, 0, 0, 0 };
+        Bit16u mult[4] = { 0, 0, 0, 0 };
+        Bit16s res[4];
+        int16x4_t w, lv, neg;
+        uint16x4_t r;
+        Bit16u wv[4] = { wave[0], wave[1], wave[2], 0 };
+        Bit16u ev[4] = { env[0], env[1], env[2], 0 };
+        w = vreinterpret_s16_u16(vld1_u16(wv));
+        neg = vshr_n_s16(w, 15);
+        lv = vadd_s16(vand_s16(w, vdup_n_s16(0x1fff)), vshl_n_s16(vreinterpret_s16_u16(vld1_u16(ev)), 3));
+        lv = vmin_s16(lv, vdup_n_s16(0x1fff));
+        vst1_u16(level, vreinterpret_u16_s16(lv));
+        for (ii = 0; ii < 3; ii++)
+        {
+            expval[ii] = exprom[level[ii] & 0xff];
+            mult[ii] = expmult[level[ii] >> 8];
+        }
+        r = vshrn_n_u32(vmull_u16(vshl_n_u16(vld1_u16(expval), 5), vld1_u16(mult)), 16);
+        vst1_s16(res, veor_s16(vreinterpret_s16_u16(r), neg));
+        for (ii = 0; ii < 3; ii++)
+        {
+            slot[ii].out = res[ii];
+        }
+    }
+#else
+    for (ii = 0; ii < 3; ii++)
+    {
+        Bit32u level = (wave[ii] & 0x1fff) + (env[ii] << 3);
+        if (level > 0x1fff)
+        {
+            level = 0x1fff;
+        }
+        slot[ii].out = (Bit16s)(((exprom[level & 0xff] << 1) >> (level >> 8)) ^ (0 - (wave[ii] >> 15)));
+    }
+#endif
+}
+#endif
+
 //
 // Channel
 //
@@ -1049,22 +1258,44 @@ static Bit16s OPL3_ClipSample(Bit32s sample)
     return (Bit16s)sample;
 }
 
-void OPL3_Generate(opl3_chip* chip, Bit16s* buf)
+static void OPL3_GenerateSlots(opl3_chip* chip, Bit8u first, Bit8u last)
 {
     Bit8u ii;
-    Bit8u jj;
-    Bit16s accm;
-    Bit8u shift = 0;
-
-    buf[1] = OPL3_ClipSample(chip->mixbuff[1]);
 
-    for (ii = 0; ii < 15; ii++)
+#ifdef USE_OPL_SIMD
+    // Feedback, envelope and phase stay per slot, in order, since rhythm mode
+    // and the noise generator carry state from one slot to the next
+    for (ii = first; ii < last; ii++)
+    {
+        OPL3_SlotCalcFB(&chip->slot[ii]);
+        OPL3_EnvelopeCalc(&chip->slot[ii]);
+        OPL3_PhaseGenerate(&chip->slot[ii]);
+    }
+    for (ii = first; ii < last; ii += 3)
+    {
+        OPL3_SlotGenerateGroup(&chip->slot[ii]);
+    }
+#else
+    for (ii = first; ii < last; ii++)
     {
         OPL3_SlotCalcFB(&chip->slot[ii]);
         OPL3_EnvelopeCalc(&chip->slot[ii]);
         OPL3_PhaseGenerate(&chip->slot[ii]);
         OPL3_SlotGenerate(&chip->slot[ii]);
     }
+#endif
+}
+
+void OPL3_Generate(opl3_chip* chip, Bit16s* buf)
+{
+    Bit8u ii;
+    Bit8u jj;
+    Bit16s accm;
+    Bit8u shift = 0;
+
+    buf[1] = OPL3_ClipSample(chip->mixbuff[1]);
+
+    OPL3_GenerateSlots(chip, 0, 15);
 
     chip->mixbuff[0] = 0;
     for (ii = 0; ii < 18; ii++)
@@ -1077,23 +1308,11 @@ void OPL3_Generate(opl3_chip* chip, Bit16s* buf)
         chip->mixbuff[0] += (Bit16s)(accm & chip->channel[ii].cha);
     }
 
-    for (ii = 15; ii < 18; ii++)
-    {
-        OPL3_SlotCalcFB(&chip->slot[ii]);
-        OPL3_EnvelopeCalc(&chip->slot[ii]);
-        OPL3_PhaseGenerate(&chip->slot[ii]);
-        OPL3_SlotGenerate(&chip->slot[ii]);
-    }
+    OPL3_GenerateSlots(chip, 15, 18);
 
     buf[0] = OPL3_ClipSample(chip->mixbuff[0]);
 
-    for (ii = 18; ii < 33; ii++)
-    {
-        OPL3_SlotCalcFB(&chip->slot[ii]);
-        OPL3_EnvelopeCalc(&chip->slot[ii]);
-        OPL3_PhaseGenerate(&chip->slot[ii]);
-        OPL3_SlotGenerate(&chip->slot[ii]);
-    }
+    OPL3_GenerateSlots(chip, 18, 33);
 
     chip->mixbuff[1] = 0;
     for (ii = 0; ii < 18; ii++)
@@ -1106,13 +1325,7 @@ void OPL3_Generate(opl3_chip* chip, Bit16s* buf)
         chip->mixbuff[1] += (Bit16s)(accm & chip->channel[ii].chb);
     }
 
-    for (ii = 33; ii < 36; ii++)
-    {
-        OPL3_SlotCalcFB(&chip->slot[ii]);
-        OPL3_EnvelopeCalc(&chip->slot[ii]);
-        OPL3_PhaseGenerate(&chip->slot[ii]);
-        OPL3_SlotGenerate(&chip->slot[ii]);
-    }
+    OPL3_GenerateSlots(chip, 33, 36);
 
     if ((chip->timer & 0x3f) == 0x3f)
     {
@@ -1202,6 +1415,12 @@ void OPL3_Reset(opl3_chip* chip, Bit32u samplerate)
     Bit8u slotnum;
     Bit8u channum;
 
+#ifdef USE_OPL_SIMD
+    if (!wavetab_ready)
+    {
+        OPL3_WaveTableInit();
+    }
+#endif
     memset(chip, 0, sizeof(opl3_chip));
     for (slotnum = 0; slotnum < 36; slotnum++)
     {
@@ -157,6 +157,7 @@ void OPL3_GenerateStream(opl3_chip* chip, Bit16s* sndptr, Bit32u numsamples);
 
 //added for interfacing with XTulator
 int16_t OPL3_getSample(opl3_chip* chip);
+uint8_t OPL3_read(opl3_chip* chip, uint32_t portnum);
 void OPL3_write(opl3_chip* chip, uint32_t portnum, uint8_t value);
 void OPL3_init(opl3_chip* chip);
 
@@ -99,32 +99,32 @@ void opl2_writeData(OPL2_t* opl2, uint8_t value) {
 			opl2->oper[op1].attackval = 0;
 			opl2->oper[op1].decayval = 0;
 			opl2->oper[op1].envelope = 0.01;
-			timing_timerEnable(opl2->oper[op1].timer);
-#ifdef DEBUG_OPL2
-			debug_log(DEBUG_DETAIL, "[OPL2] Key on channel %u, frequency: %f\r\n", ch, opl2->chan[ch].frequency);
-#endif
+			opl2->oper[op1].ticking = 1;
+			if (DEBUG_ON(DEBUG_SUB_OPL2)) {
+				debug_log(DEBUG_DETAIL, "[OPL2] Key on channel %u, frequency: %f\r\n", ch, opl2->chan[ch].frequency);
+			}
 		}
 		else {
 			opl2->chan[ch].on = (value & 0x20) ? 1 : 0;
 			opl2->oper[op1].amplitude = 0;
 			opl2->oper[op2].amplitude = 0;
-			timing_timerDisable(opl2->oper[op1].timer);
-			timing_timerDisable(opl2->oper[op2].timer);
+			opl2->oper[op1].ticking = 0;
+			opl2->oper[op2].ticking = 0;
 		}
 	}
 	else if ((opl2->addr >= 0xE0) && (opl2->addr <= 0xF5)) {
 		op = opl2->addr - 0xE0;
 		opl2->oper[op].waveform = value & 3;
-#ifdef DEBUG_OPL2
-		debug_log(DEBUG_DETAIL, "[OPL2] Oper %u waveform set to %u\r\n", op, value & 3);
-#endif
+		if (DEBUG_ON(DEBUG_SUB_OPL2)) {
+			debug_log(DEBUG_DETAIL, "[OPL2] Oper %u waveform set to %u\r\n", op, value & 3);
+		}
 	}
 }
 
 void opl2_write(OPL2_t* opl2, uint16_t portnum, uint8_t value) {
-#ifdef DEBUG_OPL2
-	debug_log(DEBUG_DETAIL, "[OPL2] Write %03X: %u\r\n", portnum, value);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_OPL2)) {
+		debug_log(DEBUG_DETAIL, "[OPL2] Write %03X: %u\r\n", portnum, value);
+	}
 
 	portnum &= 1;
 	switch (portnum) {
@@ -139,9 +139,9 @@ void opl2_write(OPL2_t* opl2, uint16_t portnum, uint8_t value) {
 }
 
 uint8_t opl2_read(OPL2_t* opl2, uint16_t portnum) {
-#ifdef DEBUG_OPL2
-	debug_log(DEBUG_DETAIL, "[OPL2] Read %03X\r\n", portnum);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_OPL2)) {
+		debug_log(DEBUG_DETAIL, "[OPL2] Read %03X\r\n", portnum);
+	}
 	portnum &= 1;
 	if (portnum == 0) { //status port
 		uint8_t ret;
@@ -167,6 +167,9 @@ int16_t opl2_generateSample(OPL2_t* opl2) {
 
 	for (op = 0; op < 0x16; op++) {
 		if (optochan[op] != 255) {
+			if (opl2->oper[op].ticking) {
+				opl2_tickOperator(&opl2->oper[op].opdata);
+			}
 			val += opl2->oper[op].sample;
 		}
 	}
@@ -234,6 +237,5 @@ void opl2_init(OPL2_t* opl2) {
 		//opl2->oper[i].opdata.chan = i;
 		opl2->oper[i].opdata.op = i;
 		opl2->oper[i].opdata.opl2 = (void*)opl2;
-		opl2->oper[i].timer = timing_addTimer(opl2_tickOperator, &opl2->oper[i].opdata, SAMPLE_RATE, TIMING_DISABLED);
 	}
 }
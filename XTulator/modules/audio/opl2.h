@@ -21,7 +21,7 @@ typedef struct {
 		uint8_t on;
 	} chan[9];
 	struct {
-		uint32_t timer;
+		uint8_t ticking; //keyed on, stepped once per generated sample
 		double amplitude;
 		double envelope;
 		double sample;
@@ -0,0 +1,176 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Runs OPL3 synthesis on its own thread.
+
+	Port writes from the emulation thread go into a single-producer/single-consumer
+	queue, stamped with the output sample they should take effect at. The synth
+	thread applies them when it gets to that sample and renders into a ring that
+	the mixer reads from. It's allowed to get OPLTHREAD_LEAD samples ahead of the
+	mixer, and writes are stamped that far ahead too, so every write lands on the
+	exact sample it was meant for at the cost of OPLTHREAD_LEAD samples of latency.
+
+	The counters are free-running and masked on access, same as the sdlaudio ring.
+*/
+
+#include "../../config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include "oplthread.h"
+#include "nukedopl.h"
+#include "../../ports.h"
+#include "../../utility.h"
+#include "../../debuglog.h"
+#include "../../hostthread.h"
+#ifdef _WIN32
+#include <Windows.h>
+#include <SDL.h>
+#include <process.h>
+#else
+#include <SDL.h>
+#include <pthread.h>
+pthread_t oplthread_threadID;
+#endif
+
+typedef struct {
+	uint32_t time;
+	uint16_t reg;
+	uint8_t value;
+} OPLTHREAD_WRITE_t;
+
+OPLTHREAD_WRITE_t oplthread_queue[OPLTHREAD_QUEUESIZE];
+SDL_atomic_t oplthread_qhead, oplthread_qtail;
+
+int16_t oplthread_ring[OPLTHREAD_RINGSIZE * 2];
+SDL_atomic_t oplthread_rhead, oplthread_consumed;
+
+opl3_chip* oplthread_chip = NULL;
+uint8_t oplthread_enabled = 0, oplthread_running = 0;
+
+void oplthread_write(opl3_chip* chip, uint32_t portnum, uint8_t value) {
+	static uint16_t port = 0;
+	uint32_t head;
+
+	switch (portnum) {
+	case 0x388:
+		port = value;
+		break;
+	case 0x389:
+		if (port == 0x04) {
+			chip->data4 = value; //status reads stay on this thread
+		}
+		head = (uint32_t)SDL_AtomicGet(&oplthread_qhead);
+		if ((head - (uint32_t)SDL_AtomicGet(&oplthread_qtail)) >= OPLTHREAD_QUEUESIZE) {
+			debug_log(DEBUG_ERROR, "[OPL] Write queue overflow, dropping register %03X write\r\n", port);
+			break;
+		}
+		oplthread_queue[head & (OPLTHREAD_QUEUESIZE - 1)].time = (uint32_t)SDL_AtomicGet(&oplthread_consumed) + OPLTHREAD_LEAD;
+		oplthread_queue[head & (OPLTHREAD_QUEUESIZE - 1)].reg = port;
+		oplthread_queue[head & (OPLTHREAD_QUEUESIZE - 1)].value = value;
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&oplthread_qhead, (int)(head + 1));
+		break;
+	}
+}
+
+#ifdef _WIN32
+void oplthread_thread(void* dummy) {
+#else
+void* oplthread_thread(void* dummy) {
+#endif
+	uint32_t pos, limit, qtail;
+	OPLTHREAD_WRITE_t* w;
+
+	hostthread_apply(HOSTTHREAD_AUDIO);
+
+	pos = 0;
+	qtail = 0;
+	while (oplthread_running) {
+		limit = (uint32_t)SDL_AtomicGet(&oplthread_consumed) + OPLTHREAD_LEAD;
+		if ((int32_t)(limit - pos) <= 0) {
+			utility_sleep(1);
+			continue;
+		}
+		while ((int32_t)(limit - pos) > 0) {
+			while (qtail != (uint32_t)SDL_AtomicGet(&oplthread_qhead)) {
+				SDL_MemoryBarrierAcquire();
+				w = &oplthread_queue[qtail & (OPLTHREAD_QUEUESIZE - 1)];
+				if ((int32_t)(w->time - pos) > 0) break;
+				OPL3_WriteRegBuffered(oplthread_chip, w->reg, w->value);
+				qtail++;
+				SDL_AtomicSet(&oplthread_qtail, (int)qtail);
+			}
+			OPL3_GenerateResampled(oplthread_chip, &oplthread_ring[(pos & (OPLTHREAD_RINGSIZE - 1)) << 1]);
+			pos++;
+			SDL_MemoryBarrierRelease();
+			SDL_AtomicSet(&oplthread_rhead, (int)pos);
+		}
+	}
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+//Takes count stereo samples for the mixer, repeating the last one if the synth thread fell behind
+void oplthread_read(int16_t* buf, uint32_t count) {
+	static int16_t last[2] = { 0, 0 };
+	uint32_t consumed, head, i, idx;
+
+	consumed = (uint32_t)SDL_AtomicGet(&oplthread_consumed);
+	head = (uint32_t)SDL_AtomicGet(&oplthread_rhead);
+	SDL_MemoryBarrierAcquire();
+	for (i = 0; i < count; i++) {
+		idx = consumed + i;
+		if ((int32_t)(head - idx) > 0) {
+			last[0] = oplthread_ring[(idx & (OPLTHREAD_RINGSIZE - 1)) << 1];
+			last[1] = oplthread_ring[((idx & (OPLTHREAD_RINGSIZE - 1)) << 1) + 1];
+		}
+		buf[i << 1] = last[0];
+		buf[(i << 1) + 1] = last[1];
+	}
+	SDL_AtomicSet(&oplthread_consumed, (int)(consumed + count));
+}
+
+int oplthread_init(opl3_chip* chip) {
+	debug_log(DEBUG_INFO, "[OPL] Moving synthesis to a worker thread\r\n");
+
+	oplthread_chip = chip;
+	SDL_AtomicSet(&oplthread_qhead, 0);
+	SDL_AtomicSet(&oplthread_qtail, 0);
+	SDL_AtomicSet(&oplthread_rhead, 0);
+	SDL_AtomicSet(&oplthread_consumed, 0);
+	oplthread_running = 1;
+
+#ifdef _WIN32
+	if (_beginthread(oplthread_thread, 0, NULL) == (uintptr_t)-1) {
+		oplthread_running = 0;
+		return -1;
+	}
+#else
+	if (pthread_create(&oplthread_threadID, NULL, oplthread_thread, NULL)) {
+		oplthread_running = 0;
+		return -1;
+	}
+#endif
+
+	ports_cbRegister(0x388, 2, (void*)OPL3_read, NULL, (void*)oplthread_write, NULL, chip);
+
+	return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef _OPLTHREAD_H_
+#define _OPLTHREAD_H_
+
+#include <stdint.h>
+#include "nukedopl.h"
+
+#define OPLTHREAD_QUEUESIZE		4096 //register writes in flight, must be a power of two
+#define OPLTHREAD_RINGSIZE		1024 //rendered stereo samples, must be a power of two and more than OPLTHREAD_LEAD
+#define OPLTHREAD_LEAD			512 //how many samples the synth thread may render ahead of the mixer
+
+extern uint8_t oplthread_enabled, oplthread_running;
+
+int oplthread_init(opl3_chip* chip);
+void oplthread_read(int16_t* buf, uint32_t count);
+
+#endif
@@ -24,16 +24,54 @@
 #include "pcspeaker.h"
 #include "../../timing.h"
 
+/*
+	Gate changes aren't applied right away. They're queued with the guest clock
+	time they happened at, and pcspeaker_render applies each one when it reaches
+	that point in the block it's producing, so a port 61h toggle lands on the
+	right output sample no matter how coarse the mixer's block size is.
+*/
+
+static void pcspeaker_apply(PCSPEAKER_t* spk, PCSPEAKER_EVENT_t* ev) {
+	if (ev->gate == PC_SPEAKER_EV_SELECT) {
+		spk->pcspeaker_gateSelect = ev->value;
+	}
+	else {
+		spk->pcspeaker_gate[ev->gate] = ev->value;
+	}
+}
+
+static void pcspeaker_post(PCSPEAKER_t* spk, uint8_t gate, uint8_t value) {
+	PCSPEAKER_EVENT_t* ev;
+
+	if ((uint16_t)(spk->evhead - spk->evtail) == PC_SPEAKER_EVENTS) { //full, the oldest one is as good as played
+		pcspeaker_apply(spk, &spk->events[spk->evtail % PC_SPEAKER_EVENTS]);
+		spk->evtail++;
+	}
+	ev = &spk->events[spk->evhead % PC_SPEAKER_EVENTS];
+	ev->time = timing_getGuestCur();
+	ev->gate = gate;
+	ev->value = value;
+	spk->evhead++;
+}
+
 void pcspeaker_setGateState(PCSPEAKER_t* spk, uint8_t gate, uint8_t value) {
-	spk->pcspeaker_gate[gate] = value;
+	pcspeaker_post(spk, gate, value);
 }
 
 void pcspeaker_selectGate(PCSPEAKER_t* spk, uint8_t value) {
-	spk->pcspeaker_gateSelect = value;
+	pcspeaker_post(spk, PC_SPEAKER_EV_SELECT, value);
 }
 
-void pcspeaker_callback(PCSPEAKER_t* spk) {
+void pcspeaker_setTimer2Source(PCSPEAKER_t* spk, void* callback, void* data) {
+	spk->timer2 = (uint8_t (*)(void*, uint64_t))callback;
+	spk->timer2data = data;
+}
+
+static void pcspeaker_step(PCSPEAKER_t* spk, uint64_t when) {
 	if (spk->pcspeaker_gateSelect == PC_SPEAKER_USE_TIMER2) {
+		if (spk->timer2 != NULL) {
+			spk->pcspeaker_gate[PC_SPEAKER_GATE_TIMER2] = (*spk->timer2)(spk->timer2data, when);
+		}
 		if (spk->pcspeaker_gate[PC_SPEAKER_GATE_TIMER2] && spk->pcspeaker_gate[PC_SPEAKER_GATE_DIRECT]) {
 			if (spk->pcspeaker_amplitude < 15000) {
 				spk->pcspeaker_amplitude += PC_SPEAKER_MOVEMENT;
@@ -62,10 +100,25 @@ void pcspeaker_callback(PCSPEAKER_t* spk) {
 	if (spk->pcspeaker_amplitude < 0) spk->pcspeaker_amplitude = 0;
 }
 
+//Renders count output samples, the first at guest time start and each following one step ticks later
+void pcspeaker_render(PCSPEAKER_t* spk, int16_t* buf, uint32_t count, uint64_t start, double step) {
+	uint32_t i;
+	uint64_t t;
+
+	for (i = 0; i < count; i++) {
+		t = start + (uint64_t)((double)i * step);
+		while ((spk->evtail != spk->evhead) && (spk->events[spk->evtail % PC_SPEAKER_EVENTS].time <= t)) {
+			pcspeaker_apply(spk, &spk->events[spk->evtail % PC_SPEAKER_EVENTS]);
+			spk->evtail++;
+		}
+		pcspeaker_step(spk, t);
+		buf[i] = spk->pcspeaker_amplitude;
+	}
+}
+
 void pcspeaker_init(PCSPEAKER_t* spk) {
 	memset(spk, 0, sizeof(PCSPEAKER_t));
 	spk->pcspeaker_gateSelect = PC_SPEAKER_GATE_DIRECT;
-	timing_addTimer(pcspeaker_callback, spk, SAMPLE_RATE, TIMING_ENABLED);
 }
 
 int16_t pcspeaker_getSample(PCSPEAKER_t* spk) {
@@ -11,15 +11,30 @@
 
 #define PC_SPEAKER_MOVEMENT		800
 
+#define PC_SPEAKER_EVENTS		256
+#define PC_SPEAKER_EV_SELECT	0xFF //event changes gateSelect instead of a gate
+
+typedef struct {
+	uint64_t time;
+	uint8_t gate;
+	uint8_t value;
+} PCSPEAKER_EVENT_t;
+
 typedef struct {
 	uint8_t pcspeaker_gateSelect;
 	uint8_t pcspeaker_gate[2];
 	int16_t pcspeaker_amplitude;
+	uint8_t (*timer2)(void*, uint64_t); //returns the PIT channel 2 output at a guest clock time when sampling for PC_SPEAKER_USE_TIMER2
+	void* timer2data;
+	PCSPEAKER_EVENT_t events[PC_SPEAKER_EVENTS]; //gate changes stamped with guest time, waiting for pcspeaker_render
+	uint16_t evhead, evtail;
 } PCSPEAKER_t;
 
 void pcspeaker_setGateState(PCSPEAKER_t* spk, uint8_t gate, uint8_t value);
 void pcspeaker_selectGate(PCSPEAKER_t* spk, uint8_t value);
+void pcspeaker_setTimer2Source(PCSPEAKER_t* spk, void* callback, void* data);
 int16_t pcspeaker_getSample(PCSPEAKER_t* spk);
+void pcspeaker_render(PCSPEAKER_t* spk, int16_t* buf, uint32_t count, uint64_t start, double step);
 void pcspeaker_init(PCSPEAKER_t* spk);
 
 #endif
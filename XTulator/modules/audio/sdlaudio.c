@@ -29,10 +29,14 @@
 #include "pcspeaker.h"
 #include "opl2.h"
 #include "blaster.h"
+#include "oplthread.h"
 #include "../../machine.h"
 #include "../../timing.h"
 #include "../../utility.h"
 #include "../../debuglog.h"
+#include "../../hostthread.h"
+#include "../../capture.h"
+#include "../../metrics.h"
 #ifdef _WIN32
 #include <Windows.h>
 #include <SDL.h>
@@ -44,51 +48,55 @@
 pthread_t sdlaudio_sampleThreadID;
 #endif
 
-SDL_mutex* sdlaudio_mutex = NULL;
-SDL_cond* sdlaudio_canFill = NULL;
-SDL_cond* sdlaudio_canBuffer = NULL;
-
-int16_t sdlaudio_buffer[SAMPLE_BUFFER], sdlaudio_bufferpos = 0;
-double sdlaudio_rateFast;
+/*
+	Samples go from the emulation thread to the SDL audio callback through a
+	single-producer/single-consumer ring. head is only written by the producer
+	and tail only by the consumer, so no lock is needed, just release/acquire
+	ordering on the indexes. They're free-running counters, masked on access.
+
+	The generator timer's rate is nudged up or down so the ring hovers around
+	SDLAUDIO_TARGETFILL instead of running dry or overflowing.
+
+	Audio is rendered SDLAUDIO_BLOCK samples at a time. Each source renders the
+	guest clock span since the previous block into its own buffer, using the
+	timestamped state changes it queued in between, and the buffers are mixed.
+	OPL register writes already carry their own sample timestamps through the
+	chip's write buffer.
+*/
+int16_t sdlaudio_ring[SDLAUDIO_RINGSIZE];
+SDL_atomic_t sdlaudio_head, sdlaudio_tail;
 
-uint8_t sdlaudio_firstfill = 1, sdlaudio_timeIdx = 0;
 SDL_AudioSpec sdlaudio_gotspec;
 uint32_t sdlaudio_timer;
-uint64_t sdlaudio_cbTime[10] = { //history of time between callbacks to dynamically adjust our sample generation
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-};
-double sdlaudio_genSampRate = SAMPLE_RATE;
-double sdlaudio_genInterval;
+double sdlaudio_genSampRate = SAMPLE_RATE, sdlaudio_avgFill = SDLAUDIO_TARGETFILL;
+uint32_t sdlaudio_sinceAdjust = 0;
+uint64_t sdlaudio_lastBlock = 0;
 
-volatile uint8_t sdlaudio_updateTiming = 0;
+volatile uint8_t sdlaudio_updateTiming = 0, sdlaudio_playing = 0;
+uint8_t sdlaudio_deferred = 0; //set from sdlaudio_init until the first sound register write opens the device
+uint8_t sdlaudio_opened = 0, sdlaudio_suspended = 0;
 
 MACHINE_t* sdlaudio_useMachine = NULL;
 
 void sdlaudio_moveBuffer(int16_t* dst, int len);
 
 void sdlaudio_fill(void* udata, uint8_t* stream, int len) {
-	static uint8_t timesmissed = 0;
-	static uint64_t curtime, lasttime;
-
-	//SDL_LockMutex(sdlaudio_mutex);
-	//SDL_CondWait(sdlaudio_canFill, sdlaudio_mutex);
+	static uint8_t applied = 0;
 
+	if (!applied) { //SDL's own thread, this is the first chance to get at it
+		hostthread_apply(HOSTTHREAD_AUDIO);
+		applied = 1;
+	}
 	sdlaudio_moveBuffer((int16_t*)stream, len);
-
-	//SDL_UnlockMutex(sdlaudio_mutex);
-	//SDL_CondSignal(sdlaudio_canBuffer);
 }
 
-int sdlaudio_init(MACHINE_t* machine) {
+static int sdlaudio_open() {
 	SDL_AudioSpec wanted;
 
-	if (machine == NULL) return -1;
-
-	if (SDL_Init(SDL_INIT_AUDIO)) return -1;
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO)) return -1;
 
-	sdlaudio_mutex = SDL_CreateMutex();
-	sdlaudio_canFill = SDL_CreateCond();
-	sdlaudio_canBuffer = SDL_CreateCond();
+	SDL_AtomicSet(&sdlaudio_head, 0);
+	SDL_AtomicSet(&sdlaudio_tail, 0);
 
 	wanted.freq = SAMPLE_RATE;
 	wanted.format = AUDIO_S16;
@@ -101,92 +109,175 @@ int sdlaudio_init(MACHINE_t* machine) {
 		return -1;
 	}
 
-	sdlaudio_useMachine = machine;
+	sdlaudio_lastBlock = timing_getGuestCur();
+	sdlaudio_timer = timing_addTimer(sdlaudio_generateBlock, NULL, (double)SAMPLE_RATE / (double)SDLAUDIO_BLOCK, sdlaudio_suspended ? TIMING_DISABLED : TIMING_ENABLED);
+	sdlaudio_opened = 1;
 
-	sdlaudio_rateFast = (double)(SAMPLE_RATE) * 1.01;
+	SDL_PauseAudio(1);
+
+	return 0;
+}
 
-	sdlaudio_timer = timing_addTimer(sdlaudio_generateSample, NULL, SAMPLE_RATE, TIMING_ENABLED);
+/*
+	Opening the audio device can take a good while on some hosts, and a lot of
+	runs never make a sound, so it's put off until the guest first writes a
+	sound register: port 61h with the speaker data bit set, the OPL ports, or
+	the Sound Blaster's. Until then nothing is rendered, and the speaker and
+	Sound Blaster just queue up state changes as they do when headless.
+*/
+int sdlaudio_init(MACHINE_t* machine) {
+	if (machine == NULL) return -1;
 
-	SDL_PauseAudio(1);
-	SDL_CondSignal(sdlaudio_canFill);
-	SDL_CondSignal(sdlaudio_canBuffer);
+	sdlaudio_useMachine = machine;
+	sdlaudio_deferred = 1;
 
 	return 0;
 }
 
-void sdlaudio_bufferSample(int16_t val) {
-	if (sdlaudio_bufferpos == SAMPLE_BUFFER) { //this shouldn't happen
+//From port_write while the device is still unopened
+void sdlaudio_portWrite(uint16_t portnum, uint8_t value) {
+	if (portnum == 0x61) {
+		if (!(value & 0x02)) return;
+	}
+	else if ((portnum != 0x388) && (portnum != 0x389) && ((portnum < 0x220) || (portnum > 0x22F))) {
 		return;
 	}
 
-	//SDL_LockMutex(sdlaudio_mutex);
-	//SDL_CondWait(sdlaudio_canBuffer, sdlaudio_mutex);
+	sdlaudio_deferred = 0;
+	if (sdlaudio_open()) {
+		debug_log(DEBUG_INFO, "[WARNING] SDL audio initialization failure\r\n");
+		return;
+	}
+	debug_log(DEBUG_DETAIL, "[SDLAUDIO] Opened audio device on first write to port %03X\r\n", portnum);
+}
 
-	sdlaudio_buffer[sdlaudio_bufferpos++] = val;
+uint32_t sdlaudio_bufferFill() {
+	return (uint32_t)SDL_AtomicGet(&sdlaudio_head) - (uint32_t)SDL_AtomicGet(&sdlaudio_tail);
+}
 
-	if (sdlaudio_bufferpos < (int)((double)(SAMPLE_BUFFER) * 0.5)) {
-		sdlaudio_updateTiming = SDLAUDIO_TIMING_FAST;
-	}
-	else if (sdlaudio_bufferpos >= (int)((double)(SAMPLE_BUFFER) * 0.75)) {
-		sdlaudio_updateTiming = SDLAUDIO_TIMING_NORMAL;
-	}
+void sdlaudio_bufferSample(int16_t val) {
+	uint32_t head, fill;
 
-	if (sdlaudio_bufferpos == SAMPLE_BUFFER) {
-		timing_timerDisable(sdlaudio_timer);
+	head = (uint32_t)SDL_AtomicGet(&sdlaudio_head);
+	fill = head - (uint32_t)SDL_AtomicGet(&sdlaudio_tail);
+	if (fill >= SAMPLE_BUFFER) { //consumer isn't keeping up or isn't running yet, drop it
+		return;
 	}
 
-	//SDL_UnlockMutex(sdlaudio_mutex);
-	//SDL_CondSignal(sdlaudio_canFill);
+	sdlaudio_ring[head & (SDLAUDIO_RINGSIZE - 1)] = val;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&sdlaudio_head, (int)(head + 1));
+
+	//fill-level feedback: every so often, pick a generation rate that pulls the ring back toward the target
+	sdlaudio_avgFill += ((double)fill - sdlaudio_avgFill) / 256.0;
+	if (++sdlaudio_sinceAdjust >= SDLAUDIO_ADJUSTEVERY) {
+		double rate;
+		sdlaudio_sinceAdjust = 0;
+		rate = (double)SAMPLE_RATE * (1.0 + SDLAUDIO_MAXSKEW * ((double)SDLAUDIO_TARGETFILL - sdlaudio_avgFill) / (double)SDLAUDIO_TARGETFILL);
+		if (rate < (double)SAMPLE_RATE * (1.0 - SDLAUDIO_MAXSKEW)) rate = (double)SAMPLE_RATE * (1.0 - SDLAUDIO_MAXSKEW);
+		if (rate > (double)SAMPLE_RATE * (1.0 + SDLAUDIO_MAXSKEW)) rate = (double)SAMPLE_RATE * (1.0 + SDLAUDIO_MAXSKEW);
+		sdlaudio_genSampRate = rate;
+		sdlaudio_updateTiming = 1;
+	}
 }
 
 void sdlaudio_updateSampleTiming() {
-	if (sdlaudio_updateTiming == SDLAUDIO_TIMING_FAST) {
-		timing_updateIntervalFreq(sdlaudio_timer, sdlaudio_rateFast);
+	if (!sdlaudio_updateTiming) return;
+	sdlaudio_updateTiming = 0;
+	timing_updateIntervalFreq(sdlaudio_timer, sdlaudio_genSampRate / (double)SDLAUDIO_BLOCK);
+	if (sdlaudio_suspended) return;
+	if (sdlaudio_playing && (sdlaudio_bufferFill() < SDLAUDIO_LOWWATER)) { //about to underrun, don't wait for the next tick
+		sdlaudio_generateBlock(NULL);
 	}
-	else if (sdlaudio_updateTiming == SDLAUDIO_TIMING_NORMAL) {
-		timing_updateIntervalFreq(sdlaudio_timer, SAMPLE_RATE);
+	if (!sdlaudio_playing && (sdlaudio_bufferFill() >= SDLAUDIO_TARGETFILL)) { //don't start playback until there's a cushion
+		sdlaudio_playing = 1;
 		SDL_PauseAudio(0);
 	}
-	sdlaudio_updateTiming = 0;
 }
 
-//I need to make this use a ring buffer soon...
 void sdlaudio_moveBuffer(int16_t* dst, int len) {
-	int i;
-	memset(dst, 0, len);
-
-	if (sdlaudio_bufferpos < (int)((double)(SAMPLE_BUFFER) * 0.75)) {
-		timing_timerEnable(sdlaudio_timer);
+	uint32_t tail, avail, count, i;
+
+	count = (uint32_t)len >> 1;
+	tail = (uint32_t)SDL_AtomicGet(&sdlaudio_tail);
+	avail = (uint32_t)SDL_AtomicGet(&sdlaudio_head) - tail;
+	SDL_MemoryBarrierAcquire();
+	if (avail > count) {
+		avail = count;
 	}
 
-	if ((sdlaudio_bufferpos << 1) < len) {
-		SDL_PauseAudio(1);
-		return;
+	for (i = 0; i < avail; i++) {
+		dst[i] = sdlaudio_ring[(tail + i) & (SDLAUDIO_RINGSIZE - 1)];
+	}
+	metrics.audio.callbacks++;
+	if (avail < count) {
+		metrics.audio.underruns++;
+		metrics.audio.underrunSamples += count - avail;
 	}
+	for (; i < count; i++) { //underrun, pad with silence rather than stopping the device
+		dst[i] = 0;
+	}
+
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&sdlaudio_tail, (int)(tail + avail));
+}
 
-	for (i = 0; i < (len >> 1); i++) {
-		dst[i] = sdlaudio_buffer[i];
+/*
+	Stops generating sound while fast-forwarding. The speaker and Sound Blaster
+	queues apply their oldest changes as they fill, the same as when headless,
+	so nothing backs up. Playback starts again once the ring has a cushion.
+*/
+void sdlaudio_suspend(uint8_t suspend) {
+	sdlaudio_suspended = suspend;
+	if (!sdlaudio_opened) return;
+	if (suspend) {
+		timing_timerDisable(sdlaudio_timer);
+		SDL_PauseAudio(1);
+		sdlaudio_playing = 0;
+		SDL_AtomicSet(&sdlaudio_tail, SDL_AtomicGet(&sdlaudio_head)); //the callback is paused, so it's safe to drop what's queued
 	}
-	for (; i < sdlaudio_bufferpos; i++) {
-		sdlaudio_buffer[i - (len >> 1)] = sdlaudio_buffer[i];
+	else {
+		sdlaudio_lastBlock = timing_getGuestCur();
+		timing_timerEnable(sdlaudio_timer);
 	}
-	sdlaudio_bufferpos -= len >> 1;
 }
 
-void sdlaudio_generateSample(void* dummy) {
-	int16_t val;
+void sdlaudio_generateBlock(void* dummy) {
+	int16_t spk[SDLAUDIO_BLOCK], opl[SDLAUDIO_BLOCK * 2], sb[SDLAUDIO_BLOCK], mix[SDLAUDIO_BLOCK];
+	uint64_t now;
+	double step;
+	int32_t val;
+	uint32_t i;
+
+	now = timing_getGuestCur();
+	step = (now > sdlaudio_lastBlock) ? (double)(now - sdlaudio_lastBlock) / (double)SDLAUDIO_BLOCK : 0.0;
 
-	val = pcspeaker_getSample(&sdlaudio_useMachine->pcspeaker) / 3;
-	//val += opl2_generateSample(&sdlaudio_useMachine->OPL2) / 3;
+	pcspeaker_render(&sdlaudio_useMachine->pcspeaker, spk, SDLAUDIO_BLOCK, sdlaudio_lastBlock, step);
 	if (sdlaudio_useMachine->mixOPL) {
-		int16_t OPLsample[2];
-		//val += sdlaudio_getOPLsample() / 2;
-		OPL3_GenerateStream(&sdlaudio_useMachine->OPL3, OPLsample, 1);
-		val += OPLsample[0] / 2;
+		if (oplthread_running) {
+			oplthread_read(opl, SDLAUDIO_BLOCK);
+		}
+		else {
+			OPL3_GenerateStream(&sdlaudio_useMachine->OPL3, opl, SDLAUDIO_BLOCK);
+		}
 	}
 	if (sdlaudio_useMachine->mixBlaster) {
-		val += blaster_getSample(&sdlaudio_useMachine->blaster) / 3;
+		blaster_render(&sdlaudio_useMachine->blaster, sb, SDLAUDIO_BLOCK, sdlaudio_lastBlock, step);
+	}
+	sdlaudio_lastBlock = now;
+
+	for (i = 0; i < SDLAUDIO_BLOCK; i++) {
+		val = spk[i] / 3;
+		if (sdlaudio_useMachine->mixOPL) {
+			val += opl[i << 1] / 2;
+		}
+		if (sdlaudio_useMachine->mixBlaster) {
+			val += sb[i] / 3;
+		}
+		mix[i] = (int16_t)val;
+		sdlaudio_bufferSample(mix[i]);
+	}
+	if (capture_enabled) {
+		capture_audio(mix, SDLAUDIO_BLOCK);
 	}
-
-	sdlaudio_bufferSample(val);
 }
@@ -8,11 +8,20 @@
 #endif
 #include "../../machine.h"
 
-#define SDLAUDIO_TIMING_FAST		1
-#define SDLAUDIO_TIMING_NORMAL		2
+#define SDLAUDIO_RINGSIZE		8192 //must be a power of two and at least SAMPLE_BUFFER
+#define SDLAUDIO_TARGETFILL		(SAMPLE_BUFFER / 2)
+#define SDLAUDIO_ADJUSTEVERY	512 //samples between generation rate adjustments
+#define SDLAUDIO_MAXSKEW		0.02 //generation rate may stray this far from SAMPLE_RATE
+#define SDLAUDIO_BLOCK			64 //samples rendered per mixer timer tick
+#define SDLAUDIO_LOWWATER		(SAMPLE_BUFFER / 4) //render an extra block right away if the ring drops below this
+
+extern uint8_t sdlaudio_deferred;
 
 int sdlaudio_init(MACHINE_t* machine);
-void sdlaudio_generateSample(void* dummy);
+void sdlaudio_portWrite(uint16_t portnum, uint8_t value);
+uint32_t sdlaudio_bufferFill();
+void sdlaudio_generateBlock(void* dummy);
 void sdlaudio_updateSampleTiming();
+void sdlaudio_suspend(uint8_t suspend);
 
 #endif
@@ -27,29 +27,133 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <stdint.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
 #include "biosdisk.h"
+#include "diskcache.h"
 #include "../../cpu/cpu.h"
+#include "../../memory.h"
 #include "../../debuglog.h"
+#include "../../metrics.h"
 
 DISK_t biosdisk[4];
-uint8_t biosdisk_sectbuf[512];
+uint8_t biosdisk_xferbuf[BIOSDISK_MAXSECTS * 512];
 
 uint8_t bootdrive = 0xFF;
 
+//Maps the whole image file so sector transfers are plain memory copies, returns 0 on success
+int biosdisk_map(uint8_t drivenum) {
+	DISK_t* disk = &biosdisk[drivenum];
+
+	disk->map = NULL;
+	disk->mapping = NULL;
+	if (disk->filesize == 0) return -1;
+#ifdef _WIN32
+	disk->mapping = (void*)CreateFileMapping((HANDLE)_get_osfhandle(_fileno(disk->diskfile)), NULL, PAGE_READWRITE, 0, 0, NULL);
+	if (disk->mapping == NULL) return -1;
+	disk->map = (uint8_t*)MapViewOfFile((HANDLE)disk->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (disk->map == NULL) {
+		CloseHandle((HANDLE)disk->mapping);
+		disk->mapping = NULL;
+		return -1;
+	}
+#else
+	{
+		void* map = mmap(NULL, disk->filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(disk->diskfile), 0);
+		if (map == MAP_FAILED) return -1;
+		disk->map = (uint8_t*)map;
+	}
+#endif
+	return 0;
+}
+
+void biosdisk_unmap(uint8_t drivenum) {
+	DISK_t* disk = &biosdisk[drivenum];
+
+	if (disk->map == NULL) return;
+#ifdef _WIN32
+	FlushViewOfFile(disk->map, 0);
+	UnmapViewOfFile(disk->map);
+	CloseHandle((HANDLE)disk->mapping);
+#else
+	munmap(disk->map, disk->filesize);
+#endif
+	disk->map = NULL;
+	disk->mapping = NULL;
+}
+
+//Closes whatever backs an inserted disk
+static void biosdisk_close(uint8_t drivenum) {
+	biosdisk_unmap(drivenum);
+	diskcache_close(biosdisk[drivenum].cache);
+	biosdisk[drivenum].cache = -1;
+	if (biosdisk[drivenum].diskfile != NULL) fclose(biosdisk[drivenum].diskfile);
+	biosdisk[drivenum].diskfile = NULL;
+	cowdisk_close(biosdisk[drivenum].cow);
+	biosdisk[drivenum].cow = NULL;
+	packdisk_close(biosdisk[drivenum].pack);
+	biosdisk[drivenum].pack = NULL;
+}
+
+//filename can be "base,overlay=file" to keep the base image read-only and put guest writes in a copy-on-write overlay
 uint8_t biosdisk_insert(CPU_t* cpu, uint8_t drivenum, char* filename) {
+	char* overlay;
+
 	debug_log(DEBUG_INFO, "[BIOSDISK] Inserting disk %u: %s\r\n", drivenum, filename);
-	if (biosdisk[drivenum].inserted) fclose(biosdisk[drivenum].diskfile);
+	if (biosdisk[drivenum].inserted) {
+		biosdisk_close(drivenum);
+	}
+	biosdisk[drivenum].cache = -1;
+	biosdisk[drivenum].diskfile = NULL;
+	biosdisk[drivenum].cow = NULL;
+	biosdisk[drivenum].pack = NULL;
+	biosdisk[drivenum].map = NULL;
 	biosdisk[drivenum].inserted = 1;
-	biosdisk[drivenum].diskfile = fopen(filename, "r+b");
-	if (biosdisk[drivenum].diskfile == NULL) {
-		biosdisk[drivenum].inserted = 0;
-		debug_log(DEBUG_INFO, "[BIOSDISK] Failed to insert disk %u: %s\r\n", drivenum, filename);
-		return 1;
-	}
-	fseek(biosdisk[drivenum].diskfile, 0L, SEEK_END);
-	biosdisk[drivenum].filesize = ftell(biosdisk[drivenum].diskfile);
-	fseek(biosdisk[drivenum].diskfile, 0L, SEEK_SET);
+	overlay = strstr(filename, ",overlay=");
+	if (overlay != NULL) {
+		char base[512];
+		size_t len = overlay - filename;
+		if (len >= sizeof(base)) len = sizeof(base) - 1;
+		memcpy(base, filename, len);
+		base[len] = 0;
+		biosdisk[drivenum].cow = cowdisk_open(base, overlay + 9);
+		if (biosdisk[drivenum].cow == NULL) {
+			biosdisk[drivenum].inserted = 0;
+			debug_log(DEBUG_INFO, "[BIOSDISK] Failed to insert disk %u: %s\r\n", drivenum, filename);
+			return 1;
+		}
+		biosdisk[drivenum].filesize = biosdisk[drivenum].cow->hdr.basesize;
+	}
+	else if (packdisk_detect(filename)) {
+		biosdisk[drivenum].pack = packdisk_open(filename);
+		if (biosdisk[drivenum].pack == NULL) {
+			biosdisk[drivenum].inserted = 0;
+			debug_log(DEBUG_INFO, "[BIOSDISK] Failed to insert disk %u: %s\r\n", drivenum, filename);
+			return 1;
+		}
+		biosdisk[drivenum].filesize = biosdisk[drivenum].pack->hdr.size;
+	}
+	else {
+		biosdisk[drivenum].diskfile = fopen(filename, "r+b");
+		if (biosdisk[drivenum].diskfile == NULL) {
+			biosdisk[drivenum].inserted = 0;
+			debug_log(DEBUG_INFO, "[BIOSDISK] Failed to insert disk %u: %s\r\n", drivenum, filename);
+			return 1;
+		}
+		fseek(biosdisk[drivenum].diskfile, 0L, SEEK_END);
+		biosdisk[drivenum].filesize = ftell(biosdisk[drivenum].diskfile);
+		fseek(biosdisk[drivenum].diskfile, 0L, SEEK_SET);
+	}
+	if ((biosdisk[drivenum].diskfile != NULL) && biosdisk_map(drivenum)) {
+		debug_log(DEBUG_DETAIL, "[BIOSDISK] Unable to map disk %u into memory, using file I/O\r\n", drivenum);
+		biosdisk[drivenum].cache = diskcache_open(biosdisk[drivenum].diskfile, biosdisk[drivenum].filesize);
+	}
 	if (drivenum >= 2) { //it's a hard disk image
 		biosdisk[drivenum].sects = 63;
 		biosdisk[drivenum].heads = 16;
@@ -76,51 +180,136 @@ uint8_t biosdisk_insert(CPU_t* cpu, uint8_t drivenum, char* filename) {
 }
 
 void biosdisk_eject(CPU_t* cpu, uint8_t drivenum) {
+	if (biosdisk[drivenum].inserted) {
+		biosdisk_close(drivenum);
+	}
 	biosdisk[drivenum].inserted = 0;
 	if (drivenum >= 2) {
 		cpu_write(cpu, 0x475, biosdisk_gethdcount());
 	}
-	if (biosdisk[drivenum].diskfile != NULL) fclose(biosdisk[drivenum].diskfile);
+}
+
+//Moves count sectors starting at lba between the image and guest memory at memaddr, returns how many made it.
+//Reads past the end of the image stop there, as do writes to a mapped image since it can't grow.
+static uint32_t biosdisk_move(uint8_t drivenum, uint32_t memaddr, uint64_t lba, uint32_t count, uint8_t write) {
+	DISK_t* disk = &biosdisk[drivenum];
+	uint32_t fileoffset, done, chunk, len;
+
+	if (!disk->inserted || (lba > ((uint64_t)disk->filesize / 512))) return 0;
+	fileoffset = (uint32_t)lba * 512UL;
+	if (disk->map != NULL) {
+		done = (disk->filesize - fileoffset) / 512; //only whole sectors, like the other paths
+		if (done > count) done = count;
+		if (write) memory_readBlock(memaddr, disk->map + fileoffset, done * 512);
+		else memory_writeBlock(memaddr, disk->map + fileoffset, done * 512);
+		return done;
+	}
+
+	if (write && (disk->pack != NULL)) return 0;
+	if ((disk->diskfile != NULL) && (disk->cache < 0)) fseek(disk->diskfile, fileoffset, SEEK_SET);
+	for (done = 0; done < count; done += chunk) {
+		chunk = count - done;
+		if (chunk > BIOSDISK_MAXSECTS) chunk = BIOSDISK_MAXSECTS;
+		len = chunk * 512;
+		if (write) {
+			memory_readBlock(memaddr, biosdisk_xferbuf, len);
+			if (disk->cow != NULL) len = cowdisk_write(disk->cow, fileoffset, biosdisk_xferbuf, len);
+			else if (disk->cache >= 0) len = diskcache_write(disk->cache, fileoffset, biosdisk_xferbuf, len);
+			else len = (uint32_t)fwrite(biosdisk_xferbuf, 1, len, disk->diskfile);
+		}
+		else {
+			if (disk->cow != NULL) len = cowdisk_read(disk->cow, fileoffset, biosdisk_xferbuf, len);
+			else if (disk->pack != NULL) len = packdisk_read(disk->pack, fileoffset, biosdisk_xferbuf, len);
+			else if (disk->cache >= 0) len = diskcache_read(disk->cache, fileoffset, biosdisk_xferbuf, len);
+			else len = (uint32_t)fread(biosdisk_xferbuf, 1, len, disk->diskfile);
+			memory_writeBlock(memaddr, biosdisk_xferbuf, len & ~511UL);
+		}
+		if (len < (chunk * 512)) return done + len / 512;
+		memaddr += len;
+		fileoffset += len;
+	}
+	return done;
+}
+
+static uint32_t biosdisk_transfer(uint8_t drivenum, uint32_t memaddr, uint64_t lba, uint32_t count, uint8_t write) {
+	uint32_t done;
+
+	done = biosdisk_move(drivenum, memaddr, lba, count, write);
+	if (write) {
+		metrics.cpu.diskWrites++;
+		metrics.cpu.diskWriteBytes += (uint64_t)done * 512;
+	}
+	else {
+		metrics.cpu.diskReads++;
+		metrics.cpu.diskReadBytes += (uint64_t)done * 512;
+	}
+	return done;
+}
+
+static uint32_t biosdisk_chsToLBA(uint8_t drivenum, uint16_t cyl, uint16_t sect, uint16_t head) {
+	return ((uint32_t)cyl * (uint32_t)biosdisk[drivenum].heads + (uint32_t)head) * (uint32_t)biosdisk[drivenum].sects + (uint32_t)sect - 1UL;
 }
 
 void biosdisk_read(CPU_t* cpu, uint8_t drivenum, uint16_t dstseg, uint16_t dstoff, uint16_t cyl, uint16_t sect, uint16_t head, uint16_t sectcount) {
-	uint32_t memdest, lba, fileoffset, cursect, sectoffset;
 	if (!sect || !biosdisk[drivenum].inserted) return;
-	lba = ((uint32_t)cyl * (uint32_t)biosdisk[drivenum].heads + (uint32_t)head) * (uint32_t)biosdisk[drivenum].sects + (uint32_t)sect - 1UL;
-	fileoffset = lba * 512UL;
-	if (fileoffset > biosdisk[drivenum].filesize) return;
-	fseek(biosdisk[drivenum].diskfile, fileoffset, SEEK_SET);
-	memdest = ((uint32_t)dstseg << 4) + (uint32_t)dstoff;
-	for (cursect = 0; cursect < sectcount; cursect++) {
-		if (fread(biosdisk_sectbuf, 1, 512, biosdisk[drivenum].diskfile) < 512) break;
-		for (sectoffset = 0; sectoffset < 512; sectoffset++) {
-			cpu_write(cpu, memdest++, biosdisk_sectbuf[sectoffset]);
-		}
-	}
-	cpu->regs.byteregs[regal] = cursect;
+	cpu->regs.byteregs[regal] = (uint8_t)biosdisk_transfer(drivenum, ((uint32_t)dstseg << 4) + (uint32_t)dstoff, biosdisk_chsToLBA(drivenum, cyl, sect, head), sectcount, 0);
 	cpu->cf = 0;
 	cpu->regs.byteregs[regah] = 0;
 }
 
 void biosdisk_write(CPU_t* cpu, uint8_t drivenum, uint16_t dstseg, uint16_t dstoff, uint16_t cyl, uint16_t sect, uint16_t head, uint16_t sectcount) {
-	uint32_t memdest, lba, fileoffset, cursect, sectoffset;
 	if (!sect || !biosdisk[drivenum].inserted) return;
-	lba = ((uint32_t)cyl * (uint32_t)biosdisk[drivenum].heads + (uint32_t)head) * (uint32_t)biosdisk[drivenum].sects + (uint32_t)sect - 1UL;
-	fileoffset = lba * 512UL;
-	if (fileoffset > biosdisk[drivenum].filesize) return;
-	fseek(biosdisk[drivenum].diskfile, fileoffset, SEEK_SET);
-	memdest = ((uint32_t)dstseg << 4) + (uint32_t)dstoff;
-	for (cursect = 0; cursect < sectcount; cursect++) {
-		for (sectoffset = 0; sectoffset < 512; sectoffset++) {
-			biosdisk_sectbuf[sectoffset] = cpu_read(cpu, memdest++);
-		}
-		fwrite(biosdisk_sectbuf, 1, 512, biosdisk[drivenum].diskfile);
-	}
-	cpu->regs.byteregs[regal] = (uint8_t)sectcount;
+	cpu->regs.byteregs[regal] = (uint8_t)biosdisk_transfer(drivenum, ((uint32_t)dstseg << 4) + (uint32_t)dstoff, biosdisk_chsToLBA(drivenum, cyl, sect, head), sectcount, 1);
 	cpu->cf = 0;
 	cpu->regs.byteregs[regah] = 0;
 }
 
+//AH=42h/43h, the disk address packet at DS:SI says where and how much. Returns the status for AH.
+static uint8_t biosdisk_extTransfer(CPU_t* cpu, uint8_t drivenum, uint8_t write) {
+	uint32_t packet, memaddr, count, done;
+	uint64_t lba;
+	uint8_t size;
+
+	packet = segbase(cpu->segregs[regds]) + getreg16(cpu, regsi);
+	size = cpu_read(cpu, packet);
+	count = cpu_readw(cpu, packet + 2);
+	if ((size < 0x10) || (count > BIOSDISK_MAXSECTS)) return 0x01;
+	memaddr = segbase(cpu_readw(cpu, packet + 6)) + cpu_readw(cpu, packet + 4);
+	if ((cpu_readw(cpu, packet + 4) == 0xFFFF) && (cpu_readw(cpu, packet + 6) == 0xFFFF) && (size >= 0x18)) {
+		memaddr = (uint32_t)cpu_readw(cpu, packet + 0x10) | ((uint32_t)cpu_readw(cpu, packet + 0x12) << 16); //flat address, EDD 3.0
+	}
+	lba = (uint64_t)cpu_readw(cpu, packet + 8) | ((uint64_t)cpu_readw(cpu, packet + 10) << 16) |
+		((uint64_t)cpu_readw(cpu, packet + 12) << 32) | ((uint64_t)cpu_readw(cpu, packet + 14) << 48);
+
+	if (write && (biosdisk[drivenum].pack != NULL)) return 0x03;
+	done = biosdisk_transfer(drivenum, memaddr, lba, count, write);
+	cpu_writew(cpu, packet + 2, (uint16_t)done);
+	return (done < count) ? 0x04 : 0x00;
+}
+
+//AH=48h, fills in the drive parameter table at DS:SI
+static uint8_t biosdisk_extParams(CPU_t* cpu, uint8_t drivenum) {
+	uint32_t table, total;
+
+	table = segbase(cpu->segregs[regds]) + getreg16(cpu, regsi);
+	if (cpu_readw(cpu, table) < 0x1A) return 0x01;
+	total = biosdisk[drivenum].filesize / 512;
+	cpu_writew(cpu, table, 0x1A);
+	cpu_writew(cpu, table + 2, 0x0002); //CHS values below are valid
+	cpu_writew(cpu, table + 4, biosdisk[drivenum].cyls);
+	cpu_writew(cpu, table + 6, 0);
+	cpu_writew(cpu, table + 8, biosdisk[drivenum].heads);
+	cpu_writew(cpu, table + 10, 0);
+	cpu_writew(cpu, table + 12, biosdisk[drivenum].sects);
+	cpu_writew(cpu, table + 14, 0);
+	cpu_writew(cpu, table + 16, (uint16_t)total);
+	cpu_writew(cpu, table + 18, (uint16_t)(total >> 16));
+	cpu_writew(cpu, table + 20, 0);
+	cpu_writew(cpu, table + 22, 0);
+	cpu_writew(cpu, table + 24, 512);
+	return 0x00;
+}
+
 void biosdisk_int19h(CPU_t* cpu, uint8_t intnum) {
 	if (intnum != 0x19) return;
 	
@@ -140,6 +329,7 @@ void biosdisk_int19h(CPU_t* cpu, uint8_t intnum) {
 void biosdisk_int13h(CPU_t* cpu, uint8_t intnum) {
 	static uint8_t lastah = 0, lastcf = 0;
 	uint8_t curdisk;
+	uint16_t cyls;
 
 	if (intnum != 0x13) return;
 
@@ -172,7 +362,11 @@ void biosdisk_int13h(CPU_t* cpu, uint8_t intnum) {
 		}
 		break;
 	case 3: //write sector(s) from memory
-		if (biosdisk[curdisk].inserted) {
+		if (biosdisk[curdisk].pack != NULL) {
+			cpu->cf = 1;
+			cpu->regs.byteregs[regah] = 0x03; //write protected
+		}
+		else if (biosdisk[curdisk].inserted) {
 			biosdisk_write(cpu, curdisk, cpu->segregs[reges], getreg16(cpu, regbx), (uint16_t)cpu->regs.byteregs[regch] + ((uint16_t)cpu->regs.byteregs[regcl] / 64) * 256, (uint16_t)cpu->regs.byteregs[regcl] & 63, (uint16_t)cpu->regs.byteregs[regdh], (uint16_t)cpu->regs.byteregs[regal]);
 			cpu->cf = 0;
 			cpu->regs.byteregs[regah] = 0;
@@ -191,9 +385,10 @@ void biosdisk_int13h(CPU_t* cpu, uint8_t intnum) {
 		if (biosdisk[curdisk].inserted) {
 			cpu->cf = 0;
 			cpu->regs.byteregs[regah] = 0;
-			cpu->regs.byteregs[regch] = biosdisk[curdisk].cyls - 1;
+			cyls = (biosdisk[curdisk].cyls > 1024) ? 1024 : biosdisk[curdisk].cyls; //the rest is only reachable through the extensions
+			cpu->regs.byteregs[regch] = (uint8_t)(cyls - 1);
 			cpu->regs.byteregs[regcl] = biosdisk[curdisk].sects & 63;
-			cpu->regs.byteregs[regcl] = cpu->regs.byteregs[regcl] + (biosdisk[curdisk].cyls / 256) * 64;
+			cpu->regs.byteregs[regcl] = cpu->regs.byteregs[regcl] + (uint8_t)(((cyls - 1) / 256) * 64);
 			cpu->regs.byteregs[regdh] = biosdisk[curdisk].heads - 1;
 			if (curdisk < 2) {
 				cpu->regs.byteregs[regbl] = 4; //else regs.byteregs[regbl] = 0;
@@ -206,6 +401,42 @@ void biosdisk_int13h(CPU_t* cpu, uint8_t intnum) {
 			cpu->regs.byteregs[regah] = 0xAA;
 		}
 		break;
+	case 0x41: //check extensions present
+		if ((curdisk >= 2) && biosdisk[curdisk].inserted && (getreg16(cpu, regbx) == 0x55AA)) {
+			cpu->cf = 0;
+			cpu->regs.byteregs[regah] = 0x21; //EDD 1.1
+			putreg16(cpu, regbx, 0xAA55);
+			putreg16(cpu, regcx, 0x0001); //functions 42h-44h, 47h and 48h
+		}
+		else {
+			cpu->cf = 1;
+			cpu->regs.byteregs[regah] = 0x01;
+		}
+		break;
+	case 0x42: //extended read
+	case 0x43: //extended write
+		if ((curdisk >= 2) && biosdisk[curdisk].inserted) {
+			cpu->regs.byteregs[regah] = biosdisk_extTransfer(cpu, curdisk, cpu->regs.byteregs[regah] == 0x43);
+		}
+		else {
+			cpu->regs.byteregs[regah] = 0x01;
+		}
+		cpu->cf = cpu->regs.byteregs[regah] ? 1 : 0;
+		break;
+	case 0x44: //extended verify
+	case 0x47: //extended seek
+		cpu->regs.byteregs[regah] = ((curdisk >= 2) && biosdisk[curdisk].inserted) ? 0x00 : 0x01;
+		cpu->cf = cpu->regs.byteregs[regah] ? 1 : 0;
+		break;
+	case 0x48: //extended get drive parameters
+		if ((curdisk >= 2) && biosdisk[curdisk].inserted) {
+			cpu->regs.byteregs[regah] = biosdisk_extParams(cpu, curdisk);
+		}
+		else {
+			cpu->regs.byteregs[regah] = 0x01;
+		}
+		cpu->cf = cpu->regs.byteregs[regah] ? 1 : 0;
+		break;
 	default:
 		cpu->cf = 1;
 	}
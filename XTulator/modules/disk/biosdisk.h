@@ -4,9 +4,18 @@
 #include <stdio.h>
 #include <stdint.h>
 #include "../../cpu/cpu.h"
+#include "cowdisk.h"
+#include "packdisk.h"
+
+#define BIOSDISK_MAXSECTS		127 //largest INT 13h extended transfer, and sectors moved per copy when the image isn't mapped
 
 typedef struct {
 	FILE* diskfile;
+	uint8_t* map; //the whole image mapped into our address space, or NULL to go through diskfile
+	void* mapping; //file mapping handle on Windows
+	int cache; //diskcache handle when the image couldn't be mapped, -1 to use diskfile directly
+	COWDISK_t* cow; //copy-on-write overlay, when inserted as "base,overlay=file". diskfile is NULL then.
+	PACKDISK_t* pack; //read-only packed image, inserted without an overlay. diskfile is NULL then too.
 	uint32_t filesize;
 	uint16_t cyls;
 	uint16_t sects;
@@ -15,6 +24,8 @@ typedef struct {
 	char* filename;
 } DISK_t;
 
+int biosdisk_map(uint8_t drivenum);
+void biosdisk_unmap(uint8_t drivenum);
 uint8_t biosdisk_insert(CPU_t* cpu, uint8_t drivenum, char* filename);
 void biosdisk_eject(CPU_t* cpu, uint8_t drivenum);
 void biosdisk_int13h(CPU_t* cpu, uint8_t intnum);
@@ -0,0 +1,252 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Copy-on-write overlay disk images.
+
+	The base image is only ever opened read-only, so any number of emulator
+	instances can share it. Guest writes go to an overlay file instead:
+
+		COWDISK_HEADER_t
+		uint32_t index[blocks]		overlay slot of each block, 0 if unchanged
+		...padding up to a block boundary...
+		slot 1, slot 2, ...			COWDISK_BLOCKSIZE bytes each, in the order first written
+
+	The first write to a block copies it out of the base into a new slot at the
+	end of the overlay, then its index entry is written. A new overlay is just
+	the header and an empty index. The base can be a packed image (packdisk.c).
+	All fields are in host byte order.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+#include "cowdisk.h"
+#include "../../debuglog.h"
+
+static void cowdisk_map(COWDISK_t* cow) {
+	cow->map = NULL;
+	cow->mapping = NULL;
+	if (cow->hdr.basesize == 0) return;
+#ifdef _WIN32
+	cow->mapping = (void*)CreateFileMapping((HANDLE)_get_osfhandle(_fileno(cow->base)), NULL, PAGE_READONLY, 0, 0, NULL);
+	if (cow->mapping == NULL) return;
+	cow->map = (uint8_t*)MapViewOfFile((HANDLE)cow->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (cow->map == NULL) {
+		CloseHandle((HANDLE)cow->mapping);
+		cow->mapping = NULL;
+	}
+#else
+	{
+		void* map = mmap(NULL, cow->hdr.basesize, PROT_READ, MAP_SHARED, fileno(cow->base), 0);
+		if (map != MAP_FAILED) cow->map = (uint8_t*)map;
+	}
+#endif
+}
+
+static void cowdisk_unmap(COWDISK_t* cow) {
+	if (cow->map == NULL) return;
+#ifdef _WIN32
+	UnmapViewOfFile(cow->map);
+	CloseHandle((HANDLE)cow->mapping);
+#else
+	munmap(cow->map, cow->hdr.basesize);
+#endif
+	cow->map = NULL;
+	cow->mapping = NULL;
+}
+
+void cowdisk_close(COWDISK_t* cow) {
+	if (cow == NULL) return;
+	cowdisk_unmap(cow);
+	if (cow->overlay != NULL) fclose(cow->overlay);
+	if (cow->base != NULL) fclose(cow->base);
+	packdisk_close(cow->pack);
+	if (cow->index != NULL) free(cow->index);
+	free(cow);
+}
+
+//Opens basename read-only with overlayname on top, creating the overlay if it doesn't exist yet. Returns NULL on error.
+COWDISK_t* cowdisk_open(char* basename, char* overlayname) {
+	COWDISK_t* cow;
+	uint32_t i;
+
+	cow = (COWDISK_t*)calloc(1, sizeof(COWDISK_t));
+	if (cow == NULL) return NULL;
+
+	if (packdisk_detect(basename)) {
+		cow->pack = packdisk_open(basename);
+		if (cow->pack == NULL) {
+			cowdisk_close(cow);
+			return NULL;
+		}
+		cow->hdr.basesize = cow->pack->hdr.size;
+	}
+	else {
+		cow->base = fopen(basename, "rb");
+		if (cow->base == NULL) {
+			debug_log(DEBUG_ERROR, "[COWDISK] Unable to open base image %s\r\n", basename);
+			cowdisk_close(cow);
+			return NULL;
+		}
+		fseek(cow->base, 0L, SEEK_END);
+		cow->hdr.basesize = ftell(cow->base);
+		fseek(cow->base, 0L, SEEK_SET);
+	}
+	cow->hdr.blocksize = COWDISK_BLOCKSIZE;
+	cow->hdr.blocks = (cow->hdr.basesize + COWDISK_BLOCKSIZE - 1) / COWDISK_BLOCKSIZE;
+	cow->dataoffset = ((sizeof(COWDISK_HEADER_t) + cow->hdr.blocks * 4 + COWDISK_BLOCKSIZE - 1) / COWDISK_BLOCKSIZE) * COWDISK_BLOCKSIZE;
+
+	cow->index = (uint32_t*)calloc(cow->hdr.blocks + 1, sizeof(uint32_t));
+	if (cow->index == NULL) {
+		cowdisk_close(cow);
+		return NULL;
+	}
+
+	cow->overlay = fopen(overlayname, "r+b");
+	if (cow->overlay != NULL) {
+		COWDISK_HEADER_t hdr;
+		if ((fread(&hdr, 1, sizeof(hdr), cow->overlay) < sizeof(hdr)) || memcmp(hdr.magic, COWDISK_MAGIC, 8) ||
+			(hdr.blocksize != cow->hdr.blocksize) || (hdr.blocks != cow->hdr.blocks) || (hdr.basesize != cow->hdr.basesize)) {
+			debug_log(DEBUG_ERROR, "[COWDISK] %s is not an overlay for %s\r\n", overlayname, basename);
+			cowdisk_close(cow);
+			return NULL;
+		}
+		if (fread(cow->index, 4, cow->hdr.blocks, cow->overlay) < cow->hdr.blocks) {
+			debug_log(DEBUG_ERROR, "[COWDISK] Overlay %s is truncated\r\n", overlayname);
+			cowdisk_close(cow);
+			return NULL;
+		}
+	}
+	else {
+		cow->overlay = fopen(overlayname, "w+b");
+		if (cow->overlay == NULL) {
+			debug_log(DEBUG_ERROR, "[COWDISK] Unable to create overlay %s\r\n", overlayname);
+			cowdisk_close(cow);
+			return NULL;
+		}
+		memcpy(cow->hdr.magic, COWDISK_MAGIC, 8);
+		if ((fwrite(&cow->hdr, 1, sizeof(COWDISK_HEADER_t), cow->overlay) < sizeof(COWDISK_HEADER_t)) ||
+			(fwrite(cow->index, 4, cow->hdr.blocks, cow->overlay) < cow->hdr.blocks)) {
+			debug_log(DEBUG_ERROR, "[COWDISK] Unable to write overlay %s\r\n", overlayname);
+			cowdisk_close(cow);
+			return NULL;
+		}
+		fflush(cow->overlay);
+	}
+
+	cow->nextslot = 1;
+	for (i = 0; i < cow->hdr.blocks; i++) {
+		if (cow->index[i] >= cow->nextslot) cow->nextslot = cow->index[i] + 1;
+	}
+
+	if (cow->base != NULL) cowdisk_map(cow);
+	debug_log(DEBUG_INFO, "[COWDISK] Opened %s over %s (%lu of %lu blocks changed)\r\n", overlayname, basename, cow->nextslot - 1, cow->hdr.blocks);
+
+	return cow;
+}
+
+//Reads len bytes of the base image at offset, returns the number that exist
+static uint32_t cowdisk_readBase(COWDISK_t* cow, uint32_t offset, uint8_t* dst, uint32_t len) {
+	if (offset >= cow->hdr.basesize) return 0;
+	if (len > (cow->hdr.basesize - offset)) len = cow->hdr.basesize - offset;
+	if (cow->pack != NULL) return packdisk_read(cow->pack, offset, dst, len);
+	if (cow->map != NULL) {
+		memcpy(dst, cow->map + offset, len);
+		return len;
+	}
+	fseek(cow->base, offset, SEEK_SET);
+	return (uint32_t)fread(dst, 1, len, cow->base);
+}
+
+static uint32_t cowdisk_slotOffset(COWDISK_t* cow, uint32_t slot) {
+	return cow->dataoffset + (slot - 1) * COWDISK_BLOCKSIZE;
+}
+
+//Returns the number of bytes copied, short at the end of the image
+uint32_t cowdisk_read(COWDISK_t* cow, uint32_t offset, uint8_t* dst, uint32_t len) {
+	uint32_t done = 0, block, boff, n;
+
+	if (offset >= cow->hdr.basesize) return 0;
+	if (len > (cow->hdr.basesize - offset)) len = cow->hdr.basesize - offset;
+
+	while (done < len) {
+		block = (offset + done) / COWDISK_BLOCKSIZE;
+		boff = (offset + done) % COWDISK_BLOCKSIZE;
+		n = COWDISK_BLOCKSIZE - boff;
+		if (n > (len - done)) n = len - done;
+		if (cow->index[block]) {
+			fseek(cow->overlay, cowdisk_slotOffset(cow, cow->index[block]) + boff, SEEK_SET);
+			if (fread(dst + done, 1, n, cow->overlay) < n) break;
+		}
+		else if (cowdisk_readBase(cow, offset + done, dst + done, n) < n) {
+			break;
+		}
+		done += n;
+	}
+
+	return done;
+}
+
+//Writes into the overlay, copying each block out of the base the first time it changes.
+//The image can't grow past the base size. Returns the number of bytes written.
+uint32_t cowdisk_write(COWDISK_t* cow, uint32_t offset, const uint8_t* src, uint32_t len) {
+	uint32_t done = 0, block, boff, n, got, slot;
+
+	if (offset >= cow->hdr.basesize) return 0;
+	if (len > (cow->hdr.basesize - offset)) len = cow->hdr.basesize - offset;
+
+	while (done < len) {
+		block = (offset + done) / COWDISK_BLOCKSIZE;
+		boff = (offset + done) % COWDISK_BLOCKSIZE;
+		n = COWDISK_BLOCKSIZE - boff;
+		if (n > (len - done)) n = len - done;
+		slot = cow->index[block];
+		if (slot) {
+			fseek(cow->overlay, cowdisk_slotOffset(cow, slot) + boff, SEEK_SET);
+			if (fwrite(src + done, 1, n, cow->overlay) < n) break;
+		}
+		else {
+			got = cowdisk_readBase(cow, block * COWDISK_BLOCKSIZE, cow->blockbuf, COWDISK_BLOCKSIZE);
+			memset(cow->blockbuf + got, 0, COWDISK_BLOCKSIZE - got);
+			memcpy(cow->blockbuf + boff, src + done, n);
+			slot = cow->nextslot;
+			fseek(cow->overlay, cowdisk_slotOffset(cow, slot), SEEK_SET);
+			if (fwrite(cow->blockbuf, 1, COWDISK_BLOCKSIZE, cow->overlay) < COWDISK_BLOCKSIZE) break;
+			//data first, then the index entry pointing at it
+			fseek(cow->overlay, sizeof(COWDISK_HEADER_t) + block * 4, SEEK_SET);
+			if (fwrite(&slot, 4, 1, cow->overlay) < 1) break;
+			cow->index[block] = slot;
+			cow->nextslot++;
+		}
+		done += n;
+	}
+	if (done < len) {
+		debug_log(DEBUG_ERROR, "[COWDISK] Overlay write failed\r\n");
+	}
+
+	return done;
+}
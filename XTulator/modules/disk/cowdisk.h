@@ -0,0 +1,37 @@
+#ifndef _COWDISK_H_
+#define _COWDISK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "packdisk.h"
+
+#define COWDISK_MAGIC			"XTCOW01"
+#define COWDISK_BLOCKSIZE		4096
+
+typedef struct {
+	char magic[8];
+	uint32_t blocksize;
+	uint32_t blocks;
+	uint32_t basesize; //must match the base image the overlay is opened against
+	uint32_t reserved;
+} COWDISK_HEADER_t;
+
+typedef struct {
+	FILE* base;
+	uint8_t* map; //read-only mapping of the base image, or NULL to read base with stdio
+	void* mapping;
+	PACKDISK_t* pack; //packed base image, base and map are unused then
+	FILE* overlay;
+	COWDISK_HEADER_t hdr;
+	uint32_t* index; //overlay slot holding each block, counting from 1. 0 means it's still in the base image.
+	uint32_t nextslot;
+	uint32_t dataoffset; //where slot 1 starts in the overlay file
+	uint8_t blockbuf[COWDISK_BLOCKSIZE];
+} COWDISK_t;
+
+COWDISK_t* cowdisk_open(char* basename, char* overlayname);
+void cowdisk_close(COWDISK_t* cow);
+uint32_t cowdisk_read(COWDISK_t* cow, uint32_t offset, uint8_t* dst, uint32_t len);
+uint32_t cowdisk_write(COWDISK_t* cow, uint32_t offset, const uint8_t* src, uint32_t len);
+
+#endif
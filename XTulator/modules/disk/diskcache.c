@@ -0,0 +1,430 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Block cache for disk images, with a worker thread doing the file I/O.
+
+	The emulation thread looks blocks up in an LRU cache shared by every open
+	image. A miss queues the block for the worker and waits for it, and a read
+	that follows on from the previous one also queues the next few blocks so
+	they're usually in by the time the guest asks. Writes only touch the cached
+	copy and queue the block for the worker to write back, so the guest never
+	waits on the host disk for them. diskcache_flush waits until everything
+	queued for an image has reached the file.
+
+	Only the worker touches the FILE pointers once an image is open. Slots being
+	loaded or waiting to be written back are never evicted.
+*/
+
+#include "../../config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "diskcache.h"
+#include "../../debuglog.h"
+#include "../../hostthread.h"
+#ifdef _WIN32
+#include <Windows.h>
+#include <SDL.h>
+#include <process.h>
+#else
+#include <SDL.h>
+#include <pthread.h>
+pthread_t diskcache_threadID;
+#endif
+
+typedef struct {
+	int32_t file; //diskcache_open handle owning this slot, -1 if it's free
+	uint32_t block;
+	uint8_t state;
+	uint8_t dirty;
+	uint8_t queued; //waiting in the write queue
+	uint32_t len; //bytes of this block that exist in the file
+	int32_t prev, next; //LRU list, most recently used at the head
+	int32_t hnext;
+	uint8_t data[DISKCACHE_BLOCKSIZE];
+} DISKCACHE_SLOT_t;
+
+typedef struct {
+	FILE* f;
+	uint32_t size;
+	uint32_t lastblock;
+	uint32_t busy; //loads and write-backs queued or in progress
+	uint8_t used;
+} DISKCACHE_FILE_t;
+
+DISKCACHE_SLOT_t* diskcache_slot = NULL;
+DISKCACHE_FILE_t diskcache_file[DISKCACHE_FILES];
+int32_t diskcache_hash[DISKCACHE_HASHSIZE];
+int32_t diskcache_lruHead = -1, diskcache_lruTail = -1;
+int32_t diskcache_loadq[DISKCACHE_BLOCKS], diskcache_writeq[DISKCACHE_BLOCKS];
+uint32_t diskcache_loadHead = 0, diskcache_loadTail = 0, diskcache_writeHead = 0, diskcache_writeTail = 0;
+
+SDL_mutex* diskcache_lock = NULL;
+SDL_cond* diskcache_work = NULL; //worker waits on this for queued loads and write-backs
+SDL_cond* diskcache_done = NULL; //emulation thread waits on this for them to finish
+volatile uint8_t diskcache_running = 0;
+
+static uint32_t diskcache_hashOf(int32_t file, uint32_t block) {
+	return ((block * 2654435761UL) ^ ((uint32_t)file * 0x9E37UL)) & (DISKCACHE_HASHSIZE - 1);
+}
+
+static int32_t diskcache_find(int32_t file, uint32_t block) {
+	int32_t s;
+
+	for (s = diskcache_hash[diskcache_hashOf(file, block)]; s >= 0; s = diskcache_slot[s].hnext) {
+		if ((diskcache_slot[s].file == file) && (diskcache_slot[s].block == block)) return s;
+	}
+	return -1;
+}
+
+static void diskcache_hashRemove(int32_t s) {
+	int32_t* link;
+
+	link = &diskcache_hash[diskcache_hashOf(diskcache_slot[s].file, diskcache_slot[s].block)];
+	while (*link >= 0) {
+		if (*link == s) {
+			*link = diskcache_slot[s].hnext;
+			return;
+		}
+		link = &diskcache_slot[*link].hnext;
+	}
+}
+
+static void diskcache_touch(int32_t s) {
+	if (diskcache_lruHead == s) return;
+	//unlink
+	if (diskcache_slot[s].prev >= 0) diskcache_slot[diskcache_slot[s].prev].next = diskcache_slot[s].next;
+	if (diskcache_slot[s].next >= 0) diskcache_slot[diskcache_slot[s].next].prev = diskcache_slot[s].prev;
+	if (diskcache_lruTail == s) diskcache_lruTail = diskcache_slot[s].prev;
+	//push to head
+	diskcache_slot[s].prev = -1;
+	diskcache_slot[s].next = diskcache_lruHead;
+	if (diskcache_lruHead >= 0) diskcache_slot[diskcache_lruHead].prev = s;
+	diskcache_lruHead = s;
+	if (diskcache_lruTail < 0) diskcache_lruTail = s;
+}
+
+//Takes the least recently used slot that isn't busy and gives it to file/block. Called with the lock held.
+static int32_t diskcache_alloc(int32_t file, uint32_t block) {
+	int32_t s;
+
+	while (1) {
+		for (s = diskcache_lruTail; s >= 0; s = diskcache_slot[s].prev) {
+			if ((diskcache_slot[s].state != DISKCACHE_LOADING) && !diskcache_slot[s].dirty && !diskcache_slot[s].queued) break;
+		}
+		if (s >= 0) break;
+		SDL_CondWait(diskcache_done, diskcache_lock); //everything is waiting on the worker
+	}
+
+	if (diskcache_slot[s].file >= 0) diskcache_hashRemove(s);
+	diskcache_slot[s].file = file;
+	diskcache_slot[s].block = block;
+	diskcache_slot[s].state = DISKCACHE_EMPTY;
+	diskcache_slot[s].len = 0;
+	diskcache_slot[s].hnext = diskcache_hash[diskcache_hashOf(file, block)];
+	diskcache_hash[diskcache_hashOf(file, block)] = s;
+	diskcache_touch(s);
+	return s;
+}
+
+static void diskcache_queueLoad(int32_t s) {
+	diskcache_slot[s].state = DISKCACHE_LOADING;
+	diskcache_file[diskcache_slot[s].file].busy++;
+	diskcache_loadq[diskcache_loadHead++ & (DISKCACHE_BLOCKS - 1)] = s;
+	SDL_CondSignal(diskcache_work);
+}
+
+static void diskcache_queueWrite(int32_t s) {
+	diskcache_slot[s].dirty = 1;
+	if (diskcache_slot[s].queued) return;
+	diskcache_slot[s].queued = 1;
+	diskcache_file[diskcache_slot[s].file].busy++;
+	diskcache_writeq[diskcache_writeHead++ & (DISKCACHE_BLOCKS - 1)] = s;
+	SDL_CondSignal(diskcache_work);
+}
+
+#ifdef _WIN32
+void diskcache_thread(void* dummy) {
+#else
+void* diskcache_thread(void* dummy) {
+#endif
+	static uint8_t buf[DISKCACHE_BLOCKSIZE];
+	DISKCACHE_SLOT_t* slot;
+	FILE* f;
+	uint32_t offset, len;
+	size_t got;
+	int32_t s, fid;
+
+	hostthread_apply(HOSTTHREAD_IO);
+
+	SDL_LockMutex(diskcache_lock);
+	while (diskcache_running) {
+		if (diskcache_loadTail != diskcache_loadHead) {
+			s = diskcache_loadq[diskcache_loadTail++ & (DISKCACHE_BLOCKS - 1)];
+			slot = &diskcache_slot[s];
+			f = diskcache_file[slot->file].f;
+			offset = slot->block * DISKCACHE_BLOCKSIZE;
+			SDL_UnlockMutex(diskcache_lock);
+			fseek(f, offset, SEEK_SET);
+			got = fread(slot->data, 1, DISKCACHE_BLOCKSIZE, f); //slot is LOADING, nobody else touches its data
+			SDL_LockMutex(diskcache_lock);
+			slot->len = (uint32_t)got;
+			slot->state = DISKCACHE_VALID;
+			diskcache_file[slot->file].busy--;
+			SDL_CondBroadcast(diskcache_done);
+		}
+		else if (diskcache_writeTail != diskcache_writeHead) {
+			s = diskcache_writeq[diskcache_writeTail++ & (DISKCACHE_BLOCKS - 1)];
+			slot = &diskcache_slot[s];
+			fid = slot->file; //once it's clean the slot can be evicted and reused while we write
+			slot->queued = 0;
+			if (slot->dirty) {
+				//write a copy, so the emulation thread can keep changing the block meanwhile. If it does, it gets queued again.
+				slot->dirty = 0;
+				len = slot->len;
+				memcpy(buf, slot->data, len);
+				f = diskcache_file[fid].f;
+				offset = slot->block * DISKCACHE_BLOCKSIZE;
+				SDL_UnlockMutex(diskcache_lock);
+				fseek(f, offset, SEEK_SET);
+				if (fwrite(buf, 1, len, f) < len) {
+					debug_log(DEBUG_ERROR, "[DISKCACHE] Write-back of %lu bytes at offset %lu failed\r\n", len, offset);
+				}
+				SDL_LockMutex(diskcache_lock);
+			}
+			diskcache_file[fid].busy--;
+			SDL_CondBroadcast(diskcache_done);
+		}
+		else {
+			SDL_CondWait(diskcache_work, diskcache_lock);
+		}
+	}
+	SDL_UnlockMutex(diskcache_lock);
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+static int diskcache_init() {
+	int32_t i;
+
+	diskcache_slot = (DISKCACHE_SLOT_t*)malloc(sizeof(DISKCACHE_SLOT_t) * DISKCACHE_BLOCKS);
+	if (diskcache_slot == NULL) return -1;
+	for (i = 0; i < DISKCACHE_HASHSIZE; i++) {
+		diskcache_hash[i] = -1;
+	}
+	for (i = 0; i < DISKCACHE_BLOCKS; i++) {
+		diskcache_slot[i].file = -1;
+		diskcache_slot[i].state = DISKCACHE_EMPTY;
+		diskcache_slot[i].dirty = 0;
+		diskcache_slot[i].queued = 0;
+		diskcache_slot[i].prev = i - 1;
+		diskcache_slot[i].next = (i == (DISKCACHE_BLOCKS - 1)) ? -1 : (i + 1);
+		diskcache_slot[i].hnext = -1;
+	}
+	diskcache_lruHead = 0;
+	diskcache_lruTail = DISKCACHE_BLOCKS - 1;
+
+	diskcache_lock = SDL_CreateMutex();
+	diskcache_work = SDL_CreateCond();
+	diskcache_done = SDL_CreateCond();
+	if ((diskcache_lock == NULL) || (diskcache_work == NULL) || (diskcache_done == NULL)) {
+		free(diskcache_slot);
+		diskcache_slot = NULL;
+		return -1;
+	}
+
+	diskcache_running = 1;
+#ifdef _WIN32
+	if (_beginthread(diskcache_thread, 0, NULL) == (uintptr_t)-1) {
+		diskcache_running = 0;
+		return -1;
+	}
+#else
+	if (pthread_create(&diskcache_threadID, NULL, diskcache_thread, NULL)) {
+		diskcache_running = 0;
+		return -1;
+	}
+#endif
+
+	debug_log(DEBUG_DETAIL, "[DISKCACHE] Started disk I/O worker with %lu KB cache\r\n", (uint32_t)(DISKCACHE_BLOCKS * DISKCACHE_BLOCKSIZE) >> 10);
+	return 0;
+}
+
+//Hands an open image to the cache, returns a handle for the other calls or -1 on error.
+//The caller must not use the FILE itself again until diskcache_close.
+int diskcache_open(FILE* f, uint32_t size) {
+	int id;
+
+	if (!diskcache_running) {
+		if (diskcache_slot != NULL) return -1; //the worker failed to start earlier
+		if (diskcache_init()) {
+			debug_log(DEBUG_ERROR, "[DISKCACHE] Unable to start disk I/O worker\r\n");
+			return -1;
+		}
+	}
+
+	SDL_LockMutex(diskcache_lock);
+	for (id = 0; id < DISKCACHE_FILES; id++) {
+		if (!diskcache_file[id].used) break;
+	}
+	if (id == DISKCACHE_FILES) {
+		SDL_UnlockMutex(diskcache_lock);
+		return -1;
+	}
+	diskcache_file[id].f = f;
+	diskcache_file[id].size = size;
+	diskcache_file[id].lastblock = 0xFFFFFFFF;
+	diskcache_file[id].busy = 0;
+	diskcache_file[id].used = 1;
+	SDL_UnlockMutex(diskcache_lock);
+
+	return id;
+}
+
+//Waits until every write queued for the image has reached the file
+void diskcache_flush(int id) {
+	if ((id < 0) || (id >= DISKCACHE_FILES) || !diskcache_file[id].used) return;
+
+	SDL_LockMutex(diskcache_lock);
+	while (diskcache_file[id].busy > 0) {
+		SDL_CondWait(diskcache_done, diskcache_lock);
+	}
+	fflush(diskcache_file[id].f);
+	SDL_UnlockMutex(diskcache_lock);
+}
+
+//Flushes the image and drops its blocks, the FILE belongs to the caller again afterward
+void diskcache_close(int id) {
+	int32_t s;
+
+	if ((id < 0) || (id >= DISKCACHE_FILES) || !diskcache_file[id].used) return;
+
+	diskcache_flush(id);
+	SDL_LockMutex(diskcache_lock);
+	for (s = 0; s < DISKCACHE_BLOCKS; s++) {
+		if (diskcache_slot[s].file == id) {
+			diskcache_hashRemove(s);
+			diskcache_slot[s].file = -1;
+			diskcache_slot[s].state = DISKCACHE_EMPTY;
+		}
+	}
+	diskcache_file[id].used = 0;
+	SDL_UnlockMutex(diskcache_lock);
+}
+
+//Copies len bytes at offset of the image into dst, waiting only for blocks that aren't cached yet.
+//Returns the number of bytes copied, which is short at the end of the file.
+uint32_t diskcache_read(int id, uint32_t offset, uint8_t* dst, uint32_t len) {
+	DISKCACHE_FILE_t* file = &diskcache_file[id];
+	uint32_t done = 0, block, boff, n, ra, b;
+	int32_t s;
+
+	SDL_LockMutex(diskcache_lock);
+	while (done < len) {
+		if ((offset + done) >= file->size) break;
+		block = (offset + done) / DISKCACHE_BLOCKSIZE;
+		boff = (offset + done) % DISKCACHE_BLOCKSIZE;
+		s = diskcache_find(id, block);
+		if (s < 0) {
+			s = diskcache_alloc(id, block);
+			diskcache_queueLoad(s);
+		}
+		diskcache_touch(s); //before the read-ahead, so that can't evict it
+		if (block == (file->lastblock + 1)) { //sequential, get the next few in while the guest works on this one
+			for (ra = 1; ra <= DISKCACHE_READAHEAD; ra++) {
+				b = block + ra;
+				if ((b * DISKCACHE_BLOCKSIZE) >= file->size) break;
+				if (diskcache_find(id, b) < 0) {
+					diskcache_queueLoad(diskcache_alloc(id, b));
+				}
+			}
+		}
+		file->lastblock = block;
+		while (diskcache_slot[s].state == DISKCACHE_LOADING) {
+			SDL_CondWait(diskcache_done, diskcache_lock);
+		}
+		if (diskcache_slot[s].len <= boff) break;
+		n = diskcache_slot[s].len - boff;
+		if (n > (len - done)) n = len - done;
+		memcpy(dst + done, diskcache_slot[s].data + boff, n);
+		done += n;
+		if ((boff + n) < DISKCACHE_BLOCKSIZE) break; //short block, that's the end of the file
+	}
+	SDL_UnlockMutex(diskcache_lock);
+
+	return done;
+}
+
+//Copies len bytes from src into the image at offset and queues them to be written back. Returns len.
+uint32_t diskcache_write(int id, uint32_t offset, const uint8_t* src, uint32_t len) {
+	DISKCACHE_FILE_t* file = &diskcache_file[id];
+	uint32_t done = 0, block, boff, n, end;
+	int32_t s;
+
+	SDL_LockMutex(diskcache_lock);
+	while (done < len) {
+		block = (offset + done) / DISKCACHE_BLOCKSIZE;
+		boff = (offset + done) % DISKCACHE_BLOCKSIZE;
+		n = DISKCACHE_BLOCKSIZE - boff;
+		if (n > (len - done)) n = len - done;
+		s = diskcache_find(id, block);
+		if (s < 0) {
+			s = diskcache_alloc(id, block);
+			if (((boff > 0) || (n < DISKCACHE_BLOCKSIZE)) && ((block * DISKCACHE_BLOCKSIZE) < file->size)) {
+				diskcache_queueLoad(s); //partial write, the rest of the block has to come from the file
+			}
+			else {
+				memset(diskcache_slot[s].data, 0, DISKCACHE_BLOCKSIZE);
+				diskcache_slot[s].state = DISKCACHE_VALID;
+			}
+		}
+		while (diskcache_slot[s].state == DISKCACHE_LOADING) {
+			SDL_CondWait(diskcache_done, diskcache_lock);
+		}
+		memcpy(diskcache_slot[s].data + boff, src + done, n);
+		if ((boff + n) > diskcache_slot[s].len) {
+			diskcache_slot[s].len = boff + n;
+		}
+		end = block * DISKCACHE_BLOCKSIZE + diskcache_slot[s].len;
+		if (end > file->size) file->size = end;
+		diskcache_queueWrite(s);
+		diskcache_touch(s);
+		done += n;
+	}
+	SDL_UnlockMutex(diskcache_lock);
+
+	return done;
+}
+
+//Writes everything back and stops the worker, for emulator exit
+void diskcache_shutdown() {
+	int id;
+
+	if (!diskcache_running) return;
+	for (id = 0; id < DISKCACHE_FILES; id++) {
+		diskcache_flush(id);
+	}
+	SDL_LockMutex(diskcache_lock);
+	diskcache_running = 0;
+	SDL_CondSignal(diskcache_work);
+	SDL_UnlockMutex(diskcache_lock);
+}
@@ -0,0 +1,24 @@
+#ifndef _DISKCACHE_H_
+#define _DISKCACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define DISKCACHE_BLOCKSIZE		4096 //bytes per cache block, must be a multiple of 512
+#define DISKCACHE_BLOCKS		1024 //blocks shared by all open images, must be a power of two
+#define DISKCACHE_HASHSIZE		2048 //must be a power of two
+#define DISKCACHE_FILES			8
+#define DISKCACHE_READAHEAD		8 //blocks queued past a sequential read
+
+#define DISKCACHE_EMPTY			0
+#define DISKCACHE_LOADING		1
+#define DISKCACHE_VALID			2
+
+int diskcache_open(FILE* f, uint32_t size);
+void diskcache_close(int id);
+void diskcache_flush(int id);
+uint32_t diskcache_read(int id, uint32_t offset, uint8_t* dst, uint32_t len);
+uint32_t diskcache_write(int id, uint32_t offset, const uint8_t* src, uint32_t len);
+void diskcache_shutdown();
+
+#endif
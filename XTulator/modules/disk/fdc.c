@@ -33,6 +33,7 @@
 #include "../../chipset/i8259.h"
 #include "../../chipset/i8237.h"
 #include "fdc.h"
+#include "diskcache.h"
 
 const uint8_t fdc_cmd_len[16] = {
 	0, 0, 9, 3, 2, 9, 9, 2, 1, 9, 2, 0, 9, 6, 0, 3
@@ -57,6 +58,8 @@ const char* fdc_cmd_name[16] = {
 	"Seek/park head"
 };
 
+void fdc_fastread(FDC_t* fdc, uint8_t drv);
+
 void fdc_cmd(FDC_t* fdc, uint8_t value) {
 	uint8_t drv;
 
@@ -64,11 +67,11 @@ void fdc_cmd(FDC_t* fdc, uint8_t value) {
 		return;
 	}
 
-#ifdef DEBUG_FDC
-	if (fdc->cmd_pos == 0) {
-		debug_log(DEBUG_DETAIL, "[FDC] Command: %s (%02Xh)\r\n", fdc_cmd_name[value & 0x0F], value & 0x0F);
+	if (DEBUG_ON(DEBUG_SUB_FDC)) {
+		if (fdc->cmd_pos == 0) {
+			debug_log(DEBUG_DETAIL, "[FDC] Command: %s (%02Xh)\r\n", fdc_cmd_name[value & 0x0F], value & 0x0F);
+		}
 	}
-#endif
 
 	if (fdc->cmd_pos < 9) {
 		fdc->cmd[fdc->cmd_pos++] = value;
@@ -96,6 +99,7 @@ void fdc_cmd(FDC_t* fdc, uint8_t value) {
 	case FDC_CMD_READ_DATA:
 		drv = fdc->cmd[1] & 3;
 		fdc->position[drv].wanttrack = fdc->cmd[2];
+		fdc->position[drv].idtrack = fdc->cmd[2];
 		fdc->position[drv].head = fdc->cmd[3];
 		fdc->position[drv].sect = fdc->cmd[4];
 		fdc->position[drv].seeking = 1;
@@ -139,9 +143,9 @@ void fdc_cmd(FDC_t* fdc, uint8_t value) {
 
 void fdc_write(FDC_t* fdc, uint32_t addr, uint8_t value) {
 
-#ifdef DEBUG_FDC
-	debug_log(DEBUG_DETAIL, "[FDC] Write port %03X: %02X\r\n", addr, value);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_FDC)) {
+		debug_log(DEBUG_DETAIL, "[FDC] Write port %03X: %02X\r\n", addr, value);
+	}
 
 	addr &= 7;
 
@@ -170,9 +174,9 @@ void fdc_write(FDC_t* fdc, uint32_t addr, uint8_t value) {
 uint8_t fdc_read(FDC_t* fdc, uint32_t addr) {
 	uint8_t ret = 0xFF, drv;
 
-#ifdef DEBUG_FDC
-	debug_log(DEBUG_DETAIL, "[FDC] Read port %03X\r\n", addr);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_FDC)) {
+		debug_log(DEBUG_DETAIL, "[FDC] Read port %03X\r\n", addr);
+	}
 
 	addr &= 7;
 
@@ -194,9 +198,9 @@ uint8_t fdc_read(FDC_t* fdc, uint32_t addr) {
 				ret |= 1 << drv;
 			}
 		}
-#ifdef DEBUG_FDC
-		debug_log(DEBUG_DETAIL, "[FDC] Returned MSR value: %02X\r\n", ret);
-#endif
+		if (DEBUG_ON(DEBUG_SUB_FDC)) {
+			debug_log(DEBUG_DETAIL, "[FDC] Returned MSR value: %02X\r\n", ret);
+		}
 		break;
 	case 5: //data register
 		ret = fdc_fiforead(fdc);
@@ -254,8 +258,14 @@ void fdc_move(FDC_t* fdc) {
 				switch (fdc->cmd[0] & 0x0F) {
 				case FDC_CMD_READ_DATA:
 					fdc->position[drv].seeking = 0;
-					fdc->position[drv].reading = 1;
 					fdc->position[drv].transferring = 0;
+					if (fdc->fastmode && fdc->usedma && fdc->disk[drv].inserted) {
+						fdc_fastread(fdc, drv);
+					}
+					else {
+						fdc->position[drv].reading = 1;
+						timing_timerEnable(fdc->timerread);
+					}
 					break;
 				case FDC_CMD_RECALIBRATE:
 				case FDC_CMD_SEEK:
@@ -264,9 +274,9 @@ void fdc_move(FDC_t* fdc) {
 					i8259_doirq(fdc->i8259, fdc->irq);
 					break;
 				}
-#ifdef DEBUG_FDC
-				debug_log(DEBUG_DETAIL, "[FDC] Completed drive %u seek to track %lu\r\n", drv, fdc->position[drv].track);
-#endif
+				if (DEBUG_ON(DEBUG_SUB_FDC)) {
+					debug_log(DEBUG_DETAIL, "[FDC] Completed drive %u seek to track %lu\r\n", drv, fdc->position[drv].track);
+				}
 				break; //Don't allow more than one IRQ to be triggered by seeks at a time
 			}
 
@@ -293,12 +303,100 @@ void fdc_incrementsect(FDC_t* fdc, uint8_t drv) {
 	}
 }
 
+//Reads both sides of the current cylinder into the drive's track buffer, unless it's already there
+void fdc_cachetrack(FDC_t* fdc, uint8_t drv) {
+	uint32_t len, got;
+
+	if (fdc->disk[drv].cachedtrack == fdc->position[drv].track) return;
+	len = fdc->disk[drv].sectors * fdc->disk[drv].sides * 512;
+	if (fdc->disk[drv].pack != NULL) {
+		got = packdisk_read(fdc->disk[drv].pack, fdc->position[drv].track * len, fdc->disk[drv].trackbuf, len);
+	}
+	else if (fdc->disk[drv].cache >= 0) {
+		got = diskcache_read(fdc->disk[drv].cache, fdc->position[drv].track * len, fdc->disk[drv].trackbuf, len);
+	}
+	else {
+		fseek(fdc->disk[drv].dfile, fdc->position[drv].track * len, SEEK_SET);
+		got = (uint32_t)fread(fdc->disk[drv].trackbuf, 1, len, fdc->disk[drv].dfile);
+	}
+	if (got < len) {
+		memset(fdc->disk[drv].trackbuf + got, 0, len - got);
+	}
+	fdc->disk[drv].cachedtrack = fdc->position[drv].track;
+}
+
+//Current sector's data in the track buffer, or NULL if the sector number is off the track
+uint8_t* fdc_sectdata(FDC_t* fdc, uint8_t drv) {
+	if ((fdc->position[drv].sect < 1) || (fdc->position[drv].sect > fdc->disk[drv].sectors)) return NULL;
+	fdc_cachetrack(fdc, drv);
+	return fdc->disk[drv].trackbuf + ((fdc->position[drv].head * fdc->disk[drv].sectors) + fdc->position[drv].sect - 1) * 512;
+}
+
+void fdc_result(FDC_t* fdc, uint8_t drv) {
+	fdc->busy = 0;
+	fdc->st[0] = FDC_ST0_INT_NORMAL | FDC_ST0_SE | (fdc->position[drv].head << 2) | drv;
+	fdc->st[1] = 0;
+	fdc->st[2] = 0;
+	fdc_fifoclear(fdc);
+	fdc_fifoadd(fdc, fdc->st[0]);
+	fdc_fifoadd(fdc, fdc->st[1]);
+	fdc_fifoadd(fdc, fdc->st[2]);
+	fdc_fifoadd(fdc, fdc->position[drv].idtrack);
+	fdc_fifoadd(fdc, fdc->position[drv].head);
+	fdc_fifoadd(fdc, fdc->position[drv].sect);
+	fdc_fifoadd(fdc, 2);
+	i8259_doirq(fdc->i8259, fdc->irq);
+}
+
+/*
+	Fast mode: moves every requested sector up to EOT or DMA terminal count in
+	one go, then leaves the result phase and IRQ to the timerdone callback.
+
+	As on the real controller, R is left on the sector after the last one
+	transferred. Past EOT it goes back to 1, and a multi-track (MT) read on
+	head 0 carries on with head 1, both sides being in the track cache.
+	Otherwise the end of the cylinder moves C on, and an MT read flips H back.
+*/
+void fdc_fastread(FDC_t* fdc, uint8_t drv) {
+	uint8_t eot = fdc->cmd[6];
+	uint8_t mt = fdc->cmd[0] & 0x80;
+	uint8_t* data;
+
+	while ((data = fdc_sectdata(fdc, drv)) != NULL) {
+		if (i8237_writeBlock(fdc->i8237, fdc->dma, data, 512) < 512) break;
+		if (fdc->position[drv].sect < eot) {
+			fdc->position[drv].sect++;
+		}
+		else {
+			fdc->position[drv].sect = 1;
+			if (mt && (fdc->position[drv].head == 0) && (fdc->disk[drv].sides > 1)) {
+				fdc->position[drv].head = 1;
+			}
+			else {
+				if (mt) fdc->position[drv].head ^= 1;
+				fdc->position[drv].idtrack++;
+				break;
+			}
+		}
+		if (fdc->i8237->chan[fdc->dma].terminal) break;
+	}
+	if (DEBUG_ON(DEBUG_SUB_FDC)) {
+		debug_log(DEBUG_DETAIL, "[FDC] Fast read on drive %u ended at C %lu H %lu R %lu\r\n", drv, fdc->position[drv].track, fdc->position[drv].head, fdc->position[drv].sect);
+	}
+	fdc->fastdrv = drv;
+	timing_timerEnable(fdc->timerdone);
+}
+
+void fdc_fastdone(FDC_t* fdc) {
+	timing_timerDisable(fdc->timerdone);
+	fdc_result(fdc, fdc->fastdrv);
+}
+
 void fdc_transfersector(FDC_t* fdc) {
 	uint8_t drv;
-	uint32_t lba, tracksize, filepos;
+	uint8_t active = 0;
 
 	for (drv = 0; drv < 4; drv++) {
-		tracksize = fdc->disk[drv].sectors * 512;
 		if (fdc->position[drv].transferring) {
 			if (fdc->sectpos < 512) {
 				if (fdc->usedma) {
@@ -317,46 +415,40 @@ void fdc_transfersector(FDC_t* fdc) {
 			}
 			else if (fdc->sectpos == 512) {
 				//fdc_incrementsect(fdc, drv);
-				filepos = ftell(fdc->disk[drv].dfile);
-
 				fdc->position[drv].transferring = 0;
 				fdc->position[drv].reading = 0;
-				fdc->busy = 0;
-				fdc->st[0] = FDC_ST0_INT_NORMAL | FDC_ST0_SE | (fdc->position[drv].head << 2) | drv;
-				fdc->st[1] = 0;
-				fdc->st[2] = 0;
-				fdc_fifoclear(fdc);
-				fdc_fifoadd(fdc, fdc->st[0]);
-				fdc_fifoadd(fdc, fdc->st[1]);
-				fdc_fifoadd(fdc, fdc->st[2]);
-				fdc_fifoadd(fdc, fdc->position[drv].track);
-				fdc_fifoadd(fdc, fdc->position[drv].head);
-				fdc_fifoadd(fdc, fdc->position[drv].sect);
-				fdc_fifoadd(fdc, 2);
-				i8259_doirq(fdc->i8259, fdc->irq);
-#ifdef DEBUG_FDC
-				debug_log(DEBUG_DETAIL, "[FDC] Finished sector transfer, raised IRQ 6\r\n");
-#endif
+				fdc_result(fdc, drv);
+				if (DEBUG_ON(DEBUG_SUB_FDC)) {
+					debug_log(DEBUG_DETAIL, "[FDC] Finished sector transfer, raised IRQ 6\r\n");
+				}
 				break;
 			}
+			active = 1;
 		}
 		else if (fdc->position[drv].reading) {
-			//printf("Reading drive %u\r\n", drv);
-			lba = (fdc->position[drv].track * tracksize * 2) + (fdc->position[drv].head * tracksize) + ((fdc->position[drv].sect - 1) * 512);
-			//printf("LBA = %lu\r\n", lba);
-			fseek(fdc->disk[drv].dfile, SEEK_SET, lba);
-			fread(fdc->sectbuf, 1, 512, fdc->disk[drv].dfile);
+			uint8_t* data = fdc_sectdata(fdc, drv);
+			if (data != NULL) {
+				memcpy(fdc->sectbuf, data, 512);
+			}
+			else {
+				memset(fdc->sectbuf, 0, 512);
+			}
 			fdc->position[drv].transferring = 1;
 			fdc->sectpos = 0;
 			fdc_fifoclear(fdc);
+			active = 1;
 		}
 	}
+
+	if (!active) {
+		timing_timerDisable(fdc->timerread); //nothing in flight, fdc_move turns it back on for the next read
+	}
 }
 
 void fdc_reset(FDC_t* fdc) {
-#ifdef DEBUG_FDC
-	debug_log(DEBUG_DETAIL, "[FDC] Reset controller\r\n");
-#endif
+	if (DEBUG_ON(DEBUG_SUB_FDC)) {
+		debug_log(DEBUG_DETAIL, "[FDC] Reset controller\r\n");
+	}
 
 	i8259_doirq(fdc->i8259, fdc->irq);
 
@@ -374,17 +466,35 @@ int fdc_insert(FDC_t* fdc, uint8_t num, char* dfile) {
 	fdc->disk[num].inserted = 0;
 
 	if (fdc->disk[num].dfile != NULL) {
+		diskcache_close(fdc->disk[num].cache);
+		fdc->disk[num].cache = -1;
 		fclose(fdc->disk[num].dfile);
+		fdc->disk[num].dfile = NULL;
+	}
+	packdisk_close(fdc->disk[num].pack);
+	fdc->disk[num].pack = NULL;
+	if (fdc->disk[num].trackbuf != NULL) {
+		free(fdc->disk[num].trackbuf);
+		fdc->disk[num].trackbuf = NULL;
 	}
 
-	fdc->disk[num].dfile = fopen(dfile, "rb");
-	if (fdc->disk[num].dfile == NULL) {
-		return -1;
+	if (packdisk_detect(dfile)) {
+		fdc->disk[num].pack = packdisk_open(dfile);
+		if (fdc->disk[num].pack == NULL) {
+			return -1;
+		}
+		fdc->disk[num].size = fdc->disk[num].pack->hdr.size;
 	}
+	else {
+		fdc->disk[num].dfile = fopen(dfile, "rb");
+		if (fdc->disk[num].dfile == NULL) {
+			return -1;
+		}
 
-	fseek(fdc->disk[num].dfile, 0, SEEK_END);
-	fdc->disk[num].size = ftell(fdc->disk[num].dfile);
-	fseek(fdc->disk[num].dfile, 0, SEEK_SET);
+		fseek(fdc->disk[num].dfile, 0, SEEK_END);
+		fdc->disk[num].size = ftell(fdc->disk[num].dfile);
+		fseek(fdc->disk[num].dfile, 0, SEEK_SET);
+	}
 
 	fdc->disk[num].tracks = 80;
 	fdc->disk[num].sectors = 18;
@@ -410,10 +520,21 @@ int fdc_insert(FDC_t* fdc, uint8_t num, char* dfile) {
 		fdc->disk[num].sides = 1;
 	}
 
+	fdc->disk[num].trackbuf = (uint8_t*)malloc(fdc->disk[num].sectors * fdc->disk[num].sides * 512);
+	if (fdc->disk[num].trackbuf == NULL) {
+		if (fdc->disk[num].dfile != NULL) fclose(fdc->disk[num].dfile);
+		fdc->disk[num].dfile = NULL;
+		packdisk_close(fdc->disk[num].pack);
+		fdc->disk[num].pack = NULL;
+		return -1;
+	}
+	fdc->disk[num].cachedtrack = FDC_NO_TRACK;
+	fdc->disk[num].cache = (fdc->disk[num].dfile != NULL) ? diskcache_open(fdc->disk[num].dfile, fdc->disk[num].size) : -1;
+
 	fdc->disk[num].inserted = 1;
-#ifdef DEBUG_FDC
-	debug_log(DEBUG_DETAIL, "[FDC] Inserted floppy: %s (%lu KB)\r\n", dfile, fdc->disk[num].size >> 10);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_FDC)) {
+		debug_log(DEBUG_DETAIL, "[FDC] Inserted floppy: %s (%lu KB)\r\n", dfile, fdc->disk[num].size >> 10);
+	}
 
 	return 0;
 }
@@ -429,8 +550,9 @@ int fdc_init(FDC_t* fdc, CPU_t* cpu, I8259_t* i8259, I8237_t* i8237) {
 	fdc->irq = 6;
 	fdc->dma = 2;
 
-	fdc->timerseek = timing_addTimer(fdc_move, fdc, 50, TIMING_ENABLED);
-	fdc->timerread = timing_addTimer(fdc_transfersector, fdc, 500000 / 8, TIMING_ENABLED);
+	fdc->timerseek = timing_addGuestTimer(fdc_move, fdc, 50, TIMING_ENABLED);
+	fdc->timerread = timing_addGuestTimer(fdc_transfersector, fdc, 500000 / 8, TIMING_DISABLED);
+	fdc->timerdone = timing_addGuestTimer(fdc_fastdone, fdc, FDC_FAST_DELAY, TIMING_DISABLED);
 	ports_cbRegister(0x3F0, 8, (void*)fdc_read, NULL, (void*)fdc_write, NULL, fdc);
 
 	return 0;
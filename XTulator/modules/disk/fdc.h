@@ -6,8 +6,10 @@
 #include "../../cpu/cpu.h"
 #include "../../chipset/i8259.h"
 #include "../../chipset/i8237.h"
+#include "packdisk.h"
 
 #define FDC_FIFO_LEN					1024
+#define FDC_FAST_DELAY					2000 //Hz, fast mode raises the result IRQ this long after a whole read is moved
 
 #define FDC_CMD_READ_TRACK				2
 #define FDC_CMD_SPECIFY					3
@@ -60,13 +62,20 @@ typedef struct {
 	uint32_t sectors;
 	uint32_t tracks;
 	uint32_t sides;
+	uint8_t* trackbuf; //both sides of one cylinder, read in on seek
+	uint32_t cachedtrack; //cylinder held in trackbuf, FDC_NO_TRACK if none
+	int cache; //diskcache handle, -1 to read dfile directly
+	PACKDISK_t* pack; //packed image, dfile is NULL then
 } FDCDISK_t;
 
+#define FDC_NO_TRACK					0xFFFFFFFF
+
 typedef struct {
 	uint32_t track;
 	uint32_t head;
 	uint32_t sect;
 	uint32_t wanttrack;
+	uint32_t idtrack; //C of the result phase, which moves on past the end of a cylinder while the head stays put
 	uint8_t seeking;
 	uint8_t reading;
 	uint8_t transferring;
@@ -93,6 +102,9 @@ typedef struct {
 	uint8_t busy;
 	uint32_t timerseek;
 	uint32_t timerread;
+	uint32_t timerdone;
+	uint8_t fastmode; //move whole reads out of the track cache with block DMA instead of a byte per timer tick
+	uint8_t fastdrv;
 	FDCPOS_t position[4];
 	FDCDISK_t disk[4];
 	uint8_t sectbuf[512];
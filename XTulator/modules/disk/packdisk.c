@@ -0,0 +1,223 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Block-compressed, read-only disk images.
+
+		PACKDISK_HEADER_t
+		uint32_t index[blocks + 1]	file offset of each block's data, then the end of the last one
+		block 0, block 1, ...
+
+	Each block is PACKDISK_BLOCKSIZE bytes of the raw image packed with
+	utility_pack. A block whose packed length comes out as zero is all zeros,
+	one that is exactly the block size is stored as it is. The index gives
+	random access, and the last PACKDISK_CACHE blocks read are kept unpacked
+	so sector sized reads don't unpack the same block over and over. Images
+	are made with -packimage. They can be inserted as they are, or as the base
+	of a copy-on-write overlay when the guest needs to write. All fields are in
+	host byte order.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "packdisk.h"
+#include "../../utility.h"
+#include "../../debuglog.h"
+
+//Returns 1 if filename is a packed image
+int packdisk_detect(char* filename) {
+	FILE* f;
+	char magic[8];
+	int ret = 0;
+
+	f = fopen(filename, "rb");
+	if (f == NULL) return 0;
+	if ((fread(magic, 1, 8, f) == 8) && (memcmp(magic, PACKDISK_MAGIC, 8) == 0)) ret = 1;
+	fclose(f);
+	return ret;
+}
+
+void packdisk_close(PACKDISK_t* pack) {
+	if (pack == NULL) return;
+	if (pack->f != NULL) fclose(pack->f);
+	if (pack->index != NULL) free(pack->index);
+	if (pack->cachedata != NULL) free(pack->cachedata);
+	if (pack->packbuf != NULL) free(pack->packbuf);
+	free(pack);
+}
+
+//Returns NULL on error
+PACKDISK_t* packdisk_open(char* filename) {
+	PACKDISK_t* pack;
+	uint32_t i;
+
+	pack = (PACKDISK_t*)calloc(1, sizeof(PACKDISK_t));
+	if (pack == NULL) return NULL;
+
+	pack->f = fopen(filename, "rb");
+	if ((pack->f == NULL) || (fread(&pack->hdr, 1, sizeof(PACKDISK_HEADER_t), pack->f) < sizeof(PACKDISK_HEADER_t)) ||
+		memcmp(pack->hdr.magic, PACKDISK_MAGIC, 8) || (pack->hdr.blocksize == 0) || (pack->hdr.blocksize > UTILITY_PACK_MAXLEN) ||
+		(pack->hdr.blocks != ((pack->hdr.size + pack->hdr.blocksize - 1) / pack->hdr.blocksize))) {
+		debug_log(DEBUG_ERROR, "[PACKDISK] %s is not a packed disk image\r\n", filename);
+		packdisk_close(pack);
+		return NULL;
+	}
+
+	pack->index = (uint32_t*)malloc(((size_t)pack->hdr.blocks + 1) * 4);
+	pack->cachedata = (uint8_t*)malloc((size_t)PACKDISK_CACHE * pack->hdr.blocksize);
+	pack->packbuf = (uint8_t*)malloc(pack->hdr.blocksize);
+	if ((pack->index == NULL) || (pack->cachedata == NULL) || (pack->packbuf == NULL)) {
+		packdisk_close(pack);
+		return NULL;
+	}
+	if (fread(pack->index, 4, (size_t)pack->hdr.blocks + 1, pack->f) < ((size_t)pack->hdr.blocks + 1)) {
+		debug_log(DEBUG_ERROR, "[PACKDISK] %s is truncated\r\n", filename);
+		packdisk_close(pack);
+		return NULL;
+	}
+	for (i = 0; i < PACKDISK_CACHE; i++) {
+		pack->cacheblock[i] = PACKDISK_NONE;
+	}
+
+	debug_log(DEBUG_INFO, "[PACKDISK] Opened %s (%lu KB in %lu KB)\r\n", filename, (unsigned long)(pack->hdr.size >> 10), (unsigned long)(pack->index[pack->hdr.blocks] >> 10));
+	return pack;
+}
+
+//Unpacked contents of a block, NULL if the file can't be read or the block is corrupt
+static uint8_t* packdisk_block(PACKDISK_t* pack, uint32_t block) {
+	uint32_t slot, len;
+	uint8_t* data;
+
+	slot = block & (PACKDISK_CACHE - 1);
+	data = pack->cachedata + (size_t)slot * pack->hdr.blocksize;
+	if (pack->cacheblock[slot] == block) return data;
+
+	pack->cacheblock[slot] = PACKDISK_NONE;
+	len = pack->index[block + 1] - pack->index[block];
+	if (len == 0) {
+		memset(data, 0, pack->hdr.blocksize);
+	}
+	else if (len == pack->hdr.blocksize) {
+		fseek(pack->f, pack->index[block], SEEK_SET);
+		if (fread(data, 1, len, pack->f) < len) return NULL;
+	}
+	else {
+		if (len > pack->hdr.blocksize) return NULL;
+		fseek(pack->f, pack->index[block], SEEK_SET);
+		if (fread(pack->packbuf, 1, len, pack->f) < len) return NULL;
+		if (utility_unpack(pack->packbuf, len, data, pack->hdr.blocksize)) return NULL;
+	}
+	pack->cacheblock[slot] = block;
+	return data;
+}
+
+//Returns the number of bytes copied, short at the end of the image or on a bad block
+uint32_t packdisk_read(PACKDISK_t* pack, uint32_t offset, uint8_t* dst, uint32_t len) {
+	uint32_t done = 0, block, boff, n;
+	uint8_t* data;
+
+	if (offset >= pack->hdr.size) return 0;
+	if (len > (pack->hdr.size - offset)) len = pack->hdr.size - offset;
+
+	while (done < len) {
+		block = (offset + done) / pack->hdr.blocksize;
+		boff = (offset + done) % pack->hdr.blocksize;
+		n = pack->hdr.blocksize - boff;
+		if (n > (len - done)) n = len - done;
+		data = packdisk_block(pack, block);
+		if (data == NULL) {
+			debug_log(DEBUG_ERROR, "[PACKDISK] Block %lu is unreadable\r\n", (unsigned long)block);
+			break;
+		}
+		memcpy(dst + done, data + boff, n);
+		done += n;
+	}
+
+	return done;
+}
+
+//Packs the raw image rawname into packname, returns 0 on success
+int packdisk_create(char* rawname, char* packname) {
+	FILE* raw, * out;
+	PACKDISK_HEADER_t hdr;
+	uint32_t* index = NULL;
+	uint8_t* block = NULL, * packed = NULL, * data;
+	uint32_t i, got, len;
+	int ret = -1;
+
+	raw = fopen(rawname, "rb");
+	if (raw == NULL) {
+		printf("Unable to open %s\r\n", rawname);
+		return -1;
+	}
+	out = fopen(packname, "wb");
+	if (out == NULL) {
+		printf("Unable to create %s\r\n", packname);
+		fclose(raw);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PACKDISK_MAGIC, 8);
+	fseek(raw, 0L, SEEK_END);
+	hdr.size = ftell(raw);
+	fseek(raw, 0L, SEEK_SET);
+	hdr.blocksize = PACKDISK_BLOCKSIZE;
+	hdr.blocks = (hdr.size + PACKDISK_BLOCKSIZE - 1) / PACKDISK_BLOCKSIZE;
+
+	index = (uint32_t*)calloc((size_t)hdr.blocks + 1, 4);
+	block = (uint8_t*)malloc(PACKDISK_BLOCKSIZE);
+	packed = (uint8_t*)malloc(PACKDISK_BLOCKSIZE);
+	if ((index == NULL) || (block == NULL) || (packed == NULL)) goto done;
+
+	//index goes in once every block's offset is known
+	if ((fwrite(&hdr, 1, sizeof(hdr), out) < sizeof(hdr)) || (fwrite(index, 4, (size_t)hdr.blocks + 1, out) < ((size_t)hdr.blocks + 1))) goto done;
+	index[0] = sizeof(hdr) + (hdr.blocks + 1) * 4;
+	for (i = 0; i < hdr.blocks; i++) {
+		got = (uint32_t)fread(block, 1, PACKDISK_BLOCKSIZE, raw);
+		memset(block + got, 0, PACKDISK_BLOCKSIZE - got);
+		for (len = 0; (len < PACKDISK_BLOCKSIZE) && (block[len] == 0); len++);
+		if (len == PACKDISK_BLOCKSIZE) {
+			len = 0;
+		}
+		else {
+			len = utility_pack(block, PACKDISK_BLOCKSIZE, packed);
+			if (len == 0) len = PACKDISK_BLOCKSIZE;
+			data = (len == PACKDISK_BLOCKSIZE) ? block : packed;
+			if (fwrite(data, 1, len, out) < len) goto done;
+		}
+		index[i + 1] = index[i] + len;
+	}
+	fseek(out, sizeof(hdr), SEEK_SET);
+	if (fwrite(index, 4, (size_t)hdr.blocks + 1, out) < ((size_t)hdr.blocks + 1)) goto done;
+
+	printf("Packed %lu KB into %lu KB\r\n", (unsigned long)(hdr.size >> 10), (unsigned long)(index[hdr.blocks] >> 10));
+	ret = 0;
+
+done:
+	if (ret) printf("Unable to write %s\r\n", packname);
+	if (index != NULL) free(index);
+	if (block != NULL) free(block);
+	if (packed != NULL) free(packed);
+	fclose(raw);
+	fclose(out);
+	return ret;
+}
@@ -0,0 +1,35 @@
+#ifndef _PACKDISK_H_
+#define _PACKDISK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PACKDISK_MAGIC			"XTPACK1"
+#define PACKDISK_BLOCKSIZE		16384 //image bytes per compressed block, at most UTILITY_PACK_MAXLEN
+#define PACKDISK_CACHE			64 //unpacked blocks kept per image, must be a power of two
+#define PACKDISK_NONE			0xFFFFFFFF
+
+typedef struct {
+	char magic[8];
+	uint32_t blocksize;
+	uint32_t blocks;
+	uint32_t size; //of the raw image
+	uint32_t reserved;
+} PACKDISK_HEADER_t;
+
+typedef struct {
+	FILE* f;
+	PACKDISK_HEADER_t hdr;
+	uint32_t* index; //file offset of each block's data and one past the last, so a block's packed length is the gap to the next
+	uint32_t cacheblock[PACKDISK_CACHE]; //block unpacked in each cache slot, PACKDISK_NONE if empty
+	uint8_t* cachedata;
+	uint8_t* packbuf;
+} PACKDISK_t;
+
+int packdisk_detect(char* filename);
+PACKDISK_t* packdisk_open(char* filename);
+void packdisk_close(PACKDISK_t* pack);
+uint32_t packdisk_read(PACKDISK_t* pack, uint32_t offset, uint8_t* dst, uint32_t len);
+int packdisk_create(char* rawname, char* packname);
+
+#endif
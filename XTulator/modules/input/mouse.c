@@ -27,6 +27,8 @@
 #include "../../config.h"
 #include "../../debuglog.h"
 #include "../../ports.h"
+#include "../../timing.h"
+#include "../../replay.h"
 #include "../../chipset/uart.h"
 #include "mouse.h"
 
@@ -35,11 +37,14 @@ UART_t* mouse_uart = NULL;
 uint8_t mouse_buf[MOUSE_BUFFER_LEN]; //room for six events
 uint8_t mouse_bufpos = 0;
 uint8_t mouse_lasttoggle = 0;
+uint32_t mouse_timer = 0;
+uint8_t mouse_haveTimer = 0;
 
 void mouse_addbuf(uint8_t value) {
 	if (mouse_bufpos == MOUSE_BUFFER_LEN) return;
 
 	mouse_buf[mouse_bufpos++] = value;
+	if (mouse_haveTimer && (mouse_bufpos == 1)) timing_timerEnable(mouse_timer); //runs only while there is something to send
 }
 
 void mouse_togglereset(void* dummy, uint8_t value) { //reset mouse, allows detection, is a callback for the UART module
@@ -71,16 +76,30 @@ void mouse_action(uint8_t action, uint8_t state, int32_t xrel, int32_t yrel) {
 }
 
 void mouse_rxpoll(void* dummy) {
+	int sent;
+
 	if (mouse_uart == NULL) return;
-	if (mouse_uart->rxnew) return;
-	if (mouse_bufpos == 0) return;
+	if (mouse_bufpos == 0) {
+		timing_timerDisable(mouse_timer);
+		return;
+	}
 
-	uart_rxdata(mouse_uart, mouse_buf[0]);
-	memmove(mouse_buf, mouse_buf + 1, MOUSE_BUFFER_LEN - 1);
-	mouse_bufpos--;
+	if (replay_mode == REPLAY_PLAY) {
+		mouse_bufpos = 0; //the recording has the bytes that went in
+		return;
+	}
+	sent = uart_rxbytes(mouse_uart, mouse_buf, mouse_bufpos); //one byte, or as many as the FIFO takes
+	if (sent == 0) return;
+	replay_input(REPLAY_SERIAL, mouse_uart, mouse_buf, sent);
+	memmove(mouse_buf, mouse_buf + sent, MOUSE_BUFFER_LEN - sent);
+	mouse_bufpos -= sent;
 }
 
 void mouse_init(UART_t* uart) {
 	debug_log(DEBUG_INFO, "[MOUSE] Initializing Microsoft-compatible serial mouse\r\n");
 	mouse_uart = uart;
+	if (!mouse_haveTimer) {
+		mouse_timer = timing_addTimer(mouse_rxpoll, NULL, baudrate / 9, TIMING_DISABLED);
+		mouse_haveTimer = 1;
+	}
 }
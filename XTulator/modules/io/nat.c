@@ -0,0 +1,856 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	User mode NAT backend for the NE2000 (-net nat), so the guest can get
+	online without pcap, a host interface or root.
+
+	The guest sees a private 10.0.2.0/24 network. 10.0.2.2 is the gateway and
+	answers ARP, DHCP and pings, 10.0.2.3 is the name server and 10.0.2.15 is
+	what DHCP hands out. Guest TCP connections and UDP datagrams are carried
+	over ordinary host sockets: TCP is terminated here with just enough of a
+	state machine for in-order data, and UDP is relayed from one host socket
+	per guest port. Anything sent to 10.0.2.2 goes to the host's 127.0.0.1,
+	and DNS to 10.0.2.3 goes to the host's own name server.
+
+	Everything runs on the emulation thread. A host timer polls all of the
+	sockets with a single zero timeout poll() and hands queued frames to the
+	NE2000 as its receive ring has room for them.
+*/
+
+#include "../../config.h"
+
+#ifdef USE_NE2000
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <iphlpapi.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#endif
+#include "ne2000.h"
+#include "nat.h"
+#include "../../timing.h"
+#include "../../replay.h"
+#include "../../debuglog.h"
+
+#ifdef _WIN32
+#define NAT_POLLFD			WSAPOLLFD
+#define nat_pollSockets(f, n)	WSAPoll(f, n, 0)
+#define nat_closeSocket		closesocket
+#define nat_wouldBlock()	(WSAGetLastError() == WSAEWOULDBLOCK)
+#define NAT_SOCKERR			((NAT_SOCKET)INVALID_SOCKET)
+#else
+#define NAT_POLLFD			struct pollfd
+#define nat_pollSockets(f, n)	poll(f, n, 0)
+#define nat_closeSocket		close
+#define nat_wouldBlock()	((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINPROGRESS))
+#define NAT_SOCKERR			((NAT_SOCKET)-1)
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define NAT_SENDFLAGS		MSG_NOSIGNAL //a host side reset shouldn't raise SIGPIPE
+#else
+#define NAT_SENDFLAGS		0
+#endif
+
+#define NAT_PROTO_ICMP		1
+#define NAT_PROTO_TCP		6
+#define NAT_PROTO_UDP		17
+
+#define NAT_FIN				0x01
+#define NAT_SYN				0x02
+#define NAT_RST				0x04
+#define NAT_PSH				0x08
+#define NAT_ACK				0x10
+
+NE2000_t* nat_ne2000 = NULL;
+char* nat_dns = NULL; //-netdns, otherwise the host's configured name server is used
+
+NAT_TCP_t nat_tcp[NAT_MAXTCP];
+NAT_UDP_t nat_udp[NAT_MAXUDP];
+NAT_FRAME_t nat_out[NAT_OUTSLOTS];
+uint32_t nat_outhead = 0, nat_outtail = 0;
+uint8_t nat_build[NAT_MAXFRAME]; //the frame being put together for the guest
+uint8_t nat_guestmac[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }; //learned from the guest's frames
+const uint8_t nat_gatewaymac[6] = { 0x52, 0x55, 0x0A, 0x00, 0x02, 0x02 };
+uint32_t nat_dnsaddr = 0;
+uint16_t nat_ipid = 0;
+uint32_t nat_isn = 0x1000;
+
+static uint16_t nat_get16(const uint8_t* p) {
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t nat_get32(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void nat_put16(uint8_t* p, uint16_t value) {
+	p[0] = (uint8_t)(value >> 8);
+	p[1] = (uint8_t)value;
+}
+
+static void nat_put32(uint8_t* p, uint32_t value) {
+	p[0] = (uint8_t)(value >> 24);
+	p[1] = (uint8_t)(value >> 16);
+	p[2] = (uint8_t)(value >> 8);
+	p[3] = (uint8_t)value;
+}
+
+//Ones' complement sum of big endian words, folded and inverted by nat_fold
+static uint32_t nat_sum(const uint8_t* p, int len, uint32_t sum) {
+	while (len > 1) {
+		sum += ((uint32_t)p[0] << 8) | p[1];
+		p += 2;
+		len -= 2;
+	}
+	if (len) sum += (uint32_t)p[0] << 8;
+	return sum;
+}
+
+static uint16_t nat_fold(uint32_t sum) {
+	while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+//Sequence number comparisons that survive wrapping
+static int nat_seqLT(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) < 0;
+}
+
+static int nat_seqLE(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) <= 0;
+}
+
+static uint32_t nat_now() {
+	return (uint32_t)(timing_getCur() / (timing_getFreq() / 1000));
+}
+
+static void nat_setNonblocking(NAT_SOCKET sock) {
+#ifdef _WIN32
+	u_long on = 1;
+	ioctlsocket(sock, FIONBIO, &on);
+#else
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+//Where a guest destination really is on the host side
+static void nat_hostAddr(struct sockaddr_in* addr, uint32_t ip, uint16_t port) {
+	memset(addr, 0, sizeof(struct sockaddr_in));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+	if (ip == NAT_GATEWAY) {
+		ip = NAT_IP(127, 0, 0, 1);
+	}
+	else if (ip == NAT_NAMESERVER) {
+		ip = nat_dnsaddr;
+	}
+	addr->sin_addr.s_addr = htonl(ip);
+}
+
+static uint32_t nat_outFree() {
+	return NAT_OUTSLOTS - (nat_outhead - nat_outtail);
+}
+
+static void nat_queue(uint8_t* data, int len) {
+	NAT_FRAME_t* frame;
+
+	if (nat_outFree() == 0) {
+		debug_log(DEBUG_DETAIL, "[NAT] Output queue full, dropping a frame\r\n");
+		return;
+	}
+	if (len < 60) { //pad runts out to the Ethernet minimum
+		memset(data + len, 0, 60 - len);
+		len = 60;
+	}
+	frame = &nat_out[nat_outhead & (NAT_OUTSLOTS - 1)];
+	memcpy(frame->data, data, len);
+	frame->len = (uint16_t)len;
+	nat_outhead++;
+}
+
+static void nat_drain() {
+	while (nat_outtail != nat_outhead) {
+		NAT_FRAME_t* frame = &nat_out[nat_outtail & (NAT_OUTSLOTS - 1)];
+		if (!ne2000_rx_room(nat_ne2000, frame->len)) break;
+		if (replay_input(REPLAY_NET, nat_ne2000, frame->data, frame->len)) {
+			ne2000_rx_frame(nat_ne2000, frame->data, frame->len);
+		}
+		nat_outtail++;
+	}
+}
+
+//Wraps the l4len bytes at nat_build + 34 in IP and Ethernet headers and queues the frame
+static void nat_ipOut(uint8_t proto, uint32_t src, uint32_t dst, int l4len) {
+	uint8_t* ip = nat_build + 14;
+	uint8_t* l4 = nat_build + 34;
+	uint32_t sum;
+	uint16_t check;
+	int at;
+
+	memcpy(nat_build, nat_guestmac, 6);
+	memcpy(nat_build + 6, nat_gatewaymac, 6);
+	nat_put16(nat_build + 12, 0x0800);
+
+	ip[0] = 0x45;
+	ip[1] = 0;
+	nat_put16(ip + 2, (uint16_t)(20 + l4len));
+	nat_put16(ip + 4, nat_ipid++);
+	nat_put16(ip + 6, 0);
+	ip[8] = 64;
+	ip[9] = proto;
+	nat_put16(ip + 10, 0);
+	nat_put32(ip + 12, src);
+	nat_put32(ip + 16, dst);
+	nat_put16(ip + 10, nat_fold(nat_sum(ip, 20, 0)));
+
+	if ((proto == NAT_PROTO_TCP) || (proto == NAT_PROTO_UDP)) {
+		at = (proto == NAT_PROTO_TCP) ? 16 : 6;
+		nat_put16(l4 + at, 0);
+		sum = nat_sum(ip + 12, 8, 0) + proto + (uint32_t)l4len;
+		check = nat_fold(nat_sum(l4, l4len, sum));
+		if ((proto == NAT_PROTO_UDP) && (check == 0)) check = 0xFFFF;
+		nat_put16(l4 + at, check);
+	}
+
+	nat_queue(nat_build, 34 + l4len);
+}
+
+static void nat_udpOut(uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport, uint8_t* data, int len) {
+	uint8_t* udp = nat_build + 34;
+
+	if (len > (NAT_MAXFRAME - 42)) return;
+	nat_put16(udp, sport);
+	nat_put16(udp + 2, dport);
+	nat_put16(udp + 4, (uint16_t)(8 + len));
+	if (data != NULL) memcpy(udp + 8, data, len);
+	nat_ipOut(NAT_PROTO_UDP, src, dst, 8 + len);
+}
+
+static void nat_tcpSegment(uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport, uint32_t seq, uint32_t ack, uint8_t flags, uint8_t* data, int len) {
+	uint8_t* tcp = nat_build + 34;
+	int hlen = (flags & NAT_SYN) ? 24 : 20;
+
+	nat_put16(tcp, sport);
+	nat_put16(tcp + 2, dport);
+	nat_put32(tcp + 4, seq);
+	nat_put32(tcp + 8, ack);
+	tcp[12] = (uint8_t)((hlen / 4) << 4);
+	tcp[13] = flags;
+	nat_put16(tcp + 14, NAT_TCP_WINDOW);
+	nat_put16(tcp + 16, 0);
+	nat_put16(tcp + 18, 0);
+	if (flags & NAT_SYN) { //MSS option
+		tcp[20] = 2;
+		tcp[21] = 4;
+		nat_put16(tcp + 22, NAT_TCP_MSS);
+	}
+	if (len > 0) memcpy(tcp + hlen, data, len);
+	nat_ipOut(NAT_PROTO_TCP, src, dst, hlen + len);
+}
+
+static void nat_tcpOut(NAT_TCP_t* tcp, uint8_t flags, uint32_t seq, uint8_t* data, int len) {
+	nat_tcpSegment(tcp->hip, tcp->hport, tcp->gip, tcp->gport, seq, tcp->rcv_nxt, flags, data, len);
+	if ((len > 0) || (flags & (NAT_SYN | NAT_FIN))) tcp->lastsend = nat_now(); //bare ACKs don't restart the retransmit clock
+}
+
+static void nat_tcpFree(NAT_TCP_t* tcp) {
+	if (tcp->sock != NAT_SOCKERR) nat_closeSocket(tcp->sock);
+	tcp->sock = NAT_SOCKERR;
+	tcp->state = NAT_TCP_FREE;
+}
+
+static void nat_tcpReset(NAT_TCP_t* tcp) {
+	nat_tcpOut(tcp, NAT_RST | NAT_ACK, tcp->snd_nxt, NULL, 0);
+	nat_tcpFree(tcp);
+}
+
+//Sends whatever host data the guest's window allows, then the FIN once the host has closed and it's all out
+static void nat_tcpPush(NAT_TCP_t* tcp) {
+	uint32_t inflight, len;
+
+	if ((tcp->state != NAT_TCP_ESTABLISHED) || tcp->finsent) return;
+	while (nat_outFree() > 1) {
+		inflight = tcp->snd_nxt - tcp->snd_una;
+		if ((inflight >= tcp->sendlen) || (inflight >= tcp->guestwin)) break;
+		len = tcp->sendlen - inflight;
+		if (len > (uint32_t)(tcp->guestwin - inflight)) len = tcp->guestwin - inflight;
+		if (len > tcp->mss) len = tcp->mss;
+		nat_tcpOut(tcp, NAT_ACK | NAT_PSH, tcp->snd_nxt, tcp->sendbuf + inflight, (int)len);
+		tcp->snd_nxt += len;
+	}
+	if (tcp->hostfin && ((tcp->snd_nxt - tcp->snd_una) == tcp->sendlen) && nat_outFree()) {
+		nat_tcpOut(tcp, NAT_FIN | NAT_ACK, tcp->snd_nxt, NULL, 0);
+		tcp->snd_nxt++;
+		tcp->finsent = 1;
+	}
+}
+
+static void nat_tcpSYN(uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport, uint32_t seq, uint8_t* opt, int optlen) {
+	NAT_TCP_t* tcp = NULL;
+	struct sockaddr_in addr;
+	int i;
+
+	if (((dst & NAT_NETMASK) == NAT_NETWORK) && (dst != NAT_GATEWAY) && (dst != NAT_NAMESERVER)) {
+		nat_tcpSegment(dst, dport, src, sport, 0, seq + 1, NAT_RST | NAT_ACK, NULL, 0);
+		return;
+	}
+	for (i = 0; i < NAT_MAXTCP; i++) {
+		if (nat_tcp[i].state == NAT_TCP_FREE) {
+			tcp = &nat_tcp[i];
+			break;
+		}
+	}
+	if (tcp == NULL) {
+		debug_log(DEBUG_DETAIL, "[NAT] Out of TCP connections\r\n");
+		nat_tcpSegment(dst, dport, src, sport, 0, seq + 1, NAT_RST | NAT_ACK, NULL, 0);
+		return;
+	}
+
+	tcp->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (tcp->sock == NAT_SOCKERR) {
+		nat_tcpSegment(dst, dport, src, sport, 0, seq + 1, NAT_RST | NAT_ACK, NULL, 0);
+		return;
+	}
+	nat_setNonblocking(tcp->sock);
+	nat_hostAddr(&addr, dst, dport);
+	if ((connect(tcp->sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) && !nat_wouldBlock()) {
+		nat_closeSocket(tcp->sock);
+		tcp->sock = NAT_SOCKERR;
+		nat_tcpSegment(dst, dport, src, sport, 0, seq + 1, NAT_RST | NAT_ACK, NULL, 0);
+		return;
+	}
+
+	tcp->state = NAT_TCP_CONNECTING;
+	tcp->gip = src;
+	tcp->gport = sport;
+	tcp->hip = dst;
+	tcp->hport = dport;
+	tcp->rcv_nxt = seq + 1;
+	nat_isn += 0x10000;
+	tcp->snd_una = tcp->snd_nxt = nat_isn;
+	tcp->guestwin = 0;
+	tcp->mss = 536;
+	for (i = 0; i < optlen; ) { //the guest's MSS option, if it has one
+		if (opt[i] == 0) break;
+		if (opt[i] == 1) {
+			i++;
+			continue;
+		}
+		if (((i + 1) >= optlen) || (opt[i + 1] < 2)) break;
+		if ((opt[i] == 2) && (opt[i + 1] == 4) && ((i + 4) <= optlen)) {
+			tcp->mss = nat_get16(opt + i + 2);
+		}
+		i += opt[i + 1];
+	}
+	if (tcp->mss > NAT_TCP_MSS) tcp->mss = NAT_TCP_MSS;
+	if (tcp->mss < 64) tcp->mss = 64;
+	tcp->hostfin = tcp->finsent = tcp->guestfin = 0;
+	tcp->sendlen = 0;
+	tcp->lastsend = nat_now();
+}
+
+static void nat_tcpIn(uint32_t src, uint32_t dst, uint8_t* seg, int len) {
+	NAT_TCP_t* tcp = NULL;
+	uint16_t sport, dport;
+	uint32_t seq, ack, acked;
+	uint8_t flags;
+	int hlen, datalen, i, sent;
+
+	if (len < 20) return;
+	sport = nat_get16(seg);
+	dport = nat_get16(seg + 2);
+	seq = nat_get32(seg + 4);
+	ack = nat_get32(seg + 8);
+	hlen = (seg[12] >> 4) * 4;
+	flags = seg[13];
+	if ((hlen < 20) || (hlen > len)) return;
+	datalen = len - hlen;
+
+	for (i = 0; i < NAT_MAXTCP; i++) {
+		if ((nat_tcp[i].state != NAT_TCP_FREE) && (nat_tcp[i].gport == sport) && (nat_tcp[i].hport == dport) &&
+			(nat_tcp[i].gip == src) && (nat_tcp[i].hip == dst)) {
+			tcp = &nat_tcp[i];
+			break;
+		}
+	}
+
+	if (tcp == NULL) {
+		if (flags & NAT_RST) return;
+		if ((flags & (NAT_SYN | NAT_ACK)) == NAT_SYN) {
+			nat_tcpSYN(src, sport, dst, dport, seq, seg + 20, hlen - 20);
+		}
+		else {
+			nat_tcpSegment(dst, dport, src, sport, (flags & NAT_ACK) ? ack : 0, seq + datalen + ((flags & NAT_FIN) ? 1 : 0), NAT_RST | NAT_ACK, NULL, 0);
+		}
+		return;
+	}
+
+	if (flags & NAT_RST) {
+		nat_tcpFree(tcp);
+		return;
+	}
+	if (flags & NAT_SYN) { //a retransmitted SYN
+		if (tcp->state == NAT_TCP_SYNACK) nat_tcpOut(tcp, NAT_SYN | NAT_ACK, tcp->snd_una, NULL, 0);
+		return;
+	}
+	if (tcp->state == NAT_TCP_CONNECTING) return;
+	if (!(flags & NAT_ACK)) return;
+
+	tcp->guestwin = nat_get16(seg + 14);
+	if (tcp->state == NAT_TCP_SYNACK) {
+		if (ack != (tcp->snd_una + 1)) return;
+		tcp->snd_una = ack;
+		tcp->state = NAT_TCP_ESTABLISHED;
+	}
+	else if (nat_seqLT(tcp->snd_una, ack) && nat_seqLE(ack, tcp->snd_nxt)) {
+		acked = ack - tcp->snd_una;
+		if (acked > tcp->sendlen) acked = tcp->sendlen; //the rest is our FIN
+		memmove(tcp->sendbuf, tcp->sendbuf + acked, tcp->sendlen - acked);
+		tcp->sendlen -= acked;
+		tcp->snd_una = ack;
+		tcp->lastsend = nat_now();
+	}
+
+	if ((datalen > 0) || (flags & NAT_FIN)) {
+		if ((seq != tcp->rcv_nxt) || tcp->guestfin) { //out of order or a repeat, only in order data is taken
+			nat_tcpOut(tcp, NAT_ACK, tcp->snd_nxt, NULL, 0);
+			return;
+		}
+		sent = 0;
+		if (datalen > 0) {
+			sent = send(tcp->sock, (const char*)seg + hlen, datalen, NAT_SENDFLAGS);
+			if (sent < 0) {
+				if (!nat_wouldBlock()) {
+					nat_tcpReset(tcp);
+					return;
+				}
+				sent = 0; //the host is backed up, the guest will send it again
+			}
+			tcp->rcv_nxt += (uint32_t)sent;
+		}
+		if ((flags & NAT_FIN) && (sent == datalen)) {
+			tcp->rcv_nxt++;
+			tcp->guestfin = 1;
+#ifdef _WIN32
+			shutdown(tcp->sock, SD_SEND);
+#else
+			shutdown(tcp->sock, SHUT_WR);
+#endif
+		}
+		nat_tcpOut(tcp, NAT_ACK, tcp->snd_nxt, NULL, 0);
+	}
+
+	if (tcp->guestfin && tcp->finsent && (tcp->snd_una == tcp->snd_nxt)) {
+		nat_tcpFree(tcp);
+		return;
+	}
+	nat_tcpPush(tcp);
+}
+
+static NAT_UDP_t* nat_udpSocket(uint32_t gip, uint16_t gport) {
+	NAT_UDP_t* udp = NULL;
+	struct sockaddr_in addr;
+	int i;
+
+	for (i = 0; i < NAT_MAXUDP; i++) {
+		if (nat_udp[i].used && (nat_udp[i].gport == gport) && (nat_udp[i].gip == gip)) return &nat_udp[i];
+		if (!nat_udp[i].used && (udp == NULL)) udp = &nat_udp[i];
+	}
+	if (udp == NULL) {
+		debug_log(DEBUG_DETAIL, "[NAT] Out of UDP sockets\r\n");
+		return NULL;
+	}
+
+	udp->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (udp->sock == NAT_SOCKERR) return NULL;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	if (bind(udp->sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		nat_closeSocket(udp->sock);
+		return NULL;
+	}
+	nat_setNonblocking(udp->sock);
+	udp->used = 1;
+	udp->gip = gip;
+	udp->gport = gport;
+	return udp;
+}
+
+static void nat_dhcp(uint8_t* bootp, int len) {
+	uint8_t reply[300];
+	uint8_t* opt;
+	uint8_t type = 0;
+	int i;
+
+	if ((len < 240) || (bootp[0] != 1) || (nat_get32(bootp + 236) != 0x63825363)) return;
+	for (i = 240; i < len; ) {
+		if (bootp[i] == 255) break;
+		if (bootp[i] == 0) {
+			i++;
+			continue;
+		}
+		if ((i + 1) >= len) break;
+		if ((bootp[i] == 53) && ((i + 2) < len)) type = bootp[i + 2];
+		i += 2 + bootp[i + 1];
+	}
+	if (type == 1) {
+		type = 2; //DISCOVER gets an OFFER
+	}
+	else if (type == 3) {
+		type = 5; //REQUEST gets an ACK
+	}
+	else {
+		return;
+	}
+
+	memset(reply, 0, sizeof(reply));
+	reply[0] = 2;
+	reply[1] = 1;
+	reply[2] = 6;
+	memcpy(reply + 4, bootp + 4, 4); //xid
+	memcpy(reply + 10, bootp + 10, 2); //flags
+	nat_put32(reply + 16, NAT_GUEST);
+	nat_put32(reply + 20, NAT_GATEWAY);
+	memcpy(reply + 28, bootp + 28, 16); //chaddr
+	nat_put32(reply + 236, 0x63825363);
+	opt = reply + 240;
+	*opt++ = 53; *opt++ = 1; *opt++ = type;
+	*opt++ = 54; *opt++ = 4; nat_put32(opt, NAT_GATEWAY); opt += 4;
+	*opt++ = 51; *opt++ = 4; nat_put32(opt, 86400); opt += 4;
+	*opt++ = 1; *opt++ = 4; nat_put32(opt, NAT_NETMASK); opt += 4;
+	*opt++ = 3; *opt++ = 4; nat_put32(opt, NAT_GATEWAY); opt += 4;
+	*opt++ = 6; *opt++ = 4; nat_put32(opt, NAT_NAMESERVER); opt += 4;
+	*opt++ = 255;
+
+	nat_udpOut(NAT_GATEWAY, 67, 0xFFFFFFFF, 68, reply, sizeof(reply));
+}
+
+static void nat_udpIn(uint32_t src, uint32_t dst, uint8_t* dgram, int len) {
+	NAT_UDP_t* udp;
+	struct sockaddr_in addr;
+	uint16_t sport, dport, ulen;
+
+	if (len < 8) return;
+	sport = nat_get16(dgram);
+	dport = nat_get16(dgram + 2);
+	ulen = nat_get16(dgram + 4);
+	if ((ulen < 8) || (ulen > len)) return;
+
+	if ((dport == 67) && (sport == 68)) {
+		nat_dhcp(dgram + 8, ulen - 8);
+		return;
+	}
+	if ((dst == 0xFFFFFFFF) || (dst == (NAT_NETWORK | ~NAT_NETMASK))) return; //no other broadcasts leave the guest's network
+	if (((dst & NAT_NETMASK) == NAT_NETWORK) && (dst != NAT_GATEWAY) && (dst != NAT_NAMESERVER)) return;
+	if ((dst == NAT_NAMESERVER) && (nat_dnsaddr == 0)) return;
+
+	udp = nat_udpSocket(src, sport);
+	if (udp == NULL) return;
+	udp->lastused = nat_now();
+	nat_hostAddr(&addr, dst, dport);
+	sendto(udp->sock, (const char*)dgram + 8, ulen - 8, 0, (struct sockaddr*)&addr, sizeof(addr));
+}
+
+static void nat_icmpIn(uint32_t src, uint32_t dst, uint8_t* msg, int len) {
+	uint8_t* icmp = nat_build + 34;
+
+	//only the gateway and name server answer pings, other hosts need raw sockets
+	if ((len < 8) || (msg[0] != 8) || ((dst != NAT_GATEWAY) && (dst != NAT_NAMESERVER))) return;
+	if (len > (NAT_MAXFRAME - 34)) return;
+	memcpy(icmp, msg, len);
+	icmp[0] = 0; //echo reply
+	nat_put16(icmp + 2, 0);
+	nat_put16(icmp + 2, nat_fold(nat_sum(icmp, len, 0)));
+	nat_ipOut(NAT_PROTO_ICMP, dst, src, len);
+}
+
+static void nat_arpIn(uint8_t* arp, int len) {
+	uint32_t target;
+
+	if ((len < 28) || (nat_get16(arp) != 1) || (nat_get16(arp + 2) != 0x0800) || (nat_get16(arp + 6) != 1)) return;
+	target = nat_get32(arp + 24);
+	if ((target != NAT_GATEWAY) && (target != NAT_NAMESERVER)) return;
+
+	memcpy(nat_build, arp + 8, 6);
+	memcpy(nat_build + 6, nat_gatewaymac, 6);
+	nat_put16(nat_build + 12, 0x0806);
+	memcpy(nat_build + 14, arp, 6); //hardware and protocol types and sizes
+	nat_put16(nat_build + 20, 2);
+	memcpy(nat_build + 22, nat_gatewaymac, 6);
+	nat_put32(nat_build + 28, target);
+	memcpy(nat_build + 32, arp + 8, 10); //the asker's MAC and IP
+	nat_queue(nat_build, 42);
+}
+
+//The NE2000's txframe callback, for every frame the guest sends
+void nat_txFrame(uint8_t* data, int len) {
+	uint8_t* ip;
+	uint32_t src, dst;
+	int hlen, total;
+
+	if (len < 14) return;
+	memcpy(nat_guestmac, data + 6, 6);
+
+	switch (nat_get16(data + 12)) {
+	case 0x0806:
+		nat_arpIn(data + 14, len - 14);
+		return;
+	case 0x0800:
+		break;
+	default:
+		return;
+	}
+
+	ip = data + 14;
+	len -= 14;
+	if ((len < 20) || ((ip[0] >> 4) != 4)) return;
+	hlen = (ip[0] & 0x0F) * 4;
+	total = nat_get16(ip + 2);
+	if ((hlen < 20) || (total < hlen) || (total > len)) return;
+	if (nat_fold(nat_sum(ip, hlen, 0)) != 0) return;
+	if (nat_get16(ip + 6) & 0x3FFF) return; //fragments aren't reassembled
+	src = nat_get32(ip + 12);
+	dst = nat_get32(ip + 16);
+
+	switch (ip[9]) {
+	case NAT_PROTO_TCP:
+		nat_tcpIn(src, dst, ip + hlen, total - hlen);
+		break;
+	case NAT_PROTO_UDP:
+		nat_udpIn(src, dst, ip + hlen, total - hlen);
+		break;
+	case NAT_PROTO_ICMP:
+		nat_icmpIn(src, dst, ip + hlen, total - hlen);
+		break;
+	}
+}
+
+static void nat_tcpEvent(NAT_TCP_t* tcp, short revents) {
+	int err, n;
+	socklen_t errlen;
+
+	if (tcp->state == NAT_TCP_CONNECTING) {
+		if (!(revents & (POLLOUT | POLLERR | POLLHUP))) return;
+		err = 0;
+		errlen = sizeof(err);
+		if (getsockopt(tcp->sock, SOL_SOCKET, SO_ERROR, (char*)&err, &errlen) || err) {
+			nat_tcpReset(tcp);
+			return;
+		}
+		tcp->state = NAT_TCP_SYNACK;
+		nat_tcpOut(tcp, NAT_SYN | NAT_ACK, tcp->snd_una, NULL, 0);
+		tcp->snd_nxt = tcp->snd_una + 1;
+		return;
+	}
+
+	if ((tcp->state != NAT_TCP_ESTABLISHED) || tcp->hostfin || !(revents & (POLLIN | POLLERR | POLLHUP))) return;
+	if (tcp->sendlen == NAT_TCP_BUFSIZE) return;
+	n = recv(tcp->sock, (char*)tcp->sendbuf + tcp->sendlen, NAT_TCP_BUFSIZE - tcp->sendlen, 0);
+	if (n > 0) {
+		tcp->sendlen += (uint32_t)n;
+	}
+	else if (n == 0) {
+		tcp->hostfin = 1;
+	}
+	else if (!nat_wouldBlock()) {
+		nat_tcpReset(tcp);
+	}
+}
+
+static void nat_udpEvent(NAT_UDP_t* udp) {
+	uint8_t buf[NAT_MAXFRAME];
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	uint32_t from;
+	uint16_t port;
+	int n;
+
+	for (;;) {
+		addrlen = sizeof(addr);
+		n = recvfrom(udp->sock, (char*)buf, NAT_MAXFRAME - 42, 0, (struct sockaddr*)&addr, &addrlen);
+		if (n < 0) return;
+		from = ntohl(addr.sin_addr.s_addr);
+		port = ntohs(addr.sin_port);
+		if ((from == nat_dnsaddr) && (port == 53)) {
+			from = NAT_NAMESERVER;
+		}
+		else if (from == NAT_IP(127, 0, 0, 1)) {
+			from = NAT_GATEWAY;
+		}
+		udp->lastused = nat_now();
+		nat_udpOut(from, port, udp->gip, udp->gport, buf, n);
+	}
+}
+
+//Host timer at NAT_POLLRATE
+void nat_poll(void* dummy) {
+	NAT_POLLFD fds[NAT_MAXTCP + NAT_MAXUDP];
+	void* owner[NAT_MAXTCP + NAT_MAXUDP];
+	uint8_t istcp[NAT_MAXTCP + NAT_MAXUDP];
+	NAT_TCP_t* tcp;
+	uint32_t now = nat_now();
+	int i, count = 0;
+
+	for (i = 0; i < NAT_MAXTCP; i++) {
+		tcp = &nat_tcp[i];
+		if (tcp->state == NAT_TCP_FREE) continue;
+		if ((tcp->state == NAT_TCP_CONNECTING) && ((now - tcp->lastsend) >= NAT_TCP_CONNECTTIMEOUT)) {
+			nat_tcpReset(tcp);
+			continue;
+		}
+		fds[count].fd = tcp->sock;
+		fds[count].events = (tcp->state == NAT_TCP_CONNECTING) ? POLLOUT : ((tcp->hostfin || (tcp->sendlen == NAT_TCP_BUFSIZE)) ? 0 : POLLIN);
+		fds[count].revents = 0;
+		owner[count] = tcp;
+		istcp[count++] = 1;
+	}
+	for (i = 0; i < NAT_MAXUDP; i++) {
+		if (!nat_udp[i].used) continue;
+		if ((now - nat_udp[i].lastused) >= NAT_UDP_TIMEOUT) {
+			nat_closeSocket(nat_udp[i].sock);
+			nat_udp[i].used = 0;
+			continue;
+		}
+		fds[count].fd = nat_udp[i].sock;
+		fds[count].events = POLLIN;
+		fds[count].revents = 0;
+		owner[count] = &nat_udp[i];
+		istcp[count++] = 0;
+	}
+
+	if ((count > 0) && (nat_pollSockets(fds, count) > 0)) {
+		for (i = 0; i < count; i++) {
+			if (fds[i].revents == 0) continue;
+			if (istcp[i]) {
+				nat_tcpEvent((NAT_TCP_t*)owner[i], fds[i].revents);
+			}
+			else {
+				nat_udpEvent((NAT_UDP_t*)owner[i]);
+			}
+		}
+	}
+
+	for (i = 0; i < NAT_MAXTCP; i++) {
+		tcp = &nat_tcp[i];
+		if (tcp->state < NAT_TCP_SYNACK) continue;
+		if ((tcp->snd_nxt != tcp->snd_una) && ((now - tcp->lastsend) >= NAT_TCP_RTO)) { //go back to the oldest unacknowledged byte
+			if (tcp->state == NAT_TCP_SYNACK) {
+				nat_tcpOut(tcp, NAT_SYN | NAT_ACK, tcp->snd_una, NULL, 0);
+				continue;
+			}
+			tcp->snd_nxt = tcp->snd_una;
+			tcp->finsent = 0;
+		}
+		nat_tcpPush(tcp);
+	}
+
+	nat_drain();
+}
+
+//The host's first IPv4 name server, 0 if there isn't one
+static uint32_t nat_findDNS() {
+	uint32_t addr = 0;
+#ifdef _WIN32
+	FIXED_INFO* info;
+	ULONG len = 0;
+
+	if (GetNetworkParams(NULL, &len) != ERROR_BUFFER_OVERFLOW) return 0;
+	info = (FIXED_INFO*)malloc(len);
+	if (info == NULL) return 0;
+	if (GetNetworkParams(info, &len) == NO_ERROR) {
+		addr = ntohl(inet_addr(info->DnsServerList.IpAddress.String));
+	}
+	free(info);
+#else
+	FILE* file;
+	char line[256], ip[64];
+
+	file = fopen("/etc/resolv.conf", "r");
+	if (file == NULL) return 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if ((sscanf(line, " nameserver %63s", ip) == 1) && (strchr(ip, ':') == NULL)) {
+			addr = ntohl(inet_addr(ip));
+			break;
+		}
+	}
+	fclose(file);
+#endif
+	if (addr == 0xFFFFFFFF) addr = 0; //INADDR_NONE
+	return addr;
+}
+
+int nat_init(NE2000_t* ne2000) {
+	int i;
+#ifdef _WIN32
+	WSADATA wsa;
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+		debug_log(DEBUG_ERROR, "[NAT] Unable to initialize Winsock\r\n");
+		return -1;
+	}
+#endif
+
+	if (nat_dns != NULL) {
+		nat_dnsaddr = ntohl(inet_addr(nat_dns));
+		if (nat_dnsaddr == 0xFFFFFFFF) {
+			debug_log(DEBUG_ERROR, "[NAT] %s is not an IPv4 address\r\n", nat_dns);
+			return -1;
+		}
+	}
+	else {
+		nat_dnsaddr = nat_findDNS();
+	}
+	if (nat_dnsaddr == 0) {
+		debug_log(DEBUG_INFO, "[NAT] No host name server found, use -netdns to give one\r\n");
+	}
+
+	for (i = 0; i < NAT_MAXTCP; i++) {
+		nat_tcp[i].state = NAT_TCP_FREE;
+		nat_tcp[i].sock = NAT_SOCKERR;
+	}
+	for (i = 0; i < NAT_MAXUDP; i++) {
+		nat_udp[i].used = 0;
+	}
+	nat_outhead = nat_outtail = 0;
+	nat_isn = (uint32_t)timing_getCur() << 8;
+
+	nat_ne2000 = ne2000;
+	ne2000->txframe = nat_txFrame;
+	timing_addTimer(nat_poll, NULL, NAT_POLLRATE, TIMING_ENABLED);
+
+	debug_log(DEBUG_INFO, "[NAT] User mode networking: guest 10.0.2.15, gateway 10.0.2.2, name server 10.0.2.3\r\n");
+	return 0;
+}
+
+#endif
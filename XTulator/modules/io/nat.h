@@ -0,0 +1,81 @@
+#ifndef _NAT_H_
+#define _NAT_H_
+
+#include "../../config.h"
+
+#ifdef USE_NE2000
+
+#include <stdint.h>
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+typedef SOCKET NAT_SOCKET;
+#else
+typedef int NAT_SOCKET;
+#endif
+#include "ne2000.h"
+
+#define NAT_POLLRATE		1000 //socket polls per second, one poll() covers every open socket
+#define NAT_MAXTCP		64 //guest TCP connections open at once
+#define NAT_MAXUDP		32 //guest UDP ports with a host socket behind them
+#define NAT_OUTSLOTS		128 //frames waiting for room in the NE2000 receive ring, power of two
+#define NAT_MAXFRAME		1514
+#define NAT_TCP_BUFSIZE		16384 //host data the guest hasn't acknowledged yet, per connection
+#define NAT_TCP_MSS		1460
+#define NAT_TCP_WINDOW		8192 //receive window advertised to the guest
+#define NAT_TCP_RTO		500 //ms before unacknowledged data is sent again
+#define NAT_TCP_CONNECTTIMEOUT	20000 //ms a host connect() may take
+#define NAT_UDP_TIMEOUT		60000 //ms a UDP port may sit idle before its host socket is closed
+
+#define NAT_IP(a, b, c, d)	(((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+#define NAT_NETWORK		NAT_IP(10, 0, 2, 0)
+#define NAT_NETMASK		NAT_IP(255, 255, 255, 0)
+#define NAT_GATEWAY		NAT_IP(10, 0, 2, 2) //connections to it go to the host's own 127.0.0.1
+#define NAT_NAMESERVER		NAT_IP(10, 0, 2, 3) //relayed to the host's DNS server
+#define NAT_GUEST		NAT_IP(10, 0, 2, 15) //handed out by DHCP
+
+#define NAT_TCP_FREE		0
+#define NAT_TCP_CONNECTING	1 //host connect() in progress, the guest's SYN isn't answered yet
+#define NAT_TCP_SYNACK		2 //SYN-ACK sent, waiting for the guest to acknowledge it
+#define NAT_TCP_ESTABLISHED	3
+
+typedef struct {
+	uint8_t state; //NAT_TCP_*
+	NAT_SOCKET sock;
+	uint32_t gip, hip; //guest address, and the address the guest connected to
+	uint16_t gport, hport;
+	uint32_t snd_una; //oldest sequence number the guest hasn't acknowledged
+	uint32_t snd_nxt; //next sequence number sent to the guest
+	uint32_t rcv_nxt; //next sequence number expected from the guest
+	uint16_t guestwin;
+	uint16_t mss;
+	uint8_t hostfin; //host closed its side, send a FIN once the buffer is out
+	uint8_t finsent;
+	uint8_t guestfin;
+	uint32_t lastsend; //ms
+	uint8_t sendbuf[NAT_TCP_BUFSIZE]; //host data starting at snd_una
+	uint32_t sendlen;
+} NAT_TCP_t;
+
+typedef struct {
+	uint8_t used;
+	NAT_SOCKET sock;
+	uint32_t gip;
+	uint16_t gport;
+	uint32_t lastused; //ms
+} NAT_UDP_t;
+
+typedef struct {
+	uint16_t len;
+	uint8_t data[NAT_MAXFRAME];
+} NAT_FRAME_t;
+
+extern char* nat_dns;
+
+int nat_init(NE2000_t* ne2000);
+void nat_txFrame(uint8_t* data, int len);
+void nat_poll(void* dummy);
+
+#endif //USE_NE2000
+
+#endif //_NAT_H_
@@ -11,11 +11,11 @@
 #include <string.h>
 #include <time.h>
 #include <stdint.h>
-#include "pcap-win32.h"
 #include "../../chipset/i8259.h"
 #include "../../ports.h"
 #include "../../timing.h"
 #include "../../debuglog.h"
+#include "../../metrics.h"
 #include "ne2000.h"
 
 #define NE2K_RESET_HARDWARE 0
@@ -36,9 +36,9 @@ static void ne2000_reset(NE2000_t* ne2000, int type)
 {
     int i;
 
-#ifdef DEBUG_NE2000
-    debug_log(DEBUG_DETAIL, "[NE2000] ne2000 reset\n");
-#endif
+    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+        debug_log(DEBUG_DETAIL, "[NE2000] ne2000 reset\n");
+    }
 
     // Initialise the mac address area by doubling the physical address
     ne2000->macaddr[0] = ne2000->physaddr[0];
@@ -208,9 +208,9 @@ uint16_t ne2000_asic_read_w(NE2000_t* ne2000, uint32_t offset)
         ne2000_dma_read(ne2000, 1);
     }
 
-#ifdef DEBUG_NE2000
-    debug_log(DEBUG_DETAIL, "[NE2000] asic read val=0x%04x\n", retval);
-#endif
+    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+        debug_log(DEBUG_DETAIL, "[NE2000] asic read val=0x%04x\n", retval);
+    }
 
     return retval;
 }
@@ -238,9 +238,9 @@ void ne2000_dma_write(NE2000_t* ne2000, int io_len)
 
 void ne2000_asic_write_w(NE2000_t* ne2000, uint32_t offset, uint16_t value)
 {
-#ifdef DEBUG_NE2000
-    debug_log(DEBUG_DETAIL, "[NE2000] asic write val=0x%04x\n", value);
-#endif
+    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+        debug_log(DEBUG_DETAIL, "[NE2000] asic write val=0x%04x\n", value);
+    }
 
     if (ne2000->remote_bytes == 0)
         return;
@@ -256,6 +256,100 @@ void ne2000_asic_write_w(NE2000_t* ne2000, uint32_t offset, uint16_t value)
     }
 }
 
+//
+// asic_read_block/asic_write_block - REP INSW/OUTSW (or INSB/OUTSB
+// in 8-bit mode) on the data port. Runs that stay inside packet
+// memory, don't cross the ring's wrap point and don't finish the
+// transfer are copied in one go, with the same effect on
+// remote_dma/remote_bytes as that many single accesses. Anything
+// else goes through asic_read_w/asic_write_w a word at a time.
+//
+static uint32_t ne2000_dma_run(NE2000_t* ne2000, uint32_t count, int width)
+{
+    uint32_t addr = ne2000->remote_dma;
+    uint32_t stop = (uint32_t)ne2000->page_stop << 8;
+    uint32_t end = NE2K_MEMEND;
+    uint32_t n;
+
+    if ((addr < NE2K_MEMSTART) || (ne2000->remote_bytes <= width)) {
+        return 0;
+    }
+    if ((addr < stop) && (stop < end)) {
+        end = stop;
+    }
+    if (addr >= end) {
+        return 0;
+    }
+    n = (end - addr) / width;
+    // stop one access short of the one that ends the transfer and raises the IRQ
+    if (n > (uint32_t)(ne2000->remote_bytes - 1) / width) {
+        n = (uint32_t)(ne2000->remote_bytes - 1) / width;
+    }
+    return (n > count) ? count : n;
+}
+
+static void ne2000_dma_advance(NE2000_t* ne2000, uint32_t bytes)
+{
+    ne2000->remote_dma += bytes;
+    if (ne2000->remote_dma == ne2000->page_stop << 8) {
+        ne2000->remote_dma = ne2000->page_start << 8;
+    }
+    ne2000->remote_bytes -= bytes;
+}
+
+uint32_t ne2000_asic_read_block(NE2000_t* ne2000, uint32_t offset, uint8_t* dst, uint32_t count, uint8_t size)
+{
+    int width = (ne2000->DCR.wdsize & 0x01) ? 2 : 1;
+    uint32_t done = 0, n;
+    uint16_t value;
+
+    if (size != width) {
+        return 0;
+    }
+    while (done < count) {
+        n = ne2000_dma_run(ne2000, count - done, width);
+        if (n > 0) {
+            memcpy(dst, &ne2000->mem[ne2000->remote_dma - NE2K_MEMSTART], n * width);
+            ne2000_dma_advance(ne2000, n * width);
+        }
+        else {
+            n = 1;
+            value = ne2000_asic_read_w(ne2000, offset);
+            dst[0] = (uint8_t)value;
+            if (width == 2) {
+                dst[1] = (uint8_t)(value >> 8);
+            }
+        }
+        dst += n * width;
+        done += n;
+    }
+    return done;
+}
+
+uint32_t ne2000_asic_write_block(NE2000_t* ne2000, uint32_t offset, const uint8_t* src, uint32_t count, uint8_t size)
+{
+    int width = (ne2000->DCR.wdsize & 0x01) ? 2 : 1;
+    uint32_t done = 0, n;
+
+    if (size != width) {
+        return 0;
+    }
+    while (done < count) {
+        n = ne2000_dma_run(ne2000, count - done, width);
+        if (n > 0) {
+            memcpy(&ne2000->mem[ne2000->remote_dma - NE2K_MEMSTART], src, n * width);
+            ne2000_dma_advance(ne2000, n * width);
+        }
+        else {
+            n = 1;
+            ne2000_asic_write_w(ne2000, offset, (width == 2) ? ((uint16_t)src[0] | ((uint16_t)src[1] << 8)) : src[0]);
+        }
+        src += n * width;
+        done += n;
+    }
+    return done;
+}
+
 uint8_t ne2000_asic_read_b(NE2000_t* ne2000, uint32_t offset)
 {
     if (offset & 1)
@@ -290,9 +384,9 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
 {
     int ret;
 
-#ifdef DEBUG_NE2000
-    debug_log(DEBUG_DETAIL, "[NE2000] read addr %x\n", address);
-#endif
+    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+        debug_log(DEBUG_DETAIL, "[NE2000] read addr %x\n", address);
+    }
 
     address &= 0xf;
 
@@ -303,16 +397,16 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
                 (ne2000->CR.tx_packet << 2) |
                 (ne2000->CR.start << 1) |
                 (ne2000->CR.stop));
-#ifdef DEBUG_NE2000
-        debug_log(DEBUG_DETAIL, "[NE2000] read CR returns 0x%08x\n", ret);
-#endif
+        if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+            debug_log(DEBUG_DETAIL, "[NE2000] read CR returns 0x%08x\n", ret);
+        }
     }
     else {
         switch (ne2000->CR.pgsel) {
         case 0x00:
-#ifdef DEBUG_NE2000
-            debug_log(DEBUG_DETAIL, "[NE2000] page 0 read from port %04x\n", address);
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                debug_log(DEBUG_DETAIL, "[NE2000] page 0 read from port %04x\n", address);
+            }
             switch (address) {
             case 0x1:  // CLDA0
                 return (ne2000->local_dma & 0xff);
@@ -342,9 +436,9 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
 
             case 0x6:  // FIFO
               // reading FIFO is only valid in loopback mode
-#ifdef DEBUG_NE2000
-                debug_log(DEBUG_DETAIL, "[NE2000] reading FIFO not supported yet\n");
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    debug_log(DEBUG_DETAIL, "[NE2000] reading FIFO not supported yet\n");
+                }
                 return (ne2000->fifo);
                 break;
 
@@ -368,16 +462,16 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
                 break;
 
             case 0xa:  // reserved
-#ifdef DEBUG_NE2000
-                debug_log(DEBUG_DETAIL, "[NE2000] reserved read - page 0, 0xa\n");
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    debug_log(DEBUG_DETAIL, "[NE2000] reserved read - page 0, 0xa\n");
+                }
                 return (0xff);
                 break;
 
             case 0xb:  // reserved
-#ifdef DEBUG_NE2000
-                debug_log(DEBUG_DETAIL, "[NE2000] reserved read - page 0, 0xb\n");
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    debug_log(DEBUG_DETAIL, "[NE2000] reserved read - page 0, 0xb\n");
+                }
                 return (0xff);
                 break;
 
@@ -409,9 +503,9 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
             break;
 
         case 0x01:
-#ifdef DEBUG_NE2000
-            debug_log(DEBUG_DETAIL, "[NE2000] page 1 read from port %04x\n", address);
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                debug_log(DEBUG_DETAIL, "[NE2000] page 1 read from port %04x\n", address);
+            }
             switch (address) {
             case 0x1:  // PAR0-5
             case 0x2:
@@ -423,9 +517,9 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
                 break;
 
             case 0x7:  // CURR
-#ifdef DEBUG_NE2000
-                debug_log(DEBUG_DETAIL, "[NE2000] returning current page: %02x\n", (ne2000->curr_page));
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    debug_log(DEBUG_DETAIL, "[NE2000] returning current page: %02x\n", (ne2000->curr_page));
+                }
                 return (ne2000->curr_page);
 
             case 0x8:  // MAR0-7
@@ -444,9 +538,9 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
             break;
 
         case 0x02:
-#ifdef DEBUG_NE2000
-            debug_log(DEBUG_DETAIL, "[NE2000] page 2 read from port %04x\n", address);
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                debug_log(DEBUG_DETAIL, "[NE2000] page 2 read from port %04x\n", address);
+            }
             switch (address) {
             case 0x1:  // PSTART
                 return (ne2000->page_start);
@@ -480,9 +574,9 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
             case 0x9:
             case 0xa:
             case 0xb:
-#ifdef DEBUG_NE2000
-                debug_log(DEBUG_DETAIL, "[NE2000] reserved read - page 2, 0x%02x\n", address);
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    debug_log(DEBUG_DETAIL, "[NE2000] reserved read - page 2, 0x%02x\n", address);
+                }
                 break;
 
             case 0xc:  // RCR
@@ -545,9 +639,9 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
             break;
 
         default:
-#ifdef DEBUG_NE2000
-            debug_log(DEBUG_DETAIL, "ne2000 unknown value of pgsel in read - %d\n", ne2000->CR.pgsel);
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                debug_log(DEBUG_DETAIL, "ne2000 unknown value of pgsel in read - %d\n", ne2000->CR.pgsel);
+            }
             break;
         }
     }
@@ -561,9 +655,9 @@ uint8_t ne2000_read(NE2000_t* ne2000, uint32_t address)
 //
 void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
 {
-#ifdef DEBUG_NE2000
-    debug_log(DEBUG_DETAIL, "[NE2000] write address %x, val=%x\n", address, value);
-#endif
+    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+        debug_log(DEBUG_DETAIL, "[NE2000] write address %x, val=%x\n", address, value);
+    }
     address &= 0xf;
 
     //
@@ -573,14 +667,14 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
     //  command register
     //
     if (address == 0x00) {
-#ifdef DEBUG_NE2000
-        debug_log(DEBUG_DETAIL, "[NE2000] wrote 0x%02x to CR\n", value);
-#endif
+        if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+            debug_log(DEBUG_DETAIL, "[NE2000] wrote 0x%02x to CR\n", value);
+        }
         // Validate remote-DMA
         if ((value & 0x38) == 0x00) {
-#ifdef DEBUG_NE2000
-            debug_log(DEBUG_DETAIL, "[NE2000] CR write - invalid rDMA value 0\n");
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                debug_log(DEBUG_DETAIL, "[NE2000] CR write - invalid rDMA value 0\n");
+            }
             value |= 0x20; /* dma_cmd == 4 is a safe default */
         }
 
@@ -611,18 +705,18 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
                 ne2000->bound_ptr * 256;
             ne2000->remote_bytes = *((uint16_t*)&
                 ne2000->mem[ne2000->bound_ptr * 256 + 2 - NE2K_MEMSTART]);
-#ifdef DEBUG_NE2000
-            debug_log(DEBUG_DETAIL, "[NE2000] Sending buffer #x%x length %d\n", ne2000->remote_start, ne2000->remote_bytes);
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                debug_log(DEBUG_DETAIL, "[NE2000] Sending buffer #x%x length %d\n", ne2000->remote_start, ne2000->remote_bytes);
+            }
         }
 
         // Check for start-tx
         if ((value & 0x04) && ne2000->TCR.loop_cntl) {
             // loopback mode
             if (ne2000->TCR.loop_cntl != 1) {
-#ifdef DEBUG_NE2000
-                debug_log(DEBUG_DETAIL, "[NE2000] Loop mode %d not supported.\n", ne2000->TCR.loop_cntl);
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    debug_log(DEBUG_DETAIL, "[NE2000] Loop mode %d not supported.\n", ne2000->TCR.loop_cntl);
+                }
             }
             else {
                 ne2000_rx_frame(ne2000, &ne2000->mem[ne2000->tx_page_start * 256 - NE2K_MEMSTART], ne2000->tx_bytes);
@@ -638,16 +732,19 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
         else if (value & 0x04) {
             double microsecs;
             // start-tx and no loopback
-#ifdef DEBUG_NE2000
-            if (ne2000->CR.stop || !ne2000->CR.start)
-                debug_log(DEBUG_DETAIL, "[NE2000] CR write - tx start, dev in reset\n");
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                if (ne2000->CR.stop || !ne2000->CR.start)
+                    debug_log(DEBUG_DETAIL, "[NE2000] CR write - tx start, dev in reset\n");
 
-            if (ne2000->tx_bytes == 0)
-                debug_log(DEBUG_DETAIL, "[NE2000] CR write - tx start, tx bytes == 0\n");
-#endif
+                if (ne2000->tx_bytes == 0)
+                    debug_log(DEBUG_DETAIL, "[NE2000] CR write - tx start, tx bytes == 0\n");
+            }
 
-            // Send the packet to the system driver
-            pcap_txPacket((u_char*)&ne2000->mem[ne2000->tx_page_start * 256 - NE2K_MEMSTART], (int)ne2000->tx_bytes);
+            // Send the packet to the backend, pcap or NAT
+            if (ne2000->txframe != NULL)
+                ne2000->txframe(&ne2000->mem[ne2000->tx_page_start * 256 - NE2K_MEMSTART], (int)ne2000->tx_bytes);
+            metrics.cpu.netTxPackets++;
+            metrics.cpu.netTxBytes += ne2000->tx_bytes;
 
             microsecs = (double)((64 + 96 + 4 * 8 + ne2000->tx_bytes * 8) / 10);
             microsecs *= ((double)timing_getFreq() / 1000000);
@@ -675,9 +772,9 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
     else {
         switch (ne2000->CR.pgsel) {
         case 0x00:
-#ifdef DEBUG_NE2000
-            debug_log(DEBUG_DETAIL, "[NE2000] page 0 write to port %04x\n", address);
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                debug_log(DEBUG_DETAIL, "[NE2000] page 0 write to port %04x\n", address);
+            }
             // It appears to be a common practice to use outw on page0 regs...
 
             switch (address) {
@@ -766,10 +863,10 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
 
             case 0xc:  // RCR
               // Check if the reserved bits are set
-#ifdef DEBUG_NE2000
-                if (value & 0xc0)
-                    debug_log(DEBUG_DETAIL, "[NE2000] RCR write, reserved bits set\n");
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    if (value & 0xc0)
+                        debug_log(DEBUG_DETAIL, "[NE2000] RCR write, reserved bits set\n");
+                }
                 // Set all other bit-fields
                 ne2000->RCR.errors_ok = ((value & 0x01) == 0x01);
                 ne2000->RCR.runts_ok = ((value & 0x02) == 0x02);
@@ -779,25 +876,25 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
                 ne2000->RCR.monitor = ((value & 0x20) == 0x20);
 
                 // Monitor bit is a little suspicious...
-#ifdef DEBUG_NE2000
-                if (value & 0x20)
-                    debug_log(DEBUG_DETAIL, "[NE2000] RCR write, monitor bit set!\n");
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    if (value & 0x20)
+                        debug_log(DEBUG_DETAIL, "[NE2000] RCR write, monitor bit set!\n");
+                }
                 break;
 
             case 0xd:  // TCR
               // Check reserved bits
-#ifdef DEBUG_NE2000
-                if (value & 0xe0)
-                    debug_log(DEBUG_DETAIL, "[NE2000] TCR write, reserved bits set\n");
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    if (value & 0xe0)
+                        debug_log(DEBUG_DETAIL, "[NE2000] TCR write, reserved bits set\n");
+                }
 
                 // Test loop mode (not supported)
                 if (value & 0x06) {
                     ne2000->TCR.loop_cntl = (value & 0x6) >> 1;
-#ifdef DEBUG_NE2000
-                    debug_log(DEBUG_DETAIL, "[NE2000] TCR write, loop mode %d not supported\n", ne2000->TCR.loop_cntl);
-#endif
+                    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                        debug_log(DEBUG_DETAIL, "[NE2000] TCR write, loop mode %d not supported\n", ne2000->TCR.loop_cntl);
+                    }
                 }
                 else {
                     ne2000->TCR.loop_cntl = 0;
@@ -806,35 +903,35 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
                 // Inhibit-CRC not supported.
                 if (value & 0x01)
                 {
-#ifdef DEBUG_NE2000
-                    debug_log(DEBUG_DETAIL, "[NE2000] ne2000 TCR write, inhibit-CRC not supported\n");
-#endif
+                    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                        debug_log(DEBUG_DETAIL, "[NE2000] ne2000 TCR write, inhibit-CRC not supported\n");
+                    }
                     return;
                 }
 
                 // Auto-transmit disable very suspicious
-#ifdef DEBUG_NE2000
-                if (value & 0x08) {
-                    debug_log(DEBUG_DETAIL, "[NE2000] ne2000 TCR write, auto transmit disable not supported\n");
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    if (value & 0x08) {
+                        debug_log(DEBUG_DETAIL, "[NE2000] ne2000 TCR write, auto transmit disable not supported\n");
+                    }
                 }
-#endif
                 // Allow collision-offset to be set, although not used
                 ne2000->TCR.coll_prio = ((value & 0x08) == 0x08);
                 break;
 
             case 0xe:  // DCR
               // the loopback mode is not suppported yet
-#ifdef DEBUG_NE2000
-                if (!(value & 0x08)) {
-                    debug_log(DEBUG_DETAIL, "[NE2000] DCR write, loopback mode selected\n");
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    if (!(value & 0x08)) {
+                        debug_log(DEBUG_DETAIL, "[NE2000] DCR write, loopback mode selected\n");
+                    }
+                    // It is questionable to set longaddr and auto_rx, since they
+                    // aren't supported on the ne2000. Print a warning and continue
+                    if (value & 0x04)
+                        debug_log(DEBUG_DETAIL, "[NE2000] DCR write - LAS set ???\n");
+                    if (value & 0x10)
+                        debug_log(DEBUG_DETAIL, "[NE2000] DCR write - AR set ???\n");
                 }
-                // It is questionable to set longaddr and auto_rx, since they
-                // aren't supported on the ne2000. Print a warning and continue
-                if (value & 0x04)
-                    debug_log(DEBUG_DETAIL, "[NE2000] DCR write - LAS set ???\n");
-                if (value & 0x10)
-                    debug_log(DEBUG_DETAIL, "[NE2000] DCR write - AR set ???\n");
-#endif
 
                 // Set other values.
                 ne2000->DCR.wdsize = ((value & 0x01) == 0x01);
@@ -846,11 +943,11 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
                 break;
 
             case 0xf:  // IMR
-#ifdef DEBUG_NE2000
-              // Check for reserved bit
-                if (value & 0x80)
-                    debug_log(DEBUG_DETAIL, "[NE2000] IMR write, reserved bit set\n");
-#endif
+              if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                  // Check for reserved bit
+                    if (value & 0x80)
+                        debug_log(DEBUG_DETAIL, "[NE2000] IMR write, reserved bit set\n");
+              }
                 // Set other values
                 ne2000->IMR.rx_inte = ((value & 0x01) == 0x01);
                 ne2000->IMR.tx_inte = ((value & 0x02) == 0x02);
@@ -860,9 +957,9 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
                 ne2000->IMR.cofl_inte = ((value & 0x20) == 0x20);
                 ne2000->IMR.rdma_inte = ((value & 0x40) == 0x40);
                 if (ne2000->ISR.pkt_tx && ne2000->IMR.tx_inte) {
-#ifdef DEBUG_NE2000
-                    debug_log(DEBUG_DETAIL, "[NE2000] tx irq retrigger\n");
-#endif
+                    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                        debug_log(DEBUG_DETAIL, "[NE2000] tx irq retrigger\n");
+                    }
                     i8259_doirq(ne2000->i8259, ne2000->base_irq);
                 }
                 break;
@@ -870,9 +967,9 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
             break;
 
         case 0x01:
-#ifdef DEBUG_NE2000
-            debug_log(DEBUG_DETAIL, "[NE2000] page 1 w offset %04x\n", address);
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                debug_log(DEBUG_DETAIL, "[NE2000] page 1 w offset %04x\n", address);
+            }
             switch (address) {
             case 0x1:  // PAR0-5
             case 0x2:
@@ -901,10 +998,10 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
             break;
 
         case 0x02:
-#ifdef DEBUG_NE2000
-            if (address != 0)
-                debug_log(DEBUG_DETAIL, "[NE2000] page 2 write ?\n");
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                if (address != 0)
+                    debug_log(DEBUG_DETAIL, "[NE2000] page 2 write ?\n");
+            }
             switch (address) {
             case 0x1:  // CLDA0
               // Clear out low byte and re-insert
@@ -925,9 +1022,9 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
             case 0x4:
                 //fatal("page 2 write to reserved offset 4\n");
                 //OS/2 Warp can cause this to freak out.
-#ifdef DEBUG_NE2000
-                debug_log(DEBUG_DETAIL, "[NE2000] ne2000 page 2 write to reserved offset 4\n");
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    debug_log(DEBUG_DETAIL, "[NE2000] ne2000 page 2 write to reserved offset 4\n");
+                }
                 break;
 
             case 0x5:  // Local Next-packet pointer
@@ -954,9 +1051,9 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
             case 0xd:
             case 0xe:
             case 0xf:
-#ifdef DEBUG_NE2000
-                debug_log(DEBUG_DETAIL, "[NE2000] ne2000 page 2 write to reserved offset %0x\n", address);
-#endif
+                if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                    debug_log(DEBUG_DETAIL, "[NE2000] ne2000 page 2 write to reserved offset %0x\n", address);
+                }
             default:
                 break;
             }
@@ -984,9 +1081,9 @@ void ne2000_write(NE2000_t* ne2000, uint32_t address, uint8_t value)
             break;
 
         default:
-#ifdef DEBUG_NE2000
-            debug_log(DEBUG_DETAIL, "[NE2000] ne2000 unknown value of pgsel in write - %d\n", ne2000->CR.pgsel);
-#endif
+            if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+                debug_log(DEBUG_DETAIL, "[NE2000] ne2000 unknown value of pgsel in write - %d\n", ne2000->CR.pgsel);
+            }
             break;
         }
     }
@@ -1018,6 +1115,37 @@ static int mcast_index(const void* dst)
 #undef POLYNOMIAL
 }
 
+/*
+ * rx_room() - nonzero if rx_frame() has somewhere to put a frame
+ * of io_len bytes, or would throw it away no matter when it came
+ * because the receiver is stopped. The platform code keeps frames
+ * queued while this is zero instead of losing them.
+ */
+int ne2000_rx_room(NE2000_t* ne2000, int io_len)
+{
+    int pages;
+    int avail;
+
+    if ((ne2000->CR.stop != 0) ||
+        (ne2000->page_start == 0)) {
+        return 1;
+    }
+
+    pages = (io_len + 4 + 4 + 255) / 256;
+    if (ne2000->curr_page < ne2000->bound_ptr) {
+        avail = ne2000->bound_ptr - ne2000->curr_page;
+    }
+    else {
+        avail = (ne2000->page_stop - ne2000->page_start) -
+            (ne2000->curr_page - ne2000->bound_ptr);
+    }
+#if NE2K_NEVER_FULL_RING
+    return avail > pages;
+#else
+    return avail >= pages;
+#endif
+}
+
 /*
  * rx_frame() - called by the platform-specific code when an
  * ethernet frame has been received. The destination address
@@ -1063,16 +1191,17 @@ void ne2000_rx_frame(NE2000_t* ne2000, const void* buf, int io_len)
         || (avail == pages)
 #endif
         ) {
-#ifdef DEBUG_NE2000
-        debug_log(DEBUG_DETAIL, "[NE2000] no space\n");
-#endif
+        if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+            debug_log(DEBUG_DETAIL, "[NE2000] no space\n");
+        }
+        metrics.cpu.netRxDropped++;
         return;
     }
 
     if ((io_len < 40/*60*/) && !ne2000->RCR.runts_ok) {
-#ifdef DEBUG_NE2000
-        debug_log(DEBUG_DETAIL, "[NE2000] rejected small packet, length %d\n", io_len);
-#endif
+        if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+            debug_log(DEBUG_DETAIL, "[NE2000] rejected small packet, length %d\n", io_len);
+        }
         return;
     }
     // some computers don't care...
@@ -1099,25 +1228,25 @@ void ne2000_rx_frame(NE2000_t* ne2000, const void* buf, int io_len)
         }
     }
     else {
-#ifdef DEBUG_NE2000
-        debug_log(DEBUG_DETAIL, "[NE2000] rx_frame promiscuous receive\n");
-#endif
+        if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+            debug_log(DEBUG_DETAIL, "[NE2000] rx_frame promiscuous receive\n");
+        }
     }
 
-#ifdef DEBUG_NE2000
-    debug_log(DEBUG_DETAIL, "[NE2000] rx_frame %d to %x:%x:%x:%x:%x:%x from %x:%x:%x:%x:%x:%x\n",
-        io_len,
-        pktbuf[0], pktbuf[1], pktbuf[2], pktbuf[3], pktbuf[4], pktbuf[5],
-        pktbuf[6], pktbuf[7], pktbuf[8], pktbuf[9], pktbuf[10], pktbuf[11]);
+    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+        debug_log(DEBUG_DETAIL, "[NE2000] rx_frame %d to %x:%x:%x:%x:%x:%x from %x:%x:%x:%x:%x:%x\n",
+            io_len,
+            pktbuf[0], pktbuf[1], pktbuf[2], pktbuf[3], pktbuf[4], pktbuf[5],
+            pktbuf[6], pktbuf[7], pktbuf[8], pktbuf[9], pktbuf[10], pktbuf[11]);
 
-    {
-        int i;
-        for (i = 0; i < io_len; i++) {
-            debug_log(DEBUG_DETAIL, "[NE2000] %02X ", pktbuf[i]);
+        {
+            int i;
+            for (i = 0; i < io_len; i++) {
+                debug_log(DEBUG_DETAIL, "[NE2000] %02X ", pktbuf[i]);
+            }
+            debug_log(DEBUG_DETAIL, "[NE2000] \n");
         }
-        debug_log(DEBUG_DETAIL, "[NE2000] \n");
     }
-#endif
 
     nextpage = ne2000->curr_page + pages;
     if (nextpage >= ne2000->page_stop) {
@@ -1154,6 +1283,8 @@ void ne2000_rx_frame(NE2000_t* ne2000, const void* buf, int io_len)
         ne2000->curr_page = nextpage;
     }
 
+    metrics.cpu.netRxPackets++;
+    metrics.cpu.netRxBytes += io_len;
     ne2000->RSR.rx_ok = 1;
     if (pktbuf[0] & 0x80) {
         ne2000->RSR.rx_mbit = 1;
@@ -1162,9 +1293,9 @@ void ne2000_rx_frame(NE2000_t* ne2000, const void* buf, int io_len)
     ne2000->ISR.pkt_rx = 1;
 
     if (ne2000->IMR.rx_inte) {
-#ifdef DEBUG_NE2000
-        debug_log(DEBUG_DETAIL, "[NE2000] packet rx interrupt\n");
-#endif
+        if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+            debug_log(DEBUG_DETAIL, "[NE2000] packet rx interrupt\n");
+        }
         i8259_doirq(ne2000->i8259, ne2000->base_irq);
     }
 
@@ -1174,15 +1305,15 @@ void NE2000_tx_timer(NE2000_t* ne2000)
 {
     timing_timerDisable(ne2000->tx_timer);
 
-#ifdef DEBUG_NE2000
-    debug_log(DEBUG_DETAIL, "[NE2000] tx_timer\n");
-#endif
+    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+        debug_log(DEBUG_DETAIL, "[NE2000] tx_timer\n");
+    }
     ne2000->TSR.tx_ok = 1;
     // Generate an interrupt if not masked and not one in progress
     if (ne2000->IMR.tx_inte && !ne2000->ISR.pkt_tx) {
-#ifdef DEBUG_NE2000
-        debug_log(DEBUG_DETAIL, "[NE2000] tx complete interrupt\n");
-#endif
+        if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+            debug_log(DEBUG_DETAIL, "[NE2000] tx complete interrupt\n");
+        }
         i8259_doirq(ne2000->i8259, ne2000->base_irq);
     }
     ne2000->ISR.pkt_tx = 1;
@@ -1196,20 +1327,22 @@ void NE2000_tx_event(NE2000_t* ne2000, uint64_t interval)
 }
 
 void ne2000_init(NE2000_t* ne2000, I8259_t* i8259, uint32_t baseport, uint8_t irq, uint8_t* macaddr) {
-#ifdef DEBUG_NE2000
-    debug_log(DEBUG_INFO, "[NE2000] Initializing NE2000 Ethernet adapter at 0x%03X, IRQ %u\r\n", baseport, irq);
-#endif
+    if (DEBUG_ON(DEBUG_SUB_NE2000)) {
+        debug_log(DEBUG_INFO, "[NE2000] Initializing NE2000 Ethernet adapter at 0x%03X, IRQ %u\r\n", baseport, irq);
+    }
     ne2000->i8259 = i8259;
+    ne2000->txframe = NULL;
 
     ports_cbRegister(baseport, 0x10, ne2000_read, NULL, ne2000_write, NULL, ne2000);
     ports_cbRegister(baseport + 0x10, 0x10, ne2000_asic_read_b, ne2000_asic_read_w, ne2000_asic_write_b, ne2000_asic_write_w, ne2000);
     ports_cbRegister(baseport + 0x1F, 0x01, ne2000_reset_read, NULL, ne2000_reset_write, NULL, ne2000);
+    ports_cbRegisterBlock(baseport + 0x10, 0x01, (void*)ne2000_asic_read_block, (void*)ne2000_asic_write_block);
 
     ne2000_setirq(ne2000, irq);
     memcpy(ne2000->physaddr, macaddr, 6);
     ne2000_reset(ne2000, NE2K_RESET_HARDWARE);
     
-    ne2000->tx_timer = timing_addTimer(NE2000_tx_timer, ne2000, 1000, TIMING_DISABLED);
+    ne2000->tx_timer = timing_addGuestTimer(NE2000_tx_timer, ne2000, 1000, TIMING_DISABLED);
 }
 
 #endif
@@ -166,10 +166,12 @@ typedef struct
     //XTulator stuff
     I8259_t* i8259;
     uint32_t tx_timer;
+    void (*txframe)(uint8_t* data, int len); //set by the backend taking transmitted frames, pcap or NAT
 
 } NE2000_t;
 
 void ne2000_init(NE2000_t* ne2000, I8259_t* i8259, uint32_t baseport, uint8_t irq, uint8_t* macaddr);
+int ne2000_rx_room(NE2000_t* ne2000, int io_len);
 void ne2000_rx_frame(NE2000_t* ne2000, const void* buf, int io_len);
 void NE2000_tx_event(NE2000_t* ne2000, uint64_t interval);
 void NE2000_tx_timer(NE2000_t* ne2000);
@@ -35,15 +35,44 @@
 pthread_t pcap_dispatchThreadID;
 #endif
 #include <pcap.h>
+#include <SDL.h>
 #include "../../debuglog.h"
 #include "../../utility.h"
+#include "../../replay.h"
 #include "ne2000.h"
 #include "pcap-win32.h"
+#include "../../hostthread.h"
 
 pcap_t* pcap_adhandle;
 
 NE2000_t* pcap_ne2000 = NULL;
 
+/*
+	The pcap thread never touches the NE2000 itself. Received frames are
+	copied into a ring of preallocated slots, with the pcap thread as the only
+	producer and the emulation thread as the only consumer, the same lock-free
+	scheme as the audio ring. pcap_rxPoll hands them to the card between CPU
+	slices, and holds them back while the card's receive ring is full rather
+	than have the card drop them.
+
+	Transmits go the other way through a second ring. pcap_txPacket queues
+	the frame and wakes the sender thread, which sends everything queued by
+	the time it gets to run, so the emulation thread never waits on the host's
+	network stack.
+*/
+typedef struct {
+	uint16_t len;
+	uint8_t data[PCAP_MAXFRAME];
+} PCAP_FRAME_t;
+
+static PCAP_FRAME_t pcap_rxring[PCAP_RXSLOTS], pcap_txring[PCAP_TXSLOTS];
+static SDL_atomic_t pcap_rxhead, pcap_rxtail, pcap_txhead, pcap_txtail;
+static SDL_mutex* pcap_txlock = NULL;
+static SDL_cond* pcap_txwake = NULL;
+#ifndef _WIN32
+pthread_t pcap_senderThreadID;
+#endif
+
 void pcap_listdevs() {
 	pcap_if_t* alldevs;
 	pcap_if_t* d;
@@ -112,20 +141,33 @@ int pcap_init(NE2000_t* ne2000, int dev) {
 
 	pcap_freealldevs(alldevs);
 
-	pcap_ne2000 = ne2000;
-
+	SDL_AtomicSet(&pcap_rxhead, 0);
+	SDL_AtomicSet(&pcap_rxtail, 0);
+	SDL_AtomicSet(&pcap_txhead, 0);
+	SDL_AtomicSet(&pcap_txtail, 0);
+	pcap_txlock = SDL_CreateMutex();
+	pcap_txwake = SDL_CreateCond();
+	if ((pcap_txlock == NULL) || (pcap_txwake == NULL)) {
+		debug_log(DEBUG_ERROR, "[PCAP-WIN32] Unable to create the transmit queue\r\n");
+		return -1;
+	}
 
+	pcap_ne2000 = ne2000;
+	ne2000->txframe = (void*)pcap_txPacket;
 
 #ifdef _WIN32
 	_beginthread((void*)pcap_dispatchThread, 0, NULL);
+	_beginthread(pcap_senderThread, 0, NULL);
 #else
 	pthread_create(&pcap_dispatchThreadID, NULL, pcap_dispatchThread, NULL);
+	pthread_create(&pcap_senderThreadID, NULL, pcap_senderThread, NULL);
 #endif
 
 	return 0;
 }
 
 void pcap_dispatchThread() {
+	hostthread_apply(HOSTTHREAD_NET);
 	pcap_loop(pcap_adhandle, 0, pcap_rx_handler, NULL);
 	/*while (running) {
 		pcap_dispatch(pcap_adhandle, 1, pcap_rx_handler, NULL);
@@ -135,14 +177,97 @@ void pcap_dispatchThread() {
 	}*/
 }
 
+//On the pcap thread
 void pcap_rx_handler(u_char* param, const struct pcap_pkthdr* header, const u_char* pkt_data) {
+	PCAP_FRAME_t* slot;
+	uint32_t head;
 	(void)(param); //unused variable
 
-	ne2000_rx_frame(pcap_ne2000, (void*)pkt_data, header->caplen);
+	head = (uint32_t)SDL_AtomicGet(&pcap_rxhead);
+	if ((header->caplen > PCAP_MAXFRAME) || ((head - (uint32_t)SDL_AtomicGet(&pcap_rxtail)) >= PCAP_RXSLOTS)) {
+		debug_log(DEBUG_DETAIL, "[PCAP-WIN32] Receive queue full or frame too big, dropped a %lu byte frame\r\n", (unsigned long)header->caplen);
+		return;
+	}
+	slot = &pcap_rxring[head & (PCAP_RXSLOTS - 1)];
+	memcpy(slot->data, pkt_data, header->caplen);
+	slot->len = (uint16_t)header->caplen;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&pcap_rxhead, (int)(head + 1));
 }
 
+//On the emulation thread, between CPU slices
+void pcap_rxPoll() {
+	PCAP_FRAME_t* slot;
+	uint32_t head, tail;
+
+	tail = (uint32_t)SDL_AtomicGet(&pcap_rxtail);
+	head = (uint32_t)SDL_AtomicGet(&pcap_rxhead);
+	if (head == tail) return;
+	SDL_MemoryBarrierAcquire();
+	while (tail != head) {
+		slot = &pcap_rxring[tail & (PCAP_RXSLOTS - 1)];
+		if (!ne2000_rx_room(pcap_ne2000, slot->len)) {
+			break; //leave the rest queued until the guest empties the card's ring
+		}
+		if (replay_input(REPLAY_NET, pcap_ne2000, slot->data, slot->len)) {
+			ne2000_rx_frame(pcap_ne2000, slot->data, slot->len);
+		}
+		tail++;
+	}
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&pcap_rxtail, (int)tail);
+}
+
+#ifdef _WIN32
+void pcap_senderThread(void* dummy) {
+#else
+void* pcap_senderThread(void* dummy) {
+#endif
+	PCAP_FRAME_t* slot;
+	uint32_t head, tail;
+
+	hostthread_apply(HOSTTHREAD_NET);
+
+	while (1) {
+		SDL_LockMutex(pcap_txlock);
+		while ((head = (uint32_t)SDL_AtomicGet(&pcap_txhead)) == (tail = (uint32_t)SDL_AtomicGet(&pcap_txtail))) {
+			SDL_CondWait(pcap_txwake, pcap_txlock);
+		}
+		SDL_UnlockMutex(pcap_txlock);
+
+		SDL_MemoryBarrierAcquire();
+		while (tail != head) {
+			slot = &pcap_txring[tail & (PCAP_TXSLOTS - 1)];
+			pcap_sendpacket(pcap_adhandle, slot->data, slot->len);
+			tail++;
+		}
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&pcap_txtail, (int)tail);
+	}
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+//On the emulation thread, the frame is copied so the card's buffer can be reused right away
 void pcap_txPacket(u_char* data, int len) {
-	pcap_sendpacket(pcap_adhandle, data, len);
+	PCAP_FRAME_t* slot;
+	uint32_t head;
+
+	head = (uint32_t)SDL_AtomicGet(&pcap_txhead);
+	if ((len <= 0) || (len > PCAP_MAXFRAME) || ((head - (uint32_t)SDL_AtomicGet(&pcap_txtail)) >= PCAP_TXSLOTS)) {
+		debug_log(DEBUG_DETAIL, "[PCAP-WIN32] Transmit queue full or frame too big, dropped a %d byte frame\r\n", len);
+		return;
+	}
+	slot = &pcap_txring[head & (PCAP_TXSLOTS - 1)];
+	memcpy(slot->data, data, len);
+	slot->len = (uint16_t)len;
+	SDL_MemoryBarrierRelease();
+
+	SDL_LockMutex(pcap_txlock);
+	SDL_AtomicSet(&pcap_txhead, (int)(head + 1));
+	SDL_CondSignal(pcap_txwake);
+	SDL_UnlockMutex(pcap_txlock);
 }
 
 #endif
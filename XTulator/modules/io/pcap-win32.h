@@ -9,11 +9,23 @@
 #include <pcap.h>
 #include "ne2000.h"
 
+#define PCAP_RXSLOTS		64 //received frames queued for the emulation thread, power of two
+#define PCAP_TXSLOTS		32 //frames queued for the sender thread, power of two
+#define PCAP_MAXFRAME		1536 //largest frame either queue takes, bigger ones can't be an Ethernet frame the NE2000 would handle
+
+extern NE2000_t* pcap_ne2000;
+
 void pcap_rx_handler(u_char* param, const struct pcap_pkthdr* header, const u_char* pkt_data);
 void pcap_listdevs();
 int pcap_init(NE2000_t* ne2000, int dev);
 void pcap_dispatchThread();
 void pcap_txPacket(u_char* data, int len);
+void pcap_rxPoll();
+#ifdef _WIN32
+void pcap_senderThread(void* dummy);
+#else
+void* pcap_senderThread(void* dummy);
+#endif
 
 #endif //USE_NE2000
 
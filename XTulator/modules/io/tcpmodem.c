@@ -20,76 +20,179 @@
 /*
 	Emulates a modem over TCP connections.
 
+	The sockets are all nonblocking and serviced by one reactor thread shared
+	by every modem, which sits in poll() and queues received bytes in a ring
+	per modem. The emulation thread hands them to the UART at the baud rate
+	from a timer that is only enabled while there is something to deliver,
+	and it does everything else itself: accepting callers, hanging up, AT
+	commands and sending. The reactor raises tcpmodem_events when it has
+	news, which the main loop passes to tcpmodem_service().
+
 	This code is hilariously ugly. Fix that.
 */
 
 #include "../../config.h"
 #ifdef ENABLE_TCP_MODEM
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <SDL.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <arpa/inet.h>
+pthread_t tcpmodem_reactorThreadID;
+#endif
 #include "../../debuglog.h"
+#include "../../utility.h"
 #include "../../chipset/uart.h"
 #include "../../chipset/i8259.h"
 #include "../../timing.h"
+#include "../../replay.h"
 #include "tcpmodem.h"
+#include "../../hostthread.h"
+
+#ifdef _WIN32
+#define TCPMODEM_POLLFD			WSAPOLLFD
+#define tcpmodem_poll(f, n, ms)	WSAPoll(f, n, ms)
+#define tcpmodem_wouldBlock()	(WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#define TCPMODEM_POLLFD			struct pollfd
+#define tcpmodem_poll(f, n, ms)	poll(f, n, ms)
+#define tcpmodem_wouldBlock()	((errno == EAGAIN) || (errno == EWOULDBLOCK))
+#define closesocket				close
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define TCPMODEM_SENDFLAGS		MSG_NOSIGNAL
+#else
+#define TCPMODEM_SENDFLAGS		0
+#endif
+
+TCPMODEM_t* tcpmodem_list[TCPMODEM_MAX];
+int tcpmodem_count = 0;
+SDL_mutex* tcpmodem_lock = NULL; //held by the emulation thread while it changes sockets, and by the reactor while it uses them
+SDL_atomic_t tcpmodem_events;
+
+static void tcpmodem_setNonblocking(TCPMODEM_SOCKET sock) {
+#ifdef _WIN32
+	unsigned long iMode = 1;
+	ioctlsocket(sock, FIONBIO, &iMode);
+#else
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+static void tcpmodem_close(TCPMODEM_SOCKET* sock) {
+	if (*sock != TCPMODEM_NOSOCKET) {
+		closesocket(*sock);
+		*sock = TCPMODEM_NOSOCKET;
+	}
+}
+
+//Drops whatever the reactor queued from an earlier connection
+static void tcpmodem_flushRing(TCPMODEM_t* tcpmodem) {
+	SDL_AtomicSet(&tcpmodem->rxtail, SDL_AtomicGet(&tcpmodem->rxhead));
+	SDL_AtomicSet(&tcpmodem->hangup, 0);
+}
+
+//Paces the delivery timer so each tick hands the UART one FIFO trigger's worth of bytes at the baud rate
+static void tcpmodem_pace(TCPMODEM_t* tcpmodem) {
+	int batch = uart_rxbatch(tcpmodem->uart);
+
+	if (batch == tcpmodem->rxbatch) return;
+	tcpmodem->rxbatch = (uint8_t)batch;
+	timing_updateIntervalFreq(tcpmodem->rxtimer, (double)baudrate / 9.0 / (double)batch);
+}
+
+//Starts the delivery timer if there is anything for the UART
+static void tcpmodem_kick(TCPMODEM_t* tcpmodem) {
+	if (tcpmodem->rxactive) return;
+	if ((tcpmodem->rxbuf[tcpmodem->rxpos] != 0) ||
+		(tcpmodem->livesocket && !tcpmodem->escaped && (SDL_AtomicGet(&tcpmodem->rxhead) != SDL_AtomicGet(&tcpmodem->rxtail)))) {
+		tcpmodem->rxactive = 1;
+		tcpmodem_pace(tcpmodem);
+		timing_timerEnable(tcpmodem->rxtimer);
+	}
+}
 
 int tcpmodem_listen(TCPMODEM_t* tcpmodem, uint16_t port) {
 	int ret;
 	struct addrinfo hints, *result = NULL;
-	unsigned long iMode = 1;
 	char portstr[16];
+#ifndef _WIN32
+	int reuse = 1;
+#endif
 
-	ZeroMemory(&hints, sizeof(hints));
+	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_INET;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_protocol = IPPROTO_TCP;
 	hints.ai_flags = AI_PASSIVE;
-	hints.ai_addr = INADDR_ANY;
 
 	sprintf(portstr, "%u", port);
 
-	closesocket(tcpmodem->serversocket);
+	SDL_LockMutex(tcpmodem_lock);
+	tcpmodem->generation++;
+	tcpmodem_close(&tcpmodem->serversocket);
+	SDL_UnlockMutex(tcpmodem_lock);
 
 	ret = getaddrinfo(NULL, portstr, &hints, &result);
 	if (ret != 0) {
-#ifdef DEBUG_TCPMODEM
-		debug_log(DEBUG_ERROR, "[TCPMODEM] getaddrinfo error: %d\r\n", ret);
-#endif
+		if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+			debug_log(DEBUG_ERROR, "[TCPMODEM] getaddrinfo error: %d\r\n", ret);
+		}
 		return -1;
 	}
 
+	SDL_LockMutex(tcpmodem_lock);
 	tcpmodem->serversocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-	if (tcpmodem->serversocket == INVALID_SOCKET) {
-#ifdef DEBUG_TCPMODEM
-		debug_log(DEBUG_ERROR, "[TCPMODEM] Could not create socket to listen on: error %d\r\n", WSAGetLastError());
-#endif
+	if (tcpmodem->serversocket == TCPMODEM_NOSOCKET) {
+		SDL_UnlockMutex(tcpmodem_lock);
+		freeaddrinfo(result);
+		if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+			debug_log(DEBUG_ERROR, "[TCPMODEM] Could not create socket to listen on\r\n");
+		}
 		return -1;
 	}
-	ioctlsocket(tcpmodem->serversocket, FIONBIO, &iMode);
-
-	ret = bind(tcpmodem->serversocket, result->ai_addr, result->ai_addrlen);
-	if (ret == SOCKET_ERROR) {
-#ifdef DEBUG_TCPMODEM
-		debug_log(DEBUG_ERROR, "[TCPMODEM] bind error %d\r\n", WSAGetLastError());
+	tcpmodem_setNonblocking(tcpmodem->serversocket);
+#ifndef _WIN32
+	setsockopt(tcpmodem->serversocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
 #endif
-		closesocket(tcpmodem->socket);
+
+	ret = bind(tcpmodem->serversocket, result->ai_addr, (int)result->ai_addrlen);
+	freeaddrinfo(result);
+	if (ret != 0) {
+		if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+			debug_log(DEBUG_ERROR, "[TCPMODEM] bind error\r\n");
+		}
+		tcpmodem_close(&tcpmodem->serversocket);
+		SDL_UnlockMutex(tcpmodem_lock);
 		return -1;
 	}
 
 	ret = listen(tcpmodem->serversocket, 1);
-	if (ret == SOCKET_ERROR) {
-#ifdef DEBUG_TCPMODEM
-		debug_log(DEBUG_ERROR, "[TCPMODEM] listen error\r\n");
-#endif
-		closesocket(tcpmodem->serversocket);
+	if (ret != 0) {
+		if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+			debug_log(DEBUG_ERROR, "[TCPMODEM] listen error\r\n");
+		}
+		tcpmodem_close(&tcpmodem->serversocket);
+		SDL_UnlockMutex(tcpmodem_lock);
 		return -1;
 	}
 
-#ifdef DEBUG_TCPMODEM
-	debug_log(DEBUG_INFO, "[TCPMODEM] Listening for connections on port %u\r\n", port);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+		debug_log(DEBUG_INFO, "[TCPMODEM] Listening for connections on port %u\r\n", port);
+	}
 	tcpmodem->listening = 1;
+	SDL_AtomicSet(&tcpmodem->caller, 0);
+	SDL_UnlockMutex(tcpmodem_lock);
 
 	return 0;
 }
@@ -102,52 +205,58 @@ void tcpmodem_msrirq(TCPMODEM_t* tcpmodem) {
 
 int tcpmodem_connect(TCPMODEM_t* tcpmodem, char* host, uint16_t port) {
 	int ret;
-	unsigned long iMode = 1;
-	HOSTENT* hostent;
+	struct hostent* hostent;
+	TCPMODEM_SOCKET sock;
 
 	tcpmodem->rxpos = 0;
 
-	tcpmodem->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (tcpmodem->socket == INVALID_SOCKET) {
-		WSACleanup();
-#ifdef DEBUG_TCPMODEM
-		debug_log(DEBUG_ERROR, "[TCPMODEM] Unable to prepare a socket\r\n");
-#endif
+	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (sock == TCPMODEM_NOSOCKET) {
+		if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+			debug_log(DEBUG_ERROR, "[TCPMODEM] Unable to prepare a socket\r\n");
+		}
 		return -1;
 	}
 
 	hostent = gethostbyname(host);
 	if (hostent == NULL) {
-#ifdef DEBUG_TCPMODEM
-		debug_log(DEBUG_ERROR, "[TCPMODEM] Error returned from gethostbyname(\"%s\")\r\n", host);
-#endif
+		if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+			debug_log(DEBUG_ERROR, "[TCPMODEM] Error returned from gethostbyname(\"%s\")\r\n", host);
+		}
+		closesocket(sock);
 		sprintf(tcpmodem->rxbuf, "\nNO CARRIER\r\n");
 		return -1;
 	}
 
+	memset(&tcpmodem->server, 0, sizeof(tcpmodem->server));
 	tcpmodem->server.sin_family = AF_INET;
 	tcpmodem->server.sin_port = htons(port);
 	tcpmodem->server.sin_addr.s_addr = *(uint32_t*)hostent->h_addr_list[0]; //inet_addr(host);
 	//printf("%08X\r\n", tcpmodem->server.sin_addr.s_addr);
 
-	ret = connect(tcpmodem->socket, (SOCKADDR*)&tcpmodem->server, sizeof(tcpmodem->server));
-	if (ret == SOCKET_ERROR) {
-#ifdef DEBUG_TCPMODEM
-		debug_log(DEBUG_ERROR, "[TCPMODEM] No connect\r\n");
-#endif
-		closesocket(tcpmodem->socket);
+	ret = connect(sock, (struct sockaddr*)&tcpmodem->server, sizeof(tcpmodem->server));
+	if (ret != 0) {
+		if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+			debug_log(DEBUG_ERROR, "[TCPMODEM] No connect\r\n");
+		}
+		closesocket(sock);
 		sprintf(tcpmodem->rxbuf, "\nNO CARRIER\r\n");
 		return -1;
 	}
 
-	iMode = 1;
-	ioctlsocket(tcpmodem->socket, FIONBIO, &iMode);
+	tcpmodem_setNonblocking(sock);
 
 	sprintf(tcpmodem->rxbuf, "\nCONNECT\r\n");
+	SDL_LockMutex(tcpmodem_lock);
+	tcpmodem->generation++;
+	tcpmodem_close(&tcpmodem->socket);
+	tcpmodem->socket = sock;
+	tcpmodem_flushRing(tcpmodem);
 	tcpmodem->livesocket = 1;
 	tcpmodem->escaped = 0;
 	tcpmodem->listening = 0;
-	closesocket(tcpmodem->serversocket);
+	tcpmodem_close(&tcpmodem->serversocket);
+	SDL_UnlockMutex(tcpmodem_lock);
 	tcpmodem->uart->msr |= 0x80; //data carrier detect
 	tcpmodem->uart->msr &= 0xF7; //delta data carrier detect
 	tcpmodem_msrirq(tcpmodem);
@@ -167,21 +276,26 @@ void tcpmodem_setringmsr(TCPMODEM_t* tcpmodem, uint8_t state) {
 }
 
 void tcpmodem_offline(TCPMODEM_t* tcpmodem) {
-	closesocket(tcpmodem->socket);
+	SDL_LockMutex(tcpmodem_lock);
+	tcpmodem->generation++;
+	tcpmodem_close(&tcpmodem->socket);
+	tcpmodem_flushRing(tcpmodem);
 	tcpmodem->livesocket = 0;
+	tcpmodem->listening = 0;
+	SDL_UnlockMutex(tcpmodem_lock);
 	tcpmodem->escaped = 1;
 	sprintf(tcpmodem->rxbuf, "\nNO CARRIER\r\n");
 	tcpmodem->rxpos = 0;
-	tcpmodem->listening = 0;
 	tcpmodem->ringing = 0;
 	tcpmodem->uart->msr &= 0x7F; //data carrier detect
 	tcpmodem->uart->msr |= 0x08; //delta data carrier detect
 	tcpmodem_msrirq(tcpmodem);
 	tcpmodem_listen(tcpmodem, tcpmodem->listenport);
+	tcpmodem_kick(tcpmodem);
 }
 
 void tcpmodem_parseAT(TCPMODEM_t* tcpmodem) {
-	uint16_t i = 0, port = 23, hostpos = 0, gethost = 0, isdial = 0;
+	uint16_t i = 0, port = 23, hostpos = 0, isdial = 0;
 	char host[1024];
 	if ((tcpmodem->txbuf[0] != 'A') || (tcpmodem->txbuf[1] != 'T')) return;
 	if (tcpmodem->txbuf[2] == 'D') {
@@ -238,9 +352,9 @@ void tcpmodem_parseAT(TCPMODEM_t* tcpmodem) {
 			host[hostpos++] = cc;
 		}
 		host[hostpos++] = 0;
-#ifdef DEBUG_TCPMODEM
-		debug_log(DEBUG_DETAIL, "[TCPMODEM] Connect to %s (port %u)\r\n", host, port);
-#endif
+		if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+			debug_log(DEBUG_DETAIL, "[TCPMODEM] Connect to %s (port %u)\r\n", host, port);
+		}
 		tcpmodem_connect(tcpmodem, host, port);
 	} else {
 		sprintf(tcpmodem->rxbuf, "\nOK\r\n");
@@ -248,64 +362,103 @@ void tcpmodem_parseAT(TCPMODEM_t* tcpmodem) {
 	}
 }
 
-void tcpmodem_rxpoll(TCPMODEM_t* tcpmodem) {
-	char cc;
-	int ret;
-
-	if (tcpmodem->uart->rxnew) return;
+//Accepts a caller the reactor saw waiting, and starts ringing
+static void tcpmodem_accept(TCPMODEM_t* tcpmodem) {
+	TCPMODEM_SOCKET sock;
 
-	if (tcpmodem->livesocket && !(tcpmodem->uart->mcr & 1)) { //software hung up via DTR toggle
-		tcpmodem_offline(tcpmodem);
+	if (!tcpmodem->listening) return;
+	sock = accept(tcpmodem->serversocket, NULL, NULL);
+	if (sock == TCPMODEM_NOSOCKET) {
+		if (!tcpmodem_wouldBlock()) {
+			if (DEBUG_ON(DEBUG_SUB_TCPMODEM)) {
+				debug_log(DEBUG_DETAIL, "[TCPMODEM] Accept error\r\n");
+			}
+			tcpmodem_listen(tcpmodem, tcpmodem->listenport);
+		}
+		else {
+			SDL_AtomicSet(&tcpmodem->caller, 0);
+		}
+		return;
 	}
 
-	if (tcpmodem->livesocket && !tcpmodem->escaped && (tcpmodem->rxbuf[tcpmodem->rxpos] == 0)) {
-		ret = recv(tcpmodem->socket, &cc, 1, 0);
-		//printf("%d\r\n", ret);
-		if (ret > 0) {
-			uart_rxdata(tcpmodem->uart, (uint8_t)cc);
-			//printf("%c", cc);
-		} else if (ret == SOCKET_ERROR) {
-			switch (WSAGetLastError()) {
-				//case 10035:
-			case WSAENETDOWN:
-			case WSAENETUNREACH:
-			case WSAENETRESET:
-			case WSAECONNABORTED:
-			case WSAECONNRESET:
-			case WSAENOTCONN:
-			case WSAEHOSTUNREACH:
-				tcpmodem_offline(tcpmodem);
-				break;
-			}
+	tcpmodem_setNonblocking(sock);
+	SDL_LockMutex(tcpmodem_lock);
+	tcpmodem->generation++;
+	tcpmodem_close(&tcpmodem->socket);
+	tcpmodem->socket = sock;
+	tcpmodem_flushRing(tcpmodem);
+	tcpmodem_close(&tcpmodem->serversocket);
+	tcpmodem->livesocket = 1;
+	tcpmodem->listening = 0;
+	SDL_UnlockMutex(tcpmodem_lock);
+	tcpmodem->escaped = 1;
+	tcpmodem->ringing = 1;
+	tcpmodem->ringstate = 0;
+	timing_timerEnable(tcpmodem->ringtimer);
+}
+
+//From the main loop when the reactor has raised tcpmodem_events
+void tcpmodem_service() {
+	int i;
+
+	SDL_AtomicSet(&tcpmodem_events, 0);
+	for (i = 0; i < tcpmodem_count; i++) {
+		TCPMODEM_t* tcpmodem = tcpmodem_list[i];
+		if (SDL_AtomicGet(&tcpmodem->hangup)) {
+			SDL_AtomicSet(&tcpmodem->hangup, 0);
+			if (tcpmodem->livesocket) tcpmodem_offline(tcpmodem);
 		}
-	} else { //no live socket connection
-		cc = tcpmodem->rxbuf[tcpmodem->rxpos];
-		if (cc != 0) {
-			uart_rxdata(tcpmodem->uart, (uint8_t)cc);
-			tcpmodem->rxpos++;
-		} else {
-			memset(tcpmodem->rxbuf, 0, 1024);
-			tcpmodem->rxpos = 0;
+		if (SDL_AtomicGet(&tcpmodem->caller)) {
+			SDL_AtomicSet(&tcpmodem->caller, 0);
+			tcpmodem_accept(tcpmodem);
 		}
+		tcpmodem_kick(tcpmodem);
+	}
+}
 
-		if (tcpmodem->listening) {
-			closesocket(tcpmodem->socket);
-			tcpmodem->socket = accept(tcpmodem->serversocket, NULL, NULL);
-			if ((tcpmodem->socket == INVALID_SOCKET) && (WSAGetLastError() != WSAEWOULDBLOCK)) {
-#ifdef DEBUG_TCPMODEM
-				debug_log(DEBUG_DETAIL, "[TCPMODEM] Accept error: %d\r\n", WSAGetLastError());
-#endif
-				tcpmodem_listen(tcpmodem, tcpmodem->listenport);
-			} else if (tcpmodem->socket != INVALID_SOCKET) {
-				closesocket(tcpmodem->serversocket);
-				tcpmodem->livesocket = 1;
-				tcpmodem->escaped = 1;
-				tcpmodem->listening = 0;
-				tcpmodem->ringing = 1;
-				tcpmodem->ringstate = 0;
-				timing_timerEnable(tcpmodem->ringtimer);
-			}
+//The delivery timer, while there is anything queued
+void tcpmodem_deliver(TCPMODEM_t* tcpmodem) {
+	uint8_t buf[UART_FIFOSIZE];
+	int room, count = 0, head, tail;
+
+	tcpmodem_pace(tcpmodem);
+	room = uart_rxroom(tcpmodem->uart);
+	if (room > tcpmodem->rxbatch) room = tcpmodem->rxbatch;
+	if (room == 0) return;
+
+	while ((count < room) && (tcpmodem->rxbuf[tcpmodem->rxpos] != 0)) {
+		buf[count++] = (uint8_t)tcpmodem->rxbuf[tcpmodem->rxpos++];
+	}
+	if ((tcpmodem->rxbuf[tcpmodem->rxpos] == 0) && (tcpmodem->rxpos != 0)) {
+		memset(tcpmodem->rxbuf, 0, 1024);
+		tcpmodem->rxpos = 0;
+	}
+
+	if (tcpmodem->livesocket && !tcpmodem->escaped) {
+		head = SDL_AtomicGet(&tcpmodem->rxhead);
+		tail = SDL_AtomicGet(&tcpmodem->rxtail);
+		SDL_MemoryBarrierAcquire();
+		while ((count < room) && (tail != head)) {
+			buf[count++] = tcpmodem->rxring[tail++ & (TCPMODEM_RXRING - 1)];
+		}
+		SDL_AtomicSet(&tcpmodem->rxtail, tail);
+	}
+
+	if (count > 0) {
+		if (replay_input(REPLAY_SERIAL, tcpmodem->uart, buf, count)) {
+			uart_rxbytes(tcpmodem->uart, buf, count);
 		}
+		return;
+	}
+
+	tcpmodem->rxactive = 0;
+	timing_timerDisable(tcpmodem->rxtimer);
+}
+
+//UART MCR callback, software hangs up by dropping DTR
+void tcpmodem_mcr(TCPMODEM_t* tcpmodem, uint8_t value) {
+	if (tcpmodem->livesocket && !(value & 1)) {
+		tcpmodem_offline(tcpmodem);
 	}
 }
 
@@ -328,20 +481,9 @@ void tcpmodem_tx(TCPMODEM_t* tcpmodem, uint8_t value) {
 	}
 
 	if (tcpmodem->livesocket && !tcpmodem->escaped) {
-		ret = send(tcpmodem->socket, &value, 1, 0);
-		if (ret == SOCKET_ERROR) {
-			switch (WSAGetLastError()) {
-				//case 10035:
-			case WSAENETDOWN:
-			case WSAENETUNREACH:
-			case WSAENETRESET:
-			case WSAECONNABORTED:
-			case WSAECONNRESET:
-			case WSAENOTCONN:
-			case WSAEHOSTUNREACH:
-				tcpmodem_offline(tcpmodem);
-				break;
-			}
+		ret = send(tcpmodem->socket, (const char*)&value, 1, TCPMODEM_SENDFLAGS);
+		if ((ret < 0) && !tcpmodem_wouldBlock()) {
+			tcpmodem_offline(tcpmodem);
 		}
 	} else {
 		if (tcpmodem->echocmd) {
@@ -372,6 +514,7 @@ void tcpmodem_tx(TCPMODEM_t* tcpmodem, uint8_t value) {
 			}
 		}
 	}
+	tcpmodem_kick(tcpmodem);
 }
 
 void tcpmodem_ringer(TCPMODEM_t* tcpmodem) {
@@ -383,20 +526,128 @@ void tcpmodem_ringer(TCPMODEM_t* tcpmodem) {
 		tcpmodem->rxpos = 0;
 	}
 	tcpmodem_setringmsr(tcpmodem, tcpmodem->ringstate);
+	tcpmodem_kick(tcpmodem);
+}
+
+//Waits on every modem's sockets, filling receive rings and flagging callers and hangups for the emulation thread
+#ifdef _WIN32
+void tcpmodem_reactorThread(void* dummy) {
+#else
+void* tcpmodem_reactorThread(void* dummy) {
+#endif
+	TCPMODEM_POLLFD fds[TCPMODEM_MAX];
+	uint32_t generation[TCPMODEM_MAX];
+	uint8_t which[TCPMODEM_MAX];
+	int i, count, ret, news;
+
+	hostthread_apply(HOSTTHREAD_NET);
+
+	while (running) {
+		SDL_LockMutex(tcpmodem_lock);
+		count = 0;
+		for (i = 0; i < tcpmodem_count; i++) {
+			TCPMODEM_t* tcpmodem = tcpmodem_list[i];
+			generation[i] = tcpmodem->generation;
+			if (tcpmodem->livesocket && !SDL_AtomicGet(&tcpmodem->hangup)) {
+				if ((uint32_t)(SDL_AtomicGet(&tcpmodem->rxhead) - SDL_AtomicGet(&tcpmodem->rxtail)) >= TCPMODEM_RXRING) continue; //full, let TCP push back
+				fds[count].fd = tcpmodem->socket;
+			}
+			else if (tcpmodem->listening && (tcpmodem->serversocket != TCPMODEM_NOSOCKET) && !SDL_AtomicGet(&tcpmodem->caller)) {
+				fds[count].fd = tcpmodem->serversocket;
+			}
+			else {
+				continue;
+			}
+			fds[count].events = POLLIN;
+			fds[count].revents = 0;
+			which[count++] = (uint8_t)i;
+		}
+		SDL_UnlockMutex(tcpmodem_lock);
+
+		if (count == 0) {
+			utility_sleep(TCPMODEM_POLLMS);
+			continue;
+		}
+		ret = tcpmodem_poll(fds, count, TCPMODEM_POLLMS);
+		if (ret <= 0) {
+			if (ret < 0) utility_sleep(TCPMODEM_POLLMS);
+			continue;
+		}
+
+		news = 0;
+		SDL_LockMutex(tcpmodem_lock);
+		for (i = 0; i < count; i++) {
+			TCPMODEM_t* tcpmodem = tcpmodem_list[which[i]];
+			int head, space, len;
+			if ((fds[i].revents == 0) || (tcpmodem->generation != generation[which[i]])) continue; //socket changed under the poll
+			if (!tcpmodem->livesocket) {
+				SDL_AtomicSet(&tcpmodem->caller, 1);
+				news = 1;
+				continue;
+			}
+			head = SDL_AtomicGet(&tcpmodem->rxhead);
+			space = TCPMODEM_RXRING - (head - SDL_AtomicGet(&tcpmodem->rxtail));
+			len = TCPMODEM_RXRING - (head & (TCPMODEM_RXRING - 1)); //contiguous room up to the wrap
+			if (len > space) len = space;
+			ret = recv(tcpmodem->socket, (char*)&tcpmodem->rxring[head & (TCPMODEM_RXRING - 1)], len, 0);
+			if (ret > 0) {
+				SDL_MemoryBarrierRelease();
+				SDL_AtomicSet(&tcpmodem->rxhead, head + ret);
+				news = 1;
+			}
+			else if ((ret == 0) || !tcpmodem_wouldBlock()) {
+				SDL_AtomicSet(&tcpmodem->hangup, 1);
+				news = 1;
+			}
+		}
+		SDL_UnlockMutex(tcpmodem_lock);
+		if (news) SDL_AtomicSet(&tcpmodem_events, 1);
+	}
+#ifndef _WIN32
+	return NULL;
+#endif
 }
 
 int tcpmodem_init(TCPMODEM_t* tcpmodem, UART_t* uart, uint16_t port) {
 	debug_log(DEBUG_INFO, "[TCPMODEM] Initializing TCP serial modem emulator (listen on port %u)\r\n", port);
 
+	if (tcpmodem_count == TCPMODEM_MAX) {
+		debug_log(DEBUG_ERROR, "[TCPMODEM] Too many modems\r\n");
+		return -1;
+	}
+	if (tcpmodem_lock == NULL) {
+#ifdef _WIN32
+		WSADATA wsa;
+		WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+		tcpmodem_lock = SDL_CreateMutex();
+		if (tcpmodem_lock == NULL) {
+			debug_log(DEBUG_ERROR, "[TCPMODEM] Unable to create the socket lock\r\n");
+			return -1;
+		}
+		SDL_AtomicSet(&tcpmodem_events, 0);
+#ifdef _WIN32
+		_beginthread(tcpmodem_reactorThread, 0, NULL);
+#else
+		pthread_create(&tcpmodem_reactorThreadID, NULL, tcpmodem_reactorThread, NULL);
+#endif
+	}
+
 	memset(tcpmodem, 0, sizeof(TCPMODEM_t));
 	tcpmodem->uart = uart;
 	tcpmodem->escaped = 1;
 	tcpmodem->echocmd = 1;
 	tcpmodem->listenport = port;
+	tcpmodem->socket = TCPMODEM_NOSOCKET;
+	tcpmodem->serversocket = TCPMODEM_NOSOCKET;
+	tcpmodem->ringtimer = timing_addTimer(tcpmodem_ringer, tcpmodem, 1, TIMING_DISABLED);
+	tcpmodem->rxtimer = timing_addTimer(tcpmodem_deliver, tcpmodem, baudrate / 9, TIMING_DISABLED);
+	tcpmodem->rxbatch = 1;
 
-	WSAStartup(MAKEWORD(2, 2), &tcpmodem->wsa);
+	SDL_LockMutex(tcpmodem_lock);
+	tcpmodem_list[tcpmodem_count++] = tcpmodem;
+	SDL_UnlockMutex(tcpmodem_lock);
 	tcpmodem_listen(tcpmodem, tcpmodem->listenport);
-	tcpmodem->ringtimer = timing_addTimer(tcpmodem_ringer, tcpmodem, 1, TIMING_DISABLED);
 
 	return 0;
 }
@@ -5,11 +5,26 @@
 
 #ifdef ENABLE_TCP_MODEM
 #include <stdint.h>
+#include <SDL.h>
 #include "../../chipset/uart.h"
 
 #ifdef _WIN32
 #include <WinSock2.h>
 #include <WS2tcpip.h>
+typedef SOCKET TCPMODEM_SOCKET;
+#define TCPMODEM_NOSOCKET	INVALID_SOCKET
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+typedef int TCPMODEM_SOCKET;
+#define TCPMODEM_NOSOCKET	-1
+#endif
+
+#define TCPMODEM_MAX		2 //one per UART
+#define TCPMODEM_RXRING		4096 //bytes the reactor thread can queue ahead of the UART, power of two
+#define TCPMODEM_POLLMS		20 //longest the reactor thread sits in poll() before it sees new or closed sockets
 
 typedef struct {
 	uint8_t escaped;
@@ -25,23 +40,29 @@ typedef struct {
 	uint16_t rxpos;
 	uint16_t txpos;
 	char lasttx[3];
-	WSADATA wsa;
-	SOCKET socket;
-	SOCKET serversocket;
-	SOCKADDR_IN server;
+	TCPMODEM_SOCKET socket;
+	TCPMODEM_SOCKET serversocket;
+	struct sockaddr_in server;
 	UART_t* uart;
+	uint32_t rxtimer; //hands queued bytes to the UART at the baud rate, only enabled while there are some
+	uint8_t rxactive;
+	uint8_t rxbatch; //bytes handed over per timer tick, the UART's FIFO trigger level
+	uint8_t rxring[TCPMODEM_RXRING]; //filled by the reactor thread
+	SDL_atomic_t rxhead, rxtail;
+	SDL_atomic_t hangup; //the reactor saw the connection drop
+	SDL_atomic_t caller; //the reactor saw a connection waiting on the listening socket
+	uint32_t generation; //bumped under tcpmodem_lock whenever the sockets change
 } TCPMODEM_t;
 
+extern SDL_atomic_t tcpmodem_events;
+
 int tcpmodem_connect(TCPMODEM_t* tcpmodem, char* host, uint16_t port);
 void tcpmodem_offline(TCPMODEM_t* tcpmodem);
-void tcpmodem_rxpoll(TCPMODEM_t* tcpmodem);
+void tcpmodem_service();
 void tcpmodem_tx(TCPMODEM_t* tcpmodem, uint8_t value);
+void tcpmodem_mcr(TCPMODEM_t* tcpmodem, uint8_t value);
 int tcpmodem_init(TCPMODEM_t* tcpmodem, UART_t* uart, uint16_t port);
 
-#else
-
-#endif
-
 #endif
 
 #endif
@@ -0,0 +1,271 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Optional HLE of the INT 10h text output calls: teletype (0Eh), scroll
+	up and down (06h/07h), write character and attribute (09h) and write
+	string (13h). DOS and most text mode programs print through these, and
+	running the video BIOS for them means a port write for every cursor move
+	plus a byte at a time trip through the video card's memory handlers.
+	Here a call becomes a few block writes to video memory and one cursor
+	update, using the same BDA fields the BIOS keeps so the two can be mixed
+	freely. Anything else, graphics modes, protected mode and a vector that
+	a TSR has hooked all go to the BIOS as usual.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "biosvideo.h"
+#include "../../cpu/cpu.h"
+#include "../../memory.h"
+#include "../../debuglog.h"
+
+typedef struct {
+	uint32_t vram; //start of the page in video memory
+	uint16_t cols;
+	uint16_t rows;
+	uint8_t page;
+} BIOSVIDEO_SCREEN_t;
+
+static uint8_t biosvideo_row[512];
+
+//Fills in scr for the given page, returns -1 when the current mode isn't one we handle
+static int biosvideo_screen(CPU_t* cpu, BIOSVIDEO_SCREEN_t* scr, uint8_t page) {
+	uint8_t mode, rows;
+
+	mode = cpu_read(cpu, BIOSVIDEO_BDA_MODE) & 0x7F;
+	if ((mode > 3) && (mode != 7)) return -1;
+	if (page > 7) return -1;
+
+	scr->cols = cpu_readw(cpu, BIOSVIDEO_BDA_COLS);
+	rows = cpu_read(cpu, BIOSVIDEO_BDA_ROWS);
+	scr->rows = (rows == 0) ? 25 : (uint16_t)rows + 1;
+	if ((scr->cols == 0) || (scr->cols > (sizeof(biosvideo_row) / 2))) return -1;
+	scr->page = page;
+	scr->vram = ((mode == 7) ? 0xB0000 : 0xB8000) + (uint32_t)page * cpu_readw(cpu, BIOSVIDEO_BDA_PAGESIZE);
+	return 0;
+}
+
+static uint32_t biosvideo_cell(BIOSVIDEO_SCREEN_t* scr, uint8_t row, uint8_t col) {
+	return scr->vram + ((uint32_t)row * scr->cols + col) * 2;
+}
+
+static void biosvideo_getCursor(CPU_t* cpu, uint8_t page, uint8_t* row, uint8_t* col) {
+	uint16_t pos;
+
+	pos = cpu_readw(cpu, BIOSVIDEO_BDA_CURSOR + (uint32_t)page * 2);
+	*col = (uint8_t)pos;
+	*row = (uint8_t)(pos >> 8);
+}
+
+//Same as AH=02h: the BDA always, the CRTC only when it's the page on screen
+static void biosvideo_setCursor(CPU_t* cpu, BIOSVIDEO_SCREEN_t* scr, uint8_t row, uint8_t col) {
+	uint16_t crtc, pos;
+
+	cpu_writew(cpu, BIOSVIDEO_BDA_CURSOR + (uint32_t)scr->page * 2, ((uint16_t)row << 8) | col);
+	if (scr->page != cpu_read(cpu, BIOSVIDEO_BDA_PAGE)) return;
+	crtc = cpu_readw(cpu, BIOSVIDEO_BDA_CRTC);
+	if (crtc == 0) return;
+	pos = (cpu_readw(cpu, BIOSVIDEO_BDA_PAGESTART) >> 1) + (uint16_t)row * scr->cols + col;
+	port_write(cpu, crtc, 0x0E);
+	port_write(cpu, crtc + 1, (uint8_t)(pos >> 8));
+	port_write(cpu, crtc, 0x0F);
+	port_write(cpu, crtc + 1, (uint8_t)pos);
+}
+
+static void biosvideo_fill(BIOSVIDEO_SCREEN_t* scr, uint8_t row, uint8_t left, uint8_t width, uint8_t ch, uint8_t attr) {
+	uint16_t i;
+
+	for (i = 0; i < width; i++) {
+		biosvideo_row[i * 2] = ch;
+		biosvideo_row[i * 2 + 1] = attr;
+	}
+	memory_writeBlock(biosvideo_cell(scr, row, left), biosvideo_row, (uint32_t)width * 2);
+}
+
+//Scrolls the window by lines rows, up when up is set, and blanks what it uncovers. lines of zero or more than the window's height blank all of it.
+static void biosvideo_scroll(BIOSVIDEO_SCREEN_t* scr, uint8_t top, uint8_t left, uint8_t bottom, uint8_t right, uint8_t lines, uint8_t attr, uint8_t up) {
+	uint16_t height, width, i;
+
+	if (bottom >= scr->rows) bottom = (uint8_t)(scr->rows - 1);
+	if (right >= scr->cols) right = (uint8_t)(scr->cols - 1);
+	if ((top > bottom) || (left > right)) return;
+	height = bottom - top + 1;
+	width = right - left + 1;
+	if ((lines == 0) || (lines > height)) lines = (uint8_t)height;
+
+	for (i = 0; i < (height - lines); i++) {
+		uint8_t dst, src;
+		dst = up ? (uint8_t)(top + i) : (uint8_t)(bottom - i);
+		src = up ? (uint8_t)(dst + lines) : (uint8_t)(dst - lines);
+		memory_readBlock(biosvideo_cell(scr, src, left), biosvideo_row, (uint32_t)width * 2);
+		memory_writeBlock(biosvideo_cell(scr, dst, left), biosvideo_row, (uint32_t)width * 2);
+	}
+	for (i = 0; i < lines; i++) {
+		biosvideo_fill(scr, up ? (uint8_t)(bottom - i) : (uint8_t)(top + i), left, (uint8_t)width, ' ', attr);
+	}
+}
+
+//One character of teletype output at *row, *col, which it moves on. BEL is left to the caller.
+static void biosvideo_tty(BIOSVIDEO_SCREEN_t* scr, uint8_t* row, uint8_t* col, uint8_t ch, uint8_t attr, uint8_t useattr) {
+	uint8_t cell[2];
+	uint32_t addr;
+
+	switch (ch) {
+	case 0x0D:
+		*col = 0;
+		break;
+	case 0x0A:
+		(*row)++;
+		break;
+	case 0x08:
+		if (*col > 0) (*col)--;
+		break;
+	default:
+		addr = biosvideo_cell(scr, *row, *col);
+		cell[0] = ch;
+		cell[1] = attr;
+		memory_writeBlock(addr, cell, useattr ? 2 : 1);
+		if (++(*col) >= scr->cols) {
+			*col = 0;
+			(*row)++;
+		}
+		break;
+	}
+
+	if (*row >= scr->rows) {
+		//like the BIOS, the new line gets the attribute found at the cursor
+		*row = (uint8_t)(scr->rows - 1);
+		memory_readBlock(biosvideo_cell(scr, *row, *col) + 1, cell, 1);
+		biosvideo_scroll(scr, 0, 0, *row, (uint8_t)(scr->cols - 1), 1, cell[0], 1);
+	}
+}
+
+static int biosvideo_teletype(CPU_t* cpu) {
+	BIOSVIDEO_SCREEN_t scr;
+	uint8_t row, col;
+
+	if (cpu->regs.byteregs[regal] == 0x07) return -1;
+	if (biosvideo_screen(cpu, &scr, cpu->regs.byteregs[regbh])) return -1;
+	biosvideo_getCursor(cpu, scr.page, &row, &col);
+	if ((row >= scr.rows) || (col >= scr.cols)) return -1;
+	biosvideo_tty(&scr, &row, &col, cpu->regs.byteregs[regal], 0, 0);
+	biosvideo_setCursor(cpu, &scr, row, col);
+	return 0;
+}
+
+static int biosvideo_scrollcall(CPU_t* cpu, uint8_t up) {
+	BIOSVIDEO_SCREEN_t scr;
+
+	//these work on the page on screen, which starts where the BDA says rather than at page times page size
+	if (biosvideo_screen(cpu, &scr, 0)) return -1;
+	scr.page = cpu_read(cpu, BIOSVIDEO_BDA_PAGE);
+	scr.vram += cpu_readw(cpu, BIOSVIDEO_BDA_PAGESTART);
+	biosvideo_scroll(&scr, cpu->regs.byteregs[regch], cpu->regs.byteregs[regcl], cpu->regs.byteregs[regdh], cpu->regs.byteregs[regdl],
+		cpu->regs.byteregs[regal], cpu->regs.byteregs[regbh], up);
+	return 0;
+}
+
+static int biosvideo_writeChar(CPU_t* cpu) {
+	BIOSVIDEO_SCREEN_t scr;
+	uint32_t addr, end, len, i;
+	uint8_t row, col;
+
+	if (biosvideo_screen(cpu, &scr, cpu->regs.byteregs[regbh])) return -1;
+	biosvideo_getCursor(cpu, scr.page, &row, &col);
+	if ((row >= scr.rows) || (col >= scr.cols)) return -1;
+
+	//the count runs on past the end of the line but not past the page
+	addr = biosvideo_cell(&scr, row, col);
+	end = biosvideo_cell(&scr, (uint8_t)scr.rows, 0);
+	len = getreg16(cpu, regcx);
+	if (len > ((end - addr) / 2)) len = (end - addr) / 2;
+	for (i = 0; i < (sizeof(biosvideo_row) / 2); i++) {
+		biosvideo_row[i * 2] = cpu->regs.byteregs[regal];
+		biosvideo_row[i * 2 + 1] = cpu->regs.byteregs[regbl];
+	}
+	while (len > 0) {
+		uint32_t chunk = (len > (sizeof(biosvideo_row) / 2)) ? (sizeof(biosvideo_row) / 2) : len;
+		memory_writeBlock(addr, biosvideo_row, chunk * 2);
+		addr += chunk * 2;
+		len -= chunk;
+	}
+	return 0;
+}
+
+static int biosvideo_writeString(CPU_t* cpu) {
+	BIOSVIDEO_SCREEN_t scr;
+	uint32_t str, i, len;
+	uint8_t mode, row, col, saverow, savecol, ch, attr;
+
+	mode = cpu->regs.byteregs[regal];
+	if (mode > 3) return -1;
+	if (biosvideo_screen(cpu, &scr, cpu->regs.byteregs[regbh])) return -1;
+	row = cpu->regs.byteregs[regdh];
+	col = cpu->regs.byteregs[regdl];
+	if ((row >= scr.rows) || (col >= scr.cols)) return -1;
+
+	str = segbase(cpu->segregs[reges]) + getreg16(cpu, regbp);
+	len = getreg16(cpu, regcx);
+	if (mode & 2) len *= 2;
+	for (i = 0; i < len; i += (mode & 2) ? 2 : 1) {
+		if (cpu_read(cpu, str + i) == 0x07) return -1; //the BIOS beeps for it, so it gets the whole string
+	}
+
+	biosvideo_getCursor(cpu, scr.page, &saverow, &savecol);
+	attr = cpu->regs.byteregs[regbl];
+	for (i = 0; i < len; ) {
+		ch = cpu_read(cpu, str + i++);
+		if (mode & 2) attr = cpu_read(cpu, str + i++);
+		biosvideo_tty(&scr, &row, &col, ch, attr, 1);
+	}
+	if (mode & 1) biosvideo_setCursor(cpu, &scr, row, col);
+	else biosvideo_setCursor(cpu, &scr, saverow, savecol);
+	return 0;
+}
+
+void biosvideo_int10h(CPU_t* cpu, uint8_t intnum) {
+	int ret = -1;
+
+	if (!cpu->protected_mode && (cpu_readw(cpu, 0x42) >= BIOSVIDEO_ROMSEG)) {
+		switch (cpu->regs.byteregs[regah]) {
+		case 0x06:
+		case 0x07:
+			ret = biosvideo_scrollcall(cpu, cpu->regs.byteregs[regah] == 0x06);
+			break;
+		case 0x09:
+			ret = biosvideo_writeChar(cpu);
+			break;
+		case 0x0E:
+			ret = biosvideo_teletype(cpu);
+			break;
+		case 0x13:
+			ret = biosvideo_writeString(cpu);
+			break;
+		}
+	}
+
+	if (ret) cpu_intDispatch(cpu, intnum);
+}
+
+void biosvideo_init(CPU_t* cpu) {
+	debug_log(DEBUG_INFO, "[BIOSVIDEO] Handling INT 10h text output in the emulator\r\n");
+	cpu_registerIntCallback(cpu, 0x10, biosvideo_int10h);
+}
@@ -0,0 +1,21 @@
+#ifndef _BIOSVIDEO_H_
+#define _BIOSVIDEO_H_
+
+#include <stdint.h>
+#include "../../cpu/cpu.h"
+
+#define BIOSVIDEO_BDA_MODE		0x449
+#define BIOSVIDEO_BDA_COLS		0x44A
+#define BIOSVIDEO_BDA_PAGESIZE	0x44C
+#define BIOSVIDEO_BDA_PAGESTART	0x44E
+#define BIOSVIDEO_BDA_CURSOR	0x450 //eight words, column in the low byte and row in the high byte
+#define BIOSVIDEO_BDA_PAGE		0x462
+#define BIOSVIDEO_BDA_CRTC		0x463
+#define BIOSVIDEO_BDA_ROWS		0x484 //rows minus one, zero on BIOSes that don't keep it
+
+#define BIOSVIDEO_ROMSEG		0xC000 //INT 10h vectors below this belong to something the guest loaded, leave those alone
+
+void biosvideo_int10h(CPU_t* cpu, uint8_t intnum);
+void biosvideo_init(CPU_t* cpu);
+
+#endif
@@ -18,6 +18,7 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <stdint.h>
 #include <stddef.h>
 #ifdef _WIN32
@@ -33,7 +34,14 @@ pthread_t cga_renderThreadID;
 #include "../../ports.h"
 #include "../../memory.h"
 #include "sdlconsole.h"
+#include "vnc.h"
+#include "../../capture.h"
 #include "../../debuglog.h"
+#include "../../snapshot.h"
+#include "../../profile.h"
+#include "../../hostthread.h"
+#include "../../metrics.h"
+#include "frameskip.h"
 
 const uint8_t cga_palette[16][3] = { //R, G, B
 	{ 0x00, 0x00, 0x00 }, //black
@@ -73,6 +81,59 @@ uint8_t cga_cursor_blink_state = 0;
 uint8_t *cga_RAM = NULL;
 
 volatile uint8_t cga_doDraw = 1;
+volatile uint8_t cga_dumpPending = 0; //headless with -vnc or -capture, the render thread writes the next -framedump
+
+/*
+	Dirty tracking, same scheme as the VGA: RAM writes stamp their chunk with the
+	current generation, the render thread bumps it per frame and only redraws
+	scanlines with a chunk stamped since the previous frame started.
+*/
+uint32_t cga_dirty[CGA_DIRTY_CHUNKS];
+volatile uint32_t cga_dirtyGen = 1, cga_allGen = 1;
+volatile uint32_t cga_drawnGen = 0; //generation the render thread last drew up to, writes stamped after it are still to be drawn
+
+#define cga_invalidate() cga_allGen = cga_dirtyGen
+
+uint8_t cga_spanDirty(uint32_t offset, uint32_t len, uint32_t since) {
+	uint32_t chunk, last;
+
+	chunk = (offset & 0x3FFF) >> CGA_DIRTY_SHIFT;
+	last = ((offset + len - 1) & 0x3FFF) >> CGA_DIRTY_SHIFT;
+	while (1) {
+		if (cga_dirty[chunk] > since) return 1;
+		if (chunk == last) return 0;
+		chunk = (chunk + 1) & (CGA_DIRTY_CHUNKS - 1);
+	}
+}
+
+/*
+	Text cells are copied from pre-rendered glyphs, the eight scanlines of a
+	character in the colors of one attribute. The character ROM and the palette
+	never change so entries stay good, they're only replaced on a collision.
+*/
+CGAGLYPH_t cga_glyphs[CGA_GLYPHS];
+
+//Pixels of one row of character cc in attribute attr, hidden blanks it for the blink phase
+static const uint32_t* cga_glyphRow(uint8_t cc, uint8_t attr, uint8_t hidden, uint32_t row) {
+	CGAGLYPH_t* glyph;
+	uint32_t key, r, col, fore, back;
+	uint8_t fontdata;
+
+	key = (uint32_t)cc | ((uint32_t)attr << 8) | ((uint32_t)hidden << 16);
+	glyph = &cga_glyphs[((key * 2654435761UL) >> 16) & (CGA_GLYPHS - 1)];
+	if (glyph->key != key) {
+		fore = cga_color(attr & 0x0F);
+		back = cga_color(attr >> 4);
+		for (r = 0; r < 8; r++) {
+			fontdata = hidden ? 0 : cga_font[2048 + (cc * 8) + r];
+			for (col = 0; col < 8; col++) {
+				glyph->rows[r][col] = ((fontdata >> (7 - col)) & 1) ? fore : back;
+			}
+		}
+		glyph->key = key;
+	}
+	return glyph->rows[row];
+}
 
 int cga_init() {
 	int x, y;
@@ -84,23 +145,33 @@ int cga_init() {
 		return -1;
 	}
 
+	for (x = 0; x < CGA_GLYPHS; x++) {
+		cga_glyphs[x].key = CGA_GLYPH_NONE;
+	}
+
 	for (y = 0; y < 400; y++) {
 		for (x = 0; x < 640; x++) {
 			cga_framebuffer[y][x] = cga_color(CGA_BLACK);
 		}
 	}
-	sdlconsole_blit((uint32_t *)cga_framebuffer, 640, 400, 640 * sizeof(uint32_t));
+	if (!headless) {
+		sdlconsole_blit((uint32_t *)cga_framebuffer, 640, 400, 640 * sizeof(uint32_t));
+	}
 
 	timing_addTimer(cga_blinkCallback, NULL, 3, TIMING_ENABLED);
-	timing_addTimer(cga_scanlineCallback, NULL, 62800, TIMING_ENABLED);
-	timing_addTimer(cga_drawCallback, NULL, 60, TIMING_ENABLED);
+	if (!headless || vncport || (capturefile != NULL)) {
+		timing_addTimer(cga_drawCallback, NULL, 60, TIMING_ENABLED);
+	}
+	if (headless && (framedump != NULL)) {
+		timing_addGuestTimer(cga_dumpCallback, NULL, 1.0 / framedumpinterval, TIMING_ENABLED);
+	}
 	/*
 		NOTE: CGA scanlines are clocked at 15.7 KHz. We are breaking each scanline into
 		four parts and using the last part as a very approximate horizontal retrace period.
 		
 		15700 x 4 = 62800
 
-		See cga_scanlineCallback function for more details.
+		See cga_scanlineStatus function for more details.
 	*/
 
 	cga_RAM = (uint8_t*)malloc(16384);
@@ -109,61 +180,86 @@ int cga_init() {
 		return -1;
 	}
 
-	//TODO: error checking below
+	if (!headless || vncport || (capturefile != NULL)) { //the VNC server and -capture get their frames from the render thread
+		//TODO: error checking below
 #ifdef _WIN32
-	_beginthread(cga_renderThread, 0, NULL);
+		_beginthread(cga_renderThread, 0, NULL);
 #else
-	pthread_create(&cga_renderThreadID, NULL, cga_renderThread, NULL);
+		pthread_create(&cga_renderThreadID, NULL, cga_renderThread, NULL);
 #endif
+	}
 
 	ports_cbRegister(0x3D0, 16, (void*)cga_readport, NULL, (void*)cga_writeport, NULL, NULL);
 	memory_mapCallbackRegister(0xB8000, 0x4000, (void*)cga_readmemory, (void*)cga_writememory, NULL);
+	memory_mapBlockRegister(0xB8000, cga_readBlock, cga_writeBlock);
 
 	return 0;
 }
 
-void cga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end_y) {
-	uint32_t addr, startaddr, cursorloc, cursor_x, cursor_y;
-	uint32_t scx, scy, x, y;
-	uint8_t cc, attr, fontdata, blink, mode, colorset, intensity, blinkenable;
-
+//Redraws the lines in the given area whose video memory changed after generation since (0 redraws all of it), returns how many were drawn
+uint32_t cga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end_y, uint32_t since) {
+	static uint32_t lastcursor = 0xFFFFFFFF;
+	static uint8_t lastblink = 0;
+	uint32_t addr, startaddr, cursorloc, prevcursor, cursor_x, cursor_y, lastcursor_y, drawn;
+	uint32_t scx, scy, x, y, col, color;
+	const uint32_t* pixels;
+	uint8_t cc, attr, blink, mode, colorset, intensity, blinkenable, full, blinkstate, cursorchanged;
+
+	intensity = (cga_regs[0x9] & 0x10) ? 1 : 0;
+	colorset = (cga_regs[0x9] & 0x20) ? 1 : 0;
+	blinkenable = (cga_regs[0x8] & 0x20) ? 1 : 0;
 	if (cga_regs[0x8] & 0x02) { //graphics modes
 		mode = (cga_regs[0x8] & 0x10) ? CGA_MODE_GRAPHICS_HI : CGA_MODE_GRAPHICS_LO;
-		intensity = (cga_regs[0x9] & 0x10) ? 1 : 0;
-		colorset = (cga_regs[0x9] & 0x20) ? 1 : 0;
 	} else { //text modes
 		mode = (cga_regs[0x8] & 0x01) ? CGA_MODE_TEXT_80X25 : CGA_MODE_TEXT_40X25;
-		blinkenable = (cga_regs[0x8] & 0x20) ? 1 : 0;
 	}
 	startaddr = (((uint32_t)cga_datareg[0x12] & 0x3F) << 8) | (uint32_t)cga_datareg[0x13];
 	cursorloc = (((uint32_t)cga_datareg[0xE] << 8) & 0xFF00) | (uint32_t)cga_datareg[0xF];
+	drawn = 0;
+	full = (cga_allGen > since);
+	blinkstate = cga_cursor_blink_state;
+	cursorchanged = (cursorloc != lastcursor) || (blinkstate != lastblink);
+	if ((mode == CGA_MODE_TEXT_80X25) || (mode == CGA_MODE_TEXT_40X25)) {
+		if (blinkenable && (blinkstate != lastblink)) { //blinking characters can be anywhere on screen
+			full = 1;
+		}
+	}
+	prevcursor = lastcursor; //the row the cursor left needs redrawing too
+	lastcursor = cursorloc;
+	lastblink = blinkstate;
 
 	switch (mode) {
 	case CGA_MODE_TEXT_80X25:
 		cursor_x = cursorloc % 80;
 		cursor_y = cursorloc / 80;
+		lastcursor_y = prevcursor / 80;
 		for (scy = start_y; scy <= end_y; scy++) {
 			y = scy / (((cga_datareg[0x09] & 0x1F) + 1) * 2);
-			for (scx = start_x; scx <= end_x; scx++) {
+			if (!full && !(cursorchanged && ((y == cursor_y) || (y == lastcursor_y))) && !cga_spanDirty(startaddr + (y * 160), 160, since)) {
+				continue;
+			}
+			drawn++;
+			for (scx = start_x; scx <= end_x; ) { //a character cell at a time
 				x = scx / 8;
 				addr = startaddr + ((y * 80) + x) * 2;
 				cc = cga_RAM[addr];
 				attr = cga_RAM[addr + 1];
 				blink = attr >> 7;
 				if (blinkenable) attr &= 0x7F; //enabling text mode blink attribute limits background color selection
-				fontdata = cga_font[2048 + (cc * 8) + ((scy % 16) / 2)];
-				fontdata = (fontdata >> (7 - (scx % 8))) & 1;
 				if ((y == cursor_y) && (x == cursor_x) &&
 					((uint8_t)(scy % 16) >= (cga_datareg[CGA_REG_DATA_CURSOR_BEGIN] & 31) * 2) &&
 					((uint8_t)(scy % 16) <= (cga_datareg[CGA_REG_DATA_CURSOR_END] & 31) * 2) &&
-					cga_cursor_blink_state && blinkenable) { //cursor should be displayed
-					cga_framebuffer[scy][scx] = cga_color(attr & 0x0F);
-				}
-				else {
-					if (blinkenable && blink && !cga_cursor_blink_state) {
-						fontdata = 0; //all pixels in character get background color if blink attribute set and blink visible state is false
+					blinkstate && blinkenable) { //cursor should be displayed
+					color = cga_color(attr & 0x0F);
+					for (col = scx % 8; (col < 8) && (scx <= end_x); col++) {
+						cga_framebuffer[scy][scx++] = color;
 					}
-					cga_framebuffer[scy][scx] = cga_color(fontdata ? (attr & 0x0F) : (attr >> 4));
+					continue;
+				}
+				//all pixels in character get background color if blink attribute set and blink visible state is false
+				pixels = cga_glyphRow(cc, attr, blinkenable && blink && !blinkstate, (scy % 16) / 2);
+				for (col = scx % 8; (col < 8) && (scx <= end_x); col++) {
+					cga_framebuffer[scy][scx++] = pixels[col];
 				}
 			}
 		}
@@ -171,30 +267,34 @@ void cga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end
 	case CGA_MODE_TEXT_40X25:
 		cursor_x = cursorloc % 40;
 		cursor_y = cursorloc / 40;
+		lastcursor_y = prevcursor / 40;
 		for (scy = start_y; scy <= end_y; scy++) {
 			y = scy / 16;
-			for (scx = start_x; scx <= end_x; scx += 2) {
+			if (!full && !(cursorchanged && ((y == cursor_y) || (y == lastcursor_y))) && !cga_spanDirty(startaddr + (y * 80), 80, since)) {
+				continue;
+			}
+			drawn++;
+			for (scx = start_x; scx <= end_x; ) {
 				x = scx / 16;
 				addr = startaddr + ((y * 40) + x) * 2;
 				cc = cga_RAM[addr];
 				attr = cga_RAM[addr + 1];
 				blink = attr >> 7;
 				if (blinkenable) attr &= 0x7F; //enabling text mode blink attribute limits background color selection
-				fontdata = cga_font[2048 + (cc * 8) + ((scy % 16) / 2)];
-				fontdata = (fontdata >> (7 - ((scx / 2) % 8))) & 1;
 				if ((y == cursor_y) && (x == cursor_x) &&
 					((uint8_t)(scy % 16) >= (cga_datareg[CGA_REG_DATA_CURSOR_BEGIN] & 31) * 2) &&
 					((uint8_t)(scy % 16) <= (cga_datareg[CGA_REG_DATA_CURSOR_END] & 31) * 2) &&
-					cga_cursor_blink_state && blinkenable) {
-					cga_framebuffer[scy][scx] = cga_color(attr & 0x0F);
-				}
-				else {
-					if (blinkenable && blink && !cga_cursor_blink_state) {
-						fontdata = 0;
+					blinkstate && blinkenable) {
+					color = cga_color(attr & 0x0F);
+					for (col = (scx / 2) % 8; (col < 8) && (scx <= end_x); col++, scx += 2) {
+						cga_framebuffer[scy][scx] = cga_framebuffer[scy][scx + 1] = color;
 					}
-					cga_framebuffer[scy][scx] = cga_color(fontdata ? (attr & 0x0F) : (attr >> 4));
+					continue;
+				}
+				pixels = cga_glyphRow(cc, attr, blinkenable && blink && !blinkstate, (scy % 16) / 2);
+				for (col = (scx / 2) % 8; (col < 8) && (scx <= end_x); col++, scx += 2) {
+					cga_framebuffer[scy][scx] = cga_framebuffer[scy][scx + 1] = pixels[col]; //double pixels horizontally
 				}
-				cga_framebuffer[scy][scx + 1] = cga_framebuffer[scy][scx]; //double pixels horizontally
 			}
 		}
 		break;
@@ -203,6 +303,10 @@ void cga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end
 			uint8_t isodd;
 			isodd = scy & 2;
 			y = scy >> 2;
+			if (!full && !cga_spanDirty((isodd ? 0x2000 : 0x0000) + (y * 80), 80, since)) {
+				continue;
+			}
+			drawn += 2;
 			for (scx = start_x; scx <= end_x; scx += 2) {
 				x = scx >> 1;
 				addr = (isodd ? 0x2000 : 0x0000) + (y * 80) + (x >> 2);
@@ -222,6 +326,10 @@ void cga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end
 			uint8_t isodd;
 			isodd = scy & 2;
 			y = scy >> 2;
+			if (!full && !cga_spanDirty((isodd ? 0x2000 : 0x0000) + (y * 80), 80, since)) {
+				continue;
+			}
+			drawn += 2;
 			for (scx = start_x; scx <= end_x; scx++) {
 				x = scx;
 				addr = (isodd ? 0x2000 : 0x0000) + (y * 80) + (x >> 3);
@@ -234,13 +342,53 @@ void cga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end
 		break;
 	}
 
-	sdlconsole_blit((uint32_t *)cga_framebuffer, 640, 400, 640 * sizeof(uint32_t));
+	return drawn;
 }
 
 void cga_renderThread(void* dummy) {
+	uint32_t since = 0, gen, drawn;
+	uint64_t start = 0;
+
+	hostthread_apply(HOSTTHREAD_RENDER);
+	if (!headless) sdlconsole_attach();
+
 	while (running) {
 		if (cga_doDraw == 1) {
-			cga_update(0, 0, 639, 399);
+			gen = cga_dirtyGen;
+			cga_dirtyGen = gen + 1; //writes from here on belong to the next frame
+			cga_drawnGen = gen;
+			if (profile_enabled) start = profile_begin();
+			drawn = cga_update(0, 0, 639, 399, since);
+			if (drawn) metrics.render.framesRendered++;
+			else metrics.render.framesUnchanged++;
+			if (profile_enabled) {
+				profile_endSection(PROFILE_SECT_RENDER, start);
+				start = profile_begin();
+			}
+			if (!headless) {
+				if (drawn) {
+					sdlconsole_blit((uint32_t *)cga_framebuffer, 640, 400, 640 * sizeof(uint32_t));
+				} else { //nothing changed, only present a frame that was held back earlier
+					sdlconsole_blitRects((uint32_t *)cga_framebuffer, 640, 400, 640 * sizeof(uint32_t), NULL, 0);
+				}
+			}
+#ifdef ENABLE_VNC
+			if (vncport && drawn) {
+				SDL_Rect rect = { 0, 0, 640, 400 };
+				vnc_frame((uint32_t *)cga_framebuffer, 640, 400, 640 * sizeof(uint32_t), &rect, 1);
+			}
+#endif
+			if (capture_enabled) {
+				capture_frame((uint32_t *)cga_framebuffer, 640, 400, 640 * sizeof(uint32_t), (uint8_t)drawn);
+			}
+			if (profile_enabled) profile_endSection(PROFILE_SECT_BLIT, start);
+			if (cga_dumpPending) {
+				cga_dumpPending = 0;
+				if (utility_savePPM(framedump, (uint32_t*)cga_framebuffer, 640, 400, 640 * sizeof(uint32_t))) {
+					debug_log(DEBUG_ERROR, "[CGA] Unable to write frame dump to %s\r\n", framedump);
+				}
+			}
+			since = gen;
 			cga_doDraw = 0;
 		}
 		else {
@@ -254,28 +402,52 @@ void cga_renderThread(void* dummy) {
 #endif
 }
 
+//Headless mode only. Draws the current frame on the CPU thread and writes it to the -framedump file
+void cga_dumpCallback(void* dummy) {
+	static uint32_t since = 0;
+	uint32_t gen;
+
+	if (vncport || (capturefile != NULL)) { //the render thread is running, leave the drawing to it
+		cga_dumpPending = 1;
+		return;
+	}
+	gen = cga_dirtyGen;
+	cga_dirtyGen = gen + 1;
+	cga_update(0, 0, 639, 399, since);
+	since = gen;
+	if (utility_savePPM(framedump, (uint32_t*)cga_framebuffer, 640, 400, 640 * sizeof(uint32_t))) {
+		debug_log(DEBUG_ERROR, "[CGA] Unable to write frame dump to %s\r\n", framedump);
+	}
+}
+
 void cga_writeport(void* dummy, uint16_t port, uint8_t value) {
-#ifdef DEBUG_CGA
-	debug_log(DEBUG_DETAIL, "Write CGA port: %02X -> %03X (indexreg = %02X)\r\n", value, port, cga_indexreg);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_CGA)) {
+		debug_log(DEBUG_DETAIL, "Write CGA port: %02X -> %03X (indexreg = %02X)\r\n", value, port, cga_indexreg);
+	}
 	switch (port) {
 	case 0x3D4:
 		cga_indexreg = value;
 		break;
 	case 0x3D5:
+		if ((cga_datareg[cga_indexreg] != value) && (cga_indexreg != 0x0E) && (cga_indexreg != 0x0F)) { //cursor moves are picked up by cga_update itself
+			cga_invalidate();
+		}
 		cga_datareg[cga_indexreg] = value;
 		break;
 	case 0x3DA:
 		break;
 	default:
+		if (cga_regs[port - 0x3D0] != value) {
+			cga_invalidate();
+		}
 		cga_regs[port - 0x3D0] = value;
 	}
 }
 
 uint8_t cga_readport(void* dummy, uint16_t port) {
-#ifdef DEBUG_CGA
-	debug_log(DEBUG_DETAIL, "Read CGA port: %03X (indexreg = %02X)\r\n", port, cga_indexreg);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_CGA)) {
+		debug_log(DEBUG_DETAIL, "Read CGA port: %03X (indexreg = %02X)\r\n", port, cga_indexreg);
+	}
 	switch (port) {
 	case 0x3D4:
 		return cga_indexreg;
@@ -283,6 +455,7 @@ uint8_t cga_readport(void* dummy, uint16_t port) {
 		//if ((cga_indexreg < 0x0E) || (cga_indexreg > 0x0F)) return 0xFF;
 		return cga_datareg[cga_indexreg];
 	case 0x3DA:
+		cga_scanlineStatus();
 		return cga_regs[0xA]; //rand() & 0xF;
 	}
 	return cga_regs[port - 0x3D0]; //0xFF;
@@ -293,6 +466,7 @@ void cga_writememory(void* dummy, uint32_t addr, uint8_t value) {
 	if (addr >= 16384) return;
 
 	cga_RAM[addr] = value;
+	cga_dirty[addr >> CGA_DIRTY_SHIFT] = cga_dirtyGen;
 }
 
 uint8_t cga_readmemory(void* dummy, uint32_t addr) {
@@ -302,37 +476,105 @@ uint8_t cga_readmemory(void* dummy, uint32_t addr) {
 	return cga_RAM[addr];
 }
 
+//Bulk handlers, runs never leave a 4 KB page so they stay inside the 16 KB of video memory
+uint32_t cga_writeBlock(void* dummy, uint32_t addr, const uint8_t* src, uint32_t len) {
+	uint32_t i;
+
+	addr -= 0xB8000;
+	if ((addr + len) > 16384) return 0;
+	memcpy(&cga_RAM[addr], src, len);
+	for (i = addr >> CGA_DIRTY_SHIFT; i <= ((addr + len - 1) >> CGA_DIRTY_SHIFT); i++) {
+		cga_dirty[i] = cga_dirtyGen;
+	}
+	return len;
+}
+
+uint32_t cga_readBlock(void* dummy, uint32_t addr, uint8_t* dst, uint32_t len) {
+	addr -= 0xB8000;
+	if ((addr + len) > 16384) return 0;
+	memcpy(dst, &cga_RAM[addr], len);
+	return len;
+}
+
 void cga_blinkCallback(void* dummy) {
 	cga_cursor_blink_state ^= 1;
 }
 
-void cga_scanlineCallback(void* dummy) {
+void cga_scanlineStatus() {
 	/*
 		NOTE: We are only doing very approximate CGA timing. Breaking the horizontal scan into
 		four parts and setting the display inactive bit on 3DAh on the last quarter of it. Being
 		more precise shouldn't be necessary and will take much more host CPU time.
 
+		The position is worked out from the guest clock whenever 3DAh is read, instead of
+		stepping it from a timer tens of thousands of times a second.
+
 		TODO: Look into whether this is true? So far, things are working fine.
 	*/
-	static uint16_t scanline = 0, hpart = 0;
+	uint64_t quarter;
+	uint16_t scanline, hpart;
+
+	quarter = (uint64_t)((double)timing_getGuestCur() * (double)CGA_SCANLINE_RATE / (double)timing_getFreq());
+	hpart = (uint16_t)(quarter & 3);
+	scanline = (uint16_t)((quarter >> 2) & 255);
 
 	cga_regs[0xA] = 6; //light pen bits always high
 	cga_regs[0xA] |= (hpart == 3) ? 1 : 0;
 	cga_regs[0xA] |= (scanline >= 224) ? 8 : 0;
-	
-	hpart++;
-	if (hpart == 4) {
-		/*if (scanline < 200) {
-			cga_update(0, (scanline<<1), 639, (scanline<<1)+1);
-		}*/
-		hpart = 0;
-		scanline++;
+}
+
+//Writes the card's state into the snapshot section being saved
+void cga_saveState() {
+	snapshot_put(&cga_cursorloc, sizeof(cga_cursorloc));
+	snapshot_put(&cga_indexreg, sizeof(cga_indexreg));
+	snapshot_put(cga_datareg, sizeof(cga_datareg));
+	snapshot_put(cga_regs, sizeof(cga_regs));
+	snapshot_put(&cga_cursor_blink_state, sizeof(cga_cursor_blink_state));
+	snapshot_put(cga_RAM, 16384);
+}
+
+//Reads back what cga_saveState wrote and has the whole screen redrawn from it
+int cga_loadState() {
+	if (snapshot_get(&cga_cursorloc, sizeof(cga_cursorloc)) || snapshot_get(&cga_indexreg, sizeof(cga_indexreg)) ||
+		snapshot_get(cga_datareg, sizeof(cga_datareg)) || snapshot_get(cga_regs, sizeof(cga_regs)) ||
+		snapshot_get(&cga_cursor_blink_state, sizeof(cga_cursor_blink_state)) || snapshot_get(cga_RAM, 16384)) {
+		return -1;
 	}
-	if (scanline == 256) {
-		scanline = 0;
+	cga_invalidate();
+	return 0;
+}
+
+//Whether the render thread would find anything new to draw, the cursor is compared with where it was at the last call
+static uint8_t cga_changed() {
+	static uint16_t lastcursor = 0xFFFF;
+	static uint8_t lastblink = 0xFF;
+	uint16_t cursorloc;
+	uint32_t i;
+	uint8_t changed = 0;
+
+	cursorloc = ((uint16_t)cga_datareg[0xE] << 8) | (uint16_t)cga_datareg[0xF];
+	if ((cursorloc != lastcursor) || (cga_cursor_blink_state != lastblink) || (cga_allGen > cga_drawnGen)) {
+		changed = 1;
 	}
+	for (i = 0; !changed && (i < CGA_DIRTY_CHUNKS); i++) {
+		if (cga_dirty[i] > cga_drawnGen) changed = 1;
+	}
+	lastcursor = cursorloc;
+	lastblink = cga_cursor_blink_state;
+	return changed;
 }
 
 void cga_drawCallback(void* dummy) {
+	static uint32_t skipped = 0;
+
+	if (turbo && (++skipped < TURBO_FRAMEDIV)) {
+		metrics.cpu.framesSkipped++;
+		return;
+	}
+	skipped = 0;
+	if (!frameskip_draw(60, cga_changed())) {
+		return; //short of time
+	}
+	if (cga_doDraw) metrics.cpu.framesSkipped++; //the render thread hasn't got to the last one yet
 	cga_doDraw = 1;
 }
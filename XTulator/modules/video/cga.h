@@ -6,16 +6,26 @@
 
 extern const uint8_t cga_palette[16][3];
 
+typedef struct {
+	uint32_t key; //character, attribute << 8, hidden for the blink phase << 16
+	uint32_t rows[8][8];
+} CGAGLYPH_t;
+
 int cga_init();
-void cga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end_y);
+uint32_t cga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end_y, uint32_t since);
 void cga_writeport(void* dummy, uint16_t port, uint8_t value);
 uint8_t cga_readport(void* dummy, uint16_t port);
 void cga_blinkCallback(void* dummy);
-void cga_scanlineCallback(void* dummy);
+void cga_scanlineStatus();
 void cga_renderThread(void* cpu);
 void cga_writememory(void* dummy, uint32_t addr, uint8_t value);
 uint8_t cga_readmemory(void* dummy, uint32_t addr);
+uint32_t cga_writeBlock(void* dummy, uint32_t addr, const uint8_t* src, uint32_t len);
+uint32_t cga_readBlock(void* dummy, uint32_t addr, uint8_t* dst, uint32_t len);
 void cga_drawCallback(void* dummy);
+void cga_dumpCallback(void* dummy);
+void cga_saveState();
+int cga_loadState();
 
 //#define cga_color(c) ((uint32_t)cga_palette[c][0] | ((uint32_t)cga_palette[c][1]<<8) | ((uint32_t)cga_palette[c][2]<<16))
 #define cga_color(c) ((uint32_t)cga_palette[c][2] | ((uint32_t)cga_palette[c][1]<<8) | ((uint32_t)cga_palette[c][0]<<16))
@@ -45,4 +55,11 @@ void cga_drawCallback(void* dummy);
 #define CGA_MODE_GRAPHICS_LO				2
 #define CGA_MODE_GRAPHICS_HI				3
 
+#define CGA_SCANLINE_RATE					62800 //quarter scanlines per second, 15700 x 4
+
+#define CGA_DIRTY_SHIFT						6 //dirty tracking granularity, 64 byte chunks of video RAM
+#define CGA_DIRTY_CHUNKS					(16384 >> CGA_DIRTY_SHIFT)
+#define CGA_GLYPHS							512 //pre-rendered character/attribute pairs kept for text modes, power of two
+#define CGA_GLYPH_NONE						0xFFFFFFFF
+
 #endif
@@ -0,0 +1,119 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Adaptive frame skipping, so the emulation keeps its speed when the host
+	is short of time and the display gives way instead.
+
+	optimer hands frameskip_update the host time the CPU thread has spent
+	sleeping. Every FRAMESKIP_WINDOW ticks that's weighed up: a CPU thread
+	that is paced (by -speed or the guest clock) but hardly sleeps can't keep
+	up, and one that gets much less CPU time than it's awake for is being
+	crowded out by other threads. Either way only every frameskip_div'th
+	frame is drawn, one more at a time down to -minfps, and once things are
+	calm again for FRAMESKIP_CALM windows it goes back the other way.
+
+	The draw timers ask frameskip_draw before handing a frame to the render
+	thread. A change after a still screen is always drawn right away, so
+	typing at a prompt doesn't lag even when frames are being skipped.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../../config.h"
+#include "../../timing.h"
+#include "../../hostthread.h"
+#include "../../metrics.h"
+#include "frameskip.h"
+
+double frameskip_minFPS = FRAMESKIP_MINFPS; //-minfps, 0 when frames are never skipped for time
+volatile uint32_t frameskip_div = 1; //draw one frame in this many
+uint32_t frameskip_maxDiv = 1, frameskip_count = 0;
+uint8_t frameskip_still = 0; //the last frame had nothing new in it
+
+//the window being measured
+uint32_t frameskip_ticks = 0, frameskip_calm = 0;
+uint64_t frameskip_start = 0, frameskip_sleptStart;
+double frameskip_cpuStart;
+
+//optimer, on the CPU thread. slept is a running total of host ticks, paced is set when the CPU has a speed to keep up
+void frameskip_update(uint64_t slept, uint8_t paced) {
+	uint64_t now, wall, spent;
+	uint32_t threads;
+	double cpu, used, busy, freq;
+	uint8_t first, pressure;
+
+	if (frameskip_minFPS <= 0) return;
+	if (turbo) {
+		frameskip_div = 1; //fast-forward does its own skipping, start afresh afterwards
+		frameskip_start = 0;
+		return;
+	}
+	if ((frameskip_start != 0) && (++frameskip_ticks < FRAMESKIP_WINDOW)) return;
+
+	now = timing_getCur();
+	cpu = hostthread_cpuTime(HOSTTHREAD_CPU, &threads);
+	first = (frameskip_start == 0);
+	wall = now - frameskip_start;
+	spent = slept - frameskip_sleptStart;
+	used = cpu - frameskip_cpuStart;
+	frameskip_start = now;
+	frameskip_sleptStart = slept;
+	frameskip_cpuStart = cpu;
+	frameskip_ticks = 0;
+
+	freq = (double)timing_getFreq();
+	if (first || ((double)wall > ((2.0 * FRAMESKIP_WINDOW * freq) / 10.0))) {
+		return; //nothing to compare with yet, or paused or stopped by the host for a while, not a fair window
+	}
+	if (spent > wall) spent = wall;
+	busy = (double)(wall - spent) / freq;
+	pressure = (paced && ((double)spent < ((double)wall * FRAMESKIP_SLACK))) ||
+		((threads > 0) && (busy > 0) && (used < (busy * FRAMESKIP_MINSHARE)));
+
+	if (pressure) {
+		frameskip_calm = 0;
+		if (frameskip_div < frameskip_maxDiv) frameskip_div++;
+	}
+	else if ((frameskip_div > 1) && (++frameskip_calm >= FRAMESKIP_CALM)) {
+		frameskip_calm = 0;
+		frameskip_div--;
+	}
+}
+
+//Draw timers, on the CPU thread. Returns whether this frame goes to the render thread, changed says if anything on screen has
+uint8_t frameskip_draw(double fps, uint8_t changed) {
+	uint32_t div;
+
+	if (frameskip_minFPS <= 0) return 1;
+	frameskip_maxDiv = (fps > frameskip_minFPS) ? (uint32_t)(fps / frameskip_minFPS) : 1;
+	div = (frameskip_div < frameskip_maxDiv) ? frameskip_div : frameskip_maxDiv;
+	if (changed && frameskip_still) {
+		frameskip_still = 0;
+		frameskip_count = 0;
+		return 1;
+	}
+	if (!changed) frameskip_still = 1;
+	if ((div <= 1) || (++frameskip_count >= div)) {
+		frameskip_count = 0;
+		return 1;
+	}
+	metrics.cpu.framesSkipped++;
+	return 0;
+}
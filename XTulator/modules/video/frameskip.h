@@ -0,0 +1,18 @@
+#ifndef _FRAMESKIP_H_
+#define _FRAMESKIP_H_
+
+#include <stdint.h>
+
+#define FRAMESKIP_MINFPS	20 //default for -minfps, the lowest rate frames are drawn at while the CPU thread is short of time
+#define FRAMESKIP_WINDOW	5 //optimer ticks the CPU thread's time is judged over, Windows only counts thread time in scheduler quanta
+#define FRAMESKIP_SLACK		0.02 //a paced CPU thread sleeping less than this share of the time isn't keeping up
+#define FRAMESKIP_MINSHARE	0.8 //a CPU thread getting less than this share of the time it wants is being crowded out
+#define FRAMESKIP_CALM		2 //windows without pressure before frames are drawn more often again
+
+extern double frameskip_minFPS;
+extern volatile uint32_t frameskip_div;
+
+void frameskip_update(uint64_t slept, uint8_t paced);
+uint8_t frameskip_draw(double fps, uint8_t changed);
+
+#endif
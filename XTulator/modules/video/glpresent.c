@@ -0,0 +1,348 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Shader presenter, -gpu. Instead of SDL's renderer stretching a texture of
+	finished 32-bit pixels to a window the size of the mode, the frame goes to
+	an OpenGL 2.0 context as it was drawn and the shader does the rest.
+
+	VGA graphics modes hand over their palette indices at the mode's native
+	resolution, a byte per pixel with no doubling, along with the 256-entry
+	table they index. The shader looks every texel up in that table, so a
+	DAC write only uploads the table again. Text modes and CGA still send
+	32-bit pixels, they go through the same shader without the lookup.
+
+	Filtering is done by hand from four nearest taps, since indices can't be
+	interpolated. Integer scaling shows the mode at the largest whole multiple
+	of its displayed size that fits the window, pixel for pixel. Sharp scaling
+	fills the window at 4:3 the way a monitor would, blending only across the
+	edges between source pixels.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../config.h"
+
+#ifdef USE_GL_PRESENTER
+#include <SDL.h>
+#include <SDL_opengl.h>
+#include "glpresent.h"
+#include "../../debuglog.h"
+
+GLPRESENT_GL_t glpresent_gl;
+GLPRESENT_PROGRAM_t glpresent_rgb, glpresent_indexed;
+SDL_Window* glpresent_window = NULL;
+SDL_GLContext glpresent_context = NULL;
+GLuint glpresent_frame, glpresent_paletteTex;
+uint32_t glpresent_pal[256];
+int glpresent_texw = 0, glpresent_texh = 0;
+uint8_t glpresent_sharp = 0, glpresent_isIndexed = 0, glpresent_palValid = 0;
+
+static const GLfloat glpresent_quad[8] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+static const char* glpresent_vertexSource =
+	"attribute vec2 pos;\n"
+	"uniform vec2 size;\n"
+	"varying vec2 uv;\n"
+	"void main() {\n"
+	"	uv = vec2(pos.x + 1.0, 1.0 - pos.y) * 0.5 * size;\n" //in texels, with row 0 at the top
+	"	gl_Position = vec4(pos, 0.0, 1.0);\n"
+	"}\n";
+
+static const char* glpresent_fragmentSource =
+	"uniform sampler2D frame;\n"
+	"uniform sampler2D palette;\n"
+	"uniform vec2 size;\n"
+	"uniform vec2 scale;\n" //output pixels per texel, how hard the blend between two texels is squeezed toward their edge
+	"varying vec2 uv;\n"
+	"vec3 texel(vec2 p) {\n"
+	"	vec2 t = (p + 0.5) / size;\n"
+	"#ifdef INDEXED\n"
+	"	float i = texture2D(frame, t).r;\n"
+	"	return texture2D(palette, vec2((i * 255.0 + 0.5) / 256.0, 0.5)).rgb;\n"
+	"#else\n"
+	"	return texture2D(frame, t).rgb;\n"
+	"#endif\n"
+	"}\n"
+	"void main() {\n"
+	"	vec2 p = uv - 0.5;\n"
+	"	vec2 i = floor(p);\n"
+	"	vec2 f = clamp((p - i - 0.5) * scale + 0.5, 0.0, 1.0);\n"
+	"	vec3 top = mix(texel(i), texel(i + vec2(1.0, 0.0)), f.x);\n"
+	"	vec3 bottom = mix(texel(i + vec2(0.0, 1.0)), texel(i + vec2(1.0, 1.0)), f.x);\n"
+	"	gl_FragColor = vec4(mix(top, bottom, f.y), 1.0);\n"
+	"}\n";
+
+#define GLPRESENT_LOAD(fn) \
+	if ((*(void**)&glpresent_gl.fn = SDL_GL_GetProcAddress("gl" #fn)) == NULL) { \
+		debug_log(DEBUG_ERROR, "[GL] Missing gl" #fn "\r\n"); \
+		return -1; \
+	}
+
+int glpresent_load() {
+	GLPRESENT_LOAD(GetString);
+	GLPRESENT_LOAD(GetError);
+	GLPRESENT_LOAD(Viewport);
+	GLPRESENT_LOAD(ClearColor);
+	GLPRESENT_LOAD(Clear);
+	GLPRESENT_LOAD(PixelStorei);
+	GLPRESENT_LOAD(GenTextures);
+	GLPRESENT_LOAD(DeleteTextures);
+	GLPRESENT_LOAD(BindTexture);
+	GLPRESENT_LOAD(TexParameteri);
+	GLPRESENT_LOAD(TexImage2D);
+	GLPRESENT_LOAD(TexSubImage2D);
+	GLPRESENT_LOAD(DrawArrays);
+	GLPRESENT_LOAD(ActiveTexture);
+	GLPRESENT_LOAD(CreateShader);
+	GLPRESENT_LOAD(ShaderSource);
+	GLPRESENT_LOAD(CompileShader);
+	GLPRESENT_LOAD(GetShaderiv);
+	GLPRESENT_LOAD(GetShaderInfoLog);
+	GLPRESENT_LOAD(DeleteShader);
+	GLPRESENT_LOAD(CreateProgram);
+	GLPRESENT_LOAD(AttachShader);
+	GLPRESENT_LOAD(BindAttribLocation);
+	GLPRESENT_LOAD(LinkProgram);
+	GLPRESENT_LOAD(GetProgramiv);
+	GLPRESENT_LOAD(GetProgramInfoLog);
+	GLPRESENT_LOAD(DeleteProgram);
+	GLPRESENT_LOAD(UseProgram);
+	GLPRESENT_LOAD(GetUniformLocation);
+	GLPRESENT_LOAD(Uniform1i);
+	GLPRESENT_LOAD(Uniform2f);
+	GLPRESENT_LOAD(VertexAttribPointer);
+	GLPRESENT_LOAD(EnableVertexAttribArray);
+	return 0;
+}
+
+GLuint glpresent_shader(GLenum type, const char* defines, const char* source) {
+	const GLchar* parts[3];
+	GLchar log[1024];
+	GLuint shader;
+	GLint ok;
+
+	parts[0] = "#version 110\n";
+	parts[1] = defines;
+	parts[2] = source;
+	shader = glpresent_gl.CreateShader(type);
+	if (shader == 0) return 0;
+	glpresent_gl.ShaderSource(shader, 3, parts, NULL);
+	glpresent_gl.CompileShader(shader);
+	glpresent_gl.GetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		glpresent_gl.GetShaderInfoLog(shader, sizeof(log), NULL, log);
+		debug_log(DEBUG_ERROR, "[GL] Shader didn't compile: %s\r\n", log);
+		glpresent_gl.DeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+int glpresent_program(GLPRESENT_PROGRAM_t* prog, const char* defines) {
+	GLchar log[1024];
+	GLuint vertex, fragment;
+	GLint ok;
+
+	vertex = glpresent_shader(GL_VERTEX_SHADER, "", glpresent_vertexSource);
+	fragment = glpresent_shader(GL_FRAGMENT_SHADER, defines, glpresent_fragmentSource);
+	if ((vertex == 0) || (fragment == 0)) return -1;
+
+	prog->program = glpresent_gl.CreateProgram();
+	glpresent_gl.AttachShader(prog->program, vertex);
+	glpresent_gl.AttachShader(prog->program, fragment);
+	glpresent_gl.BindAttribLocation(prog->program, 0, "pos");
+	glpresent_gl.LinkProgram(prog->program);
+	glpresent_gl.DeleteShader(vertex); //only flagged, they go once the program does
+	glpresent_gl.DeleteShader(fragment);
+	glpresent_gl.GetProgramiv(prog->program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		glpresent_gl.GetProgramInfoLog(prog->program, sizeof(log), NULL, log);
+		debug_log(DEBUG_ERROR, "[GL] Shader program didn't link: %s\r\n", log);
+		return -1;
+	}
+
+	prog->frame = glpresent_gl.GetUniformLocation(prog->program, "frame");
+	prog->palette = glpresent_gl.GetUniformLocation(prog->program, "palette");
+	prog->size = glpresent_gl.GetUniformLocation(prog->program, "size");
+	prog->scale = glpresent_gl.GetUniformLocation(prog->program, "scale");
+	glpresent_gl.UseProgram(prog->program);
+	glpresent_gl.Uniform1i(prog->frame, 0); //texture units, they never change
+	glpresent_gl.Uniform1i(prog->palette, 1);
+	return 0;
+}
+
+void glpresent_texParams() {
+	glpresent_gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glpresent_gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glpresent_gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glpresent_gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+//Creates a GL context for window on the calling thread, which is the only one that may present with it afterwards
+int glpresent_init(SDL_Window* window, uint8_t sharp) {
+	const char* version;
+
+	glpresent_context = SDL_GL_CreateContext(window);
+	if (glpresent_context == NULL) {
+		debug_log(DEBUG_ERROR, "[GL] Unable to create an OpenGL context: %s\r\n", SDL_GetError());
+		return -1;
+	}
+	if (glpresent_load()) goto fail;
+	version = (const char*)glpresent_gl.GetString(GL_VERSION);
+	if ((version == NULL) || (atoi(version) < 2)) { //lookups can succeed for functions a driver doesn't really have
+		debug_log(DEBUG_ERROR, "[GL] OpenGL 2.0 is required, the driver has %s\r\n", (version == NULL) ? "none" : version);
+		goto fail;
+	}
+	debug_log(DEBUG_INFO, "[GL] OpenGL %s, %s\r\n", version, (const char*)glpresent_gl.GetString(GL_RENDERER));
+
+	if (glpresent_program(&glpresent_rgb, "") || glpresent_program(&glpresent_indexed, "#define INDEXED\n")) goto fail;
+
+	glpresent_gl.GenTextures(1, &glpresent_frame);
+	glpresent_gl.GenTextures(1, &glpresent_paletteTex);
+	glpresent_gl.ActiveTexture(GL_TEXTURE1);
+	glpresent_gl.BindTexture(GL_TEXTURE_2D, glpresent_paletteTex);
+	glpresent_texParams();
+	glpresent_gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+	glpresent_gl.ActiveTexture(GL_TEXTURE0);
+	glpresent_gl.BindTexture(GL_TEXTURE_2D, glpresent_frame);
+	glpresent_texParams();
+	glpresent_gl.PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	glpresent_gl.VertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, glpresent_quad);
+	glpresent_gl.EnableVertexAttribArray(0);
+	glpresent_gl.ClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	if (glpresent_gl.GetError() != GL_NO_ERROR) {
+		debug_log(DEBUG_ERROR, "[GL] Unable to set up the presenter's textures\r\n");
+		goto fail;
+	}
+
+	SDL_GL_SetSwapInterval(0); //sdlconsole paces presents itself, waiting on vsync would hold up the render thread
+	glpresent_window = window;
+	glpresent_sharp = sharp;
+	glpresent_texw = glpresent_texh = 0;
+	glpresent_palValid = 0;
+	return 0;
+
+fail:
+	SDL_GL_DeleteContext(glpresent_context); //takes the programs and textures with it
+	glpresent_context = NULL;
+	return -1;
+}
+
+/*
+	Copies the given areas of a frame into the frame texture, recreating it
+	with the whole frame when the size or kind of pixels has changed. Indexed
+	frames are a byte per pixel, anything else is 32-bit host pixels. Returns
+	1 if anything was uploaded.
+*/
+uint8_t glpresent_upload(const void* pixels, int w, int h, int stride, uint8_t indexed, SDL_Rect* rects, int count) {
+	SDL_Rect full;
+	GLenum format, type;
+	int i, bpp;
+	uint8_t uploaded = 0;
+
+	bpp = indexed ? 1 : 4;
+	format = indexed ? GL_LUMINANCE : GL_BGRA;
+	type = indexed ? GL_UNSIGNED_BYTE : GL_UNSIGNED_INT_8_8_8_8_REV;
+	if ((w != glpresent_texw) || (h != glpresent_texh) || (indexed != glpresent_isIndexed)) {
+		glpresent_gl.TexImage2D(GL_TEXTURE_2D, 0, indexed ? GL_LUMINANCE8 : GL_RGBA8, w, h, 0, format, type, NULL);
+		glpresent_texw = w;
+		glpresent_texh = h;
+		glpresent_isIndexed = indexed;
+		full.x = 0;
+		full.y = 0;
+		full.w = w;
+		full.h = h;
+		rects = &full;
+		count = 1;
+	}
+
+	glpresent_gl.PixelStorei(GL_UNPACK_ROW_LENGTH, stride / bpp);
+	for (i = 0; i < count; i++) {
+		SDL_Rect rect = rects[i];
+		if ((rect.x + rect.w) > w) rect.w = w - rect.x;
+		if ((rect.y + rect.h) > h) rect.h = h - rect.y;
+		if ((rect.w <= 0) || (rect.h <= 0)) continue;
+		glpresent_gl.TexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, format, type,
+			(const uint8_t*)pixels + ((size_t)rect.y * stride) + ((size_t)rect.x * bpp));
+		uploaded = 1;
+	}
+	glpresent_gl.PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	return uploaded;
+}
+
+//What indexed frames' bytes stand for, as 32-bit host pixels. Returns 1 if it differed from the last one
+uint8_t glpresent_palette(const uint32_t* palette) {
+	if (glpresent_palValid && !memcmp(palette, glpresent_pal, sizeof(glpresent_pal))) return 0;
+	memcpy(glpresent_pal, palette, sizeof(glpresent_pal));
+	glpresent_palValid = 1;
+	glpresent_gl.ActiveTexture(GL_TEXTURE1);
+	glpresent_gl.TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, glpresent_pal);
+	glpresent_gl.ActiveTexture(GL_TEXTURE0);
+	return 1;
+}
+
+//Draws the frame texture to the window and swaps, dispw by disph being the size the mode is meant to be seen at
+void glpresent_draw(int dispw, int disph) {
+	GLPRESENT_PROGRAM_t* prog;
+	GLfloat scalex, scaley;
+	int ww, wh, outw, outh, k;
+
+	SDL_GL_GetDrawableSize(glpresent_window, &ww, &wh);
+	glpresent_gl.Viewport(0, 0, ww, wh);
+	glpresent_gl.Clear(GL_COLOR_BUFFER_BIT);
+	if ((glpresent_texw == 0) || (dispw <= 0) || (disph <= 0) || (ww <= 0) || (wh <= 0)) {
+		SDL_GL_SwapWindow(glpresent_window);
+		return;
+	}
+
+	k = (ww / dispw < wh / disph) ? ww / dispw : wh / disph;
+	if (!glpresent_sharp && (k >= 1)) {
+		outw = dispw * k;
+		outh = disph * k;
+		scalex = scaley = GLPRESENT_NEAREST;
+	} else { //sharp, or a window too small for the mode even once, which shrinks it the same way
+		if (glpresent_sharp) {
+			dispw = GLPRESENT_ASPECTW;
+			disph = GLPRESENT_ASPECTH;
+		}
+		outw = ww;
+		outh = (int)(((int64_t)ww * disph) / dispw);
+		if (outh > wh) {
+			outh = wh;
+			outw = (int)(((int64_t)wh * dispw) / disph);
+		}
+		scalex = (GLfloat)outw / (GLfloat)glpresent_texw;
+		scaley = (GLfloat)outh / (GLfloat)glpresent_texh;
+		if (scalex < 1.0f) scalex = 1.0f; //shrinking, plain bilinear
+		if (scaley < 1.0f) scaley = 1.0f;
+	}
+
+	prog = glpresent_isIndexed ? &glpresent_indexed : &glpresent_rgb;
+	glpresent_gl.Viewport((ww - outw) / 2, (wh - outh) / 2, outw, outh);
+	glpresent_gl.UseProgram(prog->program);
+	glpresent_gl.Uniform2f(prog->size, (GLfloat)glpresent_texw, (GLfloat)glpresent_texh);
+	glpresent_gl.Uniform2f(prog->scale, scalex, scaley);
+	glpresent_gl.DrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	SDL_GL_SwapWindow(glpresent_window);
+}
+#endif
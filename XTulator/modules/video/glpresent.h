@@ -0,0 +1,62 @@
+#ifndef _GLPRESENT_H_
+#define _GLPRESENT_H_
+
+#include "../../config.h"
+
+#ifdef USE_GL_PRESENTER
+#include <stdint.h>
+#include <SDL.h>
+#include <SDL_opengl.h>
+
+#define GLPRESENT_ASPECTW	4 //shape of the picture a CRT makes of every mode when sharp scaling
+#define GLPRESENT_ASPECTH	3
+#define GLPRESENT_NEAREST	65536.0f //sharpness that turns the shader's filter into nearest neighbor, for integer scaling
+
+typedef struct {
+	const GLubyte* (APIENTRY *GetString)(GLenum name);
+	GLenum (APIENTRY *GetError)(void);
+	void (APIENTRY *Viewport)(GLint x, GLint y, GLsizei w, GLsizei h);
+	void (APIENTRY *ClearColor)(GLclampf r, GLclampf g, GLclampf b, GLclampf a);
+	void (APIENTRY *Clear)(GLbitfield mask);
+	void (APIENTRY *PixelStorei)(GLenum pname, GLint param);
+	void (APIENTRY *GenTextures)(GLsizei n, GLuint* textures);
+	void (APIENTRY *DeleteTextures)(GLsizei n, const GLuint* textures);
+	void (APIENTRY *BindTexture)(GLenum target, GLuint texture);
+	void (APIENTRY *TexParameteri)(GLenum target, GLenum pname, GLint param);
+	void (APIENTRY *TexImage2D)(GLenum target, GLint level, GLint internalformat, GLsizei w, GLsizei h, GLint border, GLenum format, GLenum type, const void* pixels);
+	void (APIENTRY *TexSubImage2D)(GLenum target, GLint level, GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type, const void* pixels);
+	void (APIENTRY *DrawArrays)(GLenum mode, GLint first, GLsizei count);
+	void (APIENTRY *ActiveTexture)(GLenum texture);
+	GLuint (APIENTRY *CreateShader)(GLenum type);
+	void (APIENTRY *ShaderSource)(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length);
+	void (APIENTRY *CompileShader)(GLuint shader);
+	void (APIENTRY *GetShaderiv)(GLuint shader, GLenum pname, GLint* params);
+	void (APIENTRY *GetShaderInfoLog)(GLuint shader, GLsizei size, GLsizei* length, GLchar* log);
+	void (APIENTRY *DeleteShader)(GLuint shader);
+	GLuint (APIENTRY *CreateProgram)(void);
+	void (APIENTRY *AttachShader)(GLuint program, GLuint shader);
+	void (APIENTRY *BindAttribLocation)(GLuint program, GLuint index, const GLchar* name);
+	void (APIENTRY *LinkProgram)(GLuint program);
+	void (APIENTRY *GetProgramiv)(GLuint program, GLenum pname, GLint* params);
+	void (APIENTRY *GetProgramInfoLog)(GLuint program, GLsizei size, GLsizei* length, GLchar* log);
+	void (APIENTRY *DeleteProgram)(GLuint program);
+	void (APIENTRY *UseProgram)(GLuint program);
+	GLint (APIENTRY *GetUniformLocation)(GLuint program, const GLchar* name);
+	void (APIENTRY *Uniform1i)(GLint location, GLint v0);
+	void (APIENTRY *Uniform2f)(GLint location, GLfloat v0, GLfloat v1);
+	void (APIENTRY *VertexAttribPointer)(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+	void (APIENTRY *EnableVertexAttribArray)(GLuint index);
+} GLPRESENT_GL_t; //everything is looked up through SDL, so there's no OpenGL library to link against
+
+typedef struct {
+	GLuint program;
+	GLint frame, palette, size, scale; //uniform locations
+} GLPRESENT_PROGRAM_t;
+
+int glpresent_init(SDL_Window* window, uint8_t sharp);
+uint8_t glpresent_upload(const void* pixels, int w, int h, int stride, uint8_t indexed, SDL_Rect* rects, int count);
+uint8_t glpresent_palette(const uint32_t* palette);
+void glpresent_draw(int dispw, int disph);
+#endif
+
+#endif
@@ -28,19 +28,31 @@
 #endif
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include "sdlconsole.h"
+#include "glpresent.h"
 #include "../input/sdlkeys.h"
 #include "../input/mouse.h"
 #include "../../timing.h"
 #include "../../menus.h"
+#include "../../debuglog.h"
+#include "../../metrics.h"
 
 SDL_Window *sdlconsole_window = NULL;
 SDL_Renderer *sdlconsole_renderer = NULL;
 SDL_Texture *sdlconsole_texture = NULL;
 
-uint64_t sdlconsole_frameTime[30];
-uint32_t sdlconsole_keyTimer;
-uint8_t sdlconsole_curkey, sdlconsole_lastKey, sdlconsole_frameIdx = 0, sdlconsole_grabbed = 0, sdlconsole_ctrl = 0, sdlconsole_alt = 0, sdlconsole_doRepeat = 0;
+uint64_t sdlconsole_lastPresent = 0, sdlconsole_presentCost = 0, sdlconsole_fpsStart = 0;
+uint32_t sdlconsole_keyTimer, sdlconsole_frames = 0;
+uint8_t sdlconsole_presentPending = 0;
+volatile uint8_t sdlconsole_redraw = 0; //the window was resized or uncovered, present again even if nothing changed
+uint8_t sdlconsole_gpu = SDLCONSOLE_GPU_OFF, sdlconsole_attached = 0;
+
+SDLCONSOLE_INPUT_t sdlconsole_queue[SDLCONSOLE_QUEUESIZE];
+SDL_atomic_t sdlconsole_qhead, sdlconsole_qtail;
+SDL_SpinLock sdlconsole_qlock = 0; //the VNC server thread queues input too
+uint16_t sdlconsole_menuCommand = 0;
+uint8_t sdlconsole_curkey, sdlconsole_lastKey, sdlconsole_grabbed = 0, sdlconsole_ctrl = 0, sdlconsole_alt = 0, sdlconsole_doRepeat = 0;
 int sdlconsole_curw, sdlconsole_curh;
 
 char* sdlconsole_title;
@@ -59,19 +71,18 @@ int sdlconsole_init(char *title) {
 	if (SDL_Init(SDL_INIT_VIDEO)) return -1;
 
 	sdlconsole_title = title;
+	sdlconsole_initInput();
 
 	sdlconsole_window = SDL_CreateWindow(sdlconsole_title,
 		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-		640, 400,
-		SDL_WINDOW_OPENGL);
+		sdlconsole_gpu ? SDLCONSOLE_GPUW : 640, sdlconsole_gpu ? SDLCONSOLE_GPUH : 400,
+		sdlconsole_gpu ? (SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE) : SDL_WINDOW_OPENGL);
 	if (sdlconsole_window == NULL) return -1;
 
-	if (sdlconsole_setWindow(640, 400)) {
+	if (!sdlconsole_gpu && sdlconsole_setWindow(640, 400)) { //the shader presenter starts on the render thread, sdlconsole_attach
 		return -1;
 	}
 
-	sdlconsole_keyTimer = timing_addTimer(sdlconsole_keyRepeat, NULL, 2, TIMING_DISABLED);
-
 #ifdef _WIN32
 	SDL_VERSION(&wmInfo.version);
 	SDL_GetWindowWMInfo(sdlconsole_window, &wmInfo);
@@ -82,6 +93,32 @@ int sdlconsole_init(char *title) {
 	return 0;
 }
 
+//Called by a render thread before its first frame. The shader presenter's GL context belongs to the thread that creates it.
+void sdlconsole_attach() {
+#ifdef USE_GL_PRESENTER
+	if (!sdlconsole_gpu || (sdlconsole_window == NULL)) return;
+	if (glpresent_init(sdlconsole_window, sdlconsole_gpu == SDLCONSOLE_GPU_SHARP)) {
+		debug_log(DEBUG_ERROR, "[GL] Unable to start the shader presenter, using SDL's renderer instead\r\n");
+		sdlconsole_gpu = SDLCONSOLE_GPU_OFF;
+		sdlconsole_curw = sdlconsole_curh = 0; //the next blit creates the renderer
+		return;
+	}
+	sdlconsole_attached = 1;
+#endif
+}
+
+//Whether the render thread can hand over palette indices rather than finished pixels
+uint8_t sdlconsole_indexed() {
+	return sdlconsole_gpu && sdlconsole_attached;
+}
+
+//The input queue and key repeat, without a window. Headless mode with -vnc uses them on their own.
+void sdlconsole_initInput() {
+	SDL_AtomicSet(&sdlconsole_qhead, 0);
+	SDL_AtomicSet(&sdlconsole_qtail, 0);
+	sdlconsole_keyTimer = timing_addTimer(sdlconsole_keyRepeat, NULL, 2, TIMING_DISABLED);
+}
+
 int sdlconsole_setWindow(int w, int h) {
 	if (sdlconsole_renderer != NULL) SDL_DestroyRenderer(sdlconsole_renderer);
 	if (sdlconsole_texture != NULL) SDL_DestroyTexture(sdlconsole_texture);
@@ -110,40 +147,146 @@ void sdlconsole_setTitle(char* title) { //appends something to the main title, d
 	SDL_SetWindowTitle(sdlconsole_window, tmp);
 }
 
+void sdlconsole_upload(uint32_t* pixels, int stride, SDL_Rect* rect) {
+	void* dst;
+	uint8_t* src;
+	int pitch, y;
+
+	src = (uint8_t*)pixels + ((size_t)rect->y * stride) + ((size_t)rect->x * sizeof(uint32_t));
+	if (SDL_LockTexture(sdlconsole_texture, rect, &dst, &pitch)) {
+		SDL_UpdateTexture(sdlconsole_texture, rect, src, stride);
+		return;
+	}
+	for (y = 0; y < rect->h; y++) {
+		memcpy((uint8_t*)dst + ((size_t)y * pitch), src + ((size_t)y * stride), rect->w * sizeof(uint32_t));
+	}
+	SDL_UnlockTexture(sdlconsole_texture);
+}
+
+void sdlconsole_updateFPS(uint64_t curtime) {
+	static uint64_t lastSkipped = 0;
+	uint64_t skipped;
+	char tmp[64];
+
+	sdlconsole_frames++;
+	if (sdlconsole_fpsStart == 0) {
+		sdlconsole_fpsStart = curtime;
+	} else if ((curtime - sdlconsole_fpsStart) >= timing_getFreq()) { //refresh the title about once a second
+		skipped = metrics.cpu.framesSkipped - lastSkipped;
+		lastSkipped += skipped;
+		if (skipped > 0) {
+			sprintf(tmp, "%.2f FPS, %llu skipped", (double)sdlconsole_frames * (double)timing_getFreq() / (double)(curtime - sdlconsole_fpsStart), (unsigned long long)skipped);
+		}
+		else {
+			sprintf(tmp, "%.2f FPS", (double)sdlconsole_frames * (double)timing_getFreq() / (double)(curtime - sdlconsole_fpsStart));
+		}
+		sdlconsole_setTitle(tmp);
+		sdlconsole_frames = 0;
+		sdlconsole_fpsStart = curtime;
+	}
+}
+
+//Whether to present now, see sdlconsole_blitRects. Sets curtime if so.
+uint8_t sdlconsole_presentDue(uint64_t* curtime) {
+	if (sdlconsole_redraw) {
+		sdlconsole_redraw = 0;
+		sdlconsole_presentPending = 1;
+	}
+	if (!sdlconsole_presentPending) return 0;
+
+	*curtime = timing_getCur();
+	return (*curtime - sdlconsole_lastPresent) >= (sdlconsole_presentCost * 2);
+}
+
+void sdlconsole_presented(uint64_t curtime) {
+	uint64_t donetime;
+
+	sdlconsole_presentPending = 0;
+	metrics.render.framesPresented++;
+
+	donetime = timing_getCur();
+	sdlconsole_presentCost = (sdlconsole_presentCost * 7 + (donetime - curtime)) / 8; //running average
+	sdlconsole_lastPresent = curtime;
+	sdlconsole_updateFPS(curtime);
+}
+
 void sdlconsole_blit(uint32_t *pixels, int w, int h, int stride) {
-	static uint64_t lasttime = 0;
+	SDL_Rect rect;
+
+	rect.x = 0;
+	rect.y = 0;
+	rect.w = w;
+	rect.h = h;
+	sdlconsole_blitRects(pixels, w, h, stride, &rect, 1);
+}
+
+/*
+	Uploads the given areas of the frame into the streaming texture and presents
+	it. If presenting has been taking more than half of the time between frames
+	(remote desktop sessions, software renderers) the present is held back until
+	enough time has passed, so the caller isn't stalled by it. The texture still
+	receives every update, and a call with no areas will present anything that
+	was held back. With -gpu the same goes for the shader presenter's texture.
+*/
+void sdlconsole_blitRects(uint32_t* pixels, int w, int h, int stride, SDL_Rect* rects, int count) {
+	SDL_Rect full;
 	uint64_t curtime;
-	curtime = timing_getCur();
+	int i;
+
+#ifdef USE_GL_PRESENTER
+	if (sdlconsole_gpu) {
+		if (!sdlconsole_attached) return; //nothing to draw with until the render thread starts the presenter
+		if (glpresent_upload(pixels, w, h, stride, 0, rects, count)) sdlconsole_presentPending = 1;
+		if (!sdlconsole_presentDue(&curtime)) return;
+		glpresent_draw(w, h);
+		sdlconsole_presented(curtime);
+		return;
+	}
+#endif
 
 	if ((w != sdlconsole_curw) || (h != sdlconsole_curh)) {
-		sdlconsole_setWindow(w, h);
+		if (sdlconsole_setWindow(w, h)) return;
+		full.x = 0; //new texture, needs the whole frame
+		full.y = 0;
+		full.w = w;
+		full.h = h;
+		rects = &full;
+		count = 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		SDL_Rect rect = rects[i];
+		if ((rect.x + rect.w) > w) rect.w = w - rect.x;
+		if ((rect.y + rect.h) > h) rect.h = h - rect.y;
+		if ((rect.w <= 0) || (rect.h <= 0)) continue;
+		sdlconsole_upload(pixels, stride, &rect);
+		sdlconsole_presentPending = 1;
 	}
-	SDL_UpdateTexture(sdlconsole_texture, NULL, pixels, stride);
+	if (!sdlconsole_presentDue(&curtime)) return;
+
 	SDL_RenderClear(sdlconsole_renderer);
 	SDL_RenderCopy(sdlconsole_renderer, sdlconsole_texture, NULL, NULL);
 	SDL_RenderPresent(sdlconsole_renderer);
+	sdlconsole_presented(curtime);
+}
 
-	if (lasttime != 0) {
-		int i, avgcount;
-		uint64_t curavg;
-		char tmp[64];
-		sdlconsole_frameTime[sdlconsole_frameIdx++] = curtime - lasttime;
-		if (sdlconsole_frameIdx == 30) {
-			sdlconsole_frameIdx = 0;
-			avgcount = 0;
-			curavg = 0;
-			for (i = 0; i < 30; i++) {
-				if (sdlconsole_frameTime[i] != 0) {
-					curavg += sdlconsole_frameTime[i];
-					avgcount++;
-				}
-			}
-			curavg /= avgcount;
-			sprintf(tmp, "%.2f FPS", (double)((timing_getFreq() * 10) / curavg) / 10);
-			sdlconsole_setTitle(tmp);
-		}
-	}
-	lasttime = curtime;
+/*
+	sdlconsole_blitRects for a frame of palette indices at the mode's native
+	resolution, with the 256 host pixels they stand for. dispw by disph is
+	the size the mode is shown at, which the shader presenter scales from.
+	Only valid once sdlconsole_indexed says so.
+*/
+void sdlconsole_blitIndexed(uint8_t* pixels, int w, int h, int stride, int dispw, int disph, const uint32_t* palette, SDL_Rect* rects, int count) {
+#ifdef USE_GL_PRESENTER
+	uint64_t curtime;
+
+	if (glpresent_palette(palette)) sdlconsole_presentPending = 1;
+	if (glpresent_upload(pixels, w, h, stride, 1, rects, count)) sdlconsole_presentPending = 1;
+	if (!sdlconsole_presentDue(&curtime)) return;
+
+	glpresent_draw(dispw, disph);
+	sdlconsole_presented(curtime);
+#endif
 }
 
 void sdlconsole_mousegrab() {
@@ -157,67 +300,90 @@ void sdlconsole_mousegrab() {
 	}
 }
 
-int sdlconsole_loop() {
+/*
+	Input handling is split in two. sdlconsole_pump runs on the thread that owns
+	the window (the main thread), translates SDL events and queues them in a
+	single producer/single consumer ring. sdlconsole_loop is called by the CPU
+	thread and hands back one queued event at a time, so keyboard and mouse
+	state are only ever touched between instructions. The VNC server is a
+	second producer, so producers take sdlconsole_qlock.
+*/
+void sdlconsole_queueInput(uint8_t type, uint16_t code, uint8_t state, int8_t xrel, int8_t yrel) {
+	SDLCONSOLE_INPUT_t* input;
+	uint32_t head;
+
+	SDL_AtomicLock(&sdlconsole_qlock);
+	head = (uint32_t)SDL_AtomicGet(&sdlconsole_qhead);
+	if ((head - (uint32_t)SDL_AtomicGet(&sdlconsole_qtail)) >= SDLCONSOLE_QUEUESIZE) {
+		SDL_AtomicUnlock(&sdlconsole_qlock);
+		return; //CPU thread isn't draining, drop it
+	}
+	input = &sdlconsole_queue[head & (SDLCONSOLE_QUEUESIZE - 1)];
+	input->type = type;
+	input->code = code;
+	input->state = state;
+	input->xrel = xrel;
+	input->yrel = yrel;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&sdlconsole_qhead, (int)(head + 1));
+	SDL_AtomicUnlock(&sdlconsole_qlock);
+}
+
+//Waits up to timeout ms for SDL events and queues everything pending for the CPU thread
+void sdlconsole_pump(uint32_t timeout) {
 	SDL_Event event;
 	int8_t xrel, yrel;
-	uint8_t action = 0;
-
-	if (sdlconsole_doRepeat) {
-		sdlconsole_doRepeat = 0;
-		sdlconsole_curkey = sdlconsole_lastKey;
-		return SDLCONSOLE_EVENT_KEY;
-	}
+	uint8_t action, key;
 
-	if (!SDL_PollEvent(&event)) return SDLCONSOLE_EVENT_NONE;
-	switch (event.type) {
+	if (!SDL_WaitEventTimeout(&event, (int)timeout)) return;
+	do {
+		switch (event.type) {
 		case SDL_KEYDOWN:
-#ifdef DEBUG_VGA
-			if (event.key.keysym.sym == SDLK_F12) {
-				vga_dumpregs();
-			}
-#endif
-			if (event.key.repeat) return SDLCONSOLE_EVENT_NONE;
+			if (event.key.repeat) break;
 			switch (event.key.keysym.sym) {
+			case SDLK_F10:
+				sdlconsole_queueInput(SDLCONSOLE_EVENT_TURBO, 0, 0, 0, 0);
+				break;
 			case SDLK_F11:
-				return SDLCONSOLE_EVENT_DEBUG_1;
+				sdlconsole_queueInput(SDLCONSOLE_EVENT_DEBUG_1, 0, 0, 0, 0);
+				break;
 			case SDLK_F12:
-				return SDLCONSOLE_EVENT_DEBUG_2;
+				sdlconsole_queueInput(SDLCONSOLE_EVENT_DEBUG_2, 0, 0, 0, 0);
+				break;
 			default:
 				if (event.key.keysym.sym == SDLK_LCTRL) sdlconsole_ctrl = 1;
 				if (event.key.keysym.sym == SDLK_LALT) sdlconsole_alt = 1;
 				if (sdlconsole_ctrl & sdlconsole_alt) {
 					sdlconsole_mousegrab();
 				}
-				sdlconsole_curkey = sdlconsole_translateScancode(event.key.keysym.sym);
-				if (sdlconsole_curkey == 0x00) {
-					return SDLCONSOLE_EVENT_NONE;
-				} else {
-					sdlconsole_lastKey = sdlconsole_curkey;
-					timing_updateIntervalFreq(sdlconsole_keyTimer, 2);
-					timing_timerEnable(sdlconsole_keyTimer);
-					return SDLCONSOLE_EVENT_KEY;
+				key = sdlconsole_translateScancode(event.key.keysym.sym);
+				if (key != 0x00) {
+					sdlconsole_queueInput(SDLCONSOLE_EVENT_KEY, key, 0, 0, 0);
 				}
+				break;
 			}
+			break;
 		case SDL_KEYUP:
-			if (event.key.repeat) return SDLCONSOLE_EVENT_NONE;
+			if (event.key.repeat) break;
 			if (event.key.keysym.sym == SDLK_LCTRL) sdlconsole_ctrl = 0;
 			if (event.key.keysym.sym == SDLK_LALT) sdlconsole_alt = 0;
-			sdlconsole_curkey = sdlconsole_translateScancode(event.key.keysym.sym) | 0x80;
-			if ((sdlconsole_curkey & 0x7F) == sdlconsole_lastKey) {
-				timing_timerDisable(sdlconsole_keyTimer);
+			key = sdlconsole_translateScancode(event.key.keysym.sym);
+			if (key != 0x00) {
+				sdlconsole_queueInput(SDLCONSOLE_EVENT_KEY, key | 0x80, 0, 0, 0);
 			}
-			return (sdlconsole_curkey == 0x80) ? SDLCONSOLE_EVENT_NONE : SDLCONSOLE_EVENT_KEY;
+			break;
 		case SDL_MOUSEMOTION:
 			xrel = (event.motion.xrel < -128) ? -128 : (int8_t)event.motion.xrel;
 			xrel = (event.motion.xrel > 127) ? 127 : (int8_t)event.motion.xrel;
 			yrel = (event.motion.yrel < -128) ? -128 : (int8_t)event.motion.yrel;
 			yrel = (event.motion.yrel > 127) ? 127 : (int8_t)event.motion.yrel;
 			if (sdlconsole_grabbed) {
-				mouse_action(MOUSE_ACTION_MOVE, MOUSE_NEITHER, xrel, yrel);
+				sdlconsole_queueInput(SDLCONSOLE_EVENT_MOUSE, MOUSE_ACTION_MOVE, MOUSE_NEITHER, xrel, yrel);
 			}
-			return SDLCONSOLE_EVENT_NONE;
+			break;
 		case SDL_MOUSEBUTTONDOWN:
 		case SDL_MOUSEBUTTONUP:
+			action = 0;
 			if (event.button.button == SDL_BUTTON_LEFT) {
 				action = MOUSE_ACTION_LEFT;
 				if (!sdlconsole_grabbed) {
@@ -229,13 +395,63 @@ int sdlconsole_loop() {
 				action = MOUSE_ACTION_RIGHT;
 			}
 			if (sdlconsole_grabbed) {
-				mouse_action(action, (event.button.state == SDL_PRESSED) ? MOUSE_PRESSED : MOUSE_UNPRESSED, 0, 0);
+				sdlconsole_queueInput(SDLCONSOLE_EVENT_MOUSE, action, (event.button.state == SDL_PRESSED) ? MOUSE_PRESSED : MOUSE_UNPRESSED, 0, 0);
+			}
+			break;
+		case SDL_WINDOWEVENT:
+			if ((event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) || (event.window.event == SDL_WINDOWEVENT_EXPOSED)) {
+				sdlconsole_redraw = 1;
 			}
-			return SDLCONSOLE_EVENT_NONE;
+			break;
 		case SDL_QUIT:
-			return SDLCONSOLE_EVENT_QUIT;
+			sdlconsole_queueInput(SDLCONSOLE_EVENT_QUIT, 0, 0, 0, 0);
+			break;
+		}
+	} while (SDL_PollEvent(&event));
+}
+
+//CPU thread side, returns the type of the next queued input event or SDLCONSOLE_EVENT_NONE
+int sdlconsole_loop() {
+	SDLCONSOLE_INPUT_t input;
+	uint32_t tail;
+
+	if (sdlconsole_doRepeat) {
+		sdlconsole_doRepeat = 0;
+		sdlconsole_curkey = sdlconsole_lastKey;
+		return SDLCONSOLE_EVENT_KEY;
+	}
+
+	tail = (uint32_t)SDL_AtomicGet(&sdlconsole_qtail);
+	if (tail == (uint32_t)SDL_AtomicGet(&sdlconsole_qhead)) return SDLCONSOLE_EVENT_NONE;
+	SDL_MemoryBarrierAcquire();
+	input = sdlconsole_queue[tail & (SDLCONSOLE_QUEUESIZE - 1)];
+	SDL_AtomicSet(&sdlconsole_qtail, (int)(tail + 1));
+
+	switch (input.type) {
+	case SDLCONSOLE_EVENT_KEY:
+		sdlconsole_curkey = (uint8_t)input.code;
+		if (sdlconsole_curkey & 0x80) {
+			if ((sdlconsole_curkey & 0x7F) == sdlconsole_lastKey) {
+				timing_timerDisable(sdlconsole_keyTimer);
+			}
+		} else {
+			sdlconsole_lastKey = sdlconsole_curkey;
+			timing_updateIntervalFreq(sdlconsole_keyTimer, 2);
+			timing_timerEnable(sdlconsole_keyTimer);
+		}
+		break;
+	case SDLCONSOLE_EVENT_MOUSE:
+		mouse_action((uint8_t)input.code, input.state, input.xrel, input.yrel);
+		return SDLCONSOLE_EVENT_NONE;
+	case SDLCONSOLE_EVENT_MENU:
+		sdlconsole_menuCommand = input.code;
+		break;
 	}
-	return SDLCONSOLE_EVENT_NONE;
+	return input.type;
+}
+
+uint16_t sdlconsole_getMenuCommand() {
+	return sdlconsole_menuCommand;
 }
 
 uint8_t sdlconsole_getScancode() {
@@ -12,10 +12,41 @@
 #define SDLCONSOLE_EVENT_QUIT		2
 #define SDLCONSOLE_EVENT_DEBUG_1	3
 #define SDLCONSOLE_EVENT_DEBUG_2	4
+#define SDLCONSOLE_EVENT_MOUSE		5
+#define SDLCONSOLE_EVENT_MENU		6
+#define SDLCONSOLE_EVENT_TURBO		7
+
+#define SDLCONSOLE_QUEUESIZE		256 //must be a power of 2
+
+#define SDLCONSOLE_GPU_OFF			0 //SDL's renderer, the window is the size of the mode
+#define SDLCONSOLE_GPU_INTEGER		1 //shader presenter, -gpu integer
+#define SDLCONSOLE_GPU_SHARP		2 //shader presenter, -gpu sharp
+#define SDLCONSOLE_GPUW				960 //window size the shader presenter starts out with, it can be resized from there
+#define SDLCONSOLE_GPUH				720
+
+typedef struct {
+	uint8_t type;
+	uint16_t code; //scancode, mouse action or menu command
+	uint8_t state;
+	int8_t xrel;
+	int8_t yrel;
+} SDLCONSOLE_INPUT_t;
+
+extern uint8_t sdlconsole_gpu;
 
 int sdlconsole_init(char *title);
+void sdlconsole_attach();
+uint8_t sdlconsole_indexed();
+void sdlconsole_initInput();
+void sdlconsole_upload(uint32_t* pixels, int stride, SDL_Rect* rect);
+void sdlconsole_updateFPS(uint64_t curtime);
 void sdlconsole_blit(uint32_t* pixels, int w, int h, int stride);
+void sdlconsole_blitRects(uint32_t* pixels, int w, int h, int stride, SDL_Rect* rects, int count);
+void sdlconsole_blitIndexed(uint8_t* pixels, int w, int h, int stride, int dispw, int disph, const uint32_t* palette, SDL_Rect* rects, int count);
+void sdlconsole_queueInput(uint8_t type, uint16_t code, uint8_t state, int8_t xrel, int8_t yrel);
+void sdlconsole_pump(uint32_t timeout);
 int sdlconsole_loop();
+uint16_t sdlconsole_getMenuCommand();
 uint8_t sdlconsole_getScancode();
 uint8_t sdlconsole_translateScancode(SDL_Keycode keyval);
 int sdlconsole_setWindow(int w, int h);
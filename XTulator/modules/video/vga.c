@@ -27,6 +27,7 @@
 #include <pthread.h>
 pthread_t vga_renderThreadID;
 #endif
+#include <SDL.h>
 #include "vga.h"
 #include "../../config.h"
 #include "../../timing.h"
@@ -34,11 +35,29 @@ pthread_t vga_renderThreadID;
 #include "../../ports.h"
 #include "../../memory.h"
 #include "../../debuglog.h"
+#include "../../snapshot.h"
+#include "../../profile.h"
 #include "sdlconsole.h"
+#include "vnc.h"
+#include "../../capture.h"
+#include "../../hostthread.h"
+#include "../../metrics.h"
+#include "frameskip.h"
 
-uint8_t VBIOS[32768];
+#ifdef USE_VGA_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define VGA_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VGA_SIMD_NEON
+#endif
+#endif
+
+uint8_t* VBIOS = NULL;
 
 uint8_t vga_palette[256][3]; //R, G, B
+uint32_t vga_pal32[256]; //vga_palette as host pixels, an entry is rebuilt when its DAC triplet is written
 
 const uint8_t vga_gfxpal[2][2][4] = { //palettes for 320x200 graphics mode 2bpp
 	{
@@ -65,61 +84,141 @@ uint8_t vga_gfxi = 0, vga_gfxd[0x09];
 uint8_t vga_seqi = 0, vga_seqd[0x05];
 uint8_t vga_misc, vga_status0, vga_status1;
 uint8_t vga_cursor_blink_state = 0;
-volatile uint8_t vga_wmode, vga_rmode, vga_shiftmode, vga_rotate, vga_logicop, vga_enableplane, vga_readmap, vga_scandbl, vga_hdbl, vga_bpp, vga_latch[4];
-uint8_t* vga_RAM[4]; //4 planes
+volatile uint8_t vga_wmode, vga_rmode, vga_shiftmode, vga_rotate, vga_logicop, vga_enableplane, vga_readmap, vga_scandbl, vga_hdbl, vga_bpp;
+uint32_t vga_latch; //plane n in byte n, like vga_RAM
+uint32_t* vga_RAM; //64K words, byte n of each one is plane n
 
 volatile uint64_t vga_hblankstart, vga_hblankend, vga_hblanklen, vga_dispinterval, vga_hblankinterval, vga_htotal;
 volatile uint64_t vga_vblankstart, vga_vblankend, vga_vblanklen, vga_vblankinterval, vga_frameinterval;
-volatile uint8_t vga_doRender = 0, vga_doBlit = 0;
 volatile double vga_targetFPS = 60, vga_lockFPS = 0;
 
-volatile uint32_t vga_hblankTimer, vga_hblankEndTimer, vga_drawTimer;
+volatile uint32_t vga_drawTimer;
+uint64_t vga_scanStart = 0; //guest time the current scanline timing took effect, 3DAh's retrace bits count from it
 volatile uint16_t vga_curScanline = 0;
 
+/*
+	Dirty tracking. Every video RAM write stamps the chunk of plane offsets it
+	touched with the current generation number. Register writes that change how
+	memory is displayed stamp vga_allGen to force everything. DAC writes stamp
+	vga_palGen, which is the same thing unless the shader presenter is doing
+	the palette lookup, then only the palette has to go to it again.
+
+	At each frame the CPU thread copies the chunks stamped since the previous
+	snapshot, along with the display registers, into vga_frame and bumps the
+	generation. The render thread draws only from vga_frame, and only the
+	scanlines whose span has a chunk stamped after the last frame it drew.
+*/
+uint32_t vga_dirty[VGA_DIRTY_CHUNKS];
+volatile uint32_t vga_dirtyGen = 1, vga_allGen = 1, vga_fontGen = 0, vga_palGen = 0;
+
+VGAFRAME_t vga_frame;
+SDL_mutex* vga_frameLock = NULL;
+SDL_cond* vga_frameCond = NULL;
+uint8_t vga_framePending = 0;
+
+SDL_Rect vga_dirtyRects[VGA_DIRTY_RECTS]; //bands of scanlines drawn by the last vga_update, for sdlconsole_blitRects
+int vga_dirtyRectCount = 0;
+volatile uint8_t vga_dumpPending = 0; //headless with -vnc or -capture, the render thread writes the next -framedump
+
+//-gpu, graphics modes are drawn as palette indices at their native resolution for the shader presenter to look up and scale
+uint8_t vga_indexbuffer[1024][1024];
+uint32_t vga_indexPalette[256]; //host pixels the indices in vga_indexbuffer stand for
+uint32_t vga_indexW = 0, vga_indexH = 0, vga_indexYScan = 1;
+uint8_t vga_indexed = 0; //set by the render thread when indices will do, nothing else reads vga_framebuffer
+uint8_t vga_frameIndexed = 0; //the last vga_update drew indices
+
+#define vga_markdirty(offset) vga_dirty[((offset) & 0xFFFF) >> VGA_DIRTY_SHIFT] = vga_dirtyGen
+#define vga_invalidate() vga_allGen = vga_dirtyGen
+
+void vga_addDirtyRows(uint32_t y, uint32_t count) {
+	SDL_Rect* rect;
+
+	if (vga_dirtyRectCount > 0) {
+		rect = &vga_dirtyRects[vga_dirtyRectCount - 1];
+		if (((uint32_t)(rect->y + rect->h) == y) || (vga_dirtyRectCount == VGA_DIRTY_RECTS)) {
+			rect->h = y + count - rect->y; //extend the previous band, or grow it over the gap when out of slots
+			return;
+		}
+	}
+	rect = &vga_dirtyRects[vga_dirtyRectCount++];
+	rect->x = 0;
+	rect->y = y;
+	rect->w = vga_frame.w;
+	rect->h = count;
+}
+
+uint8_t vga_spanDirty(uint32_t offset, uint32_t len, uint32_t since) {
+	uint32_t chunk, last;
+
+	chunk = (offset & 0xFFFF) >> VGA_DIRTY_SHIFT;
+	last = ((offset + len - 1) & 0xFFFF) >> VGA_DIRTY_SHIFT;
+	while (1) {
+		if (vga_dirty[chunk] > since) return 1;
+		if (chunk == last) return 0;
+		chunk = (chunk + 1) & (VGA_DIRTY_CHUNKS - 1); //span can wrap around the end of the plane
+	}
+}
+
 int vga_init() {
 	int x, y, i;
 
 	debug_log(DEBUG_INFO, "[VGA] Initializing VGA video device\r\n");
 
+	vga_buildExpandTables();
+
 	for (y = 0; y < 400; y++) {
 		for (x = 0; x < 640; x++) {
 			vga_framebuffer[y][x] = vga_color(0);
 		}
 	}
-	sdlconsole_blit((uint32_t*)vga_framebuffer, 640, 400, 1024 * sizeof(uint32_t));
+	if (!headless) {
+		sdlconsole_blit((uint32_t*)vga_framebuffer, 640, 400, 1024 * sizeof(uint32_t));
+	}
 
 	if (vga_lockFPS >= 1) {
 		vga_targetFPS = vga_lockFPS;
 	}
 
 	timing_addTimer(vga_blinkCallback, NULL, 3.75, TIMING_ENABLED);
-	vga_drawTimer = timing_addTimer(vga_drawCallback, NULL, vga_targetFPS, TIMING_ENABLED);
-	vga_hblankTimer = timing_addTimer(vga_hblankCallback, NULL, 10000, TIMING_ENABLED); //nonsense frequency values to begin with is fine
-	vga_hblankEndTimer = timing_addTimer(vga_hblankEndCallback, NULL, 100, TIMING_ENABLED); //same here
+	vga_drawTimer = timing_addTimer(vga_drawCallback, NULL, vga_targetFPS, (headless && !vncport && (capturefile == NULL)) ? TIMING_DISABLED : TIMING_ENABLED);
 	vga_curScanline = 0;
+	vga_scanStart = timing_getGuestCur();
 
-	for (i = 0; i < 4; i++) { //4 planes of 64 KB (It's actually 64K addresses on a 32-bit data bus on real VGA hardware)
-		vga_RAM[i] = (uint8_t*)malloc(65536);
-		if (vga_RAM[i] == NULL) break;
+	//4 planes of 64 KB, kept the way real VGA hardware has them: 64K addresses on a 32-bit data bus, a plane per byte lane.
+	//The write modes and latches then work on all four planes with one operation.
+	vga_RAM = (uint32_t*)utility_allocPages(65536 * sizeof(uint32_t), "VGA planes");
+	if (vga_RAM == NULL) {
+		return -1;
 	}
-	if (i < 4) { //If there was an allocation error
-		for (; i >= 0; i--) { //step back through any successfully allocated chunks
-			free((void*)vga_RAM[i]); //and free them
-		}
+	for (i = 0; i < VGA_DIRTY_CHUNKS; i++) {
+		vga_dirty[i] = vga_dirtyGen; //the first snapshot copies all of video memory
+	}
+
+	vga_frameLock = SDL_CreateMutex();
+	vga_frameCond = SDL_CreateCond();
+	if ((vga_frameLock == NULL) || (vga_frameCond == NULL)) {
+		debug_log(DEBUG_ERROR, "[VGA] Unable to create render thread synchronization objects\r\n");
 		return -1;
 	}
 
-	//TODO: error checking below
+	if (headless && (framedump != NULL)) {
+		timing_addGuestTimer(vga_dumpCallback, NULL, 1.0 / framedumpinterval, TIMING_ENABLED);
+	}
+	if (!headless || vncport || (capturefile != NULL)) { //the VNC server and -capture get their frames from the render thread
+		//TODO: error checking below
 #ifdef _WIN32
-	_beginthread(vga_renderThread, 0, NULL);
+		_beginthread(vga_renderThread, 0, NULL);
 #else
-	pthread_create(&vga_renderThreadID, NULL, vga_renderThread, NULL);
+		pthread_create(&vga_renderThreadID, NULL, vga_renderThread, NULL);
 #endif
+	}
 
 	ports_cbRegister(0x3B4, 39, (void*)vga_readport, NULL, (void*)vga_writeport, NULL, NULL);
 	memory_mapCallbackRegister(0xA0000, 0x20000, (void*)vga_readmemory, (void*)vga_writememory, NULL);
+	memory_mapBlockRegister(0xA0000, vga_readBlock, vga_writeBlock);
 
-	if (utility_loadFile(VBIOS, 32768, "roms/video/et4000.bin")) {
+	VBIOS = utility_loadROM(32768, "roms/video/et4000.bin");
+	if (VBIOS == NULL) {
 		return -1;
 	}
 	memory_mapRegister(0xC0000, 32768, VBIOS, NULL);
@@ -164,32 +263,287 @@ void vga_updateScanlineTiming() {
 		lastFPS = vga_targetFPS;
 	}
 
-	timing_updateInterval(vga_hblankTimer, vga_dispinterval);
-	timing_updateInterval(vga_hblankEndTimer, vga_hblankinterval);
-	timing_timerEnable(vga_hblankTimer);
-	timing_timerDisable(vga_hblankEndTimer);
+	vga_scanStart = timing_getGuestCur();
 	if (vga_lockFPS == 0) {
 		timing_updateIntervalFreq(vga_drawTimer, vga_targetFPS);
 	}
 }
 
-void vga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end_y) {
-	uint32_t addr, startaddr, cursorloc, cursor_x, cursor_y, fontbase, color32;
-	uint32_t scx, scy, x, y, hchars, divx, yscanpixels, xscanpixels, xstride, bpp, pixelsperbyte, shift;
-	uint8_t cc, attr, fontdata, blink, mode, colorset, intensity, blinkenable, cursorenable, dup9;
+/*
+	Scanline renderers. Each one fetches the palette indices for a single source
+	line with the mode's memory layout, then vga_emitLine maps them through a
+	32-bit lookup table and widens them by the horizontal pixel repeat. Rows
+	repeated by the vertical scan doubling are copied afterwards.
+*/
+uint64_t vga_expand8[256]; //byte n of each entry holds bit (7 - n) of the index, so one plane byte becomes eight pixels
+uint32_t vga_expand2[256]; //byte n of each entry holds 2bpp pixel n of the index
+uint32_t vga_planeExpand[16]; //byte n of each entry is 0xFF if bit n of the index is set, turns a plane mask or 4-bit color into a word mask
 
-	//debug_log(DEBUG_DETAIL, "Width: %u\r\n", vga_crtcd[0x01] - ((vga_crtcd[0x05] & 0x60) >> 5));
-	if (vga_attrd[0x10] & 1) { //graphics mode enable
-		if (vga_shiftmode & 0x02) {
+void vga_buildExpandTables() {
+	uint32_t i, n;
+
+	for (i = 0; i < 256; i++) {
+		uint8_t* p8 = (uint8_t*)&vga_expand8[i];
+		uint8_t* p2 = (uint8_t*)&vga_expand2[i];
+		for (n = 0; n < 8; n++) {
+			p8[n] = (i >> (7 - n)) & 1;
+		}
+		for (n = 0; n < 4; n++) {
+			p2[n] = (i >> ((3 - n) << 1)) & 3;
+		}
+	}
+	for (i = 0; i < 16; i++) {
+		vga_planeExpand[i] = 0;
+		for (n = 0; n < 4; n++) {
+			if (i & (1 << n)) vga_planeExpand[i] |= 0xFFUL << (n << 3);
+		}
+	}
+}
+
+//Resolves the 16 attribute controller palette entries to host pixels
+void vga_buildAttrLUT(uint32_t* lut) {
+	uint32_t i, color;
+
+	for (i = 0; i < 16; i++) {
+		color = vga_frame.attrd[i] | (vga_frame.attrd[0x14] << 4);
+		if (vga_frame.attrd[0x10] & 0x80) { //P5, P4 replace
+			color = (color & 0xCF) | ((vga_frame.attrd[0x14] & 3) << 4);
+		}
+		lut[i] = vga_frame.pal32[color & 0xFF];
+	}
+}
+
+void vga_emitLine(uint32_t* dst, const uint8_t* idx, uint32_t count, uint32_t xscanpixels, const uint32_t* lut) {
+	uint32_t i = 0, xadd;
+
+	switch (xscanpixels) {
+	case 1:
+		for (; i < count; i++) {
+			dst[i] = lut[idx[i]];
+		}
+		break;
+	case 2:
+#if defined(VGA_SIMD_SSE2)
+		for (; i + 4 <= count; i += 4) {
+			__m128i c = _mm_setr_epi32(lut[idx[i]], lut[idx[i + 1]], lut[idx[i + 2]], lut[idx[i + 3]]);
+			_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi32(c, c));
+			_mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi32(c, c));
+			dst += 8;
+		}
+#elif defined(VGA_SIMD_NEON)
+		for (; i + 4 <= count; i += 4) {
+			uint32x4x2_t c;
+			c.val[0] = vsetq_lane_u32(lut[idx[i]], vdupq_n_u32(0), 0);
+			c.val[0] = vsetq_lane_u32(lut[idx[i + 1]], c.val[0], 1);
+			c.val[0] = vsetq_lane_u32(lut[idx[i + 2]], c.val[0], 2);
+			c.val[0] = vsetq_lane_u32(lut[idx[i + 3]], c.val[0], 3);
+			c.val[1] = c.val[0];
+			vst2q_u32(dst, c); //interleaving store writes every pixel twice
+			dst += 8;
+		}
+#endif
+		for (; i < count; i++) {
+			dst[0] = dst[1] = lut[idx[i]];
+			dst += 2;
+		}
+		break;
+	default:
+		for (; i < count; i++) {
+			for (xadd = 0; xadd < xscanpixels; xadd++) {
+				*dst++ = lut[idx[i]];
+			}
+		}
+		break;
+	}
+}
+
+//Chain-4: pixel n of the display lives in plane (n & 3) at offset (n >> 2). Planes are the bytes of each word in order,
+//so on a little endian host a run of words is already a run of pixels.
+void vga_fetch8bpp(uint8_t* idx, uint32_t base, uint32_t startaddr, uint32_t count) {
+	uint32_t x = 0, linear, offset, n;
+
+#ifndef __BIG_ENDIAN__
+	if ((base & 3) == 0) {
+		while ((x + 4) <= count) {
+			linear = (base + x) & 0xFFFF;
+			offset = ((linear >> 2) + startaddr) & 0xFFFF;
+			n = (count - x) >> 2;
+			if (n > (0x10000 - offset)) n = 0x10000 - offset; //stop where either address wraps around
+			if (n > ((0x10000 - linear) >> 2)) n = (0x10000 - linear) >> 2;
+			memcpy(&idx[x], &vga_frame.RAM[offset], n << 2);
+			x += n << 2;
+		}
+	}
+#endif
+	for (; x < count; x++) {
+		linear = (base + x) & 0xFFFF;
+		idx[x] = VGA_PLANE(vga_frame.RAM[((linear >> 2) + startaddr) & 0xFFFF], linear & 3);
+	}
+}
+
+//Planar 16 color: one byte from each plane supplies one bit of eight pixels
+void vga_fetch4bpp(uint8_t* idx, uint32_t base, uint32_t startaddr, uint32_t count) {
+	uint32_t bx, addr, planes;
+	uint64_t pixels;
+
+	for (bx = 0; (bx << 3) < count; bx++) {
+		addr = (((base + bx) & 0xFFFF) + startaddr) & 0xFFFF;
+		planes = vga_frame.RAM[addr];
+		pixels = vga_expand8[planes & 0xFF];
+		pixels |= vga_expand8[(planes >> 8) & 0xFF] << 1;
+		pixels |= vga_expand8[(planes >> 16) & 0xFF] << 2;
+		pixels |= vga_expand8[planes >> 24] << 3;
+		memcpy(&idx[bx << 3], &pixels, 8);
+	}
+}
+
+//CGA compatible 4 color: odd/even interleaved bytes, two bits per pixel
+void vga_fetch2bpp(uint8_t* idx, uint32_t base, uint32_t startaddr, uint32_t count) {
+	uint32_t bx, addr;
+
+	for (bx = 0; (bx << 2) < count; bx++) {
+		addr = ((base + bx) & 0xFFFF) + startaddr;
+		memcpy(&idx[bx << 2], &vga_expand2[VGA_PLANE(vga_frame.RAM[(addr >> 1) & 0xFFFF], addr & 1)], 4);
+	}
+}
+
+//CGA compatible monochrome: plane 0 only, one bit per pixel
+void vga_fetch1bpp(uint8_t* idx, uint32_t base, uint32_t startaddr, uint32_t count) {
+	uint32_t bx, addr;
+
+	for (bx = 0; (bx << 3) < count; bx++) {
+		addr = (((base + bx) & 0xFFFF) + startaddr) & 0xFFFF;
+		memcpy(&idx[bx << 3], &vga_expand8[VGA_PLANE(vga_frame.RAM[addr], 0)], 8);
+	}
+}
+
+/*
+	Text cells are drawn from a cache of pre-rendered glyphs, the scanlines of
+	a character in the colors of one attribute, so a cell row is a copy. Rows
+	are rendered the first time they're drawn. The font, the attribute palette
+	and the character width are baked into the entries, vga_glyphCheck empties
+	the cache when any of them change.
+*/
+VGAGLYPH_t vga_glyphs[VGA_GLYPHS];
+uint32_t vga_glyphLut[16], vga_glyphFontGen = VGA_GLYPH_NONE, vga_glyphDots = 0;
+
+//Called by vga_update before drawing text, with the palette it's drawing with
+void vga_glyphCheck(const uint32_t* lut) {
+	uint32_t i;
+
+	if ((vga_glyphFontGen == vga_frame.fontGen) && (vga_glyphDots == vga_frame.dots) && !memcmp(vga_glyphLut, lut, sizeof(vga_glyphLut))) return;
+	for (i = 0; i < VGA_GLYPHS; i++) {
+		vga_glyphs[i].key = VGA_GLYPH_NONE;
+	}
+	memcpy(vga_glyphLut, lut, sizeof(vga_glyphLut));
+	vga_glyphFontGen = vga_frame.fontGen;
+	vga_glyphDots = vga_frame.dots;
+}
+
+//Pixels of one row of character cc in attribute attr, rendered into the cache first if they aren't there. hidden blanks it for the blink phase.
+static const uint32_t* vga_glyphRow(uint8_t cc, uint8_t attr, uint32_t fontbase, uint8_t hidden, uint32_t row) {
+	VGAGLYPH_t* glyph;
+	uint32_t key, col, bitcol, fore, back;
+	uint8_t fontdata, dup9;
+
+	key = (uint32_t)cc | ((uint32_t)attr << 8) | (fontbase << 3) | ((uint32_t)hidden << 19); //font bases are multiples of 0x2000
+	glyph = &vga_glyphs[((key * 2654435761UL) >> 16) & (VGA_GLYPHS - 1)];
+	if (glyph->key != key) {
+		glyph->key = key;
+		glyph->valid = 0;
+	}
+	if (glyph->valid & (1UL << row)) return glyph->rows[row];
+
+	dup9 = 1; //TODO: fix this hack
+	fore = vga_glyphLut[attr & 0x0F];
+	back = vga_glyphLut[attr >> 4];
+	fontdata = hidden ? 0 : VGA_PLANE(vga_frame.RAM[fontbase + ((uint32_t)cc * 32) + row], 2);
+	for (col = 0; col < vga_glyphDots; col++) {
+		bitcol = col;
+		if (dup9 && (col == 0) && (cc >= 0xC0) && (cc <= 0xDF)) {
+			bitcol = 1;
+		}
+		glyph->rows[row][col] = ((fontdata >> ((vga_glyphDots - 1) - bitcol)) & 1) ? fore : back;
+	}
+	glyph->valid |= 1UL << row;
+	return glyph->rows[row];
+}
+
+void vga_renderTextLine(uint32_t* dst, uint32_t scy, uint32_t width, uint32_t rowaddr, uint32_t maxscan, uint32_t fontbase,
+	uint32_t cursorcol, uint8_t cursorline, uint8_t blinkenable, uint8_t blinkstate, const uint32_t* lut) {
+	uint32_t x, col, rep, scx, dbl, dots, fore;
+	const uint32_t* pixels;
+	uint8_t cc, attr, hidden;
+
+	dbl = vga_frame.dbl ? 2 : 1;
+	dots = vga_frame.dots;
+	for (x = 0, scx = 0; scx < width; x++) {
+		uint32_t addr = (rowaddr + x) & 0xFFFF;
+		cc = VGA_PLANE(vga_frame.RAM[addr], 0);
+		attr = VGA_PLANE(vga_frame.RAM[addr], 1);
+		hidden = 0;
+		if (blinkenable) {
+			if ((attr & 0x80) && !blinkstate) {
+				hidden = 1; //all pixels in character get background color if blink attribute set and blink visible state is false
+			}
+			attr &= 0x7F; //enabling text mode blink attribute limits background color selection
+		}
+		if (cursorline && (x == cursorcol)) { //cursor covers the whole character cell
+			fore = lut[attr & 0x0F];
+			for (col = 0; (col < (dots * dbl)) && (scx < width); col++) {
+				dst[scx++] = fore;
+			}
+			continue;
+		}
+		pixels = vga_glyphRow(cc, attr, fontbase, hidden, scy % maxscan);
+		if ((scx + (dots * dbl)) <= width) { //whole cell fits, the common case
+			if (dbl == 1) {
+				for (col = 0; col < 8; col++) {
+					dst[scx + col] = pixels[col];
+				}
+				if (dots == 9) dst[scx + 8] = pixels[8];
+			} else {
+				for (col = 0; col < 8; col++) {
+					dst[scx + (col << 1)] = dst[scx + (col << 1) + 1] = pixels[col];
+				}
+				if (dots == 9) dst[scx + 16] = dst[scx + 17] = pixels[8];
+			}
+			scx += dots * dbl;
+			continue;
+		}
+		for (col = 0; (col < dots) && (scx < width); col++) {
+			for (rep = 0; (rep < dbl) && (scx < width); rep++) {
+				dst[scx++] = pixels[col];
+			}
+		}
+	}
+}
+
+//Redraws the lines in the given area whose video memory changed after generation since (0 redraws all of it), returns how many were drawn.
+//Lines are always drawn across the full display width.
+uint32_t vga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end_y, uint32_t since) {
+	static uint32_t lastcursor = 0xFFFFFFFF;
+	static uint8_t lastblink = 0;
+	static const uint32_t monolut[2] = { 0x00000000, 0xFFFFFFFF };
+	uint8_t idx[1024 + 64];
+	uint32_t attrlut[16];
+	const uint32_t* lut;
+	uint32_t startaddr, cursorloc, cursor_x, cursor_y, lastcursor_y, fontbase, count, width;
+	uint32_t scy, y, yadd, hchars, yscanpixels, xscanpixels, xstride, bpp, pixelsperbyte, drawn;
+	uint8_t mode, blinkenable, cursorenable, full, blinkstate, cursorchanged, indexed;
+
+	//debug_log(DEBUG_DETAIL, "Width: %u\r\n", vga_frame.crtcd[0x01] - ((vga_frame.crtcd[0x05] & 0x60) >> 5));
+	if (vga_frame.attrd[0x10] & 1) { //graphics mode enable
+		if (vga_frame.shiftmode & 0x02) {
 			xscanpixels = 2;
-			yscanpixels = (vga_crtcd[0x09] & 0x1F) + 1;
+			yscanpixels = (vga_frame.crtcd[0x09] & 0x1F) + 1;
 		} else {
-			xscanpixels = (vga_seqd[0x01] & 0x08) ? 2 : 1;
-			yscanpixels = (vga_crtcd[0x09] & 0x80) ? 2 : 1;
+			xscanpixels = (vga_frame.seqd[0x01] & 0x08) ? 2 : 1;
+			yscanpixels = (vga_frame.crtcd[0x09] & 0x80) ? 2 : 1;
 		}
-		switch (vga_shiftmode) {
+		switch (vga_frame.shiftmode) {
 		case 0x00:
-			if ((vga_attrd[0x12] & 0x0F) == 0x01) { //TODO: is this the right way to detect 1bpp mode?
+			if ((vga_frame.attrd[0x12] & 0x0F) == 0x01) { //TODO: is this the right way to detect 1bpp mode?
 				bpp = 1;
 				pixelsperbyte = 8;
 				mode = VGA_MODE_GRAPHICS_1BPP;
@@ -204,204 +558,238 @@ void vga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end
 			pixelsperbyte = 4;
 			mode = VGA_MODE_GRAPHICS_2BPP;
 			break;
-		case 0x02:
-		case 0x03:
+		default:
 			bpp = 8;
 			pixelsperbyte = 1;
 			mode = VGA_MODE_GRAPHICS_8BPP;
 			break;
 		}
-		xstride = (vga_w / xscanpixels) / pixelsperbyte;
-#ifdef DEBUG_VGA
-		debug_log(DEBUG_DETAIL, "[VGA] Resolution: %lux%lu %lu bpp (X stride: %lu, V lines per pixel: %lu, H lines per pixel = %lu)\r\n",
-			vga_w, vga_h, bpp, xstride, yscanpixels, xscanpixels);
-#endif
+		xstride = (vga_frame.w / xscanpixels) / pixelsperbyte;
+		if (DEBUG_ON(DEBUG_SUB_VGA)) {
+			debug_log(DEBUG_DETAIL, "[VGA] Resolution: %lux%lu %lu bpp (X stride: %lu, V lines per pixel: %lu, H lines per pixel = %lu)\r\n",
+				vga_frame.w, vga_frame.h, bpp, xstride, yscanpixels, xscanpixels);
+		}
 	} else { //text mode enable
 		mode = VGA_MODE_TEXT;
-		hchars = vga_dbl ? 40 : 80;
-		divx = vga_dbl ? vga_dots * 2 : vga_dots;
-		cursorenable = (vga_crtcd[0x0A] & 0x20) ? 0 : 1; //TODO: fix this
+		hchars = vga_frame.dbl ? 40 : 80;
+		cursorenable = (vga_frame.crtcd[0x0A] & 0x20) ? 0 : 1; //TODO: fix this
 		blinkenable = 0;
-		fontbase = vga_fontbases[vga_seqd[0x03]];
-		dup9 = (vga_attrd[0x10] & 0x04) ? 0 : 1;
-		vga_scandbl = 0;
-#ifdef DEBUG_VGA
-		debug_log(DEBUG_DETAIL, "[VGA] Resolution: %lux%lu (text mode)\r\n",
-			vga_w, vga_h);
-#endif
+		fontbase = vga_fontbases[vga_frame.seqd[0x03]];
+		if (DEBUG_ON(DEBUG_SUB_VGA)) {
+			debug_log(DEBUG_DETAIL, "[VGA] Resolution: %lux%lu (text mode)\r\n",
+				vga_frame.w, vga_frame.h);
+		}
 	}
-	intensity = 0;
-	colorset = 0;
-	startaddr = ((uint32_t)vga_crtcd[0xC] << 8) | (uint32_t)vga_crtcd[0xD];
-	cursorloc = ((uint32_t)vga_crtcd[0xE] << 8) | (uint32_t)vga_crtcd[0xF];
+	drawn = 0;
+	width = (vga_frame.w > 1024) ? 1024 : vga_frame.w;
+	startaddr = ((uint32_t)vga_frame.crtcd[0xC] << 8) | (uint32_t)vga_frame.crtcd[0xD];
+	cursorloc = ((uint32_t)vga_frame.crtcd[0xE] << 8) | (uint32_t)vga_frame.crtcd[0xF];
+	indexed = vga_indexed && (mode != VGA_MODE_TEXT);
+	full = (vga_frame.allGen > since) || ((mode == VGA_MODE_TEXT) && (vga_frame.fontGen > since)) ||
+		(!indexed && (vga_frame.palGen > since)) || (indexed != vga_frameIndexed); //switching buffers, the other one is stale
+	vga_frameIndexed = indexed;
+	vga_buildAttrLUT(attrlut);
 
-	switch (mode) {
-	case VGA_MODE_TEXT:
-		dup9 = 1; //TODO: fix this hack
+	if (mode == VGA_MODE_TEXT) {
+		uint32_t maxscan = (vga_frame.crtcd[0x09] & 0x1F) + 1;
 		cursor_x = cursorloc % hchars;
 		cursor_y = cursorloc / hchars;
+		lastcursor_y = lastcursor / hchars;
+		blinkstate = vga_frame.blink;
+		cursorchanged = (cursorloc != lastcursor) || (blinkstate != lastblink);
+		lastcursor = cursorloc;
+		lastblink = blinkstate;
+		vga_glyphCheck(attrlut);
 		for (scy = start_y; scy <= end_y; scy++) {
-			uint32_t maxscan = ((vga_crtcd[0x09] & 0x1F) + 1);
+			uint8_t cursorline;
 			y = scy / maxscan;
-			for (scx = start_x; scx <= end_x; scx++) {
-				uint32_t charcolumn;
-				x = scx / divx;
-				addr = startaddr + (y * hchars) + x;
-				cc = vga_RAM[0][addr];
-				attr = vga_RAM[1][addr];
-				blink = attr >> 7;
-				if (blinkenable) attr &= 0x7F; //enabling text mode blink attribute limits background color selection
-				fontdata = vga_RAM[2][fontbase + ((uint32_t)cc * 32) + (scy % maxscan)];
-				charcolumn = ((scx >> (vga_dbl ? 1 : 0)) % vga_dots);
-				if (dup9 && (charcolumn == 0) && (cc >= 0xC0) && (cc <= 0xDF)) {
-					charcolumn = 1;
-				}
-				fontdata = (fontdata >> ((vga_dots - 1) - charcolumn)) & 1;
-				if ((y == cursor_y) && (x == cursor_x) &&
-					((uint8_t)(scy % 16) >= (vga_crtcd[VGA_REG_DATA_CURSOR_BEGIN] & 31)) &&
-					((uint8_t)(scy % 16) <= (vga_crtcd[VGA_REG_DATA_CURSOR_END] & 31)) &&
-					vga_cursor_blink_state && cursorenable) { //cursor should be displayed
-					color32 = vga_attrd[attr & 0x0F] | (vga_attrd[0x14] << 4);
-					if (vga_attrd[0x10] & 0x80) { //P5, P4 replace
-						color32 = (color32 & 0xCF) | ((vga_attrd[0x14] & 3) << 4);
-					}
-					color32 = vga_color(color32);
-					vga_framebuffer[scy][scx] = color32;
-				}
-				else {
-					if (blinkenable && blink && !vga_cursor_blink_state) {
-						fontdata = 0; //all pixels in character get background color if blink attribute set and blink visible state is false
-					}
-					//determine index into actual DAC palette
-					color32 = vga_attrd[fontdata ? (attr & 0x0F) : (attr >> 4)] | (vga_attrd[0x14] << 4);
-					if (vga_attrd[0x10] & 0x80) { //P5, P4 replace
-						color32 = (color32 & 0xCF) | ((vga_attrd[0x14] & 3) << 4);
-					}
-					color32 = vga_color(color32);
-					vga_framebuffer[scy][scx] = color32;
-				}
+			if (!full && !(cursorchanged && ((y == cursor_y) || (y == lastcursor_y))) && !vga_spanDirty(startaddr + (y * hchars), hchars, since)) {
+				continue;
 			}
+			drawn++;
+			vga_addDirtyRows(scy, 1);
+			cursorline = (y == cursor_y) && blinkstate && cursorenable &&
+				((uint8_t)(scy % 16) >= (vga_frame.crtcd[VGA_REG_DATA_CURSOR_BEGIN] & 31)) &&
+				((uint8_t)(scy % 16) <= (vga_frame.crtcd[VGA_REG_DATA_CURSOR_END] & 31));
+			vga_renderTextLine(vga_framebuffer[scy], scy, width, startaddr + (y * hchars), maxscan, fontbase,
+				cursor_x, cursorline, blinkenable, blinkstate, attrlut);
 		}
-		break;
+		return drawn;
+	}
+
+	count = width / xscanpixels;
+	switch (mode) {
 	case VGA_MODE_GRAPHICS_8BPP:
-		for (scy = start_y; scy <= end_y; scy += yscanpixels) {
-			y = scy / yscanpixels;
-			for (scx = start_x; scx <= end_x; scx += xscanpixels) {
-				uint8_t plane;
-				uint32_t yadd, xadd, color32;
-				x = scx / xscanpixels;
-				//x += vga_attrd[0x13] & 0x0F;
-				addr = ((y * xstride) + x) & 0xFFFF;
-				plane = addr & 3;
-				addr = (addr >> 2) + startaddr;
-				cc = vga_RAM[plane][addr & 0xFFFF];
-				color32 = vga_color(cc);
-				for (yadd = 0; yadd < yscanpixels; yadd++) {
-					for (xadd = 0; xadd < xscanpixels; xadd++) {
-						vga_framebuffer[scy + yadd][scx + xadd] = color32;
-					}
-				}
-			}
-		}
+		lut = vga_frame.pal32;
 		break;
-	case VGA_MODE_GRAPHICS_4BPP:
-		for (scy = start_y; scy <= end_y; scy += yscanpixels) {
-			y = scy / yscanpixels;
-			for (scx = start_x; scx <= end_x; scx += xscanpixels) {
-				uint32_t yadd, xadd;
-				x = scx / xscanpixels;
-				//x += vga_attrd[0x13] & 0x0F;
-				addr = ((y * xstride) + (x / 8)) & 0xFFFF;
-				addr = addr + startaddr;
-				shift = 7 - (x & 7);
-				cc = (vga_RAM[0][addr & 0xFFFF] >> shift) & 1;
-				cc |= ((vga_RAM[1][addr & 0xFFFF] >> shift) & 1) << 1;
-				cc |= ((vga_RAM[2][addr & 0xFFFF] >> shift) & 1) << 2;
-				cc |= ((vga_RAM[3][addr & 0xFFFF] >> shift) & 1) << 3;
-				//determine index into actual DAC palette
-				color32 = vga_attrd[cc] | (vga_attrd[0x14] << 4);
-				if (vga_attrd[0x10] & 0x80) { //P5, P4 replace
-					color32 = (color32 & 0xCF) | ((vga_attrd[0x14] & 3) << 4);
-				}
-				color32 = vga_color(color32);
-				for (yadd = 0; yadd < yscanpixels; yadd++) {
-					for (xadd = 0; xadd < xscanpixels; xadd++) {
-						vga_framebuffer[scy + yadd][scx + xadd] = color32;
-					}
-				}
-			}
-		}
+	case VGA_MODE_GRAPHICS_1BPP:
+		lut = monolut;
 		break;
-	case VGA_MODE_GRAPHICS_2BPP:
-		for (scy = start_y; scy <= end_y; scy += yscanpixels) {
-			uint8_t isodd;
-			y = scy / yscanpixels;
-			isodd = y & 1;
-			y >>= 1;
-			for (scx = start_x; scx <= end_x; scx += xscanpixels) {
-				uint32_t yadd, xadd;
-				x = scx / xscanpixels;
-				//x += vga_attrd[0x13] & 0x0F;
-				addr = ((8192 * isodd) + (y * xstride) + (x / pixelsperbyte)) & 0xFFFF;
-				addr = addr + startaddr;
-				shift = (3 - (x & 3)) << 1;
-				cc = (vga_RAM[addr & 1][addr >> 1] >> shift) & 3;
-				//determine index into actual DAC palette
-				color32 = vga_attrd[cc] | (vga_attrd[0x14] << 4);
-				if (vga_attrd[0x10] & 0x80) { //P5, P4 replace
-					color32 = (color32 & 0xCF) | ((vga_attrd[0x14] & 3) << 4);
-				}
-				color32 = vga_color(color32);
-				for (yadd = 0; yadd < yscanpixels; yadd++) {
-					for (xadd = 0; xadd < xscanpixels; xadd++) {
-						vga_framebuffer[scy + yadd][scx + xadd] = color32;
-					}
-				}
-			}
-		}
+	default:
+		lut = attrlut;
 		break;
-	case VGA_MODE_GRAPHICS_1BPP:
-		for (scy = start_y; scy <= end_y; scy += yscanpixels) {
-			uint8_t isodd;
-			y = scy / yscanpixels;
+	}
+	if (indexed) {
+		memcpy(vga_indexPalette, lut, ((mode == VGA_MODE_GRAPHICS_8BPP) ? 256 : (mode == VGA_MODE_GRAPHICS_1BPP) ? 2 : 16) * sizeof(uint32_t));
+		vga_indexW = count;
+		vga_indexH = (vga_frame.h + yscanpixels - 1) / yscanpixels;
+		vga_indexYScan = yscanpixels;
+	}
+	for (scy = start_y; scy <= end_y; scy += yscanpixels) {
+		uint32_t base, spanstart, spanlen;
+		uint8_t isodd;
+		y = scy / yscanpixels;
+		switch (mode) {
+		case VGA_MODE_GRAPHICS_8BPP:
+			base = y * xstride;
+			spanstart = (base >> 2) + startaddr;
+			spanlen = (xstride >> 2) + 2;
+			break;
+		case VGA_MODE_GRAPHICS_4BPP:
+			base = y * xstride;
+			spanstart = base + startaddr;
+			spanlen = xstride + 1;
+			break;
+		case VGA_MODE_GRAPHICS_2BPP:
 			isodd = y & 1;
-			y >>= 1;
-			for (scx = start_x; scx <= end_x; scx += xscanpixels) {
-				uint32_t yadd, xadd;
-				x = scx / xscanpixels;
-				//x += vga_attrd[0x13] & 0x0F;
-				addr = ((8192 * isodd) + (y * xstride) + (x / pixelsperbyte)) & 0xFFFF;
-				addr = addr + startaddr;
-				shift = 7 - (x & 7);
-				cc = (vga_RAM[0][addr] >> shift) & 1;
-				color32 = cc ? 0xFFFFFFFF : 0x00000000;
-				for (yadd = 0; yadd < yscanpixels; yadd++) {
-					for (xadd = 0; xadd < xscanpixels; xadd++) {
-						vga_framebuffer[scy + yadd][scx + xadd] = color32;
-					}
-				}
-			}
+			base = (8192 * isodd) + ((y >> 1) * xstride);
+			spanstart = ((base & 0xFFFF) + startaddr) >> 1;
+			spanlen = (xstride >> 1) + 2;
+			break;
+		default:
+			isodd = y & 1;
+			base = (8192 * isodd) + ((y >> 1) * xstride);
+			spanstart = (base & 0xFFFF) + startaddr;
+			spanlen = xstride + 1;
+			break;
 		}
-		break;
+		if (!full && !vga_spanDirty(spanstart, spanlen, since)) {
+			continue;
+		}
+		drawn += yscanpixels;
+		vga_addDirtyRows(scy, yscanpixels);
+		switch (mode) {
+		case VGA_MODE_GRAPHICS_8BPP:
+			vga_fetch8bpp(idx, base, startaddr, count);
+			break;
+		case VGA_MODE_GRAPHICS_4BPP:
+			vga_fetch4bpp(idx, base, startaddr, count);
+			break;
+		case VGA_MODE_GRAPHICS_2BPP:
+			vga_fetch2bpp(idx, base, startaddr, count);
+			break;
+		default:
+			vga_fetch1bpp(idx, base, startaddr, count);
+			break;
+		}
+		if (indexed) {
+			memcpy(vga_indexbuffer[y], idx, count); //lookup and doubling are left to the shader
+			continue;
+		}
+		vga_emitLine(vga_framebuffer[scy], idx, count, xscanpixels, lut);
+		for (yadd = 1; (yadd < yscanpixels) && ((scy + yadd) < 1024); yadd++) {
+			memcpy(vga_framebuffer[scy + yadd], vga_framebuffer[scy], count * xscanpixels * sizeof(uint32_t));
+		}
+	}
 
+	return drawn;
+}
+
+//Called on the CPU thread at the end of a frame with vga_frameLock held
+void vga_snapshot() {
+	uint32_t i, gen;
+
+	gen = vga_dirtyGen;
+	for (i = 0; i < VGA_DIRTY_CHUNKS; i++) {
+		if (vga_dirty[i] > vga_frame.gen) {
+			memcpy(&vga_frame.RAM[i << VGA_DIRTY_SHIFT], &vga_RAM[i << VGA_DIRTY_SHIFT], (1 << VGA_DIRTY_SHIFT) * sizeof(uint32_t));
+		}
 	}
+	memcpy(vga_frame.pal32, vga_pal32, sizeof(vga_frame.pal32));
+	memcpy(vga_frame.crtcd, vga_crtcd, sizeof(vga_frame.crtcd));
+	memcpy(vga_frame.attrd, vga_attrd, sizeof(vga_frame.attrd));
+	memcpy(vga_frame.seqd, vga_seqd, sizeof(vga_frame.seqd));
+	vga_frame.shiftmode = vga_shiftmode;
+	vga_frame.dbl = vga_dbl;
+	vga_frame.blink = vga_cursor_blink_state;
+	vga_frame.dots = vga_dots;
+	vga_frame.w = vga_w;
+	vga_frame.h = vga_h;
+	vga_frame.allGen = vga_allGen;
+	vga_frame.fontGen = vga_fontGen;
+	vga_frame.palGen = vga_palGen;
+	vga_frame.gen = gen;
+	vga_dirtyGen = gen + 1; //writes from here on belong to the next frame
+}
+
+//Passes the indices drawn by the last vga_update to the shader presenter, with the dirty bands in native rows
+void vga_blitIndexed(uint32_t w, uint32_t h) {
+	SDL_Rect rects[VGA_DIRTY_RECTS];
+	int i;
+
+	for (i = 0; i < vga_dirtyRectCount; i++) {
+		rects[i].x = 0;
+		rects[i].y = vga_dirtyRects[i].y / vga_indexYScan;
+		rects[i].w = vga_indexW;
+		rects[i].h = (vga_dirtyRects[i].h + vga_indexYScan - 1) / vga_indexYScan;
+	}
+	sdlconsole_blitIndexed((uint8_t*)vga_indexbuffer, (int)vga_indexW, (int)vga_indexH, 1024, (int)w, (int)h, vga_indexPalette, rects, vga_dirtyRectCount);
 }
 
 void vga_renderThread(void* dummy) {
+	uint32_t since = 0, w, h;
+	uint64_t start = 0;
+
+	hostthread_apply(HOSTTHREAD_RENDER);
+	if (!headless) sdlconsole_attach();
+
+	SDL_LockMutex(vga_frameLock);
 	while (running) {
-		if (vga_doRender == 1) {
-			vga_update(0, 0, vga_w - 1, vga_h - 1);
-			vga_doRender = 0;
+		if (!vga_framePending) {
+			SDL_CondWaitTimeout(vga_frameCond, vga_frameLock, 100); //the timeout only matters for noticing shutdown
+			continue;
 		}
+		vga_framePending = 0;
+		vga_dirtyRectCount = 0;
+		vga_indexed = !headless && sdlconsole_indexed() && !vncport && !capture_enabled; //those two want finished pixels
+		if (profile_enabled) start = profile_begin();
+		vga_update(0, 0, vga_frame.w - 1, vga_frame.h - 1, since);
+		if (profile_enabled) profile_endSection(PROFILE_SECT_RENDER, start);
+		if (vga_dirtyRectCount > 0) metrics.render.framesRendered++;
+		else metrics.render.framesUnchanged++;
+		since = vga_frame.gen;
+		w = vga_frame.w;
+		h = vga_frame.h;
+		SDL_UnlockMutex(vga_frameLock);
 
-		if (vga_doBlit == 1) {
-			sdlconsole_blit((uint32_t*)vga_framebuffer, (int)vga_w, (int)vga_h, 1024 * sizeof(uint32_t));
-			vga_doBlit = 0;
+		//with nothing drawn this only presents a frame that was held back earlier
+		if (profile_enabled) start = profile_begin();
+		if (!headless) {
+			if (vga_frameIndexed) {
+				vga_blitIndexed(w, h);
+			} else {
+				sdlconsole_blitRects((uint32_t*)vga_framebuffer, (int)w, (int)h, 1024 * sizeof(uint32_t), vga_dirtyRects, vga_dirtyRectCount);
+			}
 		}
-		else {
-			utility_sleep(1);
+#ifdef ENABLE_VNC
+		if (vncport) {
+			vnc_frame((uint32_t*)vga_framebuffer, (int)w, (int)h, 1024 * sizeof(uint32_t), vga_dirtyRects, vga_dirtyRectCount);
+		}
+#endif
+		if (capture_enabled) {
+			capture_frame((uint32_t*)vga_framebuffer, (int)w, (int)h, 1024 * sizeof(uint32_t), vga_dirtyRectCount > 0);
 		}
+		if (profile_enabled) profile_endSection(PROFILE_SECT_BLIT, start);
+		if (vga_dumpPending) {
+			vga_dumpPending = 0;
+			if (utility_savePPM(framedump, (uint32_t*)vga_framebuffer, w, h, 1024 * sizeof(uint32_t))) {
+				debug_log(DEBUG_ERROR, "[VGA] Unable to write frame dump to %s\r\n", framedump);
+			}
+		}
+
+		SDL_LockMutex(vga_frameLock);
 	}
+	SDL_UnlockMutex(vga_frameLock);
 #ifdef _WIN32
 	_endthread();
 #else
@@ -409,6 +797,92 @@ void vga_renderThread(void* dummy) {
 #endif
 }
 
+//Headless mode only. Draws the current frame on the CPU thread and writes it to the -framedump file
+void vga_dumpCallback(void* dummy) {
+	static uint32_t since = 0;
+
+	if (vncport || (capturefile != NULL)) { //the render thread is running, leave the drawing to it
+		vga_dumpPending = 1;
+		return;
+	}
+	vga_snapshot();
+	vga_dirtyRectCount = 0;
+	vga_update(0, 0, vga_frame.w - 1, vga_frame.h - 1, since);
+	since = vga_frame.gen;
+	if (utility_savePPM(framedump, (uint32_t*)vga_framebuffer, vga_frame.w, vga_frame.h, 1024 * sizeof(uint32_t))) {
+		debug_log(DEBUG_ERROR, "[VGA] Unable to write frame dump to %s\r\n", framedump);
+	}
+}
+
+//Registers and timing saved in snapshots, in order. The planes follow them.
+static const struct {
+	void* ptr;
+	uint32_t size;
+} vga_state[] = {
+	{ (void*)vga_palette, sizeof(vga_palette) }, { (void*)vga_pal32, sizeof(vga_pal32) }, { (void*)&vga_DAC, sizeof(vga_DAC) },
+	{ (void*)&vga_dots, sizeof(vga_dots) }, { (void*)&vga_w, sizeof(vga_w) }, { (void*)&vga_h, sizeof(vga_h) },
+	{ (void*)&vga_membase, sizeof(vga_membase) }, { (void*)&vga_memmask, sizeof(vga_memmask) },
+	{ (void*)&vga_cursorloc, sizeof(vga_cursorloc) }, { (void*)&vga_dbl, sizeof(vga_dbl) },
+	{ (void*)&vga_crtci, sizeof(vga_crtci) }, { (void*)vga_crtcd, sizeof(vga_crtcd) },
+	{ (void*)&vga_attri, sizeof(vga_attri) }, { (void*)vga_attrd, sizeof(vga_attrd) },
+	{ (void*)&vga_attrflipflop, sizeof(vga_attrflipflop) }, { (void*)&vga_attrpal, sizeof(vga_attrpal) },
+	{ (void*)&vga_gfxi, sizeof(vga_gfxi) }, { (void*)vga_gfxd, sizeof(vga_gfxd) },
+	{ (void*)&vga_seqi, sizeof(vga_seqi) }, { (void*)vga_seqd, sizeof(vga_seqd) },
+	{ (void*)&vga_misc, sizeof(vga_misc) }, { (void*)&vga_status0, sizeof(vga_status0) }, { (void*)&vga_status1, sizeof(vga_status1) },
+	{ (void*)&vga_cursor_blink_state, sizeof(vga_cursor_blink_state) },
+	{ (void*)&vga_wmode, sizeof(vga_wmode) }, { (void*)&vga_rmode, sizeof(vga_rmode) }, { (void*)&vga_shiftmode, sizeof(vga_shiftmode) },
+	{ (void*)&vga_rotate, sizeof(vga_rotate) }, { (void*)&vga_logicop, sizeof(vga_logicop) }, { (void*)&vga_enableplane, sizeof(vga_enableplane) },
+	{ (void*)&vga_readmap, sizeof(vga_readmap) }, { (void*)&vga_scandbl, sizeof(vga_scandbl) }, { (void*)&vga_hdbl, sizeof(vga_hdbl) },
+	{ (void*)&vga_bpp, sizeof(vga_bpp) }, { (void*)&vga_latch, sizeof(vga_latch) },
+	{ (void*)&vga_hblankstart, sizeof(vga_hblankstart) }, { (void*)&vga_hblankend, sizeof(vga_hblankend) },
+	{ (void*)&vga_hblanklen, sizeof(vga_hblanklen) }, { (void*)&vga_dispinterval, sizeof(vga_dispinterval) },
+	{ (void*)&vga_hblankinterval, sizeof(vga_hblankinterval) }, { (void*)&vga_htotal, sizeof(vga_htotal) },
+	{ (void*)&vga_vblankstart, sizeof(vga_vblankstart) }, { (void*)&vga_vblankend, sizeof(vga_vblankend) },
+	{ (void*)&vga_vblanklen, sizeof(vga_vblanklen) }, { (void*)&vga_vblankinterval, sizeof(vga_vblankinterval) },
+	{ (void*)&vga_frameinterval, sizeof(vga_frameinterval) }, { (void*)&vga_curScanline, sizeof(vga_curScanline) },
+	{ (void*)&vga_scanStart, sizeof(vga_scanStart) }
+};
+
+//one plane at a time, snapshots keep the planes one after another
+static uint8_t vga_planebuf[65536];
+
+//Writes the card's state into the snapshot section being saved
+void vga_saveState() {
+	uint32_t i, addr;
+
+	for (i = 0; i < (sizeof(vga_state) / sizeof(vga_state[0])); i++) {
+		snapshot_put(vga_state[i].ptr, vga_state[i].size);
+	}
+	for (i = 0; i < 4; i++) {
+		for (addr = 0; addr < 65536; addr++) {
+			vga_planebuf[addr] = VGA_PLANE(vga_RAM[addr], i);
+		}
+		snapshot_put(vga_planebuf, 65536);
+	}
+}
+
+//Reads back what vga_saveState wrote and has the whole screen redrawn from it
+int vga_loadState() {
+	uint32_t i, addr;
+
+	for (i = 0; i < (sizeof(vga_state) / sizeof(vga_state[0])); i++) {
+		if (snapshot_get(vga_state[i].ptr, vga_state[i].size)) return -1;
+	}
+	for (i = 0; i < 4; i++) {
+		if (snapshot_get(vga_planebuf, 65536)) return -1;
+		for (addr = 0; addr < 65536; addr++) {
+			vga_RAM[addr] = (vga_RAM[addr] & ~(0xFFUL << (i << 3))) | ((uint32_t)vga_planebuf[addr] << (i << 3));
+		}
+	}
+
+	for (i = 0; i < VGA_DIRTY_CHUNKS; i++) {
+		vga_dirty[i] = vga_dirtyGen;
+	}
+	vga_invalidate();
+	vga_fontGen = vga_dirtyGen;
+	return 0;
+}
+
 void vga_calcmemorymap() {
 	switch (vga_gfxd[0x06] & 0x0C) {
 	case 0x00: //0xA0000 - 0xBFFFF (128 KB)
@@ -462,6 +936,9 @@ void vga_writecrtci(uint8_t value) {
 void vga_writecrtcd(uint8_t value) {
 	if (vga_crtci > 0x18) return;
 
+	if ((vga_crtcd[vga_crtci] != value) && (vga_crtci != 0x0E) && (vga_crtci != 0x0F)) { //cursor moves are picked up by vga_update itself
+		vga_invalidate();
+	}
 	vga_crtcd[vga_crtci] = value;
 	//debug_log(DEBUG_DETAIL, "VGA CRTC index %02X = %u\r\n", vga_crtci, value);
 	switch (vga_crtci) {
@@ -478,9 +955,9 @@ void vga_writecrtcd(uint8_t value) {
 }
 
 void vga_writeport(void* dummy, uint16_t port, uint8_t value) {
-#ifdef DEBUG_VGA
-	debug_log(DEBUG_DETAIL, "Write VGA port: %02X -> %03X\r\n", value, port);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_VGA)) {
+		debug_log(DEBUG_DETAIL, "Write VGA port: %02X -> %03X\r\n", value, port);
+	}
 	switch (port) {
 	case 0x3B4:
 		if ((vga_misc & 1) == 0) {
@@ -499,8 +976,9 @@ void vga_writeport(void* dummy, uint16_t port, uint8_t value) {
 			vga_attrpal = value & 0x20;
 		}
 		else {
-			if (vga_attri < 0x15) {
+			if ((vga_attri < 0x15) && (vga_attrd[vga_attri] != value)) {
 				vga_attrd[vga_attri] = value;
+				vga_invalidate();
 			}
 		}
 		vga_attrflipflop ^= 1;
@@ -522,18 +1000,24 @@ void vga_writeport(void* dummy, uint16_t port, uint8_t value) {
 			vga_palette[vga_DAC.index][0] = vga_DAC.pal[vga_DAC.index][0] << 2;
 			vga_palette[vga_DAC.index][1] = vga_DAC.pal[vga_DAC.index][1] << 2;
 			vga_palette[vga_DAC.index][2] = vga_DAC.pal[vga_DAC.index][2] << 2;
+			vga_pal32[vga_DAC.index] = (uint32_t)vga_palette[vga_DAC.index][2] | ((uint32_t)vga_palette[vga_DAC.index][1] << 8) | ((uint32_t)vga_palette[vga_DAC.index][0] << 16);
+			vga_palGen = vga_dirtyGen;
 			vga_DAC.step = 0;
 			vga_DAC.index++;
 		}
 		break;
 	case 0x3C2:
 		vga_misc = value;
+		vga_invalidate();
 		break;
 	case 0x3C4:
 		vga_seqi = value & 0x1F;
 		break;
 	case 0x3C5:
 		if (vga_seqi < 0x05) {
+			if (((vga_seqi == 0x01) || (vga_seqi == 0x03)) && (vga_seqd[vga_seqi] != value)) { //dot clock/width and font select
+				vga_invalidate();
+			}
 			vga_seqd[vga_seqi] = value;
 			switch (vga_seqi) {
 			case 0x01:
@@ -564,6 +1048,9 @@ void vga_writeport(void* dummy, uint16_t port, uint8_t value) {
 			case 0x05:
 				vga_wmode = value & 3;
 				vga_rmode = (value >> 3) & 1;
+				if (vga_shiftmode != ((value >> 5) & 3)) {
+					vga_invalidate();
+				}
 				vga_shiftmode = (value >> 5) & 3;
 				//debug_log(DEBUG_DETAIL, "wmode = %u\r\n", vga_wmode);
 				//debug_log(DEBUG_DETAIL, "rmode = %u\r\n", vga_rmode);
@@ -589,9 +1076,9 @@ void vga_writeport(void* dummy, uint16_t port, uint8_t value) {
 
 uint8_t vga_readport(void* dummy, uint16_t port) {
 	uint8_t ret = 0xFF;
-#ifdef DEBUG_VGA
-	debug_log(DEBUG_DETAIL, "Read VGA port: %03X\r\n", port);
-#endif
+	if (DEBUG_ON(DEBUG_SUB_VGA)) {
+		debug_log(DEBUG_DETAIL, "Read VGA port: %03X\r\n", port);
+	}
 	switch (port) {
 	case 0x3B4:
 		if ((vga_misc & 1) == 0) {
@@ -657,12 +1144,13 @@ uint8_t vga_readport(void* dummy, uint16_t port) {
 		break;
 	case 0x3DA:
 		vga_attrflipflop = 0; //because VGA is weird
+		vga_retraceStatus();
 		return vga_status1;
 	}
 	return ret;
 }
 
-uint8_t vga_dologic(uint8_t value, uint8_t latch) {
+uint32_t vga_dologic(uint32_t value, uint32_t latch) {
 	switch (vga_logicop) {
 	case 0:
 		return value;
@@ -675,157 +1163,184 @@ uint8_t vga_dologic(uint8_t value, uint8_t latch) {
 	}
 }
 
+#define vga_putplane(addr, plane, value) vga_RAM[addr] = (vga_RAM[addr] & ~(0xFFUL << ((plane) << 3))) | ((uint32_t)(value) << ((plane) << 3))
+
 void vga_writememory(void* dummy, uint32_t addr, uint8_t value) {
-	uint8_t temp, plane;
+	uint32_t data, mask, planes;
 	if ((vga_misc & 0x02) == 0) return; //RAM writes are disabled
 	addr -= 0xA0000;
 	addr = (addr - vga_membase) & vga_memmask; //TODO: Is this right?
 
 	if (vga_gfxd[0x05] & 0x10) { //host odd/even mode (text)
-		vga_RAM[addr & 1][addr >> 1] = value;
+		vga_putplane(addr >> 1, addr & 1, value);
+		vga_markdirty(addr >> 1);
 		return;
 	}
 
 	if (vga_seqd[0x04] & 0x08) { //chain-4
-		vga_RAM[addr & 3][addr >> 2] = value;
+		vga_putplane(addr >> 2, addr & 3, value);
+		vga_markdirty(addr >> 2);
 		return;
 	}
 
+	vga_markdirty(addr);
+	if (vga_enableplane & 0x04) { //plane 2 holds the font in text mode
+		vga_fontGen = vga_dirtyGen;
+	}
+
+	//every mode is worked out for all four planes at once, the map mask then picks which of them take it
 	switch (vga_wmode) {
 	case 0:
-		for (plane = 0; plane < 4; plane++) {
-			if (vga_enableplane & (1 << plane)) { //are we allowed to write to this plane?
-				if (vga_gfxd[0x01] & (1 << plane)) { //test enable set/reset bit for plane
-					temp = (vga_gfxd[0x00] & (1 << plane)) ? 0xFF : 0x00; //set/reset expansion as source data
-				} else { //host data as source
-					temp = vga_dorotate(value);
-				}
-				temp = vga_dologic(temp, vga_latch[plane]);
-				temp = (temp & vga_gfxd[0x08]) | (vga_latch[plane] & (~vga_gfxd[0x08]));
-				vga_RAM[plane][addr] = temp;
-				//debug_log(DEBUG_DETAIL, "mode 0 write plane %u\r\n", plane);
-			}
-		}
+		data = vga_dorotate(value) * 0x01010101UL;
+		mask = vga_planeExpand[vga_gfxd[0x01] & 0x0F]; //planes with set/reset enabled take it instead of host data
+		data = (data & ~mask) | (vga_planeExpand[vga_gfxd[0x00] & 0x0F] & mask);
+		data = vga_dologic(data, vga_latch);
+		mask = vga_gfxd[0x08] * 0x01010101UL;
 		break;
 	case 1:
-		for (plane = 0; plane < 4; plane++) {
-			if (vga_enableplane & (1 << plane)) {
-				vga_RAM[plane][addr] = vga_latch[plane];
-				//debug_log(DEBUG_DETAIL, "mode 1 write plane %u\r\n", plane);
-			}
-		}
+		data = vga_latch;
+		mask = 0xFFFFFFFF;
 		break;
 	case 2:
-		for (plane = 0; plane < 4; plane++) {
-			if (vga_enableplane & (1 << plane)) {
-				temp = (value & (1 << plane)) ? 0xFF : 0x00;
-				temp = vga_dologic(temp, vga_latch[plane]);
-				temp = (temp & vga_gfxd[0x08]) | (vga_latch[plane] & (~vga_gfxd[0x08]));
-				vga_RAM[plane][addr] = temp;
-			}
-		}
+		data = vga_dologic(vga_planeExpand[value & 0x0F], vga_latch);
+		mask = vga_gfxd[0x08] * 0x01010101UL;
 		break;
-	case 3:
-		for (plane = 0; plane < 4; plane++) {
-			if (vga_enableplane & (1 << plane)) {
-				temp = (vga_gfxd[0x00] & (1 << plane)) ? 0xFF : 0x00;
-				temp = (vga_dorotate(value) & vga_gfxd[0x08]) | (temp & (~vga_gfxd[0x08])); //bit mask logic
-				vga_RAM[plane][addr] = temp;
-			}
-		}
+	default: //3, set/reset is the data and the rotated host byte ANDs into the bit mask
+		data = vga_dologic(vga_planeExpand[vga_gfxd[0x00] & 0x0F], vga_latch);
+		mask = (vga_dorotate(value) & vga_gfxd[0x08]) * 0x01010101UL;
 		break;
 	}
+	data = (data & mask) | (vga_latch & ~mask);
+	planes = vga_planeExpand[vga_enableplane & 0x0F];
+	vga_RAM[addr] = (vga_RAM[addr] & ~planes) | (data & planes);
+}
+
+//Bulk handlers, the write modes, latches and plane masks still apply to every byte but the CPU's per-byte page lookup is skipped
+uint32_t vga_writeBlock(void* dummy, uint32_t addr, const uint8_t* src, uint32_t len) {
+	uint32_t i;
+
+	for (i = 0; i < len; i++) {
+		vga_writememory(dummy, addr + i, src[i]);
+	}
+	return len;
+}
+
+uint32_t vga_readBlock(void* dummy, uint32_t addr, uint8_t* dst, uint32_t len) {
+	uint32_t i;
+
+	for (i = 0; i < len; i++) {
+		dst[i] = vga_readmemory(dummy, addr + i);
+	}
+	return len;
 }
 
 uint8_t vga_readmemory(void* dummy, uint32_t addr) {
-	uint8_t plane, ret;
+	uint32_t diff;
 
 	addr -= 0xA0000;
 	addr = (addr - vga_membase) & vga_memmask; //TODO: Is this right?
 
 	if (vga_gfxd[0x05] & 0x10) { //host odd/even mode (text)
-		return vga_RAM[addr & 1][addr >> 1];
+		return VGA_PLANE(vga_RAM[(addr >> 1) & 0xFFFF], addr & 1);
 	}
 
 	if (vga_seqd[0x04] & 0x08) { //chain-4
-		return vga_RAM[addr & 3][addr >> 2];
+		return VGA_PLANE(vga_RAM[(addr >> 2) & 0xFFFF], addr & 3);
 	}
 
-	vga_latch[0] = vga_RAM[0][addr];
-	vga_latch[1] = vga_RAM[1][addr];
-	vga_latch[2] = vga_RAM[2][addr];
-	vga_latch[3] = vga_RAM[3][addr];
-
+	vga_latch = vga_RAM[addr];
 	if (vga_rmode == 0) {
-		return vga_RAM[vga_readmap][addr];
-	} else {
-		//TODO: Is this correct?
-		ret = 0;
-		for (plane = 0; plane < 4; plane++) {
-			if (vga_gfxd[0x07] & (1 << plane)) { //color don't care bit check
-				if ((vga_RAM[plane][addr] & 0x0F) == (vga_gfxd[0x02] & 0x0F)) { //compare RAM value with color compare register
-					ret |= 1 << plane; //set bit if true
-				}
-			}
-		}
-		return ret;
+		return VGA_PLANE(vga_latch, vga_readmap);
+	}
+	//color compare: a bit is set where that pixel matches the compare color in every plane color don't care selects
+	diff = (vga_latch ^ vga_planeExpand[vga_gfxd[0x02] & 0x0F]) & vga_planeExpand[vga_gfxd[0x07] & 0x0F];
+	diff |= diff >> 16;
+	diff |= diff >> 8;
+	return (uint8_t)~diff;
+}
+
+//Whether the next snapshot would have anything for the render thread to draw
+static uint8_t vga_changed() {
+	uint32_t i;
+
+	if ((vga_allGen > vga_frame.gen) || (vga_fontGen > vga_frame.gen) || (vga_palGen > vga_frame.gen)) return 1;
+	if ((vga_cursor_blink_state != vga_frame.blink) || memcmp(&vga_crtcd[0xE], &vga_frame.crtcd[0xE], 2)) return 1;
+	for (i = 0; i < VGA_DIRTY_CHUNKS; i++) {
+		if (vga_dirty[i] > vga_frame.gen) return 1;
 	}
+	return 0;
 }
 
 void vga_drawCallback(void* dummy) {
-	vga_doRender = 1;
-	vga_doBlit = 1;
+	static uint32_t skipped = 0;
+
+	if (turbo && (++skipped < TURBO_FRAMEDIV)) {
+		metrics.cpu.framesSkipped++;
+		return;
+	}
+	skipped = 0;
+	if (!frameskip_draw(vga_targetFPS, vga_changed())) {
+		return; //short of time, the dirty stamps carry over like a frame the render thread was too busy for
+	}
+	if (SDL_TryLockMutex(vga_frameLock) != 0) {
+		metrics.cpu.framesSkipped++;
+		return; //still drawing the previous frame, the dirty stamps carry over to the next snapshot
+	}
+	vga_snapshot();
+	vga_framePending = 1;
+	SDL_CondSignal(vga_frameCond);
+	SDL_UnlockMutex(vga_frameLock);
 }
 
 void vga_blinkCallback(void* dummy) {
 	vga_cursor_blink_state ^= 1;
 }
 
-void vga_hblankCallback(void* dummy) {
-	timing_timerEnable(vga_hblankEndTimer);
-	vga_status1 |= 0x01;
-	vga_curScanline++;
-	if (vga_curScanline == vga_vblankstart) {
-		vga_status1 |= 0x08;
+//Works out the display enable and vertical retrace bits of 3DAh from the guest clock, when it's read
+void vga_retraceStatus() {
+	uint64_t elapsed, line, frame;
+
+	vga_status1 &= 0xF6;
+	if (vga_dispinterval == 0) return;
+	elapsed = timing_getGuestCur() - vga_scanStart;
+	line = elapsed / vga_dispinterval; //scanlines started so far
+	if ((line > 0) && ((elapsed % vga_dispinterval) < vga_hblankinterval)) {
+		vga_status1 |= 0x01;
 	}
-	else if (vga_curScanline == vga_vblankend) {
-		vga_curScanline = 0;
-		vga_status1 &= 0xF7;
+	frame = (vga_vblankend > 0) ? vga_vblankend : 1;
+	vga_curScanline = (uint16_t)(line % frame);
+	if (vga_curScanline >= vga_vblankstart) {
+		vga_status1 |= 0x08;
 	}
 }
 
-void vga_hblankEndCallback(void* dummy) {
-	timing_timerDisable(vga_hblankEndTimer);
-	vga_status1 &= 0xFE;
-}
-
 void vga_dumpregs() {
-#ifdef DEBUG_VGA
-	int i;
-	debug_log(DEBUG_DETAIL, "VGA registers:\r\n");
-	for (i = 0; i < 0x15; i++) {
-		debug_log(DEBUG_DETAIL, "  ATTR[0x%02X] = %u%u%u%u%u%u%u%u\r\n", i,
-			(vga_attrd[i] >> 7) & 1, (vga_attrd[i] >> 6) & 1, (vga_attrd[i] >> 5) & 1, (vga_attrd[i] >> 4) & 1,
-			(vga_attrd[i] >> 3) & 1, (vga_attrd[i] >> 2) & 1, (vga_attrd[i] >> 1) & 1, (vga_attrd[i] >> 0) & 1);
-	}
-	debug_log(DEBUG_DETAIL, "\r\n");
-	for (i = 0; i < 0x05; i++) {
-		debug_log(DEBUG_DETAIL, "  SEQ[0x%02X] = %u%u%u%u%u%u%u%u\r\n", i,
-			(vga_seqd[i] >> 7) & 1, (vga_seqd[i] >> 6) & 1, (vga_seqd[i] >> 5) & 1, (vga_seqd[i] >> 4) & 1,
-			(vga_seqd[i] >> 3) & 1, (vga_seqd[i] >> 2) & 1, (vga_seqd[i] >> 1) & 1, (vga_seqd[i] >> 0) & 1);
-	}
-	debug_log(DEBUG_DETAIL, "\r\n");
-	for (i = 0; i < 0x09; i++) {
-		debug_log(DEBUG_DETAIL, "  GFX[0x%02X] = %u%u%u%u%u%u%u%u\r\n", i,
-			(vga_gfxd[i] >> 7) & 1, (vga_gfxd[i] >> 6) & 1, (vga_gfxd[i] >> 5) & 1, (vga_gfxd[i] >> 4) & 1,
-			(vga_gfxd[i] >> 3) & 1, (vga_gfxd[i] >> 2) & 1, (vga_gfxd[i] >> 1) & 1, (vga_gfxd[i] >> 0) & 1);
-	}
-	debug_log(DEBUG_DETAIL, "\r\n");
-	for (i = 0; i < 0x19; i++) {
-		debug_log(DEBUG_DETAIL, "  CRTC[0x%02X] = %u%u%u%u%u%u%u%u\r\n", i,
-			(vga_crtcd[i] >> 7) & 1, (vga_crtcd[i] >> 6) & 1, (vga_crtcd[i] >> 5) & 1, (vga_crtcd[i] >> 4) & 1,
-			(vga_crtcd[i] >> 3) & 1, (vga_crtcd[i] >> 2) & 1, (vga_crtcd[i] >> 1) & 1, (vga_crtcd[i] >> 0) & 1);
-	}
-	debug_log(DEBUG_DETAIL, "\r\n");
-#endif
+	if (DEBUG_ON(DEBUG_SUB_VGA)) {
+		int i;
+		debug_log(DEBUG_DETAIL, "VGA registers:\r\n");
+		for (i = 0; i < 0x15; i++) {
+			debug_log(DEBUG_DETAIL, "  ATTR[0x%02X] = %u%u%u%u%u%u%u%u\r\n", i,
+				(vga_attrd[i] >> 7) & 1, (vga_attrd[i] >> 6) & 1, (vga_attrd[i] >> 5) & 1, (vga_attrd[i] >> 4) & 1,
+				(vga_attrd[i] >> 3) & 1, (vga_attrd[i] >> 2) & 1, (vga_attrd[i] >> 1) & 1, (vga_attrd[i] >> 0) & 1);
+		}
+		debug_log(DEBUG_DETAIL, "\r\n");
+		for (i = 0; i < 0x05; i++) {
+			debug_log(DEBUG_DETAIL, "  SEQ[0x%02X] = %u%u%u%u%u%u%u%u\r\n", i,
+				(vga_seqd[i] >> 7) & 1, (vga_seqd[i] >> 6) & 1, (vga_seqd[i] >> 5) & 1, (vga_seqd[i] >> 4) & 1,
+				(vga_seqd[i] >> 3) & 1, (vga_seqd[i] >> 2) & 1, (vga_seqd[i] >> 1) & 1, (vga_seqd[i] >> 0) & 1);
+		}
+		debug_log(DEBUG_DETAIL, "\r\n");
+		for (i = 0; i < 0x09; i++) {
+			debug_log(DEBUG_DETAIL, "  GFX[0x%02X] = %u%u%u%u%u%u%u%u\r\n", i,
+				(vga_gfxd[i] >> 7) & 1, (vga_gfxd[i] >> 6) & 1, (vga_gfxd[i] >> 5) & 1, (vga_gfxd[i] >> 4) & 1,
+				(vga_gfxd[i] >> 3) & 1, (vga_gfxd[i] >> 2) & 1, (vga_gfxd[i] >> 1) & 1, (vga_gfxd[i] >> 0) & 1);
+		}
+		debug_log(DEBUG_DETAIL, "\r\n");
+		for (i = 0; i < 0x19; i++) {
+			debug_log(DEBUG_DETAIL, "  CRTC[0x%02X] = %u%u%u%u%u%u%u%u\r\n", i,
+				(vga_crtcd[i] >> 7) & 1, (vga_crtcd[i] >> 6) & 1, (vga_crtcd[i] >> 5) & 1, (vga_crtcd[i] >> 4) & 1,
+				(vga_crtcd[i] >> 3) & 1, (vga_crtcd[i] >> 2) & 1, (vga_crtcd[i] >> 1) & 1, (vga_crtcd[i] >> 0) & 1);
+		}
+		debug_log(DEBUG_DETAIL, "\r\n");
+	}
 }
@@ -11,27 +11,70 @@ typedef struct {
 	uint8_t pal[256][3];
 } VGADAC_t;
 
+typedef struct {
+	uint32_t RAM[65536]; //same layout as vga_RAM
+	uint32_t pal32[256];
+	uint8_t crtcd[0x19];
+	uint8_t attrd[0x15];
+	uint8_t seqd[0x05];
+	uint8_t shiftmode;
+	uint8_t dbl;
+	uint8_t blink;
+	uint32_t dots;
+	uint32_t w;
+	uint32_t h;
+	uint32_t gen; //dirty generation this snapshot was taken at
+	uint32_t allGen;
+	uint32_t fontGen;
+	uint32_t palGen;
+} VGAFRAME_t; //display state captured at the end of a frame, the render thread only reads from this
+
+typedef struct {
+	uint32_t key; //character, attribute, font and blink phase, VGA_GLYPH_NONE if the slot is empty
+	uint32_t valid; //bit n set once row n has been rendered
+	uint32_t rows[32][9]; //host pixels for each scanline of the cell, a pixel per dot before any doubling
+} VGAGLYPH_t;
+
 extern uint8_t vga_palette[256][3];
+extern uint32_t vga_pal32[256];
 extern volatile double vga_lockFPS;
 
 int vga_init();
 void vga_updateScanlineTiming();
-void vga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end_y);
+void vga_addDirtyRows(uint32_t y, uint32_t count);
+void vga_buildExpandTables();
+void vga_buildAttrLUT(uint32_t* lut);
+void vga_emitLine(uint32_t* dst, const uint8_t* idx, uint32_t count, uint32_t xscanpixels, const uint32_t* lut);
+void vga_fetch8bpp(uint8_t* idx, uint32_t base, uint32_t startaddr, uint32_t count);
+void vga_fetch4bpp(uint8_t* idx, uint32_t base, uint32_t startaddr, uint32_t count);
+void vga_fetch2bpp(uint8_t* idx, uint32_t base, uint32_t startaddr, uint32_t count);
+void vga_fetch1bpp(uint8_t* idx, uint32_t base, uint32_t startaddr, uint32_t count);
+void vga_glyphCheck(const uint32_t* lut);
+void vga_renderTextLine(uint32_t* dst, uint32_t scy, uint32_t width, uint32_t rowaddr, uint32_t maxscan, uint32_t fontbase,
+	uint32_t cursorcol, uint8_t cursorline, uint8_t blinkenable, uint8_t blinkstate, const uint32_t* lut);
+uint32_t vga_update(uint32_t start_x, uint32_t start_y, uint32_t end_x, uint32_t end_y, uint32_t since);
 void vga_writeport(void* dummy, uint16_t port, uint8_t value);
 uint8_t vga_readport(void* dummy, uint16_t port);
 void vga_blinkCallback(void* dummy);
-void vga_hblankCallback(void* dummy);
-void vga_hblankEndCallback(void* dummy);
+void vga_retraceStatus();
 void vga_drawCallback(void* dummy);
+void vga_dumpCallback(void* dummy);
+void vga_snapshot();
+void vga_blitIndexed(uint32_t w, uint32_t h);
 void vga_renderThread(void* cpu);
 void vga_writememory(void* dummy, uint32_t addr, uint8_t value);
 uint8_t vga_readmemory(void* dummy, uint32_t addr);
+uint32_t vga_writeBlock(void* dummy, uint32_t addr, const uint8_t* src, uint32_t len);
+uint32_t vga_readBlock(void* dummy, uint32_t addr, uint8_t* dst, uint32_t len);
 void vga_dumpregs();
+void vga_saveState();
+int vga_loadState();
 
 //#define cga_color(c) ((uint32_t)cga_palette[c][0] | ((uint32_t)cga_palette[c][1]<<8) | ((uint32_t)cga_palette[c][2]<<16))
-#define vga_color(c) ((uint32_t)vga_palette[c][2] | ((uint32_t)vga_palette[c][1]<<8) | ((uint32_t)vga_palette[c][0]<<16))
+#define vga_color(c) (vga_pal32[c])
 
 #define vga_dorotate(v) ((uint8_t)((v >> vga_rotate) | (v << (8 - vga_rotate))))
+#define VGA_PLANE(word, plane) ((uint8_t)((word) >> ((plane) << 3))) //one plane's byte out of a video memory word
 
 #define VGA_DAC_MODE_READ	0x00
 #define VGA_DAC_MODE_WRITE	0x03
@@ -45,4 +88,11 @@ void vga_dumpregs();
 #define VGA_MODE_GRAPHICS_2BPP				3
 #define VGA_MODE_GRAPHICS_1BPP				4
 
+#define VGA_DIRTY_SHIFT						6 //dirty tracking granularity, 64 byte chunks of each plane
+#define VGA_DIRTY_CHUNKS					(65536 >> VGA_DIRTY_SHIFT)
+#define VGA_DIRTY_RECTS						64
+
+#define VGA_GLYPHS							1024 //text cells kept pre-rendered, must be a power of two
+#define VGA_GLYPH_NONE						0xFFFFFFFF
+
 #endif
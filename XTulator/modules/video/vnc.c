@@ -0,0 +1,829 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Remote framebuffer (RFB, what VNC speaks) server, so a machine can be used
+	remotely without forwarding the SDL window, and from headless mode.
+
+	The render threads hand each frame's drawn areas to vnc_frame, which copies
+	them into vnc_fb and marks their rows. The server thread serves one client
+	at a time: when the client has asked for an update, the marked rows are
+	compared in VNC_TILE square tiles against vnc_sent, the frame as the client
+	already has it, and only tiles that differ go out, Raw or ZRLE encoded.
+	Keys and the mouse are put in the same input queue SDL's events go to.
+
+	There's no zlib in the tree, so the ZRLE stream is made of stored deflate
+	blocks. Its palette and run length tile encodings still do most of the
+	work, a tile of text usually takes a few dozen bytes.
+*/
+
+#include "../../config.h"
+#ifdef ENABLE_VNC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <SDL.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+pthread_t vnc_threadID;
+#endif
+#include "../../debuglog.h"
+#include "../../utility.h"
+#include "../../hostthread.h"
+#include "../input/mouse.h"
+#include "sdlconsole.h"
+#include "vnc.h"
+
+#ifdef _WIN32
+#define VNC_POLLFD			WSAPOLLFD
+#define vnc_poll(f, n, ms)	WSAPoll(f, n, ms)
+#else
+#define VNC_POLLFD			struct pollfd
+#define vnc_poll(f, n, ms)	poll(f, n, ms)
+#define closesocket			close
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define VNC_SENDFLAGS		MSG_NOSIGNAL
+#else
+#define VNC_SENDFLAGS		0
+#endif
+
+uint32_t* vnc_fb = NULL; //latest frame, VNC_MAXW pixels per row
+uint32_t* vnc_sent = NULL; //the frame as the client has it, only the server thread touches it
+uint8_t vnc_rows[VNC_MAXH]; //rows of vnc_fb written since the server thread last looked
+uint8_t vnc_changed = 0;
+int vnc_w = 640, vnc_h = 400;
+SDL_mutex* vnc_lock = NULL; //held while vnc_fb, vnc_rows and the size are used
+
+VNC_SOCKET vnc_server = VNC_NOSOCKET;
+VNC_CLIENT_t vnc_client;
+char* vnc_name;
+
+uint8_t vnc_out[VNC_OUTSIZE], vnc_zbuf[VNC_OUTSIZE];
+uint8_t vnc_tiles[VNC_MAXH / VNC_TILE][VNC_MAXW / VNC_TILE];
+uint16_t vnc_rects[(VNC_MAXH / VNC_TILE) * (VNC_MAXW / VNC_TILE)][4];
+
+//X keysyms for everything that isn't printable ASCII, and the XT scancodes they're sent as
+static const uint32_t vnc_keysyms[][2] = {
+	{ 0xFF08, 0x0E }, { 0xFF09, 0x0F }, { 0xFF0D, 0x1C }, { 0xFF1B, 0x01 }, { 0xFF8D, 0x1C },
+	{ 0xFFE3, 0x1D }, { 0xFFE4, 0x1D }, { 0xFFE1, 0x2A }, { 0xFFE2, 0x36 }, { 0xFFE9, 0x38 }, { 0xFFEA, 0x38 },
+	{ 0xFFE5, 0x3A }, { 0xFF7F, 0x45 }, { 0xFF14, 0x46 },
+	{ 0xFFBE, 0x3B }, { 0xFFBF, 0x3C }, { 0xFFC0, 0x3D }, { 0xFFC1, 0x3E }, { 0xFFC2, 0x3F },
+	{ 0xFFC3, 0x40 }, { 0xFFC4, 0x41 }, { 0xFFC5, 0x42 }, { 0xFFC6, 0x43 }, { 0xFFC7, 0x44 },
+	{ 0xFF50, 0x47 }, { 0xFF52, 0x48 }, { 0xFF55, 0x49 }, { 0xFF51, 0x4B }, { 0xFF53, 0x4D },
+	{ 0xFF57, 0x4F }, { 0xFF54, 0x50 }, { 0xFF56, 0x51 }, { 0xFF63, 0x52 }, { 0xFFFF, 0x53 },
+	{ 0xFFAA, 0x37 }, { 0xFFAD, 0x4A }, { 0xFFAB, 0x4E }, { 0xFFAE, 0x53 },
+	{ 0xFFB0, 0x52 }, { 0xFFB1, 0x4F }, { 0xFFB2, 0x50 }, { 0xFFB3, 0x51 }, { 0xFFB4, 0x4B },
+	{ 0xFFB5, 0x4C }, { 0xFFB6, 0x4D }, { 0xFFB7, 0x47 }, { 0xFFB8, 0x48 }, { 0xFFB9, 0x49 },
+	{ 0xFF95, 0x47 }, { 0xFF96, 0x4B }, { 0xFF97, 0x48 }, { 0xFF98, 0x4D }, { 0xFF99, 0x50 },
+	{ 0xFF9A, 0x49 }, { 0xFF9B, 0x51 }, { 0xFF9C, 0x4F }, { 0xFF9D, 0x4C }, { 0xFF9E, 0x52 }, { 0xFF9F, 0x53 }
+};
+
+//printable ASCII keysyms are the characters themselves, a key's plain and shifted character share its scancode
+static const struct {
+	const char* plain;
+	const char* shifted;
+	uint8_t first;
+} vnc_keyrows[] = {
+	{ "1234567890-=", "!@#$%^&*()_+", 0x02 },
+	{ "qwertyuiop[]", "QWERTYUIOP{}", 0x10 },
+	{ "asdfghjkl;'`", "ASDFGHJKL:\"~", 0x1E },
+	{ "\\zxcvbnm,./", "|ZXCVBNM<>?", 0x2B }
+};
+
+static uint8_t vnc_scancode(uint32_t keysym) {
+	uint32_t i;
+	const char* pos;
+
+	if (keysym == ' ') return 0x39;
+	if ((keysym > ' ') && (keysym < 0x7F)) {
+		for (i = 0; i < sizeof(vnc_keyrows) / sizeof(vnc_keyrows[0]); i++) {
+			if ((pos = strchr(vnc_keyrows[i].plain, (int)keysym)) != NULL) return vnc_keyrows[i].first + (uint8_t)(pos - vnc_keyrows[i].plain);
+			if ((pos = strchr(vnc_keyrows[i].shifted, (int)keysym)) != NULL) return vnc_keyrows[i].first + (uint8_t)(pos - vnc_keyrows[i].shifted);
+		}
+		return 0x00;
+	}
+	for (i = 0; i < sizeof(vnc_keysyms) / sizeof(vnc_keysyms[0]); i++) {
+		if (vnc_keysyms[i][0] == keysym) return (uint8_t)vnc_keysyms[i][1];
+	}
+	return 0x00;
+}
+
+static void vnc_put16(uint8_t* dst, uint16_t value) {
+	dst[0] = (uint8_t)(value >> 8);
+	dst[1] = (uint8_t)value;
+}
+
+static void vnc_put32(uint8_t* dst, uint32_t value) {
+	dst[0] = (uint8_t)(value >> 24);
+	dst[1] = (uint8_t)(value >> 16);
+	dst[2] = (uint8_t)(value >> 8);
+	dst[3] = (uint8_t)value;
+}
+
+static int vnc_sendAll(VNC_SOCKET sock, const uint8_t* src, uint32_t len) {
+	int ret;
+
+	while (len > 0) {
+		ret = send(sock, (const char*)src, (int)len, VNC_SENDFLAGS);
+		if (ret <= 0) return -1;
+		src += ret;
+		len -= (uint32_t)ret;
+	}
+	return 0;
+}
+
+static int vnc_recvAll(VNC_SOCKET sock, uint8_t* dst, uint32_t len) {
+	int ret;
+
+	while (len > 0) {
+		ret = recv(sock, (char*)dst, (int)len, 0);
+		if (ret <= 0) return -1;
+		dst += ret;
+		len -= (uint32_t)ret;
+	}
+	return 0;
+}
+
+//A framebuffer pixel in the client's format
+static uint32_t vnc_convert(VNC_CLIENT_t* client, uint32_t rgb) {
+	if (client->native) return rgb & 0xFFFFFF;
+	return ((((rgb >> 16) & 0xFF) * client->rmax / 255) << client->rshift) |
+		((((rgb >> 8) & 0xFF) * client->gmax / 255) << client->gshift) |
+		(((rgb & 0xFF) * client->bmax / 255) << client->bshift);
+}
+
+//Writes the low bytes of value in the client's byte order, returns how many
+static uint32_t vnc_putPixel(VNC_CLIENT_t* client, uint8_t* dst, uint32_t value, uint8_t bytes) {
+	uint8_t i;
+
+	for (i = 0; i < bytes; i++) {
+		dst[client->bigendian ? (bytes - 1 - i) : i] = (uint8_t)(value >> (i * 8));
+	}
+	return bytes;
+}
+
+static void vnc_setFormat(VNC_CLIENT_t* client, const uint8_t* pf) {
+	uint32_t mask;
+
+	client->bytes = pf[0] / 8;
+	client->bigendian = pf[2] ? 1 : 0;
+	client->rmax = ((uint16_t)pf[4] << 8) | pf[5];
+	client->gmax = ((uint16_t)pf[6] << 8) | pf[7];
+	client->bmax = ((uint16_t)pf[8] << 8) | pf[9];
+	client->rshift = pf[10];
+	client->gshift = pf[11];
+	client->bshift = pf[12];
+	client->native = (client->rmax == 255) && (client->gmax == 255) && (client->bmax == 255) &&
+		(client->rshift == 16) && (client->gshift == 8) && (client->bshift == 0);
+	mask = ((uint32_t)client->rmax << client->rshift) | ((uint32_t)client->gmax << client->gshift) | ((uint32_t)client->bmax << client->bshift);
+	client->cbytes = client->bytes;
+	client->cshift = 0;
+	if ((client->bytes == 4) && (pf[1] <= 24)) { //CPIXELs drop the unused byte of 32-bit pixels
+		if ((mask & 0xFF000000) == 0) {
+			client->cbytes = 3;
+		}
+		else if ((mask & 0xFF) == 0) {
+			client->cbytes = 3;
+			client->cshift = 8;
+		}
+	}
+}
+
+//Bytes needed for a ZRLE run length
+#define vnc_runBytes(len) ((((len) - 1) / 255) + 1)
+
+static uint32_t vnc_putRun(uint8_t* dst, uint32_t len) {
+	uint32_t count = 0;
+
+	len--;
+	while (len >= 255) {
+		dst[count++] = 255;
+		len -= 255;
+	}
+	dst[count++] = (uint8_t)len;
+	return count;
+}
+
+//One ZRLE tile of vnc_sent, in whichever subencoding comes out smallest. Returns its length.
+static uint32_t vnc_zrleTile(VNC_CLIENT_t* client, uint8_t* dst, int tx, int ty, int tw, int th) {
+	static uint8_t idx[VNC_TILE * VNC_TILE];
+	uint32_t palette[VNC_PALETTE], color, last, len, raw, packed, palrle, plainrle, best, run;
+	int x, y, n, i, pal, bits, cb;
+	uint8_t* start = dst;
+
+	cb = client->cbytes;
+	pal = 0;
+	n = 0;
+	palrle = plainrle = 0;
+	last = 0;
+	run = 0;
+	for (y = 0; y < th; y++) {
+		const uint32_t* src = &vnc_sent[(ty + y) * VNC_MAXW + tx];
+		for (x = 0; x < tw; x++, n++) {
+			color = src[x] & 0xFFFFFF;
+			if ((n > 0) && (color == last)) {
+				idx[n] = idx[n - 1];
+				run++;
+				continue;
+			}
+			if (run > 0) {
+				palrle += 1 + ((run > 1) ? vnc_runBytes(run) : 0);
+				plainrle += cb + vnc_runBytes(run);
+			}
+			run = 1;
+			last = color;
+			if (pal > VNC_PALETTE) continue; //too many colors for a palette, only the plain encodings are left
+			for (i = 0; i < pal; i++) {
+				if (palette[i] == color) break;
+			}
+			if ((i == pal) && (pal++ < VNC_PALETTE)) {
+				palette[i] = color;
+			}
+			idx[n] = (uint8_t)i;
+		}
+	}
+	palrle += 1 + ((run > 1) ? vnc_runBytes(run) : 0);
+	plainrle += cb + vnc_runBytes(run);
+
+	if (pal == 1) { //solid
+		*dst++ = 1;
+		dst += vnc_putPixel(client, dst, vnc_convert(client, palette[0]) >> client->cshift, (uint8_t)cb);
+		return (uint32_t)(dst - start);
+	}
+
+	raw = (uint32_t)(n * cb);
+	best = raw;
+	bits = (pal <= 2) ? 1 : ((pal <= 4) ? 2 : 4);
+	packed = 0xFFFFFFFF;
+	if (pal <= 16) {
+		packed = (uint32_t)(pal * cb + th * ((tw * bits + 7) / 8));
+		if (packed < best) best = packed;
+	}
+	if (pal <= VNC_PALETTE) {
+		palrle += (uint32_t)(pal * cb);
+		if (palrle < best) best = palrle;
+	}
+	else {
+		palrle = 0xFFFFFFFF;
+	}
+	if (plainrle < best) best = plainrle;
+
+	if ((best == packed) || (best == palrle)) {
+		*dst++ = (uint8_t)((best == packed) ? pal : (128 + pal));
+		for (i = 0; i < pal; i++) {
+			dst += vnc_putPixel(client, dst, vnc_convert(client, palette[i]) >> client->cshift, (uint8_t)cb);
+		}
+		if (best == packed) {
+			for (y = 0, n = 0; y < th; y++) {
+				uint8_t byte = 0, used = 0;
+				for (x = 0; x < tw; x++, n++) {
+					byte |= idx[n] << (8 - bits - used);
+					used += (uint8_t)bits;
+					if (used == 8) {
+						*dst++ = byte;
+						byte = 0;
+						used = 0;
+					}
+				}
+				if (used) *dst++ = byte; //rows start on a byte
+			}
+			return (uint32_t)(dst - start);
+		}
+		for (i = 0; i < tw * th; i += len) {
+			for (len = 1; ((i + (int)len) < (tw * th)) && (idx[i + len] == idx[i]); len++);
+			if (len == 1) {
+				*dst++ = idx[i];
+			}
+			else {
+				*dst++ = idx[i] | 0x80;
+				dst += vnc_putRun(dst, len);
+			}
+		}
+		return (uint32_t)(dst - start);
+	}
+
+	if (best == plainrle) {
+		*dst++ = 128;
+		for (y = 0, run = 0; y < th; y++) {
+			const uint32_t* src = &vnc_sent[(ty + y) * VNC_MAXW + tx];
+			for (x = 0; x < tw; x++) {
+				color = src[x] & 0xFFFFFF;
+				if ((run > 0) && (color == last)) {
+					run++;
+					continue;
+				}
+				if (run > 0) {
+					dst += vnc_putPixel(client, dst, vnc_convert(client, last) >> client->cshift, (uint8_t)cb);
+					dst += vnc_putRun(dst, run);
+				}
+				last = color;
+				run = 1;
+			}
+		}
+		dst += vnc_putPixel(client, dst, vnc_convert(client, last) >> client->cshift, (uint8_t)cb);
+		dst += vnc_putRun(dst, run);
+		return (uint32_t)(dst - start);
+	}
+
+	*dst++ = 0;
+	for (y = 0; y < th; y++) {
+		const uint32_t* src = &vnc_sent[(ty + y) * VNC_MAXW + tx];
+		for (x = 0; x < tw; x++) {
+			dst += vnc_putPixel(client, dst, vnc_convert(client, src[x]) >> client->cshift, (uint8_t)cb);
+		}
+	}
+	return (uint32_t)(dst - start);
+}
+
+//Encodes one rectangle of vnc_sent, header included, into vnc_out. Returns its length.
+static uint32_t vnc_encodeRect(VNC_CLIENT_t* client, int x, int y, int w, int h) {
+	uint32_t len, zlen, chunk, pos;
+	int tx, ty;
+	uint8_t* dst;
+
+	vnc_put16(&vnc_out[0], (uint16_t)x);
+	vnc_put16(&vnc_out[2], (uint16_t)y);
+	vnc_put16(&vnc_out[4], (uint16_t)w);
+	vnc_put16(&vnc_out[6], (uint16_t)h);
+	vnc_put32(&vnc_out[8], (uint32_t)client->encoding);
+	dst = &vnc_out[12];
+
+	if (client->encoding == VNC_ENC_RAW) {
+		for (ty = y; ty < (y + h); ty++) {
+			const uint32_t* src = &vnc_sent[ty * VNC_MAXW + x];
+			if (client->native && (client->bytes == 4) && !client->bigendian) {
+				memcpy(dst, src, w * sizeof(uint32_t));
+				dst += w * sizeof(uint32_t);
+				continue;
+			}
+			for (tx = 0; tx < w; tx++) {
+				dst += vnc_putPixel(client, dst, vnc_convert(client, src[tx]), client->bytes);
+			}
+		}
+		return (uint32_t)(dst - vnc_out);
+	}
+
+	zlen = 0;
+	for (ty = y; ty < (y + h); ty += VNC_TILE) {
+		for (tx = x; tx < (x + w); tx += VNC_TILE) {
+			zlen += vnc_zrleTile(client, &vnc_zbuf[zlen], tx, ty,
+				((x + w - tx) < VNC_TILE) ? (x + w - tx) : VNC_TILE, ((y + h - ty) < VNC_TILE) ? (y + h - ty) : VNC_TILE);
+		}
+	}
+
+	//wrap it in the zlib stream the client keeps open for the whole connection, as stored blocks
+	len = 4;
+	if (!client->zstarted) {
+		dst[len++] = 0x78;
+		dst[len++] = 0x01;
+		client->zstarted = 1;
+	}
+	for (pos = 0; pos < zlen; pos += chunk) {
+		chunk = ((zlen - pos) > 65535) ? 65535 : (zlen - pos);
+		dst[len++] = 0x00; //not the final block, stored
+		dst[len++] = (uint8_t)chunk;
+		dst[len++] = (uint8_t)(chunk >> 8);
+		dst[len++] = (uint8_t)~chunk;
+		dst[len++] = (uint8_t)(~chunk >> 8);
+		memcpy(&dst[len], &vnc_zbuf[pos], chunk);
+		len += chunk;
+	}
+	vnc_put32(dst, len - 4);
+	return 12 + len;
+}
+
+/*
+	Finds the tiles that changed since the client's last update and sends them,
+	merging runs of changed tiles along a row of tiles into one rectangle. An
+	incremental request with nothing changed stays outstanding.
+*/
+static int vnc_update(VNC_CLIENT_t* client) {
+	uint8_t head[16];
+	int tx, ty, tilesx, tilesy, y, w, h, rects, resize, full, i;
+	uint32_t len;
+
+	SDL_LockMutex(vnc_lock);
+	resize = ((vnc_w != client->w) || (vnc_h != client->h)) && client->desktopsize;
+	if (resize) {
+		client->w = vnc_w;
+		client->h = vnc_h;
+	}
+	full = client->wantfull || resize;
+	if (!full && !vnc_changed) {
+		SDL_UnlockMutex(vnc_lock);
+		return 0;
+	}
+	w = (vnc_w < client->w) ? vnc_w : client->w; //a client that can't be resized only sees what fits
+	h = (vnc_h < client->h) ? vnc_h : client->h;
+	tilesx = (w + VNC_TILE - 1) / VNC_TILE;
+	tilesy = (h + VNC_TILE - 1) / VNC_TILE;
+	rects = 0;
+	for (ty = 0; ty < tilesy; ty++) {
+		int top = ty * VNC_TILE, bottom = ((top + VNC_TILE) < h) ? (top + VNC_TILE) : h, marked = full;
+		for (y = top; (y < bottom) && !marked; y++) {
+			marked = vnc_rows[y];
+		}
+		for (tx = 0; tx < tilesx; tx++) {
+			int left = tx * VNC_TILE, tw = (((left + VNC_TILE) < w) ? (left + VNC_TILE) : w) - left;
+			vnc_tiles[ty][tx] = 0;
+			if (!marked) continue;
+			for (y = top; y < bottom; y++) {
+				if (full || (vnc_rows[y] && memcmp(&vnc_fb[y * VNC_MAXW + left], &vnc_sent[y * VNC_MAXW + left], tw * sizeof(uint32_t)))) {
+					vnc_tiles[ty][tx] = 1;
+					break;
+				}
+			}
+			if (!vnc_tiles[ty][tx]) continue;
+			for (y = top; y < bottom; y++) {
+				memcpy(&vnc_sent[y * VNC_MAXW + left], &vnc_fb[y * VNC_MAXW + left], tw * sizeof(uint32_t));
+			}
+			if ((tx > 0) && vnc_tiles[ty][tx - 1]) {
+				vnc_rects[rects - 1][2] += (uint16_t)tw;
+				continue;
+			}
+			vnc_rects[rects][0] = (uint16_t)left;
+			vnc_rects[rects][1] = (uint16_t)top;
+			vnc_rects[rects][2] = (uint16_t)tw;
+			vnc_rects[rects][3] = (uint16_t)(bottom - top);
+			rects++;
+		}
+	}
+	memset(vnc_rows, 0, sizeof(vnc_rows));
+	vnc_changed = 0;
+	SDL_UnlockMutex(vnc_lock);
+
+	if ((rects == 0) && !resize) return 0;
+
+	head[0] = 0; //FramebufferUpdate
+	head[1] = 0;
+	vnc_put16(&head[2], (uint16_t)(rects + resize));
+	if (vnc_sendAll(client->socket, head, 4)) return -1;
+	if (resize) {
+		memset(head, 0, 12);
+		vnc_put16(&head[4], (uint16_t)client->w);
+		vnc_put16(&head[6], (uint16_t)client->h);
+		vnc_put32(&head[8], (uint32_t)VNC_ENC_DESKTOPSIZE);
+		if (vnc_sendAll(client->socket, head, 12)) return -1;
+	}
+	for (i = 0; i < rects; i++) {
+		len = vnc_encodeRect(client, vnc_rects[i][0], vnc_rects[i][1], vnc_rects[i][2], vnc_rects[i][3]);
+		if (vnc_sendAll(client->socket, vnc_out, len)) return -1;
+	}
+	client->wantupdate = 0;
+	client->wantfull = 0;
+	return 0;
+}
+
+static void vnc_key(VNC_CLIENT_t* client, uint8_t down, uint32_t keysym) {
+	uint8_t scancode;
+
+	scancode = vnc_scancode(keysym);
+	if (scancode == 0x00) return;
+	if (down) {
+		if (client->keydown[scancode]) return; //the client's autorepeat, the emulated keyboard has its own
+		client->keydown[scancode] = 1;
+		sdlconsole_queueInput(SDLCONSOLE_EVENT_KEY, scancode, 0, 0, 0);
+	}
+	else if (client->keydown[scancode]) {
+		client->keydown[scancode] = 0;
+		sdlconsole_queueInput(SDLCONSOLE_EVENT_KEY, scancode | 0x80, 0, 0, 0);
+	}
+}
+
+//Pointer events are absolute, the emulated serial mouse only deals in movement
+static void vnc_pointer(VNC_CLIENT_t* client, uint8_t buttons, int x, int y) {
+	int dx, dy, stepx, stepy;
+	uint8_t changed;
+
+	if (client->havemouse) {
+		dx = x - client->mousex;
+		dy = y - client->mousey;
+		while ((dx != 0) || (dy != 0)) {
+			stepx = (dx < -128) ? -128 : ((dx > 127) ? 127 : dx);
+			stepy = (dy < -128) ? -128 : ((dy > 127) ? 127 : dy);
+			sdlconsole_queueInput(SDLCONSOLE_EVENT_MOUSE, MOUSE_ACTION_MOVE, MOUSE_NEITHER, (int8_t)stepx, (int8_t)stepy);
+			dx -= stepx;
+			dy -= stepy;
+		}
+	}
+	client->havemouse = 1;
+	client->mousex = x;
+	client->mousey = y;
+
+	changed = buttons ^ client->buttons;
+	if (changed & 0x01) {
+		sdlconsole_queueInput(SDLCONSOLE_EVENT_MOUSE, MOUSE_ACTION_LEFT, (buttons & 0x01) ? MOUSE_PRESSED : MOUSE_UNPRESSED, 0, 0);
+	}
+	if (changed & 0x04) {
+		sdlconsole_queueInput(SDLCONSOLE_EVENT_MOUSE, MOUSE_ACTION_RIGHT, (buttons & 0x04) ? MOUSE_PRESSED : MOUSE_UNPRESSED, 0, 0);
+	}
+	client->buttons = buttons;
+}
+
+//Reads and acts on one client message, returns -1 if the connection should be dropped
+static int vnc_message(VNC_CLIENT_t* client) {
+	uint8_t msg[20], discard[256];
+	uint32_t len, chunk;
+	uint16_t count, i;
+	int32_t encoding;
+
+	if (vnc_recvAll(client->socket, msg, 1)) return -1;
+	switch (msg[0]) {
+	case 0: //SetPixelFormat
+		if (vnc_recvAll(client->socket, &msg[1], 19)) return -1;
+		if (!msg[7] || ((msg[4] != 8) && (msg[4] != 16) && (msg[4] != 32))) {
+			debug_log(DEBUG_ERROR, "[VNC] Client asked for an unsupported pixel format\r\n");
+			return -1;
+		}
+		vnc_setFormat(client, &msg[4]);
+		break;
+	case 2: //SetEncodings
+		if (vnc_recvAll(client->socket, &msg[1], 3)) return -1;
+		count = ((uint16_t)msg[2] << 8) | msg[3];
+		client->encoding = VNC_ENC_RAW;
+		client->desktopsize = 0;
+		for (i = 0; i < count; i++) {
+			if (vnc_recvAll(client->socket, msg, 4)) return -1;
+			encoding = (int32_t)(((uint32_t)msg[0] << 24) | ((uint32_t)msg[1] << 16) | ((uint32_t)msg[2] << 8) | msg[3]);
+			if (encoding == VNC_ENC_DESKTOPSIZE) {
+				client->desktopsize = 1;
+			}
+			else if ((encoding == VNC_ENC_ZRLE) && (client->encoding == VNC_ENC_RAW)) {
+				client->encoding = VNC_ENC_ZRLE; //the list is in order of preference, Raw is always understood
+			}
+		}
+		break;
+	case 3: //FramebufferUpdateRequest
+		if (vnc_recvAll(client->socket, &msg[1], 9)) return -1;
+		client->wantupdate = 1;
+		if (!msg[1]) client->wantfull = 1;
+		break;
+	case 4: //KeyEvent
+		if (vnc_recvAll(client->socket, &msg[1], 7)) return -1;
+		vnc_key(client, msg[1], ((uint32_t)msg[4] << 24) | ((uint32_t)msg[5] << 16) | ((uint32_t)msg[6] << 8) | msg[7]);
+		break;
+	case 5: //PointerEvent
+		if (vnc_recvAll(client->socket, &msg[1], 5)) return -1;
+		vnc_pointer(client, msg[1], ((int)msg[2] << 8) | msg[3], ((int)msg[4] << 8) | msg[5]);
+		break;
+	case 6: //ClientCutText, not used
+		if (vnc_recvAll(client->socket, &msg[1], 7)) return -1;
+		len = ((uint32_t)msg[4] << 24) | ((uint32_t)msg[5] << 16) | ((uint32_t)msg[6] << 8) | msg[7];
+		while (len > 0) {
+			chunk = (len > sizeof(discard)) ? sizeof(discard) : len;
+			if (vnc_recvAll(client->socket, discard, chunk)) return -1;
+			len -= chunk;
+		}
+		break;
+	default:
+		debug_log(DEBUG_ERROR, "[VNC] Unknown client message type %u\r\n", msg[0]);
+		return -1;
+	}
+	return 0;
+}
+
+//Protocol version, security (None) and the init messages. Versions 3.3, 3.7 and 3.8 are spoken.
+static int vnc_handshake(VNC_CLIENT_t* client) {
+	static const uint8_t format[16] = { 32, 24, 0, 1, 0, 255, 0, 255, 0, 255, 16, 8, 0, 0, 0, 0 }; //the framebuffer's own
+	uint8_t buf[32];
+	uint32_t len;
+	int minor;
+
+	if (vnc_sendAll(client->socket, (const uint8_t*)"RFB 003.008\n", 12)) return -1;
+	if (vnc_recvAll(client->socket, buf, 12)) return -1;
+	if (memcmp(buf, "RFB 003.", 8)) return -1;
+	minor = atoi((char*)&buf[8]);
+	if (minor < 7) {
+		vnc_put32(buf, 1); //3.3, the server picks the security type
+		if (vnc_sendAll(client->socket, buf, 4)) return -1;
+	}
+	else {
+		buf[0] = 1; //one type, None
+		buf[1] = 1;
+		if (vnc_sendAll(client->socket, buf, 2) || vnc_recvAll(client->socket, buf, 1) || (buf[0] != 1)) return -1;
+		if (minor >= 8) {
+			vnc_put32(buf, 0); //SecurityResult OK
+			if (vnc_sendAll(client->socket, buf, 4)) return -1;
+		}
+	}
+	if (vnc_recvAll(client->socket, buf, 1)) return -1; //ClientInit, the shared flag doesn't matter with one client
+
+	SDL_LockMutex(vnc_lock);
+	client->w = vnc_w;
+	client->h = vnc_h;
+	SDL_UnlockMutex(vnc_lock);
+	vnc_setFormat(client, format);
+	vnc_put16(&buf[0], (uint16_t)client->w);
+	vnc_put16(&buf[2], (uint16_t)client->h);
+	memcpy(&buf[4], format, 16);
+	len = (uint32_t)strlen(vnc_name);
+	vnc_put32(&buf[20], len);
+	if (vnc_sendAll(client->socket, buf, 24) || vnc_sendAll(client->socket, (const uint8_t*)vnc_name, len)) return -1;
+	return 0;
+}
+
+static void vnc_accept() {
+	VNC_CLIENT_t* client = &vnc_client;
+	VNC_SOCKET sock;
+	int nodelay = 1;
+#ifdef _WIN32
+	unsigned long iMode = 0;
+#endif
+
+	sock = accept(vnc_server, NULL, NULL);
+	if (sock == VNC_NOSOCKET) return;
+#ifdef _WIN32
+	ioctlsocket(sock, FIONBIO, &iMode); //accepted sockets inherit nonblocking mode there
+#else
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+#endif
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+
+	memset(client, 0, sizeof(VNC_CLIENT_t));
+	client->socket = sock;
+	client->encoding = VNC_ENC_RAW;
+	if (vnc_handshake(client)) {
+		debug_log(DEBUG_INFO, "[VNC] Handshake with a client failed\r\n");
+		closesocket(sock);
+		client->socket = VNC_NOSOCKET;
+		return;
+	}
+	debug_log(DEBUG_INFO, "[VNC] Client connected\r\n");
+}
+
+static void vnc_disconnect() {
+	VNC_CLIENT_t* client = &vnc_client;
+	int i;
+
+	for (i = 0; i < 128; i++) { //don't leave keys stuck down in the guest
+		if (client->keydown[i]) {
+			sdlconsole_queueInput(SDLCONSOLE_EVENT_KEY, (uint16_t)(i | 0x80), 0, 0, 0);
+		}
+	}
+	closesocket(client->socket);
+	client->socket = VNC_NOSOCKET;
+	debug_log(DEBUG_INFO, "[VNC] Client disconnected\r\n");
+}
+
+#ifdef _WIN32
+void vnc_thread(void* dummy) {
+#else
+void* vnc_thread(void* dummy) {
+#endif
+	VNC_POLLFD fd;
+	int ret;
+
+	hostthread_apply(HOSTTHREAD_NET);
+
+	while (running) {
+		fd.fd = (vnc_client.socket != VNC_NOSOCKET) ? vnc_client.socket : vnc_server;
+		fd.events = POLLIN;
+		fd.revents = 0;
+		ret = vnc_poll(&fd, 1, VNC_POLLMS);
+		if (vnc_client.socket == VNC_NOSOCKET) {
+			if (ret > 0) vnc_accept();
+			continue;
+		}
+		if ((ret < 0) || ((ret > 0) && vnc_message(&vnc_client))) {
+			vnc_disconnect();
+			continue;
+		}
+		if (vnc_client.wantupdate && vnc_update(&vnc_client)) {
+			vnc_disconnect();
+		}
+	}
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+//Called by the render threads with the areas of the frame they drew
+void vnc_frame(uint32_t* pixels, int w, int h, int stride, SDL_Rect* rects, int count) {
+	SDL_Rect full;
+	int i, y;
+
+	if (vnc_lock == NULL) return;
+	if (w > VNC_MAXW) w = VNC_MAXW;
+	if (h > VNC_MAXH) h = VNC_MAXH;
+	SDL_LockMutex(vnc_lock);
+	if ((w != vnc_w) || (h != vnc_h)) {
+		vnc_w = w;
+		vnc_h = h;
+		full.x = 0; //the renderer only reports what it drew, take all of the new mode
+		full.y = 0;
+		full.w = w;
+		full.h = h;
+		rects = &full;
+		count = 1;
+	}
+	for (i = 0; i < count; i++) {
+		SDL_Rect rect = rects[i];
+		if ((rect.x + rect.w) > w) rect.w = w - rect.x;
+		if ((rect.y + rect.h) > h) rect.h = h - rect.y;
+		if ((rect.w <= 0) || (rect.h <= 0)) continue;
+		for (y = rect.y; y < (rect.y + rect.h); y++) {
+			memcpy(&vnc_fb[y * VNC_MAXW + rect.x], (uint8_t*)pixels + ((size_t)y * stride) + ((size_t)rect.x * sizeof(uint32_t)), rect.w * sizeof(uint32_t));
+			vnc_rows[y] = 1;
+		}
+		vnc_changed = 1;
+	}
+	SDL_UnlockMutex(vnc_lock);
+}
+
+int vnc_init(char* name, char* addr, uint16_t port) {
+	int ret;
+	struct addrinfo hints, *result = NULL;
+	char portstr[16];
+#ifdef _WIN32
+	WSADATA wsa;
+	unsigned long iMode = 1;
+#else
+	int reuse = 1;
+#endif
+
+	if (addr == NULL) addr = VNC_DEFAULTADDR;
+	debug_log(DEBUG_INFO, "[VNC] Initializing remote framebuffer server (listen on %s port %u)\r\n", addr, port);
+
+#ifdef _WIN32
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+	vnc_name = name;
+	vnc_client.socket = VNC_NOSOCKET;
+	vnc_fb = (uint32_t*)calloc((size_t)VNC_MAXW * VNC_MAXH, sizeof(uint32_t));
+	vnc_sent = (uint32_t*)calloc((size_t)VNC_MAXW * VNC_MAXH, sizeof(uint32_t));
+	vnc_lock = SDL_CreateMutex();
+	if ((vnc_fb == NULL) || (vnc_sent == NULL) || (vnc_lock == NULL)) {
+		debug_log(DEBUG_ERROR, "[VNC] Unable to allocate the framebuffer copies\r\n");
+		return -1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_PASSIVE;
+	sprintf(portstr, "%u", port);
+	ret = getaddrinfo(addr, portstr, &hints, &result);
+	if (ret != 0) {
+		debug_log(DEBUG_ERROR, "[VNC] getaddrinfo error: %d\r\n", ret);
+		return -1;
+	}
+	vnc_server = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (vnc_server == VNC_NOSOCKET) {
+		freeaddrinfo(result);
+		debug_log(DEBUG_ERROR, "[VNC] Could not create socket to listen on\r\n");
+		return -1;
+	}
+#ifdef _WIN32
+	ioctlsocket(vnc_server, FIONBIO, &iMode);
+#else
+	fcntl(vnc_server, F_SETFL, fcntl(vnc_server, F_GETFL, 0) | O_NONBLOCK);
+	setsockopt(vnc_server, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+#endif
+	ret = bind(vnc_server, result->ai_addr, (int)result->ai_addrlen);
+	freeaddrinfo(result);
+	if ((ret != 0) || (listen(vnc_server, 1) != 0)) {
+		debug_log(DEBUG_ERROR, "[VNC] Unable to listen on %s port %u\r\n", addr, port);
+		closesocket(vnc_server);
+		vnc_server = VNC_NOSOCKET;
+		return -1;
+	}
+
+	if (headless) {
+		sdlconsole_initInput(); //nothing else sets up the input queue
+	}
+
+#ifdef _WIN32
+	_beginthread(vnc_thread, 0, NULL);
+#else
+	pthread_create(&vnc_threadID, NULL, vnc_thread, NULL);
+#endif
+	return 0;
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef _VNC_H_
+#define _VNC_H_
+
+#include "../../config.h"
+
+#ifdef ENABLE_VNC
+#include <stdint.h>
+#include <SDL.h>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+typedef SOCKET VNC_SOCKET;
+#define VNC_NOSOCKET		INVALID_SOCKET
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+typedef int VNC_SOCKET;
+#define VNC_NOSOCKET		-1
+#endif
+
+#define VNC_MAXW			1024 //largest frame the renderers produce
+#define VNC_MAXH			1024
+#define VNC_TILE			64 //changes are found and sent in tiles this size, which is also the ZRLE tile size
+#define VNC_POLLMS			10 //longest the server thread waits on the client before it looks for a new frame
+#define VNC_PALETTE			127 //most colors a ZRLE tile can be palette encoded with
+#define VNC_OUTSIZE			(VNC_MAXW * VNC_TILE * 4 + 4096) //one row of tiles in the fattest encoding, plus headers
+#define VNC_DEFAULTADDR		"127.0.0.1" //there's no authentication, so only local connections unless asked
+
+#define VNC_ENC_RAW			0
+#define VNC_ENC_ZRLE		16
+#define VNC_ENC_DESKTOPSIZE	-223
+
+//what the connected client wants, and what it has been sent
+typedef struct {
+	VNC_SOCKET socket;
+	uint8_t bytes; //bytes per pixel
+	uint8_t bigendian;
+	uint16_t rmax, gmax, bmax;
+	uint8_t rshift, gshift, bshift;
+	uint8_t native; //pixels are laid out like the framebuffer's, they go out unconverted
+	uint8_t cbytes; //bytes in a ZRLE CPIXEL
+	uint8_t cshift; //how far a pixel is shifted right to make its CPIXEL
+	int32_t encoding; //VNC_ENC_RAW or VNC_ENC_ZRLE
+	uint8_t desktopsize; //understands the DesktopSize pseudo encoding
+	uint8_t wantupdate; //has a framebuffer update request outstanding
+	uint8_t wantfull; //and it wasn't incremental
+	uint8_t zstarted; //the zlib stream header has been sent
+	int w, h; //framebuffer size the client was last told
+	int mousex, mousey;
+	uint8_t havemouse, buttons;
+	uint8_t keydown[128]; //scancodes the client is holding down
+} VNC_CLIENT_t;
+
+int vnc_init(char* name, char* addr, uint16_t port);
+void vnc_frame(uint32_t* pixels, int w, int h, int stride, SDL_Rect* rects, int count);
+#endif
+
+#endif
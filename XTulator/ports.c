@@ -30,39 +30,60 @@
 #include "chipset/i8237.h"
 #include "chipset/i8255.h"
 #include "ports.h"
+#include "profile.h"
+#include "bench.h"
 #include "modules/video/sdlconsole.h"
+#include "modules/audio/sdlaudio.h"
 #include "modules/video/cga.h"
 #include "modules/video/vga.h"
 
-uint8_t (*ports_cbReadB[PORTS_COUNT])(void* udata, uint32_t portnum);
-uint16_t (*ports_cbReadW[PORTS_COUNT])(void* udata, uint32_t portnum);
-void (*ports_cbWriteB[PORTS_COUNT])(void* udata, uint32_t portnum, uint8_t value);
-void (*ports_cbWriteW[PORTS_COUNT])(void* udata, uint32_t portnum, uint16_t value);
-void* ports_udata[PORTS_COUNT];
+/*
+	Each registered range of ports gets one handler holding its callbacks, and
+	a byte per port says which handler it belongs to. That's a 4 KB map and a
+	small table instead of seven pointer arrays with an entry for every port,
+	so the lookups on the I/O path stay in cache.
+*/
+PORTS_HANDLER_t ports_handlers[PORTS_MAXHANDLERS + 1];
+uint8_t ports_map[PORTS_COUNT];
+uint32_t ports_handlerCount = 1;
 
 extern MACHINE_t machine;
 
 void port_write(CPU_t* cpu, uint16_t portnum, uint8_t value) {
-#ifdef DEBUG_PORTS
-	debug_log(DEBUG_DETAIL, "port_write @ %03X <- %02X\r\n", portnum, value);
-#endif
+	PORTS_HANDLER_t* handler;
+
+	if (DEBUG_ON(DEBUG_SUB_PORTS)) {
+		debug_log(DEBUG_DETAIL, "port_write @ %03X <- %02X\r\n", portnum, value);
+	}
 	portnum &= 0x0FFF;
 	if (portnum == 0x80) {
 		debug_log(DEBUG_INFO, "[POST CARD] Port 80h Out: %02X\n", value);
 	}
-	if (ports_cbWriteB[portnum] != NULL) {
-		(*ports_cbWriteB[portnum])(ports_udata[portnum], portnum, value);
+	profile_countPortOut(portnum);
+#ifdef USE_BENCH
+	bench_portWrite(portnum, value);
+#endif
+	if (sdlaudio_deferred) {
+		sdlaudio_portWrite(portnum, value);
+	}
+	handler = ports_handler(portnum);
+	if (handler->writeb != NULL) {
+		(*handler->writeb)(handler->udata, portnum, value);
 		return;
 	}
 }
 
 void port_writew(CPU_t* cpu, uint16_t portnum, uint16_t value) {
+	PORTS_HANDLER_t* handler;
+
 	portnum &= 0x0FFF;
 	if (portnum == 0x80) {
 		debug_log(DEBUG_DETAIL, "Diagnostic port out: %04X\r\n", value);
 	}
-	if (ports_cbWriteW[portnum] != NULL) {
-		(*ports_cbWriteW[portnum])(ports_udata[portnum], portnum, value);
+	handler = ports_handler(portnum);
+	if (handler->writew != NULL) {
+		profile_countPortOut(portnum);
+		(*handler->writew)(handler->udata, portnum, value);
 		return;
 	}
 	port_write(cpu, portnum, (uint8_t)value);
@@ -70,49 +91,131 @@ void port_writew(CPU_t* cpu, uint16_t portnum, uint16_t value) {
 }
 
 uint8_t port_read(CPU_t* cpu, uint16_t portnum) {
-#ifdef DEBUG_PORTS
-	debug_log(DEBUG_DETAIL, "port_read @ %03X\r\n", portnum);
-#endif
+	PORTS_HANDLER_t* handler;
+
+	if (DEBUG_ON(DEBUG_SUB_PORTS)) {
+		debug_log(DEBUG_DETAIL, "port_read @ %03X\r\n", portnum);
+	}
 	portnum &= 0x0FFF;
-	if (ports_cbReadB[portnum] != NULL) {
-		return (*ports_cbReadB[portnum])(ports_udata[portnum], portnum);
+	profile_countPortIn(portnum);
+	handler = ports_handler(portnum);
+	if (handler->readb != NULL) {
+		return (*handler->readb)(handler->udata, portnum);
 	}
 
 	return 0xFF;
 }
 
 uint16_t port_readw(CPU_t* cpu, uint16_t portnum) {
+	PORTS_HANDLER_t* handler;
 	uint16_t ret;
+
 	portnum &= 0x0FFF;
-	if (ports_cbReadW[portnum] != NULL) {
-		return (*ports_cbReadW[portnum])(ports_udata[portnum], portnum);
+	handler = ports_handler(portnum);
+	if (handler->readw != NULL) {
+		profile_countPortIn(portnum);
+		return (*handler->readw)(handler->udata, portnum);
 	}
 	ret = port_read(cpu, portnum);
 	ret |= (uint16_t)port_read(cpu, portnum + 1) << 8;
 	return ret;
 }
 
+//Returns how many of the count elements the port's bulk handler read into dst, the caller does the rest one access at a time
+uint32_t port_readBlock(CPU_t* cpu, uint16_t portnum, uint8_t* dst, uint32_t count, uint8_t size) {
+	PORTS_HANDLER_t* handler;
+	uint32_t n;
+
+	portnum &= 0x0FFF;
+	handler = ports_handler(portnum);
+	if (handler->readblock == NULL) {
+		return 0;
+	}
+	n = (*handler->readblock)(handler->udata, portnum, dst, count, size);
+	if (profile_enabled) profile_portIn[portnum] += n;
+	return n;
+}
+
+uint32_t port_writeBlock(CPU_t* cpu, uint16_t portnum, const uint8_t* src, uint32_t count, uint8_t size) {
+	PORTS_HANDLER_t* handler;
+	uint32_t n;
+
+	portnum &= 0x0FFF;
+	handler = ports_handler(portnum);
+	if (handler->writeblock == NULL) {
+		return 0;
+	}
+	n = (*handler->writeblock)(handler->udata, portnum, src, count, size);
+	if (profile_enabled) profile_portOut[portnum] += n;
+	return n;
+}
+
+static PORTS_HANDLER_t* ports_newHandler(uint32_t start, uint32_t count) {
+	PORTS_HANDLER_t* handler;
+
+	if (ports_handlerCount > PORTS_MAXHANDLERS) {
+		debug_log(DEBUG_ERROR, "[PORTS] Out of port handlers, ports %03X-%03X are left as they were\r\n", start, start + count - 1);
+		return NULL;
+	}
+	handler = &ports_handlers[ports_handlerCount];
+	memset(handler, 0, sizeof(PORTS_HANDLER_t));
+	handler->base = start;
+	handler->count = count;
+	return handler;
+}
+
 void ports_cbRegister(uint32_t start, uint32_t count, uint8_t (*readb)(void*, uint32_t), uint16_t (*readw)(void*, uint32_t), void (*writeb)(void*, uint32_t, uint8_t), void (*writew)(void*, uint32_t, uint16_t), void* udata) {
+	PORTS_HANDLER_t* handler;
 	uint32_t i;
+
+	if (start >= PORTS_COUNT) return;
+	if ((start + count) > PORTS_COUNT) count = PORTS_COUNT - start;
+	handler = ports_newHandler(start, count);
+	if (handler == NULL) return;
+	handler->readb = readb;
+	handler->readw = readw;
+	handler->writeb = writeb;
+	handler->writew = writew;
+	handler->udata = udata;
 	for (i = 0; i < count; i++) {
-		if ((start + i) >= PORTS_COUNT) {
-			break;
+		ports_map[start + i] = (uint8_t)ports_handlerCount;
+	}
+	ports_handlerCount++;
+}
+
+//After ports_cbRegister, for devices that can move a whole string in one go. Ports that are only part of a range get a copy of its handler.
+void ports_cbRegisterBlock(uint32_t start, uint32_t count, uint32_t (*readblock)(void*, uint32_t, uint8_t*, uint32_t, uint8_t), uint32_t (*writeblock)(void*, uint32_t, const uint8_t*, uint32_t, uint8_t)) {
+	PORTS_HANDLER_t* handler;
+	PORTS_HANDLER_t* split = NULL;
+	uint32_t i, from = PORTS_MAXHANDLERS + 1, to = 0;
+
+	if (start >= PORTS_COUNT) return;
+	if ((start + count) > PORTS_COUNT) count = PORTS_COUNT - start;
+	for (i = 0; i < count; i++) {
+		handler = ports_handler(start + i);
+		if ((handler->base >= start) && ((handler->base + handler->count) <= (start + count)) && (ports_map[start + i] != 0)) {
+			handler->readblock = readblock; //the whole range is covered
+			handler->writeblock = writeblock;
+			continue;
+		}
+		if (ports_map[start + i] != from) { //first port here from this range, split
+			from = ports_map[start + i];
+			split = ports_newHandler(start + i, 0);
+			if (split == NULL) return;
+			*split = ports_handlers[from];
+			split->base = start + i;
+			split->count = 0;
+			split->readblock = readblock;
+			split->writeblock = writeblock;
+			to = ports_handlerCount++;
 		}
-		ports_cbReadB[start + i] = readb;
-		ports_cbReadW[start + i] = readw;
-		ports_cbWriteB[start + i] = writeb;
-		ports_cbWriteW[start + i] = writew;
-		ports_udata[start + i] = udata;
+		ports_map[start + i] = (uint8_t)to;
+		split->count++;
 	}
 }
 
 void ports_init() {
-	uint32_t i;
-	for (i = 0; i < PORTS_COUNT; i++) {
-		ports_cbReadB[i] = NULL;
-		ports_cbReadW[i] = NULL;
-		ports_cbWriteB[i] = NULL;
-		ports_cbWriteW[i] = NULL;
-		ports_udata[i] = NULL;
-	}
+	memset(ports_handlers, 0, sizeof(ports_handlers));
+	memset(ports_map, 0, sizeof(ports_map));
+	ports_handlerCount = 1;
 }
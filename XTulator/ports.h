@@ -4,14 +4,29 @@
 #include <stdint.h>
 
 #define PORTS_COUNT 0x1000
+#define PORTS_MAXHANDLERS	255 //registered port ranges, handler 0 is the empty one
 
-extern uint8_t(*ports_cbReadB[PORTS_COUNT])(void* udata, uint32_t portnum);
-extern uint16_t(*ports_cbReadW[PORTS_COUNT])(void* udata, uint32_t portnum);
-extern void (*ports_cbWriteB[PORTS_COUNT])(void* udata, uint32_t portnum, uint8_t value);
-extern void (*ports_cbWriteW[PORTS_COUNT])(void* udata, uint32_t portnum, uint16_t value);
-extern void* ports_udata[PORTS_COUNT];
+//one per registered range of ports, the callbacks get the port number itself, base is there for devices that want the offset
+typedef struct {
+	uint32_t base;
+	uint32_t count;
+	uint8_t (*readb)(void* udata, uint32_t portnum);
+	uint16_t (*readw)(void* udata, uint32_t portnum);
+	void (*writeb)(void* udata, uint32_t portnum, uint8_t value);
+	void (*writew)(void* udata, uint32_t portnum, uint16_t value);
+	//optional bulk handlers REP INS and REP OUTS try first, they move up to count elements of size bytes and return how many they did
+	uint32_t (*readblock)(void* udata, uint32_t portnum, uint8_t* dst, uint32_t count, uint8_t size);
+	uint32_t (*writeblock)(void* udata, uint32_t portnum, const uint8_t* src, uint32_t count, uint8_t size);
+	void* udata;
+} PORTS_HANDLER_t;
+
+extern PORTS_HANDLER_t ports_handlers[PORTS_MAXHANDLERS + 1];
+extern uint8_t ports_map[PORTS_COUNT]; //handler of each port
+
+#define ports_handler(portnum) (&ports_handlers[ports_map[portnum]])
 
 void ports_cbRegister(uint32_t start, uint32_t count, uint8_t(*readb)(void*, uint32_t), uint16_t(*readw)(void*, uint32_t), void (*writeb)(void*, uint32_t, uint8_t), void (*writew)(void*, uint32_t, uint16_t), void* udata);
+void ports_cbRegisterBlock(uint32_t start, uint32_t count, uint32_t (*readblock)(void*, uint32_t, uint8_t*, uint32_t, uint8_t), uint32_t (*writeblock)(void*, uint32_t, const uint8_t*, uint32_t, uint8_t));
 void ports_init();
 
 #endif
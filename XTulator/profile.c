@@ -0,0 +1,260 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Built-in profiler, enabled with -profile.
+
+	Counts instructions per opcode, port I/O per port and MMIO callback hits
+	per 4 KB page, and times each timer callback run by timing_loop plus video
+	rendering and blitting. A summary goes to the log when the emulator exits.
+	With -profilecsv the cumulative counters are also appended to a CSV file
+	periodically, one row per non-zero counter:
+
+		seconds,category,item,count,microseconds
+
+	The counters are plain increments. Rendering and blitting run on the render
+	thread in VGA mode, but each counter only ever has one writer.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "config.h"
+#include "debuglog.h"
+#include "timing.h"
+#include "memory.h"
+#include "ports.h"
+#include "profile.h"
+
+uint8_t profile_enabled = 0;
+uint64_t profile_ops[256], profile_ops0F[256];
+uint64_t profile_portIn[PORTS_COUNT], profile_portOut[PORTS_COUNT];
+uint64_t profile_mmioRead[MEMORY_PAGES], profile_mmioWrite[MEMORY_PAGES];
+PROFILE_TIME_t profile_timers[PROFILE_MAXTIMERS];
+PROFILE_TIME_t profile_sections[PROFILE_SECTIONS];
+
+uint64_t profile_start = 0, profile_freq = 1;
+FILE* profile_csv = NULL;
+
+const char* profile_sectionNames[PROFILE_SECTIONS] = { "render", "blit" };
+
+uint64_t profile_begin() {
+	return SDL_GetPerformanceCounter();
+}
+
+void profile_endTimer(uint32_t tnum, uint64_t start) {
+	if (tnum >= PROFILE_MAXTIMERS) return;
+	profile_timers[tnum].calls++;
+	profile_timers[tnum].ticks += SDL_GetPerformanceCounter() - start;
+}
+
+void profile_endSection(uint8_t sect, uint64_t start) {
+	profile_sections[sect].calls++;
+	profile_sections[sect].ticks += SDL_GetPerformanceCounter() - start;
+}
+
+static double profile_usec(uint64_t ticks) {
+	return (double)ticks * 1000000.0 / (double)profile_freq;
+}
+
+static uint64_t profile_instructions() {
+	uint64_t total = 0;
+	uint32_t i;
+	for (i = 0; i < 256; i++) {
+		total += profile_ops[i];
+	}
+	return total;
+}
+
+//Fills out with the indexes of the (up to) max largest a[i] + b[i], largest first. Returns how many are non-zero.
+static uint32_t profile_top(const uint64_t* a, const uint64_t* b, uint32_t n, uint32_t* out, uint32_t max) {
+	uint32_t i, j, found = 0;
+	uint64_t val;
+
+	for (i = 0; i < n; i++) {
+		val = a[i] + ((b == NULL) ? 0 : b[i]);
+		if (val == 0) continue;
+		for (j = found; j > 0; j--) {
+			uint32_t prev = out[j - 1];
+			if ((a[prev] + ((b == NULL) ? 0 : b[prev])) >= val) break;
+			if (j < max) out[j] = prev;
+		}
+		if (j < max) {
+			out[j] = i;
+			if (found < max) found++;
+		}
+	}
+	return found;
+}
+
+//Adjacent pages handled by the same callbacks are one device, returns the page after the range starting at page
+static uint32_t profile_mmioRange(uint32_t page) {
+	MEMORY_PAGE_t* first = &memory_pages[page];
+	uint32_t end;
+
+	for (end = page + 1; end < MEMORY_PAGES; end++) {
+		MEMORY_PAGE_t* cur = &memory_pages[end];
+		if ((profile_mmioRead[end] + profile_mmioWrite[end]) == 0) break;
+		if ((cur->readcb != first->readcb) || (cur->writecb != first->writecb) || (cur->udata != first->udata) || (cur->sub != NULL) || (first->sub != NULL)) break;
+	}
+	return end;
+}
+
+void profile_report() {
+	uint32_t top[PROFILE_TOP], count, i, page, end;
+	uint64_t total;
+	double seconds;
+	TIMER timer;
+
+	if (!profile_enabled) return;
+	total = profile_instructions();
+	seconds = (double)(SDL_GetPerformanceCounter() - profile_start) / (double)profile_freq;
+
+	debug_log(DEBUG_INFO, "[PROFILE] %llu instructions in %.02f seconds (%.02f MIPS)\r\n", (unsigned long long)total, seconds,
+		(seconds > 0) ? (double)total / seconds / 1000000.0 : 0.0);
+
+	count = profile_top(profile_ops, NULL, 256, top, PROFILE_TOP);
+	debug_log(DEBUG_INFO, "[PROFILE] Top opcodes:\r\n");
+	for (i = 0; i < count; i++) {
+		debug_log(DEBUG_INFO, "[PROFILE]   %02X     %14llu  %5.02f%%\r\n", top[i], (unsigned long long)profile_ops[top[i]],
+			(double)profile_ops[top[i]] * 100.0 / (double)total);
+	}
+	count = profile_top(profile_ops0F, NULL, 256, top, PROFILE_TOP);
+	if (count > 0) {
+		debug_log(DEBUG_INFO, "[PROFILE] Top 0F opcodes:\r\n");
+		for (i = 0; i < count; i++) {
+			debug_log(DEBUG_INFO, "[PROFILE]   0F %02X  %14llu\r\n", top[i], (unsigned long long)profile_ops0F[top[i]]);
+		}
+	}
+
+	debug_log(DEBUG_INFO, "[PROFILE] Timer callbacks:          calls      total ms    avg us\r\n");
+	for (i = 0; (i < timing_timerCount()) && (i < PROFILE_MAXTIMERS); i++) {
+		if (profile_timers[i].calls == 0) continue;
+		timing_timerState(i, &timer);
+		debug_log(DEBUG_INFO, "[PROFILE]   #%-3u %s %10.02f Hz %10llu  %12.02f  %8.02f  (callback %p)\r\n", i,
+			(timer.clock == TIMING_CLOCK_GUEST) ? "guest" : "host ",
+			(timer.interval > 0) ? (double)timing_getFreq() / (double)timer.interval : 0.0,
+			(unsigned long long)profile_timers[i].calls, profile_usec(profile_timers[i].ticks) / 1000.0,
+			profile_usec(profile_timers[i].ticks) / (double)profile_timers[i].calls, (void*)timer.callback);
+	}
+
+	count = profile_top(profile_portIn, profile_portOut, PORTS_COUNT, top, PROFILE_TOP);
+	if (count > 0) {
+		debug_log(DEBUG_INFO, "[PROFILE] Top I/O ports:        in             out\r\n");
+		for (i = 0; i < count; i++) {
+			debug_log(DEBUG_INFO, "[PROFILE]   %03X   %14llu  %14llu\r\n", top[i], (unsigned long long)profile_portIn[top[i]], (unsigned long long)profile_portOut[top[i]]);
+		}
+	}
+
+	debug_log(DEBUG_INFO, "[PROFILE] MMIO callbacks:             reads          writes\r\n");
+	for (page = 0; page < MEMORY_PAGES; page = end) {
+		uint64_t reads = 0, writes = 0;
+		if ((profile_mmioRead[page] + profile_mmioWrite[page]) == 0) {
+			end = page + 1;
+			continue;
+		}
+		end = profile_mmioRange(page);
+		for (i = page; i < end; i++) {
+			reads += profile_mmioRead[i];
+			writes += profile_mmioWrite[i];
+		}
+		debug_log(DEBUG_INFO, "[PROFILE]   %06X-%06X %14llu  %14llu\r\n", page << MEMORY_PAGE_SHIFT, (end << MEMORY_PAGE_SHIFT) - 1,
+			(unsigned long long)reads, (unsigned long long)writes);
+	}
+
+	for (i = 0; i < PROFILE_SECTIONS; i++) {
+		if (profile_sections[i].calls == 0) continue;
+		debug_log(DEBUG_INFO, "[PROFILE] %s: %llu calls, %.02f ms total, %.02f us avg\r\n", profile_sectionNames[i],
+			(unsigned long long)profile_sections[i].calls, profile_usec(profile_sections[i].ticks) / 1000.0,
+			profile_usec(profile_sections[i].ticks) / (double)profile_sections[i].calls);
+	}
+
+	if (profile_csv != NULL) {
+		fclose(profile_csv);
+		profile_csv = NULL;
+	}
+}
+
+static void profile_csvRow(double seconds, const char* category, const char* item, uint64_t count, double usec) {
+	fprintf(profile_csv, "%.03f,%s,%s,%llu,%.01f\n", seconds, category, item, (unsigned long long)count, usec);
+}
+
+//Host timer callback, appends every non-zero counter as it stands
+void profile_csvCallback(void* dummy) {
+	char item[32];
+	uint32_t i;
+	double seconds;
+
+	if (profile_csv == NULL) return;
+	seconds = (double)(SDL_GetPerformanceCounter() - profile_start) / (double)profile_freq;
+
+	profile_csvRow(seconds, "instructions", "all", profile_instructions(), 0);
+	for (i = 0; i < 256; i++) {
+		if (profile_ops[i] == 0) continue;
+		sprintf(item, "%02X", i);
+		profile_csvRow(seconds, "opcode", item, profile_ops[i], 0);
+	}
+	for (i = 0; i < 256; i++) {
+		if (profile_ops0F[i] == 0) continue;
+		sprintf(item, "0F%02X", i);
+		profile_csvRow(seconds, "opcode", item, profile_ops0F[i], 0);
+	}
+	for (i = 0; i < PROFILE_MAXTIMERS; i++) {
+		if (profile_timers[i].calls == 0) continue;
+		sprintf(item, "%u", i);
+		profile_csvRow(seconds, "timer", item, profile_timers[i].calls, profile_usec(profile_timers[i].ticks));
+	}
+	for (i = 0; i < PORTS_COUNT; i++) {
+		sprintf(item, "%03X", i);
+		if (profile_portIn[i] != 0) profile_csvRow(seconds, "port_in", item, profile_portIn[i], 0);
+		if (profile_portOut[i] != 0) profile_csvRow(seconds, "port_out", item, profile_portOut[i], 0);
+	}
+	for (i = 0; i < MEMORY_PAGES; i++) {
+		sprintf(item, "%06X", i << MEMORY_PAGE_SHIFT);
+		if (profile_mmioRead[i] != 0) profile_csvRow(seconds, "mmio_read", item, profile_mmioRead[i], 0);
+		if (profile_mmioWrite[i] != 0) profile_csvRow(seconds, "mmio_write", item, profile_mmioWrite[i], 0);
+	}
+	for (i = 0; i < PROFILE_SECTIONS; i++) {
+		if (profile_sections[i].calls == 0) continue;
+		profile_csvRow(seconds, profile_sectionNames[i], "all", profile_sections[i].calls, profile_usec(profile_sections[i].ticks));
+	}
+	fflush(profile_csv);
+}
+
+//csvfile may be NULL for just the exit summary, otherwise the counters are appended to it every csvinterval seconds of host time
+int profile_init(char* csvfile, double csvinterval) {
+	profile_freq = SDL_GetPerformanceFrequency();
+	profile_start = SDL_GetPerformanceCounter();
+
+	if (csvfile != NULL) {
+		profile_csv = fopen(csvfile, "w");
+		if (profile_csv == NULL) {
+			debug_log(DEBUG_ERROR, "[PROFILE] Unable to create %s\r\n", csvfile);
+			return -1;
+		}
+		fprintf(profile_csv, "seconds,category,item,count,microseconds\n");
+		timing_addTimer(profile_csvCallback, NULL, 1.0 / csvinterval, TIMING_ENABLED);
+	}
+
+	profile_enabled = 1;
+	debug_log(DEBUG_INFO, "[PROFILE] Profiling enabled\r\n");
+	return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+#include "memory.h"
+#include "ports.h"
+
+#define PROFILE_MAXTIMERS	128 //timers numbered past this aren't timed
+#define PROFILE_TOP			20 //entries shown per table in the exit summary
+
+#define PROFILE_SECT_RENDER	0 //vga_update/cga_update
+#define PROFILE_SECT_BLIT	1 //sdlconsole_blitRects, texture upload and present
+#define PROFILE_SECTIONS	2
+
+typedef struct {
+	uint64_t calls;
+	uint64_t ticks; //SDL performance counter ticks spent inside
+} PROFILE_TIME_t;
+
+extern uint8_t profile_enabled;
+extern uint64_t profile_ops[256], profile_ops0F[256];
+extern uint64_t profile_portIn[PORTS_COUNT], profile_portOut[PORTS_COUNT];
+extern uint64_t profile_mmioRead[MEMORY_PAGES], profile_mmioWrite[MEMORY_PAGES];
+
+//the counters are cheap enough to leave in the hot paths, they cost one predictable branch when -profile isn't given
+#define profile_countOp(op) if (profile_enabled) profile_ops[op]++
+#define profile_countOp0F(op) if (profile_enabled) profile_ops0F[op]++
+#define profile_countPortIn(port) if (profile_enabled) profile_portIn[port]++
+#define profile_countPortOut(port) if (profile_enabled) profile_portOut[port]++
+#define profile_countMMIORead(addr32) if (profile_enabled) profile_mmioRead[(addr32) >> MEMORY_PAGE_SHIFT]++
+#define profile_countMMIOWrite(addr32) if (profile_enabled) profile_mmioWrite[(addr32) >> MEMORY_PAGE_SHIFT]++
+
+uint64_t profile_begin();
+void profile_endTimer(uint32_t tnum, uint64_t start);
+void profile_endSection(uint8_t sect, uint64_t start);
+int profile_init(char* csvfile, double csvinterval);
+void profile_report();
+
+#endif
@@ -0,0 +1,257 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Deterministic record and replay, enabled with -record <file> and
+	-replay <file>.
+
+	With the guest clock counted in instructions, the only things that make
+	one run differ from the next are inputs from the host: keystrokes, bytes
+	from the mouse and the TCP modem, frames from the network, and the time of
+	day. The emulation loop runs slices of a fixed length while recording or
+	replaying, so inputs always arrive between the same two instructions, and
+	the places that take input from the host go through replay_input first.
+	Recording logs each input with the instruction count it went in at.
+	Replaying ignores the live inputs and hands over the logged ones at the
+	same instruction counts, from replay_deliver at the top of the emulation
+	loop. The clock chips count on from the time the recording started, in
+	guest time.
+
+	The file is a REPLAY_HEADER_t followed by REPLAY_EVENT_t headers, each
+	followed by its data. Changes to the modem control lines of a TCP modem
+	connection aren't logged, and disk images have to be the same as they were
+	when the recording started.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "debuglog.h"
+#include "timing.h"
+#include "machine.h"
+#include "replay.h"
+#include "chipset/i8042.h"
+#include "chipset/uart.h"
+#ifdef USE_NE2000
+#include "modules/io/ne2000.h"
+#endif
+
+uint8_t replay_mode = REPLAY_OFF;
+uint64_t replay_icount = 0; //instructions run since recording or replaying began
+
+MACHINE_t* replay_machine = NULL;
+FILE* replay_file = NULL;
+uint8_t* replay_log = NULL; //whole recording, when replaying
+size_t replay_logLen = 0, replay_logPos = 0;
+uint64_t replay_events = 0;
+time_t replay_start;
+uint64_t replay_guestStart;
+
+static int replay_unit(uint8_t type, void* dev) {
+	if ((type == REPLAY_SERIAL) && (dev == (void*)&replay_machine->UART[1])) {
+		return 1;
+	}
+	return 0;
+}
+
+//Called with every input from the host. Returns 1 if it should go to the device, 0 if a replay is supplying them instead.
+int replay_input(uint8_t type, void* dev, const uint8_t* data, int len) {
+	REPLAY_EVENT_t event;
+
+	if (replay_mode == REPLAY_OFF) {
+		return 1;
+	}
+	if (replay_mode == REPLAY_PLAY) {
+		return 0;
+	}
+	if ((len <= 0) || (len > REPLAY_MAXDATA)) {
+		return 1;
+	}
+	memset(&event, 0, sizeof(event));
+	event.icount = replay_icount;
+	event.type = type;
+	event.unit = (uint8_t)replay_unit(type, dev);
+	event.len = (uint16_t)len;
+	if ((fwrite(&event, 1, sizeof(event), replay_file) != sizeof(event)) || (fwrite(data, 1, len, replay_file) != (size_t)len)) {
+		debug_log(DEBUG_ERROR, "[REPLAY] Unable to write to the recording, it stops here\r\n");
+		replay_stop();
+		return 1;
+	}
+	replay_events++;
+	return 1;
+}
+
+//Hands over the logged inputs that went in at this instruction count
+void replay_deliver() {
+	REPLAY_EVENT_t event;
+	uint8_t* data;
+
+	if (replay_mode != REPLAY_PLAY) {
+		return;
+	}
+	while (1) {
+		if ((replay_logPos + sizeof(event)) > replay_logLen) {
+			debug_log(DEBUG_INFO, "[REPLAY] End of the recording after %llu instructions, input is live again\r\n", (unsigned long long)replay_icount);
+			replay_stop();
+			return;
+		}
+		memcpy(&event, replay_log + replay_logPos, sizeof(event));
+		if (event.icount > replay_icount) {
+			return;
+		}
+		if ((replay_logPos + sizeof(event) + event.len) > replay_logLen) {
+			debug_log(DEBUG_ERROR, "[REPLAY] The recording is cut short\r\n");
+			replay_stop();
+			return;
+		}
+		if (event.icount < replay_icount) {
+			debug_log(DEBUG_ERROR, "[REPLAY] Out of step, input from instruction %llu delivered at %llu\r\n",
+				(unsigned long long)event.icount, (unsigned long long)replay_icount);
+		}
+		data = replay_log + replay_logPos + sizeof(event);
+		replay_logPos += sizeof(event) + event.len;
+		replay_events++;
+
+		switch (event.type) {
+		case REPLAY_KEY:
+			i8042_send_scancode(&replay_machine->i8042, data[0]);
+			break;
+		case REPLAY_SERIAL:
+			uart_rxbytes(&replay_machine->UART[event.unit & 1], data, event.len);
+			break;
+#ifdef USE_NE2000
+		case REPLAY_NET:
+			ne2000_rx_frame(&replay_machine->ne2000, data, event.len);
+			break;
+#endif
+		}
+	}
+}
+
+//Shortens a CPU slice so it ends where the next logged input goes in
+uint32_t replay_slice(uint32_t want) {
+	REPLAY_EVENT_t event;
+
+	if ((replay_mode != REPLAY_PLAY) || ((replay_logPos + sizeof(event)) > replay_logLen)) {
+		return want;
+	}
+	memcpy(&event, replay_log + replay_logPos, sizeof(event));
+	if (event.icount <= replay_icount) {
+		return 1; //replay_deliver hands it over before the next slice
+	}
+	if ((event.icount - replay_icount) < want) {
+		return (uint32_t)(event.icount - replay_icount);
+	}
+	return want;
+}
+
+void replay_ran(uint32_t instructions) {
+	replay_icount += instructions;
+}
+
+//Time of day for the clock chips, counted on in guest time from when the recording started
+time_t replay_time() {
+	if (replay_mode == REPLAY_OFF) {
+		return time(NULL);
+	}
+	return replay_start + (time_t)((timing_getGuestCur() - replay_guestStart) / timing_getFreq());
+}
+
+int replay_init(MACHINE_t* machine, char* filename, uint8_t mode) {
+	REPLAY_HEADER_t hdr;
+	FILE* file;
+	long len;
+
+	if (timing_mode == TIMING_MODE_HOST) {
+		debug_log(DEBUG_ERROR, "[REPLAY] Recording and replaying need the guest clock, not -clock host\r\n");
+		return -1;
+	}
+	replay_machine = machine;
+	replay_icount = 0;
+	replay_events = 0;
+	replay_guestStart = timing_getGuestCur();
+
+	if (mode == REPLAY_RECORD) {
+		replay_file = fopen(filename, "wb");
+		if (replay_file == NULL) {
+			debug_log(DEBUG_ERROR, "[REPLAY] Unable to create %s\r\n", filename);
+			return -1;
+		}
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, REPLAY_MAGIC, 8);
+		replay_start = time(NULL);
+		hdr.start = (int64_t)replay_start;
+		strncpy(hdr.machine, usemachine, sizeof(hdr.machine) - 1);
+		fwrite(&hdr, 1, sizeof(hdr), replay_file);
+		replay_mode = REPLAY_RECORD;
+		debug_log(DEBUG_INFO, "[REPLAY] Recording input to %s\r\n", filename);
+		return 0;
+	}
+
+	file = fopen(filename, "rb");
+	if (file == NULL) {
+		debug_log(DEBUG_ERROR, "[REPLAY] Unable to open %s\r\n", filename);
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if ((len < (long)sizeof(hdr)) || (fread(&hdr, 1, sizeof(hdr), file) != sizeof(hdr)) || memcmp(hdr.magic, REPLAY_MAGIC, 8)) {
+		debug_log(DEBUG_ERROR, "[REPLAY] %s isn't a recording\r\n", filename);
+		fclose(file);
+		return -1;
+	}
+	replay_logLen = (size_t)len - sizeof(hdr);
+	replay_log = (uint8_t*)malloc(replay_logLen + 1);
+	if ((replay_log == NULL) || (fread(replay_log, 1, replay_logLen, file) != replay_logLen)) {
+		debug_log(DEBUG_ERROR, "[REPLAY] Unable to read %s\r\n", filename);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	hdr.machine[sizeof(hdr.machine) - 1] = 0;
+	if (strcmp(hdr.machine, usemachine)) {
+		debug_log(DEBUG_INFO, "[REPLAY] Recorded on machine %s, this is %s, it won't replay the same\r\n", hdr.machine, usemachine);
+	}
+	replay_start = (time_t)hdr.start;
+	replay_logPos = 0;
+	replay_mode = REPLAY_PLAY;
+	debug_log(DEBUG_INFO, "[REPLAY] Replaying input from %s\r\n", filename);
+	return 0;
+}
+
+void replay_stop() {
+	if (replay_mode == REPLAY_OFF) {
+		return;
+	}
+	debug_log(DEBUG_INFO, "[REPLAY] %s %llu inputs over %llu instructions\r\n", (replay_mode == REPLAY_RECORD) ? "Recorded" : "Replayed",
+		(unsigned long long)replay_events, (unsigned long long)replay_icount);
+	if (replay_file != NULL) {
+		fclose(replay_file);
+		replay_file = NULL;
+	}
+	if (replay_log != NULL) {
+		free(replay_log);
+		replay_log = NULL;
+	}
+	replay_mode = REPLAY_OFF;
+}
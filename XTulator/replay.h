@@ -0,0 +1,44 @@
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "machine.h"
+
+#define REPLAY_MAGIC		"XTREPLY1"
+#define REPLAY_MAXDATA		2048 //longest input, a whole Ethernet frame fits
+
+#define REPLAY_OFF			0
+#define REPLAY_RECORD		1
+#define REPLAY_PLAY			2
+
+#define REPLAY_KEY			1 //scancode into the keyboard controller, dev is the I8042_t
+#define REPLAY_SERIAL		2 //bytes into a UART's receiver, dev is the UART_t
+#define REPLAY_NET			3 //frame into the NE2000, dev is the NE2000_t
+
+typedef struct {
+	char magic[8];
+	int64_t start; //host time when recording began, the RTC counts on from it in guest time
+	char machine[32];
+} REPLAY_HEADER_t;
+
+typedef struct {
+	uint64_t icount; //instructions run before the input went in
+	uint8_t type; //REPLAY_KEY etc
+	uint8_t unit; //which UART for REPLAY_SERIAL
+	uint16_t len;
+	uint32_t reserved;
+} REPLAY_EVENT_t;
+
+extern uint8_t replay_mode;
+extern uint64_t replay_icount;
+
+int replay_input(uint8_t type, void* dev, const uint8_t* data, int len);
+void replay_deliver();
+uint32_t replay_slice(uint32_t want);
+void replay_ran(uint32_t instructions);
+time_t replay_time();
+int replay_init(MACHINE_t* machine, char* filename, uint8_t mode);
+void replay_stop();
+
+#endif
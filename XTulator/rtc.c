@@ -27,6 +27,7 @@
 #include "config.h"
 #include "ports.h"
 #include "debuglog.h"
+#include "replay.h"
 
 #ifdef _WIN32
 
@@ -37,6 +38,19 @@ uint8_t rtc_read(void* dummy, uint16_t addr) {
 	SYSTEMTIME tdata;
 
 	GetLocalTime(&tdata);
+	if (replay_mode != REPLAY_OFF) {
+		//recording or replaying, the time has to come from the guest clock
+		time_t t = replay_time();
+		struct tm tm = *localtime(&t);
+		tdata.wMilliseconds = 0;
+		tdata.wSecond = (WORD)tm.tm_sec;
+		tdata.wMinute = (WORD)tm.tm_min;
+		tdata.wHour = (WORD)tm.tm_hour;
+		tdata.wDayOfWeek = (WORD)tm.tm_wday;
+		tdata.wDay = (WORD)tm.tm_mday;
+		tdata.wMonth = (WORD)(tm.tm_mon + 1);
+		tdata.wYear = (WORD)(tm.tm_year + 1900);
+	}
 
 	addr &= 0x1F;
 	switch (addr) {
@@ -83,8 +97,9 @@ uint8_t rtc_read(void* dummy, uint16_t addr) {
 uint8_t rtc_read(void* dummy, uint16_t addr) {
 	uint8_t ret = 0xFF;
 	struct tm tdata;
+	time_t t = replay_time();
 
-	time(&tdata);
+	tdata = *localtime(&t);
 
 	addr &= 0x1F;
 	switch (addr) {
@@ -0,0 +1,183 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Guest hot-spot sampler, enabled with -sample <n>.
+
+	Every n-th instruction cpu_exec hands the CS:IP it's about to execute to
+	sampler_hit, which counts it in an open addressing hash table. The most
+	frequent addresses are logged on exit, or whenever F12 is pressed.
+
+	With -samplemap, a linker MAP file is read and real mode samples are shown
+	as symbol+offset. Any line of the form "SSSS:OOOO name" is taken as a
+	public symbol, which covers the "Publics by Value" list of the Microsoft
+	and Borland linkers. The segments are relative to where the program was
+	loaded, so that segment has to be given as well.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "debuglog.h"
+#include "sampler.h"
+
+uint8_t sampler_enabled = 0;
+uint32_t sampler_interval = 0, sampler_countdown = 0;
+uint64_t sampler_samples = 0, sampler_dropped = 0;
+SAMPLER_BUCKET_t* sampler_table = NULL;
+uint32_t sampler_used = 0;
+
+SAMPLER_SYMBOL_t* sampler_symbols = NULL;
+uint32_t sampler_symbolCount = 0;
+
+static uint32_t sampler_hash(uint64_t key) {
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (uint32_t)(key >> 40) & (SAMPLER_BUCKETS - 1);
+}
+
+void sampler_hit(uint16_t cs, uint16_t ip, uint8_t pmode) {
+	uint64_t key;
+	uint32_t slot, probes;
+
+	sampler_countdown = sampler_interval;
+	sampler_samples++;
+	key = ((uint64_t)pmode << 32) | ((uint32_t)cs << 16) | ip;
+	slot = sampler_hash(key);
+	for (probes = 0; probes < SAMPLER_BUCKETS; probes++) {
+		SAMPLER_BUCKET_t* bucket = &sampler_table[slot];
+		if (bucket->count == 0) {
+			//keep the table at most 3/4 full so probe runs stay short, anything new after that goes uncounted
+			if (sampler_used >= (SAMPLER_BUCKETS / 4 * 3)) break;
+			bucket->key = key;
+			bucket->count = 1;
+			sampler_used++;
+			return;
+		}
+		if (bucket->key == key) {
+			bucket->count++;
+			return;
+		}
+		slot = (slot + 1) & (SAMPLER_BUCKETS - 1);
+	}
+	sampler_dropped++;
+}
+
+static int sampler_compareSymbols(const void* a, const void* b) {
+	uint32_t la = ((const SAMPLER_SYMBOL_t*)a)->linear, lb = ((const SAMPLER_SYMBOL_t*)b)->linear;
+	return (la < lb) ? -1 : ((la > lb) ? 1 : 0);
+}
+
+//Returns the symbol at or below linear, NULL if there is none
+static SAMPLER_SYMBOL_t* sampler_findSymbol(uint32_t linear) {
+	uint32_t lo = 0, hi = sampler_symbolCount;
+
+	while (lo < hi) { //first symbol above linear
+		uint32_t mid = (lo + hi) >> 1;
+		if (sampler_symbols[mid].linear <= linear) lo = mid + 1;
+		else hi = mid;
+	}
+	return (lo == 0) ? NULL : &sampler_symbols[lo - 1];
+}
+
+int sampler_loadMap(char* filename, uint16_t loadseg) {
+	FILE* file;
+	char line[256], name[48];
+	unsigned int seg, off;
+
+	file = fopen(filename, "r");
+	if (file == NULL) {
+		debug_log(DEBUG_ERROR, "[SAMPLER] Unable to open MAP file %s\r\n", filename);
+		return -1;
+	}
+
+	sampler_symbols = (SAMPLER_SYMBOL_t*)malloc(sizeof(SAMPLER_SYMBOL_t) * SAMPLER_MAXSYMBOLS);
+	if (sampler_symbols == NULL) {
+		fclose(file);
+		return -1;
+	}
+
+	while ((sampler_symbolCount < SAMPLER_MAXSYMBOLS) && (fgets(line, sizeof(line), file) != NULL)) {
+		if (sscanf(line, " %4x:%4x %47s", &seg, &off, name) != 3) continue;
+		sampler_symbols[sampler_symbolCount].linear = (((uint32_t)(loadseg + seg) & 0xFFFF) << 4) + off;
+		strcpy(sampler_symbols[sampler_symbolCount].name, name);
+		sampler_symbolCount++;
+	}
+	fclose(file);
+
+	qsort(sampler_symbols, sampler_symbolCount, sizeof(SAMPLER_SYMBOL_t), sampler_compareSymbols);
+	debug_log(DEBUG_INFO, "[SAMPLER] Loaded %lu symbols from %s, based at segment %04X\r\n", sampler_symbolCount, filename, loadseg);
+	return 0;
+}
+
+void sampler_dump() {
+	uint32_t top[SAMPLER_TOP], found = 0, i, j;
+	uint64_t count;
+
+	if (!sampler_enabled) return;
+
+	//insertion into a short sorted list, the table is only walked once
+	for (i = 0; i < SAMPLER_BUCKETS; i++) {
+		count = sampler_table[i].count;
+		if (count == 0) continue;
+		for (j = found; (j > 0) && (sampler_table[top[j - 1]].count < count); j--) {
+			if (j < SAMPLER_TOP) top[j] = top[j - 1];
+		}
+		if (j < SAMPLER_TOP) {
+			top[j] = i;
+			if (found < SAMPLER_TOP) found++;
+		}
+	}
+
+	debug_log(DEBUG_INFO, "[SAMPLER] %llu samples of every %lu instructions, %lu distinct addresses, %llu not counted (table full)\r\n",
+		(unsigned long long)sampler_samples, sampler_interval, sampler_used, (unsigned long long)sampler_dropped);
+	for (i = 0; i < found; i++) {
+		SAMPLER_BUCKET_t* bucket = &sampler_table[top[i]];
+		uint16_t cs = (uint16_t)(bucket->key >> 16), ip = (uint16_t)bucket->key;
+		uint8_t pmode = (uint8_t)(bucket->key >> 32);
+		SAMPLER_SYMBOL_t* sym = NULL;
+
+		if (!pmode && (sampler_symbolCount > 0)) {
+			sym = sampler_findSymbol(((uint32_t)cs << 4) + ip);
+			if ((sym != NULL) && ((((uint32_t)cs << 4) + ip - sym->linear) >= 0x10000)) sym = NULL; //too far past anything in the MAP to be part of it
+		}
+		if (sym != NULL) {
+			debug_log(DEBUG_INFO, "[SAMPLER]   %s%04X:%04X %12llu  %5.02f%%  %s+%X\r\n", pmode ? "PM " : "", cs, ip, (unsigned long long)bucket->count,
+				(double)bucket->count * 100.0 / (double)sampler_samples, sym->name, (((uint32_t)cs << 4) + ip) - sym->linear);
+		}
+		else {
+			debug_log(DEBUG_INFO, "[SAMPLER]   %s%04X:%04X %12llu  %5.02f%%\r\n", pmode ? "PM " : "", cs, ip, (unsigned long long)bucket->count,
+				(double)bucket->count * 100.0 / (double)sampler_samples);
+		}
+	}
+}
+
+int sampler_init(uint32_t interval) {
+	sampler_table = (SAMPLER_BUCKET_t*)calloc(SAMPLER_BUCKETS, sizeof(SAMPLER_BUCKET_t));
+	if (sampler_table == NULL) {
+		debug_log(DEBUG_ERROR, "[SAMPLER] Unable to allocate the sample table\r\n");
+		return -1;
+	}
+	sampler_interval = interval;
+	sampler_countdown = interval;
+	sampler_enabled = 1;
+	debug_log(DEBUG_INFO, "[SAMPLER] Sampling CS:IP every %lu instructions\r\n", interval);
+	return 0;
+}
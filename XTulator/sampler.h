@@ -0,0 +1,32 @@
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include <stdint.h>
+
+#define SAMPLER_BUCKETS		65536 //distinct CS:IP values the histogram can hold, power of two
+#define SAMPLER_TOP			40 //addresses shown by sampler_dump
+#define SAMPLER_MAXSYMBOLS	32768
+
+typedef struct {
+	uint64_t key; //protected mode flag << 32 | CS << 16 | IP
+	uint64_t count; //0 means the bucket is free
+} SAMPLER_BUCKET_t;
+
+typedef struct {
+	uint32_t linear; //real mode address the symbol was loaded at
+	char name[48];
+} SAMPLER_SYMBOL_t;
+
+extern uint8_t sampler_enabled;
+extern uint32_t sampler_countdown;
+
+void sampler_hit(uint16_t cs, uint16_t ip, uint8_t pmode);
+
+//called once per instruction from cpu_exec, only every sampler_interval-th one gets recorded
+#define sampler_tick(cs, ip, pmode) if (sampler_enabled && (--sampler_countdown == 0)) sampler_hit(cs, ip, pmode)
+
+int sampler_init(uint32_t interval);
+int sampler_loadMap(char* filename, uint16_t loadseg);
+void sampler_dump();
+
+#endif
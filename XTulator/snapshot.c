@@ -0,0 +1,864 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Machine snapshots.
+
+	A snapshot file is a SNAPSHOT_HEADER_t followed by tagged sections, each a
+	SNAPSHOT_SECTION_t and its payload. Devices are saved as raw images of
+	their structs in MACHINE_t. On restore the pointers and callbacks in them
+	(which only mean something to the process that wrote them) are kept from
+	the live struct, so a snapshot can only be restored by the same build with
+	the same machine configuration. The MACH section is checked for that first.
+
+	Guest RAM is saved as a directory of its non-zero 4 KB pages, each packed
+	with a small LZ77 coder, or stored as is when that doesn't make it smaller.
+	If the file can be mapped, restored pages are only unpacked the first time
+	the guest touches them. Until then they are mapped with callbacks that
+	unpack the page and put the direct mapping back.
+
+	Host-side connections (TCP modem sockets, pcap, the mouse) aren't part of a
+	snapshot and carry on from whatever state they're in.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+#include "config.h"
+#include "debuglog.h"
+#include "timing.h"
+#include "memory.h"
+#include "machine.h"
+#include "snapshot.h"
+#include "utility.h"
+#include "cpu/cpu.h"
+#include "cpu/decode.h"
+#include "chipset/i8042.h"
+#include "modules/disk/biosdisk.h"
+#include "modules/video/cga.h"
+#include "modules/video/vga.h"
+
+typedef struct {
+	uint32_t offset;
+	uint32_t size;
+} SNAPSHOT_KEEP_t;
+
+#define SNAPSHOT_KEEP(type, field) { offsetof(type, field), sizeof(((type*)0)->field) }
+#define SNAPSHOT_KEEPS(list) list, (sizeof(list) / sizeof(list[0]))
+
+typedef struct {
+	char tag[4];
+	uint32_t offset; //of the device in MACHINE_t
+	uint32_t size;
+	const SNAPSHOT_KEEP_t* keep; //fields restored from the live struct instead of the snapshot
+	uint32_t keeps;
+} SNAPSHOT_DEVICE_t;
+
+typedef struct {
+	char id[32];
+	uint64_t hwflags;
+	uint32_t machinesize;
+	uint32_t ramsize;
+	uint8_t videocard;
+	uint8_t reserved[7];
+} SNAPSHOT_MACH_t;
+
+typedef struct {
+	uint64_t interval;
+	uint64_t previous;
+	uint32_t tnum;
+	uint8_t enabled;
+	uint8_t reserved[3];
+} SNAPSHOT_TIMER_t;
+
+typedef struct {
+	const uint8_t* data;
+	uint32_t len;
+} SNAPSHOT_LAZY_t;
+
+static const SNAPSHOT_KEEP_t snapshot_keepCPU[] = { SNAPSHOT_KEEP(CPU_t, int_callback), SNAPSHOT_KEEP(CPU_t, core) };
+static const SNAPSHOT_KEEP_t snapshot_keepPIC[] = { SNAPSHOT_KEEP(I8259_t, partner) };
+static const SNAPSHOT_KEEP_t snapshot_keepPIT[] = { SNAPSHOT_KEEP(I8253_t, cbdata) };
+static const SNAPSHOT_KEEP_t snapshot_keepDMA[] = { SNAPSHOT_KEEP(I8237_t, cpu) };
+static const SNAPSHOT_KEEP_t snapshot_keepPPI[] = { SNAPSHOT_KEEP(I8255_t, keystate), SNAPSHOT_KEEP(I8255_t, pcspeaker) };
+static const SNAPSHOT_KEEP_t snapshot_keepKBC[] = { SNAPSHOT_KEEP(I8042_t, keystate), SNAPSHOT_KEEP(I8042_t, cpu), SNAPSHOT_KEEP(I8042_t, i8259) };
+static const SNAPSHOT_KEEP_t snapshot_keepUART[] = { SNAPSHOT_KEEP(UART_t, udata), SNAPSHOT_KEEP(UART_t, udata2), SNAPSHOT_KEEP(UART_t, txCb),
+	SNAPSHOT_KEEP(UART_t, mcrCb), SNAPSHOT_KEEP(UART_t, i8259) };
+static const SNAPSHOT_KEEP_t snapshot_keepSB[] = { SNAPSHOT_KEEP(BLASTER_t, i8237), SNAPSHOT_KEEP(BLASTER_t, i8259) };
+static const SNAPSHOT_KEEP_t snapshot_keepSPK[] = { SNAPSHOT_KEEP(PCSPEAKER_t, timer2), SNAPSHOT_KEEP(PCSPEAKER_t, timer2data) };
+static const SNAPSHOT_KEEP_t snapshot_keepFDC[] = { SNAPSHOT_KEEP(FDC_t, cpu), SNAPSHOT_KEEP(FDC_t, i8259), SNAPSHOT_KEEP(FDC_t, i8237),
+	SNAPSHOT_KEEP(FDC_t, fastmode), SNAPSHOT_KEEP(FDC_t, disk) }; //the inserted images are whatever was given on the command line
+#ifdef USE_NE2000
+static const SNAPSHOT_KEEP_t snapshot_keepNE2K[] = { SNAPSHOT_KEEP(NE2000_t, i8259), SNAPSHOT_KEEP(NE2000_t, txframe) };
+#endif
+
+static const SNAPSHOT_DEVICE_t snapshot_devices[] = {
+	{ { 'C', 'P', 'U', ' ' }, offsetof(MACHINE_t, CPU), sizeof(CPU_t), SNAPSHOT_KEEPS(snapshot_keepCPU) },
+	{ { 'P', 'I', 'C', '0' }, offsetof(MACHINE_t, i8259), sizeof(I8259_t), SNAPSHOT_KEEPS(snapshot_keepPIC) },
+	{ { 'P', 'I', 'C', '1' }, offsetof(MACHINE_t, i8259_slave), sizeof(I8259_t), SNAPSHOT_KEEPS(snapshot_keepPIC) },
+	{ { 'P', 'I', 'T', ' ' }, offsetof(MACHINE_t, i8253), sizeof(I8253_t), SNAPSHOT_KEEPS(snapshot_keepPIT) },
+	{ { 'D', 'M', 'A', '0' }, offsetof(MACHINE_t, i8237), sizeof(I8237_t), SNAPSHOT_KEEPS(snapshot_keepDMA) },
+	{ { 'D', 'M', 'A', '1' }, offsetof(MACHINE_t, i8237_slave), sizeof(I8237_t), SNAPSHOT_KEEPS(snapshot_keepDMA) },
+	{ { 'P', 'P', 'I', ' ' }, offsetof(MACHINE_t, i8255), sizeof(I8255_t), SNAPSHOT_KEEPS(snapshot_keepPPI) },
+	{ { 'C', 'M', 'O', 'S' }, offsetof(MACHINE_t, cmos), sizeof(CMOS_t), NULL, 0 },
+	{ { 'K', 'B', 'C', ' ' }, offsetof(MACHINE_t, i8042), sizeof(I8042_t), SNAPSHOT_KEEPS(snapshot_keepKBC) },
+	{ { 'U', 'A', 'R', '0' }, offsetof(MACHINE_t, UART), sizeof(UART_t), SNAPSHOT_KEEPS(snapshot_keepUART) },
+	{ { 'U', 'A', 'R', '1' }, offsetof(MACHINE_t, UART) + sizeof(UART_t), sizeof(UART_t), SNAPSHOT_KEEPS(snapshot_keepUART) },
+	{ { 'S', 'B', ' ', ' ' }, offsetof(MACHINE_t, blaster), sizeof(BLASTER_t), SNAPSHOT_KEEPS(snapshot_keepSB) },
+	{ { 'S', 'P', 'K', ' ' }, offsetof(MACHINE_t, pcspeaker), sizeof(PCSPEAKER_t), SNAPSHOT_KEEPS(snapshot_keepSPK) },
+	{ { 'K', 'E', 'Y', 'S' }, offsetof(MACHINE_t, KeyState), sizeof(KEYSTATE_t), NULL, 0 },
+	{ { 'F', 'D', 'C', ' ' }, offsetof(MACHINE_t, fdc), sizeof(FDC_t), SNAPSHOT_KEEPS(snapshot_keepFDC) },
+#ifdef USE_NE2000
+	{ { 'N', 'E', '2', 'K' }, offsetof(MACHINE_t, ne2000), sizeof(NE2000_t), SNAPSHOT_KEEPS(snapshot_keepNE2K) },
+#endif
+};
+
+#define SNAPSHOT_DEVICES	(sizeof(snapshot_devices) / sizeof(snapshot_devices[0]))
+
+extern void port92_write(void* udata, uint32_t port, uint8_t value);
+extern uint8_t port92_read(void* udata, uint32_t port);
+
+//snapshot that snapshot_put adds to, while the video card's state is being saved
+static SNAPSHOT_BUF_t* snapshot_out = NULL;
+
+//section payload being read by snapshot_load
+static const uint8_t* snapshot_in;
+static uint32_t snapshot_inlen, snapshot_inpos;
+
+//the mapped snapshot file that lazily restored pages are unpacked from
+static uint8_t* snapshot_map = NULL;
+static void* snapshot_mapping = NULL;
+static uint32_t snapshot_mapsize = 0;
+static uint32_t snapshot_lazycount = 0;
+static SNAPSHOT_LAZY_t snapshot_lazy[MEMORY_PAGES];
+
+//len 0 is an all zero page, MEMORY_PAGE_SIZE one that is stored as it is
+static int snapshot_decompress(const uint8_t* src, uint32_t len, uint8_t* dst) {
+	if (len == 0) {
+		memset(dst, 0, MEMORY_PAGE_SIZE);
+		return 0;
+	}
+	if (len == MEMORY_PAGE_SIZE) {
+		memcpy(dst, src, MEMORY_PAGE_SIZE);
+		return 0;
+	}
+	return utility_unpack(src, len, dst, MEMORY_PAGE_SIZE);
+}
+
+static void snapshot_unmapFile(uint8_t* map, void* mapping, uint32_t size) {
+#ifdef _WIN32
+	UnmapViewOfFile(map);
+	CloseHandle((HANDLE)mapping);
+#else
+	munmap(map, size);
+#endif
+}
+
+static void snapshot_pageIn(uint32_t pagenum) {
+	MEMORY_PAGE_t* page = memory_page(pagenum);
+	uint8_t* host = main_ram + (pagenum << MEMORY_PAGE_SHIFT);
+
+	if (snapshot_decompress(snapshot_lazy[pagenum].data, snapshot_lazy[pagenum].len, host)) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] RAM page %05X is corrupt, leaving it zeroed\r\n", pagenum << MEMORY_PAGE_SHIFT);
+		memset(host, 0, MEMORY_PAGE_SIZE);
+	}
+	page->readcb = NULL;
+	page->writecb = NULL;
+	page->udata = NULL;
+	page->read = host;
+	page->write = host;
+	snapshot_lazy[pagenum].data = NULL;
+
+	if (--snapshot_lazycount == 0) {
+		snapshot_unmapFile(snapshot_map, snapshot_mapping, snapshot_mapsize);
+		snapshot_map = NULL;
+		snapshot_mapping = NULL;
+	}
+}
+
+static uint8_t snapshot_lazyRead(void* udata, uint32_t addr) {
+	snapshot_pageIn(addr >> MEMORY_PAGE_SHIFT);
+	return main_ram[addr];
+}
+
+static void snapshot_lazyWrite(void* udata, uint32_t addr, uint8_t value) {
+	snapshot_pageIn(addr >> MEMORY_PAGE_SHIFT);
+	main_ram[addr] = value;
+}
+
+//Unpacks whatever is still waiting in the mapped snapshot, which also unmaps it
+void snapshot_pageAll() {
+	uint32_t i;
+
+	for (i = 0; (i < MEMORY_PAGES) && (snapshot_lazycount > 0); i++) {
+		if (snapshot_lazy[i].data != NULL) {
+			snapshot_pageIn(i);
+		}
+	}
+}
+
+//Appends to a snapshot being built in memory
+void snapshot_bufPut(SNAPSHOT_BUF_t* buf, const void* src, uint32_t len) {
+	uint8_t* grown;
+	uint32_t cap;
+
+	if (buf->error) return;
+	if ((buf->len + len) > buf->cap) {
+		cap = (buf->cap == 0) ? 65536 : buf->cap;
+		while (cap < (buf->len + len)) cap <<= 1;
+		grown = (uint8_t*)realloc(buf->data, cap);
+		if (grown == NULL) {
+			buf->error = 1;
+			return;
+		}
+		buf->data = grown;
+		buf->cap = cap;
+	}
+	memcpy(buf->data + buf->len, src, len);
+	buf->len += len;
+}
+
+void snapshot_bufFree(SNAPSHOT_BUF_t* buf) {
+	if (buf->data != NULL) free(buf->data);
+	memset(buf, 0, sizeof(SNAPSHOT_BUF_t));
+}
+
+//For the device modules' save functions, adds to the section snapshot_writeState is on
+void snapshot_put(const void* src, uint32_t len) {
+	if (snapshot_out == NULL) return;
+	snapshot_bufPut(snapshot_out, src, len);
+}
+
+//Reads the next len bytes of the section being restored, -1 if it's shorter than that
+int snapshot_get(void* dst, uint32_t len) {
+	if (len > (snapshot_inlen - snapshot_inpos)) return -1;
+	memcpy(dst, snapshot_in + snapshot_inpos, len);
+	snapshot_inpos += len;
+	return 0;
+}
+
+static void snapshot_begin(SNAPSHOT_BUF_t* buf, const char* tag) {
+	SNAPSHOT_SECTION_t sect;
+
+	memcpy(sect.tag, tag, 4);
+	sect.size = 0;
+	buf->sectpos = buf->len;
+	snapshot_bufPut(buf, &sect, sizeof(sect));
+}
+
+//Goes back and fills in the size of the section started by snapshot_begin
+static void snapshot_end(SNAPSHOT_BUF_t* buf) {
+	uint32_t size;
+
+	if (buf->error) return;
+	size = buf->len - buf->sectpos - sizeof(SNAPSHOT_SECTION_t);
+	memcpy(buf->data + buf->sectpos + offsetof(SNAPSHOT_SECTION_t, size), &size, sizeof(size));
+	buf->sections++;
+}
+
+static uint8_t snapshot_isZero(const uint8_t* src) {
+	return (src[0] == 0) && !memcmp(src, src + 1, MEMORY_PAGE_SIZE - 1);
+}
+
+/*
+	Adds the RAM section for the listed pages, packing them on the way. Their
+	contents come from data, one after another, or straight from guest RAM if
+	it's NULL. All-zero pages get a zero length entry, a full snapshot just
+	doesn't list them. Doesn't touch any emulator state, so it can run on
+	another thread as long as data is a private copy.
+*/
+void snapshot_writeRAM(SNAPSHOT_BUF_t* buf, const uint32_t* pages, uint32_t count, const uint8_t* data) {
+	SNAPSHOT_PAGE_t entry;
+	uint8_t packed[MEMORY_PAGE_SIZE];
+	const uint8_t* src;
+	uint32_t i, n, offset, dirpos;
+
+	snapshot_begin(buf, "RAM ");
+	snapshot_bufPut(buf, &count, sizeof(count));
+	dirpos = buf->len;
+	memset(&entry, 0, sizeof(entry));
+	for (i = 0; i < count; i++) {
+		snapshot_bufPut(buf, &entry, sizeof(entry)); //filled in once the page sizes are known
+	}
+	offset = sizeof(count) + count * sizeof(SNAPSHOT_PAGE_t);
+	for (i = 0; i < count; i++) {
+		src = (data != NULL) ? (data + (i << MEMORY_PAGE_SHIFT)) : (main_ram + (pages[i] << MEMORY_PAGE_SHIFT));
+		if (snapshot_isZero(src)) {
+			n = 0;
+		}
+		else if ((n = utility_pack(src, MEMORY_PAGE_SIZE, packed)) == 0) {
+			n = MEMORY_PAGE_SIZE;
+			snapshot_bufPut(buf, src, n);
+		}
+		else {
+			snapshot_bufPut(buf, packed, n);
+		}
+		entry.page = pages[i];
+		entry.offset = offset;
+		entry.len = n;
+		if (!buf->error) {
+			memcpy(buf->data + dirpos + i * sizeof(SNAPSHOT_PAGE_t), &entry, sizeof(entry));
+		}
+		offset += n;
+	}
+	snapshot_end(buf);
+}
+
+//Starts a snapshot with everything but RAM. parent names the snapshot an incremental one's RAM pages go on top of.
+void snapshot_writeState(MACHINE_t* machine, SNAPSHOT_BUF_t* buf, const char* parent) {
+	SNAPSHOT_HEADER_t hdr;
+	SNAPSHOT_MACH_t mach;
+	SNAPSHOT_TIMER_t st;
+	TIMER t;
+	uint64_t now;
+	uint32_t i, count;
+	uint8_t misc[2];
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, 8);
+	hdr.version = SNAPSHOT_VERSION;
+	snapshot_bufPut(buf, &hdr, sizeof(hdr));
+
+	memset(&mach, 0, sizeof(mach));
+	strncpy(mach.id, usemachine, sizeof(mach.id) - 1);
+	mach.hwflags = machine->hwflags;
+	mach.machinesize = sizeof(MACHINE_t);
+	mach.ramsize = ramsize;
+	mach.videocard = videocard;
+	snapshot_begin(buf, "MACH");
+	snapshot_bufPut(buf, &mach, sizeof(mach));
+	snapshot_end(buf);
+
+	if (parent != NULL) {
+		snapshot_begin(buf, "PARN");
+		snapshot_bufPut(buf, parent, (uint32_t)strlen(parent) + 1);
+		snapshot_end(buf);
+	}
+
+	//only the guest clock is saved, host clock timers belong to this session
+	now = timing_getGuestCur();
+	for (i = 0, count = 0; i < timing_timerCount(); i++) {
+		timing_timerState(i, &t);
+		if (t.clock == TIMING_CLOCK_GUEST) count++;
+	}
+	snapshot_begin(buf, "TIME");
+	snapshot_bufPut(buf, &now, sizeof(now));
+	snapshot_bufPut(buf, &count, sizeof(count));
+	for (i = 0; i < timing_timerCount(); i++) {
+		timing_timerState(i, &t);
+		if (t.clock != TIMING_CLOCK_GUEST) continue;
+		memset(&st, 0, sizeof(st));
+		st.interval = t.interval;
+		st.previous = t.previous;
+		st.tnum = i;
+		st.enabled = t.enabled;
+		snapshot_bufPut(buf, &st, sizeof(st));
+	}
+	snapshot_end(buf);
+
+	cpu_flagsSync(&machine->CPU);
+	for (i = 0; i < SNAPSHOT_DEVICES; i++) {
+		snapshot_begin(buf, snapshot_devices[i].tag);
+		snapshot_bufPut(buf, (uint8_t*)machine + snapshot_devices[i].offset, snapshot_devices[i].size);
+		snapshot_end(buf);
+	}
+
+	if (machine->mixOPL) {
+		uint64_t base = (uint64_t)(uintptr_t)&machine->OPL3; //for rebasing its internal pointers on restore
+		snapshot_begin(buf, "OPL3");
+		snapshot_bufPut(buf, &base, sizeof(base));
+		snapshot_bufPut(buf, &machine->OPL3, sizeof(opl3_chip));
+		snapshot_end(buf);
+	}
+
+	misc[0] = port92_read(NULL, 0x92);
+	misc[1] = a20_enabled;
+	snapshot_begin(buf, "MISC");
+	snapshot_bufPut(buf, misc, sizeof(misc));
+	snapshot_end(buf);
+
+	snapshot_begin(buf, "DISK");
+	for (i = 0; i < 4; i++) {
+		snapshot_bufPut(buf, &biosdisk[i].inserted, sizeof(biosdisk[i].inserted));
+		snapshot_bufPut(buf, &biosdisk[i].filesize, sizeof(biosdisk[i].filesize));
+	}
+	snapshot_end(buf);
+
+	snapshot_out = buf;
+	switch (videocard) {
+	case VIDEO_CARD_CGA:
+		snapshot_begin(buf, "CGA ");
+		cga_saveState();
+		snapshot_end(buf);
+		break;
+	case VIDEO_CARD_VGA:
+		snapshot_begin(buf, "VGA ");
+		vga_saveState();
+		snapshot_end(buf);
+		break;
+	}
+	snapshot_out = NULL;
+}
+
+//Fills in the header's section count and writes the finished snapshot out
+int snapshot_writeFile(SNAPSHOT_BUF_t* buf, char* filename) {
+	FILE* f;
+
+	if (buf->error || (buf->len < sizeof(SNAPSHOT_HEADER_t))) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Out of memory building %s\r\n", filename);
+		return -1;
+	}
+	memcpy(buf->data + offsetof(SNAPSHOT_HEADER_t, sections), &buf->sections, sizeof(buf->sections));
+
+	f = fopen(filename, "wb");
+	if (f == NULL) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Unable to create %s\r\n", filename);
+		return -1;
+	}
+	if (fwrite(buf->data, 1, buf->len, f) < buf->len) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Error writing %s\r\n", filename);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+
+int snapshot_save(MACHINE_t* machine, char* filename) {
+	SNAPSHOT_BUF_t buf;
+	uint32_t* pages;
+	uint32_t page, count = 0;
+	int ret;
+
+	snapshot_pageAll(); //also lets go of the file in case it's the one being written over
+
+	pages = (uint32_t*)malloc(MEMORY_PAGES * sizeof(uint32_t));
+	if (pages == NULL) return -1;
+	for (page = 0; page < MEMORY_PAGES; page++) {
+		if ((memory_dirty[page] & MEMORY_TOUCHED) && !snapshot_isZero(main_ram + (page << MEMORY_PAGE_SHIFT))) pages[count++] = page;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	snapshot_writeState(machine, &buf, NULL);
+	snapshot_writeRAM(&buf, pages, count, NULL);
+	ret = snapshot_writeFile(&buf, filename);
+	if (ret == 0) {
+		debug_log(DEBUG_INFO, "[SNAPSHOT] Saved machine state to %s (%lu non-zero RAM pages, %lu KB)\r\n", filename, count, (buf.len + 1023) >> 10);
+	}
+	snapshot_bufFree(&buf);
+	free(pages);
+	return ret;
+}
+
+//Points snapshot_in at the payload of the first section with the given tag, returns -1 if there isn't one
+static int snapshot_find(const uint8_t* data, uint32_t size, const char* tag) {
+	SNAPSHOT_SECTION_t sect;
+	uint32_t pos = sizeof(SNAPSHOT_HEADER_t);
+
+	while ((pos + sizeof(sect)) <= size) {
+		memcpy(&sect, data + pos, sizeof(sect));
+		pos += sizeof(sect);
+		if (sect.size > (size - pos)) break;
+		if (!memcmp(sect.tag, tag, 4)) {
+			snapshot_in = data + pos;
+			snapshot_inlen = sect.size;
+			snapshot_inpos = 0;
+			return 0;
+		}
+		pos += sect.size;
+	}
+
+	snapshot_in = NULL;
+	snapshot_inlen = snapshot_inpos = 0;
+	return -1;
+}
+
+//Overwrites a device with its saved image, keeping the fields in its keep list
+static int snapshot_loadDevice(MACHINE_t* machine, const SNAPSHOT_DEVICE_t* dev) {
+	uint8_t* live = (uint8_t*)machine + dev->offset;
+	uint8_t* saved;
+	uint32_t i;
+
+	if (snapshot_inlen != dev->size) return -1;
+	saved = (uint8_t*)malloc(dev->size);
+	if (saved == NULL) return -1;
+	snapshot_get(saved, dev->size);
+	for (i = 0; i < dev->keeps; i++) {
+		memcpy(saved + dev->keep[i].offset, live + dev->keep[i].offset, dev->keep[i].size);
+	}
+	memcpy(live, saved, dev->size);
+	free(saved);
+	return 0;
+}
+
+//Moves a pointer saved in the snapshot's OPL3 chip into the live one. Anything outside of it keeps the live value.
+static void* snapshot_rebase(void* saved, void* live, uint64_t oldbase, opl3_chip* chip) {
+	uint64_t p = (uint64_t)(uintptr_t)saved;
+
+	if ((p < oldbase) || (p >= (oldbase + sizeof(opl3_chip)))) return live;
+	return (uint8_t*)chip + (p - oldbase);
+}
+
+static int snapshot_loadOPL3(opl3_chip* chip) {
+	opl3_chip* saved;
+	uint64_t base;
+	uint32_t i, j;
+
+	if ((snapshot_inlen != (sizeof(base) + sizeof(opl3_chip))) || snapshot_get(&base, sizeof(base))) return -1;
+	saved = (opl3_chip*)malloc(sizeof(opl3_chip));
+	if (saved == NULL) return -1;
+	snapshot_get(saved, sizeof(opl3_chip));
+
+	for (i = 0; i < 36; i++) {
+		saved->slot[i].channel = (opl3_channel*)snapshot_rebase(saved->slot[i].channel, chip->slot[i].channel, base, chip);
+		saved->slot[i].chip = chip;
+		saved->slot[i].mod = (Bit16s*)snapshot_rebase(saved->slot[i].mod, chip->slot[i].mod, base, chip);
+		saved->slot[i].trem = (Bit8u*)snapshot_rebase(saved->slot[i].trem, chip->slot[i].trem, base, chip);
+	}
+	for (i = 0; i < 18; i++) {
+		for (j = 0; j < 2; j++) {
+			saved->channel[i].slots[j] = (opl3_slot*)snapshot_rebase(saved->channel[i].slots[j], chip->channel[i].slots[j], base, chip);
+		}
+		saved->channel[i].pair = (opl3_channel*)snapshot_rebase(saved->channel[i].pair, chip->channel[i].pair, base, chip);
+		saved->channel[i].chip = chip;
+		for (j = 0; j < 4; j++) {
+			saved->channel[i].out[j] = (Bit16s*)snapshot_rebase(saved->channel[i].out[j], chip->channel[i].out[j], base, chip);
+		}
+	}
+	memcpy(chip, saved, sizeof(opl3_chip));
+	free(saved);
+	return 0;
+}
+
+static int snapshot_loadTime() {
+	SNAPSHOT_TIMER_t st;
+	TIMER t;
+	uint64_t now;
+	uint32_t count, i;
+	uint8_t* restored;
+
+	if (snapshot_get(&now, sizeof(now)) || snapshot_get(&count, sizeof(count)) ||
+		(count > ((snapshot_inlen - snapshot_inpos) / sizeof(st)))) {
+		return -1;
+	}
+	restored = (uint8_t*)calloc(timing_timerCount() + 1, 1);
+	if (restored == NULL) return -1;
+
+	timing_setGuestCur(now);
+	for (i = 0; i < count; i++) {
+		snapshot_get(&st, sizeof(st));
+		if (st.tnum >= timing_timerCount()) continue; //added after machine init in the session that saved it
+		timing_timerRestore(st.tnum, st.enabled, st.interval, st.previous);
+		restored[st.tnum] = 1;
+	}
+	//guest clock timers the snapshot doesn't have (a -framedump timer, say) start counting from the restored time
+	for (i = 0; i < timing_timerCount(); i++) {
+		timing_timerState(i, &t);
+		if ((t.clock == TIMING_CLOCK_GUEST) && !restored[i]) {
+			timing_timerRestore(i, t.enabled, t.interval, now);
+		}
+	}
+	free(restored);
+	return 0;
+}
+
+//Makes sure the snapshot's guest timers are the ones this machine has
+static int snapshot_checkTime() {
+	SNAPSHOT_TIMER_t st;
+	TIMER t;
+	uint64_t now;
+	uint32_t count, i;
+
+	if (snapshot_get(&now, sizeof(now)) || snapshot_get(&count, sizeof(count)) ||
+		(count > ((snapshot_inlen - snapshot_inpos) / sizeof(st)))) {
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		snapshot_get(&st, sizeof(st));
+		if (st.tnum >= timing_timerCount()) continue;
+		timing_timerState(st.tnum, &t);
+		if (t.clock != TIMING_CLOCK_GUEST) return -1;
+	}
+	return 0;
+}
+
+//Applies the RAM section snapshot_in points at. A full snapshot replaces all of RAM, an incremental one only the pages it lists.
+static int snapshot_loadRAM(uint8_t lazy, uint8_t incremental) {
+	SNAPSHOT_PAGE_t entry;
+	MEMORY_PAGE_t* mpage;
+	uint8_t* host;
+	uint32_t count, i, dirend, lazied = 0;
+
+	if (snapshot_get(&count, sizeof(count)) || (count > MEMORY_PAGES)) return -1;
+	dirend = sizeof(count) + count * sizeof(SNAPSHOT_PAGE_t);
+	if (dirend > snapshot_inlen) return -1;
+
+	//check the whole directory first, so no lazy page is left pointing into a file that's about to be dropped
+	for (i = 0; i < count; i++) {
+		snapshot_get(&entry, sizeof(entry));
+		if ((entry.page >= MEMORY_PAGES) || (entry.len > MEMORY_PAGE_SIZE) || (entry.offset < dirend) ||
+			(entry.offset > snapshot_inlen) || (entry.len > (snapshot_inlen - entry.offset))) {
+			debug_log(DEBUG_ERROR, "[SNAPSHOT] Bad RAM page directory entry\r\n");
+			return -1;
+		}
+	}
+
+	if (!incremental) {
+		memory_discard();
+	}
+	snapshot_inpos = sizeof(count);
+	for (i = 0; i < count; i++) {
+		snapshot_get(&entry, sizeof(entry));
+		host = main_ram + (entry.page << MEMORY_PAGE_SHIFT);
+		mpage = memory_page(entry.page);
+		memory_dirty[entry.page] |= MEMORY_TOUCHED;
+
+		//only plain RAM pages can be left for later, anything else is unpacked now
+		if (lazy && (entry.len > 0) && (mpage->sub == NULL) && (mpage->read == host) && (mpage->write == host) &&
+			(mpage->readcb == NULL) && (mpage->writecb == NULL)) {
+			snapshot_lazy[entry.page].data = snapshot_in + entry.offset;
+			snapshot_lazy[entry.page].len = entry.len;
+			mpage->read = NULL;
+			mpage->write = NULL;
+			mpage->readcb = snapshot_lazyRead;
+			mpage->writecb = snapshot_lazyWrite;
+			lazied++;
+			continue;
+		}
+		if (snapshot_decompress(snapshot_in + entry.offset, entry.len, host)) {
+			debug_log(DEBUG_ERROR, "[SNAPSHOT] RAM page %05X is corrupt\r\n", entry.page << MEMORY_PAGE_SHIFT);
+			return -1;
+		}
+	}
+	snapshot_lazycount = lazied;
+	memory_mapGeneration++;
+
+	debug_log(DEBUG_INFO, "[SNAPSHOT] Restored %lu RAM pages, %lu of them on first access\r\n", count, lazied);
+	return 0;
+}
+
+static uint8_t* snapshot_mapFile(FILE* f, uint32_t size, void** mapping) {
+	uint8_t* map = NULL;
+
+	*mapping = NULL;
+#ifdef _WIN32
+	*mapping = (void*)CreateFileMapping((HANDLE)_get_osfhandle(_fileno(f)), NULL, PAGE_READONLY, 0, 0, NULL);
+	if (*mapping == NULL) return NULL;
+	map = (uint8_t*)MapViewOfFile((HANDLE)*mapping, FILE_MAP_READ, 0, 0, 0);
+	if (map == NULL) {
+		CloseHandle((HANDLE)*mapping);
+		*mapping = NULL;
+	}
+#else
+	{
+		void* m = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(f), 0);
+		if (m != MAP_FAILED) map = (uint8_t*)m;
+	}
+#endif
+	return map;
+}
+
+//Maps the file or, failing that, reads it into memory. *mapped says which, for snapshot_releaseFile.
+static uint8_t* snapshot_readFile(char* filename, uint32_t* size, void** mapping, uint8_t* mapped) {
+	FILE* f;
+	uint8_t* data;
+
+	*mapped = 0;
+	f = fopen(filename, "rb");
+	if (f == NULL) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Unable to open %s\r\n", filename);
+		return NULL;
+	}
+	fseek(f, 0L, SEEK_END);
+	*size = (uint32_t)ftell(f);
+	fseek(f, 0L, SEEK_SET);
+
+	data = (*size > 0) ? snapshot_mapFile(f, *size, mapping) : NULL;
+	if (data != NULL) {
+		*mapped = 1;
+	}
+	else {
+		data = (uint8_t*)malloc(*size + 1);
+		if ((data == NULL) || (fread(data, 1, *size, f) < *size)) {
+			debug_log(DEBUG_ERROR, "[SNAPSHOT] Unable to read %s\r\n", filename);
+			if (data != NULL) free(data);
+			data = NULL;
+		}
+	}
+	fclose(f); //a mapping stays valid after the file is closed
+	return data;
+}
+
+static void snapshot_releaseFile(uint8_t* data, uint32_t size, void* mapping, uint8_t mapped) {
+	if (mapped) {
+		snapshot_unmapFile(data, mapping, size);
+	}
+	else {
+		free(data);
+	}
+}
+
+//Rebuilds RAM from the snapshots an incremental one sits on, oldest first, leaving just its own pages to apply
+static int snapshot_loadParents(const uint8_t* data, uint32_t size, uint32_t depth) {
+	SNAPSHOT_HEADER_t hdr;
+	uint8_t* pdata;
+	void* mapping = NULL;
+	uint8_t mapped, incremental;
+	uint32_t psize;
+	char parent[512];
+	int ret = -1;
+
+	if (snapshot_find(data, size, "PARN")) return 0; //a full snapshot, nothing under it
+	if ((snapshot_inlen == 0) || (snapshot_inlen > sizeof(parent)) || (snapshot_in[snapshot_inlen - 1] != 0)) return -1;
+	memcpy(parent, snapshot_in, snapshot_inlen);
+	if (depth >= SNAPSHOT_MAXCHAIN) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Too many incremental snapshots on top of each other at %s\r\n", parent);
+		return -1;
+	}
+
+	pdata = snapshot_readFile(parent, &psize, &mapping, &mapped);
+	if (pdata == NULL) return -1;
+	if (psize >= sizeof(hdr)) {
+		memcpy(&hdr, pdata, sizeof(hdr));
+		if (!memcmp(hdr.magic, SNAPSHOT_MAGIC, 8) && (hdr.version == SNAPSHOT_VERSION) && !snapshot_loadParents(pdata, psize, depth + 1)) {
+			incremental = !snapshot_find(pdata, psize, "PARN");
+			if (!snapshot_find(pdata, psize, "RAM ") && !snapshot_loadRAM(0, incremental)) {
+				ret = 0;
+			}
+		}
+	}
+	if (ret) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Unable to restore RAM from %s\r\n", parent);
+	}
+	snapshot_releaseFile(pdata, psize, mapping, mapped);
+	return ret;
+}
+
+//Checks that the snapshot came from this build and machine configuration before anything is touched
+static int snapshot_check(MACHINE_t* machine, const uint8_t* data, uint32_t size) {
+	SNAPSHOT_HEADER_t hdr;
+	SNAPSHOT_MACH_t mach;
+
+	if (size < sizeof(hdr)) return -1;
+	memcpy(&hdr, data, sizeof(hdr));
+	if (memcmp(hdr.magic, SNAPSHOT_MAGIC, 8) || (hdr.version != SNAPSHOT_VERSION)) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Not a snapshot file, or from an incompatible version\r\n");
+		return -1;
+	}
+	if (snapshot_find(data, size, "MACH") || snapshot_get(&mach, sizeof(mach))) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Snapshot has no machine description\r\n");
+		return -1;
+	}
+	mach.id[sizeof(mach.id) - 1] = 0;
+	if (_stricmp(mach.id, usemachine) || (mach.hwflags != machine->hwflags) || (mach.machinesize != sizeof(MACHINE_t)) ||
+		(mach.ramsize != ramsize) || (mach.videocard != videocard)) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Snapshot was taken with a different machine configuration (%s)\r\n", mach.id);
+		return -1;
+	}
+	if (snapshot_find(data, size, "TIME") || snapshot_checkTime()) {
+		debug_log(DEBUG_ERROR, "[SNAPSHOT] Snapshot timers don't match this machine\r\n");
+		return -1;
+	}
+	return 0;
+}
+
+int snapshot_load(MACHINE_t* machine, char* filename) {
+	uint8_t* data;
+	void* mapping = NULL;
+	uint8_t mapped = 0, incremental, misc[2];
+	uint32_t size = 0, i;
+	int ret = -1;
+
+	snapshot_pageAll();
+
+	data = snapshot_readFile(filename, &size, &mapping, &mapped);
+	if (data == NULL) return -1;
+
+	if (snapshot_check(machine, data, size)) goto done;
+
+	//past here the machine is being overwritten, so a failure leaves it in no useful state
+	decode_flush();
+	incremental = !snapshot_find(data, size, "PARN");
+	if (incremental && snapshot_loadParents(data, size, 0)) goto corrupt;
+	if (snapshot_find(data, size, "TIME") || snapshot_loadTime()) goto corrupt;
+	for (i = 0; i < SNAPSHOT_DEVICES; i++) {
+		if (snapshot_find(data, size, snapshot_devices[i].tag)) continue; //leave it as it is
+		if (snapshot_loadDevice(machine, &snapshot_devices[i])) goto corrupt;
+	}
+	machine->CPU.code_host = NULL;
+	cpu_descFlush(&machine->CPU);
+	machine->CPU.decode_pre = NULL;
+	machine->CPU.decode_rec = NULL;
+
+	if (machine->mixOPL && !snapshot_find(data, size, "OPL3") && snapshot_loadOPL3(&machine->OPL3)) goto corrupt;
+
+	if (!snapshot_find(data, size, "MISC")) {
+		if (snapshot_get(misc, sizeof(misc))) goto corrupt;
+		port92_write(NULL, 0x92, misc[0]);
+		memory_setA20(misc[1]);
+	}
+
+	if (!snapshot_find(data, size, "DISK")) {
+		uint32_t filesize;
+		uint8_t inserted;
+		for (i = 0; i < 4; i++) {
+			if (snapshot_get(&inserted, sizeof(inserted)) || snapshot_get(&filesize, sizeof(filesize))) goto corrupt;
+			if ((inserted != biosdisk[i].inserted) || (inserted && (filesize != biosdisk[i].filesize))) {
+				debug_log(DEBUG_INFO, "[SNAPSHOT] WARNING: Disk %u isn't the same as when the snapshot was taken\r\n", i);
+			}
+		}
+	}
+
+	switch (videocard) {
+	case VIDEO_CARD_CGA:
+		if (!snapshot_find(data, size, "CGA ") && cga_loadState()) goto corrupt;
+		break;
+	case VIDEO_CARD_VGA:
+		if (!snapshot_find(data, size, "VGA ") && vga_loadState()) goto corrupt;
+		break;
+	}
+
+	if (snapshot_find(data, size, "RAM ") || snapshot_loadRAM(mapped, incremental)) goto corrupt;
+	memory_clearDirty();
+
+	debug_log(DEBUG_INFO, "[SNAPSHOT] Restored machine state from %s\r\n", filename);
+	ret = 0;
+	goto done;
+
+corrupt:
+	debug_log(DEBUG_ERROR, "[SNAPSHOT] %s is corrupt\r\n", filename);
+done:
+	if (mapped && (ret == 0) && (snapshot_lazycount > 0)) { //pages are still waiting in the file, keep it mapped
+		snapshot_map = data;
+		snapshot_mapping = mapping;
+		snapshot_mapsize = size;
+	}
+	else {
+		snapshot_releaseFile(data, size, mapping, mapped);
+	}
+	return ret;
+}
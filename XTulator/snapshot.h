@@ -0,0 +1,51 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+#include "machine.h"
+
+#define SNAPSHOT_MAGIC			"XTSNAP1"
+#define SNAPSHOT_VERSION		1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t sections;
+} SNAPSHOT_HEADER_t;
+
+typedef struct {
+	char tag[4];
+	uint32_t size; //bytes of payload following the section header
+} SNAPSHOT_SECTION_t;
+
+//an entry of the RAM section's page directory. Pages that aren't listed are all zero, or unchanged from the parent in an incremental snapshot.
+typedef struct {
+	uint32_t page;
+	uint32_t offset; //from the start of the RAM section payload
+	uint32_t len; //MEMORY_PAGE_SIZE means the page is stored uncompressed, 0 that it's all zero
+} SNAPSHOT_PAGE_t;
+
+#define SNAPSHOT_MAXCHAIN		256 //incremental snapshots followed back to a full one before giving up
+
+//a snapshot file being put together in memory
+typedef struct {
+	uint8_t* data;
+	uint32_t len;
+	uint32_t cap;
+	uint32_t sectpos; //where the open section's header is
+	uint32_t sections;
+	uint8_t error;
+} SNAPSHOT_BUF_t;
+
+int snapshot_save(MACHINE_t* machine, char* filename);
+int snapshot_load(MACHINE_t* machine, char* filename);
+void snapshot_pageAll();
+void snapshot_put(const void* src, uint32_t len);
+int snapshot_get(void* dst, uint32_t len);
+void snapshot_bufPut(SNAPSHOT_BUF_t* buf, const void* src, uint32_t len);
+void snapshot_bufFree(SNAPSHOT_BUF_t* buf);
+void snapshot_writeState(MACHINE_t* machine, SNAPSHOT_BUF_t* buf, const char* parent);
+void snapshot_writeRAM(SNAPSHOT_BUF_t* buf, const uint32_t* pages, uint32_t count, const uint8_t* data);
+int snapshot_writeFile(SNAPSHOT_BUF_t* buf, char* filename);
+
+#endif
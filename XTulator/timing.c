@@ -28,12 +28,194 @@
 #include "config.h"
 #include "timing.h"
 #include "debuglog.h"
+#include "profile.h"
+#include "metrics.h"
 
 uint64_t timing_cur;
 uint64_t timing_freq;
 TIMER* timers = NULL;
 uint32_t timers_count = 0;
 
+/*
+	Enabled timers are kept in a binary min-heap keyed on their deadline, so
+	timing_loop only has to look at the top to see whether anything is due and
+	timing_untilNext can tell the main loop how long it may run the CPU.
+
+	timing_timerEnable and friends can be called from other threads (the SDL
+	audio callback, for one), so they only mark the timer dirty. The heap itself
+	is only ever touched from timing_loop's thread.
+*/
+/*
+	Timers live on one of two clocks. TIMING_CLOCK_HOST timers (video refresh,
+	audio output, serial polling, UI) always run against the host counter.
+	TIMING_CLOCK_GUEST timers (the emulated chips) run against the same counter
+	in TIMING_MODE_HOST, but in the virtual modes against a counter advanced by
+	timing_advance() from the number of instructions the CPU has executed, at
+	timing_guestIPS instructions per emulated second. Both use timing_freq
+	ticks per second, so intervals mean the same thing either way.
+*/
+typedef struct {
+	uint32_t* slot;
+	uint32_t count;
+} TIMING_HEAP_t;
+
+TIMING_HEAP_t timing_heap[2];
+uint32_t* timing_due = NULL;
+volatile uint8_t timing_dirty = 0;
+
+uint8_t timing_mode = TIMING_MODE_HOST;
+double timing_guestIPS = TIMING_GUEST_IPS;
+uint64_t timing_guestCur = 0, timing_guestRem = 0;
+int64_t timing_guestOffset = 0; //guest clock minus host clock, nonzero once timing_setGuestCur has moved the guest clock
+
+static void timing_heapSet(TIMING_HEAP_t* heap, uint32_t pos, uint32_t tnum) {
+	heap->slot[pos] = tnum;
+	timers[tnum].heappos = pos;
+}
+
+static void timing_siftUp(TIMING_HEAP_t* heap, uint32_t pos) {
+	uint32_t tnum, parent;
+
+	tnum = heap->slot[pos];
+	while (pos > 0) {
+		parent = (pos - 1) >> 1;
+		if (timers[heap->slot[parent]].deadline <= timers[tnum].deadline) break;
+		timing_heapSet(heap, pos, heap->slot[parent]);
+		pos = parent;
+	}
+	timing_heapSet(heap, pos, tnum);
+}
+
+static void timing_siftDown(TIMING_HEAP_t* heap, uint32_t pos) {
+	uint32_t tnum, child;
+
+	tnum = heap->slot[pos];
+	while ((child = (pos << 1) + 1) < heap->count) {
+		if (((child + 1) < heap->count) && (timers[heap->slot[child + 1]].deadline < timers[heap->slot[child]].deadline)) {
+			child++;
+		}
+		if (timers[tnum].deadline <= timers[heap->slot[child]].deadline) break;
+		timing_heapSet(heap, pos, heap->slot[child]);
+		pos = child;
+	}
+	timing_heapSet(heap, pos, tnum);
+}
+
+static void timing_unqueue(uint32_t tnum) {
+	TIMING_HEAP_t* heap;
+	uint32_t pos, last;
+
+	pos = timers[tnum].heappos;
+	if (pos == TIMING_UNQUEUED) return;
+	heap = &timing_heap[timers[tnum].clock];
+	timers[tnum].heappos = TIMING_UNQUEUED;
+	heap->count--;
+	if (pos == heap->count) return;
+	last = heap->slot[heap->count];
+	timing_heapSet(heap, pos, last);
+	timing_siftUp(heap, pos);
+	timing_siftDown(heap, timers[last].heappos);
+}
+
+//Puts the timer in the heap at its current deadline, or takes it out if it's disabled
+static void timing_queue(uint32_t tnum) {
+	TIMING_HEAP_t* heap;
+	uint32_t pos;
+
+	if (timers[tnum].enabled == TIMING_DISABLED) {
+		timing_unqueue(tnum);
+		return;
+	}
+
+	heap = &timing_heap[timers[tnum].clock];
+	timers[tnum].deadline = timers[tnum].previous + timers[tnum].interval;
+	pos = timers[tnum].heappos;
+	if (pos == TIMING_UNQUEUED) {
+		pos = heap->count++;
+		timing_heapSet(heap, pos, tnum);
+		timing_siftUp(heap, pos);
+	}
+	else {
+		timing_siftUp(heap, pos);
+		timing_siftDown(heap, timers[tnum].heappos);
+	}
+}
+
+static void timing_markDirty(uint32_t tnum) {
+	timers[tnum].dirty = 1;
+	timing_dirty = 1;
+}
+
+static void timing_refresh() {
+	uint32_t i;
+
+	if (!timing_dirty) return;
+	timing_dirty = 0;
+	for (i = 0; i < timers_count; i++) {
+		if (timers[i].dirty) {
+			timers[i].dirty = 0;
+			timing_queue(i);
+		}
+	}
+}
+
+//Current time on the given clock
+static uint64_t timing_now(uint8_t clock) {
+	if ((clock == TIMING_CLOCK_GUEST) && (timing_mode != TIMING_MODE_HOST)) {
+		return timing_guestCur;
+	}
+	if (clock == TIMING_CLOCK_GUEST) {
+		return timing_cur + (uint64_t)timing_guestOffset;
+	}
+	return timing_cur;
+}
+
+void timing_setMode(uint8_t mode) {
+	timing_mode = mode;
+	timing_guestCur = timing_getCur();
+	timing_guestRem = 0;
+	timing_guestOffset = 0;
+}
+
+//Moves the guest clock to when, e.g. to carry on from a restored snapshot. Host clock pacing continues from now.
+void timing_setGuestCur(uint64_t when) {
+	timing_getCur();
+	timing_guestOffset = (int64_t)(when - timing_cur);
+	if (timing_mode != TIMING_MODE_HOST) {
+		timing_guestCur = when;
+		timing_guestRem = 0;
+	}
+}
+
+void timing_setGuestIPS(double ips) {
+	if (ips <= 0) {
+		ips = TIMING_GUEST_IPS;
+	}
+	timing_guestIPS = ips;
+}
+
+//Called after the CPU has run, moves the guest clock ahead by that many instructions' worth of time
+void timing_advance(uint32_t instructions) {
+	uint64_t ips;
+
+	if (timing_mode == TIMING_MODE_HOST) return;
+	ips = (uint64_t)timing_guestIPS;
+	timing_guestRem += (uint64_t)instructions * timing_freq;
+	timing_guestCur += timing_guestRem / ips;
+	timing_guestRem %= ips;
+}
+
+//How far the guest clock has run ahead of the host clock, in ticks. Zero if it's behind or the mode isn't paced.
+uint64_t timing_guestAhead() {
+	uint64_t cur;
+
+	if (timing_mode != TIMING_MODE_GUEST) return 0;
+	timing_getCur();
+	cur = timing_guestCur - (uint64_t)timing_guestOffset;
+	if (cur <= timing_cur) return 0;
+	return cur - timing_cur;
+}
+
 int timing_init() {
 #ifdef _WIN32
 	LARGE_INTEGER freq;
@@ -47,7 +229,10 @@ int timing_init() {
 }
 
 void timing_loop() {
-	uint32_t i;
+	TIMING_HEAP_t* heap;
+	uint64_t now;
+	uint32_t i, tnum, due;
+	uint8_t clock;
 #ifdef _WIN32
 	LARGE_INTEGER cur;
 	//TODO: error handling
@@ -58,19 +243,91 @@ void timing_loop() {
 	gettimeofday(&tv, NULL);
 	timing_cur = (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
 #endif
-	for (i = 0; i < timers_count; i++) {
-		if (timing_cur >= (timers[i].previous + timers[i].interval)) {
-			if (timers[i].enabled != TIMING_DISABLED) {
-				if (timers[i].callback != NULL) {
-					(*timers[i].callback)(timers[i].data);
+	timing_refresh();
+
+	//pull everything that's due off the heaps first, so each timer fires at most once per call like before
+	due = 0;
+	for (clock = 0; clock < 2; clock++) {
+		heap = &timing_heap[clock];
+		now = timing_now(clock);
+		while ((heap->count > 0) && (timers[heap->slot[0]].deadline <= now)) {
+			tnum = heap->slot[0];
+			timing_unqueue(tnum);
+			timing_due[due++] = tnum;
+		}
+	}
+
+	for (i = 0; i < due; i++) {
+		tnum = timing_due[i];
+		if (timers[tnum].enabled == TIMING_DISABLED) {
+			continue;
+		}
+		now = timing_now(timers[tnum].clock);
+		if (now >= (timers[tnum].previous + timers[tnum].interval)) {
+			timers[tnum].rearmed = 0;
+			if (timers[tnum].callback != NULL) {
+				metrics.cpu.timerCallbacks++;
+				if (profile_enabled) {
+					uint64_t start = profile_begin();
+					(*timers[tnum].callback)(timers[tnum].data);
+					profile_endTimer(tnum, start);
 				}
-				timers[i].previous += timers[i].interval;
-				if ((timing_cur - timers[i].previous) >= (timers[i].interval * 100)) {
-					timers[i].previous = timing_cur;
+				else {
+					(*timers[tnum].callback)(timers[tnum].data);
 				}
 			}
+			if (!timers[tnum].rearmed) { //a callback that picked its own next deadline with timing_timerAt keeps it
+				timers[tnum].previous += timers[tnum].interval;
+				if ((now - timers[tnum].previous) >= (timers[tnum].interval * 100)) {
+					timers[tnum].previous = now;
+				}
+			}
+		}
+		timing_queue(tnum);
+	}
+}
+
+//Host timer ticks from the last timing_loop until the next enabled host clock timer is due, TIMING_NEVER if none are.
+//With the guest clock in TIMING_MODE_HOST this covers guest clock timers as well.
+uint64_t timing_untilNext() {
+	TIMING_HEAP_t* heap;
+	uint64_t deadline = TIMING_NEVER, due;
+	uint8_t clock;
+
+	timing_refresh();
+	for (clock = 0; clock < 2; clock++) {
+		heap = &timing_heap[clock];
+		if ((clock == TIMING_CLOCK_GUEST) && (timing_mode != TIMING_MODE_HOST)) continue;
+		if (heap->count == 0) continue;
+		due = timers[heap->slot[0]].deadline;
+		if (clock == TIMING_CLOCK_GUEST) {
+			due -= (uint64_t)timing_guestOffset; //back to host time
+		}
+		if (due < deadline) {
+			deadline = due;
 		}
 	}
+	if (deadline == TIMING_NEVER) {
+		return TIMING_NEVER;
+	}
+	if (deadline <= timing_cur) {
+		return 0;
+	}
+	return deadline - timing_cur;
+}
+
+//Instructions the CPU can run before the next guest clock timer is due, TIMING_NEVER if there is none or the guest clock is the host clock
+uint64_t timing_guestUntilNext() {
+	TIMING_HEAP_t* heap;
+	uint64_t deadline;
+
+	if (timing_mode == TIMING_MODE_HOST) return TIMING_NEVER;
+	timing_refresh();
+	heap = &timing_heap[TIMING_CLOCK_GUEST];
+	if (heap->count == 0) return TIMING_NEVER;
+	deadline = timers[heap->slot[0]].deadline;
+	if (deadline <= timing_guestCur) return 0;
+	return (uint64_t)(((double)(deadline - timing_guestCur) * timing_guestIPS) / (double)timing_freq) + 1;
 }
 
 //Just some code for performance testing
@@ -93,9 +350,10 @@ void timing_speedTest() {
 #endif
 }
 
-uint32_t timing_addTimerUsingInterval(void* callback, void* data, uint64_t interval, uint8_t enabled) {
+static uint32_t timing_addTimerOnClock(void* callback, void* data, uint64_t interval, uint8_t enabled, uint8_t clock) {
 	TIMER* temp;
-	uint32_t ret;
+	uint32_t* heap;
+	uint32_t ret, i;
 #ifdef _WIN32
 	LARGE_INTEGER cur;
 
@@ -114,20 +372,47 @@ uint32_t timing_addTimerUsingInterval(void* callback, void* data, uint64_t inter
 	}
 	timers = temp;
 
-	timers[timers_count].previous = timing_cur;
+	for (i = 0; i < 2; i++) {
+		heap = (uint32_t*)realloc(timing_heap[i].slot, (size_t)sizeof(uint32_t) * (timers_count + 1));
+		if (heap == NULL) {
+			return TIMING_ERROR;
+		}
+		timing_heap[i].slot = heap;
+	}
+
+	heap = (uint32_t*)realloc(timing_due, (size_t)sizeof(uint32_t) * (timers_count + 1));
+	if (heap == NULL) {
+		return TIMING_ERROR;
+	}
+	timing_due = heap;
+
+	timers[timers_count].clock = clock;
+	timers[timers_count].previous = timing_now(clock);
 	timers[timers_count].interval = interval;
 	timers[timers_count].callback = callback;
 	timers[timers_count].data = data;
 	timers[timers_count].enabled = enabled;
+	timers[timers_count].heappos = TIMING_UNQUEUED;
+	timers[timers_count].rearmed = 0;
 
 	ret = timers_count;
 	timers_count++;
+	timing_markDirty(ret);
 
 	return ret;
 }
 
+uint32_t timing_addTimerUsingInterval(void* callback, void* data, uint64_t interval, uint8_t enabled) {
+	return timing_addTimerOnClock(callback, data, interval, enabled, TIMING_CLOCK_HOST);
+}
+
 uint32_t timing_addTimer(void* callback, void* data, double frequency, uint8_t enabled) {
-	return timing_addTimerUsingInterval(callback, data, (uint64_t)((double)timing_freq / frequency), enabled);
+	return timing_addTimerOnClock(callback, data, (uint64_t)((double)timing_freq / frequency), enabled, TIMING_CLOCK_HOST);
+}
+
+//Same as timing_addTimer, but the timer runs on emulated time. Use this for anything the guest can observe.
+uint32_t timing_addGuestTimer(void* callback, void* data, double frequency, uint8_t enabled) {
+	return timing_addTimerOnClock(callback, data, (uint64_t)((double)timing_freq / frequency), enabled, TIMING_CLOCK_GUEST);
 }
 
 void timing_updateInterval(uint32_t tnum, uint64_t interval) {
@@ -136,6 +421,7 @@ void timing_updateInterval(uint32_t tnum, uint64_t interval) {
 		return;
 	}
 	timers[tnum].interval = interval;
+	timing_markDirty(tnum);
 }
 
 void timing_updateIntervalFreq(uint32_t tnum, double frequency) {
@@ -144,6 +430,7 @@ void timing_updateIntervalFreq(uint32_t tnum, double frequency) {
 		return;
 	}
 	timers[tnum].interval = (uint64_t)((double)timing_freq / frequency);
+	timing_markDirty(tnum);
 }
 
 void timing_timerEnable(uint32_t tnum) {
@@ -152,7 +439,47 @@ void timing_timerEnable(uint32_t tnum) {
 		return;
 	}
 	timers[tnum].enabled = TIMING_ENABLED;
-	timers[tnum].previous = timing_getCur();
+	timing_getCur();
+	timers[tnum].previous = timing_now(timers[tnum].clock);
+	timing_markDirty(tnum);
+}
+
+//Enables the timer and has it fire next at the given time on its own clock, instead of one interval from now
+void timing_timerAt(uint32_t tnum, uint64_t when) {
+	if (tnum >= timers_count) {
+		debug_log(DEBUG_ERROR, "[ERROR] timing_timerAt() asked to operate on invalid timer\r\n");
+		return;
+	}
+	timers[tnum].enabled = TIMING_ENABLED;
+	timers[tnum].previous = when - timers[tnum].interval;
+	timers[tnum].rearmed = 1;
+	timing_markDirty(tnum);
+}
+
+uint32_t timing_timerCount() {
+	return timers_count;
+}
+
+//Copies out a timer's scheduling state, for snapshots
+void timing_timerState(uint32_t tnum, TIMER* dst) {
+	if (tnum >= timers_count) {
+		debug_log(DEBUG_ERROR, "[ERROR] timing_timerState() asked to operate on invalid timer\r\n");
+		return;
+	}
+	*dst = timers[tnum];
+}
+
+//Puts back the scheduling state saved by timing_timerState. Callback and clock stay as they were created.
+void timing_timerRestore(uint32_t tnum, uint8_t enabled, uint64_t interval, uint64_t previous) {
+	if (tnum >= timers_count) {
+		debug_log(DEBUG_ERROR, "[ERROR] timing_timerRestore() asked to operate on invalid timer\r\n");
+		return;
+	}
+	timers[tnum].enabled = enabled;
+	timers[tnum].interval = interval;
+	timers[tnum].previous = previous;
+	timers[tnum].rearmed = 0;
+	timing_markDirty(tnum);
 }
 
 void timing_timerDisable(uint32_t tnum) {
@@ -161,6 +488,12 @@ void timing_timerDisable(uint32_t tnum) {
 		return;
 	}
 	timers[tnum].enabled = TIMING_DISABLED;
+	timing_markDirty(tnum);
+}
+
+//Current guest clock time. In TIMING_MODE_HOST this is the host time as of the last timing_loop or timing_getCur.
+uint64_t timing_getGuestCur() {
+	return timing_now(TIMING_CLOCK_GUEST);
 }
 
 uint64_t timing_getFreq() {
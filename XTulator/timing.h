@@ -7,28 +7,57 @@ typedef struct TIMER_s {
 	uint64_t interval;
 	uint64_t previous;
 	uint8_t enabled;
+	uint8_t clock; //TIMING_CLOCK_*
 	void (*callback)(void*);
 	void* data;
+	uint64_t deadline; //previous + interval as of the last time the timer was queued
+	uint32_t heappos; //slot in the scheduler heap, or TIMING_UNQUEUED
+	uint8_t rearmed; //set by timing_timerAt, so timing_loop doesn't step previous forward after the callback
+	volatile uint8_t dirty; //set when enabled/interval/previous changed, the heap is fixed up on the next timing_loop
 } TIMER;
 
 #define TIMING_ENABLED	1
 #define TIMING_DISABLED	0
 #define TIMING_ERROR 0xFFFFFFFF
+#define TIMING_UNQUEUED 0xFFFFFFFF
+#define TIMING_NEVER 0xFFFFFFFFFFFFFFFFULL
+
+#define TIMING_CLOCK_HOST	0
+#define TIMING_CLOCK_GUEST	1
+
+#define TIMING_MODE_HOST	0 //guest clock timers run on host time
+#define TIMING_MODE_GUEST	1 //guest clock follows executed instructions, paced to host time
+#define TIMING_MODE_MAX		2 //guest clock follows executed instructions, unpaced
 
 #define TIMING_RINGSIZE	1024
 
 int timing_init();
 void timing_loop();
+uint64_t timing_untilNext();
+uint64_t timing_guestUntilNext();
+uint64_t timing_guestAhead();
+void timing_advance(uint32_t instructions);
+void timing_setMode(uint8_t mode);
+void timing_setGuestIPS(double ips);
+void timing_setGuestCur(uint64_t when);
 uint32_t timing_addTimer(void* callback, void* data, double frequency, uint8_t enabled);
+uint32_t timing_addGuestTimer(void* callback, void* data, double frequency, uint8_t enabled);
 void timing_updateIntervalFreq(uint32_t tnum, double frequency);
 void timing_updateInterval(uint32_t tnum, uint64_t interval);
 void timing_speedTest();
 void timing_timerEnable(uint32_t tnum);
+void timing_timerAt(uint32_t tnum, uint64_t when);
 void timing_timerDisable(uint32_t tnum);
+uint32_t timing_timerCount();
+void timing_timerState(uint32_t tnum, TIMER* dst);
+void timing_timerRestore(uint32_t tnum, uint8_t enabled, uint64_t interval, uint64_t previous);
 uint64_t timing_getFreq();
 uint64_t timing_getCur();
+uint64_t timing_getGuestCur();
 
 extern uint64_t timing_cur;
 extern uint64_t timing_freq;
+extern uint8_t timing_mode;
+extern double timing_guestIPS;
 
 #endif
@@ -0,0 +1,337 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Binary instruction trace, enabled with -trace <file> and printed with
+	-tracedump <file>.
+
+	cpu_exec hands every instruction to trace_record, which appends a record
+	to the block it's filling: the IP, CS when it changed, the code bytes, and
+	the registers that changed since the record before. Full blocks go to a
+	writer thread through a ring of TRACE_CHUNKS of them, and it packs them with
+	utility_pack and writes them out, so the CPU only pays for a few compares
+	and stores per instruction. It waits for the writer rather than leave holes
+	in the trace when the disk can't keep up.
+
+	The file is TRACE_MAGIC, then blocks, each a 32 bit record byte count and a
+	32 bit packed length (equal to the byte count when stored as is), then the
+	data. Records don't cross blocks. A record is a tag byte (TRACE_TAG_*), IP,
+	CS if TRACE_TAG_CS, the code bytes, and if TRACE_TAG_REGS a 16 bit mask of
+	TRACE_REG_* bits followed by those registers. All values are little endian.
+	The first record has every register, so the registers going into each
+	instruction can be worked out from the start.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+#endif
+#include "config.h"
+#include "debuglog.h"
+#include "utility.h"
+#include "cpu/cpu.h"
+#include "trace.h"
+#include "hostthread.h"
+
+uint8_t trace_enabled = 0;
+
+TRACE_CHUNK_t* trace_chunks = NULL;
+TRACE_CHUNK_t* trace_cur = NULL; //block the CPU is filling
+SDL_atomic_t trace_submitted, trace_written; //blocks handed to the writer thread, and written out by it
+volatile uint8_t trace_quit = 0;
+FILE* trace_file = NULL;
+uint64_t trace_records = 0, trace_bytes = 0;
+
+uint16_t trace_regs[TRACE_REGS]; //as of the last record
+uint16_t trace_cs;
+uint8_t trace_full; //next record carries CS and every register
+
+static void trace_put16(uint8_t* dst, uint16_t value) {
+	dst[0] = (uint8_t)value;
+	dst[1] = (uint8_t)(value >> 8);
+}
+
+static uint16_t trace_get16(const uint8_t* src) {
+	return (uint16_t)src[0] | ((uint16_t)src[1] << 8);
+}
+
+static void trace_put32(uint8_t* dst, uint32_t value) {
+	trace_put16(dst, (uint16_t)value);
+	trace_put16(dst + 2, (uint16_t)(value >> 16));
+}
+
+static uint32_t trace_get32(const uint8_t* src) {
+	return (uint32_t)trace_get16(src) | ((uint32_t)trace_get16(src + 2) << 16);
+}
+
+#ifdef _WIN32
+void trace_writer(void* dummy) {
+#else
+void* trace_writer(void* dummy) {
+#endif
+	static uint8_t packed[TRACE_CHUNK];
+	uint8_t hdr[8];
+	TRACE_CHUNK_t* chunk;
+	uint32_t written, n;
+
+	hostthread_apply(HOSTTHREAD_IO);
+
+	while (1) {
+		written = (uint32_t)SDL_AtomicGet(&trace_written);
+		if (written == (uint32_t)SDL_AtomicGet(&trace_submitted)) {
+			if (trace_quit) break;
+			utility_sleep(TRACE_WRITEMS);
+			continue;
+		}
+		SDL_MemoryBarrierAcquire();
+		chunk = &trace_chunks[written % TRACE_CHUNKS];
+		n = utility_pack(chunk->data, chunk->len, packed);
+		trace_put32(hdr, chunk->len);
+		trace_put32(hdr + 4, (n > 0) ? n : chunk->len);
+		fwrite(hdr, 1, 8, trace_file);
+		fwrite((n > 0) ? packed : chunk->data, 1, (n > 0) ? n : chunk->len, trace_file);
+		trace_bytes += 8 + ((n > 0) ? n : chunk->len);
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&trace_written, (int)(written + 1));
+	}
+#ifndef _WIN32
+	return NULL;
+#endif
+}
+
+//Hands the current block to the writer thread and moves on to the next one once it's free
+static void trace_submit() {
+	uint32_t submitted;
+
+	if (trace_cur->len == 0) {
+		return;
+	}
+	submitted = (uint32_t)SDL_AtomicGet(&trace_submitted) + 1;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&trace_submitted, (int)submitted);
+	while ((submitted - (uint32_t)SDL_AtomicGet(&trace_written)) >= TRACE_CHUNKS) {
+		utility_sleep(1);
+	}
+	trace_cur = &trace_chunks[submitted % TRACE_CHUNKS];
+	trace_cur->len = 0;
+}
+
+void trace_record(CPU_t* cpu, uint16_t ip, uint8_t len) {
+	uint16_t regs[TRACE_REGS], mask = 0, cs;
+	uint32_t base;
+	uint8_t* rec;
+	uint8_t* p;
+	uint8_t i;
+
+	if ((trace_cur->len + TRACE_MAXRECORD) > TRACE_CHUNK) {
+		trace_submit();
+	}
+	rec = trace_cur->data + trace_cur->len;
+	p = rec + 3;
+
+	cs = cpu->segregs[regcs];
+	trace_put16(rec + 1, ip);
+	rec[0] = cpu->protected_mode ? TRACE_TAG_PMODE : 0;
+	if ((cs != trace_cs) || trace_full) {
+		rec[0] |= TRACE_TAG_CS;
+		trace_put16(p, cs);
+		p += 2;
+		trace_cs = cs;
+	}
+
+	if (len == 0) {
+		len = (uint8_t)((uint16_t)(cpu->ip - ip) + TRACE_LOOKAHEAD);
+	}
+	if (len > TRACE_TAG_LENMASK) {
+		len = TRACE_TAG_LENMASK;
+	}
+	base = (cpu->protected_mode && cpu->segcache[regcs].valid) ? cpu->segcache[regcs].base : ((uint32_t)cs << 4);
+	for (i = 0; i < len; i++) {
+		*p++ = cpu_read(cpu, base + (uint16_t)(ip + i));
+	}
+	rec[0] |= len;
+
+	memcpy(regs, cpu->regs.wordregs, 16);
+	regs[TRACE_REG_FLAGS] = makeflagsword(cpu);
+	regs[TRACE_REG_ES] = cpu->segregs[reges];
+	regs[TRACE_REG_SS] = cpu->segregs[regss];
+	regs[TRACE_REG_DS] = cpu->segregs[regds];
+	for (i = 0; i < TRACE_REGS; i++) {
+		if ((regs[i] != trace_regs[i]) || trace_full) {
+			mask |= 1 << i;
+		}
+	}
+	if (mask) {
+		rec[0] |= TRACE_TAG_REGS;
+		trace_put16(p, mask);
+		p += 2;
+		for (i = 0; i < TRACE_REGS; i++) {
+			if (mask & (1 << i)) {
+				trace_put16(p, regs[i]);
+				p += 2;
+				trace_regs[i] = regs[i];
+			}
+		}
+	}
+
+	trace_full = 0;
+	trace_cur->len += (uint32_t)(p - rec);
+	trace_records++;
+}
+
+int trace_init(char* filename) {
+#ifndef _WIN32
+	pthread_t thread;
+#endif
+
+	trace_chunks = (TRACE_CHUNK_t*)malloc(sizeof(TRACE_CHUNK_t) * TRACE_CHUNKS);
+	if (trace_chunks == NULL) {
+		debug_log(DEBUG_ERROR, "[TRACE] Unable to allocate trace buffers\r\n");
+		return -1;
+	}
+	trace_file = fopen(filename, "wb");
+	if (trace_file == NULL) {
+		debug_log(DEBUG_ERROR, "[TRACE] Unable to create %s\r\n", filename);
+		free(trace_chunks);
+		trace_chunks = NULL;
+		return -1;
+	}
+	fwrite(TRACE_MAGIC, 1, 8, trace_file);
+	trace_bytes = 8;
+
+	SDL_AtomicSet(&trace_submitted, 0);
+	SDL_AtomicSet(&trace_written, 0);
+	trace_cur = &trace_chunks[0];
+	trace_cur->len = 0;
+	trace_full = 1;
+	trace_quit = 0;
+#ifdef _WIN32
+	if (_beginthread(trace_writer, 0, NULL) == (uintptr_t)-1) {
+#else
+	if (pthread_create(&thread, NULL, trace_writer, NULL)) {
+#endif
+		debug_log(DEBUG_ERROR, "[TRACE] Unable to start the writer thread\r\n");
+		fclose(trace_file);
+		trace_file = NULL;
+		return -1;
+	}
+#ifndef _WIN32
+	pthread_detach(thread);
+#endif
+
+	trace_enabled = 1;
+	debug_log(DEBUG_INFO, "[TRACE] Tracing every instruction to %s\r\n", filename);
+	return 0;
+}
+
+//Writes out what's left, once the CPU has stopped
+void trace_stop() {
+	if (trace_file == NULL) {
+		return;
+	}
+	trace_enabled = 0;
+	trace_submit();
+	trace_quit = 1;
+	while (SDL_AtomicGet(&trace_written) != SDL_AtomicGet(&trace_submitted)) {
+		utility_sleep(1);
+	}
+	fclose(trace_file);
+	trace_file = NULL;
+	debug_log(DEBUG_INFO, "[TRACE] %llu instructions, %llu bytes written\r\n", (unsigned long long)trace_records, (unsigned long long)trace_bytes);
+}
+
+int trace_dump(char* filename) {
+	static const char* names[TRACE_REGS] = { "AX", "CX", "DX", "BX", "SP", "BP", "SI", "DI", "FL", "ES", "SS", "DS" };
+	static const uint8_t order[TRACE_REGS] = { 0, 3, 1, 2, 6, 7, 5, 4, 11, 9, 10, 8 }; //AX BX CX DX SI DI BP SP DS ES SS FL
+	static uint8_t packed[TRACE_CHUNK], data[TRACE_CHUNK + TRACE_MAXRECORD]; //a corrupt last record can't run off the end
+	uint16_t regs[TRACE_REGS], cs = 0, ip, mask;
+	uint32_t len, plen, pos, i, n;
+	uint64_t count = 0;
+	uint8_t hdr[8], tag;
+	char line[160];
+	int lpos;
+	FILE* file;
+
+	file = fopen(filename, "rb");
+	if (file == NULL) {
+		debug_log(DEBUG_ERROR, "[TRACE] Unable to open %s\r\n", filename);
+		return -1;
+	}
+	if ((fread(hdr, 1, 8, file) != 8) || memcmp(hdr, TRACE_MAGIC, 8)) {
+		debug_log(DEBUG_ERROR, "[TRACE] %s isn't a trace file\r\n", filename);
+		fclose(file);
+		return -1;
+	}
+	memset(regs, 0, sizeof(regs));
+
+	while (fread(hdr, 1, 8, file) == 8) {
+		len = trace_get32(hdr);
+		plen = trace_get32(hdr + 4);
+		if ((len > TRACE_CHUNK) || (plen > len) || (fread(packed, 1, plen, file) != plen) ||
+			((plen < len) && utility_unpack(packed, plen, data, len))) {
+			debug_log(DEBUG_ERROR, "[TRACE] %s is corrupt after %llu instructions\r\n", filename, (unsigned long long)count);
+			fclose(file);
+			return -1;
+		}
+		if (plen == len) {
+			memcpy(data, packed, len);
+		}
+
+		for (pos = 0; pos < len; ) {
+			tag = data[pos];
+			ip = trace_get16(data + pos + 1);
+			pos += 3;
+			if (tag & TRACE_TAG_CS) {
+				cs = trace_get16(data + pos);
+				pos += 2;
+			}
+			lpos = sprintf(line, "%04X:%04X %c ", cs, ip, (tag & TRACE_TAG_PMODE) ? 'P' : ' ');
+			n = tag & TRACE_TAG_LENMASK;
+			for (i = 0; i < TRACE_TAG_LENMASK; i++) {
+				lpos += (i < n) ? sprintf(line + lpos, "%02X ", data[pos + i]) : sprintf(line + lpos, "   ");
+			}
+			pos += n;
+			if (tag & TRACE_TAG_REGS) {
+				mask = trace_get16(data + pos);
+				pos += 2;
+				for (i = 0; i < TRACE_REGS; i++) {
+					if (mask & (1 << i)) {
+						regs[i] = trace_get16(data + pos);
+						pos += 2;
+					}
+				}
+			}
+			for (i = 0; i < TRACE_REGS; i++) {
+				lpos += sprintf(line + lpos, " %s=%04X", names[order[i]], regs[order[i]]);
+			}
+			printf("%s\n", line);
+			count++;
+		}
+	}
+
+	fclose(file);
+	debug_log(DEBUG_INFO, "[TRACE] %llu instructions\r\n", (unsigned long long)count);
+	return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include "cpu/cpu.h"
+
+#define TRACE_MAGIC			"XTTRACE1"
+#define TRACE_CHUNK			65536 //records are handed to the writer thread, packed and written in blocks of this size
+#define TRACE_CHUNKS		32 //blocks the CPU can fill before it has to wait for the writer thread
+#define TRACE_MAXRECORD		48
+#define TRACE_LOOKAHEAD		3 //code bytes kept after the opcode when the instruction length isn't known
+#define TRACE_WRITEMS		5 //writer thread sleep when there's nothing to write
+
+#define TRACE_TAG_LENMASK	0x07 //code bytes in the record
+#define TRACE_TAG_CS		0x08 //new CS follows the IP
+#define TRACE_TAG_REGS		0x10 //register mask and the registers that changed follow the code bytes
+#define TRACE_TAG_PMODE		0x20
+
+//register mask bits, in the order the values follow it
+#define TRACE_REG_FLAGS		8 //bits 0-7 are AX, CX, DX, BX, SP, BP, SI, DI
+#define TRACE_REG_ES		9
+#define TRACE_REG_SS		10
+#define TRACE_REG_DS		11
+#define TRACE_REGS			12
+
+typedef struct {
+	uint32_t len;
+	uint8_t data[TRACE_CHUNK];
+} TRACE_CHUNK_t;
+
+extern uint8_t trace_enabled;
+
+void trace_record(CPU_t* cpu, uint16_t ip, uint8_t len);
+
+//called once per instruction from cpu_exec, len is 0 when the instruction's length isn't known yet
+#define trace_tick(cpu, ip, len) if (trace_enabled) trace_record(cpu, ip, len)
+
+int trace_init(char* filename);
+void trace_stop();
+int trace_dump(char* filename);
+
+#endif
@@ -20,15 +20,22 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef _WIN32
 #include <Windows.h>
+#include <io.h>
 #else
 #include <time.h>
 #include <errno.h>
+#include <sys/mman.h>
 #endif
 #include "config.h"
 #include "memory.h"
 #include "debuglog.h"
+#include "utility.h"
+
+static UTILITY_ROM_t utility_roms[UTILITY_MAXROMS];
+static int utility_romcount = 0;
 
 int utility_loadFile(uint8_t* dst, size_t len, char* srcfile) {
 	FILE* file;
@@ -50,16 +57,333 @@ int utility_loadFile(uint8_t* dst, size_t len, char* srcfile) {
 	return 0;
 }
 
+//Maps the first len bytes of file read-only. The pages come straight from the host's file cache, so every emulator process using the same file shares them. NULL if the file is shorter than len or can't be mapped.
+static uint8_t* utility_mapFile(FILE* file, size_t len) {
+	long size;
+	uint8_t* ret = NULL;
+
+	if ((fseek(file, 0, SEEK_END) != 0) || ((size = ftell(file)) < 0) || ((size_t)size < len)) {
+		return NULL;
+	}
+#ifdef _WIN32
+	{
+		HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(_fileno(file)), NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) return NULL;
+		ret = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, len);
+		CloseHandle(mapping); //the view keeps it alive
+	}
+#else
+	{
+		void* map = mmap(NULL, len, PROT_READ, MAP_SHARED, fileno(file), 0);
+		if (map != MAP_FAILED) ret = (uint8_t*)map;
+	}
+#endif
+	return ret;
+}
+
+/*
+	Returns len bytes of the ROM image in srcfile, or NULL on error. Every
+	caller asking for the same file gets the same copy, so a BIOS mapped at
+	both F0000 and FF0000 is read once. The copy is a read-only file mapping
+	where the host allows, falling back to a plain allocation otherwise, so
+	it must only ever be mapped into the guest without a write pointer. It
+	stays loaded until the process exits.
+*/
+uint8_t* utility_loadROM(size_t len, char* srcfile) {
+	FILE* file;
+	uint8_t* data;
+	int i;
+
+	for (i = 0; i < utility_romcount; i++) {
+		if ((strcmp(utility_roms[i].filename, srcfile) == 0) && (utility_roms[i].len >= len)) {
+			return utility_roms[i].data;
+		}
+	}
+
+	file = fopen(srcfile, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+	data = utility_mapFile(file, len);
+	if (data == NULL) {
+		data = (uint8_t*)malloc(len);
+		if ((data != NULL) && ((fseek(file, 0, SEEK_SET) != 0) || (fread(data, 1, len, file) < len))) {
+			free(data);
+			data = NULL;
+		}
+	}
+	fclose(file);
+	if (data == NULL) {
+		return NULL;
+	}
+
+	if (utility_romcount < UTILITY_MAXROMS) {
+		utility_roms[utility_romcount].filename = srcfile;
+		utility_roms[utility_romcount].len = len;
+		utility_roms[utility_romcount].data = data;
+		utility_romcount++;
+	}
+	return data;
+}
+
 void utility_sleep(uint32_t ms) {
 #ifdef _WIN32
 	Sleep((DWORD)ms);
 #else
 	int res;
 	struct timespec ts;
-	ts.tv_sec = 0;
-	ts.tv_nsec = (long)ms * 1000;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000;
+	do {
+		res = nanosleep(&ts, &ts);
+	} while (res && errno == EINTR);
+#endif
+}
+
+#ifdef _WIN32
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+//Sleeps for us microseconds. Sleep only has millisecond resolution on Windows, so a high resolution waitable timer is used there.
+void utility_sleepMicros(uint32_t us) {
+#ifdef _WIN32
+	static __declspec(thread) HANDLE timer = NULL;
+	LARGE_INTEGER due;
+
+	if (timer == NULL) {
+		timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if (timer == NULL) { //before Windows 10 1803
+			timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+		}
+		if (timer == NULL) {
+			Sleep((DWORD)((us + 999) / 1000));
+			return;
+		}
+	}
+	due.QuadPart = -(LONGLONG)us * 10; //relative, in 100 ns units
+	if (SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE)) {
+		WaitForSingleObject(timer, INFINITE);
+	}
+#else
+	int res;
+	struct timespec ts;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (long)(us % 1000000) * 1000;
 	do {
 		res = nanosleep(&ts, &ts);
 	} while (res && errno == EINTR);
 #endif
 }
+
+#ifdef _WIN32
+//Large pages need the "Lock pages in memory" right turned on in the process token
+static int utility_enableLargePages() {
+	HANDLE token;
+	TOKEN_PRIVILEGES tp;
+	BOOL ok;
+
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return -1;
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	ok = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid) && AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL);
+	ok = ok && (GetLastError() == ERROR_SUCCESS); //AdjustTokenPrivileges succeeds without the right, only GetLastError says so
+	CloseHandle(token);
+	return ok ? 0 : -1;
+}
+#endif
+
+/*
+	Returns len bytes of zeroed, page aligned memory that the host only backs
+	once it's touched, or NULL. With -hugepages it's backed by 2 MB pages
+	where the host has them, so hot tables and guest RAM need far fewer TLB
+	entries, and len is rounded up to UTILITY_HUGEPAGE. It tries hugetlbfs
+	pages then transparent huge pages on Linux, and large pages on Windows,
+	which also needs the "Lock pages in memory" right. Otherwise it quietly
+	falls back to normal pages. what names the allocation in the log.
+	The memory is never freed, it lasts as long as the machine.
+*/
+void* utility_allocPages(size_t len, char* what) {
+	void* ret = NULL;
+
+	if (hugepages) {
+		len = (len + UTILITY_HUGEPAGE - 1) & ~(size_t)(UTILITY_HUGEPAGE - 1);
+	}
+#ifdef _WIN32
+	if (hugepages) {
+		static int8_t ok = 0;
+		SIZE_T large = GetLargePageMinimum();
+		if (ok == 0) ok = utility_enableLargePages() ? -1 : 1;
+		if ((ok > 0) && (large > 0)) {
+			ret = VirtualAlloc(NULL, (len + large - 1) & ~(large - 1), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		}
+		if (ret != NULL) {
+			debug_log(DEBUG_DETAIL, "[UTILITY] %s is in large pages\r\n", what);
+			return ret;
+		}
+		debug_log(DEBUG_INFO, "[UTILITY] No large pages for %s, using normal pages\r\n", what);
+	}
+	ret = VirtualAlloc(NULL, len, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	{
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+		void* map;
+		uint8_t* start;
+#ifdef MAP_HUGETLB
+		if (hugepages) {
+			map = mmap(NULL, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+			if (map != MAP_FAILED) {
+				debug_log(DEBUG_DETAIL, "[UTILITY] %s is in hugetlbfs pages\r\n", what);
+				return map;
+			}
+		}
+#endif
+#ifdef MAP_NORESERVE
+		flags |= MAP_NORESERVE;
+#endif
+		if (!hugepages) {
+			map = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+			return (map == MAP_FAILED) ? NULL : map;
+		}
+		//transparent huge pages only back whole aligned 2 MB ranges, so map extra and trim it to alignment
+		map = mmap(NULL, len + UTILITY_HUGEPAGE, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (map == MAP_FAILED) return NULL;
+		start = (uint8_t*)(((uintptr_t)map + UTILITY_HUGEPAGE - 1) & ~(uintptr_t)(UTILITY_HUGEPAGE - 1));
+		if (start > (uint8_t*)map) {
+			munmap(map, start - (uint8_t*)map);
+		}
+		munmap(start + len, ((uint8_t*)map + len + UTILITY_HUGEPAGE) - (start + len));
+		ret = start;
+#ifdef MADV_HUGEPAGE
+		if (madvise(ret, len, MADV_HUGEPAGE) == 0) {
+			debug_log(DEBUG_DETAIL, "[UTILITY] %s is in transparent huge pages\r\n", what);
+			return ret;
+		}
+#endif
+		debug_log(DEBUG_INFO, "[UTILITY] No huge pages for %s, using normal pages\r\n", what);
+	}
+#endif
+	return ret;
+}
+
+//Writes a 0x00RRGGBB framebuffer to dstfile as a binary PPM image, stride is in bytes
+int utility_savePPM(char* dstfile, uint32_t* pixels, uint32_t w, uint32_t h, uint32_t stride) {
+	FILE* file;
+	uint8_t* line;
+	uint32_t x, y;
+
+	line = (uint8_t*)malloc((size_t)w * 3);
+	if (line == NULL) {
+		return -1;
+	}
+	file = fopen(dstfile, "wb");
+	if (file == NULL) {
+		free(line);
+		return -1;
+	}
+	fprintf(file, "P6\n%u %u\n255\n", w, h);
+	for (y = 0; y < h; y++) {
+		uint32_t* src = (uint32_t*)((uint8_t*)pixels + ((size_t)y * stride));
+		for (x = 0; x < w; x++) {
+			line[x * 3] = (uint8_t)(src[x] >> 16);
+			line[x * 3 + 1] = (uint8_t)(src[x] >> 8);
+			line[x * 3 + 2] = (uint8_t)src[x];
+		}
+		fwrite(line, 1, (size_t)w * 3, file);
+	}
+	fclose(file);
+	free(line);
+	return 0;
+}
+
+static uint32_t utility_packHash(const uint8_t* src) {
+	return (((uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16)) * 2654435761U) >> (32 - UTILITY_PACK_HASHBITS);
+}
+
+/*
+	Small LZ coder for snapshot pages and trace chunks. A control byte under
+	0x80 is followed by that many plus one literal bytes. From 0x80 up, the low
+	seven bits plus UTILITY_PACK_MINMATCH are the length of a copy from earlier
+	in the block, at the distance given by the next two bytes (little endian)
+	plus one. Copies may overlap what they produce, which is how runs come out.
+*/
+//len is at most UTILITY_PACK_MAXLEN, dst has room for len bytes. Returns the packed length, or 0 if it wouldn't be any smaller
+uint32_t utility_pack(const uint8_t* src, uint32_t len, uint8_t* dst) {
+	uint32_t head[1 << UTILITY_PACK_HASHBITS]; //last position + 1 seen with each hash, 0 if none
+	uint32_t pos = 0, lit = 0, out = 0, h, cand = 0, n, max, i, dist;
+
+	memset(head, 0, sizeof(head));
+	while (pos <= len) {
+		n = 0;
+		if ((pos + UTILITY_PACK_MINMATCH) <= len) {
+			h = utility_packHash(src + pos);
+			if (head[h] && ((pos - (head[h] - 1)) <= 0x10000)) {
+				cand = head[h] - 1;
+				max = len - pos;
+				if (max > UTILITY_PACK_MAXMATCH) max = UTILITY_PACK_MAXMATCH;
+				while ((n < max) && (src[cand + n] == src[pos + n])) n++;
+				if (n < UTILITY_PACK_MINMATCH) n = 0;
+			}
+			head[h] = pos + 1;
+		}
+		if ((n == 0) && (pos < len)) {
+			pos++;
+			continue;
+		}
+
+		//flush the literals in front of the match, or at the end of the block
+		while (lit < pos) {
+			i = pos - lit;
+			if (i > 0x80) i = 0x80;
+			if ((out + 1 + i) >= len) return 0;
+			dst[out++] = (uint8_t)(i - 1);
+			memcpy(dst + out, src + lit, i);
+			out += i;
+			lit += i;
+		}
+		if (n == 0) break; //end of the block
+
+		if ((out + 3) >= len) return 0;
+		dist = pos - cand - 1;
+		dst[out++] = (uint8_t)(0x80 | (n - UTILITY_PACK_MINMATCH));
+		dst[out++] = (uint8_t)dist;
+		dst[out++] = (uint8_t)(dist >> 8);
+		for (i = 1; (i < n) && ((pos + i + UTILITY_PACK_MINMATCH) <= len); i++) {
+			head[utility_packHash(src + pos + i)] = pos + i + 1;
+		}
+		pos += n;
+		lit = pos;
+	}
+
+	return out;
+}
+
+//Unpacks exactly len bytes, -1 if the data is corrupt
+int utility_unpack(const uint8_t* src, uint32_t packed, uint8_t* dst, uint32_t len) {
+	uint32_t in = 0, out = 0, n, dist;
+	uint8_t t;
+
+	while (in < packed) {
+		t = src[in++];
+		if (t < 0x80) {
+			n = (uint32_t)t + 1;
+			if (((in + n) > packed) || ((out + n) > len)) return -1;
+			memcpy(dst + out, src + in, n);
+			in += n;
+			out += n;
+		}
+		else {
+			n = (uint32_t)(t & 0x7F) + UTILITY_PACK_MINMATCH;
+			if ((in + 2) > packed) return -1;
+			dist = ((uint32_t)src[in] | ((uint32_t)src[in + 1] << 8)) + 1;
+			in += 2;
+			if ((dist > out) || ((out + n) > len)) return -1;
+			for (; n > 0; n--, out++) {
+				dst[out] = dst[out - dist];
+			}
+		}
+	}
+
+	return (out == len) ? 0 : -1;
+}
@@ -2,8 +2,28 @@
 #define _UTILITY_H_
 
 #include <stdint.h>
+#include <stddef.h>
+
+#define UTILITY_MAXROMS		32 //distinct ROM images utility_loadROM keeps track of
+#define UTILITY_PACK_MINMATCH	3
+#define UTILITY_PACK_MAXMATCH	(0x7F + UTILITY_PACK_MINMATCH)
+#define UTILITY_PACK_HASHBITS	12
+#define UTILITY_PACK_MAXLEN		65536 //copy distances are 16 bits
+#define UTILITY_HUGEPAGE		0x200000 //size huge page allocations are rounded up to
+
+typedef struct {
+	char* filename;
+	size_t len;
+	uint8_t* data;
+} UTILITY_ROM_t;
 
 int utility_loadFile(uint8_t* dst, size_t len, char* srcfile);
+uint8_t* utility_loadROM(size_t len, char* srcfile);
+void* utility_allocPages(size_t len, char* what);
 void utility_sleep(uint32_t ms);
+void utility_sleepMicros(uint32_t us);
+int utility_savePPM(char* dstfile, uint32_t* pixels, uint32_t w, uint32_t h, uint32_t stride);
+uint32_t utility_pack(const uint8_t* src, uint32_t len, uint8_t* dst);
+int utility_unpack(const uint8_t* src, uint32_t packed, uint8_t* dst, uint32_t len);
 
 #endif
@@ -1,2 +1,13 @@
 #!/bin/sh
-gcc -g -O0 -o bin/xtulator XTulator/*.c XTulator/chipset/*.c XTulator/cpu/cpu.c XTulator/modules/audio/*.c XTulator/modules/disk/*.c XTulator/modules/input/*.c XTulator/modules/io/*.c XTulator/modules/video/*.c -lm -lpthread `pcap-config --cflags --libs` `sdl2-config --cflags --libs`
+# ./build.sh        debug build, bin/xtulator
+# ./build.sh bench  optimized build with the -bench harness, bin/xtulator-bench
+# ./build.sh cputest  the CPU core and memory map against device stubs, bin/cputest
+SOURCES="XTulator/*.c XTulator/chipset/*.c XTulator/cpu/*.c XTulator/modules/audio/*.c XTulator/modules/disk/*.c XTulator/modules/input/*.c XTulator/modules/io/*.c XTulator/modules/video/*.c"
+LIBS="-lm -lpthread `pcap-config --cflags --libs` `sdl2-config --cflags --libs`"
+if [ "$1" = "cputest" ]; then
+	gcc -O2 -g -o bin/cputest cputest/*.c XTulator/cpu/*.c XTulator/memory.c -lm
+elif [ "$1" = "bench" ]; then
+	gcc -O2 -g -DUSE_BENCH -o bin/xtulator-bench $SOURCES $LIBS
+else
+	gcc -g -O0 -o bin/xtulator $SOURCES $LIBS
+fi
@@ -0,0 +1,540 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	CPU conformance runner, a program of its own (./build.sh cputest or the
+	cputest project in the solution) that links the CPU core and memory.c and
+	nothing else from the emulator.
+
+	Runs single-step test vectors in the JSON format of the community 8086/286
+	suites (one file per opcode, decompressed):
+
+		[ { "name": "...", "bytes": [...],
+			"initial": { "regs": { "ax": n, ... "ip": n, "flags": n }, "ram": [[addr, value], ...] },
+			"final": { "regs": { only the ones that changed }, "ram": [[addr, value], ...] } }, ... ]
+
+	There's no machine behind it. stub.c stands in for the devices and the
+	rest the core calls out to: the first megabyte is mapped as plain RAM,
+	there are no devices behind the ports, and the CPU runs real mode with A20
+	off, aliased by memory.c the way it is in the emulator. Memory is only
+	touched through cpu_write/cpu_read so the decode cache stays coherent,
+	which means the cached and block cores can be checked against the
+	vectors too.
+
+		cputest [-core interp|cached|block] [-flags <mask>] <file> [<file> ...]
+
+	Each test is one instruction. One with a REP prefix is stepped until IP
+	moves off it, since cpu_exec runs a REP iteration at a time. Failures are
+	logged with the registers, flags and bytes that differ. The time spent in
+	cpu_exec is summed per opcode (0F xx separately) and shown as nanoseconds
+	per step, which includes reading the performance counter around each one.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+#include "../XTulator/debuglog.h"
+#include "../XTulator/memory.h"
+#include "../XTulator/cpu/cpu.h"
+#include "cputest.h"
+#include "stub.h"
+
+const char* cputest_regNames[CPUTEST_REGS] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "es", "cs", "ss", "ds", "ip", "flags" };
+
+char* cputest_pos;
+char* cputest_end;
+uint8_t cputest_error;
+
+CPUTEST_STATE_t cputest_initial, cputest_final;
+CPUTEST_GROUP_t cputest_groups[512]; //opcode, then 256 + 0F opcode
+char cputest_name[256];
+uint8_t cputest_bytes[16];
+uint32_t cputest_byteCount;
+
+CPU_t cputest_cpu;
+
+//The emulator times things with SDL's performance counter, this goes straight to the host's
+static uint64_t cputest_ticks() {
+#ifdef _WIN32
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return (uint64_t)count.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static double cputest_frequency() {
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return (double)freq.QuadPart;
+#else
+	return 1000000000.0;
+#endif
+}
+
+/*
+	Just enough of a JSON reader for the test files. It walks the text in
+	place and anything it doesn't need is skipped.
+*/
+static void cputest_ws() {
+	while ((cputest_pos < cputest_end) && ((*cputest_pos == ' ') || (*cputest_pos == '\t') || (*cputest_pos == '\r') || (*cputest_pos == '\n'))) {
+		cputest_pos++;
+	}
+}
+
+static int cputest_expect(char c) {
+	cputest_ws();
+	if ((cputest_pos >= cputest_end) || (*cputest_pos != c)) {
+		cputest_error = 1;
+		return -1;
+	}
+	cputest_pos++;
+	return 0;
+}
+
+//Consumes c if it's next, returns 1 if it was
+static int cputest_accept(char c) {
+	cputest_ws();
+	if ((cputest_pos < cputest_end) && (*cputest_pos == c)) {
+		cputest_pos++;
+		return 1;
+	}
+	return 0;
+}
+
+static void cputest_string(char* dst, uint32_t size) {
+	uint32_t len = 0;
+
+	if (cputest_expect('"')) return;
+	while ((cputest_pos < cputest_end) && (*cputest_pos != '"')) {
+		if ((*cputest_pos == '\\') && ((cputest_pos + 1) < cputest_end)) {
+			cputest_pos++;
+		}
+		if ((dst != NULL) && ((len + 1) < size)) {
+			dst[len++] = *cputest_pos;
+		}
+		cputest_pos++;
+	}
+	if (dst != NULL) dst[len] = 0;
+	cputest_expect('"');
+}
+
+static int64_t cputest_number() {
+	int64_t val = 0;
+	uint8_t neg = 0;
+
+	cputest_ws();
+	if ((cputest_pos < cputest_end) && (*cputest_pos == '-')) {
+		neg = 1;
+		cputest_pos++;
+	}
+	if ((cputest_pos >= cputest_end) || (*cputest_pos < '0') || (*cputest_pos > '9')) {
+		cputest_error = 1;
+		return 0;
+	}
+	while ((cputest_pos < cputest_end) && (*cputest_pos >= '0') && (*cputest_pos <= '9')) {
+		val = val * 10 + (*cputest_pos++ - '0');
+	}
+	return neg ? -val : val;
+}
+
+static void cputest_skip() {
+	uint32_t depth = 0;
+
+	cputest_ws();
+	if (cputest_pos >= cputest_end) {
+		cputest_error = 1;
+		return;
+	}
+	if (*cputest_pos == '"') {
+		cputest_string(NULL, 0);
+		return;
+	}
+	if ((*cputest_pos != '{') && (*cputest_pos != '[')) { //number, true, false, null
+		while ((cputest_pos < cputest_end) && (*cputest_pos != ',') && (*cputest_pos != '}') && (*cputest_pos != ']')) {
+			cputest_pos++;
+		}
+		return;
+	}
+	do {
+		if (*cputest_pos == '"') {
+			cputest_string(NULL, 0);
+			continue;
+		}
+		if ((*cputest_pos == '{') || (*cputest_pos == '[')) depth++;
+		else if ((*cputest_pos == '}') || (*cputest_pos == ']')) depth--;
+		cputest_pos++;
+	} while ((depth > 0) && (cputest_pos < cputest_end) && !cputest_error);
+}
+
+static void cputest_regs(CPUTEST_STATE_t* state) {
+	char key[16];
+	uint32_t i;
+
+	if (cputest_expect('{')) return;
+	if (cputest_accept('}')) return;
+	do {
+		cputest_string(key, sizeof(key));
+		cputest_expect(':');
+		for (i = 0; i < CPUTEST_REGS; i++) {
+			if (!strcmp(key, cputest_regNames[i])) break;
+		}
+		if (i < CPUTEST_REGS) {
+			state->regs[i] = (uint16_t)cputest_number();
+			state->have[i] = 1;
+		}
+		else {
+			cputest_skip();
+		}
+	} while (cputest_accept(',') && !cputest_error);
+	cputest_expect('}');
+}
+
+static void cputest_ram(CPUTEST_STATE_t* state) {
+	if (cputest_expect('[')) return;
+	if (cputest_accept(']')) return;
+	do {
+		uint32_t addr, value;
+		cputest_expect('[');
+		addr = (uint32_t)cputest_number();
+		cputest_expect(',');
+		value = (uint32_t)cputest_number();
+		cputest_expect(']');
+		if (state->ramcount >= CPUTEST_MAXRAM) {
+			cputest_error = 1;
+			return;
+		}
+		state->ram[state->ramcount][0] = addr & 0xFFFFF;
+		state->ram[state->ramcount][1] = value;
+		state->ramcount++;
+	} while (cputest_accept(',') && !cputest_error);
+	cputest_expect(']');
+}
+
+static void cputest_state(CPUTEST_STATE_t* state) {
+	char key[16];
+
+	memset(state->have, 0, sizeof(state->have));
+	state->ramcount = 0;
+	if (cputest_expect('{')) return;
+	if (cputest_accept('}')) return;
+	do {
+		cputest_string(key, sizeof(key));
+		cputest_expect(':');
+		if (!strcmp(key, "regs")) cputest_regs(state);
+		else if (!strcmp(key, "ram")) cputest_ram(state);
+		else cputest_skip();
+	} while (cputest_accept(',') && !cputest_error);
+	cputest_expect('}');
+}
+
+//Reads the next test object into cputest_name/bytes/initial/final
+static void cputest_parseTest() {
+	char key[16];
+
+	cputest_name[0] = 0;
+	cputest_byteCount = 0;
+	cputest_initial.ramcount = 0;
+	cputest_final.ramcount = 0;
+	if (cputest_expect('{')) return;
+	if (cputest_accept('}')) return;
+	do {
+		cputest_string(key, sizeof(key));
+		cputest_expect(':');
+		if (!strcmp(key, "name")) {
+			cputest_string(cputest_name, sizeof(cputest_name));
+		}
+		else if (!strcmp(key, "bytes")) {
+			cputest_expect('[');
+			if (!cputest_accept(']')) {
+				do {
+					uint8_t val = (uint8_t)cputest_number();
+					if (cputest_byteCount < sizeof(cputest_bytes)) cputest_bytes[cputest_byteCount++] = val;
+				} while (cputest_accept(',') && !cputest_error);
+				cputest_expect(']');
+			}
+		}
+		else if (!strcmp(key, "initial")) cputest_state(&cputest_initial);
+		else if (!strcmp(key, "final")) cputest_state(&cputest_final);
+		else cputest_skip();
+	} while (cputest_accept(',') && !cputest_error);
+	cputest_expect('}');
+}
+
+//Index into cputest_groups for the test's instruction, and whether it's REP prefixed
+static uint32_t cputest_group(uint8_t* rep) {
+	uint32_t i;
+
+	*rep = 0;
+	for (i = 0; i < cputest_byteCount; i++) {
+		switch (cputest_bytes[i]) {
+		case 0x26: case 0x2E: case 0x36: case 0x3E: case 0xF0:
+			continue;
+		case 0xF2: case 0xF3:
+			*rep = 1;
+			continue;
+		case 0x0F:
+			return ((i + 1) < cputest_byteCount) ? 256 + cputest_bytes[i + 1] : 0x0F;
+		}
+		return cputest_bytes[i];
+	}
+	return 0;
+}
+
+static void cputest_load(CPU_t* cpu, CPUTEST_STATE_t* state) {
+	uint32_t i;
+
+	for (i = 0; i < 8; i++) {
+		cpu->regs.wordregs[i] = state->regs[i];
+	}
+	for (i = 0; i < 4; i++) {
+		cpu->segregs[i] = state->regs[8 + i];
+	}
+	cpu->ip = state->regs[12];
+	decodeflagsword(cpu, state->regs[13]);
+	for (i = 0; i < state->ramcount; i++) {
+		cpu_write(cpu, state->ram[i][0], (uint8_t)state->ram[i][1]);
+	}
+	cpu->hltstate = 0;
+	cpu->trap_toggle = 0;
+	cpu->code_host = NULL;
+}
+
+//Returns 1 if the CPU ended up where the final state says, logging the differences if report is set
+static int cputest_check(CPU_t* cpu, uint16_t flagmask, uint8_t report) {
+	uint16_t got[CPUTEST_REGS], want, mask;
+	uint32_t i;
+	int ok = 1;
+
+	for (i = 0; i < 8; i++) got[i] = cpu->regs.wordregs[i];
+	for (i = 0; i < 4; i++) got[8 + i] = cpu->segregs[i];
+	got[12] = cpu->ip;
+	got[13] = makeflagsword(cpu);
+
+	for (i = 0; i < CPUTEST_REGS; i++) {
+		want = cputest_final.have[i] ? cputest_final.regs[i] : cputest_initial.regs[i];
+		mask = (i == 13) ? flagmask : 0xFFFF;
+		if ((got[i] & mask) == (want & mask)) continue;
+		if (report) {
+			debug_log(DEBUG_INFO, "[CPUTEST]   %-5s expected %04X, got %04X\r\n", cputest_regNames[i], want & mask, got[i] & mask);
+		}
+		ok = 0;
+	}
+	for (i = 0; i < cputest_final.ramcount; i++) {
+		uint8_t value = cpu_read(cpu, cputest_final.ram[i][0]);
+		if (value == (uint8_t)cputest_final.ram[i][1]) continue;
+		if (report) {
+			debug_log(DEBUG_INFO, "[CPUTEST]   [%05X] expected %02X, got %02X\r\n", cputest_final.ram[i][0], (uint8_t)cputest_final.ram[i][1], value);
+		}
+		ok = 0;
+	}
+	return ok;
+}
+
+static void cputest_clear(CPU_t* cpu) {
+	uint32_t i;
+	for (i = 0; i < cputest_initial.ramcount; i++) cpu_write(cpu, cputest_initial.ram[i][0], 0);
+	for (i = 0; i < cputest_final.ramcount; i++) cpu_write(cpu, cputest_final.ram[i][0], 0);
+}
+
+static uint8_t* cputest_readFile(char* filename, uint32_t* size) {
+	FILE* file;
+	uint8_t* data;
+	long len;
+
+	file = fopen(filename, "rb");
+	if (file == NULL) return NULL;
+	fseek(file, 0L, SEEK_END);
+	len = ftell(file);
+	fseek(file, 0L, SEEK_SET);
+	data = (uint8_t*)malloc(len + 1);
+	if ((data == NULL) || (fread(data, 1, len, file) < (size_t)len)) {
+		if (data != NULL) free(data);
+		fclose(file);
+		return NULL;
+	}
+	fclose(file);
+	*size = (uint32_t)len;
+	return data;
+}
+
+//Returns 0 if every test passed, 1 if any failed and -1 if the file couldn't be used
+int cputest_run(CPU_t* cpu, char* filename, uint16_t flagmask) {
+	uint8_t* data;
+	uint32_t size, group, steps, i;
+	uint64_t tests = 0, failed = 0, start;
+	uint8_t rep;
+	double freq;
+
+	data = cputest_readFile(filename, &size);
+	if (data == NULL) {
+		debug_log(DEBUG_ERROR, "[CPUTEST] Unable to read %s\r\n", filename);
+		return -1;
+	}
+	if ((size >= 2) && (data[0] == 0x1F) && (data[1] == 0x8B)) {
+		debug_log(DEBUG_ERROR, "[CPUTEST] %s is gzipped, decompress it first\r\n", filename);
+		free(data);
+		return -1;
+	}
+
+	memset(main_ram, 0, CPUTEST_RAMSIZE);
+	decode_flush(); //the RAM changed behind the decode cache, as after a snapshot load
+	cpu_reset(cpu);
+	memory_setA20(0);
+	memset(cputest_groups, 0, sizeof(cputest_groups));
+	freq = cputest_frequency();
+
+	cputest_pos = (char*)data;
+	cputest_end = (char*)data + size;
+	cputest_error = 0;
+	cputest_expect('[');
+	if (!cputest_error && !cputest_accept(']')) {
+		do {
+			cputest_parseTest();
+			if (cputest_error) break;
+			tests++;
+			group = cputest_group(&rep);
+
+			cputest_load(cpu, &cputest_initial);
+			steps = 0;
+			start = cputest_ticks();
+			do {
+				cpu_exec(cpu, 1);
+				steps++;
+			} while (rep && (cpu->ip == cputest_initial.regs[12]) && (cpu->segregs[regcs] == cputest_initial.regs[9]) && (steps < CPUTEST_MAXREP));
+			cputest_groups[group].ticks += cputest_ticks() - start;
+			cputest_groups[group].steps += steps;
+			cputest_groups[group].tests++;
+
+			if (!cputest_check(cpu, flagmask, 0)) {
+				failed++;
+				cputest_groups[group].failed++;
+				if (failed <= CPUTEST_MAXREPORT) {
+					debug_log(DEBUG_INFO, "[CPUTEST] FAIL #%llu: %s\r\n", (unsigned long long)(tests - 1), cputest_name);
+					cputest_check(cpu, flagmask, 1);
+				}
+			}
+			cputest_clear(cpu);
+		} while (cputest_accept(',') && !cputest_error);
+	}
+	free(data);
+	if (cputest_error) {
+		debug_log(DEBUG_ERROR, "[CPUTEST] Parse error in %s after %llu tests\r\n", filename, (unsigned long long)tests);
+		return -1;
+	}
+
+	debug_log(DEBUG_INFO, "[CPUTEST] Opcode      tests   failed   ns/step\r\n");
+	for (i = 0; i < 512; i++) {
+		CPUTEST_GROUP_t* g = &cputest_groups[i];
+		if (g->tests == 0) continue;
+		debug_log(DEBUG_INFO, "[CPUTEST]   %s%02X  %10llu %8llu %9.01f\r\n", (i >= 256) ? "0F " : "   ", i & 0xFF,
+			(unsigned long long)g->tests, (unsigned long long)g->failed, (double)g->ticks * 1000000000.0 / freq / (double)g->steps);
+	}
+	debug_log(DEBUG_INFO, "[CPUTEST] %s: %llu of %llu tests passed (flags mask %04X)\r\n", filename,
+		(unsigned long long)(tests - failed), (unsigned long long)tests, flagmask);
+
+	return (failed > 0) ? 1 : 0;
+}
+
+static void cputest_help() {
+	printf("Usage: cputest [options] <file> [<file> ...]\r\n\r\n");
+	printf("Runs the single-step CPU test vectors in each JSON <file> and lists failures and time per opcode.\r\n\r\n");
+	printf("Options:\r\n");
+	printf("  -core <option>         CPU core to check. Valid options: interp, cached, block\r\n");
+	printf("                         (Default is interp)\r\n");
+	printf("  -flags <mask>          Hex mask of the flags compared, to leave out undefined ones.\r\n");
+	printf("                         (Default is 0FD5, every defined flag)\r\n");
+	printf("  -h                     Show this help screen.\r\n");
+}
+
+int main(int argc, char* argv[]) {
+	uint16_t flagmask = 0x0FD5;
+	int i, ret = 0, files = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-h")) {
+			cputest_help();
+			return 0;
+		}
+		else if (!strcmp(argv[i], "-core")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -core. Use -h for help.\r\n");
+				return 2;
+			}
+			i++;
+			if (!strcmp(argv[i], "interp")) cputest_cpu.core = CPU_CORE_INTERP;
+			else if (!strcmp(argv[i], "cached")) cputest_cpu.core = CPU_CORE_CACHED;
+			else if (!strcmp(argv[i], "block")) cputest_cpu.core = CPU_CORE_BLOCK;
+			else {
+				printf("%s is an invalid CPU core option\r\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (!strcmp(argv[i], "-flags")) {
+			if ((i + 1) == argc) {
+				printf("Parameter required for -flags. Use -h for help.\r\n");
+				return 2;
+			}
+			flagmask = (uint16_t)strtol(argv[++i], NULL, 16);
+		}
+		else if (argv[i][0] == '-') {
+			printf("%s is an invalid option. Use -h for help.\r\n", argv[i]);
+			return 2;
+		}
+	}
+
+	if (stub_init()) {
+		return 2;
+	}
+
+	//every file gets a fresh CPU and RAM, a failure in one doesn't stop the rest
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-') {
+			i++;
+			continue;
+		}
+		files++;
+		switch (cputest_run(&cputest_cpu, argv[i], flagmask)) {
+		case 0:
+			break;
+		case 1:
+			if (ret == 0) ret = 1;
+			break;
+		default:
+			ret = 2;
+			break;
+		}
+	}
+
+	if (files == 0) {
+		cputest_help();
+		return 2;
+	}
+	return ret;
+}
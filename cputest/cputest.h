@@ -0,0 +1,29 @@
+#ifndef _CPUTEST_H_
+#define _CPUTEST_H_
+
+#include <stdint.h>
+#include "../XTulator/cpu/cpu.h"
+
+#define CPUTEST_REGS		14 //the eight word registers, ES CS SS DS, IP, flags
+#define CPUTEST_MAXRAM		4096 //bytes a test's initial or final state may list
+#define CPUTEST_MAXREPORT	20 //failures shown in detail, the rest are only counted
+#define CPUTEST_MAXREP		65536 //steps a REP prefixed test may take to finish
+#define CPUTEST_RAMSIZE		0x100000 //the flat RAM the stub maps, real mode only reaches the first megabyte
+
+typedef struct {
+	uint16_t regs[CPUTEST_REGS];
+	uint8_t have[CPUTEST_REGS]; //final states only list the registers that changed
+	uint32_t ram[CPUTEST_MAXRAM][2]; //address, value
+	uint32_t ramcount;
+} CPUTEST_STATE_t;
+
+typedef struct {
+	uint64_t tests;
+	uint64_t failed;
+	uint64_t steps;
+	uint64_t ticks;
+} CPUTEST_GROUP_t;
+
+int cputest_run(CPU_t* cpu, char* filename, uint16_t flagmask);
+
+#endif
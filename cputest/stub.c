@@ -0,0 +1,114 @@
+/*
+  XTulator: A portable, open-source 80186 PC emulator.
+  Copyright (C)2020 Mike Chambers
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+	Everything the CPU core and memory.c call out to, for the conformance
+	runner: the port bus, the PIC, the A20 line's i8042 variable, the
+	profiler, sampler and tracer, and the log thread, with the least that
+	satisfies them. memory.c itself is linked in, so the runner goes through
+	the same page map, A20 aliasing and block transfers the emulator does.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "../XTulator/debuglog.h"
+#include "../XTulator/memory.h"
+#include "../XTulator/profile.h"
+#include "../XTulator/sampler.h"
+#include "../XTulator/trace.h"
+#include "../XTulator/utility.h"
+#include "../XTulator/chipset/i8042.h"
+#include "../XTulator/chipset/i8259.h"
+#include "../XTulator/cpu/cpu.h"
+#include "cputest.h"
+#include "stub.h"
+
+volatile uint8_t a20_enabled = 0;
+uint8_t profile_enabled = 0;
+uint64_t profile_ops[256], profile_ops0F[256];
+uint64_t profile_mmioRead[MEMORY_PAGES], profile_mmioWrite[MEMORY_PAGES];
+uint8_t sampler_enabled = 0;
+uint32_t sampler_countdown = 0;
+uint8_t trace_enabled = 0;
+uint8_t debug_level = DEBUG_INFO;
+uint32_t debug_mask = 0;
+
+//No devices on the bus, reads float high and writes go nowhere
+void port_write(CPU_t* cpu, uint16_t portnum, uint8_t value) {
+}
+
+void port_writew(CPU_t* cpu, uint16_t portnum, uint16_t value) {
+}
+
+uint8_t port_read(CPU_t* cpu, uint16_t portnum) {
+	return 0xFF;
+}
+
+uint16_t port_readw(CPU_t* cpu, uint16_t portnum) {
+	return 0xFFFF;
+}
+
+//Moving nothing makes the core fall back to port_read/port_write per element
+uint32_t port_readBlock(CPU_t* cpu, uint16_t portnum, uint8_t* dst, uint32_t count, uint8_t size) {
+	return 0;
+}
+
+uint32_t port_writeBlock(CPU_t* cpu, uint16_t portnum, const uint8_t* src, uint32_t count, uint8_t size) {
+	return 0;
+}
+
+//Only reached through cpu_interruptCheck, which the runner never calls
+uint8_t i8259_nextintr(I8259_t* i8259) {
+	return 0;
+}
+
+void sampler_hit(uint16_t cs, uint16_t ip, uint8_t pmode) {
+}
+
+void trace_record(CPU_t* cpu, uint16_t ip, uint8_t len) {
+}
+
+//Without -hugepages this is what the emulator's version comes down to, zeroed pages
+void* utility_allocPages(size_t len, char* what) {
+	return calloc(1, len);
+}
+
+//Straight to stdout, without the log thread
+void debug_log(uint8_t level, char* format, ...) {
+	va_list args;
+
+	if (level > debug_level) {
+		return;
+	}
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+//The first megabyte as plain RAM, the rest of the map left empty
+int stub_init() {
+	if (memory_init()) {
+		debug_log(DEBUG_ERROR, "[STUB] Unable to allocate guest RAM\r\n");
+		return -1;
+	}
+	memory_mapRegister(0x00000, CPUTEST_RAMSIZE, main_ram, main_ram);
+	return 0;
+}
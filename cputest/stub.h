@@ -0,0 +1,6 @@
+#ifndef _STUB_H_
+#define _STUB_H_
+
+int stub_init();
+
+#endif